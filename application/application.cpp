@@ -30,6 +30,7 @@
 #endif
 #ifdef HAVE_GRANITE_AUDIO
 #include "audio_mixer.hpp"
+#include "audio_prefetch.hpp"
 #endif
 
 using namespace Vulkan;
@@ -151,6 +152,7 @@ bool Application::poll()
 
 		// Recycle dead streams.
 		am->dispose_dead_streams();
+		am->get_stream_prefetcher().iterate(*GRANITE_THREAD_GROUP());
 	}
 #endif
 
@@ -21,6 +21,7 @@
  */
 
 #include "input.hpp"
+#include "input_capture.hpp"
 #include "event.hpp"
 #include "muglm/muglm_impl.hpp"
 #include "logging.hpp"
@@ -76,6 +77,9 @@ const char *joypad_axis_to_tag(JoypadAxis axis)
 
 void InputTracker::orientation_event(quat rot)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::Orientation, 0, 0, 0, { rot.x, rot.y, rot.z, rot.w } });
+
 	OrientationEvent event(rot);
 	if (handler)
 		handler->dispatch(event);
@@ -83,6 +87,9 @@ void InputTracker::orientation_event(quat rot)
 
 void InputTracker::on_touch_down(unsigned id, float x, float y)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::TouchDown, id, 0, 0, { x, y } });
+
 	if (touch.active_pointers >= TouchCount)
 	{
 		LOGE("Touch pointer overflow!\n");
@@ -106,6 +113,9 @@ void InputTracker::on_touch_down(unsigned id, float x, float y)
 
 void InputTracker::dispatch_touch_gesture()
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::TouchGesture, 0, 0, 0, {} });
+
 	TouchGestureEvent event(touch);
 	if (handler)
 		handler->dispatch(event);
@@ -113,6 +123,9 @@ void InputTracker::dispatch_touch_gesture()
 
 void InputTracker::on_touch_move(unsigned id, float x, float y)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::TouchMove, id, 0, 0, { x, y } });
+
 	auto &pointers = touch.pointers;
 	auto itr = std::find_if(std::begin(pointers), std::begin(pointers) + touch.active_pointers, [id](const TouchState::Pointer &pointer) {
 		return pointer.id == id;
@@ -130,6 +143,9 @@ void InputTracker::on_touch_move(unsigned id, float x, float y)
 
 void InputTracker::on_touch_up(unsigned id, float x, float y)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::TouchUp, id, 0, 0, { x, y } });
+
 	auto &pointers = touch.pointers;
 	auto itr = std::find_if(std::begin(pointers), std::begin(pointers) + touch.active_pointers, [id](const TouchState::Pointer &pointer) {
 		return pointer.id == id;
@@ -154,6 +170,9 @@ void InputTracker::on_touch_up(unsigned id, float x, float y)
 
 void InputTracker::joypad_key_state(unsigned index, JoypadKey key, JoypadKeyState state)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::JoypadKey, index, uint32_t(key), uint32_t(state), {} });
+
 	if (index >= Joypads)
 		return;
 
@@ -203,6 +222,9 @@ void JoypadState::snap_deadzone(float deadzone)
 
 void InputTracker::joyaxis_state(unsigned index, JoypadAxis axis, float value)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::JoypadAxis, index, uint32_t(axis), 0, { value } });
+
 	if (index >= Joypads)
 		return;
 
@@ -223,6 +245,9 @@ void InputTracker::joyaxis_state(unsigned index, JoypadAxis axis, float value)
 
 void InputTracker::key_event(Key key, KeyState state)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::Key, 0, uint32_t(key), uint32_t(state), {} });
+
 	if (state == KeyState::Released)
 		key_state &= ~(1ull << ecast(key));
 	else if (state == KeyState::Pressed)
@@ -240,6 +265,9 @@ void InputTracker::mouse_button_event(Granite::MouseButton button, bool pressed)
 
 void InputTracker::mouse_button_event(MouseButton button, double x, double y, bool pressed)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::MouseButton, 0, uint32_t(button), uint32_t(pressed), { x, y } });
+
 	if (pressed)
 		mouse_button_state |= 1ull << ecast(button);
 	else
@@ -258,6 +286,9 @@ void InputTracker::mouse_button_event(MouseButton button, double x, double y, bo
 
 void InputTracker::mouse_move_event_relative(double x, double y)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::MouseMoveRelative, 0, 0, 0, { x, y } });
+
 	x *= mouse_speed_x;
 	y *= mouse_speed_y;
 	if (mouse_active)
@@ -276,6 +307,9 @@ void InputTracker::mouse_move_event_relative(double x, double y)
 
 void InputTracker::mouse_move_event_absolute(double x, double y)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::MouseMoveAbsolute, 0, 0, 0, { x, y } });
+
 	if (mouse_active)
 	{
 		double delta_x = x - last_mouse_x;
@@ -300,6 +334,9 @@ void InputTracker::mouse_button_event_normalized(MouseButton button, double x, d
 
 void InputTracker::mouse_enter(double x, double y)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::MouseEnter, 0, 0, 0, { x, y } });
+
 	mouse_active = true;
 	last_mouse_x = x;
 	last_mouse_y = y;
@@ -307,6 +344,9 @@ void InputTracker::mouse_enter(double x, double y)
 
 void InputTracker::mouse_leave()
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::MouseLeave, 0, 0, 0, {} });
+
 	mouse_active = false;
 }
 
@@ -339,6 +379,9 @@ int InputTracker::find_vacant_joypad_index() const
 
 void InputTracker::enable_joypad(unsigned index, uint32_t vid, uint32_t pid)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::JoypadEnable, index, vid, pid, {} });
+
 	if (index >= Joypads)
 		return;
 
@@ -356,6 +399,9 @@ void InputTracker::enable_joypad(unsigned index, uint32_t vid, uint32_t pid)
 
 void InputTracker::disable_joypad(unsigned index, uint32_t vid, uint32_t pid)
 {
+	if (capture)
+		capture->record_event({ InputCapture::EventType::JoypadDisable, index, vid, pid, {} });
+
 	if (index >= Joypads)
 		return;
 
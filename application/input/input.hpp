@@ -151,6 +151,7 @@ struct JoypadState
 static_assert(Util::ecast(JoypadKey::Count) <= 32, "Cannot have more than 32 joypad buttons.");
 
 class InputTrackerHandler;
+class InputCapture;
 
 class InputTracker
 {
@@ -228,6 +229,12 @@ public:
 		handler = handler_;
 	}
 
+	// All raw input entering the tracker is also appended to capture.
+	void set_capture(InputCapture *capture_)
+	{
+		capture = capture_;
+	}
+
 	// To support dispatching input manager (i.e. polling) state from async threads.
 	std::mutex &get_lock();
 
@@ -236,6 +243,7 @@ public:
 
 private:
 	InputTrackerHandler *handler = nullptr;
+	InputCapture *capture = nullptr;
 	std::mutex dispatch_lock;
 	uint64_t key_state = 0;
 	uint8_t mouse_button_state = 0;
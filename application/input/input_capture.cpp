@@ -0,0 +1,292 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "input_capture.hpp"
+#include "logging.hpp"
+#include <string.h>
+#include <stdio.h>
+
+namespace Granite
+{
+static constexpr const char *CaptureMagic = "granite-input-capture";
+static constexpr unsigned CaptureVersion = 1;
+
+void InputCapture::record_event(const InputEvent &event)
+{
+	events.push_back(event);
+}
+
+void InputCapture::commit_frame(double time_step)
+{
+	Frame frame = {};
+	frame.time_step = time_step;
+	frame.first_event = frames.empty() ? 0 : (frames.back().first_event + frames.back().event_count);
+	frame.event_count = uint32_t(events.size()) - frame.first_event;
+	frames.push_back(frame);
+}
+
+void InputCapture::record_camera(const vec3 &position, const quat &rotation)
+{
+	if (frames.empty())
+		return;
+
+	auto &frame = frames.back();
+	frame.has_camera = true;
+	frame.camera.position = position;
+	frame.camera.rotation = rotation;
+}
+
+const InputCapture::Frame *InputCapture::get_current_frame() const
+{
+	if (replay_index)
+		return &frames[replay_index - 1];
+	else if (!frames.empty())
+		return &frames.back();
+	else
+		return nullptr;
+}
+
+void InputCapture::rewind()
+{
+	replay_index = 0;
+}
+
+void InputCapture::reset()
+{
+	events.clear();
+	frames.clear();
+	replay_index = 0;
+	width = 0;
+	height = 0;
+}
+
+void InputCapture::replay_event(const InputEvent &event, InputTracker &tracker) const
+{
+	auto &v = event.values;
+
+	switch (event.type)
+	{
+	case EventType::Key:
+		tracker.key_event(Key(event.code), KeyState(event.state));
+		break;
+	case EventType::MouseButton:
+		tracker.mouse_button_event(MouseButton(event.code), v[0], v[1], event.state != 0);
+		break;
+	case EventType::MouseMoveAbsolute:
+		tracker.mouse_move_event_absolute(v[0], v[1]);
+		break;
+	case EventType::MouseMoveRelative:
+		tracker.mouse_move_event_relative(v[0], v[1]);
+		break;
+	case EventType::MouseEnter:
+		tracker.mouse_enter(v[0], v[1]);
+		break;
+	case EventType::MouseLeave:
+		tracker.mouse_leave();
+		break;
+	case EventType::JoypadEnable:
+		tracker.enable_joypad(event.index, event.code, event.state);
+		break;
+	case EventType::JoypadDisable:
+		tracker.disable_joypad(event.index, event.code, event.state);
+		break;
+	case EventType::JoypadKey:
+		tracker.joypad_key_state(event.index, JoypadKey(event.code), JoypadKeyState(event.state));
+		break;
+	case EventType::JoypadAxis:
+		tracker.joyaxis_state(event.index, JoypadAxis(event.code), float(v[0]));
+		break;
+	case EventType::TouchDown:
+		tracker.on_touch_down(event.index, float(v[0]), float(v[1]));
+		break;
+	case EventType::TouchMove:
+		tracker.on_touch_move(event.index, float(v[0]), float(v[1]));
+		break;
+	case EventType::TouchUp:
+		tracker.on_touch_up(event.index, float(v[0]), float(v[1]));
+		break;
+	case EventType::TouchGesture:
+		tracker.dispatch_touch_gesture();
+		break;
+	case EventType::Orientation:
+		tracker.orientation_event(quat(float(v[3]), float(v[0]), float(v[1]), float(v[2])));
+		break;
+	default:
+		break;
+	}
+}
+
+const InputCapture::Frame *InputCapture::replay_next_frame(InputTracker &tracker)
+{
+	if (replay_index >= frames.size())
+		return nullptr;
+
+	auto &frame = frames[replay_index++];
+	for (uint32_t i = 0; i < frame.event_count; i++)
+		replay_event(events[frame.first_event + i], tracker);
+	return &frame;
+}
+
+const InputCapture::Frame *InputCapture::peek_next_frame() const
+{
+	return replay_index < frames.size() ? &frames[replay_index] : nullptr;
+}
+
+std::string InputCapture::serialize() const
+{
+	std::string str;
+	char line[512];
+
+	snprintf(line, sizeof(line), "%s %u\nresolution %u %u\n", CaptureMagic, CaptureVersion, width, height);
+	str += line;
+
+	// Print with full precision so a replay sees bit-exact time steps and coordinates.
+	for (auto &frame : frames)
+	{
+		snprintf(line, sizeof(line), "frame %.17g %u\n", frame.time_step, frame.event_count);
+		str += line;
+
+		if (frame.has_camera)
+		{
+			auto &pos = frame.camera.position;
+			auto &rot = frame.camera.rotation;
+			snprintf(line, sizeof(line), "camera %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+			         pos.x, pos.y, pos.z, rot.x, rot.y, rot.z, rot.w);
+			str += line;
+		}
+
+		for (uint32_t i = 0; i < frame.event_count; i++)
+		{
+			auto &e = events[frame.first_event + i];
+			snprintf(line, sizeof(line), "event %u %u %u %u %.17g %.17g %.17g %.17g\n",
+			         unsigned(e.type), e.index, e.code, e.state,
+			         e.values[0], e.values[1], e.values[2], e.values[3]);
+			str += line;
+		}
+	}
+
+	return str;
+}
+
+bool InputCapture::parse(const std::string &str)
+{
+	reset();
+
+	const char *ptr = str.c_str();
+	const char *end = ptr + str.size();
+	unsigned line_index = 0;
+	uint32_t pending_events = 0;
+
+	while (ptr < end)
+	{
+		const char *eol = static_cast<const char *>(memchr(ptr, '\n', size_t(end - ptr)));
+		if (!eol)
+			eol = end;
+		std::string line(ptr, eol);
+		ptr = eol + 1;
+		line_index++;
+
+		if (line.empty())
+			continue;
+
+		if (line_index == 1)
+		{
+			char magic[64];
+			unsigned version;
+			if (sscanf(line.c_str(), "%63s %u", magic, &version) != 2 ||
+			    strcmp(magic, CaptureMagic) != 0 || version != CaptureVersion)
+			{
+				LOGE("Not a supported input capture.\n");
+				return false;
+			}
+		}
+		else if (line.compare(0, 6, "event ") == 0)
+		{
+			InputEvent e = {};
+			unsigned type;
+			if (sscanf(line.c_str(), "event %u %u %u %u %lf %lf %lf %lf", &type, &e.index, &e.code, &e.state,
+			           &e.values[0], &e.values[1], &e.values[2], &e.values[3]) != 8 ||
+			    type >= unsigned(EventType::Count) || pending_events == 0)
+			{
+				LOGE("Malformed input capture event on line %u.\n", line_index);
+				return false;
+			}
+
+			e.type = EventType(type);
+			events.push_back(e);
+			pending_events--;
+		}
+		else if (line.compare(0, 6, "frame ") == 0)
+		{
+			Frame frame = {};
+			if (pending_events != 0 ||
+			    sscanf(line.c_str(), "frame %lf %u", &frame.time_step, &frame.event_count) != 2)
+			{
+				LOGE("Malformed input capture frame on line %u.\n", line_index);
+				return false;
+			}
+
+			frame.first_event = uint32_t(events.size());
+			pending_events = frame.event_count;
+			frames.push_back(frame);
+		}
+		else if (line.compare(0, 7, "camera ") == 0)
+		{
+			vec3 pos;
+			vec4 rot;
+			if (frames.empty() ||
+			    sscanf(line.c_str(), "camera %f %f %f %f %f %f %f",
+			           &pos.x, &pos.y, &pos.z, &rot.x, &rot.y, &rot.z, &rot.w) != 7)
+			{
+				LOGE("Malformed input capture camera on line %u.\n", line_index);
+				return false;
+			}
+
+			auto &frame = frames.back();
+			frame.has_camera = true;
+			frame.camera.position = pos;
+			frame.camera.rotation = quat(rot);
+		}
+		else if (line.compare(0, 11, "resolution ") == 0)
+		{
+			if (sscanf(line.c_str(), "resolution %u %u", &width, &height) != 2)
+			{
+				LOGE("Malformed input capture resolution on line %u.\n", line_index);
+				return false;
+			}
+		}
+		else
+		{
+			LOGE("Unrecognized input capture line %u.\n", line_index);
+			return false;
+		}
+	}
+
+	if (pending_events != 0)
+	{
+		LOGE("Input capture is truncated.\n");
+		return false;
+	}
+
+	return true;
+}
+}
@@ -0,0 +1,169 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "input.hpp"
+#include "event.hpp"
+#include "math.hpp"
+#include <string>
+#include <vector>
+
+namespace Granite
+{
+// Raw input fed into an InputTracker, split into frames with the time step used for each frame.
+// Replaying the events through a fresh InputTracker reproduces the same event stream an
+// application observed while recording, which makes headless runs repeatable.
+class InputCapture
+{
+public:
+	enum class EventType : uint32_t
+	{
+		Key,
+		MouseButton,
+		MouseMoveAbsolute,
+		MouseMoveRelative,
+		MouseEnter,
+		MouseLeave,
+		JoypadEnable,
+		JoypadDisable,
+		JoypadKey,
+		JoypadAxis,
+		TouchDown,
+		TouchMove,
+		TouchUp,
+		TouchGesture,
+		Orientation,
+		Count
+	};
+
+	struct InputEvent
+	{
+		EventType type;
+		uint32_t index;
+		uint32_t code;
+		uint32_t state;
+		double values[4];
+	};
+
+	struct CameraPose
+	{
+		vec3 position;
+		quat rotation;
+	};
+
+	struct Frame
+	{
+		double time_step;
+		uint32_t first_event;
+		uint32_t event_count;
+		bool has_camera;
+		CameraPose camera;
+	};
+
+	// Recording. Events are appended as they arrive and belong to the next committed frame.
+	void record_event(const InputEvent &event);
+	void commit_frame(double time_step);
+	// Attaches a camera pose to the most recently committed frame.
+	void record_camera(const vec3 &position, const quat &rotation);
+
+	// Replay. Feeds the events of the next frame into tracker, and returns nullptr when the capture is exhausted.
+	const Frame *replay_next_frame(InputTracker &tracker);
+	const Frame *peek_next_frame() const;
+	void rewind();
+
+	// The frame most recently committed or replayed.
+	const Frame *get_current_frame() const;
+
+	size_t get_frame_count() const
+	{
+		return frames.size();
+	}
+
+	const Frame &get_frame(size_t index) const
+	{
+		return frames[index];
+	}
+
+	void set_resolution(unsigned width_, unsigned height_)
+	{
+		width = width_;
+		height = height_;
+	}
+
+	unsigned get_width() const
+	{
+		return width;
+	}
+
+	unsigned get_height() const
+	{
+		return height;
+	}
+
+	std::string serialize() const;
+	bool parse(const std::string &str);
+	void reset();
+
+private:
+	std::vector<InputEvent> events;
+	std::vector<Frame> frames;
+	size_t replay_index = 0;
+	unsigned width = 0;
+	unsigned height = 0;
+
+	void replay_event(const InputEvent &event, InputTracker &tracker) const;
+};
+
+enum class InputCaptureMode
+{
+	Record,
+	Replay
+};
+
+// Latched while a platform is recording or replaying a capture,
+// so applications can record or follow a camera path alongside the input.
+class InputCaptureEvent : public Granite::Event
+{
+public:
+	GRANITE_EVENT_TYPE_DECL(InputCaptureEvent)
+
+	InputCaptureEvent(InputCapture &capture_, InputCaptureMode mode_)
+		: capture(capture_), mode(mode_)
+	{
+	}
+
+	InputCapture &get_capture() const
+	{
+		return capture;
+	}
+
+	InputCaptureMode get_mode() const
+	{
+		return mode;
+	}
+
+private:
+	InputCapture &capture;
+	InputCaptureMode mode;
+};
+}
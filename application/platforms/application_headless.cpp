@@ -24,6 +24,7 @@
 #include "application.hpp"
 #include "application_events.hpp"
 #include "application_wsi.hpp"
+#include "input_capture.hpp"
 #include "vulkan_headers.hpp"
 #include <thread>
 #include <mutex>
@@ -39,6 +40,7 @@
 #include "path_utils.hpp"
 #include "thread_group.hpp"
 #include "asset_manager.hpp"
+#include "metrics.hpp"
 
 #ifdef HAVE_GRANITE_FFMPEG
 #include "ffmpeg_encode.hpp"
@@ -90,12 +92,23 @@ public:
 
 	bool alive(Vulkan::WSI &) override
 	{
+		if (input_replay && !input_replay->peek_next_frame())
+			return false;
 		return frames < max_frames;
 	}
 
 	void poll_input() override
 	{
 		std::lock_guard<std::mutex> holder{get_input_tracker().get_lock()};
+		if (input_replay)
+		{
+			// Feed recorded events through the tracker so handlers observe the same stream as the original session.
+			if (auto *frame = input_replay->replay_next_frame(get_input_tracker()))
+			{
+				get_input_tracker().dispatch_current_state(frame->time_step);
+				return;
+			}
+		}
 		get_input_tracker().dispatch_current_state(get_frame_timer().get_frame_time());
 	}
 
@@ -283,10 +296,61 @@ public:
 		time_step = t;
 	}
 
+	bool load_input_replay(const std::string &path)
+	{
+		std::string str;
+		if (!GRANITE_FILESYSTEM()->read_file_to_string(path, str))
+		{
+			LOGE("Failed to read input capture \"%s\".\n", path.c_str());
+			return false;
+		}
+
+		auto capture = std::make_unique<InputCapture>();
+		if (!capture->parse(str))
+			return false;
+
+		if (capture->get_width() != width || capture->get_height() != height)
+		{
+			LOGW("Input capture was recorded at %u x %u, but replaying at %u x %u.\n",
+			     capture->get_width(), capture->get_height(), width, height);
+		}
+
+		LOGI("Loaded %zu frames of input from \"%s\".\n", capture->get_frame_count(), path.c_str());
+		pending_input_replay = std::move(capture);
+		return true;
+	}
+
+	// Replay starts at the first frame of the measured run, not during startup.
+	void begin_input_replay()
+	{
+		if (!pending_input_replay)
+			return;
+
+		input_replay = std::move(pending_input_replay);
+		if (auto *em = GRANITE_EVENT_MANAGER())
+			em->enqueue_latched<InputCaptureEvent>(*input_replay, InputCaptureMode::Replay);
+	}
+
+	void end_input_replay()
+	{
+		if (!input_replay)
+			return;
+
+		if (auto *em = GRANITE_EVENT_MANAGER())
+			em->dequeue_all_latched(InputCaptureEvent::get_type_id());
+		input_replay.reset();
+	}
+
+	double get_next_time_step() const
+	{
+		const InputCapture::Frame *frame = input_replay ? input_replay->peek_next_frame() : nullptr;
+		return frame ? frame->time_step : time_step;
+	}
+
 	void begin_frame()
 	{
 		auto &wsi = app->get_wsi();
-		wsi.set_external_frame(frame_index, std::move(acquire_semaphore[frame_index]), time_step);
+		wsi.set_external_frame(frame_index, std::move(acquire_semaphore[frame_index]), get_next_time_step());
 		acquire_semaphore[frame_index] = {};
 	}
 
@@ -430,6 +494,8 @@ private:
 	std::vector<BufferHandle> readback_buffers;
 	std::vector<Semaphore> acquire_semaphore;
 	std::string next_readback_path;
+	std::unique_ptr<InputCapture> pending_input_replay;
+	std::unique_ptr<InputCapture> input_replay;
 	TaskGroupHandle swapchain_tasks[SwapchainImages];
 	TaskGroupHandle last_task_dependency;
 
@@ -468,9 +534,9 @@ private:
 
 static void print_help()
 {
-	LOGI("[--png-path <path>] [--stat <output.json>]\n"
+	LOGI("[--png-path <path>] [--stat <output.json>] [--metrics <output.csv|output.json>]\n"
 	     "[--fs-assets <path>] [--fs-cache <path>] [--fs-builtin <path>]\n"
-	     "[--video-encode-path <path>]\n"
+	     "[--video-encode-path <path>] [--replay-input <capture>] [--frame-times <output.json>]\n"
 	     "[--png-reference-path <path>] [--frames <frames>] [--width <width>] [--height <height>] [--time-step <step>].\n");
 }
 
@@ -490,6 +556,9 @@ int application_main_headless(
 		std::string video_encode_path;
 		std::string png_reference_path;
 		std::string stat;
+		std::string metrics;
+		std::string replay_input;
+		std::string frame_times;
 		std::string assets;
 		std::string cache;
 		std::string builtin;
@@ -511,6 +580,9 @@ int application_main_headless(
 	cbs.add("--fs-builtin", [&](CLIParser &parser) { args.builtin = parser.next_string(); });
 	cbs.add("--fs-cache", [&](CLIParser &parser) { args.cache = parser.next_string(); });
 	cbs.add("--stat", [&](CLIParser &parser) { args.stat = parser.next_string(); });
+	cbs.add("--metrics", [&](CLIParser &parser) { args.metrics = parser.next_string(); });
+	cbs.add("--replay-input", [&](CLIParser &parser) { args.replay_input = parser.next_string(); });
+	cbs.add("--frame-times", [&](CLIParser &parser) { args.frame_times = parser.next_string(); });
 	cbs.add("--help", [](CLIParser &parser)
 	{
 		print_help();
@@ -553,6 +625,9 @@ int application_main_headless(
 		p->set_time_step(args.time_step);
 		p->init_headless(app.get());
 
+		if (!args.replay_input.empty() && !p->load_input_replay(args.replay_input))
+			return 1;
+
 		// Ensure all startup work is complete.
 		while (app->get_wsi().get_device().query_initialization_progress(Vulkan::Device::InitializationStage::Pipelines) < 100 &&
 		       app->poll())
@@ -590,15 +665,39 @@ int application_main_headless(
 		app->get_wsi().get_device().wait_idle();
 		app->get_wsi().get_device().timestamp_log_reset();
 
+		auto &metrics = Util::MetricsRegistry::get();
+		if (!args.metrics.empty())
+		{
+			// Establish the baseline so startup work does not show up in the first frame.
+			metrics.end_frame();
+			metrics.reset_history();
+			metrics.set_history_enabled(true);
+		}
+
+		struct FrameTime
+		{
+			double time_step;
+			uint64_t cpu_time_ns;
+		};
+		std::vector<FrameTime> frame_times;
+
+		p->begin_input_replay();
+
 		LOGI("=== Begin run ===\n");
 
 		auto start_time = get_current_time_nsecs();
 		unsigned rendered_frames = 0;
 		while (app->poll())
 		{
+			double frame_time_step = p->get_next_time_step();
+			auto frame_start_time = get_current_time_nsecs();
 			p->begin_frame();
 			app->run_frame();
 			p->end_frame();
+			if (!args.frame_times.empty())
+				frame_times.push_back({ frame_time_step, get_current_time_nsecs() - frame_start_time });
+			if (!args.metrics.empty())
+				metrics.end_frame();
 			if (!args.video_encode_path.empty() || !args.png_path.empty())
 			{
 				LOGI("   Queued frame %u (Total time = %.3f ms).\n", rendered_frames,
@@ -613,6 +712,46 @@ int application_main_headless(
 
 		LOGI("=== End run ===\n");
 
+		p->end_input_replay();
+
+		if (!args.frame_times.empty())
+		{
+			// Per-frame CPU time of the measured run. With --replay-input, frame N
+			// corresponds to the same input across builds, so files can be diffed frame-for-frame.
+			Document doc;
+			doc.SetObject();
+			auto &allocator = doc.GetAllocator();
+
+			Value times(kArrayType);
+			Value steps(kArrayType);
+			for (auto &frame : frame_times)
+			{
+				times.PushBack(1e-3 * double(frame.cpu_time_ns), allocator);
+				steps.PushBack(frame.time_step, allocator);
+			}
+
+			doc.AddMember("replay", StringRef(args.replay_input), allocator);
+			doc.AddMember("frameCount", unsigned(frame_times.size()), allocator);
+			doc.AddMember("frameTimesUs", times, allocator);
+			doc.AddMember("timeSteps", steps, allocator);
+
+			StringBuffer buffer;
+			PrettyWriter<StringBuffer> writer(buffer);
+			doc.Accept(writer);
+
+			if (!GRANITE_FILESYSTEM()->write_string_to_file(args.frame_times, buffer.GetString()))
+				LOGE("Failed to write frame time file to disk.\n");
+		}
+
+		if (!args.metrics.empty())
+		{
+			// Pick up work which completed after the last frame was submitted.
+			metrics.end_frame();
+			metrics.set_history_enabled(false);
+			if (!metrics.write(args.metrics))
+				LOGE("Failed to write metrics file to disk.\n");
+		}
+
 		struct Report
 		{
 			std::string tag;
@@ -28,6 +28,7 @@
 #include "application_wsi.hpp"
 #include "application_events.hpp"
 #include "input.hpp"
+#include "input_capture.hpp"
 #include "input_sdl.hpp"
 #include "cli_parser.hpp"
 #include "global_managers_init.hpp"
@@ -91,6 +92,7 @@ public:
 		unsigned override_width = 0;
 		unsigned override_height = 0;
 		bool fullscreen = false;
+		std::string record_input_path;
 #ifdef _WIN32
 		bool threaded = true;
 #else
@@ -329,7 +331,11 @@ public:
 
 		if (gamepad_init_async.load(std::memory_order_acquire))
 			pad.update(get_input_tracker());
-		get_input_tracker().dispatch_current_state(get_frame_timer().get_frame_time());
+
+		double frame_time = get_frame_timer().get_frame_time();
+		if (input_capture)
+			input_capture->commit_frame(frame_time);
+		get_input_tracker().dispatch_current_state(frame_time);
 	}
 
 	void poll_input_async(Granite::InputTrackerHandler *override_handler) override
@@ -664,9 +670,15 @@ public:
 				Granite::Global::start_audio_system();
 			}
 
+			if (!options.record_input_path.empty())
+				begin_input_capture();
+
 			while (app->poll())
 				app->run_frame();
 			Granite::Global::stop_audio_system();
+
+			if (input_capture)
+				end_input_capture();
 		}
 		dispatch_stopped_events();
 		push_task_to_main_thread([this]() { async_loop_alive = false; });
@@ -677,6 +689,36 @@ public:
 		request_tear_down.store(true);
 	}
 
+	void begin_input_capture()
+	{
+		input_capture = std::make_unique<InputCapture>();
+		input_capture->set_resolution(width, height);
+		{
+			std::lock_guard<std::mutex> holder{get_input_tracker().get_lock()};
+			get_input_tracker().set_capture(input_capture.get());
+		}
+
+		if (auto *em = GRANITE_EVENT_MANAGER())
+			em->enqueue_latched<InputCaptureEvent>(*input_capture, InputCaptureMode::Record);
+		LOGI("Recording input to \"%s\".\n", options.record_input_path.c_str());
+	}
+
+	void end_input_capture()
+	{
+		if (auto *em = GRANITE_EVENT_MANAGER())
+			em->dequeue_all_latched(InputCaptureEvent::get_type_id());
+
+		{
+			std::lock_guard<std::mutex> holder{get_input_tracker().get_lock()};
+			get_input_tracker().set_capture(nullptr);
+		}
+
+		LOGI("Recorded %zu frames of input.\n", input_capture->get_frame_count());
+		if (!GRANITE_FILESYSTEM()->write_string_to_file(options.record_input_path, input_capture->serialize()))
+			LOGE("Failed to write input capture to \"%s\".\n", options.record_input_path.c_str());
+		input_capture.reset();
+	}
+
 #ifdef _WIN32
 	void set_hmonitor(HMONITOR monitor)
 	{
@@ -707,6 +749,7 @@ private:
 	unsigned height = 0;
 	uint32_t wake_event_type = 0;
 	Options options;
+	std::unique_ptr<InputCapture> input_capture;
 	std::string clipboard;
 	TaskGroupHandle gamepad_init_task;
 	std::atomic<bool> gamepad_init_async;
@@ -822,6 +865,7 @@ int application_main(
 	cbs.add("--height", [&](Util::CLIParser &parser) { options.override_height = parser.next_uint(); });
 	cbs.add("--thread-main-loop", [&](Util::CLIParser &) { options.threaded = true; });
 	cbs.add("--no-thread-main-loop", [&](Util::CLIParser &) { options.threaded = false; });
+	cbs.add("--record-input", [&](Util::CLIParser &parser) { options.record_input_path = parser.next_string(); });
 	cbs.error_handler = [&]() { LOGE("Failed to parse CLI arguments for SDL.\n"); };
 	if (!Util::parse_cli_filtered(std::move(cbs), argc, argv, exit_code))
 		return exit_code;
@@ -491,6 +491,37 @@ SceneViewerApplication::SceneViewerApplication(const std::string &path, const st
 	                             SwapchainParameterEvent);
 	EVENT_MANAGER_REGISTER_LATCH(SceneViewerApplication, on_device_created, on_device_destroyed, DeviceCreatedEvent);
 	EVENT_MANAGER_REGISTER(SceneViewerApplication, on_key_down, KeyboardEvent);
+	EVENT_MANAGER_REGISTER_LATCH(SceneViewerApplication, on_input_capture_begin, on_input_capture_end, InputCaptureEvent);
+}
+
+void SceneViewerApplication::on_input_capture_begin(const InputCaptureEvent &e)
+{
+	input_capture = &e.get_capture();
+	input_capture_mode = e.get_mode();
+}
+
+void SceneViewerApplication::on_input_capture_end(const InputCaptureEvent &)
+{
+	input_capture = nullptr;
+}
+
+void SceneViewerApplication::sync_input_capture_camera()
+{
+	if (input_capture_mode == InputCaptureMode::Record)
+	{
+		input_capture->record_camera(selected_camera->get_position(), selected_camera->get_rotation());
+	}
+	else if (selected_camera == &cam)
+	{
+		// Pin the free camera to the recorded path, so frame N views the same scene in every build
+		// even if integrating the replayed input drifts slightly.
+		auto *frame = input_capture->get_current_frame();
+		if (frame && frame->has_camera)
+		{
+			cam.set_position(frame->camera.position);
+			cam.set_rotation(frame->camera.rotation);
+		}
+	}
 }
 
 void SceneViewerApplication::export_lights()
@@ -1505,6 +1536,9 @@ void SceneViewerApplication::render_frame(double frame_time, double elapsed_time
 	fallback_lighting.cluster = lighting.cluster;
 	fallback_lighting.volumetric_diffuse = lighting.volumetric_diffuse;
 
+	if (input_capture)
+		sync_input_capture_camera();
+
 	{
 		GRANITE_SCOPED_TIMELINE_EVENT("update-scene-enqueue");
 		update_scene(composer, frame_time, elapsed_time);
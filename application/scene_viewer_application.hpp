@@ -39,6 +39,7 @@
 #include "lights/deferred_lights.hpp"
 #include "lights/volumetric_diffuse.hpp"
 #include "camera_export.hpp"
+#include "input_capture.hpp"
 #include "post/aa.hpp"
 #include "post/temporal.hpp"
 
@@ -90,6 +91,8 @@ protected:
 	void on_swapchain_changed(const Vulkan::SwapchainParameterEvent &e);
 	void on_swapchain_destroyed(const Vulkan::SwapchainParameterEvent &e);
 	bool on_key_down(const KeyboardEvent &e);
+	void on_input_capture_begin(const InputCaptureEvent &e);
+	void on_input_capture_end(const InputCaptureEvent &e);
 	RenderGraph graph;
 
 	bool need_shadow_map_update = true;
@@ -164,6 +167,10 @@ private:
 	void export_lights();
 	void export_cameras();
 
+	InputCapture *input_capture = nullptr;
+	InputCaptureMode input_capture_mode = InputCaptureMode::Record;
+	void sync_input_capture_camera();
+
 	enum { FrameWindowSize = 64, FrameWindowSizeMask = FrameWindowSize - 1 };
 	float last_frame_times[FrameWindowSize] = {};
 	unsigned last_frame_index = 0;
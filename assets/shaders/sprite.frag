@@ -104,6 +104,13 @@ void main()
         color = vec4(1.0, 1.0, 1.0, color.r);
     #endif
 
+    #if defined(VARIANT_BIT_6) && VARIANT_BIT_6
+        // Signed distance field with the edge at 0.5. Antialias over one screen pixel regardless of scale.
+        mediump float dist = color.r - 0.5;
+        mediump float edge_width = max(fwidth(dist), 1.0 / 255.0);
+        color = vec4(1.0, 1.0, 1.0, clamp(dist / edge_width + 0.5, 0.0, 1.0));
+    #endif
+
     #if defined(ALPHA_TEST)
         if (color.a < 0.5)
             discard;
@@ -22,12 +22,18 @@
 
 #include "audio_mixer.hpp"
 #include "audio_resampler.hpp"
+#include "audio_prefetch.hpp"
+#include "decoded_audio_cache.hpp"
+#include "audio_worker_pool.hpp"
+#include "dsp/dsp.hpp"
 #include "audio_events.hpp"
 #include "timer.hpp"
 #include "logging.hpp"
 #include "bitops.hpp"
 #include <string.h>
 #include <cmath>
+#include <algorithm>
+#include <thread>
 
 #define NON_CRITICAL_THREAD_LOCK() \
 	std::lock_guard<std::mutex> holder{non_critical_lock}
@@ -44,12 +50,57 @@ void MixerStream::install_message_queue(StreamID id, Util::LockFreeMessageQueue
 	message_queue = queue;
 }
 
+size_t MixerStream::skip_samples(float * const *scratch, size_t num_frames) noexcept
+{
+	const float gains[Backend::MaxAudioChannels] = {};
+	return accumulate_samples(scratch, gains, num_frames);
+}
+
 void Mixer::set_backend_parameters(float sample_rate_, unsigned channels_, size_t max_num_samples_)
 {
 	max_num_samples = max_num_samples_;
 	sample_rate = sample_rate_;
 	num_channels = channels_;
 	inv_sample_rate = 1.0 / sample_rate;
+
+	for (auto &scratch : skip_scratch)
+		scratch.clear();
+	for (unsigned c = 0; c < num_channels; c++)
+		skip_scratch[c].resize(max_num_samples);
+
+	unsigned bus_count = num_buses.load(std::memory_order_relaxed);
+	for (unsigned i = 0; i < bus_count; i++)
+	{
+		init_bus_buffers(buses[i]);
+		if (buses[i].effect && !buses[i].effect->setup(sample_rate, num_channels, max_num_samples))
+			LOGE("Failed to set up effect for bus %u.\n", i);
+	}
+}
+
+void Mixer::init_bus_buffers(Bus &bus)
+{
+	for (unsigned c = 0; c < Backend::MaxAudioChannels; c++)
+	{
+		bus.input[c].clear();
+		bus.output[c].clear();
+		bus.scratch[c].clear();
+		bus.input_ptrs[c] = nullptr;
+		bus.output_ptrs[c] = nullptr;
+		bus.scratch_ptrs[c] = nullptr;
+	}
+
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		bus.input[c].resize(max_num_samples);
+		bus.scratch[c].resize(max_num_samples);
+		bus.input_ptrs[c] = bus.input[c].data();
+		bus.scratch_ptrs[c] = bus.scratch[c].data();
+		if (bus.effect)
+		{
+			bus.output[c].resize(max_num_samples);
+			bus.output_ptrs[c] = bus.output[c].data();
+		}
+	}
 }
 
 void Mixer::on_backend_start()
@@ -104,7 +155,44 @@ Mixer::Mixer()
 		active = 0;
 	for (auto &mask : kill_channel_mask)
 		mask = 0;
+	for (auto &prio : priority)
+		prio = f32_to_u32(1.0f);
+	for (auto &virt : stream_virtual)
+		virt = false;
+	for (auto &bus : stream_bus)
+		bus = MasterBus;
+
+	for (auto &bus : buses)
+	{
+		bus.gain_linear = f32_to_u32(1.0f);
+		bus.stat_real_voices = 0;
+		bus.stat_virtual_voices = 0;
+		bus.stat_last_cpu_nsecs = 0;
+		bus.stat_peak_cpu_nsecs = 0;
+		bus.stat_total_cpu_nsecs = 0;
+		bus.stat_last_latency_nsecs = 0;
+		bus.stat_peak_latency_nsecs = 0;
+		bus.stat_renders = 0;
+	}
+	num_buses = 1;
+
+	unsigned hw_threads = std::thread::hardware_concurrency();
+	bus_worker_count = std::min(hw_threads > 2 ? hw_threads - 2 : 0u, 3u);
 	latency = 0;
+
+	max_real_voices = DefaultMaxRealVoices;
+	virtualization_threshold = f32_to_u32(std::pow(10.0f, -80.0f / 20.0f));
+
+	stat_real_voices = 0;
+	stat_virtual_voices = 0;
+	stat_last_mix_nsecs = 0;
+	stat_peak_mix_nsecs = 0;
+	stat_total_mix_nsecs = 0;
+	stat_callbacks = 0;
+	stat_promotions = 0;
+	stat_demotions = 0;
+	prefetcher.reset(new StreamPrefetcher);
+	decoded_audio_cache.reset(new DecodedAudioCache);
 }
 
 void Mixer::on_backend_stop()
@@ -119,6 +207,12 @@ Mixer::~Mixer()
 	for (auto *stream : mixer_streams)
 		if (stream)
 			stream->dispose();
+
+	// Workers never touch buses outside of mix_samples(), but shut them down before tearing down effects.
+	bus_workers.reset();
+	for (auto &bus : buses)
+		if (bus.effect)
+			bus.effect->dispose();
 }
 
 unsigned Mixer::get_stream_index(StreamID id)
@@ -197,8 +291,125 @@ void Mixer::update_stream_play_cursor(unsigned index, double new_latency) noexce
 		stream_adjusted_play_cursors_usec[index].store(t_usec, std::memory_order_release);
 }
 
+void Mixer::compute_stream_gains(unsigned index, float *gains) const noexcept
+{
+	float gain = u32_to_f32(gain_linear[index].load(std::memory_order_relaxed));
+	float pan = u32_to_f32(panning[index].load(std::memory_order_relaxed));
+
+	if (num_channels != 2)
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+			gains[c] = gain;
+	}
+	else
+	{
+		gains[0] = gain * saturate(1.0f - pan);
+		gains[1] = gain * saturate(1.0f + pan);
+	}
+}
+
+void Mixer::render_bus_task(void *userdata, unsigned index)
+{
+	auto *mixer = static_cast<Mixer *>(userdata);
+	mixer->render_bus(mixer->level_buses[index]);
+}
+
+void Mixer::render_bus(unsigned bus_index) noexcept
+{
+	auto start_time = Util::get_current_time_nsecs();
+	auto &bus = buses[bus_index];
+	size_t num_frames = current_num_frames;
+
+	// The master bus renders straight into the output.
+	float * const *target = bus_index == MasterBus ? current_channels : bus.input_ptrs;
+	if (bus_index != MasterBus)
+		for (unsigned c = 0; c < num_channels; c++)
+			memset(target[c], 0, num_frames * sizeof(float));
+
+	float gains[Backend::MaxAudioChannels];
+	unsigned real_voices = 0;
+
+	for (unsigned i = 0; i < bus.voice_count; i++)
+	{
+		unsigned candidate_index = bus_voice_list[bus.voice_offset + i];
+		auto &candidate = voice_candidates[candidate_index];
+		auto *stream = mixer_streams[candidate.index];
+
+		if (candidate.real)
+		{
+			compute_stream_gains(candidate.index, gains);
+
+#ifdef AUDIO_MIXER_DEBUG
+			auto stream_start_time = Util::get_current_time_nsecs();
+#endif
+
+			voice_frames[candidate_index] = stream->accumulate_samples(target, gains, num_frames);
+			real_voices++;
+
+#ifdef AUDIO_MIXER_DEBUG
+			voice_seconds[candidate_index] = 1e-9 * double(Util::get_current_time_nsecs() - stream_start_time);
+#endif
+		}
+		else
+		{
+			voice_frames[candidate_index] = stream->skip_samples(bus.scratch_ptrs, num_frames);
+#ifdef AUDIO_MIXER_DEBUG
+			voice_seconds[candidate_index] = 0.0;
+#endif
+		}
+	}
+
+	// Child buses were completed on an earlier level. Sum them in index order to keep output deterministic.
+	unsigned bus_count = num_buses.load(std::memory_order_relaxed);
+	for (unsigned child_index = bus_index + 1; child_index < bus_count; child_index++)
+	{
+		auto &child = buses[child_index];
+		if (child.parent != bus_index)
+			continue;
+
+		if (child.effect)
+		{
+			for (unsigned c = 0; c < num_channels; c++)
+				DSP::accumulate_channel_nogain(target[c], child.output_ptrs[c], num_frames);
+		}
+		else
+		{
+			float gain = u32_to_f32(child.gain_linear.load(std::memory_order_relaxed));
+			for (unsigned c = 0; c < num_channels; c++)
+				DSP::accumulate_channel(target[c], child.input_ptrs[c], gain, num_frames);
+		}
+	}
+
+	if (bus.effect)
+	{
+		float gain = u32_to_f32(bus.gain_linear.load(std::memory_order_relaxed));
+		for (unsigned c = 0; c < num_channels; c++)
+		{
+			gains[c] = gain;
+			memset(bus.output_ptrs[c], 0, num_frames * sizeof(float));
+		}
+		bus.effect->accumulate_samples(bus.output_ptrs, gains, num_frames);
+	}
+
+	auto end_time = Util::get_current_time_nsecs();
+	auto cpu_time = uint64_t(end_time - start_time);
+	auto latency_time = uint64_t(end_time - current_mix_start_time);
+	bus.stat_real_voices.store(real_voices, std::memory_order_relaxed);
+	bus.stat_virtual_voices.store(bus.voice_count - real_voices, std::memory_order_relaxed);
+	bus.stat_last_cpu_nsecs.store(cpu_time, std::memory_order_relaxed);
+	bus.stat_last_latency_nsecs.store(latency_time, std::memory_order_relaxed);
+	if (cpu_time > bus.stat_peak_cpu_nsecs.load(std::memory_order_relaxed))
+		bus.stat_peak_cpu_nsecs.store(cpu_time, std::memory_order_relaxed);
+	if (latency_time > bus.stat_peak_latency_nsecs.load(std::memory_order_relaxed))
+		bus.stat_peak_latency_nsecs.store(latency_time, std::memory_order_relaxed);
+	bus.stat_total_cpu_nsecs.fetch_add(cpu_time, std::memory_order_relaxed);
+	bus.stat_renders.fetch_add(1, std::memory_order_release);
+}
+
 void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 {
+	auto mix_start_time = Util::get_current_time_nsecs();
+
 	for (unsigned c = 0; c < num_channels; c++)
 		memset(channels[c], 0, num_frames * sizeof(float));
 	float gains[Backend::MaxAudioChannels];
@@ -206,6 +417,10 @@ void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 	auto current_latency = double(latency.load(std::memory_order_acquire)) * 1e-6;
 
 	constexpr unsigned iter = MaxSources / 32;
+	uint32_t dead_masks[iter] = {};
+	unsigned num_candidates = 0;
+
+	// Gather all playing streams and score them.
 	for (unsigned i = 0; i < iter; i++)
 	{
 		uint32_t active_mask = active_channel_mask[i].load(std::memory_order_acquire);
@@ -214,6 +429,7 @@ void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 
 		uint32_t dead_mask = kill_channel_mask[i].exchange(0, std::memory_order_relaxed);
 		active_mask &= ~dead_mask;
+		dead_masks[i] = dead_mask;
 
 		Util::for_each_bit(dead_mask, [&](unsigned bit) {
 			emplace_audio_event_on_queue<StreamStoppedEvent>(message_queue, bit + 32 * i);
@@ -224,46 +440,126 @@ void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 			if (!stream_playing[index].load(std::memory_order_acquire))
 				return;
 
-			float gain = u32_to_f32(gain_linear[index].load(std::memory_order_relaxed));
-			float pan = u32_to_f32(panning[index].load(std::memory_order_relaxed));
+			compute_stream_gains(index, gains);
+			float audibility = 0.0f;
+			for (unsigned c = 0; c < num_channels; c++)
+				audibility = std::max(audibility, gains[c]);
+
+			// Inaudible streams are scored negative, so they always sort last.
+			float threshold = u32_to_f32(virtualization_threshold.load(std::memory_order_relaxed));
+			float score = audibility >= threshold ?
+			              audibility * u32_to_f32(priority[index].load(std::memory_order_relaxed)) : -1.0f;
+			uint32_t bus = stream_bus[index].load(std::memory_order_relaxed);
+			voice_candidates[num_candidates++] = { score, index, bus, false };
+		});
+	}
 
-			if (num_channels != 2)
-			{
-				for (unsigned c = 0; c < num_channels; c++)
-					gains[c] = gain;
-			}
+	// Only bother ranking when there are more voices than we are allowed to mix.
+	unsigned num_real = std::min<unsigned>(num_candidates, max_real_voices.load(std::memory_order_relaxed));
+	if (num_real < num_candidates)
+	{
+		std::nth_element(voice_candidates, voice_candidates + num_real, voice_candidates + num_candidates,
+		                 [](const VoiceCandidate &a, const VoiceCandidate &b) {
+			                 return a.score > b.score;
+		                 });
+	}
+
+	unsigned real_voices = 0;
+	uint32_t promotions = 0;
+	uint32_t demotions = 0;
+
+	for (unsigned i = 0; i < num_candidates; i++)
+	{
+		auto &candidate = voice_candidates[i];
+		candidate.real = i < num_real && candidate.score >= 0.0f;
+		if (candidate.real)
+			real_voices++;
+
+		bool was_virtual = stream_virtual[candidate.index].load(std::memory_order_relaxed);
+		if (was_virtual == candidate.real)
+		{
+			if (candidate.real)
+				promotions++;
 			else
-			{
-				gains[0] = gain * saturate(1.0f - pan);
-				gains[1] = gain * saturate(1.0f + pan);
-			}
+				demotions++;
+			stream_virtual[candidate.index].store(!candidate.real, std::memory_order_relaxed);
+		}
+	}
 
-#ifdef AUDIO_MIXER_DEBUG
-			auto start_time = Util::get_current_time_nsecs();
-#endif
+	// Bucket voices by bus. This keeps candidate order, so every bus mixes its voices in a fixed order.
+	unsigned bus_count = num_buses.load(std::memory_order_acquire);
+	for (unsigned i = 0; i < bus_count; i++)
+		buses[i].voice_count = 0;
+
+	for (unsigned i = 0; i < num_candidates; i++)
+	{
+		unsigned bus = voice_candidates[i].bus;
+		buses[bus < bus_count ? bus : unsigned(MasterBus)].voice_count++;
+	}
+
+	unsigned offset = 0;
+	unsigned max_depth = 0;
+	for (unsigned i = 0; i < bus_count; i++)
+	{
+		buses[i].voice_offset = offset;
+		offset += buses[i].voice_count;
+		buses[i].voice_count = 0;
+		max_depth = std::max(max_depth, buses[i].depth);
+	}
+
+	for (unsigned i = 0; i < num_candidates; i++)
+	{
+		unsigned bus_index = voice_candidates[i].bus;
+		auto &bus = buses[bus_index < bus_count ? bus_index : unsigned(MasterBus)];
+		bus_voice_list[bus.voice_offset + bus.voice_count++] = uint16_t(i);
+	}
+
+	current_channels = channels;
+	current_num_frames = num_frames;
+	current_mix_start_time = mix_start_time;
+
+	// Render the graph from the leaves up. Buses on the same level are independent.
+	for (unsigned depth = max_depth + 1; depth; depth--)
+	{
+		unsigned level_count = 0;
+		for (unsigned i = 0; i < bus_count; i++)
+			if (buses[i].depth == depth - 1)
+				level_buses[level_count++] = i;
+
+		if (level_count > 1 && bus_workers)
+			bus_workers->run(render_bus_task, this, level_count);
+		else
+			for (unsigned i = 0; i < level_count; i++)
+				render_bus(level_buses[i]);
+	}
 
-			size_t got = mixer_streams[index]->accumulate_samples(channels, gains, num_frames);
+	for (unsigned i = 0; i < num_candidates; i++)
+	{
+		unsigned index = voice_candidates[i].index;
+		size_t got = voice_frames[i];
 
 #ifdef AUDIO_MIXER_DEBUG
-			auto end_time = Util::get_current_time_nsecs();
+		if (voice_candidates[i].real)
+		{
 			emplace_audio_event_on_queue<AudioStreamPerformanceEvent>(message_queue, mixer_streams[index]->get_stream_id(),
-			                                                          1e-9 * (end_time - start_time), got);
-
+			                                                          voice_seconds[i], got);
+		}
 #endif
 
-			stream_raw_play_cursors[index] += got;
-			update_stream_play_cursor(index, current_latency);
-
-			if (got < num_frames)
-			{
-				dead_mask |= 1u << bit;
-				emplace_audio_event_on_queue<StreamStoppedEvent>(message_queue, bit + 32 * i);
-			}
-		});
+		stream_raw_play_cursors[index] += got;
+		update_stream_play_cursor(index, current_latency);
 
-		active_channel_mask[i].fetch_and(~dead_mask, std::memory_order_release);
+		if (got < num_frames)
+		{
+			dead_masks[index / 32] |= 1u << (index & 31);
+			emplace_audio_event_on_queue<StreamStoppedEvent>(message_queue, index);
+		}
 	}
 
+	for (unsigned i = 0; i < iter; i++)
+		if (dead_masks[i])
+			active_channel_mask[i].fetch_and(~dead_masks[i], std::memory_order_release);
+
 #ifdef AUDIO_MIXER_DEBUG
 	// Pump audio data to the event queue, so applications can monitor the audio backend visually :3
 	for (unsigned c = 0; c < num_channels; c++)
@@ -272,6 +568,17 @@ void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 		                                                              c, channels[c], num_frames);
 	}
 #endif
+
+	auto mix_time = uint64_t(Util::get_current_time_nsecs() - mix_start_time);
+	stat_real_voices.store(real_voices, std::memory_order_relaxed);
+	stat_virtual_voices.store(num_candidates - real_voices, std::memory_order_relaxed);
+	stat_last_mix_nsecs.store(mix_time, std::memory_order_relaxed);
+	if (mix_time > stat_peak_mix_nsecs.load(std::memory_order_relaxed))
+		stat_peak_mix_nsecs.store(mix_time, std::memory_order_relaxed);
+	stat_total_mix_nsecs.fetch_add(mix_time, std::memory_order_relaxed);
+	stat_promotions.fetch_add(promotions, std::memory_order_relaxed);
+	stat_demotions.fetch_add(demotions, std::memory_order_relaxed);
+	stat_callbacks.fetch_add(1, std::memory_order_release);
 }
 
 StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
@@ -338,6 +645,9 @@ StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
 		panning[index].store(f32_to_u32(initial_panning), std::memory_order_relaxed);
 		kill_channel_mask[i].fetch_and(~(1u << subindex), std::memory_order_relaxed);
 		stream_playing[index].store(start_playing, std::memory_order_relaxed);
+		priority[index].store(f32_to_u32(1.0f), std::memory_order_relaxed);
+		stream_bus[index].store(MasterBus, std::memory_order_relaxed);
+		stream_virtual[index].store(false, std::memory_order_relaxed);
 
 		// Kick mixer thread.
 		active_channel_mask[i].fetch_or(1u << subindex, std::memory_order_release);
@@ -374,6 +684,187 @@ Util::LockFreeMessageQueue &Mixer::get_message_queue()
 	return message_queue;
 }
 
+StreamPrefetcher &Mixer::get_stream_prefetcher()
+{
+	return *prefetcher;
+}
+
+DecodedAudioCache &Mixer::get_decoded_audio_cache()
+{
+	return *decoded_audio_cache;
+}
+
+void Mixer::set_stream_priority(StreamID id, float new_priority)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	if (!verify_stream_id(id))
+		return;
+
+	unsigned index = get_stream_index(id);
+	priority[index].store(f32_to_u32(std::max(new_priority, 0.0f)), std::memory_order_relaxed);
+}
+
+void Mixer::set_max_real_voices(unsigned count)
+{
+	max_real_voices.store(std::min<unsigned>(count, MaxSources), std::memory_order_relaxed);
+}
+
+void Mixer::set_virtualization_threshold_db(float threshold_db)
+{
+	virtualization_threshold.store(f32_to_u32(std::pow(10.0f, threshold_db / 20.0f)), std::memory_order_relaxed);
+}
+
+bool Mixer::is_stream_virtual(StreamID id)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	if (!verify_stream_id(id))
+		return false;
+
+	unsigned index = get_stream_index(id);
+	return stream_virtual[index].load(std::memory_order_relaxed);
+}
+
+Mixer::MixStatistics Mixer::get_mix_statistics() const
+{
+	MixStatistics stats;
+	stats.num_callbacks = stat_callbacks.load(std::memory_order_acquire);
+	stats.real_voices = stat_real_voices.load(std::memory_order_relaxed);
+	stats.virtual_voices = stat_virtual_voices.load(std::memory_order_relaxed);
+	stats.last_mix_seconds = 1e-9 * double(stat_last_mix_nsecs.load(std::memory_order_relaxed));
+	stats.peak_mix_seconds = 1e-9 * double(stat_peak_mix_nsecs.load(std::memory_order_relaxed));
+	if (stats.num_callbacks)
+		stats.average_mix_seconds = 1e-9 * double(stat_total_mix_nsecs.load(std::memory_order_relaxed)) / double(stats.num_callbacks);
+	stats.promotions = stat_promotions.load(std::memory_order_relaxed);
+	stats.demotions = stat_demotions.load(std::memory_order_relaxed);
+	return stats;
+}
+
+// Feeds the bus input into the head of a bus effect chain.
+struct BusInputStream : MixerStream
+{
+	BusInputStream(float sample_rate_, unsigned num_channels_, float * const *input_)
+		: sample_rate(sample_rate_), num_channels(num_channels_), input(input_)
+	{
+	}
+
+	bool setup(float, unsigned mixer_channels, size_t) override
+	{
+		return mixer_channels == num_channels;
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+			DSP::accumulate_channel(channels[c], input[c], gains[c], num_frames);
+		return num_frames;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return sample_rate;
+	}
+
+	float sample_rate;
+	unsigned num_channels;
+	float * const *input;
+};
+
+bool Mixer::set_bus_worker_count(unsigned count)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	if (num_buses.load(std::memory_order_relaxed) > 1)
+		return false;
+	bus_worker_count = count;
+	return true;
+}
+
+unsigned Mixer::create_bus(unsigned parent_bus, const BusEffectFactory &effect, float gain_db)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	unsigned index = num_buses.load(std::memory_order_relaxed);
+	if (index >= MaxBuses || parent_bus >= index || !num_channels)
+	{
+		LOGE("Cannot create bus.\n");
+		return InvalidBus;
+	}
+
+	auto &bus = buses[index];
+	bus.parent = parent_bus;
+	bus.depth = buses[parent_bus].depth + 1;
+	bus.gain_linear.store(f32_to_u32(std::pow(10.0f, gain_db / 20.0f)), std::memory_order_relaxed);
+	bus.effect = nullptr;
+
+	// The input buffers must exist before the effect chain is built on top of them.
+	init_bus_buffers(bus);
+
+	if (effect)
+	{
+		auto *chain = effect(new BusInputStream(sample_rate, num_channels, bus.input_ptrs));
+		if (!chain)
+			return InvalidBus;
+
+		if (!chain->setup(sample_rate, num_channels, max_num_samples) ||
+		    chain->get_sample_rate() != sample_rate ||
+		    chain->get_num_channels() != num_channels)
+		{
+			LOGE("Bus effect chain does not match mixer format.\n");
+			chain->dispose();
+			return InvalidBus;
+		}
+
+		bus.effect = chain;
+		init_bus_buffers(bus);
+	}
+
+	if (!bus_workers && bus_worker_count)
+		bus_workers.reset(new MixerWorkerPool(bus_worker_count));
+
+	// Kick mixer thread.
+	num_buses.store(index + 1, std::memory_order_release);
+	return index;
+}
+
+void Mixer::set_bus_gain(unsigned bus, float gain_db)
+{
+	if (bus >= num_buses.load(std::memory_order_acquire))
+		return;
+	buses[bus].gain_linear.store(f32_to_u32(std::pow(10.0f, gain_db / 20.0f)), std::memory_order_relaxed);
+}
+
+bool Mixer::set_stream_bus(StreamID id, unsigned bus)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	if (!verify_stream_id(id) || bus >= num_buses.load(std::memory_order_relaxed))
+		return false;
+
+	unsigned index = get_stream_index(id);
+	stream_bus[index].store(bus, std::memory_order_relaxed);
+	return true;
+}
+
+bool Mixer::get_bus_statistics(unsigned bus_index, BusStatistics &stats) const
+{
+	if (bus_index >= num_buses.load(std::memory_order_acquire))
+		return false;
+
+	auto &bus = buses[bus_index];
+	uint64_t renders = bus.stat_renders.load(std::memory_order_acquire);
+	stats.real_voices = bus.stat_real_voices.load(std::memory_order_relaxed);
+	stats.virtual_voices = bus.stat_virtual_voices.load(std::memory_order_relaxed);
+	stats.last_cpu_seconds = 1e-9 * double(bus.stat_last_cpu_nsecs.load(std::memory_order_relaxed));
+	stats.last_latency_seconds = 1e-9 * double(bus.stat_last_latency_nsecs.load(std::memory_order_relaxed));
+	stats.peak_cpu_seconds = 1e-9 * double(bus.stat_peak_cpu_nsecs.load(std::memory_order_relaxed));
+	stats.peak_latency_seconds = 1e-9 * double(bus.stat_peak_latency_nsecs.load(std::memory_order_relaxed));
+	stats.average_cpu_seconds = renders ?
+	                            1e-9 * double(bus.stat_total_cpu_nsecs.load(std::memory_order_relaxed)) / double(renders) : 0.0;
+	return true;
+}
+
 bool Mixer::play_stream(StreamID id)
 {
 	NON_CRITICAL_THREAD_LOCK();
@@ -26,6 +26,8 @@
 #include "message_queue.hpp"
 #include "global_managers.hpp"
 #include <atomic>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -61,6 +63,13 @@ public:
 	// Must increment.
 	virtual size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept = 0;
 
+	// Called instead of accumulate_samples() while the stream is virtualized by the mixer.
+	// Must advance the stream by num_frames without mixing and return what accumulate_samples() would have.
+	// scratch holds get_num_channels() buffers of at least num_frames which may be clobbered.
+	// The default implementation renders into scratch with zero gain. This is always correct, but saves no work,
+	// so streams should override it if they can skip ahead cheaply.
+	virtual size_t skip_samples(float * const *scratch, size_t num_frames) noexcept;
+
 	// Called after setup().
 	// If get_num_channels() returns != mixer_channels, the stream is refused.
 	// Mono streams can trivially mix to stereo.
@@ -85,6 +94,10 @@ private:
 	Util::LockFreeMessageQueue *message_queue = nullptr;
 };
 
+class StreamPrefetcher;
+class DecodedAudioCache;
+class MixerWorkerPool;
+
 class Mixer final : public BackendCallback, public MixerInterface
 {
 public:
@@ -127,15 +140,80 @@ public:
 	bool play_stream(StreamID id);
 	static unsigned get_stream_index(StreamID id);
 
+	// Voice virtualization.
+	// Every callback, playing streams are ranked by priority * audibility, where audibility is the loudest channel gain.
+	// Only the highest ranked streams up to the real voice limit, and which are above the audibility threshold, are mixed.
+	// The rest are virtualized. Their play cursors keep advancing through MixerStream::skip_samples(),
+	// so they resume in sync when promoted again.
+	// Priority defaults to 1.
+	void set_stream_priority(StreamID id, float priority);
+	void set_max_real_voices(unsigned count);
+	void set_virtualization_threshold_db(float threshold_db);
+	bool is_stream_virtual(StreamID id);
+
+	struct MixStatistics
+	{
+		// From the most recent callback.
+		unsigned real_voices = 0;
+		unsigned virtual_voices = 0;
+		double last_mix_seconds = 0.0;
+
+		double peak_mix_seconds = 0.0;
+		double average_mix_seconds = 0.0;
+		uint64_t num_callbacks = 0;
+		uint64_t promotions = 0;
+		uint64_t demotions = 0;
+	};
+	MixStatistics get_mix_statistics() const;
+
+	// Submix buses.
+	// Streams are routed into buses, and every bus mixes into its parent, ending in the master bus.
+	// A bus can run its own DSP chain. Buses on the same level of the graph are rendered in parallel
+	// on a small dedicated worker pool. Buses are always summed in a fixed order,
+	// so output does not depend on scheduling.
+	enum { MasterBus = 0, MaxBuses = 16, InvalidBus = ~0u };
+	using BusEffectFactory = std::function<MixerStream *(MixerStream *bus_input)>;
+
+	// Can only be called from a non-critical thread after set_backend_parameters().
+	// The effect factory receives a stream producing the bus input and returns the head of a DSP chain
+	// built on it, e.g. create_fft_eq_stream(). Buses cannot be removed.
+	// Returns InvalidBus on failure.
+	unsigned create_bus(unsigned parent_bus, const BusEffectFactory &effect = {}, float gain_db = 0.0f);
+	void set_bus_gain(unsigned bus, float gain_db);
+	bool set_stream_bus(StreamID id, unsigned bus);
+
+	// Must be called before the first bus is created. Defaults to a small number based on core count.
+	bool set_bus_worker_count(unsigned count);
+
+	struct BusStatistics
+	{
+		// From the most recent callback.
+		unsigned real_voices = 0;
+		unsigned virtual_voices = 0;
+		double last_cpu_seconds = 0.0;
+		// Time from the start of the callback until the bus was complete.
+		double last_latency_seconds = 0.0;
+
+		double peak_cpu_seconds = 0.0;
+		double average_cpu_seconds = 0.0;
+		double peak_latency_seconds = 0.0;
+	};
+	bool get_bus_statistics(unsigned bus, BusStatistics &stats) const;
+
 	Util::LockFreeMessageQueue &get_message_queue();
 
+	// Decodes prefetched streams in the background. Should be iterated regularly from a non-critical thread.
+	StreamPrefetcher &get_stream_prefetcher();
+	// Shares decoded audio between streams playing the same file.
+	DecodedAudioCache &get_decoded_audio_cache();
+
 	void set_backend_parameters(float sample_rate, unsigned channels, size_t max_num_sample_count) override;
 	void on_backend_start() override;
 	void on_backend_stop() override;
 	void set_latency_usec(uint32_t usec) override;
 
 private:
-	enum { MaxSources = 128 };
+	enum { MaxSources = 1024, DefaultMaxRealVoices = 128 };
 	std::atomic_uint32_t active_channel_mask[MaxSources / 32];
 	std::atomic_uint32_t kill_channel_mask[MaxSources / 32];
 	MixerStream *mixer_streams[MaxSources] = {};
@@ -143,8 +221,40 @@ private:
 	// Actually float, bitcasted.
 	std::atomic_uint32_t panning[MaxSources];
 	std::atomic_uint32_t gain_linear[MaxSources];
+	std::atomic_uint32_t priority[MaxSources];
 	std::atomic_uint32_t latency;
 	std::atomic_bool stream_playing[MaxSources];
+	std::atomic_bool stream_virtual[MaxSources];
+	std::atomic_uint32_t stream_bus[MaxSources];
+
+	std::atomic_uint32_t max_real_voices;
+	// Actually float, bitcasted.
+	std::atomic_uint32_t virtualization_threshold;
+
+	// Only touched by the mixer thread.
+	struct VoiceCandidate
+	{
+		float score;
+		uint32_t index;
+		// Sampled once per callback, set_stream_bus() may change it while mixing.
+		uint32_t bus;
+		bool real;
+	};
+	VoiceCandidate voice_candidates[MaxSources];
+	size_t voice_frames[MaxSources];
+#ifdef AUDIO_MIXER_DEBUG
+	double voice_seconds[MaxSources];
+#endif
+	std::vector<float> skip_scratch[Backend::MaxAudioChannels];
+
+	std::atomic_uint32_t stat_real_voices;
+	std::atomic_uint32_t stat_virtual_voices;
+	std::atomic_uint64_t stat_last_mix_nsecs;
+	std::atomic_uint64_t stat_peak_mix_nsecs;
+	std::atomic_uint64_t stat_total_mix_nsecs;
+	std::atomic_uint64_t stat_callbacks;
+	std::atomic_uint64_t stat_promotions;
+	std::atomic_uint64_t stat_demotions;
 
 	uint64_t stream_raw_play_cursors[MaxSources];
 	std::atomic_uint64_t stream_adjusted_play_cursors_usec[MaxSources];
@@ -164,8 +274,55 @@ private:
 	bool is_active = false;
 
 	void update_stream_play_cursor(unsigned index, double new_latency) noexcept;
+	void compute_stream_gains(unsigned index, float *gains) const noexcept;
+
+	struct Bus
+	{
+		unsigned parent = InvalidBus;
+		unsigned depth = 0;
+		MixerStream *effect = nullptr;
+		// Actually float, bitcasted.
+		std::atomic_uint32_t gain_linear;
+
+		std::vector<float> input[Backend::MaxAudioChannels];
+		std::vector<float> output[Backend::MaxAudioChannels];
+		std::vector<float> scratch[Backend::MaxAudioChannels];
+		float *input_ptrs[Backend::MaxAudioChannels] = {};
+		float *output_ptrs[Backend::MaxAudioChannels] = {};
+		float *scratch_ptrs[Backend::MaxAudioChannels] = {};
+
+		// Voices routed to this bus in the current callback, as ranges of bus_voice_list.
+		unsigned voice_offset = 0;
+		unsigned voice_count = 0;
+
+		std::atomic_uint32_t stat_real_voices;
+		std::atomic_uint32_t stat_virtual_voices;
+		std::atomic_uint64_t stat_last_cpu_nsecs;
+		std::atomic_uint64_t stat_peak_cpu_nsecs;
+		std::atomic_uint64_t stat_total_cpu_nsecs;
+		std::atomic_uint64_t stat_last_latency_nsecs;
+		std::atomic_uint64_t stat_peak_latency_nsecs;
+		std::atomic_uint64_t stat_renders;
+	};
+	Bus buses[MaxBuses];
+	std::atomic_uint32_t num_buses;
+	uint16_t bus_voice_list[MaxSources];
+	unsigned level_buses[MaxBuses];
+	std::unique_ptr<MixerWorkerPool> bus_workers;
+	unsigned bus_worker_count;
+
+	// Per-callback state shared with bus render tasks.
+	float * const *current_channels = nullptr;
+	size_t current_num_frames = 0;
+	int64_t current_mix_start_time = 0;
+
+	void init_bus_buffers(Bus &bus);
+	void render_bus(unsigned bus_index) noexcept;
+	static void render_bus_task(void *userdata, unsigned index);
 
 	Util::LockFreeMessageQueue message_queue;
+	std::unique_ptr<StreamPrefetcher> prefetcher;
+	std::unique_ptr<DecodedAudioCache> decoded_audio_cache;
 
 private:
 	void event_start(EventManagerInterface &iface) override;
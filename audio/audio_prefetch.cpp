@@ -0,0 +1,284 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define NOMINMAX
+#include "audio_prefetch.hpp"
+#include "dsp/dsp.hpp"
+#include <algorithm>
+
+namespace Granite
+{
+namespace Audio
+{
+PrefetchedStream::PrefetchedStream()
+{
+	complete.store(false, std::memory_order_relaxed);
+	disposed.store(false, std::memory_order_relaxed);
+	decode_pending.store(false, std::memory_order_relaxed);
+	underruns.store(0, std::memory_order_relaxed);
+}
+
+bool PrefetchedStream::init_prefetch(unsigned num_channels, float sample_rate_, float decode_ahead_seconds)
+{
+	if (num_channels == 0 || num_channels > Backend::MaxAudioChannels)
+		return false;
+
+	num_input_channels = num_channels;
+	sample_rate = sample_rate_;
+	target_frames = std::max<size_t>(size_t(decode_ahead_seconds * sample_rate), DecodeChunkFrames);
+
+	// Leave room for a full decode chunk on top of the target.
+	capacity_frames = target_frames + DecodeChunkFrames;
+
+	for (unsigned c = 0; c < num_input_channels; c++)
+	{
+		rings[c].reset(capacity_frames);
+		decode_buffer[c].resize(DecodeChunkFrames);
+	}
+
+	return true;
+}
+
+bool PrefetchedStream::setup(float, unsigned mixer_channels, size_t max_num_frames)
+{
+	num_mixer_channels = mixer_channels;
+	if (num_mixer_channels != num_input_channels && num_input_channels != 1)
+		return false;
+
+	for (auto &mix : mix_buffer)
+		mix.clear();
+
+	for (unsigned c = 0; c < num_input_channels; c++)
+	{
+		mix_buffer[c].resize(max_num_frames);
+		mix_channels[c] = mix_buffer[c].data();
+	}
+
+	if (num_input_channels == 1)
+		for (unsigned c = 1; c < num_mixer_channels; c++)
+			mix_channels[c] = mix_channels[0];
+
+	return true;
+}
+
+unsigned PrefetchedStream::get_num_channels() const
+{
+	return num_mixer_channels;
+}
+
+float PrefetchedStream::get_sample_rate() const
+{
+	return sample_rate;
+}
+
+void PrefetchedStream::dispose()
+{
+	disposed.store(true, std::memory_order_release);
+	release_reference();
+}
+
+bool PrefetchedStream::is_disposed() const noexcept
+{
+	return disposed.load(std::memory_order_acquire);
+}
+
+size_t PrefetchedStream::get_buffered_frames() const noexcept
+{
+	// The last channel is written last, so it bounds what the reader can see.
+	return capacity_frames - rings[num_input_channels - 1].write_avail();
+}
+
+bool PrefetchedStream::needs_decode() const noexcept
+{
+	return !complete.load(std::memory_order_relaxed) && get_buffered_frames() < target_frames;
+}
+
+PrefetchStatus PrefetchedStream::get_status() const noexcept
+{
+	PrefetchStatus status;
+	status.buffered_frames = get_buffered_frames();
+	status.target_frames = target_frames;
+	status.underruns = underruns.load(std::memory_order_relaxed);
+	status.complete = complete.load(std::memory_order_acquire);
+	return status;
+}
+
+void PrefetchedStream::decode_ahead() noexcept
+{
+	float *decode_channels[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < num_input_channels; c++)
+		decode_channels[c] = decode_buffer[c].data();
+
+	while (!complete.load(std::memory_order_relaxed))
+	{
+		size_t buffered = get_buffered_frames();
+		if (buffered >= target_frames)
+			break;
+
+		size_t to_decode = std::min<size_t>(DecodeChunkFrames, capacity_frames - buffered);
+		size_t decoded = decode(decode_channels, to_decode);
+		if (!decoded)
+		{
+			// Release so the mixer sees every frame written before it sees completion.
+			complete.store(true, std::memory_order_release);
+			break;
+		}
+
+		for (unsigned c = 0; c < num_input_channels; c++)
+			rings[c].write_and_move(decode_channels[c], decoded);
+	}
+}
+
+size_t PrefetchedStream::read_frames(size_t num_frames) noexcept
+{
+	size_t avail = num_frames;
+	for (unsigned c = 0; c < num_input_channels; c++)
+		avail = std::min(avail, rings[c].read_avail());
+
+	for (unsigned c = 0; c < num_input_channels; c++)
+		rings[c].read_and_move(mix_channels[c], avail);
+
+	return avail;
+}
+
+size_t PrefetchedStream::complete_read(size_t read, size_t num_frames, bool done) noexcept
+{
+	if (read == num_frames || done)
+		return read;
+
+	// Decoding fell behind. Mix silence rather than ending the stream.
+	underruns.fetch_add(1, std::memory_order_relaxed);
+	return num_frames;
+}
+
+size_t PrefetchedStream::accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept
+{
+	// Check completion first, anything written before it was set is visible after.
+	bool done = complete.load(std::memory_order_acquire);
+	size_t avail = read_frames(num_frames);
+
+	for (unsigned c = 0; c < num_mixer_channels; c++)
+		DSP::accumulate_channel(channels[c], mix_channels[c], gains[c], avail);
+
+	return complete_read(avail, num_frames, done);
+}
+
+size_t PrefetchedStream::skip_samples(float * const *, size_t num_frames) noexcept
+{
+	// Decoding already happens off the mixer thread, so skipping only saves the mix.
+	bool done = complete.load(std::memory_order_acquire);
+	return complete_read(read_frames(num_frames), num_frames, done);
+}
+
+StreamPrefetcher::~StreamPrefetcher()
+{
+	wait_idle();
+}
+
+void StreamPrefetcher::add_stream(PrefetchedStream *stream)
+{
+	stream->decode_ahead();
+	std::lock_guard<std::mutex> holder{lock};
+	streams.push_back(stream->reference_from_this());
+}
+
+void StreamPrefetcher::iterate(ThreadGroup &group)
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	pending_tasks.erase(std::remove_if(pending_tasks.begin(), pending_tasks.end(), [](TaskGroupHandle &task) {
+		return task->poll();
+	}), pending_tasks.end());
+
+	auto itr = std::remove_if(streams.begin(), streams.end(), [this](const PrefetchedStreamHandle &stream) {
+		bool retire = stream->is_disposed() || stream->complete.load(std::memory_order_relaxed);
+		// A pending decode holds its own reference, so dropping ours here is safe.
+		if (retire)
+			retired_underruns += stream->underruns.load(std::memory_order_relaxed);
+		return retire;
+	});
+	streams.erase(itr, streams.end());
+
+	TaskGroupHandle task;
+	for (auto &stream : streams)
+	{
+		if (!stream->needs_decode() || stream->decode_pending.exchange(true, std::memory_order_acquire))
+			continue;
+
+		if (!task)
+		{
+			task = group.create_task();
+			task->set_desc("audio-prefetch");
+			task->set_task_class(TaskClass::Background);
+		}
+
+		task->enqueue_task([s = stream]() mutable {
+			s->decode_ahead();
+			s->decode_pending.store(false, std::memory_order_release);
+		});
+		decode_tasks++;
+	}
+
+	if (task)
+	{
+		task->flush();
+		pending_tasks.push_back(std::move(task));
+	}
+}
+
+void StreamPrefetcher::wait_idle()
+{
+	std::vector<TaskGroupHandle> tasks;
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		tasks = pending_tasks;
+		pending_tasks.clear();
+	}
+
+	for (auto &task : tasks)
+		task->wait();
+}
+
+StreamPrefetcher::Statistics StreamPrefetcher::get_statistics() const
+{
+	std::lock_guard<std::mutex> holder{lock};
+	Statistics stats;
+	stats.underruns = retired_underruns;
+	stats.decode_tasks = decode_tasks;
+
+	for (auto &stream : streams)
+	{
+		auto status = stream->get_status();
+		stats.num_streams++;
+		stats.total_buffered_frames += status.buffered_frames;
+		stats.underruns += status.underruns;
+		if (!status.complete)
+		{
+			stats.min_fill_ratio = std::min(stats.min_fill_ratio,
+			                                float(status.buffered_frames) / float(status.target_frames));
+		}
+	}
+
+	return stats;
+}
+}
+}
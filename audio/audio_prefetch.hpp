@@ -0,0 +1,144 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "audio_mixer.hpp"
+#include "message_queue.hpp"
+#include "intrusive.hpp"
+#include "thread_group.hpp"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace Granite
+{
+namespace Audio
+{
+struct PrefetchStatus
+{
+	size_t buffered_frames = 0;
+	size_t target_frames = 0;
+	uint64_t underruns = 0;
+	bool complete = false;
+};
+
+// A stream which is decoded ahead of the mixer by a StreamPrefetcher.
+// The mixer thread only copies out of per-channel ring buffers, so decode cost never lands on the critical thread.
+// If the ring runs dry, silence is mixed in and an underrun is counted, but the stream keeps playing.
+// The mixer and the prefetcher share ownership, dispose() only drops the mixer's reference.
+class PrefetchedStream : public MixerStream, public Util::ThreadSafeIntrusivePtrEnabled<PrefetchedStream>
+{
+public:
+	PrefetchedStream();
+
+	bool setup(float mixer_output_rate, unsigned mixer_channels, size_t max_num_frames) override;
+	size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept override;
+	size_t skip_samples(float * const *scratch, size_t num_frames) noexcept override;
+	unsigned get_num_channels() const override;
+	float get_sample_rate() const override;
+	void dispose() override;
+
+	// Called from non-critical threads, but never concurrently with itself.
+	// Decodes until the decode-ahead target is reached or the stream ends.
+	void decode_ahead() noexcept;
+	bool needs_decode() const noexcept;
+	bool is_disposed() const noexcept;
+	PrefetchStatus get_status() const noexcept;
+
+protected:
+	// Must be called by the implementation before the stream is handed to a prefetcher.
+	bool init_prefetch(unsigned num_channels, float sample_rate, float decode_ahead_seconds);
+
+	// Decodes up to num_frames planar frames and returns the number written.
+	// Returning 0 ends the stream.
+	virtual size_t decode(float * const *channels, size_t num_frames) noexcept = 0;
+
+private:
+	friend class StreamPrefetcher;
+
+	enum { DecodeChunkFrames = 1024 };
+	Util::LockFreeRingBuffer<float> rings[Backend::MaxAudioChannels];
+	std::vector<float> decode_buffer[Backend::MaxAudioChannels];
+	std::vector<float> mix_buffer[Backend::MaxAudioChannels];
+	float *mix_channels[Backend::MaxAudioChannels] = {};
+
+	float sample_rate = 0.0f;
+	unsigned num_input_channels = 0;
+	unsigned num_mixer_channels = 0;
+	size_t capacity_frames = 0;
+	size_t target_frames = 0;
+
+	std::atomic_bool complete;
+	std::atomic_bool disposed;
+	std::atomic_bool decode_pending;
+	std::atomic_uint64_t underruns;
+
+	size_t get_buffered_frames() const noexcept;
+	size_t read_frames(size_t num_frames) noexcept;
+	size_t complete_read(size_t read_frames, size_t num_frames, bool done) noexcept;
+};
+using PrefetchedStreamHandle = Util::IntrusivePtr<PrefetchedStream>;
+
+// Schedules decoding of prefetched streams as background tasks on a ThreadGroup.
+// iterate() must be called regularly from a non-critical thread,
+// at a rate comfortably faster than the shortest decode-ahead target.
+class StreamPrefetcher
+{
+public:
+	StreamPrefetcher() = default;
+	~StreamPrefetcher();
+	StreamPrefetcher(const StreamPrefetcher &) = delete;
+	void operator=(const StreamPrefetcher &) = delete;
+
+	// Takes a reference. The stream is decoded up to its target before returning,
+	// so playback can start immediately.
+	void add_stream(PrefetchedStream *stream);
+
+	// Kicks decode tasks for streams below their target.
+	// Streams which have been disposed by the mixer or fully decoded are dropped.
+	void iterate(ThreadGroup &group);
+
+	// Blocks until all decode tasks launched so far have completed.
+	void wait_idle();
+
+	struct Statistics
+	{
+		unsigned num_streams = 0;
+		// Lowest buffered / target ratio among live streams, 1 if there are none.
+		float min_fill_ratio = 1.0f;
+		size_t total_buffered_frames = 0;
+		// Includes underruns of streams which have since been dropped.
+		uint64_t underruns = 0;
+		uint64_t decode_tasks = 0;
+	};
+	Statistics get_statistics() const;
+
+private:
+	mutable std::mutex lock;
+	std::vector<PrefetchedStreamHandle> streams;
+	std::vector<TaskGroupHandle> pending_tasks;
+	uint64_t retired_underruns = 0;
+	uint64_t decode_tasks = 0;
+};
+}
+}
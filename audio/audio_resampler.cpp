@@ -80,5 +80,24 @@ size_t ResampledStream::accumulate_samples(float *const *channels, const float *
 
 	return source_input ? num_frames : 0;
 }
+
+size_t ResampledStream::skip_samples(float * const *, size_t num_frames) noexcept
+{
+	size_t need_samples = resamplers[0]->get_current_input_for_output_frames(num_frames);
+	float *input_channels[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		input_channels[c] = input_buffer[c].data();
+		memset(input_channels[c], 0, need_samples * sizeof(float));
+	}
+
+	// Sources which skip don't produce anything, so silence enters the filter history.
+	size_t source_input = source->skip_samples(input_channels, need_samples);
+
+	for (unsigned c = 0; c < num_channels; c++)
+		resamplers[c]->skip_output_frames(input_channels[c], num_frames);
+
+	return source_input ? num_frames : 0;
+}
 }
 }
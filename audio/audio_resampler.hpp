@@ -38,6 +38,7 @@ public:
 
 	bool setup(float output_rate, unsigned channels, size_t frames) override;
 	size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept override;
+	size_t skip_samples(float * const *scratch, size_t num_frames) noexcept override;
 
 	void install_message_queue(StreamID id, Util::LockFreeMessageQueue *queue) override
 	{
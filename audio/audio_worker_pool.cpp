@@ -0,0 +1,144 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "audio_worker_pool.hpp"
+#include "thread_priority.hpp"
+#include "thread_name.hpp"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace Granite
+{
+namespace Audio
+{
+static inline void cpu_relax()
+{
+#if defined(__SSE2__) || defined(_M_X64)
+	_mm_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+MixerWorkerPool::MixerWorkerPool(unsigned num_workers)
+{
+	busy.store(0, std::memory_order_relaxed);
+	generation.store(0, std::memory_order_relaxed);
+	dead.store(false, std::memory_order_relaxed);
+	next_index.store(0, std::memory_order_relaxed);
+	completed.store(0, std::memory_order_relaxed);
+
+	workers.reserve(num_workers);
+	for (unsigned i = 0; i < num_workers; i++)
+		workers.emplace_back(&MixerWorkerPool::worker_loop, this, i);
+}
+
+MixerWorkerPool::~MixerWorkerPool()
+{
+	dead.store(true, std::memory_order_release);
+	for (auto &worker : workers)
+		worker.join();
+}
+
+void MixerWorkerPool::drain() noexcept
+{
+	unsigned index;
+	while ((index = next_index.fetch_add(1, std::memory_order_relaxed)) < count)
+	{
+		func(userdata, index);
+		completed.fetch_add(1, std::memory_order_release);
+	}
+}
+
+void MixerWorkerPool::run(Func func_, void *userdata_, unsigned count_) noexcept
+{
+	if (!count_)
+		return;
+
+	// Workers still leaving the previous job only need to notice it is exhausted.
+	uint32_t expected = 0;
+	while (!busy.compare_exchange_weak(expected, WriterBit, std::memory_order_acquire, std::memory_order_relaxed))
+	{
+		expected = 0;
+		cpu_relax();
+	}
+
+	func = func_;
+	userdata = userdata_;
+	count = count_;
+	next_index.store(0, std::memory_order_relaxed);
+	completed.store(0, std::memory_order_relaxed);
+	generation.fetch_add(1, std::memory_order_release);
+	busy.fetch_sub(WriterBit, std::memory_order_release);
+
+	drain();
+
+	while (completed.load(std::memory_order_acquire) != count_)
+		cpu_relax();
+}
+
+void MixerWorkerPool::worker_loop(unsigned index) noexcept
+{
+	Util::set_current_thread_priority(Util::ThreadPriority::High);
+	Util::set_current_thread_name(("audio-mix-" + std::to_string(index)).c_str());
+
+	uint32_t seen = generation.load(std::memory_order_acquire);
+	unsigned idle_iterations = 0;
+
+	while (!dead.load(std::memory_order_acquire))
+	{
+		if (generation.load(std::memory_order_acquire) == seen)
+		{
+			// Callbacks come in at a steady rate, so stay hot for a while before backing off.
+			idle_iterations++;
+			if (idle_iterations < 4096)
+				cpu_relax();
+			else if (idle_iterations < 8192)
+				std::this_thread::yield();
+			else
+			{
+				auto sleep_usec = std::min<unsigned>(50u << std::min<unsigned>((idle_iterations - 8192) / 64, 5), 1000);
+				std::this_thread::sleep_for(std::chrono::microseconds(sleep_usec));
+			}
+			continue;
+		}
+
+		uint32_t state = busy.fetch_add(1, std::memory_order_acquire);
+		if ((state & WriterBit) == 0)
+		{
+			uint32_t current = generation.load(std::memory_order_acquire);
+			if (current != seen)
+			{
+				seen = current;
+				drain();
+			}
+		}
+		busy.fetch_sub(1, std::memory_order_release);
+		idle_iterations = 0;
+	}
+}
+}
+}
@@ -0,0 +1,77 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+namespace Granite
+{
+namespace Audio
+{
+// Fork/join pool for work inside the mixer callback.
+// The callback path is lock-free and never allocates. Idle workers spin briefly, then back off to sleeping.
+// The forking thread takes part in the work itself, so run() completes promptly even if no worker is awake.
+class MixerWorkerPool
+{
+public:
+	explicit MixerWorkerPool(unsigned num_workers);
+	~MixerWorkerPool();
+
+	MixerWorkerPool(const MixerWorkerPool &) = delete;
+	void operator=(const MixerWorkerPool &) = delete;
+
+	using Func = void (*)(void *userdata, unsigned index);
+
+	// Calls func(userdata, i) for every i in [0, count) and returns once all calls have completed.
+	// Must only be called from one thread at a time.
+	void run(Func func, void *userdata, unsigned count) noexcept;
+
+	unsigned get_num_workers() const
+	{
+		return unsigned(workers.size());
+	}
+
+private:
+	std::vector<std::thread> workers;
+
+	// Workers inside a job hold a reader count. run() takes WriterBit while publishing the next job,
+	// so a late worker can never observe a half-written job.
+	enum : uint32_t { WriterBit = 0x80000000u };
+	std::atomic_uint32_t busy;
+	std::atomic_uint32_t generation;
+	std::atomic_bool dead;
+
+	Func func = nullptr;
+	void *userdata = nullptr;
+	unsigned count = 0;
+	std::atomic_uint32_t next_index;
+	std::atomic_uint32_t completed;
+
+	void worker_loop(unsigned index) noexcept;
+	void drain() noexcept;
+};
+}
+}
@@ -0,0 +1,284 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define NOMINMAX
+#include "decoded_audio_cache.hpp"
+#include "stb_vorbis.h"
+#include "logging.hpp"
+#include <algorithm>
+
+namespace Granite
+{
+namespace Audio
+{
+enum { DecodeBlockFrames = 1024 };
+static constexpr uint64_t DefaultMemoryBudget = 64 * 1024 * 1024;
+
+namespace
+{
+struct VorbisDecoder : AudioDecoder
+{
+	~VorbisDecoder() override
+	{
+		if (file)
+			stb_vorbis_close(file);
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return sample_rate;
+	}
+
+	size_t get_num_frames_hint() const override
+	{
+		return num_frames;
+	}
+
+	int decode(float * const *channels, unsigned frames) override
+	{
+		return stb_vorbis_get_samples_float(file, int(num_channels), const_cast<float **>(channels), int(frames));
+	}
+
+	FileMappingHandle mapping;
+	stb_vorbis *file = nullptr;
+	unsigned num_channels = 0;
+	float sample_rate = 0.0f;
+	size_t num_frames = 0;
+};
+}
+
+std::unique_ptr<AudioDecoder> create_vorbis_decoder(FileMappingHandle mapping)
+{
+	if (!mapping || mapping->get_size() == 0)
+		return {};
+
+	std::unique_ptr<VorbisDecoder> decoder(new VorbisDecoder);
+	int error;
+	decoder->file = stb_vorbis_open_memory(mapping->data<unsigned char>(), int(mapping->get_size()), &error, nullptr);
+	if (!decoder->file)
+	{
+		LOGE("Failed to load Vorbis file, error: %d\n", error);
+		return {};
+	}
+
+	auto info = stb_vorbis_get_info(decoder->file);
+	decoder->num_channels = unsigned(info.channels);
+	decoder->sample_rate = float(info.sample_rate);
+	decoder->num_frames = stb_vorbis_stream_length_in_samples(decoder->file);
+	decoder->mapping = std::move(mapping);
+	return std::unique_ptr<AudioDecoder>(decoder.release());
+}
+
+bool DecodedAudio::open(const std::string &path_, const AudioDecoderFactory &factory)
+{
+	path = path_;
+	auto mapping = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
+	if (!mapping)
+		return false;
+
+	decoder = factory ? factory(std::move(mapping)) : create_vorbis_decoder(std::move(mapping));
+	if (!decoder)
+		return false;
+
+	num_channels = decoder->get_num_channels();
+	sample_rate = decoder->get_sample_rate();
+	if (num_channels == 0 || num_channels > Backend::MaxAudioChannels)
+	{
+		LOGE("Unsupported number of channels %u in %s.\n", num_channels, path.c_str());
+		return false;
+	}
+
+	estimated_size = uint64_t(decoder->get_num_frames_hint()) * num_channels * sizeof(float);
+	return true;
+}
+
+void DecodedAudio::decode()
+{
+	// Decode straight into the final buffers. The header tells us the length up front,
+	// so we normally never have to reallocate.
+	size_t capacity = decoder->get_num_frames_hint() + DecodeBlockFrames;
+	for (unsigned c = 0; c < num_channels; c++)
+		samples[c].resize(capacity);
+
+	float *channels[Backend::MaxAudioChannels];
+	size_t frames = 0;
+	int ret;
+
+	for (;;)
+	{
+		if (frames + DecodeBlockFrames > capacity)
+		{
+			capacity *= 2;
+			for (unsigned c = 0; c < num_channels; c++)
+				samples[c].resize(capacity);
+		}
+
+		for (unsigned c = 0; c < num_channels; c++)
+			channels[c] = samples[c].data() + frames;
+
+		ret = decoder->decode(channels, DecodeBlockFrames);
+		if (ret <= 0)
+			break;
+		frames += size_t(ret);
+	}
+
+	decoder.reset();
+
+	if (ret < 0)
+	{
+		LOGE("Failed to decode %s.\n", path.c_str());
+		for (auto &s : samples)
+			s.clear();
+		state.store(State::Failed, std::memory_order_release);
+		return;
+	}
+
+	for (unsigned c = 0; c < num_channels; c++)
+		samples[c].resize(frames);
+	num_frames = frames;
+	state.store(State::Ready, std::memory_order_release);
+}
+
+DecodedAudioCache::DecodedAudioCache()
+{
+	cache.set_total_cost(DefaultMemoryBudget);
+}
+
+DecodedAudioCache::~DecodedAudioCache()
+{
+	wait_idle();
+}
+
+void DecodedAudioCache::set_memory_budget(uint64_t bytes)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	cache.set_total_cost(bytes);
+	stats.evicted_bytes += cache.prune();
+}
+
+void DecodedAudioCache::set_decoder_factory(AudioDecoderFactory factory)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	decoder_factory = std::move(factory);
+}
+
+DecodedAudioHandle DecodedAudioCache::find_locked(uint64_t cookie, const std::string &path)
+{
+	auto *cached = cache.find_and_mark_as_recent(cookie);
+	if (cached && *cached && !(*cached)->is_failed() && (*cached)->get_path() == path)
+		return *cached;
+	else
+		return {};
+}
+
+DecodedAudioHandle DecodedAudioCache::request(const std::string &path, ThreadGroup *group)
+{
+	Util::Hasher h;
+	h.string(path);
+	uint64_t cookie = h.get();
+	AudioDecoderFactory factory;
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+
+		pending_tasks.erase(std::remove_if(pending_tasks.begin(), pending_tasks.end(), [](TaskGroupHandle &task) {
+			return task->poll();
+		}), pending_tasks.end());
+
+		auto cached = find_locked(cookie, path);
+		if (cached)
+		{
+			stats.hits++;
+			return cached;
+		}
+
+		factory = decoder_factory;
+	}
+
+	DecodedAudioHandle audio(new DecodedAudio);
+	bool opened = audio->open(path, factory);
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+
+		// Another request may have loaded the same file while we were parsing the header.
+		auto cached = find_locked(cookie, path);
+		if (cached)
+		{
+			stats.hits++;
+			return cached;
+		}
+
+		stats.misses++;
+		if (!opened)
+		{
+			cache.erase(cookie);
+			return {};
+		}
+
+		*cache.allocate(cookie, audio->get_size()) = audio;
+		stats.evicted_bytes += cache.prune();
+
+		if (group)
+		{
+			auto task = group->create_task([audio]() mutable {
+				audio->decode();
+			});
+			task->set_desc("decoded-audio-cache");
+			task->set_task_class(TaskClass::Background);
+			task->flush();
+			pending_tasks.push_back(std::move(task));
+			return audio;
+		}
+	}
+
+	audio->decode();
+	return audio;
+}
+
+void DecodedAudioCache::wait_idle()
+{
+	std::vector<TaskGroupHandle> tasks;
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		tasks = std::move(pending_tasks);
+		pending_tasks.clear();
+	}
+
+	for (auto &task : tasks)
+		task->wait();
+}
+
+DecodedAudioCache::Statistics DecodedAudioCache::get_statistics() const
+{
+	std::lock_guard<std::mutex> holder{lock};
+	auto ret = stats;
+	ret.resident_bytes = cache.get_current_cost();
+	return ret;
+}
+}
+}
@@ -0,0 +1,168 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "audio_mixer.hpp"
+#include "intrusive.hpp"
+#include "lru_cache.hpp"
+#include "filesystem.hpp"
+#include "thread_group.hpp"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Granite
+{
+namespace Audio
+{
+// Source of planar PCM for DecodedAudio. Only used from one thread at a time.
+class AudioDecoder
+{
+public:
+	virtual ~AudioDecoder() = default;
+	virtual unsigned get_num_channels() const = 0;
+	virtual float get_sample_rate() const = 0;
+	// Length from the header, used for budgeting and to size buffers up front. The decode may differ.
+	virtual size_t get_num_frames_hint() const = 0;
+	// Returns the number of frames decoded, 0 at end of stream, or negative on error.
+	virtual int decode(float * const *channels, unsigned num_frames) = 0;
+};
+
+// Factories return nullptr if the mapping cannot be decoded.
+using AudioDecoderFactory = std::function<std::unique_ptr<AudioDecoder> (FileMappingHandle mapping)>;
+std::unique_ptr<AudioDecoder> create_vorbis_decoder(FileMappingHandle mapping);
+
+// Fully decoded planar PCM which is shared between all streams playing the same file.
+// The header is parsed up front, so channel count and sample rate are always valid.
+// Samples can only be accessed once is_ready() returns true, after which the object is immutable.
+class DecodedAudio : public Util::ThreadSafeIntrusivePtrEnabled<DecodedAudio>
+{
+public:
+	unsigned get_num_channels() const
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const
+	{
+		return sample_rate;
+	}
+
+	const std::string &get_path() const
+	{
+		return path;
+	}
+
+	bool is_ready() const noexcept
+	{
+		return state.load(std::memory_order_acquire) == State::Ready;
+	}
+
+	bool is_failed() const noexcept
+	{
+		return state.load(std::memory_order_acquire) == State::Failed;
+	}
+
+	size_t get_num_frames() const noexcept
+	{
+		return num_frames;
+	}
+
+	const float *get_channel(unsigned channel) const noexcept
+	{
+		return samples[channel].data();
+	}
+
+	// Estimated from the header, so it can be accounted for before decoding completes.
+	uint64_t get_size() const
+	{
+		return estimated_size;
+	}
+
+private:
+	friend class DecodedAudioCache;
+	enum class State { Pending, Ready, Failed };
+
+	bool open(const std::string &path, const AudioDecoderFactory &factory);
+	void decode();
+
+	std::string path;
+	std::unique_ptr<AudioDecoder> decoder;
+
+	std::vector<float> samples[Backend::MaxAudioChannels];
+	size_t num_frames = 0;
+	unsigned num_channels = 0;
+	float sample_rate = 0.0f;
+	uint64_t estimated_size = 0;
+	std::atomic<State> state{State::Pending};
+};
+using DecodedAudioHandle = Util::IntrusivePtr<DecodedAudio>;
+
+// Path-keyed cache of decoded audio with a memory budget and LRU eviction.
+// Eviction only drops the cache's reference, streams which are still playing keep their buffers alive,
+// so the budget bounds what the cache retains, not what is in use.
+// Can only be called from non-critical threads.
+class DecodedAudioCache
+{
+public:
+	DecodedAudioCache();
+	~DecodedAudioCache();
+	DecodedAudioCache(const DecodedAudioCache &) = delete;
+	void operator=(const DecodedAudioCache &) = delete;
+
+	void set_memory_budget(uint64_t bytes);
+
+	// Defaults to create_vorbis_decoder. Only affects entries opened after the call.
+	void set_decoder_factory(AudioDecoderFactory factory);
+
+	// Returns shared decoded audio for path, or nullptr if the file cannot be opened.
+	// On a miss, decoding is kicked as a background task on group, or done inline if group is nullptr.
+	// Opening and decoding happen outside the cache lock, so concurrent requests for other paths are not blocked.
+	DecodedAudioHandle request(const std::string &path, ThreadGroup *group);
+
+	// Blocks until all decode tasks launched so far have completed.
+	void wait_idle();
+
+	struct Statistics
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t resident_bytes = 0;
+		uint64_t evicted_bytes = 0;
+	};
+	Statistics get_statistics() const;
+
+private:
+	mutable std::mutex lock;
+	Util::LRUCache<DecodedAudioHandle> cache;
+	AudioDecoderFactory decoder_factory;
+	std::vector<TaskGroupHandle> pending_tasks;
+	Statistics stats;
+
+	DecodedAudioHandle find_locked(uint64_t cookie, const std::string &path);
+};
+}
+}
@@ -390,6 +390,36 @@ inline size_t SincResampler::process_output(float *output, const float *input, s
 	return consumed_frames;
 }
 
+size_t SincResampler::skip_output_frames(const float *input, size_t out_frames) noexcept
+{
+	uint32_t ratio = fixed_ratio;
+	size_t consumed_frames = 0;
+
+	while (out_frames)
+	{
+		while (out_frames && time < phases)
+		{
+			out_frames--;
+			time += ratio;
+		}
+
+		while (time >= phases)
+		{
+			if (!ptr)
+				ptr = taps;
+			ptr--;
+
+			const float v = input[consumed_frames];
+			window_buffer[ptr + taps] = v;
+			window_buffer[ptr] = v;
+			consumed_frames++;
+			time -= phases;
+		}
+	}
+
+	return consumed_frames;
+}
+
 size_t SincResampler::process_output_frames(float *outputs, const float *inputs, size_t out_frames) noexcept
 {
 	return process_output<false>(outputs, inputs, out_frames);
@@ -49,6 +49,10 @@ public:
 	size_t process_output_frames(float *outputs, const float *inputs, size_t out_frames) noexcept;
 	size_t process_input_frames(float *outputs, const float *inputs, size_t in_frames) noexcept;
 
+	// Advances as process_output_frames() would, but without filtering.
+	// The inputs still enter the filter history, so processing can resume seamlessly.
+	size_t skip_output_frames(const float *inputs, size_t out_frames) noexcept;
+
 	void operator=(const SincResampler &) = delete;
 	SincResampler(const SincResampler &) = delete;
 
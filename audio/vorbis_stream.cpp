@@ -22,6 +22,9 @@
 
 #define NOMINMAX
 #include "vorbis_stream.hpp"
+#include "audio_prefetch.hpp"
+#include "decoded_audio_cache.hpp"
+#include "thread_group.hpp"
 #include "filesystem.hpp"
 #include "dsp/dsp.hpp"
 #include "stb_vorbis.h"
@@ -86,9 +89,15 @@ struct VorbisStream : MixerStream
 
 struct DecodedVorbisStream : MixerStream
 {
-	bool init(const std::string &path);
+	explicit DecodedVorbisStream(DecodedAudioHandle audio_)
+		: audio(std::move(audio_))
+	{
+		sample_rate = audio->get_sample_rate();
+		num_input_channels = audio->get_num_channels();
+	}
 
 	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override;
+	size_t skip_samples(float * const *scratch, size_t num_frames) noexcept override;
 
 	float get_sample_rate() const override
 	{
@@ -106,13 +115,26 @@ struct DecodedVorbisStream : MixerStream
 		if (num_mixer_channels != num_input_channels && num_input_channels != 1)
 			return false;
 
+		return true;
+	}
+
+	// The audio may still be decoding in the background, so only resolve pointers once it is ready.
+	bool resolve_audio() noexcept
+	{
+		if (decoded_audio_ptr[0])
+			return true;
+		if (!audio->is_ready())
+			return false;
+
 		for (unsigned i = 0; i < num_mixer_channels; i++)
-			decoded_audio_ptr[i] = decoded_audio[num_input_channels == 1 ? 0 : i].data();
+			decoded_audio_ptr[i] = audio->get_channel(num_input_channels == 1 ? 0 : i);
+		num_frames_total = audio->get_num_frames();
 		return true;
 	}
 
-	std::vector<float> decoded_audio[Backend::MaxAudioChannels];
+	DecodedAudioHandle audio;
 	const float *decoded_audio_ptr[Backend::MaxAudioChannels] = {};
+	size_t num_frames_total = 0;
 	size_t offset = 0;
 	float sample_rate = 0.0f;
 	unsigned num_input_channels = 0;
@@ -120,6 +142,18 @@ struct DecodedVorbisStream : MixerStream
 	bool looping = false;
 };
 
+struct PrefetchedVorbisStream : PrefetchedStream
+{
+	~PrefetchedVorbisStream();
+	bool init(const std::string &path, float decode_ahead_seconds);
+	size_t decode(float * const *channels, size_t num_frames) noexcept override;
+
+	stb_vorbis *file = nullptr;
+	FileMappingHandle filesystem_mapping;
+	unsigned num_channels = 0;
+	bool looping = false;
+};
+
 bool VorbisStream::init(const std::string &path)
 {
 	filesystem_mapping = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
@@ -146,57 +180,25 @@ bool VorbisStream::init(const std::string &path)
 	return true;
 }
 
-bool DecodedVorbisStream::init(const std::string &path)
+size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const float *gains, size_t num_frames) noexcept
 {
-	auto mapped = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
-	if (!mapped)
-		return false;
-
-	int error;
-	stb_vorbis *file = stb_vorbis_open_memory(mapped->data<unsigned char>(),
-	                                          int(mapped->get_size()),
-	                                          &error, nullptr);
-	if (!file)
+	if (!resolve_audio())
 	{
-		LOGE("Failed to load Vorbis file, error: %d\n", error);
-		return false;
+		// Play silence until the shared decode completes.
+		return audio->is_failed() ? 0 : num_frames;
 	}
 
-	auto info = stb_vorbis_get_info(file);
-	sample_rate = info.sample_rate;
-	num_input_channels = unsigned(info.channels);
-
-	float block[Backend::MaxAudioChannels][256];
-	float *mix_channels[Backend::MaxAudioChannels];
-	for (unsigned c = 0; c < num_input_channels; c++)
-		mix_channels[c] = block[c];
-
-	int ret;
-	while ((ret = stb_vorbis_get_samples_float(file, int(num_input_channels), mix_channels, 256)) > 0)
-		for (unsigned c = 0; c < num_input_channels; c++)
-			decoded_audio[c].insert(end(decoded_audio[c]), mix_channels[c], mix_channels[c] + ret);
-
-	if (ret < 0)
-		goto error;
-
-	stb_vorbis_close(file);
-	return true;
+	if (num_frames_total == 0)
+		return 0;
 
-error:
-	stb_vorbis_close(file);
-	return false;
-}
-
-size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const float *gains, size_t num_frames) noexcept
-{
-	size_t to_write = std::min(decoded_audio[0].size() - offset, num_frames);
+	size_t to_write = std::min(num_frames_total - offset, num_frames);
 
 	for (unsigned c = 0; c < num_mixer_channels; c++)
 		DSP::accumulate_channel(channels[c], decoded_audio_ptr[c] + offset, gains[c], to_write);
 
 	offset += to_write;
 
-	if (offset >= decoded_audio[0].size())
+	if (offset >= num_frames_total)
 	{
 		if (looping)
 			offset = 0;
@@ -217,6 +219,25 @@ size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const flo
 		return to_write;
 }
 
+size_t DecodedVorbisStream::skip_samples(float * const *, size_t num_frames) noexcept
+{
+	if (!resolve_audio())
+		return audio->is_failed() ? 0 : num_frames;
+
+	if (num_frames_total == 0)
+		return 0;
+
+	if (looping)
+	{
+		offset = (offset + num_frames) % num_frames_total;
+		return num_frames;
+	}
+
+	size_t to_skip = std::min(num_frames_total - offset, num_frames);
+	offset += to_skip;
+	return to_skip;
+}
+
 size_t VorbisStream::accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept
 {
 	auto actual_frames = stb_vorbis_get_samples_float(file, int(num_input_channels), mix_channels, int(num_frames));
@@ -238,6 +259,48 @@ size_t VorbisStream::accumulate_samples(float * const *channels, const float *ga
 	return size_t(actual_frames);
 }
 
+bool PrefetchedVorbisStream::init(const std::string &path, float decode_ahead_seconds)
+{
+	filesystem_mapping = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
+	if (!filesystem_mapping)
+		return false;
+
+	if (filesystem_mapping->get_size() == 0)
+		return false;
+
+	int error;
+	file = stb_vorbis_open_memory(filesystem_mapping->data<unsigned char>(),
+	                              int(filesystem_mapping->get_size()),
+	                              &error, nullptr);
+	if (!file)
+	{
+		LOGE("Failed to load Vorbis file, error: %d\n", error);
+		return false;
+	}
+
+	auto info = stb_vorbis_get_info(file);
+	num_channels = unsigned(info.channels);
+	return init_prefetch(unsigned(info.channels), float(info.sample_rate), decode_ahead_seconds);
+}
+
+size_t PrefetchedVorbisStream::decode(float * const *channels, size_t num_frames) noexcept
+{
+	int ret = stb_vorbis_get_samples_float(file, int(num_channels), const_cast<float **>(channels), int(num_frames));
+	if (ret <= 0 && looping)
+	{
+		stb_vorbis_seek_start(file);
+		ret = stb_vorbis_get_samples_float(file, int(num_channels), const_cast<float **>(channels), int(num_frames));
+	}
+
+	return ret > 0 ? size_t(ret) : 0;
+}
+
+PrefetchedVorbisStream::~PrefetchedVorbisStream()
+{
+	if (file)
+		stb_vorbis_close(file);
+}
+
 VorbisStream::~VorbisStream()
 {
 	if (file)
@@ -257,16 +320,44 @@ MixerStream *create_vorbis_stream(const std::string &path, bool looping)
 	return vorbis;
 }
 
+static MixerStream *create_decoded_vorbis_stream(DecodedAudioHandle audio, bool looping)
+{
+	if (!audio)
+		return nullptr;
+
+	auto vorbis = new DecodedVorbisStream(std::move(audio));
+	vorbis->looping = looping;
+	return vorbis;
+}
+
+MixerStream *create_decoded_vorbis_stream(DecodedAudioCache &cache, const std::string &path, bool looping)
+{
+	return create_decoded_vorbis_stream(cache.request(path, GRANITE_THREAD_GROUP()), looping);
+}
+
 MixerStream *create_decoded_vorbis_stream(const std::string &path, bool looping)
 {
-	auto vorbis = new DecodedVorbisStream;
-	if (!vorbis->init(path))
+	auto *mixer = GRANITE_AUDIO_MIXER();
+	if (mixer)
+		return create_decoded_vorbis_stream(mixer->get_decoded_audio_cache(), path, looping);
+
+	// Without a mixer there is no cache to share, so decode inline.
+	DecodedAudioCache cache;
+	return create_decoded_vorbis_stream(cache.request(path, nullptr), looping);
+}
+
+MixerStream *create_prefetched_vorbis_stream(StreamPrefetcher &prefetcher, const std::string &path,
+                                             bool looping, float decode_ahead_seconds)
+{
+	auto vorbis = new PrefetchedVorbisStream;
+	if (!vorbis->init(path, decode_ahead_seconds))
 	{
 		vorbis->dispose();
 		return nullptr;
 	}
 
 	vorbis->looping = looping;
+	prefetcher.add_stream(vorbis);
 	return vorbis;
 }
 }
@@ -30,6 +30,16 @@ namespace Granite
 namespace Audio
 {
 MixerStream *create_vorbis_stream(const std::string &path, bool looping = false);
+// Decoded audio is shared through the mixer's DecodedAudioCache.
+// On a cache miss, decoding happens in the background and the stream plays silence until it completes.
 MixerStream *create_decoded_vorbis_stream(const std::string &path, bool looping = false);
+class DecodedAudioCache;
+MixerStream *create_decoded_vorbis_stream(DecodedAudioCache &cache, const std::string &path, bool looping = false);
+
+class StreamPrefetcher;
+// Decoding happens ahead of time on background tasks scheduled by the prefetcher,
+// so the mixer thread only copies already decoded audio.
+MixerStream *create_prefetched_vorbis_stream(StreamPrefetcher &prefetcher, const std::string &path,
+                                             bool looping = false, float decode_ahead_seconds = 0.25f);
 }
 }
@@ -262,6 +262,17 @@ Util::Hash GLSLCompiler::get_source_hash() const
 	return h.get();
 }
 
+Util::Hash GLSLCompiler::get_compile_options_hash() const
+{
+	Util::Hasher h;
+	h.u32(uint32_t(stage));
+	h.u32(uint32_t(target));
+	h.u32(uint32_t(optimization));
+	h.u32(uint32_t(strip));
+	h.u32(GRANITE_COMPILER_OPTIMIZE);
+	return h.get();
+}
+
 std::vector<uint32_t> GLSLCompiler::compile(std::string &error_message, const std::vector<std::pair<std::string, int>> *defines) const
 {
 	shaderc::Compiler compiler;
@@ -79,6 +79,8 @@ public:
 	bool set_source_from_file_multistage(const std::string &path);
 	bool preprocess();
 	Util::Hash get_source_hash() const;
+	// Covers everything besides source and defines which affects the SPIR-V output of compile().
+	Util::Hash get_compile_options_hash() const;
 
 	std::vector<uint32_t> compile(std::string &error_message, const std::vector<std::pair<std::string, int>> *defines = nullptr) const;
 
@@ -23,12 +23,19 @@
 #include "event.hpp"
 #include <algorithm>
 #include <assert.h>
+#include <thread>
 
 namespace Granite
 {
 EventManager::~EventManager()
 {
 	dispatch();
+
+	// Events enqueued by handlers in the final dispatch are never delivered.
+	for (auto *event_type : pending_types)
+		for (auto *event : event_type->queued_events)
+			event->~Event();
+
 	for (auto &event_type : latched_events)
 	{
 		for (auto &handler : event_type.handlers)
@@ -40,27 +47,114 @@ EventManager::~EventManager()
 	}
 }
 
-void EventManager::dispatch()
+void EventManager::queue_event(EventTypeData &event_type, Event *event)
 {
-	for (auto &event_type : events)
+	if (!event_type.pending)
 	{
-		auto &handlers = event_type.handlers;
-		auto &queued_events = event_type.queued_events;
-		auto itr = remove_if(begin(handlers), end(handlers), [&](const Handler &handler) {
-			for (auto &event : queued_events)
+		event_type.pending = true;
+		pending_types.push_back(&event_type);
+	}
+	event_type.queued_events.push_back(event);
+}
+
+unsigned EventManager::begin_async_enqueue()
+{
+	for (;;)
+	{
+		unsigned epoch = async_epoch.load(std::memory_order_relaxed) & 1;
+		async_producers[epoch].fetch_add(1, std::memory_order_seq_cst);
+		// If dispatch() flipped the epoch in between, it might not wait for us.
+		if ((async_epoch.load(std::memory_order_seq_cst) & 1) == epoch)
+			return epoch;
+		async_producers[epoch].fetch_sub(1, std::memory_order_release);
+	}
+}
+
+void EventManager::end_async_enqueue(unsigned epoch, AsyncEventNode *node)
+{
+	auto &head = async_heads[epoch];
+	node->next = head.load(std::memory_order_relaxed);
+	while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed));
+	async_producers[epoch].fetch_sub(1, std::memory_order_release);
+}
+
+unsigned EventManager::flush_async_events()
+{
+	unsigned epoch = async_epoch.fetch_add(1, std::memory_order_seq_cst) & 1;
+	while (async_producers[epoch].load(std::memory_order_acquire) != 0)
+		std::this_thread::yield();
+
+	// The list is LIFO, reverse it to deliver in submission order.
+	AsyncEventNode *node = async_heads[epoch].exchange(nullptr, std::memory_order_acquire);
+	AsyncEventNode *ordered = nullptr;
+	while (node)
+	{
+		auto *next = node->next;
+		node->next = ordered;
+		ordered = node;
+		node = next;
+	}
+
+	EventTypeData *event_type = nullptr;
+	EventType last_type = 0;
+	for (node = ordered; node; node = node->next)
+	{
+		if (!event_type || node->type != last_type)
+		{
+			event_type = &events[node->type];
+			last_type = node->type;
+		}
+		queue_event(*event_type, node->event);
+	}
+
+	return epoch;
+}
+
+void EventManager::dispatch_queued_events(EventTypeData &event_type)
+{
+	auto &handlers = event_type.handlers;
+	auto &queued_events = event_type.queued_events;
+
+	// Handlers may enqueue more events of the same type, those are deferred to the next dispatch.
+	size_t count = queued_events.size();
+	auto itr = remove_if(begin(handlers), end(handlers), [&](const Handler &handler) {
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!handler.mem_fn(handler.handler, *queued_events[i]))
 			{
-				if (!handler.mem_fn(handler.handler, *event))
-				{
-					handler.unregister_key->release_manager_reference();
-					return true;
-				}
+				handler.unregister_key->release_manager_reference();
+				return true;
 			}
-			return false;
-		});
+		}
+		return false;
+	});
 
-		handlers.erase(itr, end(handlers));
-		queued_events.clear();
-	}
+	handlers.erase(itr, end(handlers));
+
+	for (size_t i = 0; i < count; i++)
+		queued_events[i]->~Event();
+	queued_events.erase(begin(queued_events), begin(queued_events) + ptrdiff_t(count));
+
+	if (queued_events.empty())
+		event_type.pending = false;
+	else
+		pending_types.push_back(&event_type);
+}
+
+void EventManager::dispatch()
+{
+	unsigned async_epoch_index = flush_async_events();
+	unsigned frame_index = frame_arena_index;
+	frame_arena_index ^= 1;
+
+	std::swap(pending_types, dispatching_types);
+	for (auto *event_type : dispatching_types)
+		dispatch_queued_events(*event_type);
+	dispatching_types.clear();
+
+	// Everything allocated before this dispatch has been delivered and destroyed now.
+	frame_arenas[frame_index].reset();
+	async_arenas[async_epoch_index].reset();
 }
 
 void EventManager::dispatch_event(std::vector<Handler> &handlers, const Event &e)
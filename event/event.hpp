@@ -24,11 +24,14 @@
 
 #include <vector>
 #include <memory>
+#include <new>
 #include <stdexcept>
 #include <utility>
+#include <atomic>
 #include "compile_time_hash.hpp"
 #include "intrusive_hash_map.hpp"
 #include "global_managers.hpp"
+#include "event_arena.hpp"
 
 #define EVENT_MANAGER_REGISTER(clazz, member, event) \
 	GRANITE_EVENT_MANAGER()->register_handler<clazz, event, &clazz::member>(this)
@@ -112,14 +115,29 @@ private:
 class EventManager final : public EventManagerInterface
 {
 public:
+	// Queued events are allocated from a per-frame arena and only live until dispatch() has delivered them.
+	// Must be called from the thread which owns the EventManager.
 	template<typename T, typename... P>
 	void enqueue(P&&... p)
 	{
 		static constexpr auto type = T::get_type_id();
-		auto &l = events[type];
+		void *mem = frame_arenas[frame_arena_index].allocate(sizeof(T), alignof(T));
+		queue_event(events[type], new (mem) T(std::forward<P>(p)...));
+	}
 
-		auto ptr = std::unique_ptr<Event>(new T(std::forward<P>(p)...));
-		l.queued_events.emplace_back(std::move(ptr));
+	// Thread-safe and lock-free in the common case, e.g. for ThreadGroup workers.
+	// Events are delivered by the next dispatch() after the regular queue of the same type.
+	template<typename T, typename... P>
+	void enqueue_async(P&&... p)
+	{
+		static constexpr auto type = T::get_type_id();
+		unsigned epoch = begin_async_enqueue();
+		auto &arena = async_arenas[epoch];
+		auto *node = static_cast<AsyncEventNode *>(arena.allocate(sizeof(AsyncEventNode), alignof(AsyncEventNode)));
+		void *mem = arena.allocate(sizeof(T), alignof(T));
+		node->event = new (mem) T(std::forward<P>(p)...);
+		node->type = type;
+		end_async_enqueue(epoch, node);
 	}
 
 	template<typename T, typename... P>
@@ -218,11 +236,13 @@ private:
 
 	struct EventTypeData : Util::IntrusiveHashMapEnabled<EventTypeData>
 	{
-		std::vector<std::unique_ptr<Event>> queued_events;
+		// Owned by the event arenas, destroyed explicitly after dispatch.
+		std::vector<Event *> queued_events;
 		std::vector<Handler> handlers;
 		std::vector<Handler> recursive_handlers;
 		bool enqueueing = false;
 		bool dispatching = false;
+		bool pending = false;
 
 		void flush_recursive_handlers();
 	};
@@ -244,7 +264,36 @@ private:
 	void dispatch_up_event(LatchEventTypeData &event_type, const Event &event);
 	void dispatch_down_event(LatchEventTypeData &event_type, const Event &event);
 
+	struct AsyncEventNode
+	{
+		AsyncEventNode *next;
+		Event *event;
+		EventType type;
+	};
+
+	void queue_event(EventTypeData &event_type, Event *event);
+	unsigned begin_async_enqueue();
+	void end_async_enqueue(unsigned epoch, AsyncEventNode *node);
+	unsigned flush_async_events();
+	void dispatch_queued_events(EventTypeData &event_type);
+
 	Util::IntrusiveHashMap<EventTypeData> events;
+
+	// Only types with queued events are visited in dispatch().
+	std::vector<EventTypeData *> pending_types;
+	std::vector<EventTypeData *> dispatching_types;
+
+	// Double buffered, so events enqueued by handlers survive until the next dispatch().
+	EventArena frame_arenas[2];
+	unsigned frame_arena_index = 0;
+
+	// MPSC queue. Producers pick an epoch, dispatch() flips it and waits for
+	// in-flight producers of the old epoch before consuming its list and arena.
+	std::atomic_uint async_epoch{0};
+	std::atomic_uint async_producers[2] = {};
+	std::atomic<AsyncEventNode *> async_heads[2] = {};
+	EventArena async_arenas[2];
+
 	Util::IntrusiveHashMap<LatchEventTypeData> latched_events;
 	uint64_t cookie_counter = 0;
 };
@@ -0,0 +1,112 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "event_arena.hpp"
+#include "aligned_alloc.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace Granite
+{
+EventArena::~EventArena()
+{
+	free_list(used_blocks);
+	free_list(free_blocks);
+}
+
+void EventArena::free_list(Block *block)
+{
+	while (block)
+	{
+		auto *next = block->next;
+		Util::memalign_free(block->data);
+		delete block;
+		block = next;
+	}
+}
+
+void *EventArena::allocate(size_t size, size_t alignment)
+{
+	// Reserve worst case padding up front, so a single fetch_add is enough.
+	size_t padded_size = size + alignment - 1;
+
+	for (;;)
+	{
+		Block *block = current.load(std::memory_order_acquire);
+		if (block)
+		{
+			size_t offset = block->offset.fetch_add(padded_size, std::memory_order_relaxed);
+			if (offset + padded_size <= block->size)
+			{
+				auto ptr = reinterpret_cast<uintptr_t>(block->data) + offset;
+				ptr = (ptr + alignment - 1) & ~uintptr_t(alignment - 1);
+				return reinterpret_cast<void *>(ptr);
+			}
+		}
+
+		grow(block, padded_size);
+	}
+}
+
+void EventArena::grow(Block *full_block, size_t min_size)
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	// Someone else might have replaced the block already.
+	if (current.load(std::memory_order_relaxed) != full_block)
+		return;
+
+	Block *block = nullptr;
+	if (free_blocks && free_blocks->size >= min_size)
+	{
+		block = free_blocks;
+		free_blocks = block->next;
+	}
+	else
+	{
+		block = new Block;
+		block->size = std::max<size_t>(DefaultBlockSize, min_size);
+		block->data = static_cast<uint8_t *>(Util::memalign_alloc(64, block->size));
+		if (!block->data)
+			throw std::bad_alloc();
+		num_blocks++;
+	}
+
+	block->offset.store(0, std::memory_order_relaxed);
+	block->next = used_blocks;
+	used_blocks = block;
+	current.store(block, std::memory_order_release);
+}
+
+void EventArena::reset()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	while (used_blocks)
+	{
+		auto *next = used_blocks->next;
+		used_blocks->next = free_blocks;
+		free_blocks = used_blocks;
+		used_blocks = next;
+	}
+	current.store(nullptr, std::memory_order_relaxed);
+}
+}
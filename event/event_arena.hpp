@@ -0,0 +1,72 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Granite
+{
+// Bump allocator for events which only live until the next EventManager::dispatch().
+// Blocks are recycled on reset(), so steady state enqueueing does not touch the heap.
+// allocate() is thread-safe and lock-free, except when a new block has to be linked in.
+// reset() must not race with allocate().
+class EventArena
+{
+public:
+	EventArena() = default;
+	~EventArena();
+	EventArena(const EventArena &) = delete;
+	void operator=(const EventArena &) = delete;
+
+	void *allocate(size_t size, size_t alignment);
+	void reset();
+
+	size_t get_num_blocks() const
+	{
+		return num_blocks;
+	}
+
+private:
+	struct Block
+	{
+		Block *next = nullptr;
+		uint8_t *data = nullptr;
+		size_t size = 0;
+		std::atomic_size_t offset;
+	};
+
+	enum { DefaultBlockSize = 64 * 1024 };
+
+	std::atomic<Block *> current{nullptr};
+	Block *used_blocks = nullptr;
+	Block *free_blocks = nullptr;
+	size_t num_blocks = 0;
+	std::mutex lock;
+
+	void grow(Block *full_block, size_t min_size);
+	static void free_list(Block *block);
+};
+}
@@ -22,11 +22,40 @@
 
 #include "asset_manager.hpp"
 #include "thread_group.hpp"
+#include "metrics.hpp"
 #include <utility>
 #include <algorithm>
 
 namespace Granite
 {
+namespace
+{
+struct AssetMetrics
+{
+	AssetMetrics()
+	{
+		auto &registry = Util::MetricsRegistry::get();
+		activations = registry.counter("asset_manager.activations");
+		activated_bytes = registry.counter("asset_manager.activated_bytes");
+		releases = registry.counter("asset_manager.releases");
+		consumed_bytes = registry.gauge("asset_manager.consumed_bytes");
+		iterate = registry.histogram("asset_manager.iterate");
+	}
+
+	Util::MetricCounter *activations;
+	Util::MetricCounter *activated_bytes;
+	Util::MetricCounter *releases;
+	Util::MetricGauge *consumed_bytes;
+	Util::MetricHistogram *iterate;
+};
+
+static AssetMetrics &get_metrics()
+{
+	static AssetMetrics metrics;
+	return metrics;
+}
+}
+
 AssetManager::AssetManager()
 {
 	asset_bank.reserve(AssetID::MaxIDs);
@@ -46,19 +75,79 @@ AssetManager::~AssetManager()
 
 AssetID AssetManager::register_asset_nolock(FileHandle file, AssetClass asset_class, int prio)
 {
-	auto *info = pool.allocate();
+	AssetInfo *info;
+	if (!free_ids.empty())
+	{
+		info = asset_bank[free_ids.back()];
+		free_ids.pop_back();
+	}
+	else if (id_count < AssetID::MaxIDs)
+	{
+		info = pool.allocate();
+		info->id.id = id_count;
+		asset_bank[id_count++] = info;
+	}
+	else
+	{
+		LOGE("Out of asset IDs.\n");
+		return {};
+	}
+
 	info->handle = std::move(file);
-	info->id.id = id_count;
 	info->prio = prio;
 	info->asset_class = asset_class;
-	AssetID ret = info->id;
-	asset_bank[id_count++] = info;
 	if (iface)
 	{
 		iface->set_id_bounds(id_count);
 		iface->set_asset_class(info->id, asset_class);
 	}
-	return ret;
+	return info->id;
+}
+
+void AssetManager::unregister_asset(AssetID id)
+{
+	std::lock_guard<std::mutex> holder{asset_bank_lock};
+	if (id.id >= id_count)
+		return;
+
+	// Never activate it again, the actual release happens in iterate().
+	asset_bank[id.id]->prio = 0;
+	unregistered_ids.push_back(id);
+}
+
+void AssetManager::recycle_unregistered_locked_assets()
+{
+	size_t pending_count = 0;
+	for (auto id : unregistered_ids)
+	{
+		auto *a = asset_bank[id.id];
+
+		// The instantiation may still be reading from the file, and will report its cost against this ID.
+		if (a->pending_consumed)
+		{
+			unregistered_ids[pending_count++] = id;
+			continue;
+		}
+
+		if (a->consumed)
+		{
+			iface->release_asset(id);
+			get_metrics().releases->add();
+			total_consumed -= a->consumed;
+			a->consumed = 0;
+		}
+
+		if (a->get_hash())
+		{
+			file_to_assets.erase(a);
+			a->set_hash(0);
+		}
+
+		a->handle.reset();
+		a->last_used = 0;
+		free_ids.push_back(id.id);
+	}
+	unregistered_ids.resize(pending_count);
 }
 
 void AssetInstantiatorInterface::set_asset_class(AssetID, AssetClass)
@@ -225,6 +314,11 @@ bool AssetManager::iterate_blocking(ThreadGroup &group, AssetID id)
 	candidate->last_used = timestamp;
 	total_consumed += estimate;
 
+	auto &metrics = get_metrics();
+	metrics.activations->add();
+	metrics.activated_bytes->add(estimate);
+	metrics.consumed_bytes->set(int64_t(total_consumed));
+
 	// We cannot increment the timestamp here, remember this for later.
 	// We hold a lock on the asset bank here, so this is fine even if called concurrently.
 	blocking_signals++;
@@ -249,6 +343,9 @@ void AssetManager::iterate(ThreadGroup *group)
 		return;
 	}
 
+	auto &metrics = get_metrics();
+	Util::ScopedMetricTimer timer{metrics.iterate};
+
 	TaskGroupHandle task;
 	if (group)
 	{
@@ -263,6 +360,7 @@ void AssetManager::iterate(ThreadGroup *group)
 	std::lock_guard<std::mutex> holder{asset_bank_lock};
 	update_costs_locked_assets();
 	update_lru_locked_assets();
+	recycle_unregistered_locked_assets();
 
 	memcpy(sorted_assets.data(), asset_bank.data(), id_count * sizeof(sorted_assets[0]));
 	std::sort(sorted_assets.data(), sorted_assets.data() + id_count, [](const AssetInfo *a, const AssetInfo *b) -> bool {
@@ -319,6 +417,7 @@ void AssetManager::iterate(ThreadGroup *group)
 			{
 				LOGI("Releasing ID %u due to page-in pressure.\n", release_candidate->id.id);
 				iface->release_asset(release_candidate->id);
+				metrics.releases->add();
 				total_consumed -= release_candidate->consumed;
 				release_candidate->consumed = 0;
 			}
@@ -365,12 +464,17 @@ void AssetManager::iterate(ThreadGroup *group)
 		{
 			LOGI("Releasing 0-prio ID %u due to page-in pressure.\n", candidate->id.id);
 			iface->release_asset(candidate->id);
+			metrics.releases->add();
 			total_consumed -= candidate->consumed;
 			candidate->consumed = 0;
 			candidate->last_used = 0;
 		}
 	}
 
+	metrics.activations->add(activation_count);
+	metrics.activated_bytes->add(activated_cost_this_iteration);
+	metrics.consumed_bytes->set(int64_t(total_consumed));
+
 	if (activated_cost_this_iteration)
 	{
 		LOGI("Activated %u resources for %llu KiB.\n", activation_count,
@@ -110,6 +110,11 @@ public:
 	AssetID register_asset(FileHandle file, AssetClass asset_class, int prio = 1);
 	AssetID register_asset(Filesystem &fs, const std::string &path, AssetClass asset_class, int prio = 1);
 
+	// Releases the asset and recycles its ID in a later iterate(), once any in-flight instantiation has completed.
+	// The ID must not be used after this call.
+	// Intended for streaming systems which would otherwise run out of IDs.
+	void unregister_asset(AssetID id);
+
 	// Prio 0: Not resident, resource may not exist.
 	bool set_asset_residency_priority(AssetID id, int prio);
 
@@ -156,6 +161,8 @@ private:
 
 	AssetInstantiatorInterface *iface = nullptr;
 	uint32_t id_count = 0;
+	std::vector<AssetID> unregistered_ids;
+	std::vector<uint32_t> free_ids;
 	uint64_t total_consumed = 0;
 	uint64_t transfer_budget = 0;
 	uint64_t transfer_budget_per_iteration = 0;
@@ -177,6 +184,7 @@ private:
 
 	void update_costs_locked_assets();
 	void update_lru_locked_assets();
+	void recycle_unregistered_locked_assets();
 
 	bool wants_mesh_assets = false;
 };
@@ -25,6 +25,7 @@
 #include "simd.hpp"
 #include "muglm/matrix_helper.hpp"
 #include <assert.h>
+#include <algorithm>
 
 namespace Granite
 {
@@ -106,6 +107,174 @@ void compute_model_transform(mat4 &world, vec3 s, quat rot, vec3 trans, const ma
 	SIMD::mul(world, parent, model);
 }
 
+#if defined(__AVX2__) || defined(__SSE__) || defined(__ARM_NEON)
+namespace
+{
+#if defined(__AVX2__)
+struct TransformLanes
+{
+	enum { Width = 8 };
+	using V = __m256;
+	static inline V load(const float *p) { return _mm256_load_ps(p); }
+	static inline void store(float *p, V v) { _mm256_store_ps(p, v); }
+	static inline V splat(float v) { return _mm256_set1_ps(v); }
+	static inline V add(V a, V b) { return _mm256_add_ps(a, b); }
+	static inline V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+	static inline V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+};
+#elif defined(__SSE__)
+struct TransformLanes
+{
+	enum { Width = 4 };
+	using V = __m128;
+	static inline V load(const float *p) { return _mm_load_ps(p); }
+	static inline void store(float *p, V v) { _mm_store_ps(p, v); }
+	static inline V splat(float v) { return _mm_set1_ps(v); }
+	static inline V add(V a, V b) { return _mm_add_ps(a, b); }
+	static inline V sub(V a, V b) { return _mm_sub_ps(a, b); }
+	static inline V mul(V a, V b) { return _mm_mul_ps(a, b); }
+};
+#elif defined(__ARM_NEON)
+struct TransformLanes
+{
+	enum { Width = 4 };
+	using V = float32x4_t;
+	static inline V load(const float *p) { return vld1q_f32(p); }
+	static inline void store(float *p, V v) { vst1q_f32(p, v); }
+	static inline V splat(float v) { return vdupq_n_f32(v); }
+	static inline V add(V a, V b) { return vaddq_f32(a, b); }
+	static inline V sub(V a, V b) { return vsubq_f32(a, b); }
+	static inline V mul(V a, V b) { return vmulq_f32(a, b); }
+};
+#endif
+
+// world = parent * [ m0 m3 m6 t.x ; m1 m4 m7 t.y ; m2 m5 m8 t.z ; 0 0 0 1 ], with m given as 3x3 column-major
+// with a stride between elements.
+static inline void mul_affine(mat4 &world, const mat4 &parent, const float *m, size_t stride, const vec3 &t)
+{
+#if defined(__SSE__)
+	__m128 p0 = _mm_loadu_ps(parent[0].data);
+	__m128 p1 = _mm_loadu_ps(parent[1].data);
+	__m128 p2 = _mm_loadu_ps(parent[2].data);
+	__m128 p3 = _mm_loadu_ps(parent[3].data);
+
+	for (unsigned c = 0; c < 3; c++)
+	{
+		const float *col = m + 3 * c * stride;
+		__m128 v = _mm_mul_ps(p0, _mm_set1_ps(col[0]));
+		v = _mm_add_ps(v, _mm_mul_ps(p1, _mm_set1_ps(col[stride])));
+		v = _mm_add_ps(v, _mm_mul_ps(p2, _mm_set1_ps(col[2 * stride])));
+		_mm_storeu_ps(world[c].data, v);
+	}
+
+	__m128 v = _mm_add_ps(p3, _mm_mul_ps(p0, _mm_set1_ps(t.x)));
+	v = _mm_add_ps(v, _mm_mul_ps(p1, _mm_set1_ps(t.y)));
+	v = _mm_add_ps(v, _mm_mul_ps(p2, _mm_set1_ps(t.z)));
+	_mm_storeu_ps(world[3].data, v);
+#elif defined(__ARM_NEON)
+	float32x4_t p0 = vld1q_f32(parent[0].data);
+	float32x4_t p1 = vld1q_f32(parent[1].data);
+	float32x4_t p2 = vld1q_f32(parent[2].data);
+	float32x4_t p3 = vld1q_f32(parent[3].data);
+
+	for (unsigned c = 0; c < 3; c++)
+	{
+		const float *col = m + 3 * c * stride;
+		float32x4_t v = vmulq_n_f32(p0, col[0]);
+		v = vmlaq_n_f32(v, p1, col[stride]);
+		v = vmlaq_n_f32(v, p2, col[2 * stride]);
+		vst1q_f32(world[c].data, v);
+	}
+
+	float32x4_t v = vmlaq_n_f32(p3, p0, t.x);
+	v = vmlaq_n_f32(v, p1, t.y);
+	v = vmlaq_n_f32(v, p2, t.z);
+	vst1q_f32(world[3].data, v);
+#endif
+}
+}
+#endif
+
+void compute_model_transforms(mat4 *const *world, const Transform *const *local, const mat4 *const *parent, size_t count)
+{
+#if defined(__AVX2__) || defined(__SSE__) || defined(__ARM_NEON)
+	using L = TransformLanes;
+	constexpr unsigned W = L::Width;
+
+	for (size_t base = 0; base < count; base += W)
+	{
+		size_t n = std::min<size_t>(W, count - base);
+		alignas(32) float q[4][W];
+		alignas(32) float s[3][W];
+		alignas(32) float m[9][W];
+
+		// Gather into SoA. Unused lanes compute an identity rotation and are never read back.
+		for (unsigned i = 0; i < W; i++)
+		{
+			if (i < n)
+			{
+				auto &t = *local[base + i];
+				q[0][i] = t.rotation.x;
+				q[1][i] = t.rotation.y;
+				q[2][i] = t.rotation.z;
+				q[3][i] = t.rotation.w;
+				s[0][i] = t.scale.x;
+				s[1][i] = t.scale.y;
+				s[2][i] = t.scale.z;
+			}
+			else
+			{
+				q[0][i] = q[1][i] = q[2][i] = 0.0f;
+				q[3][i] = 1.0f;
+				s[0][i] = s[1][i] = s[2][i] = 1.0f;
+			}
+		}
+
+		auto x = L::load(q[0]);
+		auto y = L::load(q[1]);
+		auto z = L::load(q[2]);
+		auto w = L::load(q[3]);
+		auto x2 = L::add(x, x);
+		auto y2 = L::add(y, y);
+		auto z2 = L::add(z, z);
+
+		auto xx = L::mul(x, x2);
+		auto yy = L::mul(y, y2);
+		auto zz = L::mul(z, z2);
+		auto xy = L::mul(x, y2);
+		auto xz = L::mul(x, z2);
+		auto yz = L::mul(y, z2);
+		auto wx = L::mul(w, x2);
+		auto wy = L::mul(w, y2);
+		auto wz = L::mul(w, z2);
+
+		auto one = L::splat(1.0f);
+		auto sx = L::load(s[0]);
+		auto sy = L::load(s[1]);
+		auto sz = L::load(s[2]);
+
+		L::store(m[0], L::mul(L::sub(one, L::add(yy, zz)), sx));
+		L::store(m[1], L::mul(L::add(xy, wz), sx));
+		L::store(m[2], L::mul(L::sub(xz, wy), sx));
+		L::store(m[3], L::mul(L::sub(xy, wz), sy));
+		L::store(m[4], L::mul(L::sub(one, L::add(xx, zz)), sy));
+		L::store(m[5], L::mul(L::add(yz, wx), sy));
+		L::store(m[6], L::mul(L::add(xz, wy), sz));
+		L::store(m[7], L::mul(L::sub(yz, wx), sz));
+		L::store(m[8], L::mul(L::sub(one, L::add(xx, yy)), sz));
+
+		for (size_t i = 0; i < n; i++)
+			mul_affine(*world[base + i], *parent[base + i], &m[0][i], W, local[base + i]->translation);
+	}
+#else
+	for (size_t i = 0; i < count; i++)
+	{
+		auto &t = *local[i];
+		compute_model_transform(*world[i], t.scale, t.rotation, t.translation, *parent[i]);
+	}
+#endif
+}
+
 void compute_normal_transform(mat4 &normal, const mat4 &world)
 {
 	normal = mat4(transpose(inverse(mat3(world))));
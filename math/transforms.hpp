@@ -29,6 +29,13 @@ namespace Granite
 {
 class AABB;
 
+struct Transform
+{
+	vec3 scale;
+	vec3 translation;
+	quat rotation;
+};
+
 bool compute_plane_reflection(mat4 &projection, mat4 &view, vec3 camera_pos, vec3 center, vec3 normal, vec3 look_up,
                               float radius_up, float radius_other, float &z_near, float z_far);
 
@@ -37,6 +44,11 @@ bool compute_plane_refraction(mat4 &projection, mat4 &view, vec3 camera_pos, vec
 
 void compute_model_transform(mat4 &world, vec3 scale, quat rotation, vec3 translation, const mat4 &parent);
 
+// Batched compute_model_transform(). Computes world[i] = parent[i] * T * R * S for count nodes.
+// Rotation and scale are expanded for several nodes at once in SoA form,
+// and the parent multiply exploits that the local transform is affine.
+void compute_model_transforms(mat4 *const *world, const Transform *const *local, const mat4 *const *parent, size_t count);
+
 void compute_normal_transform(mat4 &normal, const mat4 &world);
 
 quat rotate_vector(vec3 from, vec3 to);
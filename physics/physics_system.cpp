@@ -21,10 +21,18 @@
  */
 
 #include "physics_system.hpp"
+#include "thread_group.hpp"
 #include <btBulletDynamicsCommon.h>
 #include <btBulletCollisionCommon.h>
 #include <BulletCollision/CollisionDispatch/btGhostObject.h>
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
 #include <BulletDynamics/Character/btKinematicCharacterController.h>
+#include <LinearMath/btThreads.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 namespace Granite
 {
@@ -50,6 +58,149 @@ static quat convert(const btQuaternion &q)
 	return { q.w(), q.x(), q.y(), q.z() };
 }
 
+// Runs Bullet's parallel loops on the foreground workers of the ThreadGroup.
+// Bullet nests parallel loops (islands, then constraint batches), and a worker waiting for a
+// nested loop would starve the pool. The calling thread therefore always processes grains itself,
+// and workers which arrive after all grains are claimed return without touching the loop body.
+class ThreadGroupTaskScheduler final : public btITaskScheduler
+{
+public:
+	ThreadGroupTaskScheduler()
+		: btITaskScheduler("Granite")
+	{
+	}
+
+	int getMaxNumThreads() const override
+	{
+		return BT_MAX_THREAD_COUNT;
+	}
+
+	int getNumThreads() const override
+	{
+		return num_threads;
+	}
+
+	void setNumThreads(int count) override
+	{
+		num_threads = std::max(1, std::min(count, int(BT_MAX_THREAD_COUNT)));
+	}
+
+	void parallelFor(int begin, int end, int grain, const btIParallelForBody &body) override
+	{
+		run(begin, end, grain, [&body](int range_begin, int range_end) {
+			body.forLoop(range_begin, range_end);
+		});
+	}
+
+	btScalar parallelSum(int begin, int end, int grain, const btIParallelSumBody &body) override
+	{
+		grain = std::max(grain, 1);
+		int num_grains = (end - begin + grain - 1) / grain;
+		if (num_grains <= 0)
+			return btScalar(0);
+
+		// Add up in grain order so the result does not depend on scheduling.
+		std::vector<btScalar> sums(num_grains);
+		run(begin, end, grain, [&](int range_begin, int range_end) {
+			sums[(range_begin - begin) / grain] = body.sumLoop(range_begin, range_end);
+		});
+
+		btScalar sum = btScalar(0);
+		for (auto s : sums)
+			sum += s;
+		return sum;
+	}
+
+private:
+	int num_threads = BT_MAX_THREAD_COUNT;
+
+	struct Loop
+	{
+		std::atomic<int> next;
+		std::atomic<int> done;
+	};
+
+	template <typename Func>
+	void run(int begin, int end, int grain, const Func &func)
+	{
+		grain = std::max(grain, 1);
+		int num_grains = (end - begin + grain - 1) / grain;
+		if (num_grains <= 0)
+			return;
+
+		auto *group = GRANITE_THREAD_GROUP();
+		unsigned num_workers = group ? group->get_num_foreground_threads() : 0;
+
+		// Every thread which runs a loop body claims one of Bullet's BT_MAX_THREAD_COUNT thread slots.
+		if (num_workers + 1 > BT_MAX_THREAD_COUNT)
+			num_workers = 0;
+		num_workers = std::min(num_workers, unsigned(num_threads - 1));
+		num_workers = std::min(num_workers, unsigned(num_grains - 1));
+
+		if (num_workers == 0)
+		{
+			func(begin, end);
+			return;
+		}
+
+		auto loop = std::make_shared<Loop>();
+		loop->next.store(0, std::memory_order_relaxed);
+		loop->done.store(0, std::memory_order_relaxed);
+
+		auto work = [loop, &func, begin, end, grain, num_grains]() {
+			int index;
+			while ((index = loop->next.fetch_add(1, std::memory_order_relaxed)) < num_grains)
+			{
+				int range_begin = begin + index * grain;
+				func(range_begin, std::min(range_begin + grain, end));
+				loop->done.fetch_add(1, std::memory_order_release);
+			}
+		};
+
+		auto task = group->create_task();
+		task->set_desc("physics-parallel-for");
+		for (unsigned i = 0; i < num_workers; i++)
+		{
+			auto worker = work;
+			task->enqueue_task(std::move(worker));
+		}
+		task->flush();
+
+		work();
+		while (loop->done.load(std::memory_order_acquire) != num_grains)
+			std::this_thread::yield();
+	}
+};
+
+static ThreadGroupTaskScheduler &get_task_scheduler()
+{
+	static ThreadGroupTaskScheduler scheduler;
+	return scheduler;
+}
+
+template <typename Func>
+struct ParallelForBody : btIParallelForBody
+{
+	explicit ParallelForBody(const Func &func_)
+		: func(func_)
+	{
+	}
+
+	void forLoop(int begin, int end) const override
+	{
+		func(begin, end);
+	}
+
+	const Func &func;
+};
+
+template <typename Func>
+static void parallel_for(size_t count, int grain, const Func &func)
+{
+	ParallelForBody<Func> body(func);
+	btParallelFor(0, int(count), grain, body);
+}
+
 struct PhysicsHandle
 {
 	Node *node = nullptr;
@@ -118,8 +269,8 @@ void PhysicsSystem::tick_callback(float)
 	new_collision_buffer.clear();
 }
 
-RaycastResult PhysicsSystem::query_closest_hit_ray(const vec3 &from, const vec3 &dir, float t,
-                                                   InteractionTypeFlags flags)
+static RaycastResult raycast_closest(const btCollisionWorld &world, const vec3 &from, const vec3 &dir, float t,
+                                     PhysicsSystem::InteractionTypeFlags flags)
 {
 	vec3 to = from + dir * t;
 	btVector3 ray_from_world = convert(from);
@@ -127,21 +278,21 @@ RaycastResult PhysicsSystem::query_closest_hit_ray(const vec3 &from, const vec3
 	btCollisionWorld::ClosestRayResultCallback cb(ray_from_world, ray_to_world);
 
 	cb.m_collisionFilterMask = 0;
-	if (flags == INTERACTION_TYPE_ALL_BITS)
+	if (flags == PhysicsSystem::INTERACTION_TYPE_ALL_BITS)
 		cb.m_collisionFilterMask = btBroadphaseProxy::AllFilter;
 	else
 	{
-		if (flags & INTERACTION_TYPE_STATIC_BIT)
+		if (flags & PhysicsSystem::INTERACTION_TYPE_STATIC_BIT)
 			cb.m_collisionFilterMask |= btBroadphaseProxy::StaticFilter;
-		if (flags & INTERACTION_TYPE_DYNAMIC_BIT)
+		if (flags & PhysicsSystem::INTERACTION_TYPE_DYNAMIC_BIT)
 			cb.m_collisionFilterMask |= btBroadphaseProxy::DefaultFilter;
-		if (flags & INTERACTION_TYPE_INVISIBLE_BIT)
+		if (flags & PhysicsSystem::INTERACTION_TYPE_INVISIBLE_BIT)
 			cb.m_collisionFilterMask |= btBroadphaseProxy::SensorTrigger;
-		if (flags & INTERACTION_TYPE_KINEMATIC_BIT)
+		if (flags & PhysicsSystem::INTERACTION_TYPE_KINEMATIC_BIT)
 			cb.m_collisionFilterMask |= btBroadphaseProxy::CharacterFilter;
 	}
 
-	world->rayTest(ray_from_world, ray_to_world, cb);
+	world.rayTest(ray_from_world, ray_to_world, cb);
 
 	RaycastResult result = {};
 	if (cb.hasHit())
@@ -165,14 +316,51 @@ RaycastResult PhysicsSystem::query_closest_hit_ray(const vec3 &from, const vec3
 	return result;
 }
 
+RaycastResult PhysicsSystem::query_closest_hit_ray(const vec3 &from, const vec3 &dir, float t,
+                                                   InteractionTypeFlags flags)
+{
+	return raycast_closest(*world, from, dir, t, flags);
+}
+
+void PhysicsSystem::query_closest_hit_rays(const RaycastQuery *queries, RaycastResult *results, size_t count)
+{
+	// The broadphase keeps a ray test stack per Bullet thread index, so concurrent ray tests are safe.
+	const btCollisionWorld &collision_world = *world;
+	parallel_for(count, 32, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			auto &query = queries[i];
+			results[i] = raycast_closest(collision_world, query.from, query.dir, query.length, query.mask);
+		}
+	});
+}
+
 PhysicsSystem::PhysicsSystem()
+	: PhysicsSystem(Options{})
 {
-	collision_config = std::make_unique<btDefaultCollisionConfiguration>();
-	dispatcher = std::make_unique<btCollisionDispatcher>(collision_config.get());
+}
+
+PhysicsSystem::PhysicsSystem(const Options &options)
+{
+	// The multithreaded dispatcher and world query the scheduler on creation.
+	// btSetTaskScheduler must be called on the main thread.
+	if (btGetTaskScheduler() != &get_task_scheduler())
+		btSetTaskScheduler(&get_task_scheduler());
+
+	btDefaultCollisionConstructionInfo collision_info;
+	if (options.max_persistent_manifolds)
+		collision_info.m_defaultMaxPersistentManifoldPoolSize = int(options.max_persistent_manifolds);
+	if (options.max_collision_algorithms)
+		collision_info.m_defaultMaxCollisionAlgorithmPoolSize = int(options.max_collision_algorithms);
+	collision_config = std::make_unique<btDefaultCollisionConfiguration>(collision_info);
+
+	dispatcher = std::make_unique<btCollisionDispatcherMt>(collision_config.get(), 40);
 	broadphase = std::make_unique<btDbvtBroadphase>();
-	solver = std::make_unique<btSequentialImpulseConstraintSolver>();
-	world = std::make_unique<btDiscreteDynamicsWorld>(dispatcher.get(), broadphase.get(),
-	                                                  solver.get(), collision_config.get());
+	solver_pool = std::make_unique<btConstraintSolverPoolMt>(BT_MAX_THREAD_COUNT);
+	solver = std::make_unique<btSequentialImpulseConstraintSolverMt>();
+	world = std::make_unique<btDiscreteDynamicsWorldMt>(dispatcher.get(), broadphase.get(),
+	                                                    solver_pool.get(), solver.get(),
+	                                                    collision_config.get());
 
 	world->setGravity(btVector3(0.0f, -9.81f, 0.0f));
 	world->setInternalTickCallback(tick_callback_wrapper, this);
@@ -181,6 +369,12 @@ PhysicsSystem::PhysicsSystem()
 	world->getPairCache()->setInternalGhostPairCallback(ghost_callback.get());
 }
 
+void PhysicsSystem::set_num_threads(unsigned num_threads)
+{
+	// Bullet has one global scheduler, so this applies to every PhysicsSystem.
+	get_task_scheduler().setNumThreads(num_threads ? int(num_threads) : BT_MAX_THREAD_COUNT);
+}
+
 void PhysicsSystem::set_scene(Scene *scene_)
 {
 	scene = scene_;
@@ -842,6 +1036,46 @@ struct TriggerContactResultCallback : btCollisionWorld::ContactResultCallback
 	}
 };
 
+static bool overlap_passes_filter(const btCollisionObject *ghost, const btCollisionObject *object)
+{
+	bool response = (ghost->getBroadphaseHandle()->m_collisionFilterGroup &
+	                 object->getBroadphaseHandle()->m_collisionFilterMask) != 0;
+
+	response = response &&
+			(object->getBroadphaseHandle()->m_collisionFilterGroup &
+			 ghost->getBroadphaseHandle()->m_collisionFilterMask) != 0;
+
+	return response;
+}
+
+static bool overlap_has_contact(btCollisionWorld &world, btPairCachingGhostObject *ghost,
+                                const btCollisionObject *object, btManifoldArray &manifolds)
+{
+	// Only reads state left behind by the last simulation step, so it is safe to run concurrently.
+	auto *pair = world.getPairCache()->findPair(ghost->getBroadphaseHandle(), object->getBroadphaseHandle());
+	if (!pair || !pair->m_algorithm)
+		return false;
+
+	manifolds.resize(0);
+	pair->m_algorithm->getAllContactManifolds(manifolds);
+	for (int i = 0; i < manifolds.size(); i++)
+	{
+		int num_contacts = manifolds[i]->getNumContacts();
+		for (int j = 0; j < num_contacts; j++)
+			if (manifolds[i]->getContactPoint(j).getDistance() <= 0.0f)
+				return true;
+	}
+
+	return false;
+}
+
+static bool overlap_nearphase(btCollisionWorld &world, btPairCachingGhostObject *ghost, const btCollisionObject *object)
+{
+	TriggerContactResultCallback cb;
+	world.contactPairTest(ghost, const_cast<btCollisionObject *>(object), cb);
+	return cb.hit;
+}
+
 bool PhysicsSystem::get_overlapping_objects(PhysicsHandle *handle, std::vector<PhysicsHandle *> &other,
                                             OverlapMethod method)
 {
@@ -854,18 +1088,11 @@ bool PhysicsSystem::get_overlapping_objects(PhysicsHandle *handle, std::vector<P
 
 	int count = pairs.size();
 	other.reserve(count);
+	btManifoldArray manifolds;
 	for (int i = 0; i < count; i++)
 	{
 		auto *object = pairs[i];
-
-		bool response = (ghost->getBroadphaseHandle()->m_collisionFilterGroup &
-		                 object->getBroadphaseHandle()->m_collisionFilterMask) != 0;
-
-		response = response &&
-				(object->getBroadphaseHandle()->m_collisionFilterGroup &
-				 ghost->getBroadphaseHandle()->m_collisionFilterMask) != 0;
-
-		if (!response)
+		if (!overlap_passes_filter(ghost, object))
 			continue;
 
 		if (method == OverlapMethod::Broadphase)
@@ -874,9 +1101,12 @@ bool PhysicsSystem::get_overlapping_objects(PhysicsHandle *handle, std::vector<P
 		}
 		else if (method == OverlapMethod::Nearphase)
 		{
-			TriggerContactResultCallback cb;
-			world->contactPairTest(ghost, object, cb);
-			if (cb.hit)
+			if (overlap_nearphase(*world, ghost, object))
+				other.push_back(static_cast<PhysicsHandle *>(object->getUserPointer()));
+		}
+		else if (method == OverlapMethod::Manifold)
+		{
+			if (overlap_has_contact(*world, ghost, object, manifolds))
 				other.push_back(static_cast<PhysicsHandle *>(object->getUserPointer()));
 		}
 	}
@@ -884,6 +1114,75 @@ bool PhysicsSystem::get_overlapping_objects(PhysicsHandle *handle, std::vector<P
 	return true;
 }
 
+void PhysicsSystem::get_overlapping_objects(PhysicsHandle *const *handles, size_t count,
+                                            std::vector<PhysicsHandle *> &overlaps, std::vector<uint32_t> &offsets,
+                                            OverlapMethod method)
+{
+	overlaps.clear();
+	offsets.resize(count + 1);
+
+	// Reserve room for every broadphase pair up front, so each query can write its candidates
+	// to its own slot range without synchronization.
+	uint32_t total = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		offsets[i] = total;
+		auto *ghost = btPairCachingGhostObject::upcast(handles[i]->bt_object);
+		if (ghost)
+			total += uint32_t(ghost->getOverlappingPairs().size());
+	}
+	offsets[count] = total;
+
+	overlap_candidates.resize(total);
+	overlap_counts.resize(count);
+
+	auto &collision_world = *world;
+	parallel_for(count, 8, [&](int begin, int end) {
+		btManifoldArray manifolds;
+		for (int i = begin; i < end; i++)
+		{
+			uint32_t written = 0;
+			auto *ghost = btPairCachingGhostObject::upcast(handles[i]->bt_object);
+			if (ghost)
+			{
+				auto &pairs = ghost->getOverlappingPairs();
+				int num_pairs = pairs.size();
+				const btCollisionObject **out = overlap_candidates.data() + offsets[i];
+
+				for (int j = 0; j < num_pairs; j++)
+				{
+					auto *object = pairs[j];
+					if (!overlap_passes_filter(ghost, object))
+						continue;
+					if (method == OverlapMethod::Manifold && !overlap_has_contact(collision_world, ghost, object, manifolds))
+						continue;
+					out[written++] = object;
+				}
+			}
+			overlap_counts[i] = written;
+		}
+	});
+
+	// Compact the slot ranges. Nearphase contact tests allocate from the dispatcher and must stay on this thread.
+	overlaps.reserve(total);
+	for (size_t i = 0; i < count; i++)
+	{
+		const btCollisionObject *const *candidates = overlap_candidates.data() + offsets[i];
+		uint32_t num_candidates = overlap_counts[i];
+		auto *ghost = btPairCachingGhostObject::upcast(handles[i]->bt_object);
+
+		offsets[i] = uint32_t(overlaps.size());
+		for (uint32_t j = 0; j < num_candidates; j++)
+		{
+			auto *object = candidates[j];
+			if (method == OverlapMethod::Nearphase && !overlap_nearphase(collision_world, ghost, object))
+				continue;
+			overlaps.push_back(static_cast<PhysicsHandle *>(object->getUserPointer()));
+		}
+	}
+	offsets[count] = uint32_t(overlaps.size());
+}
+
 PhysicsComponent::~PhysicsComponent()
 {
 	if (handle)
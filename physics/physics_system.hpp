@@ -32,13 +32,15 @@
 class btDefaultCollisionConfiguration;
 class btCollisionDispatcher;
 struct btDbvtBroadphase;
-class btSequentialImpulseConstraintSolver;
+class btConstraintSolverPoolMt;
+class btSequentialImpulseConstraintSolverMt;
 class btDiscreteDynamicsWorld;
 class btCollisionShape;
 class btBvhTriangleMeshShape;
 class btTriangleIndexVertexArray;
 class btGhostPairCallback;
 class btDynamicsWorld;
+class btCollisionObject;
 
 namespace Granite
 {
@@ -147,7 +149,16 @@ struct RaycastResult
 class PhysicsSystem final : public PhysicsSystemInterface
 {
 public:
+	struct Options
+	{
+		// Collision algorithms and manifolds come from fixed pools shared by all threads,
+		// and fall back to the global heap once exhausted. Zero keeps Bullet's defaults.
+		unsigned max_persistent_manifolds = 0;
+		unsigned max_collision_algorithms = 0;
+	};
+
 	PhysicsSystem();
+	explicit PhysicsSystem(const Options &options);
 	~PhysicsSystem();
 	void set_scene(Scene *scene);
 
@@ -242,6 +253,11 @@ public:
 	void iterate(double frame_time);
 	void tick_callback(float tick_time);
 
+	// Collision detection and island solving in iterate() as well as batched queries
+	// are spread over the foreground workers of the ThreadGroup.
+	// 1 keeps everything on the calling thread, 0 uses every worker.
+	void set_num_threads(unsigned num_threads);
+
 	enum InteractionTypeFlagBits
 	{
 		INTERACTION_TYPE_STATIC_BIT = 1 << 0,
@@ -255,6 +271,18 @@ public:
 	RaycastResult query_closest_hit_ray(const vec3 &from, const vec3 &dir, float length,
 	                                    InteractionTypeFlags mask = INTERACTION_TYPE_ALL_BITS);
 
+	struct RaycastQuery
+	{
+		vec3 from;
+		vec3 dir;
+		float length;
+		InteractionTypeFlags mask = INTERACTION_TYPE_ALL_BITS;
+	};
+
+	// Runs the queries in parallel, results[i] belongs to queries[i].
+	// Misses leave their result zeroed like query_closest_hit_ray() does.
+	void query_closest_hit_rays(const RaycastQuery *queries, RaycastResult *results, size_t count);
+
 	void add_point_constraint(PhysicsHandle *handle, const vec3 &local_pivot);
 	void add_point_constraint(PhysicsHandle *handle0, PhysicsHandle *handle1,
 	                          const vec3 &local_pivot0, const vec3 &local_pivot1,
@@ -263,17 +291,29 @@ public:
 	enum class OverlapMethod
 	{
 		Broadphase,
-		Nearphase
+		Nearphase,
+		// Uses the contact points computed by the last iterate() instead of running a new contact test.
+		// Cheaper than Nearphase, and the only exact method which runs in parallel in batched queries.
+		Manifold
 	};
 
 	bool get_overlapping_objects(PhysicsHandle *handle, std::vector<PhysicsHandle *> &other,
 	                             OverlapMethod method = OverlapMethod::Nearphase);
 
+	// Overlaps of many ghost objects at once. The overlaps of handles[i] are overlaps[offsets[i]]
+	// up to overlaps[offsets[i + 1]], so offsets receives count + 1 entries.
+	// Handles which are not ghost objects get an empty range.
+	// Nearphase contact tests are not thread-safe in Bullet and run on the calling thread.
+	void get_overlapping_objects(PhysicsHandle *const *handles, size_t count,
+	                             std::vector<PhysicsHandle *> &overlaps, std::vector<uint32_t> &offsets,
+	                             OverlapMethod method = OverlapMethod::Nearphase);
+
 private:
 	std::unique_ptr<btDefaultCollisionConfiguration> collision_config;
 	std::unique_ptr<btCollisionDispatcher> dispatcher;
 	std::unique_ptr<btDbvtBroadphase> broadphase;
-	std::unique_ptr<btSequentialImpulseConstraintSolver> solver;
+	std::unique_ptr<btConstraintSolverPoolMt> solver_pool;
+	std::unique_ptr<btSequentialImpulseConstraintSolverMt> solver;
 	std::unique_ptr<btDiscreteDynamicsWorld> world;
 
 	Util::ObjectPool<PhysicsHandle> handle_pool;
@@ -286,6 +326,8 @@ private:
 	std::unique_ptr<btGhostPairCallback> ghost_callback;
 
 	btCollisionShape *create_shape(const ConvexMeshPart &part);
+	std::vector<const btCollisionObject *> overlap_candidates;
+	std::vector<uint32_t> overlap_counts;
 	Scene *scene = nullptr;
 	const ComponentGroupVector<PhysicsComponent, ForceComponent> *forces = nullptr;
 };
@@ -25,7 +25,9 @@
 #include "device.hpp"
 #include "event.hpp"
 #include "sprite.hpp"
+#include "sprite_batch.hpp"
 #include <float.h>
+#include <string.h>
 
 using namespace Vulkan;
 using namespace Util;
@@ -76,6 +78,8 @@ void FlatRenderer::on_module_created(const DeviceShaderModuleReadyEvent &created
 		s.bake_base_defines();
 
 	device = &dev;
+	// Retained batches reference programs of the old suites.
+	retained_epoch++;
 }
 
 void FlatRenderer::on_module_destroyed(const DeviceShaderModuleReadyEvent &)
@@ -84,6 +88,7 @@ void FlatRenderer::on_module_destroyed(const DeviceShaderModuleReadyEvent &)
 
 void FlatRenderer::begin()
 {
+	assert(recordings.empty());
 	queue.reset();
 	queue.set_shader_suites(suite);
 }
@@ -307,9 +312,218 @@ void FlatRenderer::render_text(const Font &font, const char *text, const vec3 &o
 {
 	if (color.w <= 0.0f)
 		return;
-	font.render_text(queue, text, offset, size,
-	                 scissor_stack.back().offset, scissor_stack.back().size,
-	                 color, alignment);
+	if (recordings.empty())
+	{
+		font.render_text(queue, text, offset, size,
+		                 scissor_stack.back().offset, scissor_stack.back().size,
+		                 color, alignment);
+	}
+	else
+	{
+		Font::RenderResult result;
+		font.render_text(queue, text, offset, size,
+		                 scissor_stack.back().offset, scissor_stack.back().size,
+		                 color, alignment, &result);
+
+		auto &atlas = font.get_atlas();
+		captured_atlases.push_back({ &atlas, atlas.get_generation(result.page_mask), result.page_mask });
+
+		// Missing glyphs will show up later, so don't let this text be replayed as-is.
+		if (!result.complete)
+			for (auto &recording : recordings)
+				recording.complete = false;
+	}
+}
+
+void FlatRenderBatch::reset()
+{
+	draws.clear();
+	sprite_infos.clear();
+	line_infos.clear();
+	quads.clear();
+	line_positions.clear();
+	line_colors.clear();
+	atlases.clear();
+	images.clear();
+	num_sprite_draws = 0;
+	num_line_draws = 0;
+	key = 0;
+	epoch = 0;
+	valid = false;
+}
+
+Util::Hash FlatRenderer::get_retained_key(Util::Hash key) const
+{
+	// Recorded clip rects depend on the scissor the batch is rendered in.
+	auto &current = scissor_stack.back();
+	Hasher h(key);
+	h.f32(current.offset.x);
+	h.f32(current.offset.y);
+	h.f32(current.size.x);
+	h.f32(current.size.y);
+	return h.get();
+}
+
+void FlatRenderer::begin_retained(FlatRenderBatch &batch, Util::Hash key)
+{
+	if (recordings.empty())
+		queue.set_capture_target(&captured_draws);
+
+	recordings.push_back({ &batch, get_retained_key(key),
+	                       captured_draws.size(), captured_atlases.size(), captured_images.size(),
+	                       true });
+}
+
+void FlatRenderer::end_retained()
+{
+	assert(!recordings.empty());
+	auto recording = recordings.back();
+	recordings.pop_back();
+	store_retained(*recording.batch, recording);
+
+	if (recordings.empty())
+	{
+		queue.set_capture_target(nullptr);
+		captured_draws.clear();
+		captured_atlases.clear();
+		captured_images.clear();
+	}
+}
+
+void FlatRenderer::store_retained(FlatRenderBatch &batch, const Recording &recording)
+{
+	batch.reset();
+	batch.valid = recording.complete;
+
+	for (size_t i = recording.first_draw; i < captured_draws.size(); i++)
+	{
+		auto &captured = captured_draws[i];
+		FlatRenderBatch::Draw draw = { captured.queue, captured.instance_key, captured.sorting_key, captured.render, 0, 0, 0 };
+
+		if (captured.render == RenderFunctions::sprite_render)
+		{
+			auto *instance = static_cast<const SpriteInstanceInfo *>(captured.instance_data);
+			draw.info_index = uint32_t(batch.sprite_infos.size());
+			draw.first = uint32_t(batch.quads.size());
+			draw.count = instance->count;
+			batch.sprite_infos.push_back(*static_cast<const SpriteRenderInfo *>(captured.render_info));
+			batch.quads.insert(batch.quads.end(), instance->quads, instance->quads + instance->count);
+			batch.num_sprite_draws++;
+		}
+		else if (captured.render == RenderFunctions::line_strip_render)
+		{
+			auto *lines = static_cast<const LineInfo *>(captured.instance_data);
+			draw.info_index = uint32_t(batch.line_infos.size());
+			draw.first = uint32_t(batch.line_positions.size());
+			draw.count = lines->count;
+			batch.line_infos.push_back(*static_cast<const LineStripInfo *>(captured.render_info));
+			batch.line_positions.insert(batch.line_positions.end(), lines->positions, lines->positions + lines->count);
+			batch.line_colors.insert(batch.line_colors.end(), lines->colors, lines->colors + lines->count);
+			batch.num_line_draws++;
+		}
+		else
+		{
+			// Instance data of arbitrary renderables is opaque to us, so it cannot be retained.
+			batch.valid = false;
+			continue;
+		}
+
+		batch.draws.push_back(draw);
+	}
+
+	batch.atlases.assign(captured_atlases.begin() + ptrdiff_t(recording.first_atlas), captured_atlases.end());
+	batch.images.assign(captured_images.begin() + ptrdiff_t(recording.first_image), captured_images.end());
+	batch.key = recording.key;
+	batch.epoch = retained_epoch;
+}
+
+bool FlatRenderer::replay_retained(FlatRenderBatch &batch, Util::Hash key)
+{
+	if (!batch.valid || batch.epoch != retained_epoch || batch.key != get_retained_key(key))
+		return false;
+
+	for (auto &dep : batch.atlases)
+		if (dep.atlas->get_generation(dep.page_mask) != dep.generation)
+			return false;
+
+	if (!batch.images.empty())
+	{
+		auto &res = device->get_resource_manager();
+		for (auto &dep : batch.images)
+			if (res.get_image_view(dep.id) != dep.view)
+				return false;
+	}
+
+	for (auto &dep : batch.atlases)
+		dep.atlas->mark_pages_used(dep.page_mask);
+
+	// Instance data is copied in bulk, the draws only point into it.
+	QuadData *quads = nullptr;
+	SpriteInstanceInfo *sprite_instances = nullptr;
+	if (batch.num_sprite_draws)
+	{
+		sprite_instances = queue.allocate_many<SpriteInstanceInfo>(batch.num_sprite_draws);
+		if (!batch.quads.empty())
+		{
+			quads = static_cast<QuadData *>(queue.allocate(batch.quads.size() * sizeof(QuadData), alignof(QuadData)));
+			memcpy(quads, batch.quads.data(), batch.quads.size() * sizeof(QuadData));
+		}
+	}
+
+	vec3 *line_positions = nullptr;
+	vec4 *line_colors = nullptr;
+	LineInfo *lines = nullptr;
+	if (batch.num_line_draws)
+	{
+		lines = queue.allocate_many<LineInfo>(batch.num_line_draws);
+		if (!batch.line_positions.empty())
+		{
+			line_positions = static_cast<vec3 *>(queue.allocate(batch.line_positions.size() * sizeof(vec3), alignof(vec3)));
+			line_colors = static_cast<vec4 *>(queue.allocate(batch.line_colors.size() * sizeof(vec4), alignof(vec4)));
+			memcpy(line_positions, batch.line_positions.data(), batch.line_positions.size() * sizeof(vec3));
+			memcpy(line_colors, batch.line_colors.data(), batch.line_colors.size() * sizeof(vec4));
+		}
+	}
+
+	for (auto &draw : batch.draws)
+	{
+		if (draw.render == RenderFunctions::sprite_render)
+		{
+			auto *instance = sprite_instances++;
+			instance->quads = quads + draw.first;
+			instance->count = draw.count;
+			auto *sprite_data = queue.push<SpriteRenderInfo>(draw.queue, draw.instance_key, draw.sorting_key,
+			                                                 draw.render, instance);
+			if (sprite_data)
+				*sprite_data = batch.sprite_infos[draw.info_index];
+		}
+		else
+		{
+			auto *line = lines++;
+			line->positions = line_positions + draw.first;
+			line->colors = line_colors + draw.first;
+			line->count = draw.count;
+			auto *strip_data = queue.push<LineStripInfo>(draw.queue, draw.instance_key, draw.sorting_key,
+			                                             draw.render, line);
+			if (strip_data)
+				*strip_data = batch.line_infos[draw.info_index];
+		}
+	}
+
+	// An enclosing recording inherits the dependencies.
+	if (!recordings.empty())
+	{
+		captured_atlases.insert(captured_atlases.end(), batch.atlases.begin(), batch.atlases.end());
+		captured_images.insert(captured_images.end(), batch.images.begin(), batch.images.end());
+	}
+
+	return true;
+}
+
+void FlatRenderer::add_retained_dependency(AssetID id)
+{
+	if (!recordings.empty())
+		captured_images.push_back({ id, get_device().get_resource_manager().get_image_view(id) });
 }
 
 void FlatRenderer::push_sprite(const SpriteInfo &info)
@@ -323,4 +537,67 @@ void FlatRenderer::push_sprites(const SpriteList &visible)
 		vis.sprite->get_sprite_render_info(vis.transform, queue);
 }
 
+void FlatRenderer::push_sprite_batch(SpriteBatch &batch)
+{
+	batch.prepare();
+	// Batches reuse buffers across frames, so tie them to the device generation like retained UI batches.
+	if (!batch.upload(get_device(), retained_epoch))
+		return;
+
+	auto &res = device->get_resource_manager();
+	auto &runs = batch.get_runs();
+	auto *instances = queue.allocate_many<SpriteBatchInstanceInfo>(runs.size());
+
+	for (size_t i = 0; i < runs.size(); i++)
+	{
+		auto &run = runs[i];
+		auto &group = batch.get_group(run.group);
+		bool transparent = group.pipeline == DrawPipeline::AlphaBlend;
+		auto queue_type = transparent ? Queue::Transparent : Queue::Opaque;
+		bool textured = bool(group.textures[0]);
+
+		instances[i].first = run.first;
+		instances[i].count = run.count;
+
+		Hasher h;
+		h.string("sprite-batch");
+		h.s32(ecast(group.pipeline));
+		h.u32(group.shader_flags);
+		h.s32(textured);
+		auto pipe_hash = h.get();
+		h.pointer(&batch);
+		h.u32(run.group);
+		auto instance_key = h.get();
+		auto sorting_key = RenderInfo::get_sprite_sort_key(queue_type, pipe_hash, instance_key, run.layer);
+
+		auto *info = queue.push<SpriteBatchRenderInfo>(queue_type, instance_key, sorting_key,
+		                                               RenderFunctions::sprite_batch_render, &instances[i]);
+
+		if (info)
+		{
+			if (textured)
+				info->textures[0] = res.get_image_view(group.textures[0]);
+			if (group.textures[1])
+				info->textures[1] = res.get_image_view(group.textures[1]);
+			info->sampler = group.sampler;
+			info->clip_quad = group.clip;
+			info->layout = batch.get_stream_layout();
+			info->array_texture = info->textures[0] &&
+			                      info->textures[0]->get_create_info().view_type == VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+
+			uint32_t flags = group.shader_flags;
+			if (info->array_texture)
+				flags |= Sprite::ARRAY_TEXTURE_BIT;
+
+			info->program = suite[ecast(RenderableType::Sprite)].get_program(
+				VariantSignatureKey::build(group.pipeline,
+				                           MESH_ATTRIBUTE_POSITION_BIT |
+				                           MESH_ATTRIBUTE_VERTEX_COLOR_BIT |
+				                           (textured ? MESH_ATTRIBUTE_UV_BIT : 0),
+				                           textured ? MATERIAL_TEXTURE_BASE_COLOR_BIT : 0,
+				                           flags));
+		}
+	}
+}
+
 }
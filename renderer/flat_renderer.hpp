@@ -70,6 +70,57 @@ struct LineStripInfo
 	ivec4 clip = ivec4(0, 0, 0x4000, 0x4000);
 };
 
+class SpriteBatch;
+
+// Draws recorded between FlatRenderer::begin_retained() and end_retained(),
+// which can be replayed in later frames as long as nothing they depend on changed.
+class FlatRenderBatch
+{
+public:
+	void reset();
+
+private:
+	friend class FlatRenderer;
+
+	struct Draw
+	{
+		Queue queue;
+		Util::Hash instance_key;
+		uint64_t sorting_key;
+		RenderFunc render;
+		uint32_t info_index;
+		uint32_t first;
+		uint32_t count;
+	};
+
+	struct AtlasDependency
+	{
+		GlyphAtlas *atlas;
+		uint64_t generation;
+		uint32_t page_mask;
+	};
+
+	struct ImageDependency
+	{
+		AssetID id;
+		const Vulkan::ImageView *view;
+	};
+
+	std::vector<Draw> draws;
+	std::vector<SpriteRenderInfo> sprite_infos;
+	std::vector<LineStripInfo> line_infos;
+	std::vector<QuadData> quads;
+	std::vector<vec3> line_positions;
+	std::vector<vec4> line_colors;
+	std::vector<AtlasDependency> atlases;
+	std::vector<ImageDependency> images;
+	unsigned num_sprite_draws = 0;
+	unsigned num_line_draws = 0;
+	Util::Hash key = 0;
+	uint64_t epoch = 0;
+	bool valid = false;
+};
+
 class FlatRenderer : public EventHandler
 {
 public:
@@ -79,6 +130,10 @@ public:
 	void push_sprite(const SpriteInfo &info);
 	void push_sprites(const SpriteList &visible);
 
+	// Submits one queue entry per run of equal state instead of one per sprite.
+	// The batch must stay alive until flush().
+	void push_sprite_batch(SpriteBatch &batch);
+
 	void render_quad(const vec3 &offset, const vec2 &size, const vec4 &color);
 
 	void render_textured_quad(const Vulkan::ImageView &view, const vec3 &offset, const vec2 &size,
@@ -100,6 +155,18 @@ public:
 	void push_scissor(const vec2 &offset, const vec2 &size);
 	void pop_scissor();
 
+	// Records everything rendered until end_retained() into batch. Recordings can nest.
+	// key must identify all inputs of the recorded draws, the current scissor is accounted for.
+	void begin_retained(FlatRenderBatch &batch, Util::Hash key);
+	void end_retained();
+
+	// Pushes the draws of a previous recording in one go.
+	// Returns false if the batch is stale and must be recorded again.
+	bool replay_retained(FlatRenderBatch &batch, Util::Hash key);
+
+	// Recordings are invalidated when the resource manager swaps the view of the asset, e.g. once it becomes resident.
+	void add_retained_dependency(AssetID id);
+
 	void set_opaque_state_callback(std::function<void (Vulkan::CommandBuffer &)> cb);
 	void set_transparent_state_callback(std::function<void (Vulkan::CommandBuffer &)> cb);
 
@@ -123,6 +190,24 @@ private:
 	};
 	std::vector<Scissor> scissor_stack;
 
+	struct Recording
+	{
+		FlatRenderBatch *batch;
+		Util::Hash key;
+		size_t first_draw;
+		size_t first_atlas;
+		size_t first_image;
+		bool complete;
+	};
+	std::vector<Recording> recordings;
+	std::vector<RenderQueue::CapturedDraw> captured_draws;
+	std::vector<FlatRenderBatch::AtlasDependency> captured_atlases;
+	std::vector<FlatRenderBatch::ImageDependency> captured_images;
+	uint64_t retained_epoch = 1;
+
+	Util::Hash get_retained_key(Util::Hash key) const;
+	void store_retained(FlatRenderBatch &batch, const Recording &recording);
+
 	void render_quad(const Vulkan::ImageView *view, unsigned layer, Vulkan::StockSampler sampler,
 	                 const vec3 &offset, const vec2 &size, const vec2 &tex_offset, const vec2 &tex_size, const vec4 &color,
 	                 DrawPipeline pipeline);
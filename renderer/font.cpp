@@ -20,13 +20,10 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#define NOMINMAX
-#include "stb_truetype.h"
 #include "font.hpp"
-#include <stdexcept>
-#include "filesystem.hpp"
 #include "device.hpp"
 #include "sprite.hpp"
+#include "string_helpers.hpp"
 #include <string.h>
 #include <float.h>
 
@@ -35,89 +32,92 @@ using namespace Util;
 
 namespace Granite
 {
-struct Font::Baked
+Font::Font(const std::string &path, unsigned size, GlyphAtlas::Mode mode)
+	: Font(make_handle<GlyphAtlas>(path, mode), size)
 {
-	stbtt_bakedchar chars[128 - 32];
-};
+}
 
-Font::~Font()
+Font::Font(GlyphAtlasHandle atlas_, unsigned size)
+	: atlas(std::move(atlas_)), font_height(size)
 {
+	layout_cache.set_total_cost(LayoutCacheGlyphBudget);
 }
 
-Font::Font(const std::string &path, unsigned size)
+const Font::TextLayout &Font::get_layout(const char *text) const
 {
-	baked_chars.reset(new Baked);
+	Hasher hasher;
+	hasher.string(text);
+	auto hash = hasher.get();
 
-	auto file = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
-	if (!file)
-		throw std::runtime_error("Failed to open font.");
+	auto *cached = layout_cache.find_and_mark_as_recent(hash);
+	if (cached && cached->text == text)
+		return *cached;
 
-	auto *mapped = file->data();
-	if (!mapped)
-		throw std::runtime_error("Failed to map font.");
+	// Prune before inserting, so the returned layout cannot be evicted right away.
+	layout_cache.prune();
+	size_t len = strlen(text);
+	auto &layout = *layout_cache.allocate(hash, len + 1);
+	layout.text = text;
+	layout.glyphs.clear();
+	layout.glyphs.reserve(len);
 
-	unsigned multiplier = 4;
-	bool success = false;
+	bool snap = atlas->get_mode() == GlyphAtlas::Mode::Bitmap;
+	float line_y = float(font_height);
+	vec2 pen = vec2(0.0f, line_y);
+	float maximum_x = -FLT_MAX;
+	uint32_t prev_codepoint = 0;
 
-	do
+	while (*text)
 	{
-		width = size * multiplier;
-		height = size * multiplier;
-		bitmap.resize(width * height);
-		int res = stbtt_BakeFontBitmap(static_cast<const unsigned char *>(mapped),
-		                               0, size,
-		                               bitmap.data(), width, height,
-		                               32, 96,
-		                               baked_chars->chars);
-
-		if (res <= 0)
-			multiplier++;
-		else
+		uint32_t codepoint = utf8_next_codepoint(text);
+		if (codepoint == '\n')
 		{
-			height = unsigned(res);
-			success = true;
+			line_y += float(font_height);
+			pen = vec2(0.0f, line_y);
+			prev_codepoint = 0;
+			continue;
 		}
-	} while (!success && multiplier <= 32);
-
-	if (!success)
-		throw std::runtime_error("Failed to bake bitmap.");
-
-	font_height = size;
-	EVENT_MANAGER_REGISTER_LATCH(Font, on_device_created, on_device_destroyed, DeviceCreatedEvent);
-}
-
-vec2 Font::get_text_geometry(const char *text) const
-{
-	if (!*text)
-		return vec2(0);
+		else if (codepoint < 32)
+			continue;
 
-	vec2 off = vec2(0.0f);
-	off.y += font_height;
+		if (prev_codepoint)
+			pen.x += atlas->get_kerning(prev_codepoint, codepoint, font_height);
 
-	vec2 cached = off;
-	vec2 minimum = vec2(FLT_MAX);
-	vec2 maximum = vec2(-FLT_MAX);
+		auto metrics = atlas->get_metrics(codepoint, font_height);
+		LayoutGlyph glyph;
+		glyph.codepoint = codepoint;
 
-	while (*text)
-	{
-		stbtt_aligned_quad q;
-		if (*text == '\n')
+		if (snap)
 		{
-			cached.y += font_height;
-			off = cached;
+			// Same rounding as stbtt_GetBakedQuad, so bitmap glyphs land on texel centers.
+			glyph.pos_min = floor(pen + vec2(metrics.x0, metrics.y0) + 0.5f);
+			glyph.pos_max = glyph.pos_min + vec2(metrics.x1 - metrics.x0, metrics.y1 - metrics.y0);
 		}
-		else if (*text >= 32)
+		else
 		{
-			stbtt_GetBakedQuad(baked_chars->chars, width, height, *text - 32, &off.x, &off.y, &q, 1);
-			minimum = min(minimum, vec2(q.x0, q.y0));
-			minimum = min(minimum, vec2(q.x1, q.y1));
-			maximum = max(maximum, vec2(q.x0, q.y0));
-			maximum = max(maximum, vec2(q.x1, q.y1));
+			glyph.pos_min = pen + vec2(metrics.x0, metrics.y0);
+			glyph.pos_max = pen + vec2(metrics.x1, metrics.y1);
 		}
-		text++;
+
+		maximum_x = max(maximum_x, glyph.pos_max.x);
+		if (glyph.pos_max.x > glyph.pos_min.x && glyph.pos_max.y > glyph.pos_min.y)
+			layout.glyphs.push_back(glyph);
+
+		pen.x += metrics.advance;
+		prev_codepoint = codepoint;
 	}
 
-	return ceil(vec2(maximum.x, cached.y));
+	if (maximum_x == -FLT_MAX)
+		maximum_x = 0.0f;
+	layout.geometry = ceil(vec2(maximum_x, line_y));
+	return layout;
+}
+
+vec2 Font::get_text_geometry(const char *text) const
+{
+	if (!*text)
+		return vec2(0);
+	return get_layout(text).geometry;
 }
 
 vec2 Font::get_aligned_offset(Alignment alignment, vec2 text_geometry, vec2 target_geometry) const
@@ -168,70 +168,83 @@ vec2 Font::get_aligned_offset(Alignment alignment, vec2 text_geometry, vec2 targ
 void Font::render_text(RenderQueue &queue, const char *text, const vec3 &offset, const vec2 &size,
                        const vec2 &clip_offset, const vec2 &clip_size,
                        const vec4 &color,
-                       Alignment alignment) const
+                       Alignment alignment,
+                       RenderResult *result) const
 {
 	if (!*text)
 		return;
 
-	vec2 geometry = get_text_geometry(text);
-	vec2 alignment_offset = get_aligned_offset(alignment, geometry, size);
+	auto *view = atlas->get_view();
+	if (!view)
+	{
+		if (result)
+			result->complete = false;
+		return;
+	}
+
+	atlas->flush_uploads();
+
+	auto &layout = get_layout(text);
+	if (layout.glyphs.empty())
+		return;
+
+	bool sdf = atlas->get_mode() == GlyphAtlas::Mode::SDF;
+	vec2 origin = offset.xy() + get_aligned_offset(alignment, layout.geometry, size);
+	if (!sdf)
+		origin = round(origin);
 
-	size_t len = strlen(text);
 	SpriteRenderInfo sprite;
-	sprite.textures[0] = &texture->get_view();
+	sprite.textures[0] = view;
 	sprite.sampler = StockSampler::LinearWrap;
 
 	auto *instance_data = queue.allocate_one<SpriteInstanceInfo>();
-	auto *quads = queue.allocate_many<QuadData>(len);
+	auto *quads = queue.allocate_many<QuadData>(layout.glyphs.size());
 	instance_data->quads = quads;
 	instance_data->count = 0; // Will be accumulated in the loop.
 
-	vec2 off = offset.xy();
-	off.y += font_height;
-	vec2 cached = off;
-
 	vec2 min_rect = vec2(FLT_MAX);
 	vec2 max_rect = vec2(-FLT_MAX);
+	u16vec4 half_color = floatToHalf(color);
 
-	while (*text)
+	for (auto &glyph : layout.glyphs)
 	{
-		stbtt_aligned_quad q;
-		if (*text == '\n')
-		{
-			cached.y += font_height;
-			off = cached;
-		}
-		else if (*text >= 32)
+		uvec4 rect;
+		if (!atlas->get_atlas_rect(glyph.codepoint, font_height, rect))
 		{
-			stbtt_GetBakedQuad(baked_chars->chars, width, height, *text - 32, &off.x, &off.y, &q, 1);
-
-			q.x0 += alignment_offset.x;
-			q.x1 += alignment_offset.x;
-			q.y0 += alignment_offset.y;
-			q.y1 += alignment_offset.y;
-
-			auto &quad = quads[instance_data->count++];
-			quad.color = floatToHalf(color);
-			quad.rotation[0] = 1.0f;
-			quad.rotation[1] = 0.0f;
-			quad.rotation[2] = 0.0f;
-			quad.rotation[3] = 1.0f;
-			quad.layer = offset.z;
-			quad.pos_off_x = q.x0;
-			quad.pos_off_y = q.y0;
-			quad.pos_scale_x = q.x1 - q.x0;
-			quad.pos_scale_y = q.y1 - q.y0;
-			quad.tex_off_x = muglm::round(q.s0 * width);
-			quad.tex_off_y = muglm::round(q.t0 * height);
-			quad.tex_scale_x = muglm::round(q.s1 * width) - quad.tex_off_x;
-			quad.tex_scale_y = muglm::round(q.t1 * height) - quad.tex_off_y;
-
-			max_rect = max(max_rect, vec2(q.x1, q.y1));
-			min_rect = min(min_rect, vec2(q.x0, q.y0));
+			if (result)
+				result->complete = false;
+			continue;
 		}
-		text++;
+
+		if (result)
+			result->page_mask |= atlas->get_page_mask(rect);
+
+		vec2 pos_min = origin + glyph.pos_min;
+		vec2 pos_max = origin + glyph.pos_max;
+
+		auto &quad = quads[instance_data->count++];
+		quad.color = half_color;
+		quad.rotation[0] = 1.0f;
+		quad.rotation[1] = 0.0f;
+		quad.rotation[2] = 0.0f;
+		quad.rotation[3] = 1.0f;
+		quad.layer = offset.z;
+		quad.pos_off_x = pos_min.x;
+		quad.pos_off_y = pos_min.y;
+		quad.pos_scale_x = pos_max.x - pos_min.x;
+		quad.pos_scale_y = pos_max.y - pos_min.y;
+		quad.tex_off_x = float(rect.x);
+		quad.tex_off_y = float(rect.y);
+		quad.tex_scale_x = float(rect.z);
+		quad.tex_scale_y = float(rect.w);
+
+		max_rect = max(max_rect, pos_max);
+		min_rect = min(min_rect, pos_min);
 	}
 
+	if (!instance_data->count)
+		return;
+
 	if (any(lessThan(min_rect, clip_offset)) || any(greaterThan(max_rect, clip_offset + clip_size)))
 		sprite.clip_quad = ivec4(ivec2(clip_offset), ivec2(clip_size));
 
@@ -243,6 +256,7 @@ void Font::render_text(RenderQueue &queue, const char *text, const vec3 &offset,
 	hasher.s32(sprite.clip_quad.y);
 	hasher.s32(sprite.clip_quad.z);
 	hasher.s32(sprite.clip_quad.w);
+	hasher.s32(int(sdf));
 	auto instance_key = hasher.get();
 	auto sorting_key = RenderInfo::get_sprite_sort_key(Queue::Transparent, hasher.get(), hasher.get(), offset.z);
 
@@ -259,26 +273,9 @@ void Font::render_text(RenderQueue &queue, const char *text, const vec3 &offset,
 			                           MESH_ATTRIBUTE_POSITION_BIT |
 			                           MESH_ATTRIBUTE_VERTEX_COLOR_BIT,
 			                           MATERIAL_TEXTURE_BASE_COLOR_BIT,
-			                           Sprite::ALPHA_TEXTURE_BIT));
+			                           sdf ? Sprite::SDF_TEXTURE_BIT : Sprite::ALPHA_TEXTURE_BIT));
 
 		*sprite_data = sprite;
 	}
 }
-
-void Font::on_device_created(const DeviceCreatedEvent &created)
-{
-	auto &device = created.get_device();
-
-	ImageCreateInfo info = ImageCreateInfo::immutable_2d_image(width, height, VK_FORMAT_R8_UNORM, false);
-	ImageInitialData initial = {};
-	initial.data = bitmap.data();
-	texture = device.create_image(info, &initial);
-	device.set_name(*texture, "font");
-}
-
-void Font::on_device_destroyed(const DeviceCreatedEvent &)
-{
-	texture.reset();
-}
-
 }
@@ -22,18 +22,23 @@
 
 #pragma once
 
-#include "event.hpp"
 #include "render_queue.hpp"
 #include "renderer.hpp"
+#include "glyph_atlas.hpp"
+#include "lru_cache.hpp"
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace Granite
 {
-class Font : public EventHandler
+class Font
 {
 public:
-	Font(const std::string &path, unsigned size);
-	~Font();
+	Font(const std::string &path, unsigned size, GlyphAtlas::Mode mode = GlyphAtlas::Mode::Bitmap);
+
+	// Fonts of different sizes can share an atlas. In SDF mode the glyphs themselves are shared as well.
+	Font(GlyphAtlasHandle atlas, unsigned size);
 
 	enum class Alignment
 	{
@@ -48,25 +53,52 @@ public:
 		BottomCenter
 	};
 
+	// Atlas usage of a render_text() call, for callers which retain the generated draws.
+	struct RenderResult
+	{
+		uint32_t page_mask = 0;
+		bool complete = true;
+	};
+
+	// Text is UTF-8. Glyphs which are still being rasterized are skipped until they become resident.
 	void render_text(RenderQueue &queue, const char *text,
 	                 const vec3 &offset, const vec2 &size,
 	                 const vec2 &clip_offset, const vec2 &clip_size,
 	                 const vec4 &color,
-	                 Alignment alignment = Alignment::TopLeft) const;
+	                 Alignment alignment = Alignment::TopLeft,
+	                 RenderResult *result = nullptr) const;
 
 	vec2 get_text_geometry(const char *text) const;
 
 	vec2 get_aligned_offset(Alignment alignment, vec2 text_geometry, vec2 target_geometry) const;
 
-private:
-	Vulkan::ImageHandle texture;
-	struct Baked;
-	std::unique_ptr<Baked> baked_chars;
-	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
-	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
+	GlyphAtlas &get_atlas() const
+	{
+		return *atlas;
+	}
 
-	std::vector<uint8_t> bitmap;
-	unsigned width = 0, height = 0;
+private:
+	// Text rendering is logically const, but pulls glyphs into the shared atlas on demand.
+	mutable GlyphAtlasHandle atlas;
 	unsigned font_height = 0;
+
+	struct LayoutGlyph
+	{
+		uint32_t codepoint;
+		vec2 pos_min, pos_max;
+	};
+
+	// Layout is independent of atlas residency, so static labels only shape once.
+	struct TextLayout
+	{
+		std::string text;
+		std::vector<LayoutGlyph> glyphs;
+		vec2 geometry;
+	};
+
+	enum { LayoutCacheGlyphBudget = 16 * 1024 };
+	mutable Util::LRUCache<TextLayout> layout_cache;
+
+	const TextLayout &get_layout(const char *text) const;
 };
-}
\ No newline at end of file
+}
@@ -0,0 +1,505 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define NOMINMAX
+#include "stb_truetype.h"
+#include "glyph_atlas.hpp"
+#include "device.hpp"
+#include "global_managers.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <math.h>
+
+using namespace Vulkan;
+
+namespace Granite
+{
+void SkylinePacker::init(unsigned width_, unsigned height_)
+{
+	width = width_;
+	height = height_;
+	reset();
+}
+
+void SkylinePacker::reset()
+{
+	skyline.clear();
+	skyline.push_back({ 0, 0, width });
+	used_area = 0;
+}
+
+bool SkylinePacker::fits(size_t index, unsigned rect_width, unsigned rect_height, unsigned &y) const
+{
+	unsigned x = skyline[index].x;
+	if (x + rect_width > width)
+		return false;
+
+	// Resting height is the tallest segment spanned by the rect.
+	unsigned remaining = rect_width;
+	y = 0;
+	for (size_t i = index; remaining && i < skyline.size(); i++)
+	{
+		y = std::max(y, skyline[i].y);
+		if (y + rect_height > height)
+			return false;
+		remaining -= std::min(remaining, skyline[i].width);
+	}
+
+	return true;
+}
+
+bool SkylinePacker::pack(unsigned rect_width, unsigned rect_height, unsigned &x, unsigned &y)
+{
+	if (!rect_width || !rect_height)
+		return false;
+
+	size_t best_index = skyline.size();
+	unsigned best_bottom = ~0u;
+	unsigned best_width = ~0u;
+	unsigned best_y = 0;
+
+	for (size_t i = 0; i < skyline.size(); i++)
+	{
+		unsigned candidate_y;
+		if (!fits(i, rect_width, rect_height, candidate_y))
+			continue;
+
+		unsigned bottom = candidate_y + rect_height;
+		if (bottom < best_bottom || (bottom == best_bottom && skyline[i].width < best_width))
+		{
+			best_index = i;
+			best_bottom = bottom;
+			best_width = skyline[i].width;
+			best_y = candidate_y;
+		}
+	}
+
+	if (best_index == skyline.size())
+		return false;
+
+	x = skyline[best_index].x;
+	y = best_y;
+
+	// Insert the new segment and shrink or remove the segments it covers.
+	Node node = { x, best_bottom, rect_width };
+	skyline.insert(skyline.begin() + ptrdiff_t(best_index), node);
+
+	size_t i = best_index + 1;
+	while (i < skyline.size())
+	{
+		auto &prev = skyline[i - 1];
+		auto &cur = skyline[i];
+		unsigned prev_end = prev.x + prev.width;
+		if (cur.x >= prev_end)
+			break;
+
+		unsigned shrink = prev_end - cur.x;
+		if (cur.width <= shrink)
+		{
+			skyline.erase(skyline.begin() + ptrdiff_t(i));
+		}
+		else
+		{
+			cur.x += shrink;
+			cur.width -= shrink;
+			break;
+		}
+	}
+
+	// Merge neighbours with equal height.
+	for (i = 1; i < skyline.size(); )
+	{
+		if (skyline[i - 1].y == skyline[i].y)
+		{
+			skyline[i - 1].width += skyline[i].width;
+			skyline.erase(skyline.begin() + ptrdiff_t(i));
+		}
+		else
+			i++;
+	}
+
+	used_area += rect_width * rect_height;
+	return true;
+}
+
+struct GlyphAtlas::FontInfo
+{
+	stbtt_fontinfo info;
+};
+
+GlyphAtlas::GlyphAtlas(const std::string &path, Mode mode_)
+	: mode(mode_)
+{
+	mapping = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
+	if (!mapping)
+		throw std::runtime_error("Failed to open font.");
+
+	auto *data = mapping->data<unsigned char>();
+	if (!data)
+		throw std::runtime_error("Failed to map font.");
+
+	font.reset(new FontInfo);
+	if (!stbtt_InitFont(&font->info, data, stbtt_GetFontOffsetForIndex(data, 0)))
+		throw std::runtime_error("Failed to parse font.");
+
+	for (auto &page : pages)
+		page.packer.init(Width, PageHeight);
+
+	EVENT_MANAGER_REGISTER_LATCH(GlyphAtlas, on_device_created, on_device_destroyed, DeviceCreatedEvent);
+	EVENT_MANAGER_REGISTER_LATCH(GlyphAtlas, on_swapchain_index, on_swapchain_index_destroyed, SwapchainIndexEvent);
+}
+
+GlyphAtlas::~GlyphAtlas()
+{
+	wait_idle();
+}
+
+void GlyphAtlas::wait_idle()
+{
+	std::vector<TaskGroupHandle> tasks;
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		tasks = std::move(pending_tasks);
+		pending_tasks.clear();
+	}
+
+	for (auto &task : tasks)
+		task->wait();
+}
+
+GlyphAtlas::GlyphEntry &GlyphAtlas::get_entry(uint32_t codepoint, unsigned pixel_size, Util::Hash &key)
+{
+	unsigned raster_size = mode == Mode::SDF ? unsigned(SDFPixelSize) : pixel_size;
+
+	Util::Hasher h;
+	h.u32(codepoint);
+	h.u32(raster_size);
+	key = h.get();
+
+	auto itr = glyphs.find(key);
+	if (itr != glyphs.end())
+		return itr->second;
+
+	auto &entry = glyphs[key];
+	entry = {};
+
+	float scale = stbtt_ScaleForPixelHeight(&font->info, float(raster_size));
+	int advance = 0, bearing = 0;
+	stbtt_GetCodepointHMetrics(&font->info, int(codepoint), &advance, &bearing);
+
+	int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+	stbtt_GetCodepointBitmapBox(&font->info, int(codepoint), scale, scale, &x0, &y0, &x1, &y1);
+
+	if (x1 > x0 && y1 > y0 && mode == Mode::SDF)
+	{
+		// Matches the box stbtt_GetCodepointSDF produces.
+		x0 -= SDFPadding;
+		y0 -= SDFPadding;
+		x1 += SDFPadding;
+		y1 += SDFPadding;
+	}
+
+	entry.metrics.advance = float(advance) * scale;
+	entry.metrics.x0 = float(x0);
+	entry.metrics.y0 = float(y0);
+	entry.metrics.x1 = float(std::max(x0, x1));
+	entry.metrics.y1 = float(std::max(y0, y1));
+	entry.raster_x0 = x0;
+	entry.raster_y0 = y0;
+	entry.raster_width = unsigned(std::max(x1 - x0, 0));
+	entry.raster_height = unsigned(std::max(y1 - y0, 0));
+	entry.state = GlyphState::Missing;
+	return entry;
+}
+
+GlyphAtlas::GlyphMetrics GlyphAtlas::get_metrics(uint32_t codepoint, unsigned pixel_size)
+{
+	Util::Hash key;
+	auto metrics = get_entry(codepoint, pixel_size, key).metrics;
+
+	if (mode == Mode::SDF)
+	{
+		float scale = float(pixel_size) / float(SDFPixelSize);
+		metrics.advance *= scale;
+		metrics.x0 *= scale;
+		metrics.y0 *= scale;
+		metrics.x1 *= scale;
+		metrics.y1 *= scale;
+	}
+
+	return metrics;
+}
+
+float GlyphAtlas::get_kerning(uint32_t prev_codepoint, uint32_t codepoint, unsigned pixel_size) const
+{
+	float scale = stbtt_ScaleForPixelHeight(&font->info, float(pixel_size));
+	return float(stbtt_GetCodepointKernAdvance(&font->info, int(prev_codepoint), int(codepoint))) * scale;
+}
+
+void GlyphAtlas::evict_page(unsigned page_index)
+{
+	auto &page = pages[page_index];
+	for (auto key : page.glyphs)
+	{
+		auto itr = glyphs.find(key);
+		if (itr != glyphs.end() && itr->second.page == page_index)
+			itr->second.state = GlyphState::Missing;
+	}
+
+	page.glyphs.clear();
+	page.packer.reset();
+	// In-flight rasterization into this page is discarded on completion.
+	page.generation++;
+}
+
+bool GlyphAtlas::allocate_rect(GlyphEntry &entry, Util::Hash key)
+{
+	// Keep a texel of gutter so bilinear filtering does not bleed between glyphs.
+	unsigned width = entry.raster_width + 1;
+	unsigned height = entry.raster_height + 1;
+	if (width > Width || height > PageHeight)
+		return false;
+
+	unsigned page_index = NumPages;
+	for (unsigned i = 0; i < NumPages && page_index == NumPages; i++)
+		if (pages[i].packer.pack(width, height, entry.atlas_x, entry.atlas_y))
+			page_index = i;
+
+	if (page_index == NumPages)
+	{
+		uint64_t oldest = frame;
+		for (unsigned i = 0; i < NumPages; i++)
+		{
+			if (pages[i].last_used_frame < oldest)
+			{
+				oldest = pages[i].last_used_frame;
+				page_index = i;
+			}
+		}
+
+		// Everything is in use this frame.
+		if (page_index == NumPages)
+			return false;
+
+		evict_page(page_index);
+		if (!pages[page_index].packer.pack(width, height, entry.atlas_x, entry.atlas_y))
+			return false;
+	}
+
+	entry.page = page_index;
+	entry.atlas_y += page_index * PageHeight;
+	pages[page_index].glyphs.push_back(key);
+	return true;
+}
+
+void GlyphAtlas::rasterize(uint32_t codepoint, unsigned pixel_size, Util::Hash key, const GlyphEntry &entry)
+{
+	RasterizedGlyph glyph;
+	glyph.key = key;
+	glyph.page = entry.page;
+	glyph.generation = pages[entry.page].generation;
+
+	unsigned width = entry.raster_width;
+	unsigned height = entry.raster_height;
+	auto *info = &font->info;
+	bool sdf = mode == Mode::SDF;
+	float scale = stbtt_ScaleForPixelHeight(info, float(sdf ? unsigned(SDFPixelSize) : pixel_size));
+
+	auto task_func = [this, info, sdf, scale, codepoint, width, height, glyph]() mutable {
+		glyph.pixels.resize(width * height);
+
+		if (sdf)
+		{
+			int w = 0, h = 0, xoff = 0, yoff = 0;
+			unsigned char *sdf_data = stbtt_GetCodepointSDF(info, scale, int(codepoint), SDFPadding,
+			                                                128, 128.0f / float(SDFPadding),
+			                                                &w, &h, &xoff, &yoff);
+			if (sdf_data)
+			{
+				unsigned copy_width = std::min(unsigned(w), width);
+				unsigned copy_height = std::min(unsigned(h), height);
+				for (unsigned y = 0; y < copy_height; y++)
+					memcpy(glyph.pixels.data() + y * width, sdf_data + y * unsigned(w), copy_width);
+				stbtt_FreeSDF(sdf_data, nullptr);
+			}
+		}
+		else
+		{
+			stbtt_MakeCodepointBitmap(info, glyph.pixels.data(), int(width), int(height), int(width),
+			                          scale, scale, int(codepoint));
+		}
+
+		std::lock_guard<std::mutex> holder{lock};
+		completed.push_back(std::move(glyph));
+	};
+
+	auto *group = GRANITE_THREAD_GROUP();
+	if (group)
+	{
+		auto task = group->create_task(std::move(task_func));
+		task->set_desc("glyph-rasterize");
+		task->set_task_class(TaskClass::Background);
+		task->flush();
+
+		std::lock_guard<std::mutex> holder{lock};
+		pending_tasks.erase(std::remove_if(pending_tasks.begin(), pending_tasks.end(), [](TaskGroupHandle &t) {
+			return t->poll();
+		}), pending_tasks.end());
+		pending_tasks.push_back(std::move(task));
+	}
+	else
+		task_func();
+}
+
+bool GlyphAtlas::get_atlas_rect(uint32_t codepoint, unsigned pixel_size, uvec4 &rect)
+{
+	Util::Hash key;
+	auto &entry = get_entry(codepoint, pixel_size, key);
+	if (!entry.raster_width || !entry.raster_height)
+		return false;
+
+	if (entry.state == GlyphState::Missing)
+	{
+		if (!allocate_rect(entry, key))
+			return false;
+		entry.state = GlyphState::Pending;
+		rasterize(codepoint, pixel_size, key, entry);
+	}
+
+	entry.last_used_frame = frame;
+	pages[entry.page].last_used_frame = frame;
+
+	if (entry.state != GlyphState::Ready)
+		return false;
+
+	rect = uvec4(entry.atlas_x, entry.atlas_y, entry.raster_width, entry.raster_height);
+	return true;
+}
+
+void GlyphAtlas::flush_uploads()
+{
+	// Completed glyphs stay queued until there is a device to upload to.
+	if (!texture)
+		return;
+
+	std::vector<RasterizedGlyph> uploads;
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		if (completed.empty())
+			return;
+		std::swap(uploads, completed);
+	}
+
+	auto cmd = device->request_command_buffer();
+	cmd->image_barrier(*texture, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                   VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, 0,
+	                   VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	for (auto &upload : uploads)
+	{
+		auto itr = glyphs.find(upload.key);
+		if (itr == glyphs.end())
+			continue;
+
+		auto &entry = itr->second;
+		if (entry.state != GlyphState::Pending || entry.page != upload.page ||
+		    pages[entry.page].generation != upload.generation)
+			continue;
+
+		VkOffset3D offset = { int(entry.atlas_x), int(entry.atlas_y), 0 };
+		VkExtent3D extent = { entry.raster_width, entry.raster_height, 1 };
+		VkImageSubresourceLayers subresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		void *dst = cmd->update_image(*texture, offset, extent, 0, 0, subresource);
+		memcpy(dst, upload.pixels.data(), upload.pixels.size());
+		entry.state = GlyphState::Ready;
+	}
+
+	cmd->image_barrier(*texture, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	                   VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	                   VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+	device->submit(cmd);
+}
+
+void GlyphAtlas::next_frame()
+{
+	frame++;
+}
+
+uint64_t GlyphAtlas::get_generation(uint32_t page_mask) const
+{
+	// Page generations only ever increase, so the sum changes if any of them does.
+	uint64_t sum = 0;
+	for (unsigned i = 0; i < NumPages; i++)
+		if (page_mask & (1u << i))
+			sum += pages[i].generation;
+	return sum;
+}
+
+void GlyphAtlas::mark_pages_used(uint32_t page_mask)
+{
+	for (unsigned i = 0; i < NumPages; i++)
+		if (page_mask & (1u << i))
+			pages[i].last_used_frame = frame;
+}
+
+const ImageView *GlyphAtlas::get_view() const
+{
+	return texture ? &texture->get_view() : nullptr;
+}
+
+void GlyphAtlas::on_device_created(const DeviceCreatedEvent &created)
+{
+	device = &created.get_device();
+
+	ImageCreateInfo info = ImageCreateInfo::immutable_2d_image(Width, Height, VK_FORMAT_R8_UNORM, false);
+	info.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	std::vector<uint8_t> cleared(Width * Height);
+	ImageInitialData initial = {};
+	initial.data = cleared.data();
+	texture = device->create_image(info, &initial);
+	device->set_name(*texture, "glyph-atlas");
+}
+
+void GlyphAtlas::on_device_destroyed(const DeviceCreatedEvent &)
+{
+	wait_idle();
+	texture.reset();
+	device = nullptr;
+
+	// Atlas contents are lost, everything has to be rasterized again.
+	for (unsigned i = 0; i < NumPages; i++)
+		evict_page(i);
+	std::lock_guard<std::mutex> holder{lock};
+	completed.clear();
+}
+
+void GlyphAtlas::on_swapchain_index(const SwapchainIndexEvent &)
+{
+	next_frame();
+}
+
+void GlyphAtlas::on_swapchain_index_destroyed(const SwapchainIndexEvent &)
+{
+}
+}
@@ -0,0 +1,207 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "event.hpp"
+#include "application_wsi_events.hpp"
+#include "image.hpp"
+#include "math.hpp"
+#include "intrusive.hpp"
+#include "hashmap.hpp"
+#include "thread_group.hpp"
+#include "filesystem.hpp"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Granite
+{
+// Bottom-left skyline rectangle packer. Rectangles cannot be freed individually,
+// only the whole packer can be reset.
+class SkylinePacker
+{
+public:
+	void init(unsigned width, unsigned height);
+	bool pack(unsigned rect_width, unsigned rect_height, unsigned &x, unsigned &y);
+	void reset();
+
+	unsigned get_used_area() const
+	{
+		return used_area;
+	}
+
+private:
+	struct Node
+	{
+		unsigned x, y, width;
+	};
+	std::vector<Node> skyline;
+	unsigned width = 0;
+	unsigned height = 0;
+	unsigned used_area = 0;
+
+	bool fits(size_t index, unsigned rect_width, unsigned rect_height, unsigned &y) const;
+};
+
+// Dynamic glyph atlas shared between Font instances of one font file.
+// Glyphs are rasterized on demand on background threads and uploaded from the render thread.
+// The atlas is split into horizontal pages with one skyline each,
+// and the least recently used page is evicted as a whole when space runs out.
+// In SDF mode, glyphs are rasterized once as signed distance fields and serve every font size.
+class GlyphAtlas : public Util::IntrusivePtrEnabled<GlyphAtlas>, public EventHandler
+{
+public:
+	enum class Mode
+	{
+		Bitmap,
+		SDF
+	};
+
+	GlyphAtlas(const std::string &path, Mode mode);
+	~GlyphAtlas();
+
+	Mode get_mode() const
+	{
+		return mode;
+	}
+
+	// Layout information in pixels relative to the pen position on the baseline.
+	struct GlyphMetrics
+	{
+		float advance;
+		float x0, y0, x1, y1;
+	};
+
+	GlyphMetrics get_metrics(uint32_t codepoint, unsigned pixel_size);
+	float get_kerning(uint32_t prev_codepoint, uint32_t codepoint, unsigned pixel_size) const;
+
+	// Returns false if the glyph is not resident yet. Rasterization is kicked off in that case.
+	bool get_atlas_rect(uint32_t codepoint, unsigned pixel_size, uvec4 &rect);
+
+	// Uploads glyphs which completed rasterization. Must be called before recording draws using them.
+	void flush_uploads();
+
+	// Glyphs used in the current frame are never evicted.
+	// Frames advance automatically with swapchain images, or manually for headless rendering.
+	void next_frame();
+
+	// Changes whenever one of the pages is evicted, so cached draws referencing atlas rects can detect staleness.
+	uint64_t get_generation(uint32_t page_mask) const;
+
+	// Page bit of a rect returned by get_atlas_rect().
+	uint32_t get_page_mask(const uvec4 &rect) const
+	{
+		return 1u << (rect.y / PageHeight);
+	}
+
+	// Keeps pages alive for draws which are replayed without going through get_atlas_rect().
+	void mark_pages_used(uint32_t page_mask);
+
+	const Vulkan::ImageView *get_view() const;
+
+	unsigned get_width() const
+	{
+		return Width;
+	}
+
+	unsigned get_height() const
+	{
+		return Height;
+	}
+
+	void wait_idle();
+
+private:
+	enum
+	{
+		Width = 1024,
+		Height = 1024,
+		PageHeight = 128,
+		NumPages = Height / PageHeight,
+		SDFPixelSize = 32,
+		SDFPadding = 4
+	};
+
+	enum class GlyphState : uint8_t
+	{
+		Missing,
+		Pending,
+		Ready
+	};
+
+	struct GlyphEntry
+	{
+		GlyphMetrics metrics;
+		int raster_x0, raster_y0;
+		unsigned raster_width, raster_height;
+		unsigned atlas_x, atlas_y;
+		unsigned page;
+		uint64_t last_used_frame;
+		GlyphState state;
+	};
+
+	struct Page
+	{
+		SkylinePacker packer;
+		std::vector<Util::Hash> glyphs;
+		uint64_t last_used_frame = 0;
+		uint64_t generation = 0;
+	};
+
+	struct RasterizedGlyph
+	{
+		Util::Hash key;
+		unsigned page;
+		uint64_t generation;
+		std::vector<uint8_t> pixels;
+	};
+
+	struct FontInfo;
+	std::unique_ptr<FontInfo> font;
+	FileMappingHandle mapping;
+	Mode mode;
+
+	Util::HashMap<GlyphEntry> glyphs;
+	Page pages[NumPages];
+	uint64_t frame = 1;
+
+	std::mutex lock;
+	std::vector<RasterizedGlyph> completed;
+	std::vector<TaskGroupHandle> pending_tasks;
+
+	Vulkan::Device *device = nullptr;
+	Vulkan::ImageHandle texture;
+
+	GlyphEntry &get_entry(uint32_t codepoint, unsigned pixel_size, Util::Hash &key);
+	bool allocate_rect(GlyphEntry &entry, Util::Hash key);
+	void evict_page(unsigned page);
+	void rasterize(uint32_t codepoint, unsigned pixel_size, Util::Hash key, const GlyphEntry &entry);
+
+	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
+	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
+	void on_swapchain_index(const Vulkan::SwapchainIndexEvent &e);
+	void on_swapchain_index_destroyed(const Vulkan::SwapchainIndexEvent &e);
+};
+using GlyphAtlasHandle = Util::IntrusivePtr<GlyphAtlas>;
+}
@@ -28,6 +28,7 @@
 #include "muglm/matrix_helper.hpp"
 #include "transforms.hpp"
 #include "asset_manager.hpp"
+#include "logging.hpp"
 
 using namespace Vulkan;
 using namespace Util;
@@ -214,7 +215,9 @@ void Ground::on_device_created(const DeviceCreatedEvent &created)
 	lod_map = device.create_image(image_info, nullptr);
 }
 
-void Ground::build_lod(Device &device, unsigned lod_size, unsigned stride)
+// Builds a triangle strip grid of lod_size quads covering a patch of patch_size.
+static void build_patch_mesh(Device &device, unsigned patch_size, unsigned lod_size, unsigned stride,
+                             BufferHandle &vbo, BufferHandle &ibo, unsigned &count)
 {
 	unsigned size_1 = lod_size + 1;
 	std::vector<GroundVertex> vertices;
@@ -222,11 +225,11 @@ void Ground::build_lod(Device &device, unsigned lod_size, unsigned stride)
 	std::vector<uint16_t> indices;
 	indices.reserve(lod_size * (2 * size_1 + 1));
 
-	unsigned half_size = info.base_patch_size >> 1;
+	unsigned half_size = patch_size >> 1;
 
-	for (unsigned y = 0; y <= info.base_patch_size; y += stride)
+	for (unsigned y = 0; y <= patch_size; y += stride)
 	{
-		for (unsigned x = 0; x <= info.base_patch_size; x += stride)
+		for (unsigned x = 0; x <= patch_size; x += stride)
 		{
 			GroundVertex v = {};
 			v.pos[0] = uint8_t(x);
@@ -236,11 +239,11 @@ void Ground::build_lod(Device &device, unsigned lod_size, unsigned stride)
 
 			if (x == 0)
 				v.weights[0] = 255;
-			else if (x == info.base_patch_size)
+			else if (x == patch_size)
 				v.weights[1] = 255;
 			else if (y == 0)
 				v.weights[2] = 255;
-			else if (y == info.base_patch_size)
+			else if (y == patch_size)
 				v.weights[3] = 255;
 
 			vertices.push_back(v);
@@ -263,15 +266,18 @@ void Ground::build_lod(Device &device, unsigned lod_size, unsigned stride)
 	buffer_info.size = vertices.size() * sizeof(GroundVertex);
 	buffer_info.domain = BufferDomain::Device;
 	buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-
-	LOD lod;
-	lod.vbo = device.create_buffer(buffer_info, vertices.data());
+	vbo = device.create_buffer(buffer_info, vertices.data());
 
 	buffer_info.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
 	buffer_info.size = indices.size() * sizeof(uint16_t);
-	lod.ibo = device.create_buffer(buffer_info, indices.data());
-	lod.count = indices.size();
+	ibo = device.create_buffer(buffer_info, indices.data());
+	count = indices.size();
+}
 
+void Ground::build_lod(Device &device, unsigned lod_size, unsigned stride)
+{
+	LOD lod;
+	build_patch_mesh(device, info.base_patch_size, lod_size, stride, lod.vbo, lod.ibo, lod.count);
 	quad_lod.push_back(lod);
 }
 
@@ -494,4 +500,320 @@ Ground::Handles Ground::add_to_scene(Scene &scene, unsigned size, float tiling_f
 
 	return handles;
 }
+
+static constexpr int StreamingSelectedPrio = 1 << 20;
+static constexpr int StreamingRefinedPrio = 1 << 19;
+static constexpr int StreamingRequestMaxPrio = 1 << 18;
+
+StreamingGround::StreamingGround(const Info &info_)
+	: info(info_)
+{
+	if (!init_tiles())
+		LOGE("Failed to load streaming terrain %s.\n", info.tiles.c_str());
+	EVENT_MANAGER_REGISTER_LATCH(StreamingGround, on_device_created, on_device_destroyed, DeviceCreatedEvent);
+}
+
+bool StreamingGround::init_tiles()
+{
+	if (!tile_file.open(*GRANITE_FILESYSTEM(), info.tiles))
+		return false;
+
+	auto &file_info = tile_file.get_info();
+
+	// Vertex positions are stored as 8-bit integers.
+	if (file_info.tile_size > 128)
+	{
+		LOGE("Terrain tile size %u is too large for streaming, maximum is 128.\n", file_info.tile_size);
+		return false;
+	}
+
+	auto &directory = tile_file.get_directory();
+	quadtree.init(directory, file_info.sample_spacing, file_info.height_scale, file_info.height_offset);
+	aabb = quadtree.get_tile_aabb(directory.get_num_levels() - 1, 0, 0);
+
+	base_color = GRANITE_ASSET_MANAGER()->register_asset(*GRANITE_FILESYSTEM(), info.base_color, AssetClass::ImageColor);
+	normals_fine = GRANITE_ASSET_MANAGER()->register_asset(*GRANITE_FILESYSTEM(), info.normalmap_fine,
+	                                                       AssetClass::ImageNormal);
+
+	// Tile assets are registered on first use since a large terrain can exceed the number of asset IDs.
+	// The root is the fallback for everything else, so it must always be resident.
+	tile_assets.resize(directory.get_num_tiles());
+	promote_tile(quadtree.get_root_tile(), AssetManager::persistent_prio());
+	commit_priorities();
+	return true;
+}
+
+void StreamingGround::on_device_created(const DeviceCreatedEvent &created)
+{
+	if (tile_assets.empty())
+		return;
+
+	auto &device = created.get_device();
+	unsigned tile_size = tile_file.get_info().tile_size;
+	build_patch_mesh(device, tile_size, tile_size, 1, vbo, ibo, index_count);
+
+	// Every tile has its own heightmap, so LOD and splat maps are constant.
+	const uint16_t zero_lod = 0;
+	const uint8_t full_occlusion = 0xff;
+	const uint8_t first_layer[4] = { 0xff, 0, 0, 0 };
+	ImageInitialData initial = {};
+
+	initial.data = &zero_lod;
+	lod_map = device.create_image(ImageCreateInfo::immutable_2d_image(1, 1, VK_FORMAT_R16_SFLOAT), &initial);
+	initial.data = &full_occlusion;
+	occlusion = device.create_image(ImageCreateInfo::immutable_2d_image(1, 1, VK_FORMAT_R8_UNORM), &initial);
+	initial.data = first_layer;
+	splat_map = device.create_image(ImageCreateInfo::immutable_2d_image(1, 1, VK_FORMAT_R8G8B8A8_UNORM), &initial);
+}
+
+void StreamingGround::on_device_destroyed(const DeviceCreatedEvent &)
+{
+	vbo.reset();
+	ibo.reset();
+	lod_map.reset();
+	occlusion.reset();
+	splat_map.reset();
+}
+
+void StreamingGround::promote_tile(unsigned tile, int prio)
+{
+	auto &assets = tile_assets[tile];
+	if (assets.next_prio == 0)
+		next_active_tiles.push_back(tile);
+	assets.next_prio = std::max(assets.next_prio, prio);
+}
+
+void StreamingGround::commit_priorities()
+{
+	auto *manager = GRANITE_ASSET_MANAGER();
+
+	for (auto tile : active_tiles)
+	{
+		auto &assets = tile_assets[tile];
+		if (assets.next_prio == 0)
+		{
+			manager->set_asset_residency_priority(assets.heights, 0);
+			manager->set_asset_residency_priority(assets.normals, 0);
+			assets.prio = 0;
+			quadtree.set_resident(tile, false);
+			retired_tiles.push_back({ tile, ++assets.retire_count });
+		}
+	}
+
+	for (auto tile : next_active_tiles)
+	{
+		auto &assets = tile_assets[tile];
+		if (!assets.heights)
+		{
+			assets.heights = manager->register_asset(tile_file.get_heights(tile), AssetClass::ImageZeroable,
+			                                         assets.next_prio);
+			assets.normals = manager->register_asset(tile_file.get_normals(tile), AssetClass::ImageNormal,
+			                                         assets.next_prio);
+		}
+		else if (assets.prio != assets.next_prio)
+		{
+			manager->set_asset_residency_priority(assets.heights, assets.next_prio);
+			manager->set_asset_residency_priority(assets.normals, assets.next_prio);
+		}
+
+		assets.prio = assets.next_prio;
+		assets.next_prio = 0;
+	}
+
+	std::swap(active_tiles, next_active_tiles);
+	next_active_tiles.clear();
+
+	while (retired_tiles.size() > info.max_retired_tiles)
+	{
+		auto retired = retired_tiles.front();
+		retired_tiles.pop_front();
+
+		// Skip tiles which were selected again since they were retired.
+		auto &assets = tile_assets[retired.tile];
+		if (assets.prio != 0 || assets.retire_count != retired.retire_count)
+			continue;
+
+		manager->unregister_asset(assets.heights);
+		manager->unregister_asset(assets.normals);
+		assets.heights = {};
+		assets.normals = {};
+	}
+}
+
+void StreamingGround::update_residency(const RenderContext &context)
+{
+	auto &manager = context.get_device().get_resource_manager();
+	for (auto tile : active_tiles)
+	{
+		auto &assets = tile_assets[tile];
+		quadtree.set_resident(tile, manager.is_image_view_resident(assets.heights) &&
+		                            manager.is_image_view_resident(assets.normals));
+	}
+}
+
+void StreamingGround::refresh(const RenderContext &context, const RenderInfoComponent *transform, TaskComposer &)
+{
+	if (tile_assets.empty())
+		return;
+
+	update_residency(context);
+
+	// Select in terrain space. Planes transform with the transpose of the world matrix.
+	// Screen-space error is a ratio of lengths, so uniform scaling in the world transform cancels out.
+	auto &world = transform->get_world_transform();
+	mat4 world_transposed = transpose(world);
+	const vec4 *world_planes = context.get_visibility_frustum().get_planes();
+	vec4 planes[6];
+	for (unsigned i = 0; i < 6; i++)
+		planes[i] = world_transposed * world_planes[i];
+
+	auto &params = context.get_render_parameters();
+	TerrainQuadtree::Parameters select_params;
+	select_params.camera_position = (inverse(world) * vec4(params.camera_position, 1.0f)).xyz();
+	select_params.frustum_planes = planes;
+	select_params.lod_scale = 0.5f * info.reference_height * muglm::abs(params.projection[1][1]);
+	select_params.max_pixel_error = info.max_pixel_error;
+	quadtree.select(select_params);
+
+	auto *manager = GRANITE_ASSET_MANAGER();
+	promote_tile(quadtree.get_root_tile(), AssetManager::persistent_prio());
+
+	for (auto &node : quadtree.get_selected_nodes())
+	{
+		promote_tile(node.tile, StreamingSelectedPrio);
+		manager->mark_used_asset(tile_assets[node.tile].heights);
+		manager->mark_used_asset(tile_assets[node.tile].normals);
+	}
+
+	for (auto tile : quadtree.get_refined_tiles())
+		promote_tile(tile, StreamingRefinedPrio);
+
+	auto &requests = quadtree.get_stream_requests();
+	size_t num_requests = std::min<size_t>(requests.size(), info.max_stream_requests);
+	for (size_t i = 0; i < num_requests; i++)
+	{
+		float prio = std::min(requests[i].priority, float(StreamingRequestMaxPrio));
+		promote_tile(requests[i].tile, 1 + int(prio));
+	}
+
+	commit_priorities();
+}
+
+void StreamingGround::get_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+                                      RenderQueue &queue) const
+{
+	auto &selected = quadtree.get_selected_nodes();
+	if (selected.empty() || !vbo)
+		return;
+
+	auto &manager = queue.get_resource_manager();
+	auto &world = transform->get_world_transform();
+	auto &file_info = tile_file.get_info();
+
+	// Normals are stored in terrain space.
+	mat4 normal_transform;
+	compute_normal_transform(normal_transform, world);
+
+	// The heightmap has one border sample more than the mesh has quads,
+	// so vertex N lands on texel N when stretched over (N + 1) / N of the tile.
+	float tile_size = float(file_info.tile_size);
+	float border_scale = (tile_size + 1.0f) / tile_size;
+
+	auto *base_color_image = manager.get_image_view(base_color);
+	auto *normal_fine = manager.get_image_view(normals_fine);
+
+	Util::Hasher hasher;
+	hasher.string("ground");
+	auto pipe_hash = hasher.get();
+	hasher.s32(0);
+	hasher.s32(info.bandlimited_pixel);
+	auto draw_hash = hasher.get();
+
+	uint32_t flags = 0;
+	if (info.bandlimited_pixel)
+		flags |= 1u << 0;
+
+	auto *program = queue.get_shader_suites()[ecast(RenderableType::Ground)].get_program(
+		VariantSignatureKey::build(DrawPipeline::Opaque,
+		                           MESH_ATTRIBUTE_POSITION_BIT,
+		                           MATERIAL_TEXTURE_BASE_COLOR_BIT,
+		                           flags));
+
+	for (auto &node : selected)
+	{
+		auto &assets = tile_assets[node.tile];
+		AABB tile_aabb = quadtree.get_tile_aabb(node.level, node.x, node.z);
+		float extent = quadtree.get_tile_extent(node.level);
+
+		PatchInfo patch;
+		patch.program = program;
+		patch.push[0] = world *
+		                translate(vec3(tile_aabb.get_minimum().x, file_info.height_offset, tile_aabb.get_minimum().z)) *
+		                scale(vec3(extent * border_scale, file_info.height_scale, extent * border_scale));
+		patch.push[1] = normal_transform;
+		patch.tangent_scale = vec2(1.0f / 10.0f);
+
+		patch.vbo = vbo.get();
+		patch.ibo = ibo.get();
+		patch.count = index_count;
+
+		patch.heights = manager.get_image_view(assets.heights);
+		patch.normals = manager.get_image_view(assets.normals);
+		patch.occlusion = &occlusion->get_view();
+		patch.normals_fine = normal_fine;
+		patch.base_color = base_color_image;
+		patch.type_map = &splat_map->get_view();
+		patch.lod_map = &lod_map->get_view();
+		patch.inv_heightmap_size = vec2(1.0f / (tile_size + 1.0f));
+
+		// Whole repeats per tile keep the detail textures continuous across tile borders.
+		float repeats = muglm::max(muglm::round(info.detail_tiling * extent), 1.0f);
+		patch.tiling_factor = vec2(repeats * border_scale);
+
+		auto *instance_data = queue.allocate_one<PatchInstanceInfo>();
+		instance_data->lods = vec4(float(node.edge_lod[TerrainQuadtree::EdgeNegativeX]),
+		                           float(node.edge_lod[TerrainQuadtree::EdgePositiveX]),
+		                           float(node.edge_lod[TerrainQuadtree::EdgeNegativeZ]),
+		                           float(node.edge_lod[TerrainQuadtree::EdgePositiveZ]));
+		instance_data->inner_lod = 0.0f;
+		instance_data->offsets = vec2(0.0f);
+
+		vec3 center = (world * vec4(tile_aabb.get_center(), 1.0f)).xyz();
+		auto sorting_key = RenderInfo::get_sort_key(context, Queue::Opaque, pipe_hash, draw_hash,
+		                                            center, StaticLayer::Last);
+
+		// Every tile has its own transform and heightmap, so tiles never instance together.
+		Util::Hasher instance_hasher(draw_hash);
+		instance_hasher.pointer(this);
+		instance_hasher.u32(node.tile);
+		instance_hasher.u64(patch.heights->get_cookie());
+		instance_hasher.u64(patch.normals->get_cookie());
+		instance_hasher.u64(base_color_image->get_cookie());
+		instance_hasher.u64(normal_fine->get_cookie());
+
+		auto *patch_data = queue.push<PatchInfo>(Queue::Opaque, instance_hasher.get(), sorting_key,
+		                                         RenderFunctions::ground_patch_render,
+		                                         instance_data);
+		if (patch_data)
+			*patch_data = patch;
+	}
+}
+
+StreamingGround::Handles StreamingGround::add_to_scene(Scene &scene, const Info &info)
+{
+	Handles handles;
+	handles.node = scene.create_node();
+
+	auto ground = make_handle<StreamingGround>(info);
+	handles.entity = scene.create_renderable(ground, handles.node.get());
+	handles.ground = ground.get();
+
+	// Tiles stream in and out, so they can't be baked into static shadows.
+	handles.entity->free_component<CastsStaticShadowComponent>();
+
+	auto *transforms = handles.entity->allocate_component<PerFrameUpdateTransformComponent>();
+	transforms->refresh = ground.get();
+
+	return handles;
+}
 }
@@ -25,6 +25,9 @@
 #include "abstract_renderable.hpp"
 #include "scene.hpp"
 #include "application_wsi_events.hpp"
+#include "terrain_quadtree.hpp"
+#include "terrain_tiles.hpp"
+#include <deque>
 
 namespace Granite
 {
@@ -171,4 +174,97 @@ private:
 
 	vec2 tiling_factor = vec2(1.0f);
 };
+
+// Pages tiles of a TerrainTileFile in and out through AssetManager.
+// Every frame, a TerrainQuadtree selects tiles by screen-space error and culls them against the frustum.
+// Selected tiles are drawn with the Ground shaders, one tile heightmap per draw.
+class StreamingGround : public AbstractRenderable, public PerFrameRefreshableTransform, public EventHandler
+{
+public:
+	struct Info
+	{
+		std::string tiles;
+		std::string base_color;
+		std::string normalmap_fine;
+		// Repeats of the base color per unit in terrain space.
+		float detail_tiling = 1.0f / 16.0f;
+		float max_pixel_error = 2.0f;
+		// Screen height in pixels which the error threshold is measured against.
+		float reference_height = 1080.0f;
+		// Missing tiles which are requested per frame, in order of screen-space error.
+		unsigned max_stream_requests = 16;
+		// Tiles which left the selection stay registered, and possibly resident, until this many have piled up.
+		// Older ones then give their asset IDs back, so large terrains do not run out of them.
+		unsigned max_retired_tiles = 1024;
+		bool bandlimited_pixel = false;
+	};
+
+	explicit StreamingGround(const Info &info);
+
+	struct Handles
+	{
+		Entity *entity;
+		NodeHandle node;
+		StreamingGround *ground;
+	};
+
+	static Handles add_to_scene(Scene &scene, const Info &info);
+
+	const TerrainQuadtree &get_quadtree() const
+	{
+		return quadtree;
+	}
+
+private:
+	Info info;
+	TerrainTileFile tile_file;
+	TerrainQuadtree quadtree;
+	AABB aabb;
+
+	AssetID base_color, normals_fine;
+
+	struct TileAssets
+	{
+		AssetID heights;
+		AssetID normals;
+		int prio = 0;
+		int next_prio = 0;
+		uint32_t retire_count = 0;
+	};
+	std::vector<TileAssets> tile_assets;
+	std::vector<unsigned> active_tiles;
+	std::vector<unsigned> next_active_tiles;
+
+	struct RetiredTile
+	{
+		unsigned tile;
+		uint32_t retire_count;
+	};
+	std::deque<RetiredTile> retired_tiles;
+
+	Vulkan::BufferHandle vbo, ibo;
+	unsigned index_count = 0;
+	Vulkan::ImageHandle lod_map, occlusion, splat_map;
+
+	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
+	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
+
+	bool init_tiles();
+	void promote_tile(unsigned tile, int prio);
+	void update_residency(const RenderContext &context);
+	void commit_priorities();
+
+	bool has_static_aabb() const override
+	{
+		return true;
+	}
+
+	const AABB *get_static_aabb() const override
+	{
+		return &aabb;
+	}
+
+	void get_render_info(const RenderContext &context, const RenderInfoComponent *transform, RenderQueue &queue) const override;
+	void refresh(const RenderContext &context, const RenderInfoComponent *transform, TaskComposer &composer) override;
+};
 }
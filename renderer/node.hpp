@@ -24,6 +24,7 @@
 
 #include "intrusive.hpp"
 #include "math.hpp"
+#include "transforms.hpp"
 #include "hash.hpp"
 #include "arena_allocator.hpp"
 #include <vector>
@@ -33,13 +34,6 @@ namespace Granite
 class Node;
 class Scene;
 
-struct Transform
-{
-	vec3 scale;
-	vec3 translation;
-	quat rotation;
-};
-
 struct NodeDeleter
 {
 	void operator()(Node *node);
@@ -422,6 +422,7 @@ RenderGraph::RenderGraph()
 {
 	EVENT_MANAGER_REGISTER_LATCH(RenderGraph, on_swapchain_changed, on_swapchain_destroyed, Vulkan::SwapchainParameterEvent);
 	EVENT_MANAGER_REGISTER_LATCH(RenderGraph, on_device_created, on_device_destroyed, Vulkan::DeviceCreatedEvent);
+	bake_schedule_cache.set_total_cost(BakeScheduleCacheSize);
 }
 
 void RenderGraph::on_swapchain_destroyed(const Vulkan::SwapchainParameterEvent &)
@@ -2695,15 +2696,13 @@ void RenderGraph::setup_attachments(Vulkan::Device &device_, Vulkan::ImageView *
 	}
 }
 
-void RenderGraph::traverse_dependencies(const RenderPass &pass, unsigned stack_count)
+template <typename Func>
+void RenderGraph::for_each_pass_dependency(const RenderPass &pass, const Func &func) const
 {
 	// For these kinds of resources,
 	// make sure that we pull in the dependency right away so we can merge render passes if possible.
 	if (pass.get_depth_stencil_input())
-	{
-		depend_passes_recursive(pass, pass.get_depth_stencil_input()->get_write_passes(),
-		                        stack_count, false, false, true);
-	}
+		func(pass.get_depth_stencil_input()->get_write_passes(), false, false, true);
 
 	for (auto *input : pass.get_attachment_inputs())
 	{
@@ -2712,93 +2711,139 @@ void RenderGraph::traverse_dependencies(const RenderPass &pass, unsigned stack_c
 			self_dependency = true;
 
 		if (!self_dependency)
-			depend_passes_recursive(pass, input->get_write_passes(), stack_count, false, false, true);
+			func(input->get_write_passes(), false, false, true);
 	}
 
 	for (auto *input : pass.get_color_inputs())
 	{
 		if (input)
-			depend_passes_recursive(pass, input->get_write_passes(), stack_count, false, false, true);
+			func(input->get_write_passes(), false, false, true);
 	}
 
 	for (auto *input : pass.get_color_scale_inputs())
 	{
 		if (input)
-			depend_passes_recursive(pass, input->get_write_passes(), stack_count, false, false, false);
+			func(input->get_write_passes(), false, false, false);
 	}
 
 	for (auto *input : pass.get_blit_texture_inputs())
 	{
 		if (input)
-			depend_passes_recursive(pass, input->get_write_passes(), stack_count, false, false, false);
+			func(input->get_write_passes(), false, false, false);
 	}
 
 	for (auto &input : pass.get_generic_texture_inputs())
-		depend_passes_recursive(pass, input.texture->get_write_passes(), stack_count, false, false, false);
+		func(input.texture->get_write_passes(), false, false, false);
 
 	for (auto &input : pass.get_proxy_inputs())
-		depend_passes_recursive(pass, input.proxy->get_write_passes(), stack_count, false, false, false);
+		func(input.proxy->get_write_passes(), false, false, false);
 
 	for (auto *input : pass.get_storage_inputs())
 	{
 		if (input)
 		{
 			// There might be no writers of this resource if it's used in a feedback fashion.
-			depend_passes_recursive(pass, input->get_write_passes(), stack_count, true, false, false);
+			func(input->get_write_passes(), true, false, false);
 			// Deal with write-after-read hazards if a storage buffer is read in other passes
 			// (feedback) before being updated.
-			depend_passes_recursive(pass, input->get_read_passes(), stack_count, true, true, false);
+			func(input->get_read_passes(), true, true, false);
 		}
 	}
 
 	for (auto *input : pass.get_storage_texture_inputs())
 	{
 		if (input)
-			depend_passes_recursive(pass, input->get_write_passes(), stack_count, false, false, false);
+			func(input->get_write_passes(), false, false, false);
 	}
 
 	for (auto &input : pass.get_generic_buffer_inputs())
 	{
 		// There might be no writers of this resource if it's used in a feedback fashion.
-		depend_passes_recursive(pass, input.buffer->get_write_passes(), stack_count, true, false, false);
+		func(input.buffer->get_write_passes(), true, false, false);
 	}
 }
 
-void RenderGraph::depend_passes_recursive(const RenderPass &self, const std::unordered_set<unsigned> &written_passes,
-                                          unsigned stack_count, bool no_check, bool ignore_self, bool merge_dependency)
+// Conceptually, we push every dependency of a pass followed by its own dependencies recursively,
+// then reverse the list and keep the first occurrence of every pass.
+// Expanding the same pass more than once makes this exponential with diamond shaped graphs.
+// Instead, walk the conceptual list backwards. A pass which has already been expanded
+// has all of its dependencies emitted already, so it can be skipped without changing the result.
+void RenderGraph::traverse_dependencies(const RenderPass &pass)
 {
-	if (!no_check && written_passes.empty())
-		throw std::logic_error("No pass exists which writes to resource.");
-
-	if (stack_count > passes.size())
+	unsigned self = pass.get_index();
+	if (pass_traversal_state[self] == PassTraversalState::Done)
+		return;
+	if (pass_traversal_state[self] == PassTraversalState::Active)
 		throw std::logic_error("Cycle detected.");
+	pass_traversal_state[self] = PassTraversalState::Active;
+
+	Util::SmallVector<const std::unordered_set<unsigned> *> dep_sets;
+	Util::SmallVector<bool> dep_ignore_self;
 
-	for (auto &pass : written_passes)
-		if (pass != self.get_index())
-			pass_dependencies[self.get_index()].insert(pass);
+	for_each_pass_dependency(pass, [&](const std::unordered_set<unsigned> &written_passes,
+	                                   bool no_check, bool ignore_self, bool merge_dependency) {
+		if (!no_check && written_passes.empty())
+			throw std::logic_error("No pass exists which writes to resource.");
 
-	if (merge_dependency)
-		for (auto &pass : written_passes)
-			if (pass != self.get_index())
-				pass_merge_dependencies[self.get_index()].insert(pass);
+		for (auto &dep : written_passes)
+		{
+			if (dep != self)
+			{
+				pass_dependencies[self].insert(dep);
+				if (merge_dependency)
+					pass_merge_dependencies[self].insert(dep);
+			}
+			else if (!ignore_self)
+				throw std::logic_error("Pass depends on itself.");
+		}
 
-	stack_count++;
+		dep_sets.push_back(&written_passes);
+		dep_ignore_self.push_back(ignore_self);
+	});
 
-	for (auto &pushed_pass : written_passes)
+	std::vector<unsigned> reversed_deps;
+	for (size_t i = dep_sets.size(); i; i--)
 	{
-		if (ignore_self && pushed_pass == self.get_index())
-			continue;
-		else if (pushed_pass == self.get_index())
-			throw std::logic_error("Pass depends on itself.");
+		reversed_deps.assign(dep_sets[i - 1]->begin(), dep_sets[i - 1]->end());
+
+		for (size_t j = reversed_deps.size(); j; j--)
+		{
+			unsigned dep = reversed_deps[j - 1];
+			if (dep_ignore_self[i - 1] && dep == self)
+				continue;
+
+			traverse_dependencies(*passes[dep]);
+			emit_pass(dep);
+		}
+	}
+
+	pass_traversal_state[self] = PassTraversalState::Done;
+}
 
-		pass_stack.push_back(pushed_pass);
-		auto &pass = *passes[pushed_pass];
-		traverse_dependencies(pass, stack_count);
+void RenderGraph::emit_pass(unsigned pass)
+{
+	if (!pass_emitted[pass])
+	{
+		pass_emitted[pass] = true;
+		pass_stack.push_back(pass);
 	}
 }
 
 void RenderGraph::reorder_passes(std::vector<unsigned> &flattened_passes)
 {
+	// Resolve transitive dependencies once up front. Every query below reads the closure,
+	// and new merge dependency edges update it in place, so nothing recurses through the graph.
+	pass_dependency_closure.clear();
+	pass_dependency_closure.resize(passes.size());
+	pass_dependency_closure_valid.clear();
+	pass_dependency_closure_valid.resize(passes.size());
+	for (unsigned pass = 0; pass < passes.size(); pass++)
+		get_pass_dependency_closure(pass);
+
+	const auto depends_on = [this](unsigned dst_pass, unsigned src_pass) -> bool {
+		return pass_dependency_closure[dst_pass][src_pass];
+	};
+
 	// If a pass depends on an earlier pass via merge dependencies,
 	// copy over dependencies to the dependees to avoid cases which can break subpass merging.
 	// This is a "soft" dependency. If we ignore it, it's not a real problem.
@@ -2812,11 +2857,11 @@ void RenderGraph::reorder_passes(std::vector<unsigned> &flattened_passes)
 			for (auto &dependee : pass_deps)
 			{
 				// Avoid cycles.
-				if (depends_on_pass(dependee, merge_dep))
+				if (depends_on(dependee, merge_dep))
 					continue;
 
-				if (merge_dep != dependee)
-					pass_dependencies[merge_dep].insert(dependee);
+				if (merge_dep != dependee && pass_dependencies[merge_dep].insert(dependee).second)
+					add_pass_dependency_closure(merge_dep, dependee);
 			}
 		}
 	}
@@ -2826,7 +2871,11 @@ void RenderGraph::reorder_passes(std::vector<unsigned> &flattened_passes)
 	// Clarity in the algorithm is pretty important, because these things tend to be very annoying to debug.
 
 	if (flattened_passes.size() <= 2)
+	{
+		pass_dependency_closure.clear();
+		pass_dependency_closure_valid.clear();
 		return;
+	}
 
 	std::vector<unsigned> unscheduled_passes;
 	unscheduled_passes.reserve(passes.size());
@@ -2874,7 +2923,7 @@ void RenderGraph::reorder_passes(std::vector<unsigned> &flattened_passes)
 			{
 				for (auto itr = flattened_passes.rbegin(); itr != flattened_passes.rend(); ++itr)
 				{
-					if (depends_on_pass(unscheduled_passes[i], *itr))
+					if (depends_on(unscheduled_passes[i], *itr))
 						break;
 					overlap_factor++;
 				}
@@ -2886,7 +2935,7 @@ void RenderGraph::reorder_passes(std::vector<unsigned> &flattened_passes)
 			bool possible_candidate = true;
 			for (unsigned j = 0; j < i; j++)
 			{
-				if (depends_on_pass(unscheduled_passes[i], unscheduled_passes[j]))
+				if (depends_on(unscheduled_passes[i], unscheduled_passes[j]))
 				{
 					possible_candidate = false;
 					break;
@@ -2902,20 +2951,45 @@ void RenderGraph::reorder_passes(std::vector<unsigned> &flattened_passes)
 
 		schedule(best_candidate);
 	}
+
+	pass_dependency_closure.clear();
+	pass_dependency_closure_valid.clear();
 }
 
-bool RenderGraph::depends_on_pass(unsigned dst_pass, unsigned src_pass)
+const std::vector<bool> &RenderGraph::get_pass_dependency_closure(unsigned pass)
 {
-	if (dst_pass == src_pass)
-		return true;
+	auto &closure = pass_dependency_closure[pass];
+	if (pass_dependency_closure_valid[pass])
+		return closure;
 
-	for (auto &dep : pass_dependencies[dst_pass])
+	closure.resize(passes.size());
+	closure[pass] = true;
+	for (auto &dep : pass_dependencies[pass])
 	{
-		if (depends_on_pass(dep, src_pass))
-			return true;
+		// The graph is acyclic at this point, so recursion terminates.
+		auto &dep_closure = get_pass_dependency_closure(dep);
+		for (size_t i = 0; i < dep_closure.size(); i++)
+			if (dep_closure[i])
+				closure[i] = true;
 	}
 
-	return false;
+	pass_dependency_closure_valid[pass] = true;
+	return closure;
+}
+
+void RenderGraph::add_pass_dependency_closure(unsigned dst_pass, unsigned src_pass)
+{
+	// dst_pass now depends on src_pass, and so does everything which depends on dst_pass.
+	auto &src_closure = pass_dependency_closure[src_pass];
+	for (auto &closure : pass_dependency_closure)
+	{
+		if (!closure[dst_pass])
+			continue;
+
+		for (size_t i = 0; i < src_closure.size(); i++)
+			if (src_closure[i])
+				closure[i] = true;
+	}
 }
 
 void RenderGraph::bake()
@@ -2943,21 +3017,31 @@ void RenderGraph::bake()
 	if (backbuffer_resource.get_write_passes().empty())
 		throw std::logic_error("No pass exists which writes to resource.");
 
-	for (auto &pass : backbuffer_resource.get_write_passes())
-		pass_stack.push_back(pass);
+	// If the structure of the graph has been seen before, e.g. we're rebaking due to a resize,
+	// we can skip straight to the dimension dependent parts.
+	std::vector<unsigned> reachable_passes;
+	Util::Hash schedule_hash = compute_schedule_hash(reachable_passes);
 
-	auto tmp_pass_stack = pass_stack;
-	for (auto &pushed_pass : tmp_pass_stack)
+	if (!restore_cached_schedule(schedule_hash, reachable_passes))
 	{
-		auto &pass = *passes[pushed_pass];
-		traverse_dependencies(pass, 0);
-	}
+		pass_traversal_state.clear();
+		pass_traversal_state.resize(passes.size());
+		pass_emitted.clear();
+		pass_emitted.resize(passes.size());
 
-	reverse(begin(pass_stack), end(pass_stack));
-	filter_passes(pass_stack);
+		// Walk backwards, see traverse_dependencies().
+		auto &write_passes = backbuffer_resource.get_write_passes();
+		std::vector<unsigned> root_passes(write_passes.begin(), write_passes.end());
+		for (size_t i = root_passes.size(); i; i--)
+			traverse_dependencies(*passes[root_passes[i - 1]]);
+		for (size_t i = root_passes.size(); i; i--)
+			emit_pass(root_passes[i - 1]);
 
-	// Now, reorder passes to extract better pipelining.
-	reorder_passes(pass_stack);
+		// Now, reorder passes to extract better pipelining.
+		reorder_passes(pass_stack);
+
+		store_cached_schedule(schedule_hash, reachable_passes);
+	}
 
 	// Now, we have a linear list of passes to submit in-order which would obey the dependencies.
 
@@ -3033,9 +3117,173 @@ void RenderGraph::bake()
 	// Also build virtual "transfer" barriers. These things only copy events over to other physical resources.
 	build_aliases();
 
-	for (auto &physical_pass : physical_passes)
-		for (auto pass : physical_pass.passes)
-			passes[pass]->setup(*device);
+	// Bake-only usage without a device (e.g. benchmarking) cannot set up passes.
+	if (device)
+	{
+		for (auto &physical_pass : physical_passes)
+			for (auto pass : physical_pass.passes)
+				passes[pass]->setup(*device);
+	}
+}
+
+Util::Hash RenderGraph::compute_schedule_hash(std::vector<unsigned> &reachable_passes) const
+{
+	auto &backbuffer_resource = *resources[resource_to_index.find(backbuffer_source)->second];
+
+	// Find every pass which traverse_dependencies() would visit.
+	// Passes which are culled anyways cannot affect the schedule.
+	std::vector<bool> reachable(passes.size());
+	std::vector<unsigned> stack;
+	for (auto &pass : backbuffer_resource.get_write_passes())
+	{
+		reachable[pass] = true;
+		stack.push_back(pass);
+	}
+
+	while (!stack.empty())
+	{
+		unsigned index = stack.back();
+		stack.pop_back();
+		for_each_pass_dependency(*passes[index], [&](const std::unordered_set<unsigned> &dep_passes, bool, bool, bool) {
+			for (auto &dep : dep_passes)
+			{
+				if (!reachable[dep])
+				{
+					reachable[dep] = true;
+					stack.push_back(dep);
+				}
+			}
+		});
+	}
+
+	reachable_passes.clear();
+	std::vector<unsigned> ordinals(passes.size(), RenderResource::Unused);
+	for (unsigned i = 0; i < passes.size(); i++)
+	{
+		if (reachable[i])
+		{
+			ordinals[i] = unsigned(reachable_passes.size());
+			reachable_passes.push_back(i);
+		}
+	}
+
+	// Iteration order of the dependency sets affects traversal order, so hash them in iteration order.
+	// Equivalent graphs which happen to iterate differently will just miss the cache.
+	Util::Hasher h;
+	h.u32(uint32_t(reachable_passes.size()));
+	for (auto &pass : backbuffer_resource.get_write_passes())
+		h.u32(ordinals[pass]);
+
+	for (auto index : reachable_passes)
+	{
+		auto &pass = *passes[index];
+		h.string(pass.get_name());
+		h.u32(pass.get_queue());
+		for_each_pass_dependency(pass, [&](const std::unordered_set<unsigned> &dep_passes,
+		                                   bool no_check, bool ignore_self, bool merge_dependency) {
+			h.u32((no_check ? 1u : 0u) | (ignore_self ? 2u : 0u) | (merge_dependency ? 4u : 0u));
+			h.u32(uint32_t(dep_passes.size()));
+			for (auto &dep : dep_passes)
+				h.u32(ordinals[dep]);
+		});
+	}
+
+	return h.get();
+}
+
+bool RenderGraph::restore_cached_schedule(Util::Hash hash, const std::vector<unsigned> &reachable_passes)
+{
+	auto *entry = bake_schedule_cache.find_and_mark_as_recent(hash);
+	if (!entry)
+		return false;
+
+	for (auto &ordinal : entry->pass_stack)
+		pass_stack.push_back(reachable_passes[ordinal]);
+
+	for (size_t i = 0; i < reachable_passes.size(); i++)
+	{
+		auto &deps = pass_dependencies[reachable_passes[i]];
+		for (auto &ordinal : entry->pass_dependencies[i])
+			deps.insert(reachable_passes[ordinal]);
+
+		auto &merge_deps = pass_merge_dependencies[reachable_passes[i]];
+		for (auto &ordinal : entry->pass_merge_dependencies[i])
+			merge_deps.insert(reachable_passes[ordinal]);
+	}
+
+	return true;
+}
+
+void RenderGraph::store_cached_schedule(Util::Hash hash, const std::vector<unsigned> &reachable_passes)
+{
+	std::vector<unsigned> ordinals(passes.size(), RenderResource::Unused);
+	for (size_t i = 0; i < reachable_passes.size(); i++)
+		ordinals[reachable_passes[i]] = unsigned(i);
+
+	auto *entry = bake_schedule_cache.allocate(hash, 1);
+
+	entry->pass_stack.clear();
+	for (auto &pass : pass_stack)
+		entry->pass_stack.push_back(ordinals[pass]);
+
+	entry->pass_dependencies.clear();
+	entry->pass_merge_dependencies.clear();
+	entry->pass_dependencies.resize(reachable_passes.size());
+	entry->pass_merge_dependencies.resize(reachable_passes.size());
+
+	for (size_t i = 0; i < reachable_passes.size(); i++)
+	{
+		for (auto &dep : pass_dependencies[reachable_passes[i]])
+			entry->pass_dependencies[i].push_back(ordinals[dep]);
+		for (auto &dep : pass_merge_dependencies[reachable_passes[i]])
+			entry->pass_merge_dependencies[i].push_back(ordinals[dep]);
+	}
+
+	bake_schedule_cache.prune();
+}
+
+void RenderGraph::clear_bake_cache()
+{
+	bake_schedule_cache.set_total_cost(0);
+	bake_schedule_cache.prune();
+	bake_schedule_cache.set_total_cost(BakeScheduleCacheSize);
+}
+
+bool RenderGraph::barriers_equal(const std::vector<Barrier> &a, const std::vector<Barrier> &b)
+{
+	return a.size() == b.size() &&
+	       std::equal(a.begin(), a.end(), b.begin(), [](const Barrier &x, const Barrier &y) {
+		       return x.resource_index == y.resource_index && x.layout == y.layout &&
+		              x.access == y.access && x.stages == y.stages && x.history == y.history;
+	       });
+}
+
+bool RenderGraph::has_same_schedule(const RenderGraph &other) const
+{
+	if (pass_stack != other.pass_stack)
+		return false;
+	if (pass_barriers.size() != other.pass_barriers.size() || physical_passes.size() != other.physical_passes.size())
+		return false;
+
+	for (size_t i = 0; i < pass_barriers.size(); i++)
+	{
+		if (!barriers_equal(pass_barriers[i].invalidate, other.pass_barriers[i].invalidate) ||
+		    !barriers_equal(pass_barriers[i].flush, other.pass_barriers[i].flush))
+			return false;
+	}
+
+	for (size_t i = 0; i < physical_passes.size(); i++)
+	{
+		auto &a = physical_passes[i];
+		auto &b = other.physical_passes[i];
+		if (a.passes != b.passes ||
+		    !barriers_equal(a.invalidate, b.invalidate) ||
+		    !barriers_equal(a.flush, b.flush) ||
+		    !barriers_equal(a.history, b.history))
+			return false;
+	}
+
+	return true;
 }
 
 ResourceDimensions RenderGraph::get_resource_dimensions(const RenderBufferResource &resource) const
@@ -3675,23 +3923,6 @@ void RenderGraph::build_barriers()
 	}
 }
 
-void RenderGraph::filter_passes(std::vector<unsigned> &list)
-{
-	std::unordered_set<unsigned> seen;
-
-	auto output_itr = begin(list);
-	for (auto itr = begin(list); itr != end(list); ++itr)
-	{
-		if (!seen.count(*itr))
-		{
-			*output_itr = *itr;
-			seen.insert(*itr);
-			++output_itr;
-		}
-	}
-	list.erase(output_itr, end(list));
-}
-
 void RenderGraph::enable_timestamps(bool enable)
 {
 	enabled_timestamps = enable;
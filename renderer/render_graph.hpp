@@ -36,6 +36,8 @@
 #include "application_wsi_events.hpp"
 #include "quirks.hpp"
 #include "thread_group.hpp"
+#include "lru_cache.hpp"
+#include "hash.hpp"
 
 namespace Granite
 {
@@ -784,6 +786,10 @@ public:
 
 	void bake();
 	void reset();
+	// The schedule cache survives reset(), this drops it explicitly.
+	void clear_bake_cache();
+	// Compares pass order and barriers of two baked graphs, for validating the schedule cache.
+	bool has_same_schedule(const RenderGraph &other) const;
 	void log();
 	void setup_attachments(Vulkan::Device &device, Vulkan::ImageView *swapchain);
 	void enqueue_render_passes(Vulkan::Device &device, TaskComposer &composer);
@@ -896,7 +902,6 @@ private:
 
 	std::vector<Barriers> pass_barriers;
 
-	void filter_passes(std::vector<unsigned> &list);
 	void validate_passes();
 	void build_barriers();
 
@@ -1000,17 +1005,50 @@ private:
 	void setup_physical_buffer(Vulkan::Device &device, unsigned attachment);
 	void setup_physical_image(Vulkan::Device &device, unsigned attachment);
 
-	void depend_passes_recursive(const RenderPass &pass, const std::unordered_set<unsigned> &passes,
-	                             unsigned stack_count, bool no_check, bool ignore_self, bool merge_dependency);
+	enum class PassTraversalState : uint8_t
+	{
+		Unvisited,
+		Active,
+		Done
+	};
+	std::vector<PassTraversalState> pass_traversal_state;
+	std::vector<bool> pass_emitted;
+	void traverse_dependencies(const RenderPass &pass);
+	void emit_pass(unsigned pass);
 
-	void traverse_dependencies(const RenderPass &pass, unsigned stack_count);
+	template <typename Func>
+	void for_each_pass_dependency(const RenderPass &pass, const Func &func) const;
 
 	std::vector<std::unordered_set<unsigned>> pass_dependencies;
 	std::vector<std::unordered_set<unsigned>> pass_merge_dependencies;
-	bool depends_on_pass(unsigned dst_pass, unsigned src_pass);
+
+	// Transitive closure of pass_dependencies, only valid while scheduling in reorder_passes().
+	std::vector<std::vector<bool>> pass_dependency_closure;
+	std::vector<bool> pass_dependency_closure_valid;
+	const std::vector<bool> &get_pass_dependency_closure(unsigned pass);
+	void add_pass_dependency_closure(unsigned dst_pass, unsigned src_pass);
 
 	void reorder_passes(std::vector<unsigned> &passes);
+
+	// The schedule (pass order and dependencies) only depends on the structure of the graph,
+	// not on any dimensions, so it is cached across reset() and reused when rebaking after e.g. a resize.
+	// Pass indices are stored as ordinals into the sorted list of passes reachable from the backbuffer,
+	// so adding or removing passes which end up being culled does not invalidate the schedule.
+	struct BakeScheduleCacheEntry
+	{
+		std::vector<unsigned> pass_stack;
+		std::vector<std::vector<unsigned>> pass_dependencies;
+		std::vector<std::vector<unsigned>> pass_merge_dependencies;
+	};
+	Util::LRUCache<BakeScheduleCacheEntry> bake_schedule_cache;
+	enum { BakeScheduleCacheSize = 16 };
+
+	Util::Hash compute_schedule_hash(std::vector<unsigned> &reachable_passes) const;
+	bool restore_cached_schedule(Util::Hash hash, const std::vector<unsigned> &reachable_passes);
+	void store_cached_schedule(Util::Hash hash, const std::vector<unsigned> &reachable_passes);
+
 	static bool need_invalidate(const Barrier &barrier, const PipelineEvent &event);
+	static bool barriers_equal(const std::vector<Barrier> &a, const std::vector<Barrier> &b);
 
 	struct PassSubmissionState
 	{
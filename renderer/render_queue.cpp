@@ -23,6 +23,7 @@
 #define NOMINMAX
 #include "render_queue.hpp"
 #include "render_context.hpp"
+#include "metrics.hpp"
 #include <cstring>
 #include <iterator>
 #include <assert.h>
@@ -39,8 +40,13 @@ void RenderQueue::set_device(Vulkan::Device *device)
 
 void RenderQueue::sort()
 {
+	static auto *sort_histogram = Util::MetricsRegistry::get().histogram("render_queue.sort");
+	static auto *sorted_counter = Util::MetricsRegistry::get().counter("render_queue.items_sorted");
+	Util::ScopedMetricTimer timer{sort_histogram};
+
 	for (auto &queue : queues)
 	{
+		sorted_counter->add(queue.raw_input.size());
 		queue.sorter.resize(queue.raw_input.size());
 		queue.sorted_output.reserve(queue.raw_input.size());
 
@@ -68,26 +74,11 @@ void RenderQueue::combine_render_info(const RenderQueue &queue)
 
 void RenderQueue::dispatch_range(Queue queue_type, CommandBuffer &cmd, const CommandBufferSavedState *state, size_t begin, size_t end) const
 {
-	auto *queue = queues[ecast(queue_type)].sorted_data();
-
-	// Assert that we did in fact sort.
-	assert(queues[ecast(queue_type)].sorter.size() == queues[ecast(queue_type)].raw_input.size());
-
-	while (begin < end)
-	{
+	enumerate_batches(queue_type, begin, end, [&](const RenderQueueData *data, unsigned instances) {
 		if (state)
 			cmd.restore_state(*state);
-
-		unsigned instances = 1;
-		for (size_t i = begin + 1; i < end && queue[i].render_info == queue[begin].render_info; i++)
-		{
-			assert(queue[i].render == queue[begin].render);
-			instances++;
-		}
-
-		queue[begin].render(cmd, &queue[begin], instances);
-		begin += instances;
-	}
+		data->render(cmd, data, instances);
+	});
 }
 
 size_t RenderQueue::get_dispatch_size(Queue queue) const
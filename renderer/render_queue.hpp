@@ -154,6 +154,17 @@ class RenderQueue
 public:
 	enum { BlockSize = 64 * 1024 };
 
+	// A push() as seen by a capture target. Pointers refer to queue memory and are only valid until reset().
+	struct CapturedDraw
+	{
+		Queue queue;
+		Util::Hash instance_key;
+		uint64_t sorting_key;
+		RenderFunc render;
+		const void *render_info;
+		const void *instance_data;
+	};
+
 	RenderQueue() = default;
 	void operator=(const RenderQueue &) = delete;
 	RenderQueue(const RenderQueue &) = delete;
@@ -178,6 +189,8 @@ public:
 		{
 			auto *t = static_cast<WrappedT *>(itr);
 			enqueue_queue_data(queue, { render, &t->data, instance_data, sorting_key });
+			if (capture_target)
+				capture_target->push_back({ queue, instance_key, sorting_key, render, &t->data, instance_data });
 			return nullptr;
 		}
 		else
@@ -190,6 +203,8 @@ public:
 			t->set_hash(h.get());
 			render_infos.insert_replace(t);
 			enqueue_queue_data(queue, { render, &t->data, instance_data, sorting_key });
+			if (capture_target)
+				capture_target->push_back({ queue, instance_key, sorting_key, render, &t->data, instance_data });
 			return &t->data;
 		}
 	}
@@ -241,6 +256,37 @@ public:
 	void dispatch_subset(Queue queue, Vulkan::CommandBuffer &cmd, const Vulkan::CommandBufferSavedState *state, unsigned index, unsigned num_indices) const;
 	size_t get_dispatch_size(Queue queue) const;
 
+	// Walks the sorted queue in the same instanced batches dispatch_range() submits,
+	// calling func(const RenderQueueData *data, unsigned instances) for each batch.
+	// With a recording or no-op func this exercises the CPU side of dispatch without a device.
+	template <typename Func>
+	void enumerate_batches(Queue queue_type, size_t begin, size_t end, Func &&func) const
+	{
+		auto *queue = queues[Util::ecast(queue_type)].sorted_data();
+
+		// Assert that we did in fact sort.
+		assert(queues[Util::ecast(queue_type)].sorter.size() == queues[Util::ecast(queue_type)].raw_input.size());
+
+		while (begin < end)
+		{
+			unsigned instances = 1;
+			for (size_t i = begin + 1; i < end && queue[i].render_info == queue[begin].render_info; i++)
+			{
+				assert(queue[i].render == queue[begin].render);
+				instances++;
+			}
+
+			func(&queue[begin], instances);
+			begin += instances;
+		}
+	}
+
+	// While set, every push() is also appended to the target, e.g. to record draws for later replay.
+	void set_capture_target(std::vector<CapturedDraw> *target)
+	{
+		capture_target = target;
+	}
+
 	void set_shader_suites(ShaderSuite *suite)
 	{
 		shader_suites = suite;
@@ -310,6 +356,7 @@ private:
 	Block *current = nullptr;
 
 	ShaderSuite *shader_suites = nullptr;
+	std::vector<CapturedDraw> *capture_target = nullptr;
 	Util::IntrusiveHashMapHolder<QueueDataWrappedErased> render_infos;
 	void recycle_blocks();
 };
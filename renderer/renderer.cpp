@@ -247,16 +247,46 @@ void RendererSuite::register_variants_from_cache()
 
 	GRANITE_SCOPED_TIMELINE_EVENT("renderer-suite-warm-variants");
 
-	for (auto &variant : variants)
+	if (auto task = prefetch_variants_from_cache())
 	{
-		auto *suites = handles[Util::ecast(variant.renderer_suite_type)]->get_shader_suites();
-		auto &suite = suites[Util::ecast(variant.renderable_type)];
-		suite.get_program(variant.key);
+		task->wait();
+	}
+	else
+	{
+		for (auto &variant : variants)
+		{
+			auto *suites = handles[Util::ecast(variant.renderer_suite_type)]->get_shader_suites();
+			auto &suite = suites[Util::ecast(variant.renderable_type)];
+			suite.get_program(variant.key);
+		}
 	}
 
 	LOGI("Warmed cached variants.\n");
 }
 
+TaskGroupHandle RendererSuite::prefetch_variants_from_cache()
+{
+	auto *group = GRANITE_THREAD_GROUP();
+	if (!group || variants.size() <= 1)
+		return {};
+
+	// ShaderSuite::get_program() is thread-safe, and with a cold cache nearly all time is spent in GLSL compilation,
+	// so one task per variant balances well.
+	auto task = group->create_task();
+	task->set_desc("renderer-suite-prefetch-variants");
+	for (auto &variant : variants)
+	{
+		auto *suites = handles[Util::ecast(variant.renderer_suite_type)]->get_shader_suites();
+		auto *suite = &suites[Util::ecast(variant.renderable_type)];
+		auto key = variant.key;
+		task->enqueue_task([suite, key]() {
+			suite->get_program(key);
+		});
+	}
+	task->flush();
+	return task;
+}
+
 Renderer::Renderer(RendererType type_, const ShaderSuiteResolver *resolver_)
 	: type(type_), resolver(resolver_)
 {
@@ -25,6 +25,7 @@
 #include "application_wsi_events.hpp"
 #include "shader_suite.hpp"
 #include "renderer_enums.hpp"
+#include "thread_group.hpp"
 
 namespace Granite
 {
@@ -198,6 +199,10 @@ public:
 	void promote_read_write_cache_to_read_only();
 
 	void register_variants_from_cache();
+	// Compiles every variant from load_variant_cache() on the thread group without blocking.
+	// Renderers must be set up with update_mesh_rendering_options() first.
+	// Returns an empty handle if there was nothing to do asynchronously.
+	TaskGroupHandle prefetch_variants_from_cache();
 	bool load_variant_cache(const std::string &path);
 	bool save_variant_cache(const std::string &path);
 
@@ -25,7 +25,9 @@
 #include "lights/lights.hpp"
 #include "simd.hpp"
 #include "task_composer.hpp"
+#include "metrics.hpp"
 #include <limits>
+#include <algorithm>
 
 namespace Granite
 {
@@ -65,10 +67,19 @@ Scene::~Scene()
 	destroy_entities(queued_entities);
 }
 
+static void record_visibility_metrics(size_t tested, size_t visible)
+{
+	static auto *tested_counter = Util::MetricsRegistry::get().counter("scene.renderables_tested");
+	static auto *visible_counter = Util::MetricsRegistry::get().counter("scene.renderables_visible");
+	tested_counter->add(tested);
+	visible_counter->add(visible);
+}
+
 template <typename T, typename Func>
 static void gather_visible_renderables(const Frustum &frustum, VisibilityList &list, const T &objects,
                                        size_t begin_index, size_t end_index, const Func &filter_func)
 {
+	size_t list_begin = list.size();
 	for (size_t i = begin_index; i < end_index; i++)
 	{
 		auto &o = objects[i];
@@ -96,6 +107,8 @@ static void gather_visible_renderables(const Frustum &frustum, VisibilityList &l
 		else
 			list.push_back({ renderable->renderable.get(), nullptr, h.get() });
 	}
+
+	record_visibility_metrics(end_index - begin_index, list.size() - list_begin);
 }
 
 void Scene::add_render_passes(RenderGraph &graph)
@@ -609,12 +622,47 @@ void Scene::update_transform_tree(TaskComposer *composer)
 			uint32_t num_pending_levels = 32 - Util::leading_zeroes(mask);
 
 			TaskComposer stage_composer(thread_group);
-			for (unsigned level = 0, count = num_pending_levels; level < count; level++)
+			unsigned level = 0;
+			while (level < num_pending_levels)
 			{
+				// Every level is a barrier, so deep hierarchies with few nodes per level
+				// would spend most of their time in stage transitions.
+				// Run consecutive small levels back to back in a single task instead.
+				uint32_t serial_work = 0;
+				unsigned end_level = level;
+				while (end_level < num_pending_levels &&
+				       serial_work + pending_node_update_per_level[end_level].size() <= SerialTransformUpdateNodes)
+				{
+					serial_work += pending_node_update_per_level[end_level].size();
+					end_level++;
+				}
+
 				auto &level_group = stage_composer.begin_pipeline_stage();
-				level_group.set_desc("perform-per-level-update");
-				perform_per_level_updates(level, &level_group);
+				if (end_level > level + 1)
+				{
+					level_group.set_desc("perform-per-level-update-serial");
+					level_group.enqueue_task([this, level, end_level]() {
+						for (unsigned l = level; l < end_level; l++)
+							perform_per_level_updates(l, nullptr);
+					});
+					level = end_level;
+				}
+				else
+				{
+					level_group.set_desc("perform-per-level-update");
+					perform_per_level_updates(level, &level_group);
+					level++;
+				}
 			}
+
+			// Bones can live at any level, so palettes are built once all levels are done.
+			if (pending_node_updates_skin.size())
+			{
+				auto &skin_group = stage_composer.begin_pipeline_stage();
+				skin_group.set_desc("perform-update-skinning");
+				perform_skinning_updates(&skin_group);
+			}
+
 			stage_composer.add_outgoing_dependency(*h);
 			h->flush();
 		});
@@ -628,26 +676,8 @@ void Scene::update_transform_tree(TaskComposer *composer)
 			for (unsigned level = 0, count = num_pending_levels; level < count; level++)
 				perform_per_level_updates(level, nullptr);
 		}
-	}
 
-	if (composer)
-	{
-		auto &group = composer->begin_pipeline_stage();
-		group.set_desc("perform-update-skinning");
-
-		group.enqueue_task([this, h = composer->get_deferred_enqueue_handle()]() mutable {
-			pending_node_updates_skin.for_each_ranged([&](Node *const *updates, size_t count) {
-				h->enqueue_task([=]() {
-					perform_update_skinning(updates, count);
-				});
-			});
-		});
-	}
-	else
-	{
-		pending_node_updates_skin.for_each_ranged([](Node *const *updates, size_t count) {
-			perform_update_skinning(updates, count);
-		});
+		perform_skinning_updates(nullptr);
 	}
 
 	if (composer)
@@ -875,24 +905,34 @@ void Scene::distribute_per_level_updates(TaskGroup *group)
 	}
 }
 
-static void update_transform_tree_node(Node &node, const mat4 &transform)
-{
-	node.get_cached_prev_transform() = node.get_cached_transform();
-	auto &t = node.get_transform();
-	compute_model_transform(node.get_cached_transform(), t.scale, t.rotation, t.translation, transform);
-
-	node.update_timestamp();
-	node.clear_pending_update_no_atomic();
-}
-
 static void perform_updates(Node * const *updates, size_t count)
 {
-	for (size_t i = 0; i < count; i++)
+	constexpr size_t BatchSize = 64;
+	mat4 *world[BatchSize];
+	const Transform *local[BatchSize];
+	const mat4 *parent[BatchSize];
+
+	for (size_t base = 0; base < count; base += BatchSize)
 	{
-		auto *update = updates[i];
-		auto *parent = update->get_parent();
-		auto &transform = parent ? parent->get_cached_transform() : identity_transform;
-		update_transform_tree_node(*update, transform);
+		size_t n = std::min<size_t>(BatchSize, count - base);
+		for (size_t i = 0; i < n; i++)
+		{
+			auto *update = updates[base + i];
+			auto *parent_node = update->get_parent();
+			auto &cached = update->get_cached_transform();
+			update->get_cached_prev_transform() = cached;
+			world[i] = &cached;
+			local[i] = &update->get_transform();
+			parent[i] = parent_node ? &parent_node->get_cached_transform() : &identity_transform;
+		}
+
+		compute_model_transforms(world, local, parent, n);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			updates[base + i]->update_timestamp();
+			updates[base + i]->clear_pending_update_no_atomic();
+		}
 	}
 }
 
@@ -914,6 +954,34 @@ void Scene::perform_per_level_updates(unsigned level, TaskGroup *group)
 	}
 }
 
+void Scene::perform_skinning_updates(TaskGroup *group)
+{
+	pending_node_updates_skin.for_each_ranged([group](Node *const *updates, size_t count) {
+		// Skeletons vary wildly in size, so split ranges by bone count rather than node count.
+		size_t begin = 0;
+		size_t bones = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			bones += updates[i]->get_skin()->transform.count;
+			if (bones < SkinningBonesPerTask && i + 1 < count)
+				continue;
+
+			size_t range_count = i + 1 - begin;
+			if (group)
+			{
+				group->enqueue_task([=]() {
+					perform_update_skinning(updates + begin, range_count);
+				});
+			}
+			else
+				perform_update_skinning(updates + begin, range_count);
+
+			begin = i + 1;
+			bones = 0;
+		}
+	});
+}
+
 NodeHandle Scene::create_node()
 {
 	return NodeHandle(node_pool.allocate(*this));
@@ -312,10 +312,13 @@ private:
 
 	// New transform update system:
 	enum { MaxNodeHierarchyLevels = 32 };
+	// Work sizes used when splitting transform updates into tasks.
+	enum { SerialTransformUpdateNodes = 1024, SkinningBonesPerTask = 2048 };
 	void push_pending_node_update(Node *node);
 	void distribute_per_level_updates(TaskGroup *group);
 	void distribute_update_to_level(Node *update, unsigned level);
 	void perform_per_level_updates(unsigned level, TaskGroup *group);
+	void perform_skinning_updates(TaskGroup *group);
 	Util::AtomicAppendBuffer<Node *, 8> pending_node_updates;
 	Util::AtomicAppendBuffer<Node *, 8> pending_node_updates_skin;
 	Util::AtomicAppendBuffer<Node *, 8> pending_node_update_per_level[MaxNodeHierarchyLevels];
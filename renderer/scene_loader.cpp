@@ -600,7 +600,27 @@ NodeHandle SceneLoader::parse_scene_format(const std::string &path, const std::s
 			transform.rotation = quat(1.0f, 0.0f, 0.0f, 0.0f);
 	};
 
-	if (doc.HasMember("terrain"))
+	if (doc.HasMember("terrain") && doc["terrain"].HasMember("tiles"))
+	{
+		auto &terrain = doc["terrain"];
+
+		StreamingGround::Info info;
+		info.tiles = Path::relpath(path, terrain["tiles"].GetString());
+		info.base_color = Path::relpath(path, terrain["baseColorTexture"].GetString());
+		info.normalmap_fine = Path::relpath(path, terrain["normalTexture"].GetString());
+
+		if (terrain.HasMember("bandlimitedPixel"))
+			info.bandlimited_pixel = terrain["bandlimitedPixel"].GetBool();
+		if (terrain.HasMember("tilingFactor"))
+			info.detail_tiling = terrain["tilingFactor"].GetFloat();
+		if (terrain.HasMember("maxPixelError"))
+			info.max_pixel_error = terrain["maxPixelError"].GetFloat();
+
+		auto handles = StreamingGround::add_to_scene(*scene, info);
+		read_transform(handles.node->get_transform(), terrain);
+		root->add_child(handles.node);
+	}
+	else if (doc.HasMember("terrain"))
 	{
 		auto &terrain = doc["terrain"];
 
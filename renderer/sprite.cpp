@@ -21,6 +21,7 @@
  */
 
 #include "sprite.hpp"
+#include "flat_renderer.hpp"
 #include "device.hpp"
 #include "render_context.hpp"
 #include <string.h>
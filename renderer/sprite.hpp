@@ -24,7 +24,7 @@
 
 #include "abstract_renderable.hpp"
 #include "resource_manager.hpp"
-#include "flat_renderer.hpp"
+#include "render_queue.hpp"
 
 namespace Granite
 {
@@ -72,7 +72,8 @@ struct Sprite : AbstractRenderable
 		LUMA_TO_ALPHA_BIT = 1 << 2,
 		CLEAR_ALPHA_TO_ZERO_BIT = 1 << 3,
 		ALPHA_TEXTURE_BIT = 1 << 4,
-		ARRAY_TEXTURE_BIT = 1 << 5
+		ARRAY_TEXTURE_BIT = 1 << 5,
+		SDF_TEXTURE_BIT = 1 << 6
 	};
 	using ShaderVariantFlags = uint32_t;
 
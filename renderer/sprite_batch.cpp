@@ -0,0 +1,438 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sprite_batch.hpp"
+#include "flat_renderer.hpp"
+#include "device.hpp"
+#include <algorithm>
+#include <numeric>
+#include <string.h>
+
+using namespace Util;
+
+namespace Granite
+{
+namespace RenderFunctions
+{
+void sprite_batch_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos, unsigned instances)
+{
+	auto &info = *static_cast<const SpriteBatchRenderInfo *>(infos->render_info);
+	cmd.set_program(info.program);
+
+	if (info.textures[0])
+	{
+		struct Push
+		{
+			alignas(8) vec2 resolution;
+			alignas(8) vec2 inv_resolution;
+		} push;
+
+		push.resolution.x = info.textures[0]->get_image().get_width();
+		push.resolution.y = info.textures[0]->get_image().get_height();
+		push.inv_resolution = 1.0f / push.resolution;
+
+		*cmd.allocate_typed_constant_data<Push>(3, 0, 1) = push;
+
+		cmd.set_texture(2, 0, *info.textures[0], info.sampler);
+		if (info.textures[1])
+			cmd.set_texture(2, 1, *info.textures[1], info.sampler);
+	}
+
+	VkRect2D sci;
+	sci.offset.x = info.clip_quad.x;
+	sci.offset.y = info.clip_quad.y;
+	sci.extent.width = uint32_t(info.clip_quad.z);
+	sci.extent.height = uint32_t(info.clip_quad.w);
+	cmd.set_scissor(sci);
+
+	cmd.set_primitive_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
+	Vulkan::CommandBufferUtil::set_quad_vertex_state(cmd);
+
+	auto &layout = info.layout;
+	cmd.set_vertex_binding(1, *layout.buffer, layout.transform_offset,
+	                       sizeof(SpriteBatch::Transform), VK_VERTEX_INPUT_RATE_INSTANCE);
+	cmd.set_vertex_binding(2, *layout.buffer, layout.tex_coord_offset,
+	                       sizeof(SpriteBatch::TexCoord), VK_VERTEX_INPUT_RATE_INSTANCE);
+	cmd.set_vertex_binding(3, *layout.buffer, layout.attribute_offset,
+	                       sizeof(SpriteBatch::Attributes), VK_VERTEX_INPUT_RATE_INSTANCE);
+
+	cmd.set_vertex_attrib(1, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(SpriteBatch::Transform, pos_off_scale));
+	cmd.set_vertex_attrib(2, 2, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(SpriteBatch::TexCoord, tex_off_scale));
+	cmd.set_vertex_attrib(3, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(SpriteBatch::Transform, rotation));
+	cmd.set_vertex_attrib(4, 3, VK_FORMAT_R8G8B8A8_UNORM, offsetof(SpriteBatch::Attributes, color));
+	cmd.set_vertex_attrib(5, 3, VK_FORMAT_R32_SFLOAT, offsetof(SpriteBatch::Attributes, layer));
+	if (info.textures[1])
+		cmd.set_vertex_attrib(6, 3, VK_FORMAT_R32_SFLOAT, offsetof(SpriteBatch::Attributes, blend_factor));
+	if (info.array_texture)
+		cmd.set_vertex_attrib(7, 3, VK_FORMAT_R32_SFLOAT, offsetof(SpriteBatch::Attributes, array_layer));
+
+	for (unsigned i = 0; i < instances; i++)
+	{
+		auto &range = *static_cast<const SpriteBatchInstanceInfo *>(infos[i].instance_data);
+		cmd.draw(4, range.count, 0, range.first);
+	}
+}
+}
+
+SpriteBatch::SpriteBatch(bool is_static)
+	: static_batch(is_static)
+{
+}
+
+void SpriteBatch::clear()
+{
+	transforms.clear();
+	tex_coords.clear();
+	attributes.clear();
+	sprite_groups.clear();
+	sprite_layers.clear();
+	groups.clear();
+	group_map.clear();
+	last_group = UINT32_MAX;
+	layers.clear();
+	layer_map.clear();
+	dirty = true;
+}
+
+static bool group_equal(const SpriteBatch::Group &a, const SpriteBatch::Group &b)
+{
+	return a.textures[0] == b.textures[0] && a.textures[1] == b.textures[1] &&
+	       a.sampler == b.sampler && a.pipeline == b.pipeline &&
+	       a.shader_flags == b.shader_flags && all(equal(a.clip, b.clip));
+}
+
+uint32_t SpriteBatch::find_group(const Group &group)
+{
+	// Sprites tend to come in long runs of the same state, skip hashing for those.
+	if (last_group != UINT32_MAX && group_equal(groups[last_group], group))
+		return last_group;
+
+	Hasher h;
+	h.u32(group.textures[0].id);
+	h.u32(group.textures[1].id);
+	h.s32(ecast(group.sampler));
+	h.s32(ecast(group.pipeline));
+	h.u32(group.shader_flags);
+	h.s32(group.clip.x);
+	h.s32(group.clip.y);
+	h.s32(group.clip.z);
+	h.s32(group.clip.w);
+
+	auto itr = group_map.find(h.get());
+	if (itr != group_map.end())
+	{
+		last_group = itr->second;
+		return last_group;
+	}
+
+	last_group = uint32_t(groups.size());
+	groups.push_back(group);
+	group_map[h.get()] = last_group;
+	return last_group;
+}
+
+uint32_t SpriteBatch::find_layer(float layer)
+{
+	Hash hash = floatBitsToUint(layer);
+	auto itr = layer_map.find(hash);
+	if (itr != layer_map.end())
+		return itr->second;
+
+	auto index = uint32_t(layers.size());
+	layers.push_back(layer);
+	layer_map[hash] = index;
+	return index;
+}
+
+void SpriteBatch::push(const Sprite &sprite, const SpriteTransformInfo &transform, unsigned array_layer)
+{
+	Group group;
+	group.textures[0] = sprite.texture;
+	group.textures[1] = sprite.texture_alt;
+	group.sampler = sprite.sampler;
+	group.pipeline = sprite.pipeline;
+	group.clip = transform.clip;
+	group.shader_flags = 0;
+	if (sprite.bandlimited_pixel)
+		group.shader_flags |= Sprite::BANDLIMITED_PIXEL_BIT;
+	if (sprite.texture_alt)
+		group.shader_flags |= Sprite::BLEND_TEXUTRE_BIT;
+	if (sprite.luma_to_alpha)
+		group.shader_flags |= Sprite::LUMA_TO_ALPHA_BIT;
+	if (sprite.clear_alpha_to_zero)
+		group.shader_flags |= Sprite::CLEAR_ALPHA_TO_ZERO_BIT;
+
+	uint32_t group_index = find_group(group);
+	sprite_groups.push_back(group_index);
+
+	// Only transparent sprites need ordering by layer, opaque ones rely on depth testing.
+	if (sprite.pipeline == DrawPipeline::AlphaBlend)
+		sprite_layers.push_back(find_layer(transform.position.z));
+	else
+		sprite_layers.push_back(0);
+
+	Transform t;
+	t.pos_off_scale[0] = transform.position.x;
+	t.pos_off_scale[1] = transform.position.y;
+	t.pos_off_scale[2] = float(sprite.size.x) * transform.scale.x;
+	t.pos_off_scale[3] = float(sprite.size.y) * transform.scale.y;
+	t.rotation[0] = transform.rotation[0].x;
+	t.rotation[1] = transform.rotation[0].y;
+	t.rotation[2] = transform.rotation[1].x;
+	t.rotation[3] = transform.rotation[1].y;
+	transforms.push_back(t);
+
+	TexCoord tex;
+	tex.tex_off_scale[0] = float(sprite.tex_offset.x);
+	tex.tex_off_scale[1] = float(sprite.tex_offset.y);
+	tex.tex_off_scale[2] = float(sprite.size.x);
+	tex.tex_off_scale[3] = float(sprite.size.y);
+	tex_coords.push_back(tex);
+
+	Attributes attr;
+	memcpy(attr.color, sprite.color, sizeof(attr.color));
+	attr.layer = transform.position.z;
+	attr.blend_factor = sprite.texture_blending_factor;
+	attr.array_layer = float(array_layer);
+	attributes.push_back(attr);
+
+	dirty = true;
+}
+
+static unsigned bits_for_count(size_t count)
+{
+	unsigned bits = 0;
+	while (count > (size_t(1) << bits))
+		bits++;
+	return bits;
+}
+
+unsigned SpriteBatch::compute_keys()
+{
+	// Back-to-front, so the furthest layer gets the lowest rank.
+	std::vector<uint32_t> order(layers.size());
+	std::iota(order.begin(), order.end(), 0u);
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+		return layers[a] > layers[b];
+	});
+	std::vector<uint32_t> ranks(layers.size());
+	for (uint32_t i = 0; i < uint32_t(order.size()); i++)
+		ranks[order[i]] = i;
+
+	unsigned group_bits = bits_for_count(groups.size());
+	unsigned layer_bits = bits_for_count(layers.size());
+
+	// With very many distinct layers, neighbouring layers share a bucket and keep submission order.
+	unsigned layer_shift = 0;
+	if (1 + layer_bits + group_bits > 32)
+	{
+		layer_shift = 1 + layer_bits + group_bits - 32;
+		layer_bits -= layer_shift;
+	}
+
+	uint32_t transparent_bit = 1u << (layer_bits + group_bits);
+	size_t count = transforms.size();
+	keys.resize(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t group = sprite_groups[i];
+		if (groups[group].pipeline == DrawPipeline::AlphaBlend)
+			keys[i] = transparent_bit | ((ranks[sprite_layers[i]] >> layer_shift) << group_bits) | group;
+		else
+			keys[i] = group;
+	}
+
+	return 1 + layer_bits + group_bits;
+}
+
+void SpriteBatch::gather(const uint32_t *order)
+{
+	size_t count = transforms.size();
+	sorted_transforms.resize(count);
+	sorted_tex_coords.resize(count);
+	sorted_attributes.resize(count);
+
+	if (order)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t index = order[i];
+			sorted_transforms[i] = transforms[index];
+			sorted_tex_coords[i] = tex_coords[index];
+			sorted_attributes[i] = attributes[index];
+		}
+	}
+	else
+	{
+		memcpy(sorted_transforms.data(), transforms.data(), count * sizeof(Transform));
+		memcpy(sorted_tex_coords.data(), tex_coords.data(), count * sizeof(TexCoord));
+		memcpy(sorted_attributes.data(), attributes.data(), count * sizeof(Attributes));
+	}
+}
+
+template <typename Sorter>
+void SpriteBatch::sort(Sorter &sorter)
+{
+	size_t count = keys.size();
+	sorter.resize(count);
+	memcpy(sorter.code_data(), keys.data(), count * sizeof(uint32_t));
+	sorter.sort();
+	memcpy(keys.data(), sorter.code_data(), count * sizeof(uint32_t));
+	gather(sorter.indices_data());
+}
+
+void SpriteBatch::build_runs()
+{
+	runs.clear();
+
+	// Keys embed the exact group index in the low bits, so equal keys mean equal state.
+	uint32_t group_mask = (1u << bits_for_count(groups.size())) - 1u;
+	uint32_t count = uint32_t(keys.size());
+
+	for (uint32_t i = 0; i < count; )
+	{
+		uint32_t key = keys[i];
+		uint32_t end = i + 1;
+		while (end < count && keys[end] == key)
+			end++;
+
+		runs.push_back({ key & group_mask, i, end - i, sorted_attributes[i].layer });
+		i = end;
+	}
+}
+
+void SpriteBatch::prepare()
+{
+	if (!dirty)
+		return;
+
+	dirty = false;
+	upload_dirty = true;
+
+	unsigned key_bits = compute_keys();
+
+	// Static content is often pushed in order already, no need to sort then.
+	if (std::is_sorted(keys.begin(), keys.end()))
+		gather(nullptr);
+	else if (key_bits <= 16)
+		sort(sorter16);
+	else
+		sort(sorter32);
+
+	build_runs();
+}
+
+bool SpriteBatch::upload(Vulkan::Device &device, uint64_t device_epoch)
+{
+	if (runs.empty())
+		return false;
+
+	size_t count = sorted_transforms.size();
+	VkDeviceSize transform_size = count * sizeof(Transform);
+	VkDeviceSize tex_coord_size = count * sizeof(TexCoord);
+	VkDeviceSize attribute_size = count * sizeof(Attributes);
+
+	// Offsets relative to the start of the streams.
+	VkDeviceSize tex_coord_offset = (transform_size + 15) & ~VkDeviceSize(15);
+	VkDeviceSize attribute_offset = (tex_coord_offset + tex_coord_size + 15) & ~VkDeviceSize(15);
+	VkDeviceSize total_size = attribute_offset + attribute_size;
+
+	auto write_streams = [&](uint8_t *dst) {
+		memcpy(dst, sorted_transforms.data(), transform_size);
+		memcpy(dst + tex_coord_offset, sorted_tex_coords.data(), tex_coord_size);
+		memcpy(dst + attribute_offset, sorted_attributes.data(), attribute_size);
+	};
+
+	VkDeviceSize base_offset = 0;
+
+	if (device_epoch != upload_epoch)
+	{
+		release_buffers();
+		upload_epoch = device_epoch;
+		upload_dirty = true;
+	}
+
+	Vulkan::BufferCreateInfo info = {};
+	info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+
+	if (static_batch)
+	{
+		if (upload_dirty || !static_buffer)
+		{
+			std::vector<uint8_t> staging(total_size);
+			write_streams(staging.data());
+			info.size = total_size;
+			info.domain = Vulkan::BufferDomain::Device;
+			static_buffer = device.create_buffer(info, staging.data());
+			device.set_name(*static_buffer, "sprite-batch-static");
+		}
+		layout.buffer = static_buffer.get();
+	}
+	else
+	{
+		// One persistent buffer per frame context, so the GPU is never reading what we write.
+		// Every upload within a frame gets its own range, since draws pushed earlier in the frame still read theirs.
+		// A frame context only becomes current again once the GPU is done with it, so its ranges can be reused then.
+		unsigned frame_context = device.get_current_frame_context();
+		frame_buffers.resize(device.get_num_frame_contexts());
+		auto &frame = frame_buffers[frame_context];
+		if (frame_context != last_frame_context)
+		{
+			frame.offset = 0;
+			last_frame_context = frame_context;
+		}
+
+		base_offset = (frame.offset + 63) & ~VkDeviceSize(63);
+		if (!frame.buffer || frame.buffer->get_create_info().size < base_offset + total_size)
+		{
+			// Draws of this frame keep the old buffer alive until the frame context is recycled.
+			info.size = frame.buffer ? std::max(total_size, 2 * frame.buffer->get_create_info().size) : total_size;
+			info.domain = Vulkan::BufferDomain::LinkedDeviceHost;
+			frame.buffer = device.create_buffer(info);
+			device.set_name(*frame.buffer, "sprite-batch-stream");
+			base_offset = 0;
+		}
+
+		auto *dst = static_cast<uint8_t *>(device.map_host_buffer(*frame.buffer, Vulkan::MEMORY_ACCESS_WRITE_BIT,
+		                                                          base_offset, total_size));
+		write_streams(dst);
+		device.unmap_host_buffer(*frame.buffer, Vulkan::MEMORY_ACCESS_WRITE_BIT, base_offset, total_size);
+		frame.offset = base_offset + total_size;
+		layout.buffer = frame.buffer.get();
+	}
+
+	layout.transform_offset = base_offset;
+	layout.tex_coord_offset = base_offset + tex_coord_offset;
+	layout.attribute_offset = base_offset + attribute_offset;
+
+	upload_dirty = false;
+	return true;
+}
+
+void SpriteBatch::release_buffers()
+{
+	static_buffer.reset();
+	frame_buffers.clear();
+	layout.buffer = nullptr;
+}
+}
@@ -0,0 +1,215 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "sprite.hpp"
+#include "buffer.hpp"
+#include "hashmap.hpp"
+#include "radix_sorter.hpp"
+#include <vector>
+
+namespace Granite
+{
+// Batched alternative to pushing sprites one by one through the render queue.
+// Sprites are appended to per-stream instance arrays and grouped by render state.
+// Before rendering, they are sorted once with a radix sort over compact keys,
+// uploaded in one go and submitted as one instanced draw per run of equal state.
+// A static batch keeps its sorted instance data in a device local buffer, so an unchanged
+// sprite layer costs nothing but a handful of queue entries per frame.
+// GPU buffers belong to the device, batches must not outlive it.
+class SpriteBatch
+{
+public:
+	explicit SpriteBatch(bool is_static = false);
+
+	void clear();
+	// array_layer selects the layer when the sprite texture is an array texture.
+	void push(const Sprite &sprite, const SpriteTransformInfo &transform, unsigned array_layer = 0);
+
+	size_t size() const
+	{
+		return transforms.size();
+	}
+
+	bool is_static() const
+	{
+		return static_batch;
+	}
+
+	// Instance streams, each bound as its own vertex buffer.
+	struct Transform
+	{
+		float pos_off_scale[4];
+		float rotation[4];
+	};
+
+	struct TexCoord
+	{
+		float tex_off_scale[4];
+	};
+
+	struct Attributes
+	{
+		uint8_t color[4];
+		float layer;
+		float blend_factor;
+		float array_layer;
+	};
+
+	struct Group
+	{
+		AssetID textures[2];
+		Vulkan::StockSampler sampler;
+		DrawPipeline pipeline;
+		Sprite::ShaderVariantFlags shader_flags;
+		ivec4 clip;
+	};
+
+	// A range of sorted sprites sharing a group. Transparent runs also share a layer.
+	struct Run
+	{
+		uint32_t group;
+		uint32_t first;
+		uint32_t count;
+		float layer;
+	};
+
+	// Sorts and groups pending sprites. Does nothing if the batch has not changed.
+	void prepare();
+
+	const std::vector<Run> &get_runs() const
+	{
+		return runs;
+	}
+
+	const Group &get_group(uint32_t index) const
+	{
+		return groups[index];
+	}
+
+	// Sorted streams, valid after prepare().
+	const Transform *get_sorted_transforms() const
+	{
+		return sorted_transforms.data();
+	}
+
+	const TexCoord *get_sorted_tex_coords() const
+	{
+		return sorted_tex_coords.data();
+	}
+
+	const Attributes *get_sorted_attributes() const
+	{
+		return sorted_attributes.data();
+	}
+
+	// Copies the sorted streams to the GPU. Static batches only upload after they changed.
+	// Dynamic batches may be uploaded several times per frame, every upload gets its own range.
+	// Returns false if there is nothing to draw.
+	bool upload(Vulkan::Device &device, uint64_t device_epoch);
+
+	struct StreamLayout
+	{
+		const Vulkan::Buffer *buffer;
+		VkDeviceSize transform_offset;
+		VkDeviceSize tex_coord_offset;
+		VkDeviceSize attribute_offset;
+	};
+
+	const StreamLayout &get_stream_layout() const
+	{
+		return layout;
+	}
+
+	void release_buffers();
+
+private:
+	std::vector<Transform> transforms;
+	std::vector<TexCoord> tex_coords;
+	std::vector<Attributes> attributes;
+	std::vector<uint32_t> sprite_groups;
+	std::vector<uint32_t> sprite_layers;
+
+	std::vector<Group> groups;
+	Util::HashMap<uint32_t> group_map;
+	uint32_t last_group = UINT32_MAX;
+
+	// Distinct layers of transparent sprites, in first-seen order.
+	std::vector<float> layers;
+	Util::HashMap<uint32_t> layer_map;
+
+	std::vector<Transform> sorted_transforms;
+	std::vector<TexCoord> sorted_tex_coords;
+	std::vector<Attributes> sorted_attributes;
+	std::vector<Run> runs;
+
+	Util::RadixSorter<uint32_t, 8, 8> sorter16;
+	Util::RadixSorter<uint32_t, 8, 8, 8, 8> sorter32;
+	std::vector<uint32_t> keys;
+
+	Vulkan::BufferHandle static_buffer;
+	struct FrameBuffer
+	{
+		Vulkan::BufferHandle buffer;
+		VkDeviceSize offset = 0;
+	};
+	std::vector<FrameBuffer> frame_buffers;
+	unsigned last_frame_context = UINT32_MAX;
+	StreamLayout layout = {};
+	uint64_t upload_epoch = 0;
+
+	bool static_batch;
+	bool dirty = false;
+	bool upload_dirty = false;
+
+	uint32_t find_group(const Group &group);
+	uint32_t find_layer(float layer);
+	unsigned compute_keys();
+	template <typename Sorter>
+	void sort(Sorter &sorter);
+	void gather(const uint32_t *order);
+	void build_runs();
+};
+
+namespace RenderFunctions
+{
+void sprite_batch_render(Vulkan::CommandBuffer &cmd, const RenderQueueData *infos, unsigned instances);
+}
+
+// Render info for one run of a SpriteBatch.
+struct SpriteBatchRenderInfo
+{
+	const Vulkan::ImageView *textures[2] = {};
+	Vulkan::Program *program = nullptr;
+	Vulkan::StockSampler sampler;
+	ivec4 clip_quad = ivec4(0, 0, 0x4000, 0x4000);
+	SpriteBatch::StreamLayout layout = {};
+	bool array_texture = false;
+};
+
+struct SpriteBatchInstanceInfo
+{
+	uint32_t first;
+	uint32_t count;
+};
+}
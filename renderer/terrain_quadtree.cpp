@@ -0,0 +1,313 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "terrain_quadtree.hpp"
+#include "simd.hpp"
+#include "logging.hpp"
+#include "bitops.hpp"
+#include <algorithm>
+#include <float.h>
+
+namespace Granite
+{
+bool TerrainTileDirectory::init_layout(unsigned size_, unsigned tile_size_)
+{
+	if (tile_size_ < 2 || !Util::is_pow2(tile_size_))
+	{
+		LOGE("Terrain tile size %u must be a power of two.\n", tile_size_);
+		return false;
+	}
+
+	if (size_ < tile_size_ || (size_ % tile_size_) != 0 || !Util::is_pow2(size_ / tile_size_))
+	{
+		LOGE("Terrain size %u must be a power-of-two multiple of tile size %u.\n", size_, tile_size_);
+		return false;
+	}
+
+	size = size_;
+	tile_size = tile_size_;
+	level_offsets.clear();
+
+	unsigned num_tiles = 0;
+	for (unsigned tiles_per_axis = size / tile_size; tiles_per_axis; tiles_per_axis >>= 1)
+	{
+		level_offsets.push_back(num_tiles);
+		num_tiles += tiles_per_axis * tiles_per_axis;
+	}
+
+	tiles.clear();
+	tiles.resize(num_tiles);
+	return true;
+}
+
+void TerrainTileDirectory::compute_bounds(const TerrainHeightSource &source)
+{
+	unsigned tiles_per_axis = get_tiles_per_axis(0);
+	for (unsigned tz = 0; tz < tiles_per_axis; tz++)
+	{
+		for (unsigned tx = 0; tx < tiles_per_axis; tx++)
+		{
+			float lo = FLT_MAX;
+			float hi = -FLT_MAX;
+			for (unsigned z = 0; z <= tile_size; z++)
+			{
+				for (unsigned x = 0; x <= tile_size; x++)
+				{
+					float h = source.sample(tx * tile_size + x, tz * tile_size + z);
+					lo = std::min(lo, h);
+					hi = std::max(hi, h);
+				}
+			}
+
+			auto &tile = tiles[get_tile_index(0, tx, tz)];
+			tile.min_height = lo;
+			tile.max_height = hi;
+			tile.geometric_error = 0.0f;
+		}
+	}
+
+	for (unsigned level = 1; level < get_num_levels(); level++)
+	{
+		tiles_per_axis = get_tiles_per_axis(level);
+		unsigned half_stride = 1u << (level - 1);
+
+		for (unsigned tz = 0; tz < tiles_per_axis; tz++)
+		{
+			for (unsigned tx = 0; tx < tiles_per_axis; tx++)
+			{
+				auto &tile = tiles[get_tile_index(level, tx, tz)];
+				tile.min_height = FLT_MAX;
+				tile.max_height = -FLT_MAX;
+
+				float child_error = 0.0f;
+				for (unsigned cz = 0; cz < 2; cz++)
+				{
+					for (unsigned cx = 0; cx < 2; cx++)
+					{
+						auto &child = tiles[get_tile_index(level - 1, 2 * tx + cx, 2 * tz + cz)];
+						tile.min_height = std::min(tile.min_height, child.min_height);
+						tile.max_height = std::max(tile.max_height, child.max_height);
+						child_error = std::max(child_error, child.geometric_error);
+					}
+				}
+
+				// Compare against the samples of the next finer level.
+				// Samples at even positions exist in this level as well, the rest are interpolated.
+				unsigned base_x = tx * tile_size << level;
+				unsigned base_z = tz * tile_size << level;
+				const auto fine = [&](unsigned x, unsigned z) {
+					return source.sample(base_x + x * half_stride, base_z + z * half_stride);
+				};
+
+				float error = 0.0f;
+				for (unsigned z = 0; z <= 2 * tile_size; z++)
+				{
+					for (unsigned x = 0; x <= 2 * tile_size; x++)
+					{
+						if (((x | z) & 1) == 0)
+							continue;
+
+						unsigned x0 = x & ~1u, z0 = z & ~1u;
+						unsigned x1 = x0 + ((x & 1) << 1), z1 = z0 + ((z & 1) << 1);
+						float interpolated = 0.25f * (fine(x0, z0) + fine(x1, z0) + fine(x0, z1) + fine(x1, z1));
+						error = std::max(error, muglm::abs(interpolated - fine(x, z)));
+					}
+				}
+
+				tile.geometric_error = error + child_error;
+			}
+		}
+	}
+}
+
+void TerrainQuadtree::init(const TerrainTileDirectory &directory_, float sample_spacing_,
+                           float height_scale_, float height_offset_)
+{
+	directory = &directory_;
+	sample_spacing = sample_spacing_;
+	height_scale = height_scale_;
+	height_offset = height_offset_;
+
+	resident.clear();
+	resident.resize(directory->get_num_tiles());
+	selected_mask.clear();
+	selected_mask.resize(directory->get_num_tiles());
+	selected.clear();
+	refined.clear();
+	requests.clear();
+}
+
+void TerrainQuadtree::set_resident(unsigned tile, bool resident_)
+{
+	resident[tile] = uint8_t(resident_);
+}
+
+unsigned TerrainQuadtree::get_root_tile() const
+{
+	return directory->get_tile_index(directory->get_num_levels() - 1, 0, 0);
+}
+
+float TerrainQuadtree::get_tile_extent(unsigned level) const
+{
+	return float(directory->get_tile_size() << level) * sample_spacing;
+}
+
+AABB TerrainQuadtree::get_tile_aabb(unsigned level, unsigned x, unsigned z) const
+{
+	auto &tile = directory->get_tile(directory->get_tile_index(level, x, z));
+	float extent = get_tile_extent(level);
+	vec3 lo(float(x) * extent, height_offset + tile.min_height * height_scale, float(z) * extent);
+	vec3 hi(lo.x + extent, height_offset + tile.max_height * height_scale, lo.z + extent);
+	return { lo, hi };
+}
+
+float TerrainQuadtree::compute_screen_space_error(unsigned level, unsigned x, unsigned z,
+                                                  const Parameters &params) const
+{
+	auto &tile = directory->get_tile(directory->get_tile_index(level, x, z));
+	AABB aabb = get_tile_aabb(level, x, z);
+	vec3 closest = clamp(params.camera_position, aabb.get_minimum(), aabb.get_maximum());
+	float dist = length(closest - params.camera_position);
+	return tile.geometric_error * muglm::abs(height_scale) * params.lod_scale / muglm::max(dist, 0.0001f);
+}
+
+bool TerrainQuadtree::is_visible(const AABB &aabb, const Parameters &params) const
+{
+	return !params.frustum_planes || SIMD::frustum_cull(aabb, params.frustum_planes);
+}
+
+void TerrainQuadtree::select_node(unsigned level, unsigned x, unsigned z)
+{
+	SelectedNode node = {};
+	node.tile = directory->get_tile_index(level, x, z);
+	node.level = level;
+	node.x = x;
+	node.z = z;
+	selected_mask[node.tile] = 1;
+	selected.push_back(node);
+}
+
+void TerrainQuadtree::traverse(unsigned level, unsigned x, unsigned z, const Parameters &params)
+{
+	if (!is_visible(get_tile_aabb(level, x, z), params))
+		return;
+
+	if (level == 0)
+	{
+		select_node(level, x, z);
+		return;
+	}
+
+	float sse = compute_screen_space_error(level, x, z, params);
+	if (sse <= params.max_pixel_error)
+	{
+		select_node(level, x, z);
+		return;
+	}
+
+	bool children_resident = true;
+	for (unsigned i = 0; i < 4; i++)
+	{
+		unsigned cx = 2 * x + (i & 1);
+		unsigned cz = 2 * z + (i >> 1);
+		unsigned child = directory->get_tile_index(level - 1, cx, cz);
+		if (!resident[child] && is_visible(get_tile_aabb(level - 1, cx, cz), params))
+		{
+			children_resident = false;
+			requests.push_back({ child, sse });
+		}
+	}
+
+	if (!children_resident)
+	{
+		select_node(level, x, z);
+		return;
+	}
+
+	refined.push_back(directory->get_tile_index(level, x, z));
+	for (unsigned i = 0; i < 4; i++)
+		traverse(level - 1, 2 * x + (i & 1), 2 * z + (i >> 1), params);
+}
+
+unsigned TerrainQuadtree::find_selected_level(unsigned level, int x, int z) const
+{
+	int tiles_per_axis = int(directory->get_tiles_per_axis(level));
+	if (x < 0 || z < 0 || x >= tiles_per_axis || z >= tiles_per_axis)
+		return ~0u;
+
+	for (unsigned l = level; l < directory->get_num_levels(); l++, x >>= 1, z >>= 1)
+		if (selected_mask[directory->get_tile_index(l, unsigned(x), unsigned(z))])
+			return l;
+
+	return ~0u;
+}
+
+void TerrainQuadtree::compute_edge_lods()
+{
+	static const int offsets[EdgeCount][2] = { { -1, 0 }, { +1, 0 }, { 0, -1 }, { 0, +1 } };
+
+	// Beyond this point, a coarser neighbor's edge vertices no longer line up with our corners.
+	unsigned max_edge_lod = Util::floor_log2(directory->get_tile_size());
+
+	for (auto &node : selected)
+	{
+		for (unsigned edge = 0; edge < EdgeCount; edge++)
+		{
+			// If the neighbor is finer, or not selected at all, it's the neighbor's responsibility to adapt.
+			unsigned neighbor_level = find_selected_level(node.level,
+			                                              int(node.x) + offsets[edge][0],
+			                                              int(node.z) + offsets[edge][1]);
+			if (neighbor_level != ~0u && neighbor_level > node.level)
+				node.edge_lod[edge] = std::min(neighbor_level - node.level, max_edge_lod);
+			else
+				node.edge_lod[edge] = 0;
+		}
+	}
+}
+
+void TerrainQuadtree::select(const Parameters &params)
+{
+	for (auto &node : selected)
+		selected_mask[node.tile] = 0;
+	selected.clear();
+	refined.clear();
+	requests.clear();
+
+	if (!directory || directory->get_num_tiles() == 0)
+		return;
+
+	unsigned root_level = directory->get_num_levels() - 1;
+	unsigned root = get_root_tile();
+	if (!resident[root])
+	{
+		requests.push_back({ root, FLT_MAX });
+		return;
+	}
+
+	traverse(root_level, 0, 0, params);
+	compute_edge_lods();
+
+	std::sort(requests.begin(), requests.end(), [](const StreamRequest &a, const StreamRequest &b) {
+		return a.priority > b.priority;
+	});
+}
+}
@@ -0,0 +1,208 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "math.hpp"
+#include "aabb.hpp"
+#include <vector>
+#include <stdint.h>
+
+namespace Granite
+{
+// Provides normalized [0, 1] heights for a square heightfield.
+// A heightfield of size N has (N + 1) x (N + 1) samples so that tiles can share their border samples.
+class TerrainHeightSource
+{
+public:
+	virtual ~TerrainHeightSource() = default;
+	virtual unsigned get_size() const = 0;
+	virtual float sample(unsigned x, unsigned z) const = 0;
+};
+
+// Describes the tile hierarchy of a terrain.
+// Level 0 is the finest level. Every coarser level halves the number of tiles along each axis
+// by decimating samples with a stride of 2, until the entire terrain fits in one tile.
+// Every tile has (tile_size + 1) x (tile_size + 1) samples regardless of level.
+class TerrainTileDirectory
+{
+public:
+	struct Tile
+	{
+		float min_height = 0.0f;
+		float max_height = 0.0f;
+		// Largest normalized height deviation between this tile and level 0,
+		// when rendered with bilinear interpolation.
+		float geometric_error = 0.0f;
+	};
+
+	bool init_layout(unsigned size, unsigned tile_size);
+	void compute_bounds(const TerrainHeightSource &source);
+
+	unsigned get_size() const
+	{
+		return size;
+	}
+
+	unsigned get_tile_size() const
+	{
+		return tile_size;
+	}
+
+	unsigned get_num_levels() const
+	{
+		return unsigned(level_offsets.size());
+	}
+
+	unsigned get_num_tiles() const
+	{
+		return unsigned(tiles.size());
+	}
+
+	unsigned get_tiles_per_axis(unsigned level) const
+	{
+		return (size / tile_size) >> level;
+	}
+
+	unsigned get_tile_index(unsigned level, unsigned x, unsigned z) const
+	{
+		return level_offsets[level] + z * get_tiles_per_axis(level) + x;
+	}
+
+	const Tile &get_tile(unsigned index) const
+	{
+		return tiles[index];
+	}
+
+	Tile &get_tile(unsigned index)
+	{
+		return tiles[index];
+	}
+
+private:
+	unsigned size = 0;
+	unsigned tile_size = 0;
+	std::vector<unsigned> level_offsets;
+	std::vector<Tile> tiles;
+};
+
+// Selects a crack-free set of tiles to render from a TerrainTileDirectory.
+// The hierarchy is traversed from the root, culled against the frustum and refined
+// until the projected geometric error is small enough.
+// A node is only refined when all its visible children are resident;
+// otherwise the node is drawn and its children are requested for streaming.
+class TerrainQuadtree
+{
+public:
+	enum Edge
+	{
+		EdgeNegativeX = 0,
+		EdgePositiveX = 1,
+		EdgeNegativeZ = 2,
+		EdgePositiveZ = 3,
+		EdgeCount
+	};
+
+	struct Parameters
+	{
+		// Camera position and frustum planes in terrain space.
+		vec3 camera_position = vec3(0.0f);
+		// 6 planes, or nullptr to disable culling.
+		const vec4 *frustum_planes = nullptr;
+		// Converts world space error at distance 1 into pixels,
+		// i.e. 0.5 * viewport_height * projection[1][1].
+		float lod_scale = 1.0f;
+		float max_pixel_error = 2.0f;
+	};
+
+	struct SelectedNode
+	{
+		unsigned tile;
+		unsigned level;
+		unsigned x, z;
+		// Number of levels the neighbor along each edge is coarser than this node.
+		// Edge vertices must be snapped to a stride of 1 << edge_lod to avoid cracks.
+		unsigned edge_lod[EdgeCount];
+	};
+
+	struct StreamRequest
+	{
+		unsigned tile;
+		float priority;
+	};
+
+	void init(const TerrainTileDirectory &directory, float sample_spacing, float height_scale, float height_offset);
+
+	void set_resident(unsigned tile, bool resident);
+	bool is_resident(unsigned tile) const
+	{
+		return resident[tile] != 0;
+	}
+
+	void select(const Parameters &params);
+
+	const std::vector<SelectedNode> &get_selected_nodes() const
+	{
+		return selected;
+	}
+
+	// Interior nodes which were refined through. These must stay resident as fallbacks.
+	const std::vector<unsigned> &get_refined_tiles() const
+	{
+		return refined;
+	}
+
+	// Sorted by descending priority.
+	const std::vector<StreamRequest> &get_stream_requests() const
+	{
+		return requests;
+	}
+
+	unsigned get_root_tile() const;
+	AABB get_tile_aabb(unsigned level, unsigned x, unsigned z) const;
+	float get_tile_extent(unsigned level) const;
+	float compute_screen_space_error(unsigned level, unsigned x, unsigned z, const Parameters &params) const;
+
+	const TerrainTileDirectory *get_directory() const
+	{
+		return directory;
+	}
+
+private:
+	const TerrainTileDirectory *directory = nullptr;
+	float sample_spacing = 1.0f;
+	float height_scale = 1.0f;
+	float height_offset = 0.0f;
+
+	std::vector<uint8_t> resident;
+	std::vector<uint8_t> selected_mask;
+	std::vector<SelectedNode> selected;
+	std::vector<unsigned> refined;
+	std::vector<StreamRequest> requests;
+
+	bool is_visible(const AABB &aabb, const Parameters &params) const;
+	void traverse(unsigned level, unsigned x, unsigned z, const Parameters &params);
+	void select_node(unsigned level, unsigned x, unsigned z);
+	unsigned find_selected_level(unsigned level, int x, int z) const;
+	void compute_edge_lods();
+};
+}
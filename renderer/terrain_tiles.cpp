@@ -0,0 +1,361 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "terrain_tiles.hpp"
+#include "logging.hpp"
+#include <string.h>
+#include <algorithm>
+
+using namespace Vulkan;
+
+namespace Granite
+{
+static const char terrain_magic[16] = "GRANITE TERRAIN";
+static constexpr uint32_t TerrainVersion = 1;
+static constexpr uint64_t TerrainPayloadAlignment = 64;
+
+struct TerrainFileHeader
+{
+	char magic[16];
+	uint32_t version;
+	uint32_t size;
+	uint32_t tile_size;
+	uint32_t num_levels;
+	uint32_t num_tiles;
+	float sample_spacing;
+	float height_scale;
+	float height_offset;
+};
+
+struct TerrainFileEntry
+{
+	uint64_t heights_offset;
+	uint64_t heights_size;
+	uint64_t normals_offset;
+	uint64_t normals_size;
+	float min_height;
+	float max_height;
+	float geometric_error;
+	float padding;
+};
+
+static uint64_t align_payload(uint64_t offset)
+{
+	return (offset + TerrainPayloadAlignment - 1) & ~(TerrainPayloadAlignment - 1);
+}
+
+static void init_height_texture(MemoryMappedTexture &tex, unsigned tile_size)
+{
+	tex.set_2d(VK_FORMAT_R16_UNORM, tile_size + 1, tile_size + 1);
+}
+
+static void init_normal_texture(MemoryMappedTexture &tex, unsigned tile_size)
+{
+	tex.set_2d(VK_FORMAT_R8G8_UNORM, tile_size + 1, tile_size + 1);
+	tex.set_generate_mipmaps_on_load(true);
+}
+
+static void write_tile(uint8_t *heights_dst, uint8_t *normals_dst,
+                       const TerrainHeightSource &source, const TerrainTileFileInfo &info,
+                       unsigned level, unsigned tx, unsigned tz)
+{
+	MemoryMappedTexture heights, normals;
+	init_height_texture(heights, info.tile_size);
+	init_normal_texture(normals, info.tile_size);
+
+	// The payloads live inside the mapping of the entire file.
+	heights.map_write(Util::make_handle<FileMapping>(FileHandle{}, 0, heights_dst, heights.get_required_size(),
+	                                                 0, heights.get_required_size()));
+	normals.map_write(Util::make_handle<FileMapping>(FileHandle{}, 0, normals_dst, normals.get_required_size(),
+	                                                 0, normals.get_required_size()));
+
+	unsigned size = source.get_size();
+	unsigned stride = 1u << level;
+	unsigned base_x = tx * info.tile_size << level;
+	unsigned base_z = tz * info.tile_size << level;
+
+	for (unsigned z = 0; z <= info.tile_size; z++)
+	{
+		for (unsigned x = 0; x <= info.tile_size; x++)
+		{
+			unsigned sx = base_x + x * stride;
+			unsigned sz = base_z + z * stride;
+
+			float h = muglm::clamp(source.sample(sx, sz), 0.0f, 1.0f);
+			*heights.get_layout().data_2d<uint16_t>(x, z) = uint16_t(muglm::round(h * 65535.0f));
+
+			// Gradients are taken at the resolution of this level so that the normals
+			// match the geometry which is actually rendered.
+			unsigned lo_x = sx >= stride ? sx - stride : sx;
+			unsigned hi_x = std::min(sx + stride, size);
+			unsigned lo_z = sz >= stride ? sz - stride : sz;
+			unsigned hi_z = std::min(sz + stride, size);
+
+			float dx = (source.sample(hi_x, sz) - source.sample(lo_x, sz)) * info.height_scale /
+			           (float(hi_x - lo_x) * info.sample_spacing);
+			float dz = (source.sample(sx, hi_z) - source.sample(sx, lo_z)) * info.height_scale /
+			           (float(hi_z - lo_z) * info.sample_spacing);
+			vec3 n = normalize(vec3(-dx, 1.0f, -dz));
+
+			auto *normal = normals.get_layout().data_2d<uint8_t>(x, z);
+			normal[0] = uint8_t(muglm::round(muglm::clamp(n.x * 0.5f + 0.5f, 0.0f, 1.0f) * 255.0f));
+			normal[1] = uint8_t(muglm::round(muglm::clamp(n.z * 0.5f + 0.5f, 0.0f, 1.0f) * 255.0f));
+		}
+	}
+}
+
+bool write_terrain_tile_file(Filesystem &fs, const std::string &path,
+                             const TerrainHeightSource &source, const TerrainTileFileInfo &info)
+{
+	TerrainTileDirectory directory;
+	if (!directory.init_layout(source.get_size(), info.tile_size))
+		return false;
+	directory.compute_bounds(source);
+
+	MemoryMappedTexture heights, normals;
+	init_height_texture(heights, info.tile_size);
+	init_normal_texture(normals, info.tile_size);
+	uint64_t heights_size = heights.get_required_size();
+	uint64_t normals_size = normals.get_required_size();
+
+	unsigned num_tiles = directory.get_num_tiles();
+	std::vector<TerrainFileEntry> entries(num_tiles);
+	uint64_t offset = align_payload(sizeof(TerrainFileHeader) + num_tiles * sizeof(TerrainFileEntry));
+
+	for (unsigned i = 0; i < num_tiles; i++)
+	{
+		auto &entry = entries[i];
+		auto &tile = directory.get_tile(i);
+		entry.heights_offset = offset;
+		entry.heights_size = heights_size;
+		offset = align_payload(offset + heights_size);
+		entry.normals_offset = offset;
+		entry.normals_size = normals_size;
+		offset = align_payload(offset + normals_size);
+		entry.min_height = tile.min_height;
+		entry.max_height = tile.max_height;
+		entry.geometric_error = tile.geometric_error;
+		entry.padding = 0.0f;
+	}
+
+	auto file = fs.open(path, FileMode::WriteOnly);
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	auto mapping = file->map_write(offset);
+	if (!mapping)
+	{
+		LOGE("Failed to map %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	auto *mapped = mapping->mutable_data<uint8_t>();
+	memset(mapped, 0, offset);
+
+	TerrainFileHeader header = {};
+	memcpy(header.magic, terrain_magic, sizeof(header.magic));
+	header.version = TerrainVersion;
+	header.size = directory.get_size();
+	header.tile_size = directory.get_tile_size();
+	header.num_levels = directory.get_num_levels();
+	header.num_tiles = num_tiles;
+	header.sample_spacing = info.sample_spacing;
+	header.height_scale = info.height_scale;
+	header.height_offset = info.height_offset;
+	memcpy(mapped, &header, sizeof(header));
+	memcpy(mapped + sizeof(header), entries.data(), num_tiles * sizeof(TerrainFileEntry));
+
+	for (unsigned level = 0; level < directory.get_num_levels(); level++)
+	{
+		unsigned tiles_per_axis = directory.get_tiles_per_axis(level);
+		for (unsigned tz = 0; tz < tiles_per_axis; tz++)
+		{
+			for (unsigned tx = 0; tx < tiles_per_axis; tx++)
+			{
+				auto &entry = entries[directory.get_tile_index(level, tx, tz)];
+				write_tile(mapped + entry.heights_offset, mapped + entry.normals_offset,
+				           source, info, level, tx, tz);
+			}
+		}
+	}
+
+	return true;
+}
+
+// Offsets come straight from the file, so avoid offset + size which can wrap around.
+static bool payload_in_range(uint64_t offset, uint64_t size, uint64_t file_size)
+{
+	return offset <= file_size && size <= file_size - offset;
+}
+
+bool TerrainTileFile::open(Filesystem &fs, const std::string &path)
+{
+	auto new_file = fs.open(path, FileMode::ReadOnly);
+	if (!new_file)
+	{
+		LOGE("Failed to open terrain %s.\n", path.c_str());
+		return false;
+	}
+
+	return open(std::move(new_file));
+}
+
+bool TerrainTileFile::open(FileHandle new_file)
+{
+	uint64_t file_size = new_file->get_size();
+	if (file_size < sizeof(TerrainFileHeader))
+	{
+		LOGE("Terrain file is too small.\n");
+		return false;
+	}
+
+	TerrainFileHeader header;
+	{
+		auto mapping = new_file->map_subset(0, sizeof(header));
+		if (!mapping)
+			return false;
+		memcpy(&header, mapping->data(), sizeof(header));
+	}
+
+	if (memcmp(header.magic, terrain_magic, sizeof(header.magic)) != 0 || header.version != TerrainVersion)
+	{
+		LOGE("Invalid terrain header.\n");
+		return false;
+	}
+
+	if (!directory.init_layout(header.size, header.tile_size) ||
+	    directory.get_num_levels() != header.num_levels ||
+	    directory.get_num_tiles() != header.num_tiles)
+	{
+		LOGE("Terrain tile layout does not match header.\n");
+		return false;
+	}
+
+	uint64_t entries_size = uint64_t(header.num_tiles) * sizeof(TerrainFileEntry);
+	if (sizeof(header) + entries_size > file_size)
+	{
+		LOGE("Terrain tile directory is out of range.\n");
+		return false;
+	}
+
+	std::vector<TerrainFileEntry> entries(header.num_tiles);
+	{
+		auto mapping = new_file->map_subset(sizeof(header), entries_size);
+		if (!mapping)
+			return false;
+		memcpy(entries.data(), mapping->data(), entries_size);
+	}
+
+	payloads.resize(header.num_tiles);
+	for (unsigned i = 0; i < header.num_tiles; i++)
+	{
+		auto &entry = entries[i];
+		if (!payload_in_range(entry.heights_offset, entry.heights_size, file_size) ||
+		    !payload_in_range(entry.normals_offset, entry.normals_size, file_size))
+		{
+			LOGE("Terrain tile %u is out of range.\n", i);
+			return false;
+		}
+
+		auto &tile = directory.get_tile(i);
+		tile.min_height = entry.min_height;
+		tile.max_height = entry.max_height;
+		tile.geometric_error = entry.geometric_error;
+		payloads[i] = { entry.heights_offset, entry.heights_size, entry.normals_offset, entry.normals_size };
+	}
+
+	info.tile_size = header.tile_size;
+	info.sample_spacing = header.sample_spacing;
+	info.height_scale = header.height_scale;
+	info.height_offset = header.height_offset;
+	file = std::move(new_file);
+	return true;
+}
+
+FileHandle TerrainTileFile::get_heights(unsigned tile) const
+{
+	auto &payload = payloads[tile];
+	return Util::make_handle<FileSlice>(file, payload.heights_offset, payload.heights_size);
+}
+
+FileHandle TerrainTileFile::get_normals(unsigned tile) const
+{
+	auto &payload = payloads[tile];
+	return Util::make_handle<FileSlice>(file, payload.normals_offset, payload.normals_size);
+}
+
+bool TerrainTextureHeightSource::init(const MemoryMappedTexture &texture)
+{
+	layout = &texture.get_layout();
+	width = layout->get_width();
+	height = layout->get_height();
+
+	if (width != height || width < 2)
+	{
+		LOGE("Terrain heightmap must be square.\n");
+		return false;
+	}
+
+	switch (layout->get_format())
+	{
+	case VK_FORMAT_R8_UNORM:
+	case VK_FORMAT_R16_UNORM:
+	case VK_FORMAT_R16_SFLOAT:
+	case VK_FORMAT_R32_SFLOAT:
+		break;
+
+	default:
+		LOGE("Unsupported terrain heightmap format.\n");
+		return false;
+	}
+
+	// Power-of-two textures are extended by clamping, (N + 1)^2 textures already contain the border.
+	size = (width & (width - 1)) == 0 ? width : width - 1;
+	return true;
+}
+
+unsigned TerrainTextureHeightSource::get_size() const
+{
+	return size;
+}
+
+float TerrainTextureHeightSource::sample(unsigned x, unsigned z) const
+{
+	x = std::min(x, width - 1);
+	z = std::min(z, height - 1);
+
+	switch (layout->get_format())
+	{
+	case VK_FORMAT_R8_UNORM:
+		return float(*layout->data_2d<uint8_t>(x, z)) / 255.0f;
+	case VK_FORMAT_R16_UNORM:
+		return float(*layout->data_2d<uint16_t>(x, z)) / 65535.0f;
+	case VK_FORMAT_R16_SFLOAT:
+		return muglm::halfToFloat(*layout->data_2d<uint16_t>(x, z));
+	default:
+		return *layout->data_2d<float>(x, z);
+	}
+}
+}
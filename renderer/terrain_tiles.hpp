@@ -0,0 +1,101 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "terrain_quadtree.hpp"
+#include "filesystem.hpp"
+#include "memory_mapped_texture.hpp"
+#include <string>
+#include <vector>
+
+namespace Granite
+{
+// Tiled terrain file. After a header and a tile directory, every tile of every level
+// stores its own GTX blobs: an R16_UNORM heightmap with (tile_size + 1)^2 samples and a
+// two-component RG8 normal map in terrain space, so each tile can be paged in individually
+// through AssetManager with a FileSlice.
+struct TerrainTileFileInfo
+{
+	unsigned tile_size = 64;
+	// Distance between two level 0 samples in terrain space.
+	float sample_spacing = 1.0f;
+	// Normalized heights are remapped to height_offset + height * height_scale.
+	float height_scale = 1.0f;
+	float height_offset = 0.0f;
+};
+
+bool write_terrain_tile_file(Filesystem &fs, const std::string &path,
+                             const TerrainHeightSource &source, const TerrainTileFileInfo &info);
+
+class TerrainTileFile
+{
+public:
+	bool open(Filesystem &fs, const std::string &path);
+	bool open(FileHandle file);
+
+	const TerrainTileDirectory &get_directory() const
+	{
+		return directory;
+	}
+
+	const TerrainTileFileInfo &get_info() const
+	{
+		return info;
+	}
+
+	FileHandle get_heights(unsigned tile) const;
+	FileHandle get_normals(unsigned tile) const;
+
+private:
+	FileHandle file;
+	TerrainTileDirectory directory;
+	TerrainTileFileInfo info;
+
+	struct Payload
+	{
+		uint64_t heights_offset;
+		uint64_t heights_size;
+		uint64_t normals_offset;
+		uint64_t normals_size;
+	};
+	std::vector<Payload> payloads;
+};
+
+// Samples a single channel 2D texture, R8/R16 UNORM or R16/R32 SFLOAT.
+// Textures of N x N as well as (N + 1) x (N + 1) texels are accepted, the border is clamped.
+// Samples are read straight from the mapping, so heightmaps larger than memory are paged in by the OS.
+// The texture must outlive the source.
+class TerrainTextureHeightSource : public TerrainHeightSource
+{
+public:
+	bool init(const Vulkan::MemoryMappedTexture &texture);
+	unsigned get_size() const override;
+	float sample(unsigned x, unsigned z) const override;
+
+private:
+	const Vulkan::TextureFormatLayout *layout = nullptr;
+	unsigned width = 0;
+	unsigned height = 0;
+	unsigned size = 0;
+};
+}
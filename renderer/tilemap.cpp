@@ -0,0 +1,499 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tilemap.hpp"
+#include "flat_renderer.hpp"
+#include "logging.hpp"
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+
+namespace Granite
+{
+static const char tilemap_magic[16] = "GRANITE TILEMAP";
+static constexpr uint32_t TileMapVersion = 1;
+static constexpr uint64_t TileMapPayloadAlignment = 64;
+static constexpr uint32_t MaxMapTiles = 1u << 16;
+
+struct TileMapFileHeader
+{
+	char magic[16];
+	uint32_t version;
+	uint32_t map_width;
+	uint32_t map_height;
+	uint32_t tile_width;
+	uint32_t tile_height;
+	uint32_t chunk_size;
+	uint32_t num_layers;
+	uint32_t num_tiles;
+};
+
+struct TileMapFileLayer
+{
+	uint64_t chunks_offset;
+	uint64_t tiles_offset;
+	float z;
+	float opacity;
+	uint32_t visible;
+	uint32_t padding;
+};
+
+struct TileMapFileChunk
+{
+	uint32_t count;
+	uint8_t min_x;
+	uint8_t min_y;
+	uint8_t max_x;
+	uint8_t max_y;
+};
+
+static uint64_t align_payload(uint64_t offset)
+{
+	return (offset + TileMapPayloadAlignment - 1) & ~(TileMapPayloadAlignment - 1);
+}
+
+void TileMap::init(const uvec2 &map_tiles_, const uvec2 &tile_size_, std::vector<DrawPipeline> tile_pipelines_)
+{
+	map_tiles = map_tiles_;
+	tile_size = tile_size_;
+	num_chunks = (map_tiles + uvec2(ChunkSize - 1)) / uvec2(ChunkSize);
+	tile_pipelines = std::move(tile_pipelines_);
+	layers.clear();
+	resident.clear();
+	visible.clear();
+	mapping.reset();
+	stats = {};
+}
+
+size_t TileMap::get_tile_offset(unsigned x, unsigned y) const
+{
+	unsigned chunk_index = (y / ChunkSize) * num_chunks.x + x / ChunkSize;
+	return size_t(chunk_index) * ChunkTiles + (y % ChunkSize) * ChunkSize + x % ChunkSize;
+}
+
+void TileMap::update_bounds(const int32_t *tiles, Chunk &chunk)
+{
+	unsigned min_x = ChunkSize, min_y = ChunkSize, max_x = 0, max_y = 0;
+	chunk.count = 0;
+
+	for (unsigned y = 0; y < ChunkSize; y++)
+	{
+		for (unsigned x = 0; x < ChunkSize; x++)
+		{
+			if (tiles[y * ChunkSize + x] < 0)
+				continue;
+
+			min_x = std::min(min_x, x);
+			min_y = std::min(min_y, y);
+			max_x = std::max(max_x, x);
+			max_y = std::max(max_y, y);
+			chunk.count++;
+		}
+	}
+
+	chunk.min_x = uint8_t(min_x);
+	chunk.min_y = uint8_t(min_y);
+	chunk.max_x = uint8_t(max_x);
+	chunk.max_y = uint8_t(max_y);
+	chunk.bounds_dirty = false;
+}
+
+unsigned TileMap::add_layer(const int *tile_indices, float z, float opacity)
+{
+	Layer layer;
+	layer.z = z;
+	layer.opacity = opacity;
+	layer.tiles.resize(size_t(num_chunks.x) * num_chunks.y * ChunkTiles, NoTile);
+	layer.chunks.resize(num_chunks.x * num_chunks.y);
+
+	for (unsigned y = 0; y < map_tiles.y; y++)
+		for (unsigned x = 0; x < map_tiles.x; x++)
+			layer.tiles[get_tile_offset(x, y)] = tile_indices[y * map_tiles.x + x];
+
+	for (size_t i = 0; i < layer.chunks.size(); i++)
+		update_bounds(layer.tiles.data() + i * ChunkTiles, layer.chunks[i]);
+
+	layers.push_back(std::move(layer));
+	return unsigned(layers.size() - 1);
+}
+
+void TileMap::set_layer_visible(unsigned layer, bool visible_)
+{
+	layers[layer].visible = visible_;
+}
+
+void TileMap::set_texture(AssetID texture_)
+{
+	if (texture == texture_)
+		return;
+
+	texture = texture_;
+	for (auto &layer : layers)
+		for (auto &chunk : layer.chunks)
+			chunk.dirty = true;
+}
+
+int TileMap::get_tile(unsigned layer, unsigned x, unsigned y) const
+{
+	assert(x < map_tiles.x && y < map_tiles.y);
+	return layers[layer].data()[get_tile_offset(x, y)];
+}
+
+void TileMap::set_tile(unsigned layer_index, unsigned x, unsigned y, int tile)
+{
+	assert(x < map_tiles.x && y < map_tiles.y);
+	auto &layer = layers[layer_index];
+	size_t offset = get_tile_offset(x, y);
+	if (layer.data()[offset] == tile)
+		return;
+
+	// Copy on write, baked layers are read from the file mapping until they change.
+	if (layer.mapped_tiles)
+	{
+		layer.tiles.assign(layer.mapped_tiles, layer.mapped_tiles + layer.chunks.size() * ChunkTiles);
+		layer.mapped_tiles = nullptr;
+	}
+
+	layer.tiles[offset] = tile;
+	auto &chunk = layer.chunks[offset / ChunkTiles];
+	chunk.dirty = true;
+	chunk.bounds_dirty = true;
+}
+
+void TileMap::set_max_idle_frames(unsigned frames)
+{
+	max_idle_frames = frames;
+}
+
+void TileMap::rebuild_chunk(const Layer &layer, unsigned chunk_index, Chunk &chunk)
+{
+	auto &batch = *chunk.batch;
+	batch.clear();
+
+	const int32_t *tiles = layer.data() + size_t(chunk_index) * ChunkTiles;
+	unsigned base_x = (chunk_index % num_chunks.x) * ChunkSize;
+	unsigned base_y = (chunk_index / num_chunks.x) * ChunkSize;
+
+	Sprite sprite;
+	sprite.texture = texture;
+	sprite.sampler = Vulkan::StockSampler::NearestClamp;
+	sprite.size = ivec2(int(tile_size.x), int(tile_size.y));
+	sprite.color[3] = uint8_t(muglm::round(muglm::clamp(layer.opacity, 0.0f, 1.0f) * 255.0f));
+	bool blend = layer.opacity < 1.0f;
+
+	for (unsigned y = chunk.min_y; y <= chunk.max_y; y++)
+	{
+		for (unsigned x = chunk.min_x; x <= chunk.max_x; x++)
+		{
+			int tile = tiles[y * ChunkSize + x];
+			if (tile < 0 || unsigned(tile) >= tile_pipelines.size())
+				continue;
+
+			sprite.pipeline = blend ? DrawPipeline::AlphaBlend : tile_pipelines[tile];
+			SpriteTransformInfo transform(vec3(float((base_x + x) * tile_size.x),
+			                                   float((base_y + y) * tile_size.y),
+			                                   layer.z));
+			batch.push(sprite, transform, unsigned(tile));
+		}
+	}
+
+	chunk.dirty = false;
+	stats.rebuilt_chunks++;
+}
+
+void TileMap::evict_idle_chunks()
+{
+	for (size_t i = 0; i < resident.size(); )
+	{
+		auto &chunk = layers[resident[i].layer].chunks[resident[i].chunk];
+		if (frame - chunk.last_visible > max_idle_frames)
+		{
+			chunk.batch.reset();
+			chunk.dirty = true;
+			resident[i] = resident.back();
+			resident.pop_back();
+		}
+		else
+			i++;
+	}
+}
+
+const std::vector<SpriteBatch *> &TileMap::cull(const vec2 &camera_pos, const vec2 &camera_size)
+{
+	visible.clear();
+	stats = {};
+	frame++;
+
+	vec2 chunk_extent(float(tile_size.x * ChunkSize), float(tile_size.y * ChunkSize));
+	vec2 camera_end = camera_pos + camera_size;
+	vec2 lo = clamp(camera_pos / chunk_extent, vec2(0.0f), vec2(num_chunks));
+	vec2 hi = clamp(camera_end / chunk_extent, vec2(0.0f), vec2(num_chunks));
+
+	// Visit only the chunks in the camera rectangle, the per-chunk bounds refine the test.
+	unsigned x0 = unsigned(muglm::floor(lo.x));
+	unsigned y0 = unsigned(muglm::floor(lo.y));
+	unsigned x1 = unsigned(muglm::ceil(hi.x));
+	unsigned y1 = unsigned(muglm::ceil(hi.y));
+
+	for (unsigned layer_index = 0; layer_index < layers.size(); layer_index++)
+	{
+		auto &layer = layers[layer_index];
+		if (!layer.visible || layer.opacity <= 0.0f)
+			continue;
+
+		for (unsigned cy = y0; cy < y1; cy++)
+		{
+			for (unsigned cx = x0; cx < x1; cx++)
+			{
+				unsigned chunk_index = cy * num_chunks.x + cx;
+				auto &chunk = layer.chunks[chunk_index];
+				if (chunk.bounds_dirty)
+					update_bounds(layer.data() + size_t(chunk_index) * ChunkTiles, chunk);
+				if (!chunk.count)
+					continue;
+
+				vec2 chunk_lo(float((cx * ChunkSize + chunk.min_x) * tile_size.x),
+				              float((cy * ChunkSize + chunk.min_y) * tile_size.y));
+				vec2 chunk_hi(float((cx * ChunkSize + chunk.max_x + 1) * tile_size.x),
+				              float((cy * ChunkSize + chunk.max_y + 1) * tile_size.y));
+				if (any(lessThanEqual(chunk_hi, camera_pos)) || any(greaterThanEqual(chunk_lo, camera_end)))
+					continue;
+
+				if (!chunk.batch)
+				{
+					chunk.batch.reset(new SpriteBatch(true));
+					resident.push_back({ layer_index, chunk_index });
+				}
+
+				if (chunk.dirty)
+					rebuild_chunk(layer, chunk_index, chunk);
+
+				chunk.last_visible = frame;
+				visible.push_back(chunk.batch.get());
+			}
+		}
+	}
+
+	evict_idle_chunks();
+	stats.visible_chunks = unsigned(visible.size());
+	stats.resident_chunks = unsigned(resident.size());
+	return visible;
+}
+
+void TileMap::render(FlatRenderer &renderer, const vec2 &camera_pos, const vec2 &camera_size)
+{
+	for (auto *batch : cull(camera_pos, camera_size))
+		renderer.push_sprite_batch(*batch);
+}
+
+bool TileMap::save_baked(Filesystem &fs, const std::string &path) const
+{
+	uint32_t num_layers = uint32_t(layers.size());
+	uint32_t chunk_count = num_chunks.x * num_chunks.y;
+	uint64_t chunks_size = uint64_t(chunk_count) * sizeof(TileMapFileChunk);
+	uint64_t tiles_size = uint64_t(chunk_count) * ChunkTiles * sizeof(int32_t);
+
+	std::vector<TileMapFileLayer> entries(num_layers);
+	uint64_t offset = align_payload(sizeof(TileMapFileHeader) +
+	                                num_layers * sizeof(TileMapFileLayer) +
+	                                tile_pipelines.size());
+
+	for (uint32_t i = 0; i < num_layers; i++)
+	{
+		auto &entry = entries[i];
+		entry.chunks_offset = offset;
+		offset = align_payload(offset + chunks_size);
+		entry.tiles_offset = offset;
+		offset = align_payload(offset + tiles_size);
+		entry.z = layers[i].z;
+		entry.opacity = layers[i].opacity;
+		entry.visible = layers[i].visible ? 1 : 0;
+		entry.padding = 0;
+	}
+
+	auto file = fs.open(path, FileMode::WriteOnly);
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	auto write_mapping = file->map_write(offset);
+	if (!write_mapping)
+	{
+		LOGE("Failed to map %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	auto *mapped = write_mapping->mutable_data<uint8_t>();
+	memset(mapped, 0, offset);
+
+	TileMapFileHeader header = {};
+	memcpy(header.magic, tilemap_magic, sizeof(header.magic));
+	header.version = TileMapVersion;
+	header.map_width = map_tiles.x;
+	header.map_height = map_tiles.y;
+	header.tile_width = tile_size.x;
+	header.tile_height = tile_size.y;
+	header.chunk_size = ChunkSize;
+	header.num_layers = num_layers;
+	header.num_tiles = uint32_t(tile_pipelines.size());
+	memcpy(mapped, &header, sizeof(header));
+	memcpy(mapped + sizeof(header), entries.data(), num_layers * sizeof(TileMapFileLayer));
+
+	auto *pipelines = mapped + sizeof(header) + num_layers * sizeof(TileMapFileLayer);
+	for (size_t i = 0; i < tile_pipelines.size(); i++)
+		pipelines[i] = uint8_t(tile_pipelines[i]);
+
+	for (uint32_t i = 0; i < num_layers; i++)
+	{
+		auto &layer = layers[i];
+		auto *chunks = reinterpret_cast<TileMapFileChunk *>(mapped + entries[i].chunks_offset);
+		for (uint32_t c = 0; c < chunk_count; c++)
+		{
+			Chunk chunk;
+			update_bounds(layer.data() + size_t(c) * ChunkTiles, chunk);
+			chunks[c].count = chunk.count;
+			chunks[c].min_x = chunk.min_x;
+			chunks[c].min_y = chunk.min_y;
+			chunks[c].max_x = chunk.max_x;
+			chunks[c].max_y = chunk.max_y;
+		}
+
+		memcpy(mapped + entries[i].tiles_offset, layer.data(), tiles_size);
+	}
+
+	return true;
+}
+
+bool TileMap::load_baked(Filesystem &fs, const std::string &path)
+{
+	auto new_mapping = fs.open_readonly_mapping(path);
+	if (!new_mapping)
+	{
+		LOGE("Failed to open tilemap %s.\n", path.c_str());
+		return false;
+	}
+
+	uint64_t file_size = new_mapping->get_size();
+	auto *mapped = new_mapping->data<uint8_t>();
+
+	TileMapFileHeader header;
+	if (file_size < sizeof(header))
+	{
+		LOGE("Tilemap file is too small.\n");
+		return false;
+	}
+	memcpy(&header, mapped, sizeof(header));
+
+	if (memcmp(header.magic, tilemap_magic, sizeof(header.magic)) != 0 || header.version != TileMapVersion ||
+	    header.chunk_size != ChunkSize)
+	{
+		LOGE("Invalid tilemap header.\n");
+		return false;
+	}
+
+	if (header.map_width == 0 || header.map_height == 0 || header.map_width > MaxMapTiles ||
+	    header.map_height > MaxMapTiles || header.tile_width == 0 || header.tile_height == 0)
+	{
+		LOGE("Invalid tilemap dimensions.\n");
+		return false;
+	}
+
+	uint64_t directory_size = sizeof(header) + uint64_t(header.num_layers) * sizeof(TileMapFileLayer) +
+	                          header.num_tiles;
+	if (directory_size > file_size)
+	{
+		LOGE("Tilemap layer directory is out of range.\n");
+		return false;
+	}
+
+	std::vector<TileMapFileLayer> entries(header.num_layers);
+	memcpy(entries.data(), mapped + sizeof(header), header.num_layers * sizeof(TileMapFileLayer));
+
+	std::vector<DrawPipeline> pipelines(header.num_tiles);
+	auto *file_pipelines = mapped + sizeof(header) + header.num_layers * sizeof(TileMapFileLayer);
+	for (uint32_t i = 0; i < header.num_tiles; i++)
+	{
+		if (file_pipelines[i] > uint8_t(DrawPipeline::AlphaBlend))
+		{
+			LOGE("Invalid tile pipeline.\n");
+			return false;
+		}
+		pipelines[i] = DrawPipeline(file_pipelines[i]);
+	}
+
+	// Parse into locals so a corrupt file leaves the current map untouched.
+	uvec2 new_map_tiles(header.map_width, header.map_height);
+	uvec2 new_num_chunks = (new_map_tiles + uvec2(ChunkSize - 1)) / uvec2(ChunkSize);
+	uint32_t chunk_count = new_num_chunks.x * new_num_chunks.y;
+	uint64_t chunks_size = uint64_t(chunk_count) * sizeof(TileMapFileChunk);
+	uint64_t tiles_size = uint64_t(chunk_count) * ChunkTiles * sizeof(int32_t);
+
+	std::vector<Layer> new_layers(header.num_layers);
+	for (uint32_t i = 0; i < header.num_layers; i++)
+	{
+		auto &entry = entries[i];
+		auto &layer = new_layers[i];
+
+		if (entry.chunks_offset > file_size || chunks_size > file_size - entry.chunks_offset ||
+		    entry.tiles_offset > file_size || tiles_size > file_size - entry.tiles_offset ||
+		    (entry.tiles_offset & (alignof(int32_t) - 1)) != 0)
+		{
+			LOGE("Tilemap layer %u is out of range.\n", i);
+			return false;
+		}
+
+		layer.z = entry.z;
+		layer.opacity = entry.opacity;
+		layer.visible = entry.visible != 0;
+		layer.mapped_tiles = reinterpret_cast<const int32_t *>(mapped + entry.tiles_offset);
+		layer.chunks.resize(chunk_count);
+
+		for (uint32_t c = 0; c < chunk_count; c++)
+		{
+			TileMapFileChunk file_chunk;
+			memcpy(&file_chunk, mapped + entry.chunks_offset + c * sizeof(TileMapFileChunk), sizeof(file_chunk));
+
+			if (file_chunk.count > ChunkTiles ||
+			    (file_chunk.count && (file_chunk.max_x >= ChunkSize || file_chunk.max_y >= ChunkSize ||
+			                          file_chunk.min_x > file_chunk.max_x || file_chunk.min_y > file_chunk.max_y)))
+			{
+				LOGE("Tilemap chunk %u in layer %u is invalid.\n", c, i);
+				return false;
+			}
+
+			auto &chunk = layer.chunks[c];
+			chunk.count = file_chunk.count;
+			chunk.min_x = file_chunk.min_x;
+			chunk.min_y = file_chunk.min_y;
+			chunk.max_x = file_chunk.max_x;
+			chunk.max_y = file_chunk.max_y;
+		}
+	}
+
+	init(new_map_tiles, uvec2(header.tile_width, header.tile_height), std::move(pipelines));
+	layers = std::move(new_layers);
+	mapping = std::move(new_mapping);
+	return true;
+}
+}
@@ -0,0 +1,158 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "sprite_batch.hpp"
+#include "filesystem.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Granite
+{
+class FlatRenderer;
+
+// Tile layers of a 2D map, split into chunks of ChunkSize x ChunkSize tiles.
+// Tiles are drawn from an array texture with one tile per layer, as laid out by TMXParser.
+// A chunk is baked into a static SpriteBatch the first time it becomes visible and is only
+// rebuilt after one of its tiles changed. Chunks which stay out of view give up their batch,
+// so GPU memory follows the visible area rather than the size of the map.
+class TileMap
+{
+public:
+	enum { NoTile = -1 };
+	static constexpr unsigned ChunkSize = 32;
+	static constexpr unsigned ChunkTiles = ChunkSize * ChunkSize;
+
+	void init(const uvec2 &map_tiles, const uvec2 &tile_size, std::vector<DrawPipeline> tile_pipelines);
+
+	// tile_indices holds one entry per map tile in row-major order, NoTile for empty tiles.
+	// z is used for every tile in the layer, larger z is further away like other FlatRenderer draws.
+	unsigned add_layer(const int *tile_indices, float z, float opacity = 1.0f);
+	void set_layer_visible(unsigned layer, bool visible);
+
+	// The tile array texture.
+	void set_texture(AssetID texture);
+
+	int get_tile(unsigned layer, unsigned x, unsigned y) const;
+	void set_tile(unsigned layer, unsigned x, unsigned y, int tile);
+
+	// Returns the batches of all chunks which intersect the camera rectangle, rebuilding stale ones.
+	// camera_pos and camera_size match what is passed to FlatRenderer::flush().
+	const std::vector<SpriteBatch *> &cull(const vec2 &camera_pos, const vec2 &camera_size);
+	void render(FlatRenderer &renderer, const vec2 &camera_pos, const vec2 &camera_size);
+
+	// Chunks which were not visible for this many calls to cull() release their batch.
+	void set_max_idle_frames(unsigned frames);
+
+	// The baked format stores tiles chunk by chunk along with the bounds of every chunk.
+	// Loading maps the file and reads tiles straight from the mapping until a layer is edited.
+	bool save_baked(Filesystem &fs, const std::string &path) const;
+	bool load_baked(Filesystem &fs, const std::string &path);
+
+	uvec2 get_map_tiles() const
+	{
+		return map_tiles;
+	}
+
+	uvec2 get_tile_size() const
+	{
+		return tile_size;
+	}
+
+	unsigned get_num_layers() const
+	{
+		return unsigned(layers.size());
+	}
+
+	struct Stats
+	{
+		unsigned visible_chunks;
+		unsigned rebuilt_chunks;
+		unsigned resident_chunks;
+	};
+
+	// Statistics of the last call to cull().
+	const Stats &get_stats() const
+	{
+		return stats;
+	}
+
+private:
+	struct Chunk
+	{
+		// Bounds of the non-empty tiles relative to the chunk, inclusive. Only valid if count != 0.
+		uint8_t min_x = 0;
+		uint8_t min_y = 0;
+		uint8_t max_x = 0;
+		uint8_t max_y = 0;
+		uint32_t count = 0;
+		uint32_t last_visible = 0;
+		bool bounds_dirty = false;
+		bool dirty = true;
+		std::unique_ptr<SpriteBatch> batch;
+	};
+
+	struct Layer
+	{
+		// Chunk-major, the tiles of a chunk are contiguous.
+		// Points into the baked file mapping until the layer is edited.
+		const int32_t *mapped_tiles = nullptr;
+		std::vector<int32_t> tiles;
+		std::vector<Chunk> chunks;
+		float z = 0.0f;
+		float opacity = 1.0f;
+		bool visible = true;
+
+		const int32_t *data() const
+		{
+			return mapped_tiles ? mapped_tiles : tiles.data();
+		}
+	};
+
+	struct ResidentChunk
+	{
+		uint32_t layer;
+		uint32_t chunk;
+	};
+
+	uvec2 map_tiles = uvec2(0);
+	uvec2 tile_size = uvec2(0);
+	uvec2 num_chunks = uvec2(0);
+	std::vector<DrawPipeline> tile_pipelines;
+	std::vector<Layer> layers;
+	AssetID texture;
+	FileMappingHandle mapping;
+
+	std::vector<SpriteBatch *> visible;
+	std::vector<ResidentChunk> resident;
+	uint32_t frame = 0;
+	unsigned max_idle_frames = 120;
+	Stats stats = {};
+
+	size_t get_tile_offset(unsigned x, unsigned y) const;
+	static void update_bounds(const int32_t *tiles, Chunk &chunk);
+	void rebuild_chunk(const Layer &layer, unsigned chunk_index, Chunk &chunk);
+	void evict_idle_chunks();
+};
+}
@@ -0,0 +1,1071 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define NOMINMAX
+#include "bc_compressor.hpp"
+#include "rgtc_compressor.hpp"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BC_SIMD_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BC_SIMD_NEON
+#endif
+
+namespace Granite
+{
+// Minimal 4 x float vector. Lanes are texels of the same block.
+#if defined(BC_SIMD_SSE2)
+using F32x4 = __m128;
+static inline F32x4 splat(float v) { return _mm_set1_ps(v); }
+static inline F32x4 load(const float *v) { return _mm_load_ps(v); }
+static inline void store(float *v, F32x4 a) { _mm_store_ps(v, a); }
+static inline F32x4 add(F32x4 a, F32x4 b) { return _mm_add_ps(a, b); }
+static inline F32x4 sub(F32x4 a, F32x4 b) { return _mm_sub_ps(a, b); }
+static inline F32x4 mul(F32x4 a, F32x4 b) { return _mm_mul_ps(a, b); }
+static inline F32x4 min(F32x4 a, F32x4 b) { return _mm_min_ps(a, b); }
+static inline F32x4 less_than(F32x4 a, F32x4 b) { return _mm_cmplt_ps(a, b); }
+static inline F32x4 select(F32x4 mask, F32x4 a, F32x4 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+#elif defined(BC_SIMD_NEON)
+using F32x4 = float32x4_t;
+static inline F32x4 splat(float v) { return vdupq_n_f32(v); }
+static inline F32x4 load(const float *v) { return vld1q_f32(v); }
+static inline void store(float *v, F32x4 a) { vst1q_f32(v, a); }
+static inline F32x4 add(F32x4 a, F32x4 b) { return vaddq_f32(a, b); }
+static inline F32x4 sub(F32x4 a, F32x4 b) { return vsubq_f32(a, b); }
+static inline F32x4 mul(F32x4 a, F32x4 b) { return vmulq_f32(a, b); }
+static inline F32x4 min(F32x4 a, F32x4 b) { return vminq_f32(a, b); }
+static inline F32x4 less_than(F32x4 a, F32x4 b) { return vreinterpretq_f32_u32(vcltq_f32(a, b)); }
+static inline F32x4 select(F32x4 mask, F32x4 a, F32x4 b) { return vbslq_f32(vreinterpretq_u32_f32(mask), a, b); }
+#else
+struct F32x4
+{
+	float v[4];
+};
+
+template <typename Op>
+static inline F32x4 lanewise(F32x4 a, F32x4 b, Op &&op)
+{
+	F32x4 res;
+	for (int i = 0; i < 4; i++)
+		res.v[i] = op(a.v[i], b.v[i]);
+	return res;
+}
+
+static inline F32x4 splat(float v) { return { { v, v, v, v } }; }
+static inline F32x4 load(const float *v) { return { { v[0], v[1], v[2], v[3] } }; }
+static inline void store(float *v, F32x4 a) { memcpy(v, a.v, sizeof(a.v)); }
+static inline F32x4 add(F32x4 a, F32x4 b) { return lanewise(a, b, [](float x, float y) { return x + y; }); }
+static inline F32x4 sub(F32x4 a, F32x4 b) { return lanewise(a, b, [](float x, float y) { return x - y; }); }
+static inline F32x4 mul(F32x4 a, F32x4 b) { return lanewise(a, b, [](float x, float y) { return x * y; }); }
+static inline F32x4 min(F32x4 a, F32x4 b) { return lanewise(a, b, [](float x, float y) { return std::min(x, y); }); }
+static inline F32x4 less_than(F32x4 a, F32x4 b) { return lanewise(a, b, [](float x, float y) { return x < y ? 1.0f : 0.0f; }); }
+static inline F32x4 select(F32x4 mask, F32x4 a, F32x4 b)
+{
+	F32x4 res;
+	for (int i = 0; i < 4; i++)
+		res.v[i] = mask.v[i] != 0.0f ? a.v[i] : b.v[i];
+	return res;
+}
+#endif
+
+static const int bc7_weights2[4] = { 0, 21, 43, 64 };
+static const int bc7_weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const int bc7_weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Bit n is the subset of texel n.
+static const uint16_t bc7_partitions2[64] = {
+	0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80,
+	0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+	0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce,
+	0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+	0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a,
+	0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+	0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c,
+	0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22,
+};
+
+// Bits 2n and 2n + 1 are the subset of texel n.
+static const uint32_t bc7_partitions3[64] = {
+	0xaa685050, 0x6a5a5040, 0x5a5a4200, 0x5450a0a8, 0xa5a50000, 0xa0a05050, 0x5555a0a0, 0x5a5a5050,
+	0xaa550000, 0xaa555500, 0xaaaa5500, 0x90909090, 0x94949494, 0xa4a4a4a4, 0xa9a59450, 0x2a0a4250,
+	0xa5945040, 0x0a425054, 0xa5a5a500, 0x55a0a0a0, 0xa8a85454, 0x6a6a4040, 0xa4a45000, 0x1a1a0500,
+	0x0050a4a4, 0xaaa59090, 0x14696914, 0x69691400, 0xa08585a0, 0xaa821414, 0x50a4a450, 0x6a5a0200,
+	0xa9a58000, 0x5090a0a8, 0xa8a09050, 0x24242424, 0x00aa5500, 0x24924924, 0x24499224, 0x50a50a50,
+	0x500aa550, 0xaaaa4444, 0x66660000, 0xa5a0a5a0, 0x50a050a0, 0x69286928, 0x44aaaa44, 0x66666600,
+	0xaa444444, 0x54a854a8, 0x95809580, 0x96969600, 0xa85454a8, 0x80959580, 0xaa141414, 0x96960000,
+	0xaaaa1414, 0xa05050a0, 0xa0a5a5a0, 0x96000000, 0x40804080, 0xa9a8a9a8, 0xaaaaaa44, 0x2a4a5254,
+};
+
+static const uint8_t bc7_anchors2[64] = {
+	15, 15, 15, 15, 15, 15, 15, 15,
+	15, 15, 15, 15, 15, 15, 15, 15,
+	15, 2, 8, 2, 2, 8, 8, 15,
+	2, 8, 2, 2, 8, 8, 2, 2,
+	15, 15, 6, 8, 2, 8, 15, 15,
+	2, 8, 2, 2, 2, 15, 15, 6,
+	6, 2, 6, 8, 15, 15, 2, 2,
+	15, 15, 15, 15, 15, 2, 2, 15,
+};
+
+static const uint8_t bc7_anchors3[64][2] = {
+	{ 3, 15 }, { 3, 8 }, { 15, 8 }, { 15, 3 }, { 8, 15 }, { 3, 15 }, { 15, 3 }, { 15, 8 },
+	{ 8, 15 }, { 8, 15 }, { 6, 15 }, { 6, 15 }, { 6, 15 }, { 5, 15 }, { 3, 15 }, { 3, 8 },
+	{ 3, 15 }, { 3, 8 }, { 8, 15 }, { 15, 3 }, { 3, 15 }, { 3, 8 }, { 6, 15 }, { 10, 8 },
+	{ 5, 3 }, { 8, 15 }, { 8, 6 }, { 6, 10 }, { 8, 15 }, { 5, 15 }, { 15, 10 }, { 15, 8 },
+	{ 8, 15 }, { 15, 3 }, { 3, 15 }, { 5, 10 }, { 6, 10 }, { 10, 8 }, { 8, 9 }, { 15, 10 },
+	{ 15, 6 }, { 3, 15 }, { 15, 8 }, { 5, 15 }, { 15, 3 }, { 15, 6 }, { 15, 6 }, { 15, 8 },
+	{ 3, 15 }, { 15, 3 }, { 5, 15 }, { 5, 15 }, { 5, 15 }, { 8, 15 }, { 5, 15 }, { 10, 15 },
+	{ 5, 15 }, { 10, 15 }, { 8, 15 }, { 13, 15 }, { 15, 3 }, { 12, 15 }, { 3, 15 }, { 3, 8 },
+};
+
+struct BlockTexels
+{
+	alignas(16) float channels[4][16];
+};
+
+static void load_block(BlockTexels &texels, const uint8_t *rgba)
+{
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			texels.channels[c][i] = float(rgba[4 * i + c]);
+}
+
+// Picks the closest palette entry for every texel in texel_mask and returns the summed squared error.
+// The search runs over four texels at a time.
+static float select_indices(uint8_t *indices, const BlockTexels &texels,
+                            const float (*palette)[4], unsigned palette_size,
+                            unsigned num_channels, uint32_t texel_mask)
+{
+	float total_error = 0.0f;
+
+	for (unsigned base = 0; base < 16; base += 4)
+	{
+		if (((texel_mask >> base) & 0xf) == 0)
+			continue;
+
+		F32x4 texel[4];
+		for (unsigned c = 0; c < num_channels; c++)
+			texel[c] = load(&texels.channels[c][base]);
+
+		F32x4 best_error = splat(FLT_MAX);
+		F32x4 best_index = splat(0.0f);
+
+		for (unsigned entry = 0; entry < palette_size; entry++)
+		{
+			F32x4 error = splat(0.0f);
+			for (unsigned c = 0; c < num_channels; c++)
+			{
+				F32x4 diff = sub(texel[c], splat(palette[entry][c]));
+				error = add(error, mul(diff, diff));
+			}
+
+			F32x4 closer = less_than(error, best_error);
+			best_error = min(error, best_error);
+			best_index = select(closer, splat(float(entry)), best_index);
+		}
+
+		alignas(16) float lane_error[4];
+		alignas(16) float lane_index[4];
+		store(lane_error, best_error);
+		store(lane_index, best_index);
+
+		for (unsigned lane = 0; lane < 4; lane++)
+		{
+			if (texel_mask & (1u << (base + lane)))
+			{
+				indices[base + lane] = uint8_t(lane_index[lane]);
+				total_error += lane_error[lane];
+			}
+		}
+	}
+
+	return total_error;
+}
+
+// Endpoints along the principal axis of the texels in texel_mask.
+static void fit_principal_axis(float *lo, float *hi, const BlockTexels &texels,
+                               unsigned num_channels, uint32_t texel_mask, unsigned power_iterations)
+{
+	float mean[4] = {};
+	float count = 0.0f;
+
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (texel_mask & (1u << i))
+		{
+			for (unsigned c = 0; c < num_channels; c++)
+				mean[c] += texels.channels[c][i];
+			count += 1.0f;
+		}
+	}
+
+	if (count == 0.0f)
+	{
+		std::fill(lo, lo + num_channels, 0.0f);
+		std::fill(hi, hi + num_channels, 0.0f);
+		return;
+	}
+
+	for (unsigned c = 0; c < num_channels; c++)
+		mean[c] /= count;
+
+	float covariance[4][4] = {};
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (texel_mask & (1u << i))
+		{
+			float diff[4];
+			for (unsigned c = 0; c < num_channels; c++)
+				diff[c] = texels.channels[c][i] - mean[c];
+			for (unsigned a = 0; a < num_channels; a++)
+				for (unsigned b = 0; b < num_channels; b++)
+					covariance[a][b] += diff[a] * diff[b];
+		}
+	}
+
+	// Start from the covariance row of the channel with the largest variance.
+	unsigned dominant = 0;
+	for (unsigned c = 1; c < num_channels; c++)
+		if (covariance[c][c] > covariance[dominant][dominant])
+			dominant = c;
+
+	float axis[4] = {};
+	for (unsigned c = 0; c < num_channels; c++)
+		axis[c] = covariance[dominant][c];
+
+	for (unsigned iter = 0; iter < power_iterations; iter++)
+	{
+		float next[4] = {};
+		float max_component = 0.0f;
+		for (unsigned a = 0; a < num_channels; a++)
+		{
+			for (unsigned b = 0; b < num_channels; b++)
+				next[a] += covariance[a][b] * axis[b];
+			max_component = std::max(max_component, fabsf(next[a]));
+		}
+
+		if (max_component < 1e-8f)
+			break;
+
+		for (unsigned c = 0; c < num_channels; c++)
+			axis[c] = next[c] / max_component;
+	}
+
+	float length = 0.0f;
+	for (unsigned c = 0; c < num_channels; c++)
+		length += axis[c] * axis[c];
+
+	if (length < 1e-8f)
+	{
+		std::copy(mean, mean + num_channels, lo);
+		std::copy(mean, mean + num_channels, hi);
+		return;
+	}
+
+	length = 1.0f / sqrtf(length);
+	for (unsigned c = 0; c < num_channels; c++)
+		axis[c] *= length;
+
+	float t_min = FLT_MAX;
+	float t_max = -FLT_MAX;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (texel_mask & (1u << i))
+		{
+			float t = 0.0f;
+			for (unsigned c = 0; c < num_channels; c++)
+				t += (texels.channels[c][i] - mean[c]) * axis[c];
+			t_min = std::min(t_min, t);
+			t_max = std::max(t_max, t);
+		}
+	}
+
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		lo[c] = std::min(std::max(mean[c] + axis[c] * t_min, 0.0f), 255.0f);
+		hi[c] = std::min(std::max(mean[c] + axis[c] * t_max, 0.0f), 255.0f);
+	}
+}
+
+// Least squares endpoints for a fixed index assignment. weights maps an index to its blend factor towards e1.
+static bool refine_endpoints(float *e0, float *e1, const BlockTexels &texels, const uint8_t *indices,
+                             const float *weights, unsigned num_channels, uint32_t texel_mask)
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (texel_mask & (1u << i))
+		{
+			float b = weights[indices[i]];
+			float a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (unsigned c = 0; c < num_channels; c++)
+			{
+				ax[c] += a * texels.channels[c][i];
+				bx[c] += b * texels.channels[c][i];
+			}
+		}
+	}
+
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f)
+		return false;
+
+	float inv_det = 1.0f / det;
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		e0[c] = std::min(std::max((bb * ax[c] - ab * bx[c]) * inv_det, 0.0f), 255.0f);
+		e1[c] = std::min(std::max((aa * bx[c] - ab * ax[c]) * inv_det, 0.0f), 255.0f);
+	}
+
+	return true;
+}
+
+struct BitWriter
+{
+	explicit BitWriter(uint8_t *output_, unsigned size)
+		: output(output_)
+	{
+		memset(output, 0, size);
+	}
+
+	void write(uint32_t value, unsigned bits)
+	{
+		for (unsigned i = 0; i < bits; i++, offset++)
+			output[offset >> 3] |= uint8_t(((value >> i) & 1u) << (offset & 7));
+	}
+
+	uint8_t *output;
+	unsigned offset = 0;
+};
+
+struct BitReader
+{
+	explicit BitReader(const uint8_t *input_)
+		: input(input_)
+	{
+	}
+
+	uint32_t read(unsigned bits)
+	{
+		uint32_t value = 0;
+		for (unsigned i = 0; i < bits; i++, offset++)
+			value |= uint32_t((input[offset >> 3] >> (offset & 7)) & 1u) << i;
+		return value;
+	}
+
+	const uint8_t *input;
+	unsigned offset = 0;
+};
+
+///// BC1
+
+static uint16_t pack_565(const float *color)
+{
+	int r = int(color[0] * (31.0f / 255.0f) + 0.5f);
+	int g = int(color[1] * (63.0f / 255.0f) + 0.5f);
+	int b = int(color[2] * (31.0f / 255.0f) + 0.5f);
+	return uint16_t((std::min(r, 31) << 11) | (std::min(g, 63) << 5) | std::min(b, 31));
+}
+
+static void unpack_565(int *color, uint16_t packed)
+{
+	int r = (packed >> 11) & 31;
+	int g = (packed >> 5) & 63;
+	int b = packed & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+// Entry 3 is transparent black in 3-color mode.
+static void build_bc1_palette(int (*palette)[4], uint16_t c0, uint16_t c1, bool four_color)
+{
+	unpack_565(palette[0], c0);
+	unpack_565(palette[1], c1);
+	palette[0][3] = 255;
+	palette[1][3] = 255;
+
+	if (four_color)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+		}
+		palette[2][3] = 255;
+		palette[3][3] = 255;
+	}
+	else
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c] + 1) / 2;
+			palette[3][c] = 0;
+		}
+		palette[2][3] = 255;
+		palette[3][3] = 0;
+	}
+}
+
+struct BC1Candidate
+{
+	uint16_t c0, c1;
+	uint8_t indices[16];
+	float error;
+};
+
+// Quantizes the endpoints and picks indices. Endpoints are ordered to select 4-color mode,
+// or 3-color mode when texels must be transparent. Color BC1 in BC3 blocks is always decoded as 4-color.
+static void evaluate_bc1_endpoints(BC1Candidate &candidate, const BlockTexels &texels,
+                                   const float *e0, const float *e1,
+                                   uint32_t opaque_mask, bool three_color, bool always_four_color)
+{
+	uint16_t c0 = pack_565(e0);
+	uint16_t c1 = pack_565(e1);
+	if (three_color ? (c0 > c1) : (c0 < c1))
+		std::swap(c0, c1);
+
+	bool four_color = always_four_color || c0 > c1;
+	int palette[4][4];
+	build_bc1_palette(palette, c0, c1, four_color);
+
+	float palette_float[4][4];
+	for (int i = 0; i < 4; i++)
+		for (int c = 0; c < 4; c++)
+			palette_float[i][c] = float(palette[i][c]);
+
+	candidate.c0 = c0;
+	candidate.c1 = c1;
+	for (auto &index : candidate.indices)
+		index = 3;
+	candidate.error = select_indices(candidate.indices, texels, palette_float, four_color ? 4 : 3, 3, opaque_mask);
+}
+
+static void encode_bc1_color(uint8_t *output, const BlockTexels &texels, unsigned quality,
+                             uint32_t opaque_mask, bool always_four_color)
+{
+	BC1Candidate best;
+
+	if (opaque_mask == 0)
+	{
+		best.c0 = 0;
+		best.c1 = 0;
+		memset(best.indices, 3, sizeof(best.indices));
+	}
+	else
+	{
+		bool three_color = opaque_mask != 0xffff;
+		float e0[3], e1[3];
+		fit_principal_axis(e1, e0, texels, 3, opaque_mask, 2 + quality);
+		evaluate_bc1_endpoints(best, texels, e0, e1, opaque_mask, three_color, always_four_color);
+
+		static const float four_color_weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+		static const float three_color_weights[4] = { 0.0f, 1.0f, 0.5f, 0.0f };
+
+		for (unsigned iter = 1; iter < quality && best.error > 0.0f; iter++)
+		{
+			bool four_color = always_four_color || best.c0 > best.c1;
+			if (!refine_endpoints(e0, e1, texels, best.indices,
+			                      four_color ? four_color_weights : three_color_weights, 3, opaque_mask))
+				break;
+
+			BC1Candidate candidate;
+			evaluate_bc1_endpoints(candidate, texels, e0, e1, opaque_mask, three_color, always_four_color);
+			if (candidate.error >= best.error)
+				break;
+			best = candidate;
+		}
+	}
+
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; i++)
+		bits |= uint32_t(best.indices[i]) << (2 * i);
+
+	output[0] = uint8_t(best.c0 & 0xff);
+	output[1] = uint8_t(best.c0 >> 8);
+	output[2] = uint8_t(best.c1 & 0xff);
+	output[3] = uint8_t(best.c1 >> 8);
+	for (int i = 0; i < 4; i++)
+		output[4 + i] = uint8_t(bits >> (8 * i));
+}
+
+void compress_bc1_block(uint8_t *output, const uint8_t *rgba, unsigned quality, bool punchthrough_alpha)
+{
+	BlockTexels texels;
+	load_block(texels, rgba);
+
+	uint32_t opaque_mask = 0xffff;
+	if (punchthrough_alpha)
+		for (int i = 0; i < 16; i++)
+			if (rgba[4 * i + 3] < 128)
+				opaque_mask &= ~(1u << i);
+
+	encode_bc1_color(output, texels, quality, opaque_mask, false);
+}
+
+void compress_bc3_block(uint8_t *output, const uint8_t *rgba, unsigned quality)
+{
+	uint8_t alpha[16];
+	for (int i = 0; i < 16; i++)
+		alpha[i] = rgba[4 * i + 3];
+	compress_rgtc_red_block(output, alpha);
+
+	BlockTexels texels;
+	load_block(texels, rgba);
+	encode_bc1_color(output + 8, texels, quality, 0xffff, true);
+}
+
+static void decode_bc1_color(uint8_t *rgba, const uint8_t *block, bool always_four_color)
+{
+	uint16_t c0 = uint16_t(block[0] | (block[1] << 8));
+	uint16_t c1 = uint16_t(block[2] | (block[3] << 8));
+	uint32_t bits = uint32_t(block[4]) | (uint32_t(block[5]) << 8) |
+	                (uint32_t(block[6]) << 16) | (uint32_t(block[7]) << 24);
+
+	int palette[4][4];
+	build_bc1_palette(palette, c0, c1, always_four_color || c0 > c1);
+
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			rgba[4 * i + c] = uint8_t(palette[(bits >> (2 * i)) & 3][c]);
+}
+
+void decompress_bc1_block(uint8_t *rgba, const uint8_t *block)
+{
+	decode_bc1_color(rgba, block, false);
+}
+
+void decompress_bc3_block(uint8_t *rgba, const uint8_t *block)
+{
+	uint8_t alpha[16];
+	decompress_rgtc_red_block(alpha, block);
+	decode_bc1_color(rgba, block + 8, true);
+	for (int i = 0; i < 16; i++)
+		rgba[4 * i + 3] = alpha[i];
+}
+
+///// BC7
+
+static inline int bc7_interpolate(int e0, int e1, int weight)
+{
+	return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+}
+
+struct BC7Mode6Candidate
+{
+	uint8_t endpoints[2][4]; // 7-bit
+	uint8_t pbits[2];
+	uint8_t indices[16];
+	float error;
+};
+
+// Mode 6: single subset RGBA, 7-bit endpoints with a unique p-bit each, 4-bit indices.
+static void evaluate_bc7_mode6(BC7Mode6Candidate &candidate, const BlockTexels &texels, const float *e0, const float *e1)
+{
+	const float *endpoints[2] = { e0, e1 };
+	int decoded[2][4];
+
+	for (int e = 0; e < 2; e++)
+	{
+		float best_error = FLT_MAX;
+		for (int p = 0; p < 2; p++)
+		{
+			float error = 0.0f;
+			uint8_t quant[4];
+			for (int c = 0; c < 4; c++)
+			{
+				int q = int((endpoints[e][c] - float(p)) * 0.5f + 0.5f);
+				q = std::min(std::max(q, 0), 127);
+				quant[c] = uint8_t(q);
+				float diff = float(2 * q + p) - endpoints[e][c];
+				error += diff * diff;
+			}
+
+			if (error < best_error)
+			{
+				best_error = error;
+				memcpy(candidate.endpoints[e], quant, sizeof(quant));
+				candidate.pbits[e] = uint8_t(p);
+			}
+		}
+
+		for (int c = 0; c < 4; c++)
+			decoded[e][c] = 2 * candidate.endpoints[e][c] + candidate.pbits[e];
+	}
+
+	float palette[16][4];
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			palette[i][c] = float(bc7_interpolate(decoded[0][c], decoded[1][c], bc7_weights4[i]));
+
+	candidate.error = select_indices(candidate.indices, texels, palette, 16, 4, 0xffff);
+}
+
+static BC7Mode6Candidate encode_bc7_mode6(const BlockTexels &texels, unsigned quality)
+{
+	float e0[4], e1[4];
+	fit_principal_axis(e0, e1, texels, 4, 0xffff, 2 + quality);
+
+	BC7Mode6Candidate best;
+	evaluate_bc7_mode6(best, texels, e0, e1);
+
+	float weights[16];
+	for (int i = 0; i < 16; i++)
+		weights[i] = float(bc7_weights4[i]) / 64.0f;
+
+	for (unsigned iter = 1; iter < quality && best.error > 0.0f; iter++)
+	{
+		if (!refine_endpoints(e0, e1, texels, best.indices, weights, 4, 0xffff))
+			break;
+
+		BC7Mode6Candidate candidate;
+		evaluate_bc7_mode6(candidate, texels, e0, e1);
+		if (candidate.error >= best.error)
+			break;
+		best = candidate;
+	}
+
+	return best;
+}
+
+static void pack_bc7_mode6(uint8_t *output, BC7Mode6Candidate &candidate)
+{
+	// The anchor index drops its MSB, so flip the line if needed.
+	if (candidate.indices[0] & 8)
+	{
+		std::swap(candidate.endpoints[0], candidate.endpoints[1]);
+		std::swap(candidate.pbits[0], candidate.pbits[1]);
+		for (auto &index : candidate.indices)
+			index = uint8_t(15 - index);
+	}
+
+	BitWriter writer(output, 16);
+	writer.write(1u << 6, 7);
+	for (int c = 0; c < 4; c++)
+		for (int e = 0; e < 2; e++)
+			writer.write(candidate.endpoints[e][c], 7);
+	writer.write(candidate.pbits[0], 1);
+	writer.write(candidate.pbits[1], 1);
+	for (int i = 0; i < 16; i++)
+		writer.write(candidate.indices[i], i == 0 ? 3 : 4);
+}
+
+struct BC7Mode1Candidate
+{
+	uint8_t endpoints[2][2][3]; // [subset][endpoint][channel], 6-bit
+	uint8_t pbits[2]; // Shared per subset.
+	uint8_t indices[16];
+	float error;
+};
+
+static inline int bc7_mode1_expand(int q, int p)
+{
+	int v = (q << 1) | p;
+	return (v << 1) | (v >> 6);
+}
+
+// Mode 1: two subsets RGB, 6-bit endpoints with a p-bit shared per subset, 3-bit indices.
+static float evaluate_bc7_mode1_subset(BC7Mode1Candidate &candidate, unsigned subset, const BlockTexels &texels,
+                                       const float *e0, const float *e1, uint32_t texel_mask)
+{
+	const float *endpoints[2] = { e0, e1 };
+	float best_error = FLT_MAX;
+
+	for (int p = 0; p < 2; p++)
+	{
+		float error = 0.0f;
+		uint8_t quant[2][3];
+		for (int e = 0; e < 2; e++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				int q = int((endpoints[e][c] * (127.0f / 255.0f) - float(p)) * 0.5f + 0.5f);
+				q = std::min(std::max(q, 0), 63);
+				quant[e][c] = uint8_t(q);
+				float diff = float(bc7_mode1_expand(q, p)) - endpoints[e][c];
+				error += diff * diff;
+			}
+		}
+
+		if (error < best_error)
+		{
+			best_error = error;
+			memcpy(candidate.endpoints[subset], quant, sizeof(quant));
+			candidate.pbits[subset] = uint8_t(p);
+		}
+	}
+
+	int decoded[2][3];
+	for (int e = 0; e < 2; e++)
+		for (int c = 0; c < 3; c++)
+			decoded[e][c] = bc7_mode1_expand(candidate.endpoints[subset][e][c], candidate.pbits[subset]);
+
+	float palette[8][4];
+	for (int i = 0; i < 8; i++)
+		for (int c = 0; c < 3; c++)
+			palette[i][c] = float(bc7_interpolate(decoded[0][c], decoded[1][c], bc7_weights3[i]));
+
+	return select_indices(candidate.indices, texels, palette, 8, 3, texel_mask);
+}
+
+static BC7Mode1Candidate encode_bc7_mode1(const BlockTexels &texels, unsigned partition, unsigned quality)
+{
+	float weights[8];
+	for (int i = 0; i < 8; i++)
+		weights[i] = float(bc7_weights3[i]) / 64.0f;
+
+	BC7Mode1Candidate best = {};
+	best.error = 0.0f;
+
+	for (unsigned subset = 0; subset < 2; subset++)
+	{
+		uint32_t mask = subset ? bc7_partitions2[partition] : (~bc7_partitions2[partition] & 0xffffu);
+		float e0[3], e1[3];
+		fit_principal_axis(e0, e1, texels, 3, mask, 2 + quality);
+
+		BC7Mode1Candidate current = best;
+		float error = evaluate_bc7_mode1_subset(current, subset, texels, e0, e1, mask);
+
+		for (unsigned iter = 1; iter < quality && error > 0.0f; iter++)
+		{
+			if (!refine_endpoints(e0, e1, texels, current.indices, weights, 3, mask))
+				break;
+
+			BC7Mode1Candidate candidate = current;
+			float candidate_error = evaluate_bc7_mode1_subset(candidate, subset, texels, e0, e1, mask);
+			if (candidate_error >= error)
+				break;
+			current = candidate;
+			error = candidate_error;
+		}
+
+		best = current;
+		best.error += error;
+	}
+
+	return best;
+}
+
+static void pack_bc7_mode1(uint8_t *output, BC7Mode1Candidate &candidate, unsigned partition)
+{
+	unsigned anchors[2] = { 0, bc7_anchors2[partition] };
+	for (unsigned subset = 0; subset < 2; subset++)
+	{
+		if (candidate.indices[anchors[subset]] & 4)
+		{
+			std::swap(candidate.endpoints[subset][0], candidate.endpoints[subset][1]);
+			for (unsigned i = 0; i < 16; i++)
+				if (((bc7_partitions2[partition] >> i) & 1) == subset)
+					candidate.indices[i] = uint8_t(7 - candidate.indices[i]);
+		}
+	}
+
+	BitWriter writer(output, 16);
+	writer.write(1u << 1, 2);
+	writer.write(partition, 6);
+	for (int c = 0; c < 3; c++)
+		for (int subset = 0; subset < 2; subset++)
+			for (int e = 0; e < 2; e++)
+				writer.write(candidate.endpoints[subset][e][c], 6);
+	writer.write(candidate.pbits[0], 1);
+	writer.write(candidate.pbits[1], 1);
+	for (unsigned i = 0; i < 16; i++)
+		writer.write(candidate.indices[i], (i == anchors[0] || i == anchors[1]) ? 2 : 3);
+}
+
+// Cheap estimate of how well each subset fits a line: scatter not explained by the principal axis.
+static float estimate_partition_error(const BlockTexels &texels, uint32_t mask)
+{
+	float sum[3] = {};
+	float scatter[3][3] = {};
+	float count = 0.0f;
+
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (mask & (1u << i))
+		{
+			float texel[3] = { texels.channels[0][i], texels.channels[1][i], texels.channels[2][i] };
+			for (int a = 0; a < 3; a++)
+			{
+				sum[a] += texel[a];
+				for (int b = a; b < 3; b++)
+					scatter[a][b] += texel[a] * texel[b];
+			}
+			count += 1.0f;
+		}
+	}
+
+	if (count == 0.0f)
+		return 0.0f;
+
+	float inv_count = 1.0f / count;
+	for (int a = 0; a < 3; a++)
+		for (int b = a; b < 3; b++)
+			scatter[b][a] = scatter[a][b] = scatter[a][b] - sum[a] * sum[b] * inv_count;
+
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iter = 0; iter < 4; iter++)
+	{
+		float next[3];
+		for (int a = 0; a < 3; a++)
+			next[a] = scatter[a][0] * axis[0] + scatter[a][1] * axis[1] + scatter[a][2] * axis[2];
+		float max_component = std::max(std::max(fabsf(next[0]), fabsf(next[1])), fabsf(next[2]));
+		if (max_component < 1e-8f)
+			return 0.0f;
+		for (int a = 0; a < 3; a++)
+			axis[a] = next[a] / max_component;
+	}
+
+	float rayleigh = 0.0f;
+	float length = 0.0f;
+	for (int a = 0; a < 3; a++)
+	{
+		rayleigh += axis[a] * (scatter[a][0] * axis[0] + scatter[a][1] * axis[1] + scatter[a][2] * axis[2]);
+		length += axis[a] * axis[a];
+	}
+
+	return scatter[0][0] + scatter[1][1] + scatter[2][2] - rayleigh / length;
+}
+
+void compress_bc7_block(uint8_t *output, const uint8_t *rgba, unsigned quality)
+{
+	BlockTexels texels;
+	load_block(texels, rgba);
+
+	bool opaque = true;
+	for (int i = 0; i < 16; i++)
+		opaque = opaque && rgba[4 * i + 3] == 255;
+
+	auto mode6 = encode_bc7_mode6(texels, quality);
+
+	// Two subset search only pays off at higher quality levels.
+	unsigned num_partition_candidates = quality >= 5 ? 8 : (quality >= 4 ? 4 : (quality >= 3 ? 1 : 0));
+	if (!opaque || mode6.error == 0.0f || num_partition_candidates == 0)
+	{
+		pack_bc7_mode6(output, mode6);
+		return;
+	}
+
+	struct PartitionScore
+	{
+		float error;
+		unsigned partition;
+	};
+
+	PartitionScore scores[64];
+	for (unsigned partition = 0; partition < 64; partition++)
+	{
+		uint32_t mask = bc7_partitions2[partition];
+		scores[partition].partition = partition;
+		scores[partition].error = estimate_partition_error(texels, mask) +
+		                          estimate_partition_error(texels, ~mask & 0xffffu);
+	}
+
+	std::partial_sort(scores, scores + num_partition_candidates, scores + 64,
+	                  [](const PartitionScore &a, const PartitionScore &b) { return a.error < b.error; });
+
+	BC7Mode1Candidate best_mode1 = {};
+	unsigned best_partition = 0;
+	best_mode1.error = FLT_MAX;
+
+	for (unsigned i = 0; i < num_partition_candidates; i++)
+	{
+		auto candidate = encode_bc7_mode1(texels, scores[i].partition, quality);
+		if (candidate.error < best_mode1.error)
+		{
+			best_mode1 = candidate;
+			best_partition = scores[i].partition;
+		}
+	}
+
+	if (best_mode1.error < mode6.error)
+		pack_bc7_mode1(output, best_mode1, best_partition);
+	else
+		pack_bc7_mode6(output, mode6);
+}
+
+struct BC7ModeInfo
+{
+	uint8_t num_subsets;
+	uint8_t partition_bits;
+	uint8_t rotation_bits;
+	uint8_t index_selection_bits;
+	uint8_t color_bits;
+	uint8_t alpha_bits;
+	uint8_t endpoint_pbits;
+	uint8_t shared_pbits;
+	uint8_t index_bits;
+	uint8_t secondary_index_bits;
+};
+
+static const BC7ModeInfo bc7_modes[8] = {
+	{ 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+	{ 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+	{ 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+	{ 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+	{ 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+	{ 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+	{ 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+	{ 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 },
+};
+
+static const int *bc7_weight_table(unsigned bits)
+{
+	return bits == 2 ? bc7_weights2 : (bits == 3 ? bc7_weights3 : bc7_weights4);
+}
+
+void decompress_bc7_block(uint8_t *rgba, const uint8_t *block)
+{
+	unsigned mode = 0;
+	while (mode < 8 && ((block[0] >> mode) & 1) == 0)
+		mode++;
+
+	if (mode == 8)
+	{
+		memset(rgba, 0, 64);
+		return;
+	}
+
+	auto &info = bc7_modes[mode];
+	BitReader reader(block);
+	reader.read(mode + 1);
+
+	unsigned partition = reader.read(info.partition_bits);
+	unsigned rotation = reader.read(info.rotation_bits);
+	unsigned index_selection = reader.read(info.index_selection_bits);
+
+	int endpoints[3][2][4];
+	for (int c = 0; c < 3; c++)
+		for (int s = 0; s < info.num_subsets; s++)
+			for (int e = 0; e < 2; e++)
+				endpoints[s][e][c] = int(reader.read(info.color_bits));
+
+	for (int s = 0; s < info.num_subsets; s++)
+		for (int e = 0; e < 2; e++)
+			endpoints[s][e][3] = info.alpha_bits ? int(reader.read(info.alpha_bits)) : 255;
+
+	int pbits[3][2] = {};
+	if (info.endpoint_pbits)
+	{
+		for (int s = 0; s < info.num_subsets; s++)
+			for (int e = 0; e < 2; e++)
+				pbits[s][e] = int(reader.read(1));
+	}
+	else if (info.shared_pbits)
+	{
+		for (int s = 0; s < info.num_subsets; s++)
+			pbits[s][0] = pbits[s][1] = int(reader.read(1));
+	}
+
+	bool has_pbits = info.endpoint_pbits || info.shared_pbits;
+	for (int s = 0; s < info.num_subsets; s++)
+	{
+		for (int e = 0; e < 2; e++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				int bits = c < 3 ? info.color_bits : info.alpha_bits;
+				if (bits == 0)
+					continue;
+
+				int v = endpoints[s][e][c];
+				if (has_pbits)
+				{
+					v = (v << 1) | pbits[s][e];
+					bits++;
+				}
+				endpoints[s][e][c] = (v << (8 - bits)) | (v >> (2 * bits - 8));
+			}
+		}
+	}
+
+	unsigned subsets[16];
+	unsigned anchors[3] = { 0, 0, 0 };
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (info.num_subsets == 2)
+			subsets[i] = (bc7_partitions2[partition] >> i) & 1;
+		else if (info.num_subsets == 3)
+			subsets[i] = (bc7_partitions3[partition] >> (2 * i)) & 3;
+		else
+			subsets[i] = 0;
+	}
+
+	if (info.num_subsets == 2)
+		anchors[1] = bc7_anchors2[partition];
+	else if (info.num_subsets == 3)
+	{
+		anchors[1] = bc7_anchors3[partition][0];
+		anchors[2] = bc7_anchors3[partition][1];
+	}
+
+	unsigned indices[16];
+	for (unsigned i = 0; i < 16; i++)
+	{
+		bool anchor = i == anchors[0] || (info.num_subsets > 1 && i == anchors[1]) ||
+		              (info.num_subsets > 2 && i == anchors[2]);
+		indices[i] = reader.read(info.index_bits - (anchor ? 1 : 0));
+	}
+
+	unsigned secondary_indices[16] = {};
+	if (info.secondary_index_bits)
+		for (unsigned i = 0; i < 16; i++)
+			secondary_indices[i] = reader.read(info.secondary_index_bits - (i == 0 ? 1 : 0));
+
+	const int *color_weights = bc7_weight_table(info.index_bits);
+	const int *alpha_weights = info.secondary_index_bits ? bc7_weight_table(info.secondary_index_bits) : color_weights;
+
+	for (unsigned i = 0; i < 16; i++)
+	{
+		int color_weight = color_weights[indices[i]];
+		int alpha_weight = info.secondary_index_bits ? alpha_weights[secondary_indices[i]] : color_weight;
+		if (index_selection)
+		{
+			color_weight = alpha_weights[secondary_indices[i]];
+			alpha_weight = color_weights[indices[i]];
+		}
+
+		auto &ep = endpoints[subsets[i]];
+		int texel[4];
+		for (int c = 0; c < 3; c++)
+			texel[c] = bc7_interpolate(ep[0][c], ep[1][c], color_weight);
+		texel[3] = bc7_interpolate(ep[0][3], ep[1][3], alpha_weight);
+
+		if (rotation)
+			std::swap(texel[3], texel[rotation - 1]);
+
+		for (int c = 0; c < 4; c++)
+			rgba[4 * i + c] = uint8_t(texel[c]);
+	}
+}
+}
@@ -0,0 +1,45 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Granite
+{
+// Native BC1/BC3/BC7 block encoders, used when ISPC texture compression is not available.
+// Inputs are 4x4 blocks of RGBA8 texels in row-major order (64 bytes).
+// quality follows CompressorArguments, 1 (fastest) to 5 (best).
+
+// With punchthrough_alpha, texels with alpha < 128 are encoded as transparent using 3-color mode.
+void compress_bc1_block(uint8_t *output, const uint8_t *rgba, unsigned quality, bool punchthrough_alpha);
+void compress_bc3_block(uint8_t *output, const uint8_t *rgba, unsigned quality);
+
+// Fast mode BC7. Mode 6 is always considered, opaque blocks also search two-subset mode 1 at quality >= 3.
+void compress_bc7_block(uint8_t *output, const uint8_t *rgba, unsigned quality);
+
+// Reference decoders, mostly useful for measuring encoder quality.
+void decompress_bc1_block(uint8_t *rgba, const uint8_t *block);
+void decompress_bc3_block(uint8_t *rgba, const uint8_t *block);
+void decompress_bc7_block(uint8_t *rgba, const uint8_t *block);
+}
@@ -0,0 +1,762 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define NOMINMAX
+#include "environment_filter.hpp"
+#include "thread_group.hpp"
+#include "math.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "simd_headers.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <string.h>
+
+namespace Granite
+{
+namespace SceneFormats
+{
+bool environment_filter_supports_format(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static inline float srgb_gamma_to_linear(float v)
+{
+	if (v <= 0.04045f)
+		return v * (1.0f / 12.92f);
+	else
+		return muglm::pow((v + 0.055f) / (1.0f + 0.055f), 2.4f);
+}
+
+static inline float srgb_linear_to_gamma(float v)
+{
+	if (v <= 0.0031308f)
+		return 12.92f * v;
+	else
+		return (1.0f + 0.055f) * muglm::pow(v, 1.0f / 2.4f) - 0.055f;
+}
+
+static void decode_row(VkFormat format, const void *src, unsigned count, vec4 *dst)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	{
+		bool bgra = format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+		bool srgb = format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB;
+		auto *texels = static_cast<const u8vec4 *>(src);
+		for (unsigned i = 0; i < count; i++)
+		{
+			vec4 v = vec4(texels[i]) * (1.0f / 255.0f);
+			if (bgra)
+				std::swap(v.x, v.z);
+			if (srgb)
+				v = vec4(srgb_gamma_to_linear(v.x), srgb_gamma_to_linear(v.y), srgb_gamma_to_linear(v.z), v.w);
+			dst[i] = v;
+		}
+		break;
+	}
+
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	{
+		auto *texels = static_cast<const u16vec4 *>(src);
+		for (unsigned i = 0; i < count; i++)
+		{
+			dst[i] = vec4(halfToFloat(texels[i].x), halfToFloat(texels[i].y),
+			              halfToFloat(texels[i].z), halfToFloat(texels[i].w));
+		}
+		break;
+	}
+
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		memcpy(dst, src, count * sizeof(vec4));
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void encode_row(VkFormat format, const vec4 *src, unsigned count, void *dst)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	{
+		bool bgra = format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+		bool srgb = format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB;
+		auto *texels = static_cast<u8vec4 *>(dst);
+		for (unsigned i = 0; i < count; i++)
+		{
+			vec4 v = src[i];
+			if (srgb)
+				v = vec4(srgb_linear_to_gamma(v.x), srgb_linear_to_gamma(v.y), srgb_linear_to_gamma(v.z), v.w);
+			if (bgra)
+				std::swap(v.x, v.z);
+			texels[i] = u8vec4(clamp(round(v * 255.0f), vec4(0.0f), vec4(255.0f)));
+		}
+		break;
+	}
+
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	{
+		auto *texels = static_cast<u16vec4 *>(dst);
+		for (unsigned i = 0; i < count; i++)
+			texels[i] = floatToHalf(src[i]);
+		break;
+	}
+
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		memcpy(dst, src, count * sizeof(vec4));
+		break;
+
+	default:
+		break;
+	}
+}
+
+namespace
+{
+// All layers and levels of an image, decoded to linear float RGBA.
+struct FloatImage
+{
+	unsigned width = 0;
+	unsigned height = 0;
+	unsigned layers = 0;
+	unsigned levels = 0;
+	std::vector<vec4> texels;
+	size_t offsets[16] = {};
+
+	void init(unsigned width_, unsigned height_, unsigned layers_, unsigned levels_)
+	{
+		width = width_;
+		height = height_;
+		layers = layers_;
+		levels = levels_;
+
+		size_t offset = 0;
+		for (unsigned level = 0; level < levels; level++)
+		{
+			offsets[level] = offset;
+			offset += size_t(get_width(level)) * get_height(level) * layers;
+		}
+		texels.resize(offset);
+	}
+
+	unsigned get_width(unsigned level) const
+	{
+		return std::max(width >> level, 1u);
+	}
+
+	unsigned get_height(unsigned level) const
+	{
+		return std::max(height >> level, 1u);
+	}
+
+	vec4 *data(unsigned layer, unsigned level)
+	{
+		return texels.data() + offsets[level] + size_t(layer) * get_width(level) * get_height(level);
+	}
+
+	const vec4 *data(unsigned layer, unsigned level) const
+	{
+		return texels.data() + offsets[level] + size_t(layer) * get_width(level) * get_height(level);
+	}
+};
+}
+
+// Rows of output per task, scaled so that tasks carry roughly the same amount of work.
+static unsigned rows_per_task(unsigned width, unsigned cost_per_texel)
+{
+	unsigned texels_per_task = std::max(1u, (64u * 1024u) / std::max(cost_per_texel, 1u));
+	return std::max(1u, texels_per_task / std::max(width, 1u));
+}
+
+template <typename Func>
+static void dispatch_rows(ThreadGroup &group, unsigned layers, unsigned height, unsigned band, const Func &func)
+{
+	auto task = group.create_task();
+	for (unsigned layer = 0; layer < layers; layer++)
+	{
+		for (unsigned y = 0; y < height; y += band)
+		{
+			unsigned end_y = std::min(y + band, height);
+			task->enqueue_task([&func, layer, y, end_y]() {
+				func(layer, y, end_y);
+			});
+		}
+	}
+	task->flush();
+	task->wait();
+}
+
+static void decode_image(ThreadGroup &group, const Vulkan::TextureFormatLayout &layout, FloatImage &image)
+{
+	image.init(layout.get_width(), layout.get_height(), layout.get_layers(), layout.get_levels());
+	for (unsigned level = 0; level < image.levels; level++)
+	{
+		unsigned width = image.get_width(level);
+		dispatch_rows(group, image.layers, image.get_height(level), rows_per_task(width, 1),
+		              [&, level, width](unsigned layer, unsigned begin_y, unsigned end_y) {
+			              for (unsigned y = begin_y; y < end_y; y++)
+			              {
+				              decode_row(layout.get_format(), layout.data_opaque(0, y, layer, level), width,
+				                         image.data(layer, level) + y * width);
+			              }
+		              });
+	}
+}
+
+static void encode_image(ThreadGroup &group, const FloatImage &image, const Vulkan::TextureFormatLayout &layout)
+{
+	for (unsigned level = 0; level < image.levels; level++)
+	{
+		unsigned width = image.get_width(level);
+		dispatch_rows(group, image.layers, image.get_height(level), rows_per_task(width, 1),
+		              [&, level, width](unsigned layer, unsigned begin_y, unsigned end_y) {
+			              for (unsigned y = begin_y; y < end_y; y++)
+			              {
+				              encode_row(layout.get_format(), image.data(layer, level) + y * width, width,
+				                         layout.data_opaque(0, y, layer, level));
+			              }
+		              });
+	}
+}
+
+static inline vec4 blend_texels(const vec4 &a, const vec4 &b, const vec4 &c, const vec4 &d,
+                                float wa, float wb, float wc, float wd)
+{
+	vec4 ret;
+#if defined(__SSE__)
+	__m128 v = _mm_mul_ps(_mm_loadu_ps(a.data), _mm_set1_ps(wa));
+	v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(b.data), _mm_set1_ps(wb)));
+	v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(c.data), _mm_set1_ps(wc)));
+	v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(d.data), _mm_set1_ps(wd)));
+	_mm_storeu_ps(ret.data, v);
+#elif defined(__ARM_NEON)
+	float32x4_t v = vmulq_n_f32(vld1q_f32(a.data), wa);
+	v = vmlaq_n_f32(v, vld1q_f32(b.data), wb);
+	v = vmlaq_n_f32(v, vld1q_f32(c.data), wc);
+	v = vmlaq_n_f32(v, vld1q_f32(d.data), wd);
+	vst1q_f32(ret.data, v);
+#else
+	ret = a * wa + b * wb + c * wc + d * wd;
+#endif
+	return ret;
+}
+
+static inline void accumulate_texel(vec4 &acc, const vec4 &v, float w)
+{
+#if defined(__SSE__)
+	_mm_storeu_ps(acc.data, _mm_add_ps(_mm_loadu_ps(acc.data), _mm_mul_ps(_mm_loadu_ps(v.data), _mm_set1_ps(w))));
+#elif defined(__ARM_NEON)
+	vst1q_f32(acc.data, vmlaq_n_f32(vld1q_f32(acc.data), vld1q_f32(v.data), w));
+#else
+	acc += v * w;
+#endif
+}
+
+// Bilinear filtering in texel space. Wrap for equirects, clamp within cube faces.
+static inline vec4 sample_bilinear(const vec4 *texels, unsigned width, unsigned height, float x, float y, bool wrap)
+{
+	x -= 0.5f;
+	y -= 0.5f;
+	float fx = muglm::floor(x);
+	float fy = muglm::floor(y);
+	float u = x - fx;
+	float v = y - fy;
+	int x0 = int(fx);
+	int y0 = int(fy);
+	int x1 = x0 + 1;
+	int y1 = y0 + 1;
+
+	if (wrap)
+	{
+		int w = int(width);
+		int h = int(height);
+		x0 = ((x0 % w) + w) % w;
+		x1 = ((x1 % w) + w) % w;
+		y0 = ((y0 % h) + h) % h;
+		y1 = ((y1 % h) + h) % h;
+	}
+	else
+	{
+		int max_x = int(width) - 1;
+		int max_y = int(height) - 1;
+		x0 = muglm::clamp(x0, 0, max_x);
+		x1 = muglm::clamp(x1, 0, max_x);
+		y0 = muglm::clamp(y0, 0, max_y);
+		y1 = muglm::clamp(y1, 0, max_y);
+	}
+
+	return blend_texels(texels[y0 * width + x0], texels[y0 * width + x1],
+	                    texels[y1 * width + x0], texels[y1 * width + x1],
+	                    (1.0f - u) * (1.0f - v), u * (1.0f - v),
+	                    (1.0f - u) * v, u * v);
+}
+
+// Vulkan cube face conventions, s and t in [-1, 1].
+static inline vec3 cube_face_direction(unsigned face, float s, float t)
+{
+	switch (face)
+	{
+	case 0:
+		return vec3(1.0f, -t, -s);
+	case 1:
+		return vec3(-1.0f, -t, s);
+	case 2:
+		return vec3(s, 1.0f, t);
+	case 3:
+		return vec3(s, -1.0f, -t);
+	case 4:
+		return vec3(s, -t, 1.0f);
+	default:
+		return vec3(-s, -t, -1.0f);
+	}
+}
+
+static inline unsigned cube_direction_to_face(const vec3 &dir, vec2 &uv)
+{
+	vec3 a = abs(dir);
+	unsigned face;
+	float sc, tc, ma;
+
+	if (a.x >= a.y && a.x >= a.z)
+	{
+		face = dir.x >= 0.0f ? 0 : 1;
+		sc = dir.x >= 0.0f ? -dir.z : dir.z;
+		tc = -dir.y;
+		ma = a.x;
+	}
+	else if (a.y >= a.z)
+	{
+		face = dir.y >= 0.0f ? 2 : 3;
+		sc = dir.x;
+		tc = dir.y >= 0.0f ? dir.z : -dir.z;
+		ma = a.y;
+	}
+	else
+	{
+		face = dir.z >= 0.0f ? 4 : 5;
+		sc = dir.z >= 0.0f ? dir.x : -dir.x;
+		tc = -dir.y;
+		ma = a.z;
+	}
+
+	float inv_ma = 0.5f / ma;
+	uv = vec2(sc * inv_ma + 0.5f, tc * inv_ma + 0.5f);
+	return face;
+}
+
+static inline vec4 sample_cube_level(const FloatImage &cube, unsigned face, const vec2 &uv, unsigned level)
+{
+	unsigned size = cube.get_width(level);
+	float fsize = float(size);
+	return sample_bilinear(cube.data(face, level), size, size, uv.x * fsize, uv.y * fsize, false);
+}
+
+// Trilinear lookup. Filtering does not cross face edges, unlike seamless cube sampling on GPUs.
+static inline vec4 sample_cube(const FloatImage &cube, const vec3 &dir, float lod)
+{
+	vec2 uv;
+	unsigned face = cube_direction_to_face(dir, uv);
+
+	lod = muglm::clamp(lod, 0.0f, float(cube.levels - 1));
+	unsigned level = unsigned(lod);
+	float l = lod - float(level);
+
+	vec4 v = sample_cube_level(cube, face, uv, level);
+	if (l > 0.0f && level + 1 < cube.levels)
+		v = mix(v, sample_cube_level(cube, face, uv, level + 1), l);
+	return v;
+}
+
+// Bilinear downsampling at scaled texel centers, equivalent to linear blits.
+// This is a 2x2 box filter for even sizes, and stays centered for odd sizes.
+static void generate_cube_mipmaps(ThreadGroup &group, FloatImage &cube)
+{
+	for (unsigned level = 1; level < cube.levels; level++)
+	{
+		unsigned size = cube.get_width(level);
+		unsigned src_size = cube.get_width(level - 1);
+		float rescale = float(src_size) / float(size);
+
+		dispatch_rows(group, cube.layers, size, rows_per_task(size, 4),
+		              [&, level, size, src_size, rescale](unsigned face, unsigned begin_y, unsigned end_y) {
+			              const vec4 *src = cube.data(face, level - 1);
+			              vec4 *dst = cube.data(face, level);
+			              for (unsigned y = begin_y; y < end_y; y++)
+			              {
+				              float src_y = (float(y) + 0.5f) * rescale;
+				              for (unsigned x = 0; x < size; x++)
+				              {
+					              float src_x = (float(x) + 0.5f) * rescale;
+					              dst[y * size + x] = sample_bilinear(src, src_size, src_size, src_x, src_y, false);
+				              }
+			              }
+		              });
+	}
+}
+
+static bool validate_input(const Vulkan::TextureFormatLayout &layout, bool cube)
+{
+	if (layout.get_image_type() != VK_IMAGE_TYPE_2D)
+	{
+		LOGE("Environment input must be a 2D image.\n");
+		return false;
+	}
+
+	if (!environment_filter_supports_format(layout.get_format()))
+	{
+		LOGE("Unsupported format for environment filtering.\n");
+		return false;
+	}
+
+	if (cube && (layout.get_layers() != 6 || layout.get_width() != layout.get_height()))
+	{
+		LOGE("Environment input is not a cube map.\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool decode_cube(ThreadGroup &group, const Vulkan::TextureFormatLayout &layout, FloatImage &cube)
+{
+	if (!validate_input(layout, true))
+		return false;
+
+	decode_image(group, layout, cube);
+
+	// Single level cubes are expected to be mipmapped on load, which filtering needs as well.
+	if (layout.get_levels() == 1 && layout.get_width() > 1)
+	{
+		FloatImage mipmapped;
+		mipmapped.init(cube.width, cube.height, 6, Vulkan::TextureFormatLayout::num_miplevels(cube.width));
+		memcpy(mipmapped.data(0, 0), cube.data(0, 0), size_t(cube.width) * cube.height * 6 * sizeof(vec4));
+		generate_cube_mipmaps(group, mipmapped);
+		cube = std::move(mipmapped);
+	}
+
+	return true;
+}
+
+Vulkan::MemoryMappedTexture convert_equirect_to_cube(ThreadGroup &group, const Vulkan::TextureFormatLayout &equirect,
+                                                     float scale)
+{
+	if (!validate_input(equirect, false))
+		return {};
+
+	FloatImage source;
+	decode_image(group, equirect, source);
+
+	unsigned size = unsigned(scale * std::max(equirect.get_width() / 3, equirect.get_height() / 2));
+	if (!size)
+	{
+		LOGE("Cube size is 0.\n");
+		return {};
+	}
+
+	FloatImage cube;
+	cube.init(size, size, 6, Vulkan::TextureFormatLayout::num_miplevels(size));
+
+	const vec4 *src = source.data(0, 0);
+	unsigned src_width = source.width;
+	unsigned src_height = source.height;
+	float inv_size = 1.0f / float(size);
+
+	dispatch_rows(group, 6, size, rows_per_task(size, 8),
+	              [&, src, src_width, src_height, size, inv_size](unsigned face, unsigned begin_y, unsigned end_y) {
+		              vec4 *dst = cube.data(face, 0);
+		              for (unsigned y = begin_y; y < end_y; y++)
+		              {
+			              float t = 2.0f * (float(y) + 0.5f) * inv_size - 1.0f;
+			              for (unsigned x = 0; x < size; x++)
+			              {
+				              float s = 2.0f * (float(x) + 0.5f) * inv_size - 1.0f;
+				              vec3 v = normalize(cube_face_direction(face, s, t));
+
+				              // Same mapping and constants as skybox_latlon.frag.
+				              vec2 uv = vec2(std::atan2(v.z, v.x), std::asin(-v.y));
+				              uv = uv * vec2(0.1591f, 0.3183f) + 0.5f;
+				              dst[y * size + x] = sample_bilinear(src, src_width, src_height,
+				                                                  uv.x * float(src_width), uv.y * float(src_height),
+				                                                  true);
+			              }
+		              }
+	              });
+
+	generate_cube_mipmaps(group, cube);
+
+	Vulkan::MemoryMappedTexture output;
+	output.set_cube(equirect.get_format(), size, 1, cube.levels);
+	if (!output.map_write_scratch())
+		return {};
+
+	encode_image(group, cube, output.get_layout());
+	return output;
+}
+
+static inline float radical_inverse(uint32_t bits)
+{
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	return float(bits) * 2.3283064365386963e-10f;
+}
+
+namespace
+{
+struct GGXSample
+{
+	vec3 tangent_dir;
+	float weight;
+};
+}
+
+// With N = V = R as in ibl_specular.frag, the reflected directions only depend on roughness,
+// so they are computed once per level in tangent space.
+static std::vector<GGXSample> build_ggx_samples(float roughness, unsigned sample_count)
+{
+	std::vector<GGXSample> samples;
+	samples.reserve(sample_count);
+
+	float a = roughness * roughness;
+	for (unsigned i = 0; i < sample_count; i++)
+	{
+		vec2 xi = vec2(float(i) / float(sample_count), radical_inverse(i));
+		float phi = 2.0f * pi<float>() * xi.x;
+		float cos_theta = muglm::sqrt((1.0f - xi.y) / (1.0f + (a * a - 1.0f) * xi.y));
+		float sin_theta = muglm::sqrt(muglm::max(1.0f - cos_theta * cos_theta, 0.0f));
+		vec3 h = vec3(muglm::cos(phi) * sin_theta, muglm::sin(phi) * sin_theta, cos_theta);
+		vec3 l = normalize(2.0f * h.z * h - vec3(0.0f, 0.0f, 1.0f));
+
+		if (l.z > 0.0f)
+			samples.push_back({ l, l.z });
+	}
+
+	return samples;
+}
+
+Vulkan::MemoryMappedTexture convert_cube_to_ibl_specular(ThreadGroup &group, const Vulkan::TextureFormatLayout &layout,
+                                                         unsigned sample_count)
+{
+	FloatImage cube;
+	if (!decode_cube(group, layout, cube))
+		return {};
+
+	constexpr unsigned size = 128;
+	constexpr unsigned levels = 8;
+	float base_sample_lod = muglm::log2(float(cube.width)) - 7.0f;
+
+	FloatImage output;
+	output.init(size, size, 6, levels);
+
+	for (unsigned level = 0; level < levels; level++)
+	{
+		float roughness = mix(0.001f, 1.0f, float(level) / float(levels - 1));
+		auto samples = build_ggx_samples(roughness, sample_count);
+		float sample_lod = base_sample_lod + float(level);
+		unsigned level_size = output.get_width(level);
+		float inv_size = 1.0f / float(level_size);
+
+		dispatch_rows(group, 6, level_size, rows_per_task(level_size, unsigned(samples.size())),
+		              [&, level, level_size, inv_size, sample_lod](unsigned face, unsigned begin_y, unsigned end_y) {
+			              vec4 *dst = output.data(face, level);
+			              for (unsigned y = begin_y; y < end_y; y++)
+			              {
+				              float t = 2.0f * (float(y) + 0.5f) * inv_size - 1.0f;
+				              for (unsigned x = 0; x < level_size; x++)
+				              {
+					              float s = 2.0f * (float(x) + 0.5f) * inv_size - 1.0f;
+					              vec3 n = normalize(cube_face_direction(face, s, t));
+					              vec3 up = muglm::abs(n.z) < 0.999f ? vec3(0.0f, 0.0f, 1.0f) : vec3(1.0f, 0.0f, 0.0f);
+					              vec3 tangent = normalize(cross(up, n));
+					              vec3 bitangent = cross(n, tangent);
+
+					              vec4 color = vec4(0.0f);
+					              float total_weight = 0.0f;
+					              for (auto &sample : samples)
+					              {
+						              vec3 l = tangent * sample.tangent_dir.x +
+						                       bitangent * sample.tangent_dir.y +
+						                       n * sample.tangent_dir.z;
+						              accumulate_texel(color, sample_cube(cube, l, sample_lod), sample.weight);
+						              total_weight += sample.weight;
+					              }
+
+					              color *= 1.0f / total_weight;
+					              dst[y * level_size + x] = vec4(color.xyz(), 1.0f);
+				              }
+			              }
+		              });
+	}
+
+	Vulkan::MemoryMappedTexture tex;
+	tex.set_cube(VK_FORMAT_R16G16B16A16_SFLOAT, size, 1, levels);
+	if (!tex.map_write_scratch())
+		return {};
+
+	encode_image(group, output, tex.get_layout());
+	return tex;
+}
+
+static inline void sh_basis(const vec3 &n, float *basis)
+{
+	basis[0] = 0.282095f;
+	basis[1] = 0.488603f * n.y;
+	basis[2] = 0.488603f * n.z;
+	basis[3] = 0.488603f * n.x;
+	basis[4] = 1.092548f * n.x * n.y;
+	basis[5] = 1.092548f * n.y * n.z;
+	basis[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f);
+	basis[7] = 1.092548f * n.x * n.z;
+	basis[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+}
+
+namespace
+{
+struct SHCoefficients
+{
+	vec4 coeffs[9] = {};
+	float weight = 0.0f;
+};
+}
+
+Vulkan::MemoryMappedTexture convert_cube_to_ibl_diffuse(ThreadGroup &group, const Vulkan::TextureFormatLayout &layout)
+{
+	FloatImage cube;
+	if (!decode_cube(group, layout, cube))
+		return {};
+
+	// Irradiance is very low frequency, projecting a small mip is plenty.
+	unsigned projection_level = 0;
+	while (projection_level + 1 < cube.levels && cube.get_width(projection_level) > 64)
+		projection_level++;
+
+	unsigned projection_size = cube.get_width(projection_level);
+	SHCoefficients face_sh[6];
+
+	dispatch_rows(group, 6, 1, 1, [&](unsigned face, unsigned, unsigned) {
+		auto &sh = face_sh[face];
+		const vec4 *src = cube.data(face, projection_level);
+		float inv_size = 1.0f / float(projection_size);
+		float texel_area = 4.0f * inv_size * inv_size;
+
+		for (unsigned y = 0; y < projection_size; y++)
+		{
+			float t = 2.0f * (float(y) + 0.5f) * inv_size - 1.0f;
+			for (unsigned x = 0; x < projection_size; x++)
+			{
+				float s = 2.0f * (float(x) + 0.5f) * inv_size - 1.0f;
+				float inv_len = 1.0f / muglm::sqrt(1.0f + s * s + t * t);
+				// Solid angle subtended by the texel.
+				float weight = texel_area * inv_len * inv_len * inv_len;
+				vec3 n = cube_face_direction(face, s, t) * inv_len;
+
+				float basis[9];
+				sh_basis(n, basis);
+				const vec4 &v = src[y * projection_size + x];
+				for (unsigned i = 0; i < 9; i++)
+					accumulate_texel(sh.coeffs[i], v, basis[i] * weight);
+				sh.weight += weight;
+			}
+		}
+	});
+
+	SHCoefficients sh;
+	for (auto &face : face_sh)
+	{
+		for (unsigned i = 0; i < 9; i++)
+			sh.coeffs[i] += face.coeffs[i];
+		sh.weight += face.weight;
+	}
+
+	// Normalize the solid angle approximation to exactly cover the sphere,
+	// and fold in the cosine lobe convolution (pi, 2pi/3, pi/4) and the 1/pi of a white Lambertian surface.
+	float normalization = 4.0f * pi<float>() / sh.weight;
+	static const float band_scale[9] = {
+		1.0f,
+		2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f,
+		0.25f, 0.25f, 0.25f, 0.25f, 0.25f,
+	};
+	for (unsigned i = 0; i < 9; i++)
+		sh.coeffs[i] *= normalization * band_scale[i];
+
+	constexpr unsigned size = 32;
+	FloatImage output;
+	output.init(size, size, 6, 1);
+
+	dispatch_rows(group, 6, size, size, [&](unsigned face, unsigned begin_y, unsigned end_y) {
+		vec4 *dst = output.data(face, 0);
+		float inv_size = 1.0f / float(size);
+		for (unsigned y = begin_y; y < end_y; y++)
+		{
+			float t = 2.0f * (float(y) + 0.5f) * inv_size - 1.0f;
+			for (unsigned x = 0; x < size; x++)
+			{
+				float s = 2.0f * (float(x) + 0.5f) * inv_size - 1.0f;
+				vec3 n = normalize(cube_face_direction(face, s, t));
+
+				float basis[9];
+				sh_basis(n, basis);
+				vec4 irradiance = vec4(0.0f);
+				for (unsigned i = 0; i < 9; i++)
+					accumulate_texel(irradiance, sh.coeffs[i], basis[i]);
+				dst[y * size + x] = vec4(max(irradiance.xyz(), vec3(0.0f)), 1.0f);
+			}
+		}
+	});
+
+	Vulkan::MemoryMappedTexture tex;
+	tex.set_cube(VK_FORMAT_R16G16B16A16_SFLOAT, size, 1, 1);
+	tex.set_generate_mipmaps_on_load();
+	if (!tex.map_write_scratch())
+		return {};
+
+	encode_image(group, output, tex.get_layout());
+	return tex;
+}
+}
+}
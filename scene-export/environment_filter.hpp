@@ -0,0 +1,52 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "memory_mapped_texture.hpp"
+
+namespace Granite
+{
+class ThreadGroup;
+
+namespace SceneFormats
+{
+// CPU implementations of the environment conversions in renderer/utils/image_utils.hpp,
+// for asset builds without a GPU. Outputs match the GPU path in format, size and mip layout.
+// Work is spread over the thread group, and the calls return when it has completed.
+// Inputs must be uncompressed RGBA8 or RGBA16F/RGBA32F.
+bool environment_filter_supports_format(VkFormat format);
+
+// Equirectangular 2D image to a cube with a full mip chain in the same format.
+Vulkan::MemoryMappedTexture convert_equirect_to_cube(ThreadGroup &group, const Vulkan::TextureFormatLayout &equirect,
+                                                     float scale);
+
+// GGX prefiltered reflection cube, 128x128 RGBA16F with 8 levels of increasing roughness.
+// sample_count is the number of importance samples per texel.
+Vulkan::MemoryMappedTexture convert_cube_to_ibl_specular(ThreadGroup &group, const Vulkan::TextureFormatLayout &cube,
+                                                         unsigned sample_count = 1024);
+
+// Diffuse irradiance cube, 32x32 RGBA16F. The environment is projected onto
+// 3rd order spherical harmonics, which are then convolved with the cosine lobe.
+Vulkan::MemoryMappedTexture convert_cube_to_ibl_diffuse(ThreadGroup &group, const Vulkan::TextureFormatLayout &cube);
+}
+}
@@ -26,6 +26,12 @@
 #include <iterator>
 #include <assert.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 namespace Granite
 {
 static const int range_threshold = 16;
@@ -71,100 +77,54 @@ static DividerLut divider_lut;
 
 void decompress_rgtc_red_block(uint8_t *output_r, const uint8_t *block)
 {
-	uint8_t red0 = block[0];
-	uint8_t red1 = block[1];
+	int red0 = block[0];
+	int red1 = block[1];
 	uint64_t bits = 0;
 
 	for (int i = 0; i < 6; i++)
 		bits |= uint64_t(block[2 + i]) << (8 * i);
 
+	uint8_t palette[8];
+	palette[0] = uint8_t(red0);
+	palette[1] = uint8_t(red1);
+
 	if (red0 > red1)
 	{
-		for (int i = 0; i < 16; i++)
-		{
-			int code = int((bits >> (3 * i)) & 7);
-			switch (code)
-			{
-			default:
-			case 0:
-				output_r[i] = red0;
-				break;
-
-			case 1:
-				output_r[i] = red1;
-				break;
-
-			case 2:
-				output_r[i] = uint8_t(((red0 * 6 + red1 * 1) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 3:
-				output_r[i] = uint8_t(((red0 * 5 + red1 * 2) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 4:
-				output_r[i] = uint8_t(((red0 * 4 + red1 * 3) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 5:
-				output_r[i] = uint8_t(((red0 * 3 + red1 * 4) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 6:
-				output_r[i] = uint8_t(((red0 * 2 + red1 * 5) * div_7 + 0x80000) >> 20);
-				break;
-
-			case 7:
-				output_r[i] = uint8_t(((red0 * 1 + red1 * 6) * div_7 + 0x80000) >> 20);
-				break;
-			}
-		}
+		for (int i = 1; i < 7; i++)
+			palette[i + 1] = uint8_t(((red0 * (7 - i) + red1 * i) * div_7 + 0x80000) >> 20);
 	}
 	else
 	{
-		for (int i = 0; i < 16; i++)
-		{
-			int code = int((bits >> (3 * i)) & 7);
-			switch (code)
-			{
-			default:
-			case 0:
-				output_r[i] = red0;
-				break;
-
-			case 1:
-				output_r[i] = red1;
-				break;
-
-			case 2:
-				output_r[i] = uint8_t(((red0 * 4 + red1 * 1) * div_5 + 0x80000) >> 20);
-				break;
-
-			case 3:
-				output_r[i] = uint8_t(((red0 * 3 + red1 * 2) * div_5 + 0x80000) >> 20);
-				break;
-
-			case 4:
-				output_r[i] = uint8_t(((red0 * 2 + red1 * 3) * div_5 + 0x80000) >> 20);
-				break;
-
-			case 5:
-				output_r[i] = uint8_t(((red0 * 1 + red1 * 4) * div_5 + 0x80000) >> 20);
-				break;
-
-			case 6:
-				output_r[i] = 0;
-				break;
-
-			case 7:
-				output_r[i] = 255;
-				break;
-			}
-		}
+		for (int i = 1; i < 5; i++)
+			palette[i + 1] = uint8_t(((red0 * (5 - i) + red1 * i) * div_5 + 0x80000) >> 20);
+		palette[6] = 0;
+		palette[7] = 255;
 	}
+
+	for (int i = 0; i < 16; i++)
+		output_r[i] = palette[(bits >> (3 * i)) & 7];
 }
 
-void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r)
+struct RGTCBlockState
+{
+	int sorted_block[16];
+	int best_error;
+	uint64_t block;
+	uint8_t encode_0;
+	uint8_t encode_1;
+	bool needs_partition_search;
+};
+
+struct RGTCPartition
+{
+	int lo_index = 0;
+	int hi_index = 15;
+	bool use_5_weight = false;
+};
+
+// Trivial blocks are fully encoded here. Otherwise, a 7-weight encoding is produced,
+// which the 5-weight partition search attempts to beat.
+static void begin_rgtc_red_block(RGTCBlockState &state, const uint8_t *input_r)
 {
 	int block_lo = 255;
 	int block_hi = 0;
@@ -175,25 +135,21 @@ void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r)
 		block_hi = std::max<int>(block_hi, input_r[i]);
 	}
 
-	uint64_t block = 0;
-	uint8_t encode_0 = 0;
-	uint8_t encode_1 = 0;
+	state.block = 0;
+	state.encode_0 = uint8_t(block_hi);
+	state.encode_1 = uint8_t(block_lo);
+	state.needs_partition_search = false;
 
 	int range = block_hi - block_lo;
 
 	if (range == 0)
-	{
-		encode_0 = uint8_t(block_hi);
-		encode_1 = uint8_t(block_lo);
-	}
-	else if (range < range_threshold)
-	{
-		// Simple case, range is small enough that we can directly quantize and be done with it.
-		int divider = divider_lut.lut7(range);
+		return;
 
-		encode_0 = uint8_t(block_hi);
-		encode_1 = uint8_t(block_lo);
+	int divider = divider_lut.lut7(range);
 
+	if (range < range_threshold)
+	{
+		// Simple case, range is small enough that we can directly quantize and be done with it.
 		for (int i = 0; i < 16; i++)
 		{
 			int code = ((input_r[i] - block_lo) * divider + 0x80000) >> 20;
@@ -206,138 +162,344 @@ void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r)
 			else
 				code = 8 - code;
 
-			block |= uint64_t(code) << (3 * i);
+			state.block |= uint64_t(code) << (3 * i);
 		}
+		return;
 	}
-	else
+
+	int best_error = 0;
+	for (int i = 0; i < 16; i++)
 	{
-		int divider = divider_lut.lut7(range);
-		encode_0 = uint8_t(block_hi);
-		encode_1 = uint8_t(block_lo);
+		int code = ((input_r[i] - block_lo) * divider + 0x80000) >> 20;
+		assert(code <= 7);
+		int interpolated_value = block_lo + ((range * code * div_7 + 0x80000) >> 20);
 
-		int best_error = 0;
-		int lo_index = 0;
-		int hi_index = 15;
-		bool use_5_weight = false;
+		if (code == 7)
+			code = 0;
+		else if (code == 0)
+			code = 1;
+		else
+			code = 8 - code;
 
-		for (int i = 0; i < 16; i++)
+		int diff = interpolated_value - input_r[i];
+		best_error += diff * diff;
+
+		state.block |= uint64_t(code) << (3 * i);
+	}
+
+	state.best_error = best_error;
+	state.needs_partition_search = true;
+	for (int i = 0; i < 16; i++)
+		state.sorted_block[i] = input_r[i];
+	std::sort(std::begin(state.sorted_block), std::end(state.sorted_block));
+}
+
+static RGTCPartition search_rgtc_partition(const RGTCBlockState &state)
+{
+	RGTCPartition partition;
+	auto &sorted_block = state.sorted_block;
+	int best_error = state.best_error;
+
+	for (int lo = 0; lo < 15; lo++)
+	{
+		for (int hi = lo; hi < 15; hi++)
 		{
-			int code = ((input_r[i] - block_lo) * divider + 0x80000) >> 20;
-			assert(code <= 7);
-			int interpolated_value = block_lo + ((range * code * div_7 + 0x80000) >> 20);
+			int partition_lo = sorted_block[lo];
+			int partition_hi = sorted_block[hi];
+			assert(partition_hi >= partition_lo);
+			int partition_range = partition_hi - partition_lo;
+			int partition_divider = divider_lut.lut5(partition_range);
 
-			if (code == 7)
-				code = 0;
-			else if (code == 0)
-				code = 1;
-			else
-				code = 8 - code;
+			int error = 0;
 
-			int diff = interpolated_value - input_r[i];
-			best_error += diff * diff;
+			// Consider that we can quantize to 0.0 as well.
+			for (int i = 0; i < lo; i++)
+			{
+				int diff = std::min(sorted_block[i] - 0, partition_lo - sorted_block[i]);
+				error += diff * diff;
+			}
 
-			block |= uint64_t(code) << (3 * i);
+			for (int i = lo; i <= hi; i++)
+			{
+				int code = ((sorted_block[i] - partition_lo) * partition_divider + 0x80000) >> 20;
+				assert(code <= 7);
+				int interpolated_value = partition_lo + ((partition_range * code * div_5 + 0x80000) >> 20);
+				int diff = interpolated_value - sorted_block[i];
+				error += diff * diff;
+			}
+
+			// Consider that we can quantize to 1.0 as well.
+			for (int i = hi + 1; i <= 15; i++)
+			{
+				int diff = std::min(255 - sorted_block[i], sorted_block[i] - partition_hi);
+				error += diff * diff;
+			}
+
+			if (error < best_error)
+			{
+				partition.lo_index = lo;
+				partition.hi_index = hi;
+				best_error = error;
+				partition.use_5_weight = true;
+			}
 		}
+	}
 
-		int sorted_block[16];
-		for (int i = 0; i < 16; i++)
-			sorted_block[i] = input_r[i];
-		std::sort(std::begin(sorted_block), std::end(sorted_block));
+	return partition;
+}
+
+static void end_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r,
+                               RGTCBlockState &state, const RGTCPartition &partition)
+{
+	// Did we find a better partition?
+	if (partition.use_5_weight)
+	{
+		int partition_lo = state.sorted_block[partition.lo_index];
+		int partition_hi = state.sorted_block[partition.hi_index];
+		state.encode_0 = uint8_t(partition_lo);
+		state.encode_1 = uint8_t(partition_hi);
+
+		uint64_t block = 0;
+		assert(partition_hi >= partition_lo);
+		int partition_range = partition_hi - partition_lo;
+		int partition_divider = divider_lut.lut5(partition_range);
 
-		for (int lo = 0; lo < 15; lo++)
+		for (int i = 0; i < 16; i++)
 		{
-			for (int hi = lo; hi < 15; hi++)
+			int code;
+			if (input_r[i] < partition_lo)
 			{
-				int partition_lo = sorted_block[lo];
-				int partition_hi = sorted_block[hi];
-				assert(partition_hi >= partition_lo);
-				int partition_range = partition_hi - partition_lo;
-				int partition_divider = divider_lut.lut5(partition_range);
-
-				int error = 0;
-
-				// Consider that we can quantize to 0.0 as well.
-				for (int i = 0; i < lo; i++)
-				{
-					int diff = std::min(sorted_block[i] - 0, partition_lo - sorted_block[i]);
-					error += diff * diff;
-				}
-
-				for (int i = lo; i <= hi; i++)
-				{
-					int code = ((sorted_block[i] - partition_lo) * partition_divider + 0x80000) >> 20;
-					assert(code <= 7);
-					int interpolated_value = partition_lo + ((partition_range * code * div_5 + 0x80000) >> 20);
-					int diff = interpolated_value - sorted_block[i];
-					error += diff * diff;
-				}
-
-				// Consider that we can quantize to 1.0 as well.
-				for (int i = hi + 1; i <= 15; i++)
-				{
-					int diff = std::min(255 - sorted_block[i], sorted_block[i] - partition_hi);
-					error += diff * diff;
-				}
-
-				if (error < best_error)
-				{
-					lo_index = lo;
-					hi_index = hi;
-					best_error = error;
-					use_5_weight = true;
-				}
+				if ((input_r[i] - 0) < (partition_lo - input_r[i]))
+					code = 6;
+				else
+					code = 0;
+			}
+			else if (input_r[i] > partition_hi)
+			{
+				if ((255 - input_r[i]) < (input_r[i] - partition_hi))
+					code = 7;
+				else
+					code = 1;
 			}
+			else
+			{
+				code = ((input_r[i] - partition_lo) * partition_divider + 0x80000) >> 20;
+				assert(code <= 5);
+				if (code == 5)
+					code = 1;
+				else if (code != 0)
+					code++;
+			}
+
+			block |= uint64_t(code) << (3 * i);
 		}
 
-		// Did we find a better partition?
-		if (use_5_weight)
+		state.block = block;
+	}
+
+	output_r[0] = state.encode_0;
+	output_r[1] = state.encode_1;
+	for (int i = 0; i < 6; i++)
+		output_r[2 + i] = uint8_t((state.block >> (8 * i)) & 0xff);
+}
+
+void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r)
+{
+	RGTCBlockState state;
+	begin_rgtc_red_block(state, input_r);
+
+	RGTCPartition partition;
+	if (state.needs_partition_search)
+		partition = search_rgtc_partition(state);
+
+	end_rgtc_red_block(output_r, input_r, state, partition);
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RGTC_SIMD_SSE2
+#elif defined(__ARM_NEON)
+#define RGTC_SIMD_NEON
+#endif
+
+#if defined(RGTC_SIMD_SSE2) || defined(RGTC_SIMD_NEON)
+// Minimal 4 x int32 vector. Lanes are independent blocks, so every block
+// walks the exact same (lo, hi) search as the scalar path and results are bit-exact.
+#ifdef RGTC_SIMD_SSE2
+using I32x4 = __m128i;
+static inline I32x4 splat(int v) { return _mm_set1_epi32(v); }
+static inline I32x4 load(const int *v) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(v)); }
+static inline void store(int *v, I32x4 a) { _mm_storeu_si128(reinterpret_cast<__m128i *>(v), a); }
+static inline I32x4 add(I32x4 a, I32x4 b) { return _mm_add_epi32(a, b); }
+static inline I32x4 sub(I32x4 a, I32x4 b) { return _mm_sub_epi32(a, b); }
+template <int N> static inline I32x4 shift_right(I32x4 a) { return _mm_srai_epi32(a, N); }
+static inline I32x4 less_than(I32x4 a, I32x4 b) { return _mm_cmplt_epi32(a, b); }
+static inline I32x4 select(I32x4 mask, I32x4 a, I32x4 b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+static inline I32x4 min(I32x4 a, I32x4 b) { return select(less_than(a, b), a, b); }
+
+// SSE2 has no 32-bit multiply, but every product here has small operands, so pmaddwd does the job.
+// Both operands must be in [0, 2^15).
+static inline I32x4 mul_small(I32x4 a, I32x4 b) { return _mm_madd_epi16(a, b); }
+
+// a must be in [-2^15, 2^15). The sign extended upper half contributes 1 for negative values.
+static inline I32x4 square(I32x4 a) { return _mm_add_epi32(_mm_madd_epi16(a, a), _mm_srai_epi32(a, 31)); }
+
+// For a in [0, 255] and a multiplier in [0, 2^23).
+struct Multiplier
+{
+	I32x4 hi, lo;
+};
+
+static inline Multiplier make_multiplier(I32x4 b)
+{
+	return { _mm_srli_epi32(b, 8), _mm_and_si128(b, _mm_set1_epi32(0xff)) };
+}
+
+static inline I32x4 mul(I32x4 a, const Multiplier &b)
+{
+	return add(_mm_slli_epi32(_mm_madd_epi16(a, b.hi), 8), _mm_madd_epi16(a, b.lo));
+}
+#else
+using I32x4 = int32x4_t;
+static inline I32x4 splat(int v) { return vdupq_n_s32(v); }
+static inline I32x4 load(const int *v) { return vld1q_s32(v); }
+static inline void store(int *v, I32x4 a) { vst1q_s32(v, a); }
+static inline I32x4 add(I32x4 a, I32x4 b) { return vaddq_s32(a, b); }
+static inline I32x4 sub(I32x4 a, I32x4 b) { return vsubq_s32(a, b); }
+template <int N> static inline I32x4 shift_right(I32x4 a) { return vshrq_n_s32(a, N); }
+static inline I32x4 less_than(I32x4 a, I32x4 b) { return vreinterpretq_s32_u32(vcltq_s32(a, b)); }
+static inline I32x4 select(I32x4 mask, I32x4 a, I32x4 b) { return vbslq_s32(vreinterpretq_u32_s32(mask), a, b); }
+static inline I32x4 min(I32x4 a, I32x4 b) { return vminq_s32(a, b); }
+static inline I32x4 mul_small(I32x4 a, I32x4 b) { return vmulq_s32(a, b); }
+static inline I32x4 square(I32x4 a) { return vmulq_s32(a, a); }
+using Multiplier = I32x4;
+static inline Multiplier make_multiplier(I32x4 b) { return b; }
+static inline I32x4 mul(I32x4 a, const Multiplier &b) { return vmulq_s32(a, b); }
+#endif
+
+static void search_rgtc_partition_x4(RGTCPartition *partitions, const RGTCBlockState *const *states)
+{
+	I32x4 sorted[16];
+	for (int i = 0; i < 16; i++)
+	{
+		int lanes[4];
+		for (int lane = 0; lane < 4; lane++)
+			lanes[lane] = states[lane]->sorted_block[i];
+		sorted[i] = load(lanes);
+	}
+
+	int best_error_lanes[4];
+	for (int lane = 0; lane < 4; lane++)
+		best_error_lanes[lane] = states[lane]->best_error;
+
+	I32x4 best_error = load(best_error_lanes);
+	I32x4 best_lo = splat(0);
+	I32x4 best_hi = splat(15);
+	I32x4 use_5_weight = splat(0);
+
+	const I32x4 rounding = splat(0x80000);
+	const I32x4 max_value = splat(255);
+
+	for (int lo = 0; lo < 15; lo++)
+	{
+		I32x4 partition_lo = sorted[lo];
+
+		// The lower tail does not depend on hi.
+		I32x4 lo_error = splat(0);
+		for (int i = 0; i < lo; i++)
+			lo_error = add(lo_error, square(min(sorted[i], sub(partition_lo, sorted[i]))));
+
+		for (int hi = lo; hi < 15; hi++)
 		{
-			int partition_lo = sorted_block[lo_index];
-			int partition_hi = sorted_block[hi_index];
-			encode_0 = uint8_t(partition_lo);
-			encode_1 = uint8_t(partition_hi);
+			I32x4 partition_hi = sorted[hi];
+			I32x4 partition_range = sub(partition_hi, partition_lo);
 
-			block = 0;
-			assert(partition_hi >= partition_lo);
-			int partition_range = partition_hi - partition_lo;
-			int partition_divider = divider_lut.lut5(partition_range);
+			int divider_lanes[4];
+			store(divider_lanes, partition_range);
+			for (auto &d : divider_lanes)
+				d = divider_lut.lut5(d);
+			Multiplier partition_divider = make_multiplier(load(divider_lanes));
+
+			I32x4 error = lo_error;
 
-			for (int i = 0; i < 16; i++)
+			for (int i = lo; i <= hi; i++)
 			{
-				int code;
-				if (input_r[i] < partition_lo)
-				{
-					if ((input_r[i] - 0) < (partition_lo - input_r[i]))
-						code = 6;
-					else
-						code = 0;
-				}
-				else if (input_r[i] > partition_hi)
-				{
-					if ((255 - input_r[i]) < (input_r[i] - partition_hi))
-						code = 7;
-					else
-						code = 1;
-				}
-				else
-				{
-					code = ((input_r[i] - partition_lo) * partition_divider + 0x80000) >> 20;
-					assert(code <= 5);
-					if (code == 5)
-						code = 1;
-					else if (code != 0)
-						code++;
-				}
-
-				block |= uint64_t(code) << (3 * i);
+				I32x4 offset = sub(sorted[i], partition_lo);
+				I32x4 code = shift_right<20>(add(mul(offset, partition_divider), rounding));
+				// (range * code * div_5 + 0x80000) >> 20 is exactly ((range * code + 2) * 13108) >> 16
+				// for every range * code <= 255 * 5, which keeps all products within 16-bit operands.
+				I32x4 scaled = add(mul_small(partition_range, code), splat(2));
+				I32x4 interpolated_offset = shift_right<16>(mul_small(scaled, splat(13108)));
+				error = add(error, square(sub(interpolated_offset, offset)));
 			}
+
+			for (int i = hi + 1; i <= 15; i++)
+				error = add(error, square(min(sub(max_value, sorted[i]), sub(sorted[i], partition_hi))));
+
+			I32x4 better = less_than(error, best_error);
+			best_error = select(better, error, best_error);
+			best_lo = select(better, splat(lo), best_lo);
+			best_hi = select(better, splat(hi), best_hi);
+			use_5_weight = select(better, splat(-1), use_5_weight);
 		}
 	}
 
-	output_r[0] = encode_0;
-	output_r[1] = encode_1;
-	for (int i = 0; i < 6; i++)
-		output_r[2 + i] = uint8_t((block >> (8 * i)) & 0xff);
+	int lo_lanes[4], hi_lanes[4], use_5_lanes[4];
+	store(lo_lanes, best_lo);
+	store(hi_lanes, best_hi);
+	store(use_5_lanes, use_5_weight);
+
+	for (int lane = 0; lane < 4; lane++)
+	{
+		partitions[lane].lo_index = lo_lanes[lane];
+		partitions[lane].hi_index = hi_lanes[lane];
+		partitions[lane].use_5_weight = use_5_lanes[lane] != 0;
+	}
+}
+#endif
+
+void compress_rgtc_red_blocks(uint8_t *output_r, size_t output_stride, const uint8_t *input_r, unsigned count)
+{
+	constexpr unsigned BatchSize = 32;
+	RGTCBlockState states[BatchSize];
+	RGTCPartition partitions[BatchSize];
+
+	for (unsigned base = 0; base < count; base += BatchSize)
+	{
+		unsigned batch_count = std::min(BatchSize, count - base);
+		unsigned search_indices[BatchSize];
+		unsigned search_count = 0;
+
+		for (unsigned i = 0; i < batch_count; i++)
+		{
+			begin_rgtc_red_block(states[i], input_r + (base + i) * 16);
+			partitions[i] = {};
+			if (states[i].needs_partition_search)
+				search_indices[search_count++] = i;
+		}
+
+		unsigned searched = 0;
+#if defined(RGTC_SIMD_SSE2) || defined(RGTC_SIMD_NEON)
+		for (; searched + 4 <= search_count; searched += 4)
+		{
+			const RGTCBlockState *lane_states[4];
+			RGTCPartition lane_partitions[4];
+			for (unsigned lane = 0; lane < 4; lane++)
+				lane_states[lane] = &states[search_indices[searched + lane]];
+			search_rgtc_partition_x4(lane_partitions, lane_states);
+			for (unsigned lane = 0; lane < 4; lane++)
+				partitions[search_indices[searched + lane]] = lane_partitions[lane];
+		}
+#endif
+
+		for (; searched < search_count; searched++)
+			partitions[search_indices[searched]] = search_rgtc_partition(states[search_indices[searched]]);
+
+		for (unsigned i = 0; i < batch_count; i++)
+		{
+			end_rgtc_red_block(output_r + (base + i) * output_stride, input_r + (base + i) * 16,
+			                   states[i], partitions[i]);
+		}
+	}
 }
 
 void compress_rgtc_red_green_block(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g)
@@ -345,4 +507,10 @@ void compress_rgtc_red_green_block(uint8_t *output_rg, const uint8_t *input_r, c
 	compress_rgtc_red_block(output_rg, input_r);
 	compress_rgtc_red_block(output_rg + 8, input_g);
 }
+
+void compress_rgtc_red_green_blocks(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g, unsigned count)
+{
+	compress_rgtc_red_blocks(output_rg, 16, input_r, count);
+	compress_rgtc_red_blocks(output_rg + 8, 16, input_g, count);
+}
 }
\ No newline at end of file
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 namespace Granite
@@ -29,4 +30,9 @@ namespace Granite
 void compress_rgtc_red_block(uint8_t *output_r, const uint8_t *input_r);
 void compress_rgtc_red_green_block(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g);
 void decompress_rgtc_red_block(uint8_t *output_r, const uint8_t *block);
+
+// Batched variants. Inputs are count 4x4 blocks stored back to back.
+// Blocks are searched several at a time with SIMD, output is bit-exact with the single block variants.
+void compress_rgtc_red_blocks(uint8_t *output_r, size_t output_stride, const uint8_t *input_r, unsigned count);
+void compress_rgtc_red_green_blocks(uint8_t *output_rg, const uint8_t *input_r, const uint8_t *input_g, unsigned count);
 }
\ No newline at end of file
@@ -37,6 +37,7 @@
 #endif
 
 #include "rgtc_compressor.hpp"
+#include "bc_compressor.hpp"
 #define RGTC_DEBUG
 
 using namespace muglm;
@@ -108,6 +109,15 @@ VkFormat string_to_format(const std::string &s)
 	}
 }
 
+bool texture_compression_has_ispc()
+{
+#ifdef HAVE_ISPC
+	return true;
+#else
+	return false;
+#endif
+}
+
 #ifdef HAVE_ISPC
 static unsigned output_format_to_input_stride(VkFormat format)
 {
@@ -155,6 +165,7 @@ struct CompressorState : std::enable_shared_from_this<CompressorState>
 
 	bool use_astc_encoder = false;
 	bool use_hdr = false;
+	bool use_native_bc_encoder = false;
 
 	unsigned block_size_x = 1;
 	unsigned block_size_y = 1;
@@ -164,6 +175,7 @@ struct CompressorState : std::enable_shared_from_this<CompressorState>
 	void enqueue_compression_block_ispc(TaskGroupHandle &group, unsigned layer, unsigned level);
 	void enqueue_compression_block_astc(TaskGroupHandle &group, unsigned layer, unsigned level, TextureMode mode);
 	void enqueue_compression_block_rgtc(TaskGroupHandle &group, unsigned layer, unsigned level);
+	void enqueue_compression_block_bc(TaskGroupHandle &group, unsigned layer, unsigned level);
 	void enqueue_compression_copy_8bit(TaskGroupHandle &group, unsigned layer, unsigned level);
 	void enqueue_compression_copy_16bit(TaskGroupHandle &group, unsigned layer, unsigned level);
 
@@ -186,12 +198,10 @@ void CompressorState::setup()
 		       layout.get_format() == VK_FORMAT_R8G8B8A8_UNORM;
 	};
 
-#ifdef HAVE_ISPC
 	const auto is_8bit_rgba = [&]() -> bool {
 		return layout.get_format() == VK_FORMAT_R8G8B8A8_SRGB ||
 		       layout.get_format() == VK_FORMAT_R8G8B8A8_UNORM;
 	};
-#endif
 
 	const auto is_unorm = [&]() -> bool {
 		return layout.get_format() == VK_FORMAT_R8G8B8A8_UNORM;
@@ -308,6 +318,7 @@ void CompressorState::setup()
 			return;
 		}
 		break;
+#endif
 
 	case VK_FORMAT_BC7_SRGB_BLOCK:
 	case VK_FORMAT_BC7_UNORM_BLOCK:
@@ -320,47 +331,56 @@ void CompressorState::setup()
 			return;
 		}
 
-		switch (args.quality)
+		if (args.quality < 1 || args.quality > 5)
 		{
-		case 1:
-			if (alpha)
-				GetProfile_alpha_ultrafast(&bc7);
-			else
-				GetProfile_ultrafast(&bc7);
-			break;
+			LOGE("Unknown quality.\n");
+			return;
+		}
 
-		case 2:
-			if (alpha)
-				GetProfile_alpha_veryfast(&bc7);
-			else
-				GetProfile_veryfast(&bc7);
-			break;
+#ifdef HAVE_ISPC
+		if (!args.native_bc_encoder)
+		{
+			switch (args.quality)
+			{
+			case 1:
+				if (alpha)
+					GetProfile_alpha_ultrafast(&bc7);
+				else
+					GetProfile_ultrafast(&bc7);
+				break;
 
-		case 3:
-			if (alpha)
-				GetProfile_alpha_fast(&bc7);
-			else
-				GetProfile_fast(&bc7);
-			break;
+			case 2:
+				if (alpha)
+					GetProfile_alpha_veryfast(&bc7);
+				else
+					GetProfile_veryfast(&bc7);
+				break;
 
-		case 4:
-			if (alpha)
-				GetProfile_alpha_basic(&bc7);
-			else
-				GetProfile_basic(&bc7);
-			break;
+			case 3:
+				if (alpha)
+					GetProfile_alpha_fast(&bc7);
+				else
+					GetProfile_fast(&bc7);
+				break;
 
-		case 5:
-			if (alpha)
-				GetProfile_alpha_slow(&bc7);
-			else
-				GetProfile_slow(&bc7);
-			break;
+			case 4:
+				if (alpha)
+					GetProfile_alpha_basic(&bc7);
+				else
+					GetProfile_basic(&bc7);
+				break;
 
-		default:
-			LOGE("Unknown quality.\n");
-			return;
+			default:
+				if (alpha)
+					GetProfile_alpha_slow(&bc7);
+				else
+					GetProfile_slow(&bc7);
+				break;
+			}
+			break;
 		}
+#endif
+		use_native_bc_encoder = true;
 		break;
 
 	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
@@ -376,8 +396,19 @@ void CompressorState::setup()
 			LOGE("Input format to bc1 or bc3 must be RGBA8.\n");
 			return;
 		}
-		break;
+
+		if (args.quality < 1 || args.quality > 5)
+		{
+			LOGE("Unknown quality.\n");
+			return;
+		}
+
+#ifdef HAVE_ISPC
+		if (!args.native_bc_encoder)
+			break;
 #endif
+		use_native_bc_encoder = true;
+		break;
 
 	case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
 	case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
@@ -500,104 +531,225 @@ void CompressorState::enqueue_compression_copy_8bit(TaskGroupHandle &group, unsi
 	});
 }
 
+#ifdef RGTC_DEBUG
+static double rgtc_block_error(const uint8_t *encoded, const uint8_t *padded)
+{
+	uint8_t decoded[16];
+	decompress_rgtc_red_block(decoded, encoded);
+	double error = 0.0;
+	for (int i = 0; i < 16; i++)
+		error += double((decoded[i] - padded[i]) * (decoded[i] - padded[i]));
+	return error;
+}
+
+static void bc_block_error(double *error, VkFormat format, const uint8_t *encoded, const uint8_t *texels, bool opaque)
+{
+	uint8_t decoded[64];
+	switch (format)
+	{
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		decompress_bc3_block(decoded, encoded);
+		break;
+
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		decompress_bc7_block(decoded, encoded);
+		break;
+
+	default:
+		decompress_bc1_block(decoded, encoded);
+		break;
+	}
+
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < (opaque ? 3 : 4); c++)
+		{
+			double diff = double(decoded[4 * i + c]) - double(texels[4 * i + c]);
+			error[c] += diff * diff;
+		}
+	}
+}
+#endif
+
 void CompressorState::enqueue_compression_block_rgtc(TaskGroupHandle &group, unsigned layer, unsigned level)
 {
 	int width = input->get_layout().get_width(level);
 	int height = input->get_layout().get_height(level);
 	int blocks_x = (width + block_size_x - 1) / block_size_x;
+	int blocks_y = (height + block_size_y - 1) / block_size_y;
 
-	for (int y = 0; y < height; y += block_size_y)
-	{
-		for (int x = 0; x < width; x += block_size_x)
-		{
-			group->enqueue_task([=, format = args.format]() {
-				auto &layout = input->get_layout();
-				uint8_t padded_red[4 * 4];
-				uint8_t padded_green[4 * 4];
-				auto *src = static_cast<const uint8_t *>(layout.data(layer, level));
-				unsigned pixel_stride = layout.get_block_stride();
-
-				const auto get_block_data = [&](int block_size) -> uint8_t * {
-					auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
-					dst += (x / block_size_x) * block_size;
-					dst += (y / block_size_y) * blocks_x * block_size;
-					return dst;
-				};
+	// A task per block drowns the encoder in scheduling overhead on large textures,
+	// so each task encodes a band of block rows.
+	constexpr int target_blocks_per_task = 4096;
+	int rows_per_task = std::max(1, target_blocks_per_task / blocks_x);
 
-				const auto get_encode_data = [&](int block_size) -> uint8_t * {
-					return get_block_data(block_size);
-				};
+	for (int first_row = 0; first_row < blocks_y; first_row += rows_per_task)
+	{
+		int last_row = std::min(first_row + rows_per_task, blocks_y);
+
+		group->enqueue_task([=, format = args.format]() {
+			auto &layout = input->get_layout();
+			auto *src = static_cast<const uint8_t *>(layout.data(layer, level));
+			auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
+			unsigned pixel_stride = layout.get_block_stride();
+			unsigned green_offset = pixel_stride > 1 ? 1 : 0;
+			int padded_width = blocks_x * 4;
+			int output_block_size = format == VK_FORMAT_BC5_UNORM_BLOCK ? 16 : 8;
+
+			std::vector<uint8_t> padded_red(blocks_x * 16);
+			std::vector<uint8_t> padded_green(blocks_x * 16);
+			std::vector<uint8_t> row_red(padded_width);
+			std::vector<uint8_t> row_green(padded_width);
 
-				const auto get_component = [&](int sx, int sy, int c) -> uint8_t {
-					sx = std::min(sx, width - 1);
-					sy = std::min(sy, height - 1);
-					return src[pixel_stride * (sy * width + sx) + c];
-				};
+#ifdef RGTC_DEBUG
+			double error_red = 0.0;
+			double error_green = 0.0;
+#endif
 
+			for (int block_y = first_row; block_y < last_row; block_y++)
+			{
+				// Deinterleave one texel row at a time with edge clamping, then transpose into 4x4 blocks.
 				for (int sy = 0; sy < 4; sy++)
 				{
-					for (int sx = 0; sx < 4; sx++)
+					int y = std::min(block_y * 4 + sy, height - 1);
+					auto *src_row = src + size_t(y) * width * pixel_stride;
+
+					for (int x = 0; x < width; x++)
+					{
+						row_red[x] = src_row[x * pixel_stride];
+						row_green[x] = src_row[x * pixel_stride + green_offset];
+					}
+
+					for (int x = width; x < padded_width; x++)
 					{
-						padded_red[sy * 4 + sx] = get_component(x + sx, y + sy, 0);
-						if (pixel_stride > 1)
-							padded_green[sy * 4 + sx] = get_component(x + sx, y + sy, 1);
+						row_red[x] = row_red[width - 1];
+						row_green[x] = row_green[width - 1];
+					}
+
+					for (int block_x = 0; block_x < blocks_x; block_x++)
+					{
+						memcpy(&padded_red[block_x * 16 + sy * 4], &row_red[block_x * 4], 4);
+						memcpy(&padded_green[block_x * 16 + sy * 4], &row_green[block_x * 4], 4);
 					}
 				}
 
+				auto *encode_data = dst + size_t(block_y) * blocks_x * output_block_size;
+
 				switch (format)
 				{
 				case VK_FORMAT_BC4_UNORM_BLOCK:
-				{
-					compress_rgtc_red_block(get_encode_data(8), padded_red);
-
+					compress_rgtc_red_blocks(encode_data, 8, padded_red.data(), blocks_x);
 #ifdef RGTC_DEBUG
 					if (level == 0 && layer == 0)
-					{
-						uint8_t decoded_red[16];
-						decompress_rgtc_red_block(decoded_red, get_encode_data(8));
-						double error = 0.0;
-						for (int i = 0; i < 16; i++)
-							error += double((decoded_red[i] - padded_red[i]) * (decoded_red[i] - padded_red[i])) / (width * height);
-
-						std::lock_guard<std::mutex> l{lock};
-						total_error[0] += error;
-					}
+						for (int block_x = 0; block_x < blocks_x; block_x++)
+							error_red += rgtc_block_error(encode_data + block_x * 8, &padded_red[block_x * 16]);
 #endif
 					break;
-				}
 
 				case VK_FORMAT_BC5_UNORM_BLOCK:
-				{
-					compress_rgtc_red_green_block(get_encode_data(16), padded_red, padded_green);
-
+					compress_rgtc_red_green_blocks(encode_data, padded_red.data(), padded_green.data(), blocks_x);
 #ifdef RGTC_DEBUG
 					if (level == 0 && layer == 0)
 					{
-						uint8_t decoded_red[16];
-						uint8_t decoded_green[16];
-						decompress_rgtc_red_block(decoded_red, get_encode_data(16));
-						decompress_rgtc_red_block(decoded_green, get_encode_data(16) + 8);
-
-						double error_red = 0.0;
-						double error_green = 0.0;
-						for (int i = 0; i < 16; i++)
-							error_red += double((decoded_red[i] - padded_red[i]) * (decoded_red[i] - padded_red[i])) / (width * height);
-						for (int i = 0; i < 16; i++)
-							error_green += double((decoded_green[i] - padded_green[i]) * (decoded_green[i] - padded_green[i])) / (width * height);
-
-						std::lock_guard<std::mutex> l{lock};
-						total_error[0] += error_red;
-						total_error[1] += error_green;
+						for (int block_x = 0; block_x < blocks_x; block_x++)
+						{
+							error_red += rgtc_block_error(encode_data + block_x * 16, &padded_red[block_x * 16]);
+							error_green += rgtc_block_error(encode_data + block_x * 16 + 8, &padded_green[block_x * 16]);
+						}
 					}
 #endif
 					break;
-				}
 
 				default:
 					break;
 				}
-			});
-		}
+			}
+
+#ifdef RGTC_DEBUG
+			std::lock_guard<std::mutex> l{lock};
+			total_error[0] += error_red / (width * height);
+			total_error[1] += error_green / (width * height);
+#endif
+		});
+	}
+}
+
+void CompressorState::enqueue_compression_block_bc(TaskGroupHandle &group, unsigned layer, unsigned level)
+{
+	int width = input->get_layout().get_width(level);
+	int height = input->get_layout().get_height(level);
+	int blocks_x = (width + block_size_x - 1) / block_size_x;
+	int blocks_y = (height + block_size_y - 1) / block_size_y;
+
+	// Same banding as RGTC, but BC7 blocks are far more expensive, so bands are smaller.
+	bool is_bc7 = args.format == VK_FORMAT_BC7_UNORM_BLOCK || args.format == VK_FORMAT_BC7_SRGB_BLOCK;
+	int target_blocks_per_task = is_bc7 ? 512 : 2048;
+	int rows_per_task = std::max(1, target_blocks_per_task / blocks_x);
+
+	bool punchthrough_alpha = (args.format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK ||
+	                           args.format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK) &&
+	                          (args.mode == TextureMode::sRGBA || args.mode == TextureMode::RGBA);
+
+	for (int first_row = 0; first_row < blocks_y; first_row += rows_per_task)
+	{
+		int last_row = std::min(first_row + rows_per_task, blocks_y);
+
+		group->enqueue_task([=, format = args.format, quality = args.quality]() {
+			auto &layout = input->get_layout();
+			auto *src = static_cast<const u8vec4 *>(layout.data(layer, level));
+			auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
+			int output_block_size = format == VK_FORMAT_BC1_RGB_UNORM_BLOCK ||
+			                        format == VK_FORMAT_BC1_RGB_SRGB_BLOCK ||
+			                        format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK ||
+			                        format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK ? 8 : 16;
+
+			std::vector<u8vec4> padded(blocks_x * 16);
+
+#ifdef RGTC_DEBUG
+			double error[4] = {};
+#endif
+
+			for (int block_y = first_row; block_y < last_row; block_y++)
+			{
+				// Gather a row of 4x4 blocks with edge clamping.
+				for (int sy = 0; sy < 4; sy++)
+				{
+					int y = std::min(block_y * 4 + sy, height - 1);
+					auto *src_row = src + size_t(y) * width;
+					for (int block_x = 0; block_x < blocks_x; block_x++)
+						for (int sx = 0; sx < 4; sx++)
+							padded[block_x * 16 + sy * 4 + sx] = src_row[std::min(block_x * 4 + sx, width - 1)];
+				}
+
+				auto *encode_data = dst + size_t(block_y) * blocks_x * output_block_size;
+
+				for (int block_x = 0; block_x < blocks_x; block_x++)
+				{
+					auto *block = encode_data + block_x * output_block_size;
+					auto *texels = padded[block_x * 16].data;
+
+					if (output_block_size == 8)
+						compress_bc1_block(block, texels, quality, punchthrough_alpha);
+					else if (format == VK_FORMAT_BC3_UNORM_BLOCK || format == VK_FORMAT_BC3_SRGB_BLOCK)
+						compress_bc3_block(block, texels, quality);
+					else
+						compress_bc7_block(block, texels, quality);
+
+#ifdef RGTC_DEBUG
+					if (level == 0 && layer == 0)
+						bc_block_error(error, format, block, texels, output_block_size == 8 && !punchthrough_alpha);
+#endif
+				}
+			}
+
+#ifdef RGTC_DEBUG
+			std::lock_guard<std::mutex> l{lock};
+			for (int c = 0; c < 4; c++)
+				total_error[c] += error[c] / (width * height);
+#endif
+		});
 	}
 }
 
@@ -869,6 +1021,11 @@ void CompressorState::enqueue_compression(ThreadGroup &group)
 				break;
 
 			case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+#ifdef HAVE_ISPC
+				enqueue_compression_block_ispc(compression_task, layer, level);
+#endif
+				break;
+
 			case VK_FORMAT_BC7_SRGB_BLOCK:
 			case VK_FORMAT_BC7_UNORM_BLOCK:
 			case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
@@ -877,8 +1034,11 @@ void CompressorState::enqueue_compression(ThreadGroup &group)
 			case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
 			case VK_FORMAT_BC3_SRGB_BLOCK:
 			case VK_FORMAT_BC3_UNORM_BLOCK:
+				if (use_native_bc_encoder)
+					enqueue_compression_block_bc(compression_task, layer, level);
 #ifdef HAVE_ISPC
-				enqueue_compression_block_ispc(compression_task, layer, level);
+				else
+					enqueue_compression_block_ispc(compression_task, layer, level);
 #endif
 				break;
 
@@ -936,6 +1096,18 @@ void CompressorState::enqueue_compression(ThreadGroup &group)
 			LOGI("Red PSNR: %.f dB\n", 10.0 * log10(255.0 * 255.0 / state->total_error[0]));
 		if (state->total_error[1] != 0.0)
 			LOGI("Green PSNR: %.f dB\n", 10.0 * log10(255.0 * 255.0 / state->total_error[1]));
+		if (state->total_error[2] != 0.0)
+			LOGI("Blue PSNR: %.f dB\n", 10.0 * log10(255.0 * 255.0 / state->total_error[2]));
+		if (state->total_error[3] != 0.0)
+			LOGI("Alpha PSNR: %.f dB\n", 10.0 * log10(255.0 * 255.0 / state->total_error[3]));
+
+		if (state->args.supercompress)
+		{
+			if (state->output->write_supercompressed(*GRANITE_FILESYSTEM(), state->args.output))
+				LOGI("Wrote supercompressed texture to %s.\n", state->args.output.c_str());
+			else
+				LOGE("Failed to write supercompressed texture to %s.\n", state->args.output.c_str());
+		}
 
 		LOGI("Unmapping %u bytes for texture writing.\n", unsigned(state->output->get_required_size()));
 		LOGI("Unmapping %u bytes for texture reading.\n", unsigned(state->input->get_required_size()));
@@ -993,7 +1165,12 @@ bool compress_texture(ThreadGroup &group, const CompressorArguments &args,
 			return;
 		}
 
-		if (!output->output->map_write(*GRANITE_FILESYSTEM(), output->args.output))
+		// Supercompressed output is encoded in one go once compression completes.
+		bool mapped = output->args.supercompress ?
+		              output->output->map_write_scratch() :
+		              output->output->map_write(*GRANITE_FILESYSTEM(), output->args.output);
+
+		if (!mapped)
 		{
 			LOGE("Failed to map output texture for writing.\n");
 			if (output->signal)
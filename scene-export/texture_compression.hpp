@@ -55,9 +55,15 @@ struct CompressorArguments
 		VK_COMPONENT_SWIZZLE_A,
 	};
 	bool deferred_mipgen = false;
+	// Writes a GTX v2 file with LZ supercompression applied per subresource.
+	bool supercompress = false;
+	// Use the built-in BC1/BC3/BC7 encoder even when ISPC texture compression is available.
+	bool native_bc_encoder = false;
 };
 
 VkFormat string_to_format(const std::string &s);
+// True if BC6H, and by default BC1/BC3/BC7, are encoded with ISPC.
+bool texture_compression_has_ispc();
 bool compress_texture(ThreadGroup &group, const CompressorArguments &args,
                       const std::shared_ptr<Vulkan::MemoryMappedTexture> &input,
                       TaskGroupHandle &dep, TaskSignal *signal);
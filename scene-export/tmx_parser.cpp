@@ -28,6 +28,7 @@
 #include "texture_files.hpp"
 #include "texture_utils.hpp"
 #include <stdexcept>
+#include <string.h>
 
 using namespace rapidjson;
 using namespace Granite;
@@ -309,9 +310,17 @@ void TMXParser::copy_tile(const Vulkan::TextureFormatLayout &dst_layout, unsigne
 	if (base_y + tile_size.y > src_layout.get_height())
 		throw std::runtime_error("Accessing texture out of bounds.");
 
+	// Rows of a tile are contiguous in both images.
 	for (unsigned y = 0; y < tile_size.y; y++)
-		for (unsigned x = 0; x < tile_size.x; x++)
-			*dst_layout.data_2d<u8vec4>(x, y, layer) = *src_layout.data_2d<u8vec4>(base_x + x, base_y + y);
+	{
+		memcpy(dst_layout.data_2d<u8vec4>(0, y, layer), src_layout.data_2d<u8vec4>(base_x, base_y + y),
+		       tile_size.x * sizeof(u8vec4));
+	}
+}
+
+bool TMXParser::save_tilemap_image(Granite::Filesystem &fs, const std::string &path)
+{
+	return tilemap.copy_to_path(fs, path);
 }
 
 uvec2 TMXParser::get_tile_size() const
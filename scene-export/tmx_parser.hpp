@@ -116,6 +116,8 @@ public:
 	const std::vector<Layer> &get_layers() const;
 	const std::vector<Terrain> &get_terrains() const;
 	const Vulkan::TextureFormatLayout &get_tilemap_image_layout() const;
+	// Writes the tile array texture, one tile per layer, as a GTX file.
+	bool save_tilemap_image(Granite::Filesystem &fs, const std::string &path);
 
 	muglm::uvec2 get_tile_size() const;
 	muglm::uvec2 get_map_tiles() const;
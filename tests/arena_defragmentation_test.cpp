@@ -0,0 +1,300 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "arena_allocator.hpp"
+#include "object_pool.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <vector>
+
+using namespace Util;
+
+struct MockArena;
+struct MockAllocation
+{
+	uint32_t offset = 0;
+	uint32_t mask = 0;
+	uint32_t backing_index = UINT32_MAX;
+	IntrusiveList<LegionHeap<MockAllocation>>::Iterator heap = {};
+};
+
+// Stands in for device memory. Only counts live backing heaps.
+struct MockArena : ArenaAllocator<MockArena, MockAllocation>
+{
+	uint32_t live_backing_heaps = 0;
+	uint32_t total_backing_heaps = 0;
+
+	bool allocate_backing_heap(MockAllocation *allocation)
+	{
+		allocation->backing_index = total_backing_heaps++;
+		live_backing_heaps++;
+		return true;
+	}
+
+	void free_backing_heap(MockAllocation *allocation)
+	{
+		assert(live_backing_heaps != 0);
+		allocation->backing_index = UINT32_MAX;
+		live_backing_heaps--;
+	}
+
+	void prepare_allocation(MockAllocation *allocation, IntrusiveList<MiniHeap>::Iterator heap,
+	                        const SuballocationResult &suballoc)
+	{
+		allocation->offset = suballoc.offset;
+		allocation->mask = suballoc.mask;
+		allocation->backing_index = heap->allocation.backing_index;
+		allocation->heap = heap;
+	}
+};
+
+static int test_planner_rejects_unplaceable_runs()
+{
+	std::vector<uint32_t> drain;
+
+	// Heap 0 has one run of 8 blocks in use. Heap 1 only has runs of 4 free blocks.
+	const uint32_t masks[] = { ~0xffu, 0x0f0f0f0fu };
+	ArenaDefragmentationOptions options;
+	options.max_used_sub_blocks = 8;
+	options.max_draining_heaps = 2;
+	plan_arena_defragmentation(masks, 2, options, drain);
+	if (!drain.empty())
+	{
+		LOGE("Check failed: drain.empty()\n");
+		return EXIT_FAILURE;
+	}
+
+	// With room for the run, the sparsest heap is drained and the target is left alone.
+	const uint32_t roomy_masks[] = { ~0xffu, 0x00ffff00u };
+	plan_arena_defragmentation(roomy_masks, 2, options, drain);
+	if (!(drain.size() == 1 && drain[0] == 0))
+	{
+		LOGE("Check failed: drain.size() == 1 && drain[0] == 0\n");
+		return EXIT_FAILURE;
+	}
+
+	// Too dense to be considered.
+	drain.clear();
+	options.max_used_sub_blocks = 7;
+	plan_arena_defragmentation(roomy_masks, 2, options, drain);
+	if (!drain.empty())
+	{
+		LOGE("Check failed: drain.empty()\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int test_arena_defragmentation()
+{
+	ObjectPool<LegionHeap<MockAllocation>> pool;
+	MockArena arena;
+	arena.set_object_pool(&pool);
+	arena.set_sub_block_size(1);
+
+	constexpr uint32_t AllocationSize = 4;
+	constexpr uint32_t NumHeaps = 8;
+	constexpr uint32_t AllocationsPerHeap = LegionAllocator::NumSubBlocks / AllocationSize;
+
+	std::vector<MockAllocation> allocations(NumHeaps * AllocationsPerHeap);
+	for (auto &alloc : allocations)
+		if (!arena.allocate(AllocationSize, &alloc))
+		{
+			LOGE("Check failed: arena.allocate(AllocationSize, &alloc)\n");
+			return EXIT_FAILURE;
+		}
+	if (arena.live_backing_heaps != NumHeaps)
+	{
+		LOGE("Check failed: arena.live_backing_heaps == NumHeaps\n");
+		return EXIT_FAILURE;
+	}
+
+	// Leave four heaps nearly empty and punch holes into the other four.
+	std::vector<MockAllocation> live;
+	for (uint32_t heap = 0; heap < NumHeaps; heap++)
+	{
+		for (uint32_t i = 0; i < AllocationsPerHeap; i++)
+		{
+			auto &alloc = allocations[heap * AllocationsPerHeap + i];
+			bool keep = heap < NumHeaps / 2 ? (i == 3) : ((i & 1) == 0);
+			if (keep)
+				live.push_back(alloc);
+			else
+				arena.free(alloc.heap, alloc.mask);
+		}
+	}
+
+	auto stats = arena.get_fragmentation_stats();
+	LOGI("Before: %u heaps, %llu used, %llu free, %u spans, fragmentation %.3f, occupancy %.3f.\n",
+	     stats.num_heaps, static_cast<unsigned long long>(stats.used_size),
+	     static_cast<unsigned long long>(stats.free_size),
+	     stats.num_free_spans, stats.get_fragmentation(), stats.get_occupancy());
+	if (stats.num_heaps != NumHeaps)
+	{
+		LOGE("Check failed: stats.num_heaps == NumHeaps\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.num_full_heaps != 0)
+	{
+		LOGE("Check failed: stats.num_full_heaps == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.used_size != live.size() * AllocationSize)
+	{
+		LOGE("Check failed: stats.used_size == live.size() * AllocationSize\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.get_fragmentation() <= 0.0f)
+	{
+		LOGE("Check failed: stats.get_fragmentation() > 0.0f\n");
+		return EXIT_FAILURE;
+	}
+	float occupancy_before = stats.get_occupancy();
+	float fragmentation_before = stats.get_fragmentation();
+
+	// The draining budget is respected.
+	ArenaDefragmentationOptions options;
+	options.max_used_sub_blocks = AllocationSize;
+	options.max_draining_heaps = 1;
+	if (arena.plan_defragmentation(options) != 1)
+	{
+		LOGE("Check failed: arena.plan_defragmentation(options) == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (arena.plan_defragmentation(options) != 0)
+	{
+		LOGE("Check failed: arena.plan_defragmentation(options) == 0\n");
+		return EXIT_FAILURE;
+	}
+
+	// Cancelling makes the heap usable again.
+	arena.cancel_defragmentation();
+	if (arena.get_fragmentation_stats().num_draining_heaps != 0)
+	{
+		LOGE("Check failed: arena.get_fragmentation_stats().num_draining_heaps == 0\n");
+		return EXIT_FAILURE;
+	}
+
+	// Allow the half-full heaps to be drained as well. Their holes are what fragments the arena,
+	// so they are drained into the contiguous free space of the sparse heaps which are kept.
+	options.max_used_sub_blocks = LegionAllocator::NumSubBlocks / 2;
+	options.max_draining_heaps = NumHeaps;
+	uint32_t num_draining = arena.plan_defragmentation(options);
+	uint32_t min_heaps = uint32_t((live.size() * AllocationSize + LegionAllocator::NumSubBlocks - 1) /
+	                              LegionAllocator::NumSubBlocks);
+	if (num_draining != NumHeaps - min_heaps)
+	{
+		LOGE("Check failed: num_draining == NumHeaps - min_heaps\n");
+		return EXIT_FAILURE;
+	}
+	if (arena.get_fragmentation_stats().num_draining_heaps != num_draining)
+	{
+		LOGE("Check failed: arena.get_fragmentation_stats().num_draining_heaps == num_draining\n");
+		return EXIT_FAILURE;
+	}
+
+	// Relocate like an owner would. No new backing heaps may be needed.
+	uint32_t backing_heaps_before = arena.total_backing_heaps;
+	uint32_t num_relocated = 0;
+	for (auto &alloc : live)
+	{
+		if (!MockArena::is_heap_draining(alloc.heap))
+			continue;
+
+		MockAllocation relocated;
+		if (!arena.allocate(AllocationSize, &relocated))
+		{
+			LOGE("Check failed: arena.allocate(AllocationSize, &relocated)\n");
+			return EXIT_FAILURE;
+		}
+		if (MockArena::is_heap_draining(relocated.heap))
+		{
+			LOGE("Check failed: !MockArena::is_heap_draining(relocated.heap)\n");
+			return EXIT_FAILURE;
+		}
+		arena.free(alloc.heap, alloc.mask);
+		alloc = relocated;
+		num_relocated++;
+	}
+
+	if (num_relocated == 0)
+	{
+		LOGE("Check failed: num_relocated != 0\n");
+		return EXIT_FAILURE;
+	}
+	if (arena.total_backing_heaps != backing_heaps_before)
+	{
+		LOGE("Check failed: arena.total_backing_heaps == backing_heaps_before\n");
+		return EXIT_FAILURE;
+	}
+	if (arena.live_backing_heaps != NumHeaps - num_draining)
+	{
+		LOGE("Check failed: arena.live_backing_heaps == NumHeaps - num_draining\n");
+		return EXIT_FAILURE;
+	}
+
+	stats = arena.get_fragmentation_stats();
+	LOGI("After: %u heaps, %llu used, %llu free, %u spans, fragmentation %.3f, occupancy %.3f.\n",
+	     stats.num_heaps, static_cast<unsigned long long>(stats.used_size),
+	     static_cast<unsigned long long>(stats.free_size),
+	     stats.num_free_spans, stats.get_fragmentation(), stats.get_occupancy());
+	if (stats.num_draining_heaps != 0)
+	{
+		LOGE("Check failed: stats.num_draining_heaps == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.used_size != live.size() * AllocationSize)
+	{
+		LOGE("Check failed: stats.used_size == live.size() * AllocationSize\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.get_occupancy() <= occupancy_before)
+	{
+		LOGE("Check failed: stats.get_occupancy() > occupancy_before\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.get_fragmentation() >= fragmentation_before)
+	{
+		LOGE("Check failed: stats.get_fragmentation() < fragmentation_before\n");
+		return EXIT_FAILURE;
+	}
+
+	for (auto &alloc : live)
+		arena.free(alloc.heap, alloc.mask);
+	if (arena.live_backing_heaps != 0)
+	{
+		LOGE("Check failed: arena.live_backing_heaps == 0\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	if (test_planner_rejects_unplaceable_runs() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_arena_defragmentation() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	LOGI("All tests passed.\n");
+}
@@ -1,6 +1,8 @@
 #include "asset_manager.hpp"
 #include "filesystem.hpp"
 #include "logging.hpp"
+#include <stdlib.h>
+#include <vector>
 
 using namespace Granite;
 
@@ -20,6 +22,7 @@ struct ActivationInterface final : AssetInstantiatorInterface
 	void release_asset(AssetID id) override
 	{
 		LOGI("Releasing ID: %u\n", id.id);
+		released.push_back(id);
 	}
 
 	void set_id_bounds(uint32_t bound_) override
@@ -33,13 +36,14 @@ struct ActivationInterface final : AssetInstantiatorInterface
 	}
 
 	uint32_t bound = 0;
+	std::vector<AssetID> released;
 };
 
 int main()
 {
 	Filesystem fs;
-	AssetManager manager;
 	ActivationInterface iface;
+	AssetManager manager;
 	fs.register_protocol("tmp", std::make_unique<ScratchFilesystem>());
 
 	{ auto a = fs.open_writeonly_mapping("tmp://a", 1); }
@@ -79,4 +83,36 @@ int main()
 	manager.set_asset_budget(10);
 	manager.iterate(nullptr);
 	LOGI("Cost: %u\n", unsigned(manager.get_current_total_consumed()));
+
+	// Unregistered assets are released and their IDs handed out again.
+	manager.set_asset_budget(25);
+	manager.set_asset_residency_priority(id_b, 2);
+	manager.iterate(nullptr);
+	iface.released.clear();
+	uint64_t consumed = manager.get_current_total_consumed();
+
+	manager.unregister_asset(id_b);
+	manager.iterate(nullptr);
+	if (iface.released.size() != 1 || iface.released.front() != id_b)
+	{
+		LOGE("Unregistered asset was not released.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (manager.get_current_total_consumed() != consumed - 2)
+	{
+		LOGE("Unregistered asset is still accounted for.\n");
+		return EXIT_FAILURE;
+	}
+
+	{ auto f = fs.open_writeonly_mapping("tmp://f", 32); }
+	uint32_t bound = iface.bound;
+	auto id_f = manager.register_asset(fs.open("tmp://f"), AssetClass::ImageZeroable);
+	if (id_f != id_b || iface.bound != bound)
+	{
+		LOGE("Asset ID was not recycled.\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,456 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "audio_mixer.hpp"
+#include "audio_worker_pool.hpp"
+#include "logging.hpp"
+#include <atomic>
+#include <cmath>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace Granite;
+using namespace Granite::Audio;
+
+enum { NumFrames = 256 };
+
+// Deterministic noise, so that any reordering of the float sums shows up in the output.
+struct NoiseStream : MixerStream
+{
+	explicit NoiseStream(uint32_t seed_)
+		: state(seed_ * 747796405u + 2891336453u)
+	{
+	}
+
+	bool setup(float, unsigned mixer_channels, size_t) override
+	{
+		num_channels = mixer_channels;
+		return true;
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override
+	{
+		for (size_t i = 0; i < num_frames; i++)
+		{
+			state = state * 1664525u + 1013904223u;
+			float v = float(state >> 8) * (1.0f / float(1 << 24)) - 0.5f;
+			for (unsigned c = 0; c < num_channels; c++)
+				channels[c][i] += gains[c] * v;
+		}
+		return num_frames;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return 48000.0f;
+	}
+
+	uint32_t state;
+	unsigned num_channels = 0;
+};
+
+// A stand-in for DSP chains such as create_fft_eq_stream(), built on the bus input.
+struct ScaleEffect : MixerStream
+{
+	ScaleEffect(MixerStream *source_, float scale_)
+		: source(source_), scale(scale_)
+	{
+	}
+
+	~ScaleEffect() override
+	{
+		source->dispose();
+	}
+
+	bool setup(float rate, unsigned mixer_channels, size_t) override
+	{
+		num_channels = mixer_channels;
+		return source->setup(rate, mixer_channels, NumFrames);
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override
+	{
+		float scaled[Backend::MaxAudioChannels];
+		for (unsigned c = 0; c < num_channels; c++)
+			scaled[c] = gains[c] * scale;
+		return source->accumulate_samples(channels, scaled, num_frames);
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return source->get_num_channels();
+	}
+
+	float get_sample_rate() const override
+	{
+		return source->get_sample_rate();
+	}
+
+	MixerStream *source;
+	float scale;
+	unsigned num_channels = 0;
+};
+
+// Outputs a constant, so a voice which is mixed twice or skipped shifts the output by a known amount.
+struct ConstantStream : MixerStream
+{
+	explicit ConstantStream(float value_)
+		: value(value_)
+	{
+	}
+
+	bool setup(float, unsigned mixer_channels, size_t) override
+	{
+		num_channels = mixer_channels;
+		return true;
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+			for (size_t i = 0; i < num_frames; i++)
+				channels[c][i] += gains[c] * value;
+		return num_frames;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return 48000.0f;
+	}
+
+	float value;
+	unsigned num_channels = 0;
+};
+
+static int test_worker_pool()
+{
+	MixerWorkerPool pool(3);
+	std::atomic_uint32_t hits[64];
+
+	for (unsigned iteration = 0; iteration < 10000; iteration++)
+	{
+		unsigned count = 1 + iteration % 64;
+		for (auto &h : hits)
+			h.store(0, std::memory_order_relaxed);
+
+		pool.run([](void *userdata, unsigned index) {
+			static_cast<std::atomic_uint32_t *>(userdata)[index].fetch_add(1, std::memory_order_relaxed);
+		}, hits, count);
+
+		for (unsigned i = 0; i < 64; i++)
+			if (hits[i].load(std::memory_order_relaxed) != (i < count ? 1u : 0u))
+			{
+				LOGE("Check failed: hits[i].load(std::memory_order_relaxed) == (i < count ? 1u : 0u)\n");
+				return EXIT_FAILURE;
+			}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static void build_graph(Mixer &mixer, std::vector<StreamID> &ids, unsigned *bus_ids)
+{
+	mixer.set_backend_parameters(48000.0f, 2, NumFrames);
+
+	// master <- music (effect) <- music-sub
+	//        <- sfx <- sfx-near (effect), sfx-far
+	bus_ids[0] = mixer.create_bus(Mixer::MasterBus, [](MixerStream *input) -> MixerStream * {
+		return new ScaleEffect(input, 0.5f);
+	}, -3.0f);
+	bus_ids[1] = mixer.create_bus(bus_ids[0]);
+	bus_ids[2] = mixer.create_bus(Mixer::MasterBus, {}, -6.0f);
+	bus_ids[3] = mixer.create_bus(bus_ids[2], [](MixerStream *input) -> MixerStream * {
+		return new ScaleEffect(input, 0.25f);
+	});
+	bus_ids[4] = mixer.create_bus(bus_ids[2]);
+
+	for (unsigned i = 0; i < 40; i++)
+	{
+		StreamID id = mixer.add_mixer_stream(new NoiseStream(i), true, -float(i % 7), float(i % 5) * 0.5f - 1.0f);
+		unsigned bus = i % 6;
+		if (bus)
+			mixer.set_stream_bus(id, bus_ids[bus - 1]);
+		ids.push_back(id);
+	}
+}
+
+static void mix(Mixer &mixer, std::vector<float> *buffers)
+{
+	float *channels[2];
+	for (unsigned c = 0; c < 2; c++)
+	{
+		buffers[c].resize(NumFrames);
+		channels[c] = buffers[c].data();
+	}
+	mixer.mix_samples(channels, NumFrames);
+}
+
+static int test_deterministic_graph()
+{
+	Mixer serial, parallel;
+	if (!serial.set_bus_worker_count(0))
+	{
+		LOGE("Check failed: serial.set_bus_worker_count(0)\n");
+		return EXIT_FAILURE;
+	}
+	if (!parallel.set_bus_worker_count(3))
+	{
+		LOGE("Check failed: parallel.set_bus_worker_count(3)\n");
+		return EXIT_FAILURE;
+	}
+
+	std::vector<StreamID> serial_ids, parallel_ids;
+	unsigned serial_buses[5], parallel_buses[5];
+	build_graph(serial, serial_ids, serial_buses);
+	build_graph(parallel, parallel_ids, parallel_buses);
+	for (unsigned i = 0; i < 5; i++)
+		if (!(serial_buses[i] == i + 1 && parallel_buses[i] == i + 1))
+		{
+			LOGE("Check failed: serial_buses[i] == i + 1 && parallel_buses[i] == i + 1\n");
+			return EXIT_FAILURE;
+		}
+
+	// Worker count is locked in once buses exist.
+	if (parallel.set_bus_worker_count(1))
+	{
+		LOGE("Check failed: !parallel.set_bus_worker_count(1)\n");
+		return EXIT_FAILURE;
+	}
+
+	std::vector<float> serial_out[2], parallel_out[2];
+	for (unsigned iteration = 0; iteration < 200; iteration++)
+	{
+		mix(serial, serial_out);
+		mix(parallel, parallel_out);
+		for (unsigned c = 0; c < 2; c++)
+			if (memcmp(serial_out[c].data(), parallel_out[c].data(), NumFrames * sizeof(float)) != 0)
+			{
+				LOGE("Check failed: memcmp(serial_out[c].data(), parallel_out[c].data(), NumFrames * sizeof(float)) == 0\n");
+				return EXIT_FAILURE;
+			}
+	}
+
+	float energy = 0.0f;
+	for (auto v : parallel_out[0])
+		energy += v * v;
+	if (energy <= 0.0f)
+	{
+		LOGE("Check failed: energy > 0.0f\n");
+		return EXIT_FAILURE;
+	}
+
+	// Every bus reports its voices and timings.
+	unsigned total_voices = 0;
+	for (unsigned bus = 0; bus < 6; bus++)
+	{
+		Mixer::BusStatistics stats;
+		if (!parallel.get_bus_statistics(bus, stats))
+		{
+			LOGE("Check failed: parallel.get_bus_statistics(bus, stats)\n");
+			return EXIT_FAILURE;
+		}
+		if (stats.peak_cpu_seconds < stats.average_cpu_seconds)
+		{
+			LOGE("Check failed: stats.peak_cpu_seconds >= stats.average_cpu_seconds\n");
+			return EXIT_FAILURE;
+		}
+		if (stats.last_latency_seconds < stats.last_cpu_seconds)
+		{
+			LOGE("Check failed: stats.last_latency_seconds >= stats.last_cpu_seconds\n");
+			return EXIT_FAILURE;
+		}
+		total_voices += stats.real_voices;
+	}
+	if (total_voices != 40)
+	{
+		LOGE("Check failed: total_voices == 40\n");
+		return EXIT_FAILURE;
+	}
+
+	Mixer::BusStatistics stats;
+	if (parallel.get_bus_statistics(6, stats))
+	{
+		LOGE("Check failed: !parallel.get_bus_statistics(6, stats)\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_routing()
+{
+	Mixer mixer;
+	mixer.set_backend_parameters(48000.0f, 2, NumFrames);
+
+	// Invalid parents are refused.
+	if (mixer.create_bus(1) != Mixer::InvalidBus)
+	{
+		LOGE("Check failed: mixer.create_bus(1) == Mixer::InvalidBus\n");
+		return EXIT_FAILURE;
+	}
+
+	unsigned half = mixer.create_bus(Mixer::MasterBus, [](MixerStream *input) -> MixerStream * {
+		return new ScaleEffect(input, 0.5f);
+	});
+	unsigned quiet = mixer.create_bus(half, {}, -20.0f);
+	if (!(half == 1 && quiet == 2))
+	{
+		LOGE("Check failed: half == 1 && quiet == 2\n");
+		return EXIT_FAILURE;
+	}
+
+	StreamID id = mixer.add_mixer_stream(new NoiseStream(1));
+	if (mixer.set_stream_bus(id, 3))
+	{
+		LOGE("Check failed: !mixer.set_stream_bus(id, 3)\n");
+		return EXIT_FAILURE;
+	}
+	if (!mixer.set_stream_bus(id, quiet))
+	{
+		LOGE("Check failed: mixer.set_stream_bus(id, quiet)\n");
+		return EXIT_FAILURE;
+	}
+
+	std::vector<float> routed[2];
+	mix(mixer, routed);
+
+	// Compare against the same stream played directly, scaled by the bus chain.
+	Mixer reference;
+	reference.set_backend_parameters(48000.0f, 2, NumFrames);
+	reference.add_mixer_stream(new NoiseStream(1));
+	std::vector<float> direct[2];
+	mix(reference, direct);
+
+	float expected_gain = 0.5f * std::pow(10.0f, -20.0f / 20.0f);
+	for (unsigned c = 0; c < 2; c++)
+		for (unsigned i = 0; i < NumFrames; i++)
+			if (std::fabs(routed[c][i] - expected_gain * direct[c][i]) >= 1e-6f)
+			{
+				LOGE("Check failed: std::fabs(routed[c][i] - expected_gain * direct[c][i]) < 1e-6f\n");
+				return EXIT_FAILURE;
+			}
+
+	// Bus gain changes apply on the next callback.
+	mixer.set_bus_gain(quiet, 0.0f);
+	mix(mixer, routed);
+	Mixer::BusStatistics stats;
+	if (!mixer.get_bus_statistics(quiet, stats))
+	{
+		LOGE("Check failed: mixer.get_bus_statistics(quiet, stats)\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.real_voices != 1)
+	{
+		LOGE("Check failed: stats.real_voices == 1\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_bus_change_while_mixing()
+{
+	// Buses without effects or gain leave the mix unchanged, so moving streams between them
+	// must not change the output beyond float summation order.
+	Mixer mixer, reference;
+	if (!mixer.set_bus_worker_count(2))
+	{
+		LOGE("Check failed: mixer.set_bus_worker_count(2)\n");
+		return EXIT_FAILURE;
+	}
+	mixer.set_backend_parameters(48000.0f, 2, NumFrames);
+	reference.set_backend_parameters(48000.0f, 2, NumFrames);
+
+	unsigned buses[4];
+	buses[0] = mixer.create_bus(Mixer::MasterBus);
+	buses[1] = mixer.create_bus(Mixer::MasterBus);
+	buses[2] = mixer.create_bus(buses[0]);
+	buses[3] = mixer.create_bus(buses[1]);
+
+	enum { NumStreams = 128 };
+	std::vector<StreamID> ids;
+	for (unsigned i = 0; i < NumStreams; i++)
+	{
+		float value = 1.0f / float(1u << (i % 16)) + float(i) * 0.001f;
+		ids.push_back(mixer.add_mixer_stream(new ConstantStream(value)));
+		reference.add_mixer_stream(new ConstantStream(value));
+	}
+
+	std::vector<float> expected[2];
+	mix(reference, expected);
+
+	std::atomic_bool done{false};
+	std::thread router([&]() {
+		uint32_t state = 1;
+		while (!done.load(std::memory_order_relaxed))
+		{
+			state = state * 1664525u + 1013904223u;
+			unsigned bus = (state >> 8) % 5;
+			mixer.set_stream_bus(ids[(state >> 16) % NumStreams], bus ? buses[bus - 1] : unsigned(Mixer::MasterBus));
+		}
+	});
+
+	std::vector<float> out[2];
+	bool mismatch = false;
+	for (unsigned iteration = 0; iteration < 5000 && !mismatch; iteration++)
+	{
+		mix(mixer, out);
+		for (unsigned c = 0; c < 2; c++)
+			for (unsigned i = 0; i < NumFrames; i++)
+				if (std::fabs(out[c][i] - expected[c][i]) > 1e-4f)
+					mismatch = true;
+	}
+
+	done.store(true, std::memory_order_relaxed);
+	router.join();
+	if (mismatch)
+	{
+		LOGE("Check failed: !mismatch\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	if (test_worker_pool() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_deterministic_graph() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_routing() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_bus_change_while_mixing() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	LOGI("All audio bus tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,276 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "audio_mixer.hpp"
+#include "logging.hpp"
+#include <cmath>
+#include <string.h>
+#include <random>
+#include <vector>
+
+using namespace Granite;
+using namespace Granite::Audio;
+
+enum { NumFrames = 256, NumCallbacks = 2000 };
+static constexpr float SampleRate = 48000.0f;
+
+// Stands in for a decoder, with a comparable per-sample cost.
+struct SynthStream : MixerStream
+{
+	explicit SynthStream(float frequency)
+		: phase_delta(2.0f * float(M_PI) * frequency / SampleRate)
+	{
+	}
+
+	bool setup(float, unsigned mixer_channels, size_t) override
+	{
+		num_channels = mixer_channels;
+		return true;
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override
+	{
+		for (size_t i = 0; i < num_frames; i++)
+		{
+			float v = std::sin(phase) + 0.25f * std::sin(3.0f * phase) + 0.125f * std::sin(5.0f * phase);
+			for (unsigned c = 0; c < num_channels; c++)
+				channels[c][i] += gains[c] * v;
+			phase = std::fmod(phase + phase_delta, 2.0f * float(M_PI));
+		}
+		return num_frames;
+	}
+
+	size_t skip_samples(float * const *, size_t num_frames) noexcept override
+	{
+		phase = std::fmod(phase + phase_delta * float(num_frames), 2.0f * float(M_PI));
+		return num_frames;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return SampleRate;
+	}
+
+	unsigned num_channels = 0;
+	float phase = 0.0f;
+	float phase_delta;
+};
+
+// Heavy bus DSP, comparable to an FFT EQ or convolution reverb per bus.
+struct FIREffect : MixerStream
+{
+	explicit FIREffect(MixerStream *source_)
+		: source(source_)
+	{
+		for (unsigned i = 0; i < Taps; i++)
+			coeffs[i] = 0.5f * (1.0f - std::cos(2.0f * float(M_PI) * float(i) / float(Taps - 1))) / float(Taps);
+	}
+
+	~FIREffect() override
+	{
+		source->dispose();
+	}
+
+	bool setup(float rate, unsigned mixer_channels, size_t max_frames) override
+	{
+		num_channels = mixer_channels;
+		for (unsigned c = 0; c < num_channels; c++)
+		{
+			history[c].assign(max_frames + Taps, 0.0f);
+			input_ptrs[c] = history[c].data() + Taps;
+		}
+		return source->setup(rate, mixer_channels, max_frames);
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override
+	{
+		const float unity[Backend::MaxAudioChannels] = { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f };
+		for (unsigned c = 0; c < num_channels; c++)
+		{
+			float *h = history[c].data();
+			memmove(h, h + num_frames, Taps * sizeof(float));
+			memset(input_ptrs[c], 0, num_frames * sizeof(float));
+		}
+
+		size_t ret = source->accumulate_samples(input_ptrs, unity, num_frames);
+
+		for (unsigned c = 0; c < num_channels; c++)
+		{
+			const float *in = input_ptrs[c];
+			for (size_t i = 0; i < num_frames; i++)
+			{
+				float sum = 0.0f;
+				for (unsigned t = 0; t < Taps; t++)
+					sum += coeffs[t] * in[int(i) - int(t)];
+				channels[c][i] += gains[c] * sum;
+			}
+		}
+		return ret;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return source->get_num_channels();
+	}
+
+	float get_sample_rate() const override
+	{
+		return source->get_sample_rate();
+	}
+
+	enum { Taps = 256 };
+	MixerStream *source;
+	float coeffs[Taps];
+	std::vector<float> history[Backend::MaxAudioChannels];
+	float *input_ptrs[Backend::MaxAudioChannels] = {};
+	unsigned num_channels = 0;
+};
+
+static Mixer::MixStatistics run_bench(unsigned num_voices, bool virtualize)
+{
+	Mixer mixer;
+	mixer.set_backend_parameters(SampleRate, 2, NumFrames);
+	if (virtualize)
+	{
+		mixer.set_max_real_voices(64);
+		mixer.set_virtualization_threshold_db(-60.0f);
+	}
+	else
+	{
+		mixer.set_max_real_voices(num_voices);
+		mixer.set_virtualization_threshold_db(-1000.0f);
+	}
+
+	// Game-like distribution: most voices are distant and quiet.
+	std::mt19937 rnd(1234);
+	std::uniform_real_distribution<float> gain_db(-80.0f, 0.0f);
+	std::uniform_real_distribution<float> pan(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> frequency(100.0f, 2000.0f);
+	std::uniform_real_distribution<float> priority(0.5f, 2.0f);
+
+	for (unsigned i = 0; i < num_voices; i++)
+	{
+		StreamID id = mixer.add_mixer_stream(new SynthStream(frequency(rnd)), true, gain_db(rnd), pan(rnd));
+		mixer.set_stream_priority(id, priority(rnd));
+	}
+
+	std::vector<float> buffers[2];
+	float *channels[2];
+	for (unsigned c = 0; c < 2; c++)
+	{
+		buffers[c].resize(NumFrames);
+		channels[c] = buffers[c].data();
+	}
+
+	for (unsigned i = 0; i < NumCallbacks; i++)
+		mixer.mix_samples(channels, NumFrames);
+
+	return mixer.get_mix_statistics();
+}
+
+static Mixer::MixStatistics run_bus_bench(unsigned num_buses, unsigned num_workers, bool print_buses)
+{
+	Mixer mixer;
+	mixer.set_bus_worker_count(num_workers);
+	mixer.set_backend_parameters(SampleRate, 2, NumFrames);
+
+	std::vector<unsigned> buses;
+	for (unsigned i = 0; i < num_buses; i++)
+	{
+		buses.push_back(mixer.create_bus(Mixer::MasterBus, [](MixerStream *input) -> MixerStream * {
+			return new FIREffect(input);
+		}));
+	}
+
+	std::mt19937 rnd(1234);
+	std::uniform_real_distribution<float> frequency(100.0f, 2000.0f);
+	for (unsigned i = 0; i < 16 * num_buses; i++)
+	{
+		StreamID id = mixer.add_mixer_stream(new SynthStream(frequency(rnd)), true, -12.0f);
+		mixer.set_stream_bus(id, buses[i % num_buses]);
+	}
+
+	std::vector<float> buffers[2];
+	float *channels[2];
+	for (unsigned c = 0; c < 2; c++)
+	{
+		buffers[c].resize(NumFrames);
+		channels[c] = buffers[c].data();
+	}
+
+	for (unsigned i = 0; i < NumCallbacks; i++)
+		mixer.mix_samples(channels, NumFrames);
+
+	if (print_buses)
+	{
+		for (unsigned bus = 0; bus <= num_buses; bus++)
+		{
+			Mixer::BusStatistics stats;
+			mixer.get_bus_statistics(bus, stats);
+			LOGI("  bus %2u: %3u voices, cpu avg %.4f ms (peak %.4f ms), done at %.4f ms (peak %.4f ms).\n",
+			     bus, stats.real_voices,
+			     1e3 * stats.average_cpu_seconds, 1e3 * stats.peak_cpu_seconds,
+			     1e3 * stats.last_latency_seconds, 1e3 * stats.peak_latency_seconds);
+		}
+	}
+
+	return mixer.get_mix_statistics();
+}
+
+int main()
+{
+	const double budget = double(NumFrames) / SampleRate;
+	LOGI("Callback budget: %.3f ms (%u frames @ %.0f Hz).\n", 1e3 * budget, unsigned(NumFrames), SampleRate);
+	LOGI("%8s | %22s | %34s\n", "voices", "all real: avg ms (load)", "virtualized: real/virt avg ms (load)");
+
+	const unsigned voice_counts[] = { 16, 32, 64, 128, 256, 512, 1000 };
+	for (unsigned count : voice_counts)
+	{
+		auto full = run_bench(count, false);
+		auto virt = run_bench(count, true);
+		LOGI("%8u | %13.4f (%5.1f%%) | %6u/%-6u %11.4f (%5.1f%%)\n",
+		     count,
+		     1e3 * full.average_mix_seconds, 100.0 * full.average_mix_seconds / budget,
+		     virt.real_voices, virt.virtual_voices,
+		     1e3 * virt.average_mix_seconds, 100.0 * virt.average_mix_seconds / budget);
+	}
+
+	LOGI("\nSubmix buses with a %u-tap FIR each, 16 voices per bus.\n", unsigned(FIREffect::Taps));
+	LOGI("%8s | %18s | %18s\n", "buses", "serial: avg ms", "3 workers: avg ms");
+	const unsigned bus_counts[] = { 1, 2, 4, 8, 15 };
+	for (unsigned count : bus_counts)
+	{
+		auto serial = run_bus_bench(count, 0, false);
+		auto parallel = run_bus_bench(count, 3, false);
+		LOGI("%8u | %11.4f (%4.1f%%) | %11.4f (%4.1f%%)\n", count,
+		     1e3 * serial.average_mix_seconds, 100.0 * serial.average_mix_seconds / budget,
+		     1e3 * parallel.average_mix_seconds, 100.0 * parallel.average_mix_seconds / budget);
+	}
+
+	LOGI("\nPer-bus statistics, 8 buses, 3 workers:\n");
+	run_bus_bench(8, 3, true);
+}
@@ -0,0 +1,318 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "audio_prefetch.hpp"
+#include "global_managers_init.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <vector>
+
+using namespace Granite;
+using namespace Granite::Audio;
+
+// Channel c of frame i holds (c + 1) * i, so any dropped or repeated frame is visible.
+struct RampStream : PrefetchedStream
+{
+	RampStream(unsigned num_channels_, size_t total_frames_, float decode_ahead_seconds)
+		: num_channels(num_channels_), total_frames(total_frames_)
+	{
+		init_prefetch(num_channels, 48000.0f, decode_ahead_seconds);
+	}
+
+	size_t decode(float * const *channels, size_t num_frames) noexcept override
+	{
+		size_t to_decode = std::min(num_frames, total_frames - offset);
+		for (unsigned c = 0; c < num_channels; c++)
+			for (size_t i = 0; i < to_decode; i++)
+				channels[c][i] = float((c + 1) * (offset + i));
+		offset += to_decode;
+		return to_decode;
+	}
+
+	unsigned num_channels;
+	size_t total_frames;
+	size_t offset = 0;
+};
+
+enum { MixFrames = 256 };
+
+static size_t mix(PrefetchedStream &stream, std::vector<float> *buffers, unsigned num_channels)
+{
+	float *channels[Backend::MaxAudioChannels];
+	float gains[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		buffers[c].assign(MixFrames, 0.0f);
+		channels[c] = buffers[c].data();
+		gains[c] = 1.0f;
+	}
+	return stream.accumulate_samples(channels, gains, MixFrames);
+}
+
+static int test_continuity(ThreadGroup &group)
+{
+	StreamPrefetcher prefetcher;
+	const size_t total_frames = 48000;
+	auto *stream = new RampStream(2, total_frames, 0.05f);
+	if (!stream->setup(48000.0f, 2, MixFrames))
+	{
+		LOGE("Check failed: stream->setup(48000.0f, 2, MixFrames)\n");
+		return EXIT_FAILURE;
+	}
+	prefetcher.add_stream(stream);
+	if (stream->get_status().buffered_frames < stream->get_status().target_frames)
+	{
+		LOGE("Check failed: stream->get_status().buffered_frames >= stream->get_status().target_frames\n");
+		return EXIT_FAILURE;
+	}
+
+	std::vector<float> buffers[2];
+	size_t played = 0;
+	for (;;)
+	{
+		size_t ret = mix(*stream, buffers, 2);
+		for (size_t i = 0; i < ret; i++)
+		{
+			if (buffers[0][i] != float(played + i))
+			{
+				LOGE("Check failed: buffers[0][i] == float(played + i)\n");
+				return EXIT_FAILURE;
+			}
+			if (buffers[1][i] != float(2 * (played + i)))
+			{
+				LOGE("Check failed: buffers[1][i] == float(2 * (played + i))\n");
+				return EXIT_FAILURE;
+			}
+		}
+		played += ret;
+		if (ret < MixFrames)
+			break;
+
+		prefetcher.iterate(group);
+		prefetcher.wait_idle();
+	}
+
+	if (played != total_frames)
+	{
+		LOGE("Check failed: played == total_frames\n");
+		return EXIT_FAILURE;
+	}
+	if (!stream->get_status().complete)
+	{
+		LOGE("Check failed: stream->get_status().complete\n");
+		return EXIT_FAILURE;
+	}
+	if (stream->get_status().underruns != 0)
+	{
+		LOGE("Check failed: stream->get_status().underruns == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (prefetcher.get_statistics().decode_tasks == 0)
+	{
+		LOGE("Check failed: prefetcher.get_statistics().decode_tasks != 0\n");
+		return EXIT_FAILURE;
+	}
+
+	stream->dispose();
+	prefetcher.iterate(group);
+	auto stats = prefetcher.get_statistics();
+	if (stats.num_streams != 0)
+	{
+		LOGE("Check failed: stats.num_streams == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.underruns != 0)
+	{
+		LOGE("Check failed: stats.underruns == 0\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_underrun(ThreadGroup &group)
+{
+	StreamPrefetcher prefetcher;
+	auto *stream = new RampStream(1, 48000, 0.0f);
+	if (!stream->setup(48000.0f, 2, MixFrames))
+	{
+		LOGE("Check failed: stream->setup(48000.0f, 2, MixFrames)\n");
+		return EXIT_FAILURE;
+	}
+	prefetcher.add_stream(stream);
+
+	// Mono is expanded to every mixer channel.
+	size_t buffered = stream->get_status().buffered_frames;
+	std::vector<float> buffers[2];
+	size_t played = 0;
+	while (played + MixFrames <= buffered)
+	{
+		if (mix(*stream, buffers, 2) != MixFrames)
+		{
+			LOGE("Check failed: mix(*stream, buffers, 2) == MixFrames\n");
+			return EXIT_FAILURE;
+		}
+		if (!(buffers[0][0] == float(played) && buffers[1][0] == float(played)))
+		{
+			LOGE("Check failed: buffers[0][0] == float(played) && buffers[1][0] == float(played)\n");
+			return EXIT_FAILURE;
+		}
+		played += MixFrames;
+	}
+	if (stream->get_status().underruns != 0)
+	{
+		LOGE("Check failed: stream->get_status().underruns == 0\n");
+		return EXIT_FAILURE;
+	}
+
+	// Without the prefetcher running, the ring runs dry. The stream must keep going with silence.
+	size_t remaining = buffered - played;
+	if (mix(*stream, buffers, 2) != MixFrames)
+	{
+		LOGE("Check failed: mix(*stream, buffers, 2) == MixFrames\n");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = remaining; i < MixFrames; i++)
+		if (!(buffers[0][i] == 0.0f && buffers[1][i] == 0.0f))
+		{
+			LOGE("Check failed: buffers[0][i] == 0.0f && buffers[1][i] == 0.0f\n");
+			return EXIT_FAILURE;
+		}
+	if (mix(*stream, buffers, 2) != MixFrames)
+	{
+		LOGE("Check failed: mix(*stream, buffers, 2) == MixFrames\n");
+		return EXIT_FAILURE;
+	}
+	if (stream->get_status().underruns != 2)
+	{
+		LOGE("Check failed: stream->get_status().underruns == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (prefetcher.get_statistics().underruns != 2)
+	{
+		LOGE("Check failed: prefetcher.get_statistics().underruns == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (prefetcher.get_statistics().min_fill_ratio != 0.0f)
+	{
+		LOGE("Check failed: prefetcher.get_statistics().min_fill_ratio == 0.0f\n");
+		return EXIT_FAILURE;
+	}
+
+	// Once decoding catches up, playback resumes where it left off.
+	played += remaining;
+	prefetcher.iterate(group);
+	prefetcher.wait_idle();
+	if (mix(*stream, buffers, 2) != MixFrames)
+	{
+		LOGE("Check failed: mix(*stream, buffers, 2) == MixFrames\n");
+		return EXIT_FAILURE;
+	}
+	if (buffers[0][0] != float(played))
+	{
+		LOGE("Check failed: buffers[0][0] == float(played)\n");
+		return EXIT_FAILURE;
+	}
+
+	// Underruns of dropped streams are still accounted for.
+	stream->dispose();
+	prefetcher.iterate(group);
+	if (prefetcher.get_statistics().num_streams != 0)
+	{
+		LOGE("Check failed: prefetcher.get_statistics().num_streams == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (prefetcher.get_statistics().underruns != 2)
+	{
+		LOGE("Check failed: prefetcher.get_statistics().underruns == 2\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_setup(ThreadGroup &)
+{
+	auto *stream = new RampStream(2, 1000, 0.1f);
+	// Stereo cannot be mixed into mono.
+	if (stream->setup(48000.0f, 1, MixFrames))
+	{
+		LOGE("Check failed: !stream->setup(48000.0f, 1, MixFrames)\n");
+		return EXIT_FAILURE;
+	}
+	if (!stream->setup(48000.0f, 2, MixFrames))
+	{
+		LOGE("Check failed: stream->setup(48000.0f, 2, MixFrames)\n");
+		return EXIT_FAILURE;
+	}
+
+	// Without a prefetcher, everything ends up as underruns.
+	std::vector<float> buffers[2];
+	if (mix(*stream, buffers, 2) != MixFrames)
+	{
+		LOGE("Check failed: mix(*stream, buffers, 2) == MixFrames\n");
+		return EXIT_FAILURE;
+	}
+	if (stream->get_status().underruns != 1)
+	{
+		LOGE("Check failed: stream->get_status().underruns == 1\n");
+		return EXIT_FAILURE;
+	}
+
+	stream->decode_ahead();
+	if (!stream->get_status().complete)
+	{
+		LOGE("Check failed: stream->get_status().complete\n");
+		return EXIT_FAILURE;
+	}
+	if (stream->get_status().buffered_frames != 1000)
+	{
+		LOGE("Check failed: stream->get_status().buffered_frames == 1000\n");
+		return EXIT_FAILURE;
+	}
+	size_t played = 0;
+	size_t ret;
+	while ((ret = mix(*stream, buffers, 2)) == MixFrames)
+		played += ret;
+	if (played + ret != 1000)
+	{
+		LOGE("Check failed: played + ret == 1000\n");
+		return EXIT_FAILURE;
+	}
+	stream->dispose();
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	Global::init();
+	auto &group = *GRANITE_THREAD_GROUP();
+
+	if (test_continuity(group) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_underrun(group) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_setup(group) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	LOGI("All audio prefetch tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,362 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "audio_mixer.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+
+using namespace Granite;
+using namespace Granite::Audio;
+
+enum { NumFrames = 256 };
+
+// Outputs its own frame index, so a voice resuming at the wrong position is visible.
+struct CounterStream : MixerStream
+{
+	explicit CounterStream(size_t total_frames_ = SIZE_MAX, bool can_skip_ = true)
+		: total_frames(total_frames_), can_skip(can_skip_)
+	{
+	}
+
+	bool setup(float, unsigned mixer_channels, size_t) override
+	{
+		num_channels = mixer_channels;
+		return true;
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override
+	{
+		size_t to_write = std::min(num_frames, total_frames - cursor);
+		for (unsigned c = 0; c < num_channels; c++)
+			for (size_t i = 0; i < to_write; i++)
+				channels[c][i] += gains[c] * float(cursor + i);
+
+		last_accumulate_cursor = cursor;
+		accumulate_calls++;
+		cursor += to_write;
+		return to_write;
+	}
+
+	size_t skip_samples(float * const *scratch, size_t num_frames) noexcept override
+	{
+		if (!can_skip)
+			return MixerStream::skip_samples(scratch, num_frames);
+
+		size_t to_skip = std::min(num_frames, total_frames - cursor);
+		skip_calls++;
+		cursor += to_skip;
+		return to_skip;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return 48000.0f;
+	}
+
+	size_t total_frames;
+	bool can_skip;
+	unsigned num_channels = 0;
+	size_t cursor = 0;
+	size_t last_accumulate_cursor = 0;
+	unsigned accumulate_calls = 0;
+	unsigned skip_calls = 0;
+};
+
+static void mix(Mixer &mixer, std::vector<float> *buffers)
+{
+	float *channels[2];
+	for (unsigned c = 0; c < 2; c++)
+	{
+		buffers[c].resize(NumFrames);
+		channels[c] = buffers[c].data();
+	}
+	mixer.mix_samples(channels, NumFrames);
+}
+
+static int test_virtualization()
+{
+	Mixer mixer;
+	mixer.set_backend_parameters(48000.0f, 2, NumFrames);
+	mixer.set_max_real_voices(2);
+	mixer.set_virtualization_threshold_db(-60.0f);
+
+	CounterStream *streams[4];
+	StreamID ids[4];
+	const float gains_db[4] = { 0.0f, -6.0f, -12.0f, -100.0f };
+	for (unsigned i = 0; i < 4; i++)
+	{
+		streams[i] = new CounterStream;
+		ids[i] = mixer.add_mixer_stream(streams[i], true, gains_db[i]);
+		if (!bool(ids[i]))
+		{
+			LOGE("Check failed: bool(ids[i])\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<float> buffers[2];
+	mix(mixer, buffers);
+
+	// The two loudest voices are real, the others advance without being mixed.
+	if (mixer.is_stream_virtual(ids[0]))
+	{
+		LOGE("Check failed: !mixer.is_stream_virtual(ids[0])\n");
+		return EXIT_FAILURE;
+	}
+	if (mixer.is_stream_virtual(ids[1]))
+	{
+		LOGE("Check failed: !mixer.is_stream_virtual(ids[1])\n");
+		return EXIT_FAILURE;
+	}
+	if (!mixer.is_stream_virtual(ids[2]))
+	{
+		LOGE("Check failed: mixer.is_stream_virtual(ids[2])\n");
+		return EXIT_FAILURE;
+	}
+	if (!mixer.is_stream_virtual(ids[3]))
+	{
+		LOGE("Check failed: mixer.is_stream_virtual(ids[3])\n");
+		return EXIT_FAILURE;
+	}
+	for (auto *stream : streams)
+		if (stream->cursor != NumFrames)
+		{
+			LOGE("Check failed: stream->cursor == NumFrames\n");
+			return EXIT_FAILURE;
+		}
+	if (!(streams[2]->accumulate_calls == 0 && streams[2]->skip_calls == 1))
+	{
+		LOGE("Check failed: streams[2]->accumulate_calls == 0 && streams[2]->skip_calls == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (buffers[0][1] != 1.0f + std::pow(10.0f, -6.0f / 20.0f))
+	{
+		LOGE("Check failed: buffers[0][1] == 1.0f + std::pow(10.0f, -6.0f / 20.0f)\n");
+		return EXIT_FAILURE;
+	}
+
+	auto stats = mixer.get_mix_statistics();
+	if (stats.real_voices != 2)
+	{
+		LOGE("Check failed: stats.real_voices == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.virtual_voices != 2)
+	{
+		LOGE("Check failed: stats.virtual_voices == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.demotions != 2)
+	{
+		LOGE("Check failed: stats.demotions == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.num_callbacks != 1)
+	{
+		LOGE("Check failed: stats.num_callbacks == 1\n");
+		return EXIT_FAILURE;
+	}
+
+	// Priority outweighs loudness. The promoted voice picks up where its cursor is.
+	mixer.set_stream_priority(ids[2], 10.0f);
+	mix(mixer, buffers);
+	if (mixer.is_stream_virtual(ids[2]))
+	{
+		LOGE("Check failed: !mixer.is_stream_virtual(ids[2])\n");
+		return EXIT_FAILURE;
+	}
+	if (!mixer.is_stream_virtual(ids[1]))
+	{
+		LOGE("Check failed: mixer.is_stream_virtual(ids[1])\n");
+		return EXIT_FAILURE;
+	}
+	if (streams[2]->last_accumulate_cursor != NumFrames)
+	{
+		LOGE("Check failed: streams[2]->last_accumulate_cursor == NumFrames\n");
+		return EXIT_FAILURE;
+	}
+	if (mixer.get_play_cursor(ids[2]) != mixer.get_play_cursor(ids[1]))
+	{
+		LOGE("Check failed: mixer.get_play_cursor(ids[2]) == mixer.get_play_cursor(ids[1])\n");
+		return EXIT_FAILURE;
+	}
+
+	// No amount of priority makes an inaudible voice real.
+	mixer.set_stream_priority(ids[3], 1000.0f);
+	mix(mixer, buffers);
+	if (!mixer.is_stream_virtual(ids[3]))
+	{
+		LOGE("Check failed: mixer.is_stream_virtual(ids[3])\n");
+		return EXIT_FAILURE;
+	}
+
+	stats = mixer.get_mix_statistics();
+	if (stats.promotions != 1)
+	{
+		LOGE("Check failed: stats.promotions == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.demotions != 3)
+	{
+		LOGE("Check failed: stats.demotions == 3\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.num_callbacks != 3)
+	{
+		LOGE("Check failed: stats.num_callbacks == 3\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.peak_mix_seconds < stats.average_mix_seconds)
+	{
+		LOGE("Check failed: stats.peak_mix_seconds >= stats.average_mix_seconds\n");
+		return EXIT_FAILURE;
+	}
+
+	// Paused voices neither mix nor advance.
+	mixer.pause_stream(ids[0]);
+	mix(mixer, buffers);
+	if (streams[0]->cursor != 3 * NumFrames)
+	{
+		LOGE("Check failed: streams[0]->cursor == 3 * NumFrames\n");
+		return EXIT_FAILURE;
+	}
+	if (streams[1]->cursor != 4 * NumFrames)
+	{
+		LOGE("Check failed: streams[1]->cursor == 4 * NumFrames\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_virtual_end_of_stream()
+{
+	Mixer mixer;
+	mixer.set_backend_parameters(48000.0f, 2, NumFrames);
+	mixer.set_max_real_voices(0);
+
+	// One stream skips cheaply, the other falls back to rendering with zero gain.
+	auto *skipping = new CounterStream(NumFrames + 10);
+	auto *fallback = new CounterStream(NumFrames + 10, false);
+	StreamID skipping_id = mixer.add_mixer_stream(skipping);
+	StreamID fallback_id = mixer.add_mixer_stream(fallback);
+
+	std::vector<float> buffers[2];
+	mix(mixer, buffers);
+	if (mixer.get_stream_state(skipping_id) != Mixer::StreamState::Playing)
+	{
+		LOGE("Check failed: mixer.get_stream_state(skipping_id) == Mixer::StreamState::Playing\n");
+		return EXIT_FAILURE;
+	}
+	if (mixer.get_stream_state(fallback_id) != Mixer::StreamState::Playing)
+	{
+		LOGE("Check failed: mixer.get_stream_state(fallback_id) == Mixer::StreamState::Playing\n");
+		return EXIT_FAILURE;
+	}
+	if (!(fallback->accumulate_calls == 1 && fallback->cursor == NumFrames))
+	{
+		LOGE("Check failed: fallback->accumulate_calls == 1 && fallback->cursor == NumFrames\n");
+		return EXIT_FAILURE;
+	}
+	for (auto &buffer : buffers)
+		for (auto v : buffer)
+			if (v != 0.0f)
+			{
+				LOGE("Check failed: v == 0.0f\n");
+				return EXIT_FAILURE;
+			}
+
+	// Virtual voices end like real ones do.
+	mix(mixer, buffers);
+	if (mixer.get_stream_state(skipping_id) != Mixer::StreamState::Dead)
+	{
+		LOGE("Check failed: mixer.get_stream_state(skipping_id) == Mixer::StreamState::Dead\n");
+		return EXIT_FAILURE;
+	}
+	if (mixer.get_stream_state(fallback_id) != Mixer::StreamState::Dead)
+	{
+		LOGE("Check failed: mixer.get_stream_state(fallback_id) == Mixer::StreamState::Dead\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_voice_count()
+{
+	Mixer mixer;
+	mixer.set_backend_parameters(48000.0f, 2, NumFrames);
+
+	std::vector<StreamID> ids;
+	for (unsigned i = 0; i < 1000; i++)
+	{
+		StreamID id = mixer.add_mixer_stream(new CounterStream, true, -float(i % 50));
+		if (!bool(id))
+		{
+			LOGE("Check failed: bool(id)\n");
+			return EXIT_FAILURE;
+		}
+		ids.push_back(id);
+	}
+
+	std::vector<float> buffers[2];
+	mix(mixer, buffers);
+	auto stats = mixer.get_mix_statistics();
+	if (stats.real_voices != 128)
+	{
+		LOGE("Check failed: stats.real_voices == 128\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.virtual_voices != 1000 - 128)
+	{
+		LOGE("Check failed: stats.virtual_voices == 1000 - 128\n");
+		return EXIT_FAILURE;
+	}
+
+	// The loudest voices are the ones which get mixed.
+	for (unsigned i = 0; i < 1000; i++)
+		if (i % 50 < 2)
+			if (mixer.is_stream_virtual(ids[i]))
+			{
+				LOGE("Check failed: !mixer.is_stream_virtual(ids[i])\n");
+				return EXIT_FAILURE;
+			}
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	if (test_virtualization() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_virtual_end_of_stream() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_voice_count() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	LOGI("All voice virtualization tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,219 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "global_managers_init.hpp"
+#include "texture_compression.hpp"
+#include "bc_compressor.hpp"
+#include "memory_mapped_texture.hpp"
+#include "thread_group.hpp"
+#include "filesystem.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include "math.hpp"
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+// Synthetic albedo-like texture, smooth color ramps, hard edges and noise, with an alpha gradient.
+static std::shared_ptr<Vulkan::MemoryMappedTexture> create_color_map(unsigned size)
+{
+	auto tex = std::make_shared<Vulkan::MemoryMappedTexture>();
+	tex->set_2d(VK_FORMAT_R8G8B8A8_UNORM, size, size);
+	if (!tex->map_write_scratch())
+		return {};
+
+	std::mt19937 rng(1337);
+	auto &layout = tex->get_layout();
+	for (unsigned y = 0; y < size; y++)
+	{
+		for (unsigned x = 0; x < size; x++)
+		{
+			float r = 0.5f + 0.5f * sinf(float(x) * 0.021f + float(y) * 0.007f);
+			float g = 0.5f + 0.5f * cosf(float(y) * 0.015f);
+			float b = ((x / 37) ^ (y / 23)) & 1 ? 0.8f : 0.2f;
+			int noise = int(rng() % 17) - 8;
+			auto *texel = layout.data_2d<u8vec4>(x, y);
+			texel->x = uint8_t(std::min(std::max(int(r * 255.0f) + noise, 0), 255));
+			texel->y = uint8_t(std::min(std::max(int(g * 255.0f) - noise, 0), 255));
+			texel->z = uint8_t(std::min(std::max(int(b * 255.0f) + noise, 0), 255));
+			texel->w = uint8_t((x * 255) / (size - 1));
+		}
+	}
+
+	return tex;
+}
+
+static void gather_blocks(const Vulkan::MemoryMappedTexture &tex, std::vector<uint8_t> &blocks)
+{
+	auto &layout = tex.get_layout();
+	unsigned blocks_x = layout.get_width() / 4;
+	unsigned blocks_y = layout.get_height() / 4;
+	blocks.resize(blocks_x * blocks_y * 64);
+
+	for (unsigned by = 0; by < blocks_y; by++)
+		for (unsigned bx = 0; bx < blocks_x; bx++)
+			for (unsigned i = 0; i < 16; i++)
+				memcpy(&blocks[((by * blocks_x + bx) * 16 + i) * 4],
+				       layout.data_2d<u8vec4>(bx * 4 + (i & 3), by * 4 + (i >> 2)), 4);
+}
+
+struct Codec
+{
+	const char *name;
+	VkFormat format;
+	unsigned block_size;
+	unsigned num_channels;
+	void (*compress)(uint8_t *, const uint8_t *, unsigned);
+	void (*decompress)(uint8_t *, const uint8_t *);
+};
+
+static const Codec codecs[] = {
+	{ "BC1", VK_FORMAT_BC1_RGB_UNORM_BLOCK, 8, 3,
+	  [](uint8_t *out, const uint8_t *in, unsigned quality) { compress_bc1_block(out, in, quality, false); },
+	  decompress_bc1_block },
+	{ "BC3", VK_FORMAT_BC3_UNORM_BLOCK, 16, 4, compress_bc3_block, decompress_bc3_block },
+	{ "BC7", VK_FORMAT_BC7_UNORM_BLOCK, 16, 4, compress_bc7_block, decompress_bc7_block },
+};
+
+static double compute_psnr(const Codec &codec, const uint8_t *encoded, const std::vector<uint8_t> &reference)
+{
+	size_t num_blocks = reference.size() / 64;
+	double error = 0.0;
+	for (size_t block = 0; block < num_blocks; block++)
+	{
+		uint8_t decoded[64];
+		codec.decompress(decoded, encoded + block * codec.block_size);
+		for (unsigned i = 0; i < 16; i++)
+		{
+			for (unsigned c = 0; c < codec.num_channels; c++)
+			{
+				double diff = double(decoded[4 * i + c]) - double(reference[block * 64 + 4 * i + c]);
+				error += diff * diff;
+			}
+		}
+	}
+
+	error /= double(num_blocks * 16 * codec.num_channels);
+	return error > 0.0 ? 10.0 * log10(255.0 * 255.0 / error) : INFINITY;
+}
+
+static bool compress_full(ThreadGroup &group, const Codec &codec, bool native,
+                          const std::shared_ptr<Vulkan::MemoryMappedTexture> &input,
+                          const std::vector<uint8_t> &reference, double mpixels)
+{
+	CompressorArguments args;
+	args.output = "scratch://bench.gtx";
+	args.format = codec.format;
+	args.mode = codec.num_channels == 4 ? TextureMode::RGBA : TextureMode::RGB;
+	args.native_bc_encoder = native;
+
+	auto start = Util::get_current_time_nsecs();
+	{
+		auto dep = group.create_task();
+		if (!compress_texture(group, args, input, dep, nullptr))
+			return false;
+		dep->flush();
+		group.wait_idle();
+	}
+	auto end = Util::get_current_time_nsecs();
+
+	Vulkan::MemoryMappedTexture output;
+	if (!output.map_read(*GRANITE_FILESYSTEM(), args.output))
+	{
+		LOGE("Failed to read back compressed texture.\n");
+		return false;
+	}
+
+	auto *encoded = static_cast<const uint8_t *>(output.get_layout().data());
+	LOGI("  %s %s: %8.2f Mpixel/s, PSNR %.3f dB\n", codec.name, native ? "native" : "ISPC  ",
+	     mpixels / (1e-9 * double(end - start)), compute_psnr(codec, encoded, reference));
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT | Global::MANAGER_FEATURE_THREAD_GROUP_BIT);
+
+	unsigned size = argc >= 2 ? unsigned(strtoul(argv[1], nullptr, 0)) : 1024;
+	if (size < 4 || (size & 3) != 0)
+	{
+		LOGE("Usage: bc-compressor-bench [size, multiple of 4]\n");
+		return EXIT_FAILURE;
+	}
+
+	auto input = create_color_map(size);
+	if (!input)
+		return EXIT_FAILURE;
+
+	std::vector<uint8_t> blocks;
+	gather_blocks(*input, blocks);
+	unsigned num_blocks = unsigned(blocks.size() / 64);
+	double mpixels = double(size) * double(size) * 1e-6;
+
+	bool success = true;
+
+	LOGI("Native encoder on %ux%u, single thread:\n", size, size);
+	for (auto &codec : codecs)
+	{
+		std::vector<uint8_t> encoded(num_blocks * codec.block_size);
+		for (unsigned quality = 1; quality <= 5; quality += 2)
+		{
+			auto start = Util::get_current_time_nsecs();
+			for (unsigned block = 0; block < num_blocks; block++)
+				codec.compress(&encoded[block * codec.block_size], &blocks[block * 64], quality);
+			auto end = Util::get_current_time_nsecs();
+
+			double psnr = compute_psnr(codec, encoded.data(), blocks);
+			LOGI("  %s quality %u: %8.2f Mpixel/s, PSNR %.3f dB\n", codec.name, quality,
+			     mpixels / (1e-9 * double(end - start)), psnr);
+
+			// Sanity floor, this content is easy for every format.
+			if (psnr < 30.0)
+			{
+				LOGE("%s quality %u PSNR is unexpectedly low.\n", codec.name, quality);
+				success = false;
+			}
+		}
+	}
+
+	auto &group = *GRANITE_THREAD_GROUP();
+	GRANITE_FILESYSTEM()->register_protocol("scratch", std::make_unique<ScratchFilesystem>());
+
+	LOGI("Texture compressor on %ux%u, quality 3, %u threads:\n", size, size, group.get_num_threads());
+	for (auto &codec : codecs)
+	{
+		if (!compress_full(group, codec, true, input, blocks, mpixels))
+			success = false;
+		if (texture_compression_has_ispc() && !compress_full(group, codec, false, input, blocks, mpixels))
+			success = false;
+	}
+
+	if (!texture_compression_has_ispc())
+		LOGI("Built without ISPC texture compression, skipping comparison.\n");
+
+	Global::deinit();
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
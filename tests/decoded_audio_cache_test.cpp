@@ -0,0 +1,518 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "decoded_audio_cache.hpp"
+#include "global_managers_init.hpp"
+#include "thread_group.hpp"
+#include "filesystem.hpp"
+#include "logging.hpp"
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace Granite;
+using namespace Granite::Audio;
+
+// Synthesized PCM, so the cache can be tested without Vorbis assets.
+// Channel c of frame i holds (c + 1) * i. A file can ask for the decode to fail partway through.
+struct TestAudioHeader
+{
+	char magic[4];
+	uint32_t num_channels;
+	uint32_t num_frames;
+	uint32_t fail;
+};
+
+static std::atomic<unsigned> decodes_completed;
+
+struct TestDecoder : AudioDecoder
+{
+	unsigned get_num_channels() const override
+	{
+		return header.num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return 48000.0f;
+	}
+
+	size_t get_num_frames_hint() const override
+	{
+		return header.num_frames;
+	}
+
+	int decode(float * const *channels, unsigned num_frames) override
+	{
+		if (header.fail && offset >= header.num_frames / 2)
+			return -1;
+
+		unsigned to_decode = std::min(num_frames, header.num_frames - offset);
+		for (unsigned c = 0; c < header.num_channels; c++)
+			for (unsigned i = 0; i < to_decode; i++)
+				channels[c][i] = float((c + 1) * (offset + i));
+		offset += to_decode;
+
+		if (to_decode == 0)
+			decodes_completed++;
+		return int(to_decode);
+	}
+
+	TestAudioHeader header;
+	unsigned offset = 0;
+};
+
+static std::unique_ptr<AudioDecoder> create_test_decoder(FileMappingHandle mapping)
+{
+	if (mapping->get_size() < sizeof(TestAudioHeader))
+		return {};
+
+	std::unique_ptr<TestDecoder> decoder(new TestDecoder);
+	memcpy(&decoder->header, mapping->data(), sizeof(TestAudioHeader));
+	if (memcmp(decoder->header.magic, "TPCM", 4) != 0)
+		return {};
+
+	// Slow header parsing down, so concurrent requests for the same path race to insert it.
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return std::unique_ptr<AudioDecoder>(decoder.release());
+}
+
+static bool write_test_audio(const std::string &path, unsigned num_channels, unsigned num_frames, bool fail = false)
+{
+	TestAudioHeader header = {};
+	memcpy(header.magic, "TPCM", 4);
+	header.num_channels = num_channels;
+	header.num_frames = num_frames;
+	header.fail = fail ? 1 : 0;
+	return GRANITE_FILESYSTEM()->write_buffer_to_file(path, &header, sizeof(header));
+}
+
+static bool has_expected_samples(const DecodedAudio &audio, unsigned num_channels, unsigned num_frames)
+{
+	if (!audio.is_ready() || audio.get_num_channels() != num_channels || audio.get_num_frames() != num_frames)
+		return false;
+	for (unsigned c = 0; c < num_channels; c++)
+		for (unsigned i = 0; i < num_frames; i++)
+			if (audio.get_channel(c)[i] != float((c + 1) * i))
+				return false;
+	return true;
+}
+
+enum { NumChannels = 2, NumFrames = 10000, AudioSize = NumChannels * NumFrames * sizeof(float) };
+
+static int test_open_failure(ThreadGroup &group)
+{
+	DecodedAudioCache cache;
+	cache.set_decoder_factory(create_test_decoder);
+	if (!GRANITE_FILESYSTEM()->write_buffer_to_file("memory://garbage.pcm", "garbage garbage", 15))
+	{
+		LOGE("Check failed: GRANITE_FILESYSTEM()->write_buffer_to_file(\"memory://garbage.pcm\", \"garbage garbage\", 15)\n");
+		return EXIT_FAILURE;
+	}
+
+	if (cache.request("memory://missing.pcm", &group))
+	{
+		LOGE("Check failed: !cache.request(\"memory://missing.pcm\", &group)\n");
+		return EXIT_FAILURE;
+	}
+	if (cache.request("memory://missing.pcm", nullptr))
+	{
+		LOGE("Check failed: !cache.request(\"memory://missing.pcm\", nullptr)\n");
+		return EXIT_FAILURE;
+	}
+	if (cache.request("memory://garbage.pcm", nullptr))
+	{
+		LOGE("Check failed: !cache.request(\"memory://garbage.pcm\", nullptr)\n");
+		return EXIT_FAILURE;
+	}
+
+	// Failed opens must not be cached or accounted for.
+	auto stats = cache.get_statistics();
+	if (stats.hits != 0)
+	{
+		LOGE("Check failed: stats.hits == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.misses != 3)
+	{
+		LOGE("Check failed: stats.misses == 3\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.resident_bytes != 0)
+	{
+		LOGE("Check failed: stats.resident_bytes == 0\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_decode_failure()
+{
+	DecodedAudioCache cache;
+	cache.set_decoder_factory(create_test_decoder);
+	if (!write_test_audio("memory://broken.pcm", NumChannels, NumFrames, true))
+	{
+		LOGE("Check failed: write_test_audio(\"memory://broken.pcm\", NumChannels, NumFrames, true)\n");
+		return EXIT_FAILURE;
+	}
+
+	auto audio = cache.request("memory://broken.pcm", nullptr);
+	if (!audio)
+	{
+		LOGE("Check failed: audio\n");
+		return EXIT_FAILURE;
+	}
+	if (!audio->is_failed())
+	{
+		LOGE("Check failed: audio->is_failed()\n");
+		return EXIT_FAILURE;
+	}
+
+	// Failed decodes are retried rather than shared.
+	auto retry = cache.request("memory://broken.pcm", nullptr);
+	if (!retry)
+	{
+		LOGE("Check failed: retry\n");
+		return EXIT_FAILURE;
+	}
+	if (retry == audio)
+	{
+		LOGE("Check failed: retry != audio\n");
+		return EXIT_FAILURE;
+	}
+
+	auto stats = cache.get_statistics();
+	if (stats.hits != 0)
+	{
+		LOGE("Check failed: stats.hits == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.misses != 2)
+	{
+		LOGE("Check failed: stats.misses == 2\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_sharing(ThreadGroup &group, const std::vector<std::string> &paths)
+{
+	DecodedAudioCache cache;
+	cache.set_decoder_factory(create_test_decoder);
+	unsigned decodes = decodes_completed;
+
+	auto a = cache.request(paths[0], &group);
+	auto a_again = cache.request(paths[0], &group);
+	if (!a)
+	{
+		LOGE("Check failed: a\n");
+		return EXIT_FAILURE;
+	}
+	if (a != a_again)
+	{
+		LOGE("Check failed: a == a_again\n");
+		return EXIT_FAILURE;
+	}
+	if (a->get_num_channels() != NumChannels)
+	{
+		LOGE("Check failed: a->get_num_channels() == NumChannels\n");
+		return EXIT_FAILURE;
+	}
+	if (a->get_size() != AudioSize)
+	{
+		LOGE("Check failed: a->get_size() == AudioSize\n");
+		return EXIT_FAILURE;
+	}
+
+	// Decoded inline, so it is ready on return.
+	auto b = cache.request(paths[1], nullptr);
+	if (!b)
+	{
+		LOGE("Check failed: b\n");
+		return EXIT_FAILURE;
+	}
+	if (b == a)
+	{
+		LOGE("Check failed: b != a\n");
+		return EXIT_FAILURE;
+	}
+	if (!has_expected_samples(*b, NumChannels, NumFrames))
+	{
+		LOGE("Check failed: has_expected_samples(*b, NumChannels, NumFrames)\n");
+		return EXIT_FAILURE;
+	}
+
+	cache.wait_idle();
+	if (!has_expected_samples(*a, NumChannels, NumFrames))
+	{
+		LOGE("Check failed: has_expected_samples(*a, NumChannels, NumFrames)\n");
+		return EXIT_FAILURE;
+	}
+	if (decodes_completed != decodes + 2)
+	{
+		LOGE("Check failed: decodes_completed == decodes + 2\n");
+		return EXIT_FAILURE;
+	}
+
+	auto stats = cache.get_statistics();
+	if (stats.hits != 1)
+	{
+		LOGE("Check failed: stats.hits == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.misses != 2)
+	{
+		LOGE("Check failed: stats.misses == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.resident_bytes != 2 * AudioSize)
+	{
+		LOGE("Check failed: stats.resident_bytes == 2 * AudioSize\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.evicted_bytes != 0)
+	{
+		LOGE("Check failed: stats.evicted_bytes == 0\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_concurrent_requests(ThreadGroup &group, const std::vector<std::string> &paths)
+{
+	DecodedAudioCache cache;
+	cache.set_decoder_factory(create_test_decoder);
+	unsigned decodes = decodes_completed;
+
+	enum { NumThreads = 4, NumRequests = 64 };
+	std::vector<DecodedAudioHandle> results[NumThreads];
+
+	// Plain threads rather than tasks, so requests race even when the group only has one worker.
+	auto ctx = Global::create_thread_context();
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < NumThreads; t++)
+	{
+		threads.emplace_back([&, t]() {
+			Global::set_thread_context(*ctx);
+			for (unsigned i = 0; i < NumRequests; i++)
+				results[t].push_back(cache.request(paths[i % paths.size()], (i & 1) ? &group : nullptr));
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+	cache.wait_idle();
+
+	// Every request for a path must observe the one shared object, which is decoded exactly once.
+	for (unsigned t = 0; t < NumThreads; t++)
+	{
+		for (unsigned i = 0; i < NumRequests; i++)
+		{
+			if (!results[t][i])
+			{
+				LOGE("Check failed: results[t][i]\n");
+				return EXIT_FAILURE;
+			}
+			if (results[t][i] != results[0][i % paths.size()])
+			{
+				LOGE("Check failed: results[t][i] == results[0][i %% paths.size()]\n");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < paths.size(); i++)
+		if (!has_expected_samples(*results[0][i], NumChannels, NumFrames))
+		{
+			LOGE("Check failed: has_expected_samples(*results[0][i], NumChannels, NumFrames)\n");
+			return EXIT_FAILURE;
+		}
+	if (decodes_completed != decodes + paths.size())
+	{
+		LOGE("Check failed: decodes_completed == decodes + paths.size()\n");
+		return EXIT_FAILURE;
+	}
+
+	auto stats = cache.get_statistics();
+	if (stats.misses != paths.size())
+	{
+		LOGE("Check failed: stats.misses == paths.size()\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.hits != NumThreads * NumRequests - paths.size())
+	{
+		LOGE("Check failed: stats.hits == NumThreads * NumRequests - paths.size()\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_eviction(ThreadGroup &group, const std::vector<std::string> &paths)
+{
+	DecodedAudioCache cache;
+	cache.set_decoder_factory(create_test_decoder);
+
+	// Room for two entries, so the third request evicts the least recently used one.
+	cache.set_memory_budget(2 * AudioSize);
+	auto a = cache.request(paths[0], nullptr);
+	auto b = cache.request(paths[1], &group);
+	auto c = cache.request(paths[2], &group);
+	if (!(a && b && c))
+	{
+		LOGE("Check failed: a && b && c\n");
+		return EXIT_FAILURE;
+	}
+
+	auto stats = cache.get_statistics();
+	if (stats.resident_bytes != 2 * AudioSize)
+	{
+		LOGE("Check failed: stats.resident_bytes == 2 * AudioSize\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.evicted_bytes != AudioSize)
+	{
+		LOGE("Check failed: stats.evicted_bytes == AudioSize\n");
+		return EXIT_FAILURE;
+	}
+
+	// The evicted entry stays alive and readable for whoever still holds it.
+	cache.wait_idle();
+	if (!has_expected_samples(*a, NumChannels, NumFrames))
+	{
+		LOGE("Check failed: has_expected_samples(*a, NumChannels, NumFrames)\n");
+		return EXIT_FAILURE;
+	}
+	if (!has_expected_samples(*c, NumChannels, NumFrames))
+	{
+		LOGE("Check failed: has_expected_samples(*c, NumChannels, NumFrames)\n");
+		return EXIT_FAILURE;
+	}
+
+	// Touching b leaves c as the least recently used entry.
+	if (cache.request(paths[1], &group) != b)
+	{
+		LOGE("Check failed: cache.request(paths[1], &group) == b\n");
+		return EXIT_FAILURE;
+	}
+	auto a_reloaded = cache.request(paths[0], &group);
+	if (!a_reloaded)
+	{
+		LOGE("Check failed: a_reloaded\n");
+		return EXIT_FAILURE;
+	}
+	if (a_reloaded == a)
+	{
+		LOGE("Check failed: a_reloaded != a\n");
+		return EXIT_FAILURE;
+	}
+	if (cache.request(paths[1], &group) != b)
+	{
+		LOGE("Check failed: cache.request(paths[1], &group) == b\n");
+		return EXIT_FAILURE;
+	}
+	if (cache.request(paths[2], nullptr) == c)
+	{
+		LOGE("Check failed: cache.request(paths[2], nullptr) != c\n");
+		return EXIT_FAILURE;
+	}
+
+	stats = cache.get_statistics();
+	if (stats.hits != 2)
+	{
+		LOGE("Check failed: stats.hits == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.misses != 5)
+	{
+		LOGE("Check failed: stats.misses == 5\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.resident_bytes != 2 * AudioSize)
+	{
+		LOGE("Check failed: stats.resident_bytes == 2 * AudioSize\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.evicted_bytes != 3 * AudioSize)
+	{
+		LOGE("Check failed: stats.evicted_bytes == 3 * AudioSize\n");
+		return EXIT_FAILURE;
+	}
+
+	cache.set_memory_budget(0);
+	cache.wait_idle();
+	stats = cache.get_statistics();
+	if (stats.resident_bytes != 0)
+	{
+		LOGE("Check failed: stats.resident_bytes == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (stats.evicted_bytes != 5 * AudioSize)
+	{
+		LOGE("Check failed: stats.evicted_bytes == 5 * AudioSize\n");
+		return EXIT_FAILURE;
+	}
+	if (!has_expected_samples(*a_reloaded, NumChannels, NumFrames))
+	{
+		LOGE("Check failed: has_expected_samples(*a_reloaded, NumChannels, NumFrames)\n");
+		return EXIT_FAILURE;
+	}
+	if (!has_expected_samples(*b, NumChannels, NumFrames))
+	{
+		LOGE("Check failed: has_expected_samples(*b, NumChannels, NumFrames)\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT | Global::MANAGER_FEATURE_THREAD_GROUP_BIT);
+	auto &group = *GRANITE_THREAD_GROUP();
+
+	// The cache is keyed on path, so each path is an independent entry with identical contents.
+	std::vector<std::string> paths;
+	for (unsigned i = 0; i < 3; i++)
+	{
+		paths.push_back("memory://audio" + std::to_string(i) + ".pcm");
+		if (!write_test_audio(paths.back(), NumChannels, NumFrames))
+		{
+			LOGE("Failed to write %s.\n", paths.back().c_str());
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (test_open_failure(group) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_decode_failure() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_sharing(group, paths) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_concurrent_requests(group, paths) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_eviction(group, paths) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	LOGI("All decoded audio cache tests passed.\n");
+}
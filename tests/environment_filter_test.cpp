@@ -0,0 +1,431 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "environment_filter.hpp"
+#include "global_managers_init.hpp"
+#include "thread_group.hpp"
+#include "device.hpp"
+#include "context.hpp"
+#include "utils/image_utils.hpp"
+#include "math.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Granite;
+using namespace Vulkan;
+
+// Radiance which is linear in the direction. Its irradiance is known in closed form,
+// and SH projection of it is exact.
+static const vec3 ambient = vec3(1.0f, 0.5f, 0.25f);
+static const vec3 gradient_x = vec3(0.25f, 0.0f, 0.0f);
+static const vec3 gradient_y = vec3(0.0f, 0.4f, 0.0f);
+static const vec3 gradient_z = vec3(0.0f, 0.0f, 0.2f);
+
+static vec3 linear_radiance(const vec3 &dir)
+{
+	return ambient + gradient_x * dir.x + gradient_y * dir.y + gradient_z * dir.z;
+}
+
+static vec3 linear_irradiance(const vec3 &n)
+{
+	// Cosine convolution scales the linear band by 2/3, and the output is divided by pi.
+	return ambient + (2.0f / 3.0f) * (gradient_x * n.x + gradient_y * n.y + gradient_z * n.z);
+}
+
+// Same conventions as the filter, s and t are texel centers in [-1, 1].
+static vec3 face_direction(unsigned face, unsigned x, unsigned y, unsigned size)
+{
+	float s = 2.0f * (float(x) + 0.5f) / float(size) - 1.0f;
+	float t = 2.0f * (float(y) + 0.5f) / float(size) - 1.0f;
+	static const vec3 dirs[6][3] = {
+		{ vec3(1, 0, 0), vec3(0, 0, -1), vec3(0, -1, 0) },
+		{ vec3(-1, 0, 0), vec3(0, 0, 1), vec3(0, -1, 0) },
+		{ vec3(0, 1, 0), vec3(1, 0, 0), vec3(0, 0, 1) },
+		{ vec3(0, -1, 0), vec3(1, 0, 0), vec3(0, 0, -1) },
+		{ vec3(0, 0, 1), vec3(1, 0, 0), vec3(0, -1, 0) },
+		{ vec3(0, 0, -1), vec3(-1, 0, 0), vec3(0, -1, 0) },
+	};
+	return normalize(dirs[face][0] + s * dirs[face][1] + t * dirs[face][2]);
+}
+
+static vec3 read_texel(const TextureFormatLayout &layout, unsigned x, unsigned y, unsigned layer, unsigned level)
+{
+	if (layout.get_format() == VK_FORMAT_R32G32B32A32_SFLOAT)
+		return layout.data_generic<vec4>(x, y, layer, level)->xyz();
+
+	auto &v = *layout.data_generic<u16vec4>(x, y, layer, level);
+	return vec3(halfToFloat(v.x), halfToFloat(v.y), halfToFloat(v.z));
+}
+
+static MemoryMappedTexture create_equirect(unsigned width, unsigned height)
+{
+	MemoryMappedTexture tex;
+	tex.set_2d(VK_FORMAT_R32G32B32A32_SFLOAT, width, height);
+	if (!tex.map_write_scratch())
+		return {};
+
+	// Inverse of the lat-lon mapping in skybox_latlon.frag.
+	for (unsigned y = 0; y < height; y++)
+	{
+		float theta = ((float(y) + 0.5f) / float(height) - 0.5f) * pi<float>();
+		for (unsigned x = 0; x < width; x++)
+		{
+			float phi = ((float(x) + 0.5f) / float(width) - 0.5f) * 2.0f * pi<float>();
+			vec3 dir = vec3(muglm::cos(theta) * muglm::cos(phi), -muglm::sin(theta), muglm::cos(theta) * muglm::sin(phi));
+			*tex.get_layout().data_generic<vec4>(x, y, 0, 0) = vec4(linear_radiance(dir), 1.0f);
+		}
+	}
+
+	return tex;
+}
+
+static int test_equirect_to_cube(ThreadGroup &group, MemoryMappedTexture &cube)
+{
+	auto equirect = create_equirect(512, 256);
+	if (equirect.empty())
+	{
+		LOGE("Check failed: !equirect.empty()\n");
+		return EXIT_FAILURE;
+	}
+
+	cube = SceneFormats::convert_equirect_to_cube(group, equirect.get_layout(), 1.0f);
+	if (cube.empty())
+	{
+		LOGE("Check failed: !cube.empty()\n");
+		return EXIT_FAILURE;
+	}
+
+	auto &layout = cube.get_layout();
+	if (layout.get_format() != VK_FORMAT_R32G32B32A32_SFLOAT)
+	{
+		LOGE("Check failed: layout.get_format() == VK_FORMAT_R32G32B32A32_SFLOAT\n");
+		return EXIT_FAILURE;
+	}
+	if (layout.get_width() != 170)
+	{
+		LOGE("Check failed: layout.get_width() == 170\n");
+		return EXIT_FAILURE;
+	}
+	if (layout.get_layers() != 6)
+	{
+		LOGE("Check failed: layout.get_layers() == 6\n");
+		return EXIT_FAILURE;
+	}
+	if (layout.get_levels() != TextureFormatLayout::num_miplevels(170))
+	{
+		LOGE("Check failed: layout.get_levels() == TextureFormatLayout::num_miplevels(170)\n");
+		return EXIT_FAILURE;
+	}
+	if ((cube.get_flags() & MEMORY_MAPPED_TEXTURE_CUBE_MAP_COMPATIBLE_BIT) == 0)
+	{
+		LOGE("Check failed: (cube.get_flags() & MEMORY_MAPPED_TEXTURE_CUBE_MAP_COMPATIBLE_BIT) != 0\n");
+		return EXIT_FAILURE;
+	}
+
+	for (unsigned face = 0; face < 6; face++)
+	{
+		for (unsigned y = 0; y < layout.get_height(); y += 7)
+		{
+			for (unsigned x = 0; x < layout.get_width(); x += 7)
+			{
+				vec3 expected = linear_radiance(face_direction(face, x, y, layout.get_width()));
+				vec3 value = read_texel(layout, x, y, face, 0);
+				if (!all(lessThan(abs(value - expected), vec3(0.01f))))
+				{
+					LOGE("Check failed: all(lessThan(abs(value - expected), vec3(0.01f)))\n");
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+	// The 1x1 mip of the +Z face is the face average, which only sees the Z gradient.
+	unsigned last_level = layout.get_levels() - 1;
+	vec3 average = read_texel(layout, 0, 0, 4, last_level);
+	if (muglm::abs(average.x - ambient.x) >= 0.01f)
+	{
+		LOGE("Check failed: muglm::abs(average.x - ambient.x) < 0.01f\n");
+		return EXIT_FAILURE;
+	}
+	if (muglm::abs(average.y - ambient.y) >= 0.01f)
+	{
+		LOGE("Check failed: muglm::abs(average.y - ambient.y) < 0.01f\n");
+		return EXIT_FAILURE;
+	}
+	if (!(average.z > ambient.z && average.z < ambient.z + gradient_z.z))
+	{
+		LOGE("Check failed: average.z > ambient.z && average.z < ambient.z + gradient_z.z\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int test_diffuse(ThreadGroup &group, const MemoryMappedTexture &cube, MemoryMappedTexture &diffuse)
+{
+	diffuse = SceneFormats::convert_cube_to_ibl_diffuse(group, cube.get_layout());
+	if (diffuse.empty())
+	{
+		LOGE("Check failed: !diffuse.empty()\n");
+		return EXIT_FAILURE;
+	}
+
+	auto &layout = diffuse.get_layout();
+	if (layout.get_format() != VK_FORMAT_R16G16B16A16_SFLOAT)
+	{
+		LOGE("Check failed: layout.get_format() == VK_FORMAT_R16G16B16A16_SFLOAT\n");
+		return EXIT_FAILURE;
+	}
+	if (layout.get_width() != 32)
+	{
+		LOGE("Check failed: layout.get_width() == 32\n");
+		return EXIT_FAILURE;
+	}
+	if (layout.get_layers() != 6)
+	{
+		LOGE("Check failed: layout.get_layers() == 6\n");
+		return EXIT_FAILURE;
+	}
+	if (layout.get_levels() != 1)
+	{
+		LOGE("Check failed: layout.get_levels() == 1\n");
+		return EXIT_FAILURE;
+	}
+	if ((diffuse.get_flags() & MEMORY_MAPPED_TEXTURE_GENERATE_MIPMAP_ON_LOAD_BIT) == 0)
+	{
+		LOGE("Check failed: (diffuse.get_flags() & MEMORY_MAPPED_TEXTURE_GENERATE_MIPMAP_ON_LOAD_BIT) != 0\n");
+		return EXIT_FAILURE;
+	}
+
+	for (unsigned face = 0; face < 6; face++)
+	{
+		for (unsigned y = 0; y < 32; y++)
+		{
+			for (unsigned x = 0; x < 32; x++)
+			{
+				vec3 expected = linear_irradiance(face_direction(face, x, y, 32));
+				vec3 value = read_texel(layout, x, y, face, 0);
+				if (!all(lessThan(abs(value - expected), vec3(0.01f))))
+				{
+					LOGE("Check failed: all(lessThan(abs(value - expected), vec3(0.01f)))\n");
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int test_specular(ThreadGroup &group, const MemoryMappedTexture &cube, MemoryMappedTexture &specular)
+{
+	specular = SceneFormats::convert_cube_to_ibl_specular(group, cube.get_layout(), 256);
+	if (specular.empty())
+	{
+		LOGE("Check failed: !specular.empty()\n");
+		return EXIT_FAILURE;
+	}
+
+	auto &layout = specular.get_layout();
+	if (layout.get_format() != VK_FORMAT_R16G16B16A16_SFLOAT)
+	{
+		LOGE("Check failed: layout.get_format() == VK_FORMAT_R16G16B16A16_SFLOAT\n");
+		return EXIT_FAILURE;
+	}
+	if (layout.get_width() != 128)
+	{
+		LOGE("Check failed: layout.get_width() == 128\n");
+		return EXIT_FAILURE;
+	}
+	if (layout.get_layers() != 6)
+	{
+		LOGE("Check failed: layout.get_layers() == 6\n");
+		return EXIT_FAILURE;
+	}
+	if (layout.get_levels() != 8)
+	{
+		LOGE("Check failed: layout.get_levels() == 8\n");
+		return EXIT_FAILURE;
+	}
+
+	for (unsigned face = 0; face < 6; face++)
+	{
+		for (unsigned level = 0; level < 8; level++)
+		{
+			unsigned size = layout.get_width(level);
+			for (unsigned y = 0; y < size; y += 3)
+			{
+				for (unsigned x = 0; x < size; x += 3)
+				{
+					vec3 n = face_direction(face, x, y, size);
+					vec3 value = read_texel(layout, x, y, face, level);
+
+					// The lobe is symmetric around N, so the linear band can only shrink towards the ambient term,
+					// and for a mirror-like lobe the radiance is reproduced.
+					vec3 deviation = value - ambient;
+					vec3 linear = linear_radiance(n) - ambient;
+					if (!all(lessThanEqual(abs(deviation), abs(linear) + 0.01f)))
+					{
+						LOGE("Check failed: all(lessThanEqual(abs(deviation), abs(linear) + 0.01f))\n");
+						return EXIT_FAILURE;
+					}
+					if (level == 0)
+						if (!all(lessThan(abs(value - linear_radiance(n)), vec3(0.02f))))
+						{
+							LOGE("Check failed: all(lessThan(abs(value - linear_radiance(n)), vec3(0.02f)))\n");
+							return EXIT_FAILURE;
+						}
+				}
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static double mean_relative_error(const TextureFormatLayout &a, const TextureFormatLayout &b)
+{
+	double error = 0.0;
+	uint64_t count = 0;
+
+	for (unsigned level = 0; level < a.get_levels(); level++)
+	{
+		for (unsigned layer = 0; layer < a.get_layers(); layer++)
+		{
+			for (unsigned y = 0; y < a.get_height(level); y++)
+			{
+				for (unsigned x = 0; x < a.get_width(level); x++)
+				{
+					vec3 va = read_texel(a, x, y, layer, level);
+					vec3 vb = read_texel(b, x, y, layer, level);
+					vec3 rel = abs(va - vb) / max(abs(vb), vec3(1e-3f));
+					error += double(rel.x + rel.y + rel.z) / 3.0;
+					count++;
+				}
+			}
+		}
+	}
+
+	return count ? error / double(count) : 0.0;
+}
+
+// Only runs when a Vulkan device exists.
+// The GPU filters with seamless cube lookups and a brute force hemisphere integral for irradiance,
+// so outputs are compared on average rather than per texel.
+static int test_against_gpu(const MemoryMappedTexture &cube,
+                            const MemoryMappedTexture &specular, const MemoryMappedTexture &diffuse)
+{
+	if (!Context::init_loader(nullptr))
+	{
+		LOGI("No Vulkan loader, skipping GPU comparison.\n");
+		return EXIT_SUCCESS;
+	}
+
+	Context context;
+	Context::SystemHandles handles;
+	handles.filesystem = GRANITE_FILESYSTEM();
+	handles.thread_group = GRANITE_THREAD_GROUP();
+	context.set_system_handles(handles);
+
+	if (!context.init_instance_and_device(nullptr, 0, nullptr, 0))
+	{
+		LOGI("No Vulkan device, skipping GPU comparison.\n");
+		return EXIT_SUCCESS;
+	}
+
+	Device device;
+	device.set_context(context);
+
+	auto staging = device.create_image_staging_buffer(cube.get_layout());
+	auto info = ImageCreateInfo::immutable_image(cube.get_layout());
+	info.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+	auto image = device.create_image_from_staging_buffer(info, &staging);
+	if (!image)
+	{
+		LOGE("Check failed: image\n");
+		return EXIT_FAILURE;
+	}
+
+	auto gpu_specular = convert_cube_to_ibl_specular(device, image->get_view());
+	auto gpu_diffuse = convert_cube_to_ibl_diffuse(device, image->get_view());
+
+	auto cmd = device.request_command_buffer();
+	cmd->image_barrier(*gpu_specular, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	cmd->image_barrier(*gpu_diffuse, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	device.submit(cmd);
+
+	const struct
+	{
+		const char *name;
+		const Image &gpu;
+		const MemoryMappedTexture &cpu;
+		double tolerance;
+	} comparisons[] = {
+		{ "specular", *gpu_specular, specular, 0.02 },
+		{ "diffuse", *gpu_diffuse, diffuse, 0.03 },
+	};
+
+	for (auto &comparison : comparisons)
+	{
+		auto readback = save_image_to_cpu_buffer(device, comparison.gpu, CommandBuffer::Type::Generic);
+		readback.fence->wait();
+
+		auto *ptr = device.map_host_buffer(*readback.buffer, MEMORY_ACCESS_READ_BIT);
+		readback.layout.set_buffer(ptr, readback.layout.get_required_size());
+		double error = mean_relative_error(comparison.cpu.get_layout(), readback.layout);
+		device.unmap_host_buffer(*readback.buffer, MEMORY_ACCESS_READ_BIT);
+
+		LOGI("GPU vs CPU %s: mean relative error %.4f.\n", comparison.name, error);
+		if (error >= comparison.tolerance)
+		{
+			LOGE("Check failed: error < comparison.tolerance\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	Global::init();
+	auto &group = *GRANITE_THREAD_GROUP();
+
+	MemoryMappedTexture cube, diffuse, specular;
+	if (test_equirect_to_cube(group, cube) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_diffuse(group, cube, diffuse) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_specular(group, cube, specular) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_against_gpu(cube, specular, diffuse) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	LOGI("All environment filter tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,241 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "event.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace Granite;
+
+static constexpr unsigned NumTypes = 8;
+static constexpr unsigned HandlersPerType = 2;
+static constexpr unsigned EventsPerFrame = 64 * 1024;
+static constexpr unsigned NumFrames = 32;
+static constexpr unsigned NumProducers = 4;
+
+template <unsigned Index>
+struct BenchEvent : Event
+{
+	static constexpr EventType get_type_id()
+	{
+		return 0x1000 + Index;
+	}
+
+	explicit BenchEvent(unsigned value_)
+		: value(value_)
+	{
+	}
+
+	unsigned value;
+};
+
+struct Receiver : EventHandler
+{
+	template <typename T>
+	bool on_event(const T &e)
+	{
+		sum += e.value;
+		count++;
+		return true;
+	}
+
+	void reset()
+	{
+		sum = 0;
+		count = 0;
+	}
+
+	uint64_t sum = 0;
+	uint64_t count = 0;
+};
+
+// Replicates the previous EventManager queue, one heap allocation per event,
+// and dispatch visiting every known event type.
+struct LegacyQueue
+{
+	struct TypeData
+	{
+		std::vector<std::unique_ptr<Event>> queued_events;
+		std::vector<std::pair<bool (*)(void *, const Event &), void *>> handlers;
+	};
+	std::unordered_map<EventType, TypeData> events;
+
+	template <typename T, typename... P>
+	void enqueue(P&&... p)
+	{
+		events[T::get_type_id()].queued_events.emplace_back(new T(std::forward<P>(p)...));
+	}
+
+	void dispatch()
+	{
+		for (auto &type : events)
+		{
+			for (auto &handler : type.second.handlers)
+				for (auto &event : type.second.queued_events)
+					handler.first(handler.second, *event);
+			type.second.queued_events.clear();
+		}
+	}
+};
+
+template <unsigned Index>
+static void register_types(EventManager &manager, LegacyQueue &legacy, Receiver *receivers)
+{
+	using T = BenchEvent<Index>;
+	for (unsigned i = 0; i < HandlersPerType; i++)
+	{
+		manager.register_handler<Receiver, T, &Receiver::on_event<T>>(&receivers[i]);
+		legacy.events[T::get_type_id()].handlers.emplace_back(
+				member_function_invoker<bool, Receiver, T, &Receiver::on_event<T>>, &receivers[i]);
+	}
+}
+
+template <typename Queue>
+static void enqueue_frame(Queue &queue, unsigned base, unsigned count)
+{
+	for (unsigned i = base; i < base + count; i += 4)
+	{
+		switch ((i >> 2) & 7)
+		{
+		case 0: queue.template enqueue<BenchEvent<0>>(i); break;
+		case 1: queue.template enqueue<BenchEvent<1>>(i); break;
+		case 2: queue.template enqueue<BenchEvent<2>>(i); break;
+		case 3: queue.template enqueue<BenchEvent<3>>(i); break;
+		case 4: queue.template enqueue<BenchEvent<4>>(i); break;
+		case 5: queue.template enqueue<BenchEvent<5>>(i); break;
+		case 6: queue.template enqueue<BenchEvent<6>>(i); break;
+		default: queue.template enqueue<BenchEvent<7>>(i); break;
+		}
+		queue.template enqueue<BenchEvent<0>>(i + 1);
+		queue.template enqueue<BenchEvent<1>>(i + 2);
+		queue.template enqueue<BenchEvent<2>>(i + 3);
+	}
+}
+
+struct AsyncAdapter
+{
+	EventManager &manager;
+	template <typename T, typename... P>
+	void enqueue(P&&... p)
+	{
+		manager.enqueue_async<T>(std::forward<P>(p)...);
+	}
+};
+
+template <typename Queue>
+static void run_sync(const char *tag, Queue &queue, Receiver *receivers)
+{
+	int64_t enqueue_time = 0;
+	int64_t dispatch_time = 0;
+
+	for (unsigned frame = 0; frame < NumFrames; frame++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		enqueue_frame(queue, 0, EventsPerFrame);
+		auto mid = Util::get_current_time_nsecs();
+		queue.dispatch();
+		auto end = Util::get_current_time_nsecs();
+		enqueue_time += mid - start;
+		dispatch_time += end - mid;
+	}
+
+	double total = double(NumFrames) * EventsPerFrame;
+	LOGI("%-10s enqueue: %6.2f ns/event, dispatch: %6.2f ns/event (%llu deliveries).\n", tag,
+	     double(enqueue_time) / total, double(dispatch_time) / total,
+	     static_cast<unsigned long long>(receivers[0].count + receivers[1].count));
+	for (unsigned i = 0; i < HandlersPerType; i++)
+		receivers[i].reset();
+}
+
+static void run_async(EventManager &manager, Receiver *receivers)
+{
+	int64_t total_time = 0;
+	int64_t dispatch_time = 0;
+
+	for (unsigned frame = 0; frame < NumFrames; frame++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		std::vector<std::thread> threads;
+		for (unsigned t = 0; t < NumProducers; t++)
+		{
+			threads.emplace_back([&manager, t]() {
+				AsyncAdapter adapter{manager};
+				unsigned count = EventsPerFrame / NumProducers;
+				enqueue_frame(adapter, t * count, count);
+			});
+		}
+		for (auto &thread : threads)
+			thread.join();
+		auto mid = Util::get_current_time_nsecs();
+		manager.dispatch();
+		auto end = Util::get_current_time_nsecs();
+		total_time += mid - start;
+		dispatch_time += end - mid;
+	}
+
+	double total = double(NumFrames) * EventsPerFrame;
+	LOGI("%-10s enqueue: %6.2f ns/event, dispatch: %6.2f ns/event (%u producers, %llu deliveries).\n", "async",
+	     double(total_time) / total, double(dispatch_time) / total, NumProducers,
+	     static_cast<unsigned long long>(receivers[0].count + receivers[1].count));
+}
+
+int main()
+{
+	EventManager manager;
+	LegacyQueue legacy;
+	Receiver receivers[HandlersPerType];
+
+	register_types<0>(manager, legacy, receivers);
+	register_types<1>(manager, legacy, receivers);
+	register_types<2>(manager, legacy, receivers);
+	register_types<3>(manager, legacy, receivers);
+	register_types<4>(manager, legacy, receivers);
+	register_types<5>(manager, legacy, receivers);
+	register_types<6>(manager, legacy, receivers);
+	register_types<7>(manager, legacy, receivers);
+
+	// Warm up allocators.
+	enqueue_frame(manager, 0, EventsPerFrame);
+	manager.dispatch();
+	enqueue_frame(legacy, 0, EventsPerFrame);
+	legacy.dispatch();
+	for (auto &r : receivers)
+		r.reset();
+
+	run_sync("legacy", legacy, receivers);
+	run_sync("arena", manager, receivers);
+	run_async(manager, receivers);
+
+	uint64_t expected = uint64_t(NumFrames) * EventsPerFrame * HandlersPerType;
+	if (receivers[0].count + receivers[1].count != expected)
+	{
+		LOGE("Check failed: receivers[0].count + receivers[1].count == expected\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
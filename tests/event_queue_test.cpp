@@ -0,0 +1,268 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "event.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+using namespace Granite;
+
+static unsigned live_events;
+
+struct CountEvent : Event
+{
+	GRANITE_EVENT_TYPE_DECL(CountEvent)
+	explicit CountEvent(unsigned value_, unsigned producer_ = 0)
+		: value(value_), producer(producer_)
+	{
+		live_events++;
+	}
+
+	~CountEvent() override
+	{
+		live_events--;
+	}
+
+	unsigned value;
+	unsigned producer;
+};
+
+struct OtherEvent : Event
+{
+	GRANITE_EVENT_TYPE_DECL(OtherEvent)
+	explicit OtherEvent(unsigned value_)
+		: value(value_)
+	{
+	}
+
+	alignas(64) unsigned value;
+};
+
+struct Receiver : EventHandler
+{
+	bool on_count(const CountEvent &e)
+	{
+		values.push_back(e.value);
+		if (manager && e.value == 0)
+			manager->enqueue<CountEvent>(1000u);
+		return values.size() < remove_after;
+	}
+
+	bool on_other(const OtherEvent &e)
+	{
+		other_values.push_back(e.value);
+		if ((reinterpret_cast<uintptr_t>(&e) & (alignof(OtherEvent) - 1)) != 0)
+			misaligned++;
+		return true;
+	}
+
+	EventManager *manager = nullptr;
+	std::vector<unsigned> values;
+	std::vector<unsigned> other_values;
+	size_t remove_after = size_t(-1);
+	unsigned misaligned = 0;
+};
+
+static int test_ordering_and_lifetime()
+{
+	{
+		EventManager manager;
+		Receiver receiver;
+		receiver.manager = &manager;
+		manager.register_handler<Receiver, CountEvent, &Receiver::on_count>(&receiver);
+		manager.register_handler<Receiver, OtherEvent, &Receiver::on_other>(&receiver);
+
+		for (unsigned frame = 0; frame < 4; frame++)
+		{
+			for (unsigned i = 0; i < 10000; i++)
+			{
+				manager.enqueue<CountEvent>(i);
+				manager.enqueue<OtherEvent>(i);
+			}
+			manager.dispatch();
+
+			// Events enqueued by a handler are deferred to the next dispatch.
+			if (receiver.values.size() != 10000 + (frame ? 1 : 0))
+			{
+				LOGE("Check failed: receiver.values.size() == 10000 + (frame ? 1 : 0)\n");
+				return EXIT_FAILURE;
+			}
+			if (receiver.other_values.size() != 10000)
+			{
+				LOGE("Check failed: receiver.other_values.size() == 10000\n");
+				return EXIT_FAILURE;
+			}
+			size_t offset = frame ? 1 : 0;
+			if (frame)
+				if (receiver.values[0] != 1000)
+				{
+					LOGE("Check failed: receiver.values[0] == 1000\n");
+					return EXIT_FAILURE;
+				}
+			for (unsigned i = 0; i < 10000; i++)
+			{
+				if (receiver.values[i + offset] != i)
+				{
+					LOGE("Check failed: receiver.values[i + offset] == i\n");
+					return EXIT_FAILURE;
+				}
+				if (receiver.other_values[i] != i)
+				{
+					LOGE("Check failed: receiver.other_values[i] == i\n");
+					return EXIT_FAILURE;
+				}
+			}
+			if (live_events != 1)
+			{
+				LOGE("Check failed: live_events == 1\n");
+				return EXIT_FAILURE;
+			}
+			if (receiver.misaligned != 0)
+			{
+				LOGE("Check failed: receiver.misaligned == 0\n");
+				return EXIT_FAILURE;
+			}
+			receiver.values.clear();
+			receiver.other_values.clear();
+		}
+	}
+
+	// The deferred event is destroyed with the manager.
+	if (live_events != 0)
+	{
+		LOGE("Check failed: live_events == 0\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_handler_removal()
+{
+	EventManager manager;
+	Receiver a, b;
+	a.remove_after = 3;
+	manager.register_handler<Receiver, CountEvent, &Receiver::on_count>(&a);
+	manager.register_handler<Receiver, CountEvent, &Receiver::on_count>(&b);
+
+	for (unsigned i = 1; i <= 5; i++)
+		manager.enqueue<CountEvent>(i);
+	manager.dispatch();
+	if (a.values.size() != 3)
+	{
+		LOGE("Check failed: a.values.size() == 3\n");
+		return EXIT_FAILURE;
+	}
+	if (b.values.size() != 5)
+	{
+		LOGE("Check failed: b.values.size() == 5\n");
+		return EXIT_FAILURE;
+	}
+
+	manager.enqueue<CountEvent>(6u);
+	manager.dispatch();
+	if (a.values.size() != 3)
+	{
+		LOGE("Check failed: a.values.size() == 3\n");
+		return EXIT_FAILURE;
+	}
+	if (b.values.size() != 6)
+	{
+		LOGE("Check failed: b.values.size() == 6\n");
+		return EXIT_FAILURE;
+	}
+	if (live_events != 0)
+	{
+		LOGE("Check failed: live_events == 0\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_async_enqueue()
+{
+	constexpr unsigned NumThreads = 4;
+	constexpr unsigned EventsPerThread = 20000;
+
+	EventManager manager;
+	Receiver receiver;
+	manager.register_handler<Receiver, OtherEvent, &Receiver::on_other>(&receiver);
+
+	std::vector<std::thread> threads;
+	std::atomic_uint done{0};
+	for (unsigned t = 0; t < NumThreads; t++)
+	{
+		threads.emplace_back([&, t]() {
+			for (unsigned i = 0; i < EventsPerThread; i++)
+				manager.enqueue_async<OtherEvent>(t * EventsPerThread + i);
+			done.fetch_add(1, std::memory_order_release);
+		});
+	}
+
+	// Dispatch concurrently with the producers.
+	while (done.load(std::memory_order_acquire) != NumThreads)
+		manager.dispatch();
+	for (auto &thread : threads)
+		thread.join();
+	manager.dispatch();
+
+	if (receiver.other_values.size() != NumThreads * EventsPerThread)
+	{
+		LOGE("Check failed: receiver.other_values.size() == NumThreads * EventsPerThread\n");
+		return EXIT_FAILURE;
+	}
+	if (receiver.misaligned != 0)
+	{
+		LOGE("Check failed: receiver.misaligned == 0\n");
+		return EXIT_FAILURE;
+	}
+
+	// Every event is delivered once, and in submission order per producer.
+	std::vector<unsigned> next(NumThreads);
+	for (unsigned i = 0; i < NumThreads; i++)
+		next[i] = i * EventsPerThread;
+	for (auto value : receiver.other_values)
+	{
+		unsigned producer = value / EventsPerThread;
+		if (value != next[producer])
+		{
+			LOGE("Check failed: value == next[producer]\n");
+			return EXIT_FAILURE;
+		}
+		next[producer]++;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	if (test_ordering_and_lifetime() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_handler_removal() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_async_enqueue() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	LOGI("All event queue tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "glyph_atlas.hpp"
+#include "string_helpers.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+static int test_skyline_packer()
+{
+	constexpr unsigned Width = 256;
+	constexpr unsigned Height = 128;
+
+	SkylinePacker packer;
+	packer.init(Width, Height);
+
+	std::vector<uint8_t> coverage(Width * Height);
+	std::mt19937 rnd(1234);
+	std::uniform_int_distribution<unsigned> dist(4, 24);
+
+	unsigned packed = 0;
+	unsigned failures = 0;
+	while (failures < 64)
+	{
+		unsigned w = dist(rnd);
+		unsigned h = dist(rnd);
+		unsigned x, y;
+		if (!packer.pack(w, h, x, y))
+		{
+			failures++;
+			continue;
+		}
+
+		if (x + w > Width)
+		{
+			LOGE("Check failed: x + w <= Width\n");
+			return EXIT_FAILURE;
+		}
+		if (y + h > Height)
+		{
+			LOGE("Check failed: y + h <= Height\n");
+			return EXIT_FAILURE;
+		}
+		for (unsigned j = y; j < y + h; j++)
+		{
+			for (unsigned i = x; i < x + w; i++)
+			{
+				if (coverage[j * Width + i])
+				{
+					LOGE("Check failed: !coverage[j * Width + i]\n");
+					return EXIT_FAILURE;
+				}
+				coverage[j * Width + i] = 1;
+			}
+		}
+		packed++;
+	}
+
+	unsigned used = 0;
+	for (auto c : coverage)
+		used += c;
+	if (used != packer.get_used_area())
+	{
+		LOGE("Check failed: used == packer.get_used_area()\n");
+		return EXIT_FAILURE;
+	}
+
+	float occupancy = float(used) / float(Width * Height);
+	LOGI("Packed %u glyph rects, %.1f %% occupancy.\n", packed, 100.0f * occupancy);
+	if (occupancy <= 0.6f)
+	{
+		LOGE("Check failed: occupancy > 0.6f\n");
+		return EXIT_FAILURE;
+	}
+
+	unsigned x, y;
+	if (packer.pack(Width + 1, 1, x, y))
+	{
+		LOGE("Check failed: !packer.pack(Width + 1, 1, x, y)\n");
+		return EXIT_FAILURE;
+	}
+	if (packer.pack(1, Height + 1, x, y))
+	{
+		LOGE("Check failed: !packer.pack(1, Height + 1, x, y)\n");
+		return EXIT_FAILURE;
+	}
+	packer.reset();
+	if (packer.get_used_area() != 0)
+	{
+		LOGE("Check failed: packer.get_used_area() == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (!packer.pack(Width, Height, x, y))
+	{
+		LOGE("Check failed: packer.pack(Width, Height, x, y)\n");
+		return EXIT_FAILURE;
+	}
+	if (!(x == 0 && y == 0))
+	{
+		LOGE("Check failed: x == 0 && y == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (packer.pack(1, 1, x, y))
+	{
+		LOGE("Check failed: !packer.pack(1, 1, x, y)\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int test_utf8_decode()
+{
+	const char *text = "a\xc3\xa6\xe2\x82\xac\xf0\x9f\x98\x80\xff\xc0\xafz";
+	if (Util::utf8_next_codepoint(text) != 'a')
+	{
+		LOGE("Check failed: Util::utf8_next_codepoint(text) == 'a'\n");
+		return EXIT_FAILURE;
+	}
+	if (Util::utf8_next_codepoint(text) != 0xe6)
+	{
+		LOGE("Check failed: Util::utf8_next_codepoint(text) == 0xe6\n");
+		return EXIT_FAILURE;
+	}
+	if (Util::utf8_next_codepoint(text) != 0x20ac)
+	{
+		LOGE("Check failed: Util::utf8_next_codepoint(text) == 0x20ac\n");
+		return EXIT_FAILURE;
+	}
+	if (Util::utf8_next_codepoint(text) != 0x1f600)
+	{
+		LOGE("Check failed: Util::utf8_next_codepoint(text) == 0x1f600\n");
+		return EXIT_FAILURE;
+	}
+	// Invalid lead byte and overlong encoding.
+	if (Util::utf8_next_codepoint(text) != 0xfffd)
+	{
+		LOGE("Check failed: Util::utf8_next_codepoint(text) == 0xfffd\n");
+		return EXIT_FAILURE;
+	}
+	if (Util::utf8_next_codepoint(text) != 0xfffd)
+	{
+		LOGE("Check failed: Util::utf8_next_codepoint(text) == 0xfffd\n");
+		return EXIT_FAILURE;
+	}
+	if (Util::utf8_next_codepoint(text) != 0xfffd)
+	{
+		LOGE("Check failed: Util::utf8_next_codepoint(text) == 0xfffd\n");
+		return EXIT_FAILURE;
+	}
+	if (Util::utf8_next_codepoint(text) != 'z')
+	{
+		LOGE("Check failed: Util::utf8_next_codepoint(text) == 'z'\n");
+		return EXIT_FAILURE;
+	}
+	if (*text != '\0')
+	{
+		LOGE("Check failed: *text == '\\0'\n");
+		return EXIT_FAILURE;
+	}
+
+	// Truncated sequence must not read past the terminator.
+	const char *truncated = "\xe2\x82";
+	if (Util::utf8_next_codepoint(truncated) != 0xfffd)
+	{
+		LOGE("Check failed: Util::utf8_next_codepoint(truncated) == 0xfffd\n");
+		return EXIT_FAILURE;
+	}
+	if (Util::utf8_next_codepoint(truncated) != 0xfffd)
+	{
+		LOGE("Check failed: Util::utf8_next_codepoint(truncated) == 0xfffd\n");
+		return EXIT_FAILURE;
+	}
+	if (*truncated != '\0')
+	{
+		LOGE("Check failed: *truncated == '\\0'\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	if (test_skyline_packer() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_utf8_decode() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	LOGI("All glyph atlas tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,267 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "memory_mapped_texture.hpp"
+#include "texture_supercompression.hpp"
+#include "thread_group.hpp"
+#include "filesystem.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+
+using namespace Granite;
+using namespace Vulkan;
+
+static int test_codec_round_trip()
+{
+	std::mt19937 rng(1234);
+
+	for (unsigned iter = 0; iter < 64; iter++)
+	{
+		// Mix of incompressible, low entropy and constant data.
+		std::vector<uint8_t> data(1 + rng() % 100000);
+		for (auto &d : data)
+		{
+			switch (iter % 3)
+			{
+			case 0: d = uint8_t(rng()); break;
+			case 1: d = uint8_t(rng() % 4); break;
+			default: d = 0x55; break;
+			}
+		}
+
+		for (auto codec : { TextureSupercompression::LZ, TextureSupercompression::LZShuffled })
+		{
+			std::vector<uint8_t> compressed;
+			if (!supercompress_texture_data(codec, 16, data.data(), data.size(), compressed))
+			{
+				// Only random data should fail to compress.
+				if (!(iter % 3 == 0 || data.size() < 64))
+				{
+					LOGE("Check failed: iter %% 3 == 0 || data.size() < 64\n");
+					return EXIT_FAILURE;
+				}
+				continue;
+			}
+
+			std::vector<uint8_t> decoded(data.size());
+			if (!decompress_texture_data(codec, 16, compressed.data(), compressed.size(),
+			                              decoded.data(), decoded.size()))
+			{
+				LOGE("Check failed: decompress_texture_data(codec, 16, compressed.data(), compressed.size(), decoded.data(), decoded.size())\n");
+				return EXIT_FAILURE;
+			}
+			if (decoded != data)
+			{
+				LOGE("Check failed: decoded == data\n");
+				return EXIT_FAILURE;
+			}
+
+			// Corrupt streams must be rejected, never overrun.
+			compressed.pop_back();
+			decompress_texture_data(codec, 16, compressed.data(), compressed.size(),
+			                        decoded.data(), decoded.size());
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static bool compare_textures(const MemoryMappedTexture &a, const MemoryMappedTexture &b)
+{
+	auto &layout_a = a.get_layout();
+	auto &layout_b = b.get_layout();
+	if (layout_a.get_required_size() != layout_b.get_required_size())
+		return false;
+	if (a.get_flags() != b.get_flags())
+		return false;
+	return memcmp(layout_a.data(), layout_b.data(), layout_a.get_required_size()) == 0;
+}
+
+static int test_container_round_trip()
+{
+	Filesystem fs;
+	fs.register_protocol("tmp", std::make_unique<ScratchFilesystem>());
+
+	MemoryMappedTexture tex;
+	tex.set_2d(VK_FORMAT_R8G8B8A8_UNORM, 64, 64, 3, 7);
+	tex.set_generate_mipmaps_on_load(true);
+	if (!tex.map_write_scratch())
+	{
+		LOGE("Check failed: tex.map_write_scratch()\n");
+		return EXIT_FAILURE;
+	}
+
+	auto &layout = tex.get_layout();
+	for (uint32_t level = 0; level < layout.get_levels(); level++)
+	{
+		auto &mip = layout.get_mip_info(level);
+		for (uint32_t layer = 0; layer < layout.get_layers(); layer++)
+			for (uint32_t y = 0; y < mip.height; y++)
+				for (uint32_t x = 0; x < mip.width; x++)
+					*layout.data_2d<uint32_t>(x, y, layer, level) = (x >> 2) * 0x01020304u + layer * 0x100u + (y >> 3);
+	}
+
+	if (!tex.write_supercompressed(fs, "tmp://tex.gtx"))
+	{
+		LOGE("Check failed: tex.write_supercompressed(fs, \"tmp://tex.gtx\")\n");
+		return EXIT_FAILURE;
+	}
+	auto mapping = fs.open_readonly_mapping("tmp://tex.gtx");
+	if (!mapping)
+	{
+		LOGE("Check failed: mapping\n");
+		return EXIT_FAILURE;
+	}
+	if (!MemoryMappedTexture::is_header(mapping->data(), mapping->get_size()))
+	{
+		LOGE("Check failed: MemoryMappedTexture::is_header(mapping->data(), mapping->get_size())\n");
+		return EXIT_FAILURE;
+	}
+	if (mapping->get_size() >= tex.get_required_size())
+	{
+		LOGE("Check failed: mapping->get_size() < tex.get_required_size()\n");
+		return EXIT_FAILURE;
+	}
+	LOGI("Supercompressed %zu bytes to %zu bytes.\n",
+	     size_t(tex.get_required_size()), size_t(mapping->get_size()));
+
+	// Regular reads decode everything.
+	MemoryMappedTexture decoded;
+	if (!decoded.map_read(mapping))
+	{
+		LOGE("Check failed: decoded.map_read(mapping)\n");
+		return EXIT_FAILURE;
+	}
+	if (decoded.is_supercompressed())
+	{
+		LOGE("Check failed: !decoded.is_supercompressed()\n");
+		return EXIT_FAILURE;
+	}
+	if (!compare_textures(tex, decoded))
+	{
+		LOGE("Check failed: compare_textures(tex, decoded)\n");
+		return EXIT_FAILURE;
+	}
+
+	// Streamed reads decode on demand.
+	MemoryMappedTexture streamed;
+	if (!streamed.map_read_streamed(mapping))
+	{
+		LOGE("Check failed: streamed.map_read_streamed(mapping)\n");
+		return EXIT_FAILURE;
+	}
+	if (!streamed.is_supercompressed())
+	{
+		LOGE("Check failed: streamed.is_supercompressed()\n");
+		return EXIT_FAILURE;
+	}
+	if (streamed.is_level_decoded(0))
+	{
+		LOGE("Check failed: !streamed.is_level_decoded(0)\n");
+		return EXIT_FAILURE;
+	}
+	if (!streamed.decode_levels(4, 3))
+	{
+		LOGE("Check failed: streamed.decode_levels(4, 3)\n");
+		return EXIT_FAILURE;
+	}
+	if (!streamed.is_level_decoded(4))
+	{
+		LOGE("Check failed: streamed.is_level_decoded(4)\n");
+		return EXIT_FAILURE;
+	}
+	if (streamed.is_level_decoded(3))
+	{
+		LOGE("Check failed: !streamed.is_level_decoded(3)\n");
+		return EXIT_FAILURE;
+	}
+
+	ThreadGroup group;
+	group.start(4, 0, {});
+	{
+		auto task = group.create_task();
+		streamed.enqueue_decode(*task, 0);
+		task->flush();
+		task->wait();
+	}
+
+	if (streamed.decode_failed())
+	{
+		LOGE("Check failed: !streamed.decode_failed()\n");
+		return EXIT_FAILURE;
+	}
+	for (uint32_t level = 0; level < layout.get_levels(); level++)
+		if (!streamed.is_level_decoded(level))
+		{
+			LOGE("Check failed: streamed.is_level_decoded(level)\n");
+			return EXIT_FAILURE;
+		}
+	if (!streamed.decode_all())
+	{
+		LOGE("Check failed: streamed.decode_all()\n");
+		return EXIT_FAILURE;
+	}
+	if (!compare_textures(tex, streamed))
+	{
+		LOGE("Check failed: compare_textures(tex, streamed)\n");
+		return EXIT_FAILURE;
+	}
+
+	// Raw subresources must survive as well.
+	if (!tex.write_supercompressed(fs, "tmp://raw.gtx", TextureSupercompression::None))
+	{
+		LOGE("Check failed: tex.write_supercompressed(fs, \"tmp://raw.gtx\", TextureSupercompression::None)\n");
+		return EXIT_FAILURE;
+	}
+	if (!decoded.map_read(fs, "tmp://raw.gtx"))
+	{
+		LOGE("Check failed: decoded.map_read(fs, \"tmp://raw.gtx\")\n");
+		return EXIT_FAILURE;
+	}
+	if (!compare_textures(tex, decoded))
+	{
+		LOGE("Check failed: compare_textures(tex, decoded)\n");
+		return EXIT_FAILURE;
+	}
+
+	// Truncated files must be rejected.
+	std::vector<uint8_t> truncated(mapping->data<uint8_t>(), mapping->data<uint8_t>() + mapping->get_size() - 1);
+	if (decoded.map_copy(truncated.data(), truncated.size()))
+	{
+		LOGE("Check failed: !decoded.map_copy(truncated.data(), truncated.size())\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	if (test_codec_round_trip() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_container_round_trip() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	LOGI("All tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,257 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "image_metrics.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <math.h>
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+// Straightforward double precision reference for the vectorized kernels.
+static void reference_metrics(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b,
+                              unsigned width, unsigned height, ImageMetrics &metrics)
+{
+	double squared = 0.0;
+	metrics = {};
+	for (unsigned i = 0; i < width * height; i++)
+	{
+		unsigned max_diff = 0;
+		for (unsigned c = 0; c < 3; c++)
+		{
+			int d = int(a[4 * i + c]) - int(b[4 * i + c]);
+			squared += double(d * d);
+			max_diff = std::max<unsigned>(max_diff, unsigned(abs(d)));
+		}
+		metrics.max_difference = std::max(metrics.max_difference, max_diff);
+		metrics.differing_pixels += max_diff != 0;
+	}
+	metrics.mse = squared / (3.0 * width * height);
+
+	std::vector<uint8_t> luma_a(width * height), luma_b(width * height);
+	for (unsigned i = 0; i < width * height; i++)
+	{
+		luma_a[i] = uint8_t((77u * a[4 * i] + 150u * a[4 * i + 1] + 29u * a[4 * i + 2] + 128u) >> 8);
+		luma_b[i] = uint8_t((77u * b[4 * i] + 150u * b[4 * i + 1] + 29u * b[4 * i + 2] + 128u) >> 8);
+	}
+
+	unsigned ww = std::min(width, 8u), wh = std::min(height, 8u);
+	double ssim = 0.0;
+	unsigned windows = 0;
+	for (unsigned y = 0; y + wh <= height; y += 4)
+	{
+		for (unsigned x = 0; x + ww <= width; x += 4)
+		{
+			double ma = 0.0, mb = 0.0;
+			for (unsigned j = 0; j < wh; j++)
+				for (unsigned i = 0; i < ww; i++)
+					ma += luma_a[(y + j) * width + x + i], mb += luma_b[(y + j) * width + x + i];
+			ma /= ww * wh;
+			mb /= ww * wh;
+
+			double va = 0.0, vb = 0.0, cov = 0.0;
+			for (unsigned j = 0; j < wh; j++)
+			{
+				for (unsigned i = 0; i < ww; i++)
+				{
+					double da = luma_a[(y + j) * width + x + i] - ma;
+					double db = luma_b[(y + j) * width + x + i] - mb;
+					va += da * da;
+					vb += db * db;
+					cov += da * db;
+				}
+			}
+			va /= ww * wh;
+			vb /= ww * wh;
+			cov /= ww * wh;
+
+			const double C1 = 6.5025, C2 = 58.5225;
+			ssim += ((2.0 * ma * mb + C1) * (2.0 * cov + C2)) / ((ma * ma + mb * mb + C1) * (va + vb + C2));
+			windows++;
+		}
+	}
+	metrics.ssim = ssim / windows;
+}
+
+static ImageMetrics compute_metrics(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b,
+                                    unsigned width, unsigned height, unsigned bands)
+{
+	// Split into bands like the tool does when it runs on several threads.
+	ImageErrorAccumulator acc;
+	std::vector<uint8_t> luma_a(width * height), luma_b(width * height);
+	for (unsigned band = 0; band < bands; band++)
+	{
+		ImageErrorAccumulator partial;
+		unsigned begin = height * band / bands, end = height * (band + 1) / bands;
+		accumulate_image_error(a.data(), b.data(), 4 * width, width, begin, end, partial);
+		compute_image_luma(a.data(), 4 * width, width, begin, end, luma_a.data());
+		compute_image_luma(b.data(), 4 * width, width, begin, end, luma_b.data());
+		acc.merge(partial);
+	}
+
+	unsigned window_rows = get_image_ssim_window_rows(height);
+	for (unsigned band = 0; band < bands; band++)
+	{
+		ImageErrorAccumulator partial;
+		accumulate_image_ssim(luma_a.data(), luma_b.data(), width, height,
+		                      window_rows * band / bands, window_rows * (band + 1) / bands, partial);
+		acc.merge(partial);
+	}
+
+	return finalize_image_metrics(acc, width, height);
+}
+
+static int test_random_images()
+{
+	std::mt19937 rng(1337);
+	static const unsigned sizes[][2] = { { 1, 1 }, { 3, 7 }, { 8, 8 }, { 13, 9 }, { 64, 64 }, { 4101, 5 }, { 257, 131 } };
+
+	for (auto &size : sizes)
+	{
+		unsigned width = size[0], height = size[1];
+		std::vector<uint8_t> a(4 * width * height), b(4 * width * height);
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			a[i] = uint8_t(rng());
+			// Mostly similar images with sparse large errors.
+			unsigned r = rng() % 16;
+			b[i] = r == 0 ? uint8_t(rng()) : uint8_t(std::min(255u, a[i] + r % 3));
+		}
+
+		ImageMetrics expected;
+		reference_metrics(a, b, width, height, expected);
+
+		for (unsigned bands : { 1u, 3u })
+		{
+			auto metrics = compute_metrics(a, b, width, height, std::min(bands, height));
+			if (fabs(metrics.mse - expected.mse) > 1e-9 * expected.mse)
+			{
+				LOGE("Check failed: fabs(metrics.mse - expected.mse) <= 1e-9 * expected.mse\n");
+				return EXIT_FAILURE;
+			}
+			if (metrics.max_difference != expected.max_difference)
+			{
+				LOGE("Check failed: metrics.max_difference == expected.max_difference\n");
+				return EXIT_FAILURE;
+			}
+			if (metrics.differing_pixels != expected.differing_pixels)
+			{
+				LOGE("Check failed: metrics.differing_pixels == expected.differing_pixels\n");
+				return EXIT_FAILURE;
+			}
+			if (fabs(metrics.ssim - expected.ssim) >= 1e-9)
+			{
+				LOGE("Check failed: fabs(metrics.ssim - expected.ssim) < 1e-9\n");
+				return EXIT_FAILURE;
+			}
+			if (fabs(metrics.psnr - 10.0 * log10(255.0 * 255.0 / expected.mse)) >= 1e-9)
+			{
+				LOGE("Check failed: fabs(metrics.psnr - 10.0 * log10(255.0 * 255.0 / expected.mse)) < 1e-9\n");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int test_identical_images()
+{
+	std::vector<uint8_t> a(4 * 100 * 50);
+	for (size_t i = 0; i < a.size(); i++)
+		a[i] = uint8_t(i * 7);
+	auto b = a;
+
+	// Alpha does not contribute.
+	for (size_t i = 3; i < b.size(); i += 4)
+		b[i] ^= 0xff;
+
+	auto metrics = compute_metrics(a, b, 100, 50, 2);
+	if (metrics.mse != 0.0)
+	{
+		LOGE("Check failed: metrics.mse == 0.0\n");
+		return EXIT_FAILURE;
+	}
+	if (!isinf(metrics.psnr))
+	{
+		LOGE("Check failed: isinf(metrics.psnr)\n");
+		return EXIT_FAILURE;
+	}
+	if (metrics.ssim != 1.0)
+	{
+		LOGE("Check failed: metrics.ssim == 1.0\n");
+		return EXIT_FAILURE;
+	}
+	if (metrics.max_difference != 0)
+	{
+		LOGE("Check failed: metrics.max_difference == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (metrics.differing_pixels != 0)
+	{
+		LOGE("Check failed: metrics.differing_pixels == 0\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_constant_offset()
+{
+	std::vector<uint8_t> a(4 * 32 * 32, 100), b(4 * 32 * 32, 104);
+	auto metrics = compute_metrics(a, b, 32, 32, 1);
+	if (metrics.mse != 16.0)
+	{
+		LOGE("Check failed: metrics.mse == 16.0\n");
+		return EXIT_FAILURE;
+	}
+	if (metrics.max_difference != 4)
+	{
+		LOGE("Check failed: metrics.max_difference == 4\n");
+		return EXIT_FAILURE;
+	}
+	if (metrics.differing_pixels != 32 * 32)
+	{
+		LOGE("Check failed: metrics.differing_pixels == 32 * 32\n");
+		return EXIT_FAILURE;
+	}
+	if (!(metrics.ssim < 1.0 && metrics.ssim > 0.99))
+	{
+		LOGE("Check failed: metrics.ssim < 1.0 && metrics.ssim > 0.99\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	if (test_random_images() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_identical_images() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_constant_offset() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	LOGI("All image metric tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,219 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "input_capture.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+
+using namespace Granite;
+
+// Flattens everything the tracker dispatches into a string, so a recorded and a replayed session can be compared.
+struct EventLog : InputTrackerHandler
+{
+	std::string log;
+
+	void append(const char *fmt, double a = 0.0, double b = 0.0, double c = 0.0, double d = 0.0)
+	{
+		char line[256];
+		snprintf(line, sizeof(line), fmt, a, b, c, d);
+		log += line;
+	}
+
+	void dispatch(const TouchDownEvent &e) override { append("touch-down %g %g %g\n", e.get_id(), e.get_x(), e.get_y()); }
+	void dispatch(const TouchUpEvent &e) override { append("touch-up %g %g %g\n", e.get_id(), e.get_x(), e.get_y()); }
+	void dispatch(const TouchGestureEvent &e) override { append("gesture %g\n", e.get_state().active_pointers); }
+	void dispatch(const JoypadButtonEvent &e) override { append("joy-button %g %g %g\n", e.get_index(), double(e.get_key()), double(e.get_state())); }
+	void dispatch(const JoypadAxisEvent &e) override { append("joy-axis %g %g %g\n", e.get_index(), double(e.get_axis()), e.get_value()); }
+	void dispatch(const KeyboardEvent &e) override { append("key %g %g\n", double(e.get_key()), double(e.get_key_state())); }
+	void dispatch(const OrientationEvent &e) override { append("orientation %g %g %g %g\n", e.get_rotation().x, e.get_rotation().y, e.get_rotation().z, e.get_rotation().w); }
+	void dispatch(const MouseButtonEvent &e) override { append("button %g %g %g %g\n", double(e.get_button()), e.get_abs_x(), e.get_abs_y(), e.get_pressed()); }
+	void dispatch(const MouseMoveEvent &e) override { append("move %.17g %.17g %.17g %.17g\n", e.get_delta_x(), e.get_delta_y(), e.get_abs_x(), e.get_abs_y()); }
+	void dispatch(const JoypadStateEvent &e) override { append("joy-state %.17g %g\n", e.get_delta_time(), e.get_state(0).get_axis(JoypadAxis::LeftX)); }
+	void dispatch(const InputStateEvent &e) override { append("state %.17g %.17g %.17g\n", e.get_delta_time(), e.get_mouse_x(), e.get_mouse_y()); }
+	void dispatch(const JoypadConnectionEvent &e) override { append("joy-connect %g %g\n", e.get_index(), e.is_connected()); }
+};
+
+static void run_session(InputTracker &tracker, InputCapture &capture)
+{
+	static const double time_steps[] = { 1.0 / 60.0, 1.0 / 59.7, 1.0 / 61.3, 1.0 / 60.0 };
+
+	tracker.set_touch_resolution(1280, 720);
+	tracker.set_relative_mouse_speed(0.5, 0.25);
+	tracker.mouse_enter(100.0, 200.0);
+	tracker.enable_joypad(0, 0x45e, 0x2ea);
+	capture.commit_frame(time_steps[0]);
+	tracker.dispatch_current_state(time_steps[0]);
+
+	tracker.key_event(Key::W, KeyState::Pressed);
+	tracker.mouse_move_event_relative(3.3, -1.7);
+	tracker.mouse_button_event(MouseButton::Left, true);
+	tracker.joyaxis_state(0, JoypadAxis::LeftX, 0.75f);
+	capture.commit_frame(time_steps[1]);
+	tracker.dispatch_current_state(time_steps[1]);
+
+	tracker.mouse_move_event_absolute_normalized(0.25, 0.5);
+	tracker.joypad_key_state(0, JoypadKey::South, JoypadKeyState::Pressed);
+	tracker.on_touch_down(7, 10.0f, 20.0f);
+	tracker.on_touch_move(7, 15.0f, 25.0f);
+	tracker.dispatch_touch_gesture();
+	tracker.on_touch_up(7, 16.0f, 26.0f);
+	tracker.orientation_event(quat(0.5f, 0.5f, 0.5f, 0.5f));
+	capture.commit_frame(time_steps[2]);
+	tracker.dispatch_current_state(time_steps[2]);
+
+	tracker.key_event(Key::W, KeyState::Released);
+	tracker.mouse_button_event(MouseButton::Left, false);
+	tracker.mouse_leave();
+	tracker.disable_joypad(0, 0x45e, 0x2ea);
+	capture.commit_frame(time_steps[3]);
+	capture.record_camera(vec3(1.0f, 2.0f, 3.0f), quat(0.1f, 0.2f, 0.3f, 0.4f));
+	tracker.dispatch_current_state(time_steps[3]);
+}
+
+int main()
+{
+	EventLog recorded;
+	InputCapture capture;
+	{
+		InputTracker tracker;
+		tracker.set_input_handler(&recorded);
+		tracker.set_capture(&capture);
+		run_session(tracker, capture);
+	}
+
+	capture.set_resolution(1280, 720);
+	if (capture.get_frame_count() != 4)
+	{
+		LOGE("Check failed: capture.get_frame_count() == 4\n");
+		return EXIT_FAILURE;
+	}
+	if (capture.get_current_frame() != &capture.get_frame(3))
+	{
+		LOGE("Check failed: capture.get_current_frame() == &capture.get_frame(3)\n");
+		return EXIT_FAILURE;
+	}
+
+	InputCapture parsed;
+	if (!parsed.parse(capture.serialize()))
+	{
+		LOGE("Check failed: parsed.parse(capture.serialize())\n");
+		return EXIT_FAILURE;
+	}
+	if (parsed.get_frame_count() != 4)
+	{
+		LOGE("Check failed: parsed.get_frame_count() == 4\n");
+		return EXIT_FAILURE;
+	}
+	if (!(parsed.get_width() == 1280 && parsed.get_height() == 720))
+	{
+		LOGE("Check failed: parsed.get_width() == 1280 && parsed.get_height() == 720\n");
+		return EXIT_FAILURE;
+	}
+	if (parsed.serialize() != capture.serialize())
+	{
+		LOGE("Check failed: parsed.serialize() == capture.serialize()\n");
+		return EXIT_FAILURE;
+	}
+
+	EventLog replayed;
+	InputTracker tracker;
+	tracker.set_input_handler(&replayed);
+	tracker.set_touch_resolution(1280, 720);
+	tracker.set_relative_mouse_speed(0.5, 0.25);
+
+	if (parsed.peek_next_frame() != &parsed.get_frame(0))
+	{
+		LOGE("Check failed: parsed.peek_next_frame() == &parsed.get_frame(0)\n");
+		return EXIT_FAILURE;
+	}
+	unsigned replayed_frames = 0;
+	while (const auto *frame = parsed.replay_next_frame(tracker))
+	{
+		if (parsed.get_current_frame() != frame)
+		{
+			LOGE("Check failed: parsed.get_current_frame() == frame\n");
+			return EXIT_FAILURE;
+		}
+		tracker.dispatch_current_state(frame->time_step);
+		replayed_frames++;
+	}
+
+	if (replayed_frames != 4)
+	{
+		LOGE("Check failed: replayed_frames == 4\n");
+		return EXIT_FAILURE;
+	}
+	if (parsed.peek_next_frame() != nullptr)
+	{
+		LOGE("Check failed: parsed.peek_next_frame() == nullptr\n");
+		return EXIT_FAILURE;
+	}
+	if (parsed.get_frame(2).has_camera)
+	{
+		LOGE("Check failed: !parsed.get_frame(2).has_camera\n");
+		return EXIT_FAILURE;
+	}
+	if (!parsed.get_frame(3).has_camera)
+	{
+		LOGE("Check failed: parsed.get_frame(3).has_camera\n");
+		return EXIT_FAILURE;
+	}
+	if (parsed.get_frame(3).camera.position.y != 2.0f)
+	{
+		LOGE("Check failed: parsed.get_frame(3).camera.position.y == 2.0f\n");
+		return EXIT_FAILURE;
+	}
+	if (parsed.get_frame(3).camera.rotation.w != 0.1f)
+	{
+		LOGE("Check failed: parsed.get_frame(3).camera.rotation.w == 0.1f\n");
+		return EXIT_FAILURE;
+	}
+
+	if (replayed.log != recorded.log)
+	{
+		LOGE("Replayed event stream differs.\nRecorded:\n%s\nReplayed:\n%s\n",
+		     recorded.log.c_str(), replayed.log.c_str());
+		return EXIT_FAILURE;
+	}
+
+	// Malformed captures are rejected.
+	if (parsed.parse("granite-input-capture 1\nframe 0.016 2\nevent 0 0 1 0 0 0 0 0\n"))
+	{
+		LOGE("Check failed: !parsed.parse(\"granite-input-capture 1\\nframe 0.016 2\\nevent 0 0 1 0 0 0 0 0\\n\")\n");
+		return EXIT_FAILURE;
+	}
+	if (parsed.parse("not-a-capture 1\n"))
+	{
+		LOGE("Check failed: !parsed.parse(\"not-a-capture 1\\n\")\n");
+		return EXIT_FAILURE;
+	}
+	if (parsed.parse("granite-input-capture 1\nframe 0.016 1\nevent 99 0 0 0 0 0 0 0\n"))
+	{
+		LOGE("Check failed: !parsed.parse(\"granite-input-capture 1\\nframe 0.016 1\\nevent 99 0 0 0 0 0 0 0\\n\")\n");
+		return EXIT_FAILURE;
+	}
+
+	LOGI("Input capture round-trip OK (%zu bytes of dispatched events).\n", recorded.log.size());
+	return EXIT_SUCCESS;
+}
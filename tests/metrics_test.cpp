@@ -0,0 +1,197 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "metrics.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Util;
+
+static constexpr unsigned NumThreads = 4;
+static constexpr unsigned OpsPerThread = 1000000;
+
+static double hammer(MetricCounter *counter, MetricHistogram *histogram)
+{
+	auto start = get_current_time_nsecs();
+	for (unsigned i = 0; i < OpsPerThread; i++)
+	{
+		counter->add();
+		histogram->record(i & 1023);
+	}
+	auto end = get_current_time_nsecs();
+	return double(end - start) / OpsPerThread;
+}
+
+static std::string read_file(const std::string &path)
+{
+	std::string str;
+	FILE *file = fopen(path.c_str(), "r");
+	if (!file)
+		return str;
+
+	char buffer[4096];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) != 0)
+		str.append(buffer, count);
+	fclose(file);
+	return str;
+}
+
+int main(int argc, char **argv)
+{
+	std::string prefix = argc >= 2 ? argv[1] : "metrics-test";
+	auto &registry = MetricsRegistry::get();
+
+	auto *counter = registry.counter("test.counter");
+	auto *gauge = registry.gauge("test.gauge");
+	auto *histogram = registry.histogram("test.histogram");
+	if (!(counter && gauge && histogram))
+	{
+		LOGE("Check failed: counter && gauge && histogram\n");
+		return EXIT_FAILURE;
+	}
+	if (registry.counter("test.counter") != counter)
+	{
+		LOGE("Check failed: registry.counter(\"test.counter\") == counter\n");
+		return EXIT_FAILURE;
+	}
+	// Type mismatches are rejected rather than aliased.
+	if (registry.gauge("test.counter") != nullptr)
+	{
+		LOGE("Check failed: registry.gauge(\"test.counter\") == nullptr\n");
+		return EXIT_FAILURE;
+	}
+
+	registry.set_history_enabled(true);
+
+	// Frame 0: known values.
+	counter->add(10);
+	gauge->set(-5);
+	histogram->record(1000);
+	histogram->record(3000);
+	registry.end_frame();
+
+	// Frame 1: uncontended updates, then contended updates from several threads.
+	double single_thread_ns = hammer(counter, histogram);
+	std::vector<std::thread> threads;
+	double ns_per_op[NumThreads];
+	for (unsigned i = 0; i < NumThreads; i++)
+		threads.emplace_back([&, i]() { ns_per_op[i] = hammer(counter, histogram); });
+	for (auto &t : threads)
+		t.join();
+	gauge->add(20);
+	registry.end_frame();
+
+	// Frame 2: a metric registered late.
+	registry.counter("test.late")->add(7);
+	registry.end_frame();
+	registry.set_history_enabled(false);
+
+	if (registry.get_frame_count() != 3)
+	{
+		LOGE("Check failed: registry.get_frame_count() == 3\n");
+		return EXIT_FAILURE;
+	}
+	if (counter->read() != 10 + uint64_t(NumThreads + 1) * OpsPerThread)
+	{
+		LOGE("Check failed: counter->read() == 10 + uint64_t(NumThreads + 1) * OpsPerThread\n");
+		return EXIT_FAILURE;
+	}
+
+	MetricHistogram::Snapshot snapshot;
+	histogram->read(snapshot);
+	if (snapshot.count != 2 + uint64_t(NumThreads + 1) * OpsPerThread)
+	{
+		LOGE("Check failed: snapshot.count == 2 + uint64_t(NumThreads + 1) * OpsPerThread\n");
+		return EXIT_FAILURE;
+	}
+	// 1000 and 3000 land in [512, 1024) and [2048, 4096), everything else is below 1024.
+	if (snapshot.buckets[12] != 1)
+	{
+		LOGE("Check failed: snapshot.buckets[12] == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (snapshot.quantile_ns(0.5) > 1024)
+	{
+		LOGE("Check failed: snapshot.quantile_ns(0.5) <= 1024\n");
+		return EXIT_FAILURE;
+	}
+
+	LOGI("Single thread: %.1f ns per counter add + histogram record.\n", single_thread_ns);
+	// Per-thread wall clock, this includes time spent descheduled when threads outnumber cores.
+	for (unsigned i = 0; i < NumThreads; i++)
+		LOGI("Thread %u: %.1f ns per counter add + histogram record (%u hardware threads).\n",
+		     i, ns_per_op[i], std::thread::hardware_concurrency());
+
+	auto csv_path = prefix + ".csv";
+	auto json_path = prefix + ".json";
+	if (!registry.write(csv_path))
+	{
+		LOGE("Check failed: registry.write(csv_path)\n");
+		return EXIT_FAILURE;
+	}
+	if (!registry.write(json_path))
+	{
+		LOGE("Check failed: registry.write(json_path)\n");
+		return EXIT_FAILURE;
+	}
+
+	auto csv = read_file(csv_path);
+	if (csv.find("frame,test.counter,test.gauge,test.histogram.count,test.histogram.mean_us,"
+	               "test.histogram.p50_us,test.histogram.p99_us,test.late\n") != 0)
+	{
+		LOGE("Check failed: csv.find(\"frame,test.counter,test.gauge,test.histogram.count,test.histogram.mean_us,\" \"test.histogram.p50_us,test.histogram.p99_us,test.late\\n\") == 0\n");
+		return EXIT_FAILURE;
+	}
+	if (csv.find("\n0,10,-5,2,2.000,1.024,4.096,0\n") == std::string::npos)
+	{
+		LOGE("Check failed: csv.find(\"\\n0,10,-5,2,2.000,1.024,4.096,0\\n\") != std::string::npos\n");
+		return EXIT_FAILURE;
+	}
+	if (csv.find("\n2,0,15,0,0.000,0.000,0.000,7\n") == std::string::npos)
+	{
+		LOGE("Check failed: csv.find(\"\\n2,0,15,0,0.000,0.000,0.000,7\\n\") != std::string::npos\n");
+		return EXIT_FAILURE;
+	}
+
+	auto json = read_file(json_path);
+	if (json.find("\"frames\": 3") == std::string::npos)
+	{
+		LOGE("Check failed: json.find(\"\\\"frames\\\": 3\") != std::string::npos\n");
+		return EXIT_FAILURE;
+	}
+	if (json.find("\"type\": \"histogram\"") == std::string::npos)
+	{
+		LOGE("Check failed: json.find(\"\\\"type\\\": \\\"histogram\\\"\") != std::string::npos\n");
+		return EXIT_FAILURE;
+	}
+
+	remove(csv_path.c_str());
+	remove(json_path.c_str());
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "global_managers_init.hpp"
+#include "render_graph.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <string>
+#include <stdlib.h>
+
+using namespace Granite;
+
+// Bakes synthetic render graphs without a device.
+// Only the CPU side of bake() is exercised, no physical resources are created.
+
+static void build_graph(RenderGraph &graph, unsigned num_passes, unsigned width, unsigned height, bool debug_pass)
+{
+	graph.reset();
+
+	ResourceDimensions dim;
+	dim.width = width;
+	dim.height = height;
+	dim.format = VK_FORMAT_B8G8R8A8_UNORM;
+	graph.set_backbuffer_dimensions(dim);
+
+	AttachmentInfo color;
+	color.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+	AttachmentInfo half;
+	half.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+	half.size_x = 0.5f;
+	half.size_y = 0.5f;
+
+	BufferInfo buffer;
+	buffer.size = 64 * 1024;
+	buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+	for (unsigned i = 0; i < num_passes; i++)
+	{
+		auto name = std::to_string(i);
+		bool last = i + 1 == num_passes;
+
+		if (!last && (i % 5) == 4)
+		{
+			// Compute passes which feed storage buffers to later passes.
+			auto &pass = graph.add_pass("compute-" + name, RENDER_GRAPH_QUEUE_COMPUTE_BIT);
+			pass.add_texture_input("rt-" + std::to_string(i - 1));
+			pass.add_storage_output("buf-" + name, buffer);
+			pass.add_storage_texture_output("rt-" + name, color);
+		}
+		else
+		{
+			auto &pass = graph.add_pass("pass-" + name, RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+			pass.add_color_output(last ? "backbuffer" : ("rt-" + name), (i & 1) ? half : color);
+
+			// Chain and a few longer range edges to form diamonds in the graph.
+			if (i >= 1)
+				pass.add_texture_input("rt-" + std::to_string(i - 1));
+			if (i >= 7 && (i % 3) == 0)
+				pass.add_texture_input("rt-" + std::to_string(i - 7));
+			if (i >= 6 && (i % 5) == 1)
+				pass.add_storage_read_only_input("buf-" + std::to_string(i - 2));
+		}
+	}
+
+	if (debug_pass)
+	{
+		// Never reaches the backbuffer, so it is culled.
+		auto &pass = graph.add_pass("debug", RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+		pass.add_texture_input("rt-0");
+		pass.add_color_output("debug", color);
+	}
+
+	graph.set_backbuffer_source("backbuffer");
+}
+
+static double bake_time_ms(RenderGraph &graph, unsigned num_passes, unsigned width, unsigned height, bool debug_pass)
+{
+	build_graph(graph, num_passes, width, height, debug_pass);
+	auto start = Util::get_current_time_nsecs();
+	graph.bake();
+	auto end = Util::get_current_time_nsecs();
+	return 1e-6 * double(end - start);
+}
+
+// The graph was just baked from the schedule cache, rebuild the same graph from scratch and compare.
+static bool matches_cold_bake(const RenderGraph &graph, RenderGraph &reference,
+                              unsigned num_passes, unsigned width, unsigned height, bool debug_pass)
+{
+	reference.clear_bake_cache();
+	build_graph(reference, num_passes, width, height, debug_pass);
+	reference.bake();
+	return graph.has_same_schedule(reference);
+}
+
+int main(int argc, char **argv)
+{
+	Global::init(Global::MANAGER_FEATURE_EVENT_BIT);
+
+	unsigned num_passes = argc >= 2 ? unsigned(strtoul(argv[1], nullptr, 0)) : 200;
+	unsigned iterations = argc >= 3 ? unsigned(strtoul(argv[2], nullptr, 0)) : 20;
+	if (num_passes < 2 || iterations == 0)
+	{
+		LOGE("Usage: render-graph-bake-bench [num passes] [iterations]\n");
+		return EXIT_FAILURE;
+	}
+
+	{
+		RenderGraph graph;
+		RenderGraph reference;
+		double cold = 0.0;
+		double resize = 0.0;
+		double toggle = 0.0;
+
+		for (unsigned i = 0; i < iterations; i++)
+		{
+			graph.clear_bake_cache();
+			cold += bake_time_ms(graph, num_passes, 1920, 1080, false);
+			resize += bake_time_ms(graph, num_passes, 1280 + 16 * i, 720 + 8 * i, false);
+			if (!matches_cold_bake(graph, reference, num_passes, 1280 + 16 * i, 720 + 8 * i, false))
+			{
+				LOGE("Cached schedule after resize does not match a cold bake.\n");
+				return EXIT_FAILURE;
+			}
+
+			toggle += bake_time_ms(graph, num_passes, 1280 + 16 * i, 720 + 8 * i, true);
+			if (!matches_cold_bake(graph, reference, num_passes, 1280 + 16 * i, 720 + 8 * i, true))
+			{
+				LOGE("Cached schedule with culled pass does not match a cold bake.\n");
+				return EXIT_FAILURE;
+			}
+		}
+
+		LOGI("Baked %u passes, %u iterations.\n", num_passes, iterations);
+		LOGI("  Cold bake:               %8.3f ms\n", cold / iterations);
+		LOGI("  Rebake after resize:     %8.3f ms\n", resize / iterations);
+		LOGI("  Rebake with culled pass: %8.3f ms\n", toggle / iterations);
+	}
+
+	Global::deinit();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "render_queue.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <vector>
+
+using namespace Granite;
+
+struct TestDrawInfo
+{
+	uint32_t value;
+};
+
+static void test_render(Vulkan::CommandBuffer &, const RenderQueueData *, unsigned)
+{
+}
+
+static void push_draw(RenderQueue &queue, Util::Hash key, uint64_t sorting_key, const uint32_t *instance)
+{
+	auto *info = queue.push<TestDrawInfo>(Queue::Opaque, key, sorting_key, test_render,
+	                                      const_cast<uint32_t *>(instance));
+	if (info)
+		info->value = uint32_t(key);
+}
+
+static int test_capture()
+{
+	RenderQueue queue;
+	std::vector<RenderQueue::CapturedDraw> captured;
+	static const uint32_t instances[4] = { 0, 1, 2, 3 };
+
+	push_draw(queue, 1, 10, &instances[0]);
+	queue.set_capture_target(&captured);
+	push_draw(queue, 1, 10, &instances[1]);
+	push_draw(queue, 2, 20, &instances[2]);
+	queue.set_capture_target(nullptr);
+	push_draw(queue, 2, 20, &instances[3]);
+
+	// Pushes which reuse existing render info are captured too.
+	if (captured.size() != 2)
+	{
+		LOGE("Check failed: captured.size() == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (!(captured[0].instance_key == 1 && captured[0].sorting_key == 10))
+	{
+		LOGE("Check failed: captured[0].instance_key == 1 && captured[0].sorting_key == 10\n");
+		return EXIT_FAILURE;
+	}
+	if (captured[0].render != test_render)
+	{
+		LOGE("Check failed: captured[0].render == test_render\n");
+		return EXIT_FAILURE;
+	}
+	if (captured[0].instance_data != &instances[1])
+	{
+		LOGE("Check failed: captured[0].instance_data == &instances[1]\n");
+		return EXIT_FAILURE;
+	}
+	if (static_cast<const TestDrawInfo *>(captured[0].render_info)->value != 1)
+	{
+		LOGE("Check failed: static_cast<const TestDrawInfo *>(captured[0].render_info)->value == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (!(captured[1].instance_key == 2 && captured[1].queue == Queue::Opaque))
+	{
+		LOGE("Check failed: captured[1].instance_key == 2 && captured[1].queue == Queue::Opaque\n");
+		return EXIT_FAILURE;
+	}
+	if (captured[1].instance_data != &instances[2])
+	{
+		LOGE("Check failed: captured[1].instance_data == &instances[2]\n");
+		return EXIT_FAILURE;
+	}
+	if (static_cast<const TestDrawInfo *>(captured[1].render_info)->value != 2)
+	{
+		LOGE("Check failed: static_cast<const TestDrawInfo *>(captured[1].render_info)->value == 2\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_replay()
+{
+	RenderQueue queue;
+	std::vector<RenderQueue::CapturedDraw> captured;
+	static const uint32_t instances[3] = { 0, 1, 2 };
+
+	queue.set_capture_target(&captured);
+	push_draw(queue, 1, 10, &instances[0]);
+	push_draw(queue, 2, 20, &instances[1]);
+	queue.set_capture_target(nullptr);
+
+	// Captured pointers die with the queue contents, so copy out what a retained batch would keep.
+	std::vector<RenderQueue::CapturedDraw> draws = captured;
+	std::vector<TestDrawInfo> infos;
+	for (auto &draw : captured)
+		infos.push_back(*static_cast<const TestDrawInfo *>(draw.render_info));
+
+	queue.reset();
+	for (size_t i = 0; i < draws.size(); i++)
+	{
+		auto &draw = draws[i];
+		auto *info = queue.push<TestDrawInfo>(draw.queue, draw.instance_key, draw.sorting_key, draw.render,
+		                                      const_cast<void *>(draw.instance_data));
+		if (info)
+			*info = infos[i];
+	}
+
+	// A regular push after the replay still batches with the replayed draw.
+	push_draw(queue, 1, 10, &instances[2]);
+	queue.sort();
+
+	struct Batch
+	{
+		uint32_t value;
+		unsigned instances;
+	};
+	std::vector<Batch> batches;
+	queue.enumerate_batches(Queue::Opaque, 0, queue.get_dispatch_size(Queue::Opaque),
+	                        [&](const RenderQueueData *data, unsigned count) {
+		batches.push_back({ static_cast<const TestDrawInfo *>(data->render_info)->value, count });
+	});
+
+	if (batches.size() != 2)
+	{
+		LOGE("Check failed: batches.size() == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (!(batches[0].value == 1 && batches[0].instances == 2))
+	{
+		LOGE("Check failed: batches[0].value == 1 && batches[0].instances == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (!(batches[1].value == 2 && batches[1].instances == 1))
+	{
+		LOGE("Check failed: batches[1].value == 2 && batches[1].instances == 1\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	if (test_capture() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_replay() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	LOGI("All render queue capture tests passed.\n");
+	return EXIT_SUCCESS;
+}
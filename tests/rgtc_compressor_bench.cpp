@@ -0,0 +1,215 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "global_managers_init.hpp"
+#include "texture_compression.hpp"
+#include "rgtc_compressor.hpp"
+#include "memory_mapped_texture.hpp"
+#include "thread_group.hpp"
+#include "filesystem.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include "math.hpp"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+// Synthetic tangent space normal map, smooth bumps with some high frequency noise.
+static std::shared_ptr<Vulkan::MemoryMappedTexture> create_normal_map(unsigned size)
+{
+	auto tex = std::make_shared<Vulkan::MemoryMappedTexture>();
+	tex->set_2d(VK_FORMAT_R8G8B8A8_UNORM, size, size);
+	if (!tex->map_write_scratch())
+		return {};
+
+	std::mt19937 rng(1337);
+	auto &layout = tex->get_layout();
+	for (unsigned y = 0; y < size; y++)
+	{
+		for (unsigned x = 0; x < size; x++)
+		{
+			float nx = 0.5f * sinf(float(x) * 0.031f) * cosf(float(y) * 0.017f);
+			float ny = 0.5f * cosf(float(x) * 0.013f + float(y) * 0.029f);
+			int noise_x = int(rng() % 25) - 12;
+			int noise_y = int(rng() % 25) - 12;
+			auto *texel = layout.data_2d<u8vec4>(x, y);
+			texel->x = uint8_t(std::min(std::max(int((nx * 0.5f + 0.5f) * 255.0f) + noise_x, 0), 255));
+			texel->y = uint8_t(std::min(std::max(int((ny * 0.5f + 0.5f) * 255.0f) + noise_y, 0), 255));
+			texel->z = 255;
+			texel->w = 255;
+		}
+	}
+
+	return tex;
+}
+
+static void gather_blocks(const Vulkan::MemoryMappedTexture &tex, std::vector<uint8_t> &red, std::vector<uint8_t> &green)
+{
+	auto &layout = tex.get_layout();
+	unsigned blocks_x = layout.get_width() / 4;
+	unsigned blocks_y = layout.get_height() / 4;
+	red.resize(blocks_x * blocks_y * 16);
+	green.resize(blocks_x * blocks_y * 16);
+
+	for (unsigned by = 0; by < blocks_y; by++)
+	{
+		for (unsigned bx = 0; bx < blocks_x; bx++)
+		{
+			for (unsigned i = 0; i < 16; i++)
+			{
+				auto *texel = layout.data_2d<u8vec4>(bx * 4 + (i & 3), by * 4 + (i >> 2));
+				red[(by * blocks_x + bx) * 16 + i] = texel->x;
+				green[(by * blocks_x + bx) * 16 + i] = texel->y;
+			}
+		}
+	}
+}
+
+static double compute_psnr(const uint8_t *encoded, unsigned encoded_stride, const std::vector<uint8_t> &reference)
+{
+	size_t num_blocks = reference.size() / 16;
+	double error = 0.0;
+	for (size_t block = 0; block < num_blocks; block++)
+	{
+		uint8_t decoded[16];
+		decompress_rgtc_red_block(decoded, encoded + block * encoded_stride);
+		for (unsigned i = 0; i < 16; i++)
+		{
+			double diff = double(decoded[i]) - double(reference[block * 16 + i]);
+			error += diff * diff;
+		}
+	}
+
+	error /= double(reference.size());
+	return error > 0.0 ? 10.0 * log10(255.0 * 255.0 / error) : INFINITY;
+}
+
+int main(int argc, char **argv)
+{
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT | Global::MANAGER_FEATURE_THREAD_GROUP_BIT);
+
+	unsigned size = argc >= 2 ? unsigned(strtoul(argv[1], nullptr, 0)) : 2048;
+	if (size < 4 || (size & 3) != 0)
+	{
+		LOGE("Usage: rgtc-compressor-bench [size, multiple of 4]\n");
+		return EXIT_FAILURE;
+	}
+
+	auto input = create_normal_map(size);
+	if (!input)
+		return EXIT_FAILURE;
+
+	std::vector<uint8_t> red, green;
+	gather_blocks(*input, red, green);
+	unsigned num_blocks = unsigned(red.size() / 16);
+	double mpixels = double(size) * double(size) * 1e-6;
+
+	// Single threaded encoder throughput.
+	std::vector<uint8_t> reference(num_blocks * 16);
+	std::vector<uint8_t> batched(num_blocks * 16);
+
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned block = 0; block < num_blocks; block++)
+		compress_rgtc_red_green_block(&reference[block * 16], &red[block * 16], &green[block * 16]);
+	auto end = Util::get_current_time_nsecs();
+	double reference_time = 1e-9 * double(end - start);
+
+	start = Util::get_current_time_nsecs();
+	compress_rgtc_red_green_blocks(batched.data(), red.data(), green.data(), num_blocks);
+	end = Util::get_current_time_nsecs();
+	double batched_time = 1e-9 * double(end - start);
+
+	bool exact = reference == batched;
+
+	LOGI("BC5 encode of %ux%u, single thread:\n", size, size);
+	LOGI("  Per block:  %8.2f Mpixel/s, PSNR R %.3f dB, G %.3f dB\n", mpixels / reference_time,
+	     compute_psnr(reference.data(), 16, red), compute_psnr(reference.data() + 8, 16, green));
+	LOGI("  Batched:    %8.2f Mpixel/s, PSNR R %.3f dB, G %.3f dB\n", mpixels / batched_time,
+	     compute_psnr(batched.data(), 16, red), compute_psnr(batched.data() + 8, 16, green));
+	LOGI("  Bit-exact:  %s\n", exact ? "yes" : "no");
+
+	auto &group = *GRANITE_THREAD_GROUP();
+
+	// Task per block, as the texture compressor used to schedule RGTC.
+	std::vector<uint8_t> per_block(num_blocks * 16);
+	start = Util::get_current_time_nsecs();
+	{
+		auto task = group.create_task();
+		for (unsigned block = 0; block < num_blocks; block++)
+		{
+			task->enqueue_task([&, block]() {
+				compress_rgtc_red_green_block(&per_block[block * 16], &red[block * 16], &green[block * 16]);
+			});
+		}
+		task->flush();
+		task->wait();
+	}
+	end = Util::get_current_time_nsecs();
+	double per_block_time = 1e-9 * double(end - start);
+
+	// The full compressor with tiled scheduling.
+	GRANITE_FILESYSTEM()->register_protocol("scratch", std::make_unique<ScratchFilesystem>());
+	CompressorArguments args;
+	args.output = "scratch://bench.gtx";
+	args.format = VK_FORMAT_BC5_UNORM_BLOCK;
+	args.mode = TextureMode::NormalLA;
+
+	start = Util::get_current_time_nsecs();
+	{
+		auto dep = group.create_task();
+		if (!compress_texture(group, args, input, dep, nullptr))
+			return EXIT_FAILURE;
+		dep->flush();
+		group.wait_idle();
+	}
+	end = Util::get_current_time_nsecs();
+	double tiled_time = 1e-9 * double(end - start);
+
+	Vulkan::MemoryMappedTexture output;
+	if (!output.map_read(*GRANITE_FILESYSTEM(), args.output))
+	{
+		LOGE("Failed to read back compressed texture.\n");
+		return EXIT_FAILURE;
+	}
+	auto *encoded = static_cast<const uint8_t *>(output.get_layout().data());
+	exact = exact && memcmp(encoded, reference.data(), reference.size()) == 0;
+
+	LOGI("BC5 encode of %ux%u, %u threads:\n", size, size, group.get_num_threads());
+	LOGI("  Task per block: %8.2f Mpixel/s (%u tasks)\n", mpixels / per_block_time, num_blocks);
+	LOGI("  Tiled:          %8.2f Mpixel/s, PSNR R %.3f dB, G %.3f dB\n", mpixels / tiled_time,
+	     compute_psnr(encoded, 16, red), compute_psnr(encoded + 8, 16, green));
+
+	Global::deinit();
+
+	if (!exact)
+	{
+		LOGE("Encoded output differs from the per block encoder.\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
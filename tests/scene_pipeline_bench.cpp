@@ -0,0 +1,404 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "scene.hpp"
+#include "threaded_scene.hpp"
+#include "render_context.hpp"
+#include "render_components.hpp"
+#include "render_queue.hpp"
+#include "thread_group.hpp"
+#include "task_composer.hpp"
+#include "transforms.hpp"
+#include "metrics.hpp"
+#include "gltf.hpp"
+#include "global_managers_init.hpp"
+#include "cli_parser.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "muglm/matrix_helper.hpp"
+#include <stdlib.h>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Granite;
+using namespace Util;
+
+// Stands in for a mesh. Pushes the same kind of render info a StaticMesh does,
+// but the render callback is never invoked, dispatch goes through a recording sink instead.
+struct SyntheticDrawInfo
+{
+	Hash mesh;
+};
+
+struct SyntheticInstanceInfo
+{
+	mat4 model;
+};
+
+static void synthetic_render(Vulkan::CommandBuffer &, const RenderQueueData *, unsigned)
+{
+}
+
+class SyntheticRenderable : public AbstractRenderable
+{
+public:
+	SyntheticRenderable(const AABB &aabb_, Hash pipeline_hash_, Hash mesh_hash_)
+		: aabb(aabb_), pipeline_hash(pipeline_hash_), mesh_hash(mesh_hash_)
+	{
+	}
+
+	void get_render_info(const RenderContext &context, const RenderInfoComponent *transform,
+	                     RenderQueue &queue) const override
+	{
+		auto sorting_key = RenderInfo::get_sort_key(context, Queue::Opaque, pipeline_hash, mesh_hash,
+		                                            transform->get_aabb().get_center());
+		auto *instance = queue.allocate_one<SyntheticInstanceInfo>();
+		instance->model = transform->get_world_transform();
+		auto *info = queue.push<SyntheticDrawInfo>(Queue::Opaque, mesh_hash, sorting_key, synthetic_render, instance);
+		if (info)
+			info->mesh = mesh_hash;
+	}
+
+	bool has_static_aabb() const override
+	{
+		return true;
+	}
+
+	const AABB *get_static_aabb() const override
+	{
+		return &aabb;
+	}
+
+private:
+	AABB aabb;
+	Hash pipeline_hash;
+	Hash mesh_hash;
+};
+
+static Hash hash_u32(uint32_t v)
+{
+	Hasher h;
+	h.u32(v);
+	return h.get();
+}
+
+struct BenchScene
+{
+	Scene scene;
+	std::vector<NodeHandle> nodes;
+	// Nodes whose rotation is animated every frame.
+	std::vector<Node *> animated;
+};
+
+// Clusters of objects under one root each, laid out on a grid. Every fourth cluster spins per frame.
+static void build_synthetic_scene(BenchScene &bench, unsigned num_objects, unsigned num_meshes)
+{
+	constexpr unsigned ObjectsPerCluster = 32;
+	unsigned num_clusters = (num_objects + ObjectsPerCluster - 1) / ObjectsPerCluster;
+	unsigned grid = unsigned(std::ceil(std::sqrt(float(num_clusters))));
+
+	std::vector<AbstractRenderableHandle> meshes;
+	for (unsigned i = 0; i < num_meshes; i++)
+	{
+		meshes.push_back(Util::make_handle<SyntheticRenderable>(
+				AABB(vec3(-0.5f), vec3(0.5f)), hash_u32(i % 8 + 1), hash_u32(i + 1000)));
+	}
+
+	unsigned object = 0;
+	for (unsigned c = 0; c < num_clusters; c++)
+	{
+		auto root = bench.scene.create_node();
+		auto &t = root->get_transform();
+		t.translation = vec3(8.0f * float(c % grid), 0.0f, -8.0f * float(c / grid));
+		if ((c & 3) == 0)
+			bench.animated.push_back(root.get());
+
+		for (unsigned i = 0; i < ObjectsPerCluster && object < num_objects; i++, object++)
+		{
+			auto child = bench.scene.create_node();
+			child->get_transform().translation = vec3(float(i % 4) - 1.5f, float(i / 16), float((i / 4) % 4) - 1.5f);
+			bench.scene.create_renderable(meshes[object % num_meshes], child.get());
+			root->add_child(child);
+			bench.nodes.push_back(std::move(child));
+		}
+
+		bench.nodes.push_back(std::move(root));
+	}
+}
+
+static NodeHandle build_gltf_node(BenchScene &bench, const GLTF::Parser &parser,
+                                  const std::vector<AbstractRenderableHandle> &meshes, uint32_t index)
+{
+	auto &gltf_node = parser.get_nodes()[index];
+	auto node = bench.scene.create_node();
+	auto &t = node->get_transform();
+	t.scale = gltf_node.transform.scale;
+	t.rotation = gltf_node.transform.rotation;
+	t.translation = gltf_node.transform.translation;
+
+	for (auto mesh : gltf_node.meshes)
+		bench.scene.create_renderable(meshes[mesh], node.get());
+	for (auto child : gltf_node.children)
+		node->add_child(build_gltf_node(bench, parser, meshes, child));
+
+	bench.nodes.push_back(node);
+	return node;
+}
+
+// Only hierarchy, mesh bounds and materials are used, nothing touches the GPU.
+static bool build_gltf_scene(BenchScene &bench, const std::string &path, unsigned instances)
+{
+	GLTF::Parser parser(path);
+	if (parser.get_scenes().empty())
+	{
+		LOGE("No scenes in %s.\n", path.c_str());
+		return false;
+	}
+
+	std::vector<AbstractRenderableHandle> meshes;
+	uint32_t mesh_index = 0;
+	for (auto &mesh : parser.get_meshes())
+	{
+		meshes.push_back(Util::make_handle<SyntheticRenderable>(
+				mesh.static_aabb, hash_u32(mesh.material_index + 1), hash_u32(mesh_index + 1000)));
+		mesh_index++;
+	}
+
+	auto &scene_nodes = parser.get_scenes()[parser.get_default_scene()];
+	unsigned grid = unsigned(std::ceil(std::sqrt(float(instances))));
+
+	for (unsigned i = 0; i < instances; i++)
+	{
+		auto root = bench.scene.create_node();
+		root->get_transform().translation = vec3(20.0f * float(i % grid), 0.0f, -20.0f * float(i / grid));
+		for (auto index : scene_nodes.node_indices)
+			root->add_child(build_gltf_node(bench, parser, meshes, index));
+		bench.animated.push_back(root.get());
+		bench.nodes.push_back(std::move(root));
+	}
+
+	return true;
+}
+
+enum Stage
+{
+	STAGE_ANIMATE,
+	STAGE_TRANSFORMS,
+	STAGE_CULL,
+	STAGE_RENDER_INFO,
+	STAGE_DISPATCH,
+	STAGE_COUNT
+};
+
+static const char *stage_names[STAGE_COUNT] = {
+	"animate", "transforms", "cull", "render-info+sort", "dispatch",
+};
+
+struct FrameStats
+{
+	double stage_ms[STAGE_COUNT] = {};
+	double sort_ms = 0.0;
+	size_t visible = 0;
+	size_t draws = 0;
+	size_t instances = 0;
+};
+
+// Records the draw stream dispatch() would have produced.
+struct DrawRecord
+{
+	RenderFunc render;
+	const void *render_info;
+	unsigned instances;
+};
+
+static void run_frame(BenchScene &bench, ThreadGroup &group, RenderContext &context, unsigned frame,
+                      unsigned num_tasks, std::vector<VisibilityList> &visible, std::vector<RenderQueue> &queues,
+                      std::vector<DrawRecord> &draws, FrameStats &stats)
+{
+	auto *sort_histogram = MetricsRegistry::get().histogram("render_queue.sort");
+	MetricHistogram::Snapshot sort_before, sort_after;
+	sort_histogram->read(sort_before);
+
+	auto start = get_current_time_nsecs();
+
+	float angle = 0.01f * float(frame);
+	for (auto *node : bench.animated)
+	{
+		node->get_transform().rotation = angleAxis(angle, vec3(0.0f, 1.0f, 0.0f));
+		node->invalidate_cached_transform();
+	}
+
+	for (auto &list : visible)
+		list.clear();
+	for (auto &queue : queues)
+		queue.reset();
+
+	auto t_animate = get_current_time_nsecs();
+
+	// Each stage gets its own composer and is waited for, so stages can be timed individually.
+	{
+		TaskComposer composer(group);
+		bench.scene.update_transform_tree(composer);
+		Threaded::scene_update_cached_transforms(bench.scene, composer, num_tasks);
+		composer.get_outgoing_task()->wait();
+	}
+	auto t_transforms = get_current_time_nsecs();
+
+	{
+		TaskComposer composer(group);
+		Threaded::scene_gather_opaque_renderables(bench.scene, composer, context.get_visibility_frustum(),
+		                                          visible.data(), num_tasks);
+		composer.get_outgoing_task()->wait();
+	}
+	auto t_cull = get_current_time_nsecs();
+
+	{
+		TaskComposer composer(group);
+		Threaded::compose_parallel_push_renderables(composer, context, queues.data(), visible.data(),
+		                                            num_tasks, Threaded::PushType::Normal);
+		composer.get_outgoing_task()->wait();
+	}
+	auto t_render_info = get_current_time_nsecs();
+
+	draws.clear();
+	auto &queue = queues.front();
+	queue.enumerate_batches(Queue::Opaque, 0, queue.get_dispatch_size(Queue::Opaque),
+	                        [&](const RenderQueueData *data, unsigned instances) {
+		draws.push_back({ data->render, data->render_info, instances });
+	});
+	auto t_dispatch = get_current_time_nsecs();
+
+	sort_histogram->read(sort_after);
+
+	stats.stage_ms[STAGE_ANIMATE] += 1e-6 * double(t_animate - start);
+	stats.stage_ms[STAGE_TRANSFORMS] += 1e-6 * double(t_transforms - t_animate);
+	stats.stage_ms[STAGE_CULL] += 1e-6 * double(t_cull - t_transforms);
+	stats.stage_ms[STAGE_RENDER_INFO] += 1e-6 * double(t_render_info - t_cull);
+	stats.stage_ms[STAGE_DISPATCH] += 1e-6 * double(t_dispatch - t_render_info);
+	stats.sort_ms += 1e-6 * double(sort_after.sum_ns - sort_before.sum_ns);
+
+	for (auto &list : visible)
+		stats.visible += list.size();
+	stats.draws += draws.size();
+	for (auto &draw : draws)
+		stats.instances += draw.instances;
+}
+
+static void print_help()
+{
+	LOGI("Usage: scene-pipeline-bench [--objects <count>] [--meshes <count>] [--gltf <path>] [--instances <count>]\n"
+	     "       [--frames <count>] [--threads <max threads>]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct Arguments
+	{
+		std::string gltf;
+		unsigned objects = 50000;
+		unsigned meshes = 64;
+		unsigned instances = 16;
+		unsigned frames = 100;
+		unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	} args;
+
+	CLICallbacks cbs;
+	cbs.add("--objects", [&](CLIParser &parser) { args.objects = parser.next_uint(); });
+	cbs.add("--meshes", [&](CLIParser &parser) { args.meshes = std::max(1u, parser.next_uint()); });
+	cbs.add("--gltf", [&](CLIParser &parser) { args.gltf = parser.next_string(); });
+	cbs.add("--instances", [&](CLIParser &parser) { args.instances = std::max(1u, parser.next_uint()); });
+	cbs.add("--frames", [&](CLIParser &parser) { args.frames = std::max(1u, parser.next_uint()); });
+	cbs.add("--threads", [&](CLIParser &parser) { args.threads = std::max(1u, parser.next_uint()); });
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.error_handler = [] { print_help(); };
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT);
+
+	BenchScene bench;
+	if (!args.gltf.empty())
+	{
+		if (!build_gltf_scene(bench, args.gltf, args.instances))
+			return EXIT_FAILURE;
+	}
+	else
+		build_synthetic_scene(bench, args.objects, args.meshes);
+
+	LOGI("Scene: %zu nodes, %zu animated roots.\n", bench.nodes.size(), bench.animated.size());
+
+	RenderContext context;
+	context.set_scene(&bench.scene);
+	context.set_camera(projection(0.6f, 16.0f / 9.0f, 0.1f, 500.0f),
+	                   mat4_cast(look_at(vec3(0.3f, -0.4f, -1.0f), vec3(0.0f, 1.0f, 0.0f))) *
+	                   translate(-vec3(0.0f, 30.0f, 20.0f)));
+
+	// Powers of two up to the requested thread count, plus the count itself.
+	std::vector<unsigned> thread_counts;
+	for (unsigned threads = 1; threads < args.threads; threads *= 2)
+		thread_counts.push_back(threads);
+	thread_counts.push_back(args.threads);
+
+	double baseline_ms = 0.0;
+
+	for (unsigned threads : thread_counts)
+	{
+		ThreadGroup group;
+		group.start(threads, 0, {});
+
+		unsigned num_tasks = threads;
+		std::vector<VisibilityList> visible(num_tasks);
+		std::vector<RenderQueue> queues(num_tasks);
+		std::vector<DrawRecord> draws;
+
+		// Warm up allocations and the first full transform update.
+		FrameStats stats;
+		for (unsigned frame = 0; frame < 4; frame++)
+			run_frame(bench, group, context, frame, num_tasks, visible, queues, draws, stats);
+
+		stats = {};
+		for (unsigned frame = 0; frame < args.frames; frame++)
+			run_frame(bench, group, context, frame, num_tasks, visible, queues, draws, stats);
+
+		double total_ms = 0.0;
+		for (auto &ms : stats.stage_ms)
+			total_ms += ms / args.frames;
+		if (threads == thread_counts.front())
+			baseline_ms = total_ms;
+
+		LOGI("=== %u threads: %.3f ms / frame (%.2fx), %zu visible, %zu draws, %zu instances ===\n",
+		     threads, total_ms, baseline_ms / total_ms,
+		     stats.visible / args.frames, stats.draws / args.frames, stats.instances / args.frames);
+		for (unsigned i = 0; i < STAGE_COUNT; i++)
+			LOGI("  %-18s %8.3f ms\n", stage_names[i], stats.stage_ms[i] / args.frames);
+		LOGI("  %-18s %8.3f ms (part of render-info+sort)\n", "sort", stats.sort_ms / args.frames);
+	}
+
+	Global::deinit();
+	return EXIT_SUCCESS;
+}
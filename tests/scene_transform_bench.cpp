@@ -0,0 +1,242 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "scene.hpp"
+#include "thread_group.hpp"
+#include "task_composer.hpp"
+#include "transforms.hpp"
+#include "simd.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "muglm/matrix_helper.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <random>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+using namespace Granite;
+
+static constexpr unsigned NumNodes = 100000;
+static constexpr unsigned Iterations = 20;
+
+static void randomize_transform(Transform &t, std::mt19937 &rng)
+{
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	t.scale = vec3(1.0f + 0.01f * dist(rng));
+	t.translation = vec3(dist(rng), dist(rng), dist(rng));
+	t.rotation = angleAxis(0.1f * dist(rng), normalize(vec3(dist(rng), dist(rng), 1.0f)));
+}
+
+static NodeHandle create_node(Scene &scene, std::mt19937 &rng)
+{
+	auto node = scene.create_node();
+	randomize_transform(node->get_transform(), rng);
+	return node;
+}
+
+// One root, 100 children, the rest spread evenly below those. Three levels.
+static std::vector<NodeHandle> build_wide(Scene &scene, std::mt19937 &rng)
+{
+	std::vector<NodeHandle> roots;
+	auto root = create_node(scene, rng);
+	unsigned remaining = NumNodes - 1;
+	for (unsigned i = 0; i < 100; i++)
+	{
+		auto child = create_node(scene, rng);
+		remaining--;
+		unsigned leaves = remaining / (100 - i);
+		for (unsigned j = 0; j < leaves; j++)
+			child->add_child(create_node(scene, rng));
+		remaining -= leaves;
+		root->add_child(std::move(child));
+	}
+	roots.push_back(std::move(root));
+	return roots;
+}
+
+// Chains of the maximum supported depth.
+static std::vector<NodeHandle> build_deep(Scene &scene, std::mt19937 &rng)
+{
+	std::vector<NodeHandle> roots;
+	constexpr unsigned Depth = 32;
+	for (unsigned i = 0; i < NumNodes / Depth; i++)
+	{
+		auto root = create_node(scene, rng);
+		Node *tail = root.get();
+		for (unsigned j = 1; j < Depth; j++)
+		{
+			auto child = create_node(scene, rng);
+			auto *next = child.get();
+			tail->add_child(std::move(child));
+			tail = next;
+		}
+		roots.push_back(std::move(root));
+	}
+	return roots;
+}
+
+// Skinned characters with 8 bone chains of 8 bones each.
+static std::vector<NodeHandle> build_skinned(Scene &scene, std::mt19937 &rng)
+{
+	constexpr unsigned Chains = 8;
+	constexpr unsigned ChainLength = 8;
+	constexpr unsigned NumBones = Chains * ChainLength;
+
+	SceneFormats::Skin skin;
+	skin.skin_compat = 1;
+	for (unsigned i = 0; i < NumBones; i++)
+	{
+		Transform t;
+		randomize_transform(t, rng);
+		SceneFormats::NodeTransform joint;
+		joint.scale = t.scale;
+		joint.rotation = t.rotation;
+		joint.translation = t.translation;
+		skin.joint_transforms.push_back(joint);
+		skin.inverse_bind_pose.push_back(translate(-t.translation));
+	}
+
+	for (unsigned c = 0; c < Chains; c++)
+	{
+		SceneFormats::Skin::Bone bone = { c * ChainLength + ChainLength - 1, {} };
+		for (unsigned i = ChainLength - 1; i; i--)
+			bone = { c * ChainLength + i - 1, { std::move(bone) } };
+		skin.skeletons.push_back(std::move(bone));
+	}
+
+	std::vector<NodeHandle> roots;
+	for (unsigned i = 0; i < NumNodes / (NumBones + 1); i++)
+	{
+		auto node = scene.create_skinned_node(skin);
+		randomize_transform(node->get_transform(), rng);
+		roots.push_back(std::move(node));
+	}
+	return roots;
+}
+
+struct Timing
+{
+	double serial_ms;
+	double threaded_ms;
+};
+
+static Timing run_updates(Scene &scene, ThreadGroup &group, const std::vector<NodeHandle> &roots)
+{
+	Timing timing = { 1e30, 1e30 };
+
+	for (unsigned i = 0; i < Iterations; i++)
+	{
+		for (auto &root : roots)
+			root->invalidate_cached_transform();
+		auto start = Util::get_current_time_nsecs();
+		scene.update_transform_tree();
+		auto end = Util::get_current_time_nsecs();
+		timing.serial_ms = std::min(timing.serial_ms, 1e-6 * double(end - start));
+
+		for (auto &root : roots)
+			root->invalidate_cached_transform();
+		start = Util::get_current_time_nsecs();
+		TaskComposer composer(group);
+		scene.update_transform_tree(composer);
+		composer.get_outgoing_task()->wait();
+		end = Util::get_current_time_nsecs();
+		timing.threaded_ms = std::min(timing.threaded_ms, 1e-6 * double(end - start));
+	}
+
+	return timing;
+}
+
+// Walks up the hierarchy with the scalar reference path.
+static mat4 reference_transform(Node *node)
+{
+	mat4 parent = node->get_parent() ? reference_transform(node->get_parent()) : mat4(1.0f);
+	auto &t = node->get_transform();
+	mat4 world;
+	compute_model_transform(world, t.scale, t.rotation, t.translation, parent);
+	return world;
+}
+
+static bool matches(const mat4 &a, const mat4 &b)
+{
+	for (unsigned c = 0; c < 4; c++)
+		if (distance(a[c], b[c]) > 1e-3f)
+			return false;
+	return true;
+}
+
+int main()
+{
+	ThreadGroup group;
+	group.start(std::max(1u, std::thread::hardware_concurrency()), 0, {});
+
+	std::mt19937 rng(1);
+
+	struct Shape
+	{
+		const char *name;
+		std::vector<NodeHandle> (*build)(Scene &, std::mt19937 &);
+	};
+
+	static const Shape shapes[] = {
+		{ "wide (3 levels)", build_wide },
+		{ "deep (32 levels)", build_deep },
+		{ "skinned (64 bones)", build_skinned },
+	};
+
+	for (auto &shape : shapes)
+	{
+		Scene scene;
+		auto roots = shape.build(scene, rng);
+		auto timing = run_updates(scene, group, roots);
+		LOGI("%-20s serial: %7.3f ms, %u threads: %7.3f ms.\n", shape.name,
+		     timing.serial_ms, group.get_num_threads(), timing.threaded_ms);
+
+		// Deepest leaf of the first root, compared to the unbatched path.
+		Node *leaf = roots.front().get();
+		while (!leaf->get_children().empty())
+			leaf = leaf->get_children().back().get();
+		if (!matches(leaf->get_cached_transform(), reference_transform(leaf)))
+		{
+			LOGE("Check failed: matches(leaf->get_cached_transform(), reference_transform(leaf))\n");
+			return EXIT_FAILURE;
+		}
+
+		if (auto *skin = roots.front()->get_skin())
+		{
+			auto *cached = scene.get_transforms().get_cached_transforms();
+			for (size_t i = 0; i < skin->skin.size(); i++)
+			{
+				mat4 expected;
+				SIMD::mul(expected, cached[skin->skin[i]], skin->inverse_bind_poses[i]);
+				if (!matches(roots.front()->get_skin_cached()[i], expected))
+				{
+					LOGE("Check failed: matches(roots.front()->get_skin_cached()[i], expected)\n");
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -98,11 +98,52 @@ static void test_quat()
 	}
 }
 
+static void test_batched_model_transform()
+{
+	// Odd count to exercise the partial SIMD batch.
+	constexpr unsigned Count = 13;
+	Transform local[Count];
+	mat4 parent[Count], world[Count];
+	mat4 *world_ptrs[Count];
+	const Transform *local_ptrs[Count];
+	const mat4 *parent_ptrs[Count];
+
+	for (unsigned i = 0; i < Count; i++)
+	{
+		float f = float(i);
+		local[i].scale = vec3(1.0f + 0.1f * f, 2.0f - 0.05f * f, 0.5f + 0.2f * f);
+		local[i].rotation = angleAxis(0.3f * f, normalize(vec3(0.1f, 0.2f * f, 0.3f)));
+		local[i].translation = vec3(f, -2.0f * f, 0.5f);
+		compute_model_transform(parent[i], vec3(1.5f), angleAxis(-0.2f * f, vec3(0.0f, 1.0f, 0.0f)),
+		                        vec3(3.0f, 2.0f, f), mat4(1.0f));
+		world_ptrs[i] = &world[i];
+		local_ptrs[i] = &local[i];
+		parent_ptrs[i] = &parent[i];
+	}
+
+	compute_model_transforms(world_ptrs, local_ptrs, parent_ptrs, Count);
+
+	for (unsigned i = 0; i < Count; i++)
+	{
+		mat4 reference;
+		compute_model_transform(reference, local[i].scale, local[i].rotation, local[i].translation, parent[i]);
+		for (unsigned col = 0; col < 4; col++)
+		{
+			if (distance(reference[col], world[i][col]) > 0.0001f)
+			{
+				LOGE("Batched model transform mismatch!\n");
+				exit(1);
+			}
+		}
+	}
+}
+
 int main()
 {
 	test_matrix_multiply();
 	test_frustum_cull();
 	test_aabb_transform();
 	test_quat();
+	test_batched_model_transform();
 	LOGI(":D\n");
 }
\ No newline at end of file
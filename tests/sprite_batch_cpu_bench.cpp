@@ -0,0 +1,264 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sprite_batch.hpp"
+#include "flat_renderer.hpp"
+#include "render_queue.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+static constexpr unsigned NumSprites = 100 * 1000;
+static constexpr unsigned NumTextures = 16;
+static constexpr unsigned NumLayers = 8;
+static constexpr unsigned NumFrames = 16;
+
+// CPU micro-benchmark of sprite submission without a device.
+// Times render queue building and sorting against SpriteBatch grouping, sorting and instance gathering.
+// The GPU upload is replaced with a copy into host memory, and no commands are recorded,
+// so instance buffer uploads and FlatRenderer::flush() are not measured here.
+
+static void legacy_render(Vulkan::CommandBuffer &, const RenderQueueData *, unsigned)
+{
+}
+
+// Does the same work as Sprite::get_sprite_render_info() minus resolving views and programs.
+static void push_legacy(RenderQueue &queue, const Sprite &sprite, const SpriteTransformInfo &transform)
+{
+	bool transparent = sprite.pipeline == DrawPipeline::AlphaBlend;
+	auto queue_type = transparent ? Queue::Transparent : Queue::Opaque;
+
+	auto *instance_data = queue.allocate_one<SpriteInstanceInfo>();
+	auto *quads = queue.allocate_one<QuadData>();
+	instance_data->quads = quads;
+	instance_data->count = 1;
+
+	for (unsigned i = 0; i < 4; i++)
+		quads->color[i] = sprite.color[i];
+	quads->pos_off_x = transform.position.x;
+	quads->pos_off_y = transform.position.y;
+	quads->pos_scale_x = float(sprite.size.x) * transform.scale.x;
+	quads->pos_scale_y = float(sprite.size.y) * transform.scale.y;
+	quads->tex_off_x = float(sprite.tex_offset.x);
+	quads->tex_off_y = float(sprite.tex_offset.y);
+	quads->tex_scale_x = float(sprite.size.x);
+	quads->tex_scale_y = float(sprite.size.y);
+	quads->rotation[0] = transform.rotation[0].x;
+	quads->rotation[1] = transform.rotation[0].y;
+	quads->rotation[2] = transform.rotation[1].x;
+	quads->rotation[3] = transform.rotation[1].y;
+	quads->layer = transform.position.z;
+	quads->blend_factor = sprite.texture_blending_factor;
+
+	Util::Hasher hasher;
+	hasher.s32(transparent);
+	hasher.s32(sprite.bandlimited_pixel);
+	hasher.s32(sprite.luma_to_alpha);
+	hasher.s32(sprite.clear_alpha_to_zero);
+	hasher.s32(sprite.texture_alt ? 1 : 0);
+	auto pipe_hash = hasher.get();
+	hasher.u32(sprite.texture.id);
+	hasher.u32(sprite.texture_alt.id);
+	hasher.s32(Util::ecast(sprite.sampler));
+	hasher.s32(Util::ecast(sprite.pipeline));
+	hasher.s32(transform.clip.x);
+	hasher.s32(transform.clip.y);
+	hasher.s32(transform.clip.z);
+	hasher.s32(transform.clip.w);
+	auto instance_key = hasher.get();
+	auto sorting_key = RenderInfo::get_sprite_sort_key(queue_type, pipe_hash, hasher.get(), transform.position.z);
+
+	auto *info = queue.push<SpriteRenderInfo>(queue_type, instance_key, sorting_key, legacy_render, instance_data);
+	if (info)
+		info->clip_quad = transform.clip;
+}
+
+// Gathers instance data per draw like sprite_render() does.
+static unsigned dispatch_legacy(const RenderQueue &queue, Queue queue_type, std::vector<QuadData> &staging)
+{
+	unsigned draws = 0;
+	queue.enumerate_batches(queue_type, 0, queue.get_dispatch_size(queue_type),
+	                        [&](const RenderQueueData *infos, unsigned instances) {
+		for (unsigned i = 0; i < instances; i++)
+		{
+			auto &instance = *static_cast<const SpriteInstanceInfo *>(infos[i].instance_data);
+			staging.insert(staging.end(), instance.quads, instance.quads + instance.count);
+		}
+		draws++;
+	});
+	return draws;
+}
+
+static unsigned upload_batch(const SpriteBatch &batch, std::vector<uint8_t> &staging)
+{
+	size_t count = batch.size();
+	staging.resize(count * (sizeof(SpriteBatch::Transform) + sizeof(SpriteBatch::TexCoord) +
+	                        sizeof(SpriteBatch::Attributes)));
+	uint8_t *dst = staging.data();
+	memcpy(dst, batch.get_sorted_transforms(), count * sizeof(SpriteBatch::Transform));
+	dst += count * sizeof(SpriteBatch::Transform);
+	memcpy(dst, batch.get_sorted_tex_coords(), count * sizeof(SpriteBatch::TexCoord));
+	dst += count * sizeof(SpriteBatch::TexCoord);
+	memcpy(dst, batch.get_sorted_attributes(), count * sizeof(SpriteBatch::Attributes));
+	return unsigned(batch.get_runs().size());
+}
+
+struct SceneSprite
+{
+	Sprite sprite;
+	SpriteTransformInfo transform;
+};
+
+static std::vector<SceneSprite> build_scene()
+{
+	std::mt19937 rnd(1234);
+	std::uniform_real_distribution<float> pos(0.0f, 1920.0f);
+	std::vector<SceneSprite> scene(NumSprites);
+
+	for (auto &s : scene)
+	{
+		s.sprite.texture = AssetID(rnd() % NumTextures);
+		s.sprite.pipeline = (rnd() & 3) == 0 ? DrawPipeline::AlphaBlend : DrawPipeline::Opaque;
+		s.sprite.size = ivec2(32);
+		s.sprite.tex_offset = ivec2(int(rnd() % 32) * 32, 0);
+		s.transform = SpriteTransformInfo(vec3(pos(rnd), pos(rnd), float(rnd() % NumLayers)));
+	}
+
+	return scene;
+}
+
+static int verify_runs(const SpriteBatch &batch)
+{
+	auto &runs = batch.get_runs();
+	uint32_t expected_first = 0;
+	float last_transparent_layer = float(NumLayers);
+
+	for (auto &run : runs)
+	{
+		if (run.first != expected_first)
+		{
+			LOGE("Check failed: run.first == expected_first\n");
+			return EXIT_FAILURE;
+		}
+		expected_first += run.count;
+
+		// Transparent runs have to come out back to front.
+		if (batch.get_group(run.group).pipeline == DrawPipeline::AlphaBlend)
+		{
+			if (run.layer > last_transparent_layer)
+			{
+				LOGE("Check failed: run.layer <= last_transparent_layer\n");
+				return EXIT_FAILURE;
+			}
+			last_transparent_layer = run.layer;
+			for (uint32_t i = 0; i < run.count; i++)
+				if (batch.get_sorted_attributes()[run.first + i].layer != run.layer)
+				{
+					LOGE("Check failed: batch.get_sorted_attributes()[run.first + i].layer == run.layer\n");
+					return EXIT_FAILURE;
+				}
+		}
+	}
+
+	if (expected_first != batch.size())
+	{
+		LOGE("Check failed: expected_first == batch.size()\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	auto scene = build_scene();
+
+	RenderQueue queue;
+	std::vector<QuadData> legacy_staging;
+	unsigned legacy_draws = 0;
+
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned frame = 0; frame < NumFrames; frame++)
+	{
+		queue.reset();
+		for (auto &s : scene)
+			push_legacy(queue, s.sprite, s.transform);
+		queue.sort();
+
+		legacy_staging.clear();
+		legacy_draws = dispatch_legacy(queue, Queue::Opaque, legacy_staging);
+		legacy_draws += dispatch_legacy(queue, Queue::Transparent, legacy_staging);
+	}
+	auto legacy_time = Util::get_current_time_nsecs() - start;
+	if (legacy_staging.size() != NumSprites)
+	{
+		LOGE("Check failed: legacy_staging.size() == NumSprites\n");
+		return EXIT_FAILURE;
+	}
+
+	SpriteBatch dynamic_batch;
+	std::vector<uint8_t> batch_staging;
+	unsigned batch_draws = 0;
+
+	start = Util::get_current_time_nsecs();
+	for (unsigned frame = 0; frame < NumFrames; frame++)
+	{
+		dynamic_batch.clear();
+		for (auto &s : scene)
+			dynamic_batch.push(s.sprite, s.transform);
+		dynamic_batch.prepare();
+		batch_draws = upload_batch(dynamic_batch, batch_staging);
+	}
+	auto batch_time = Util::get_current_time_nsecs() - start;
+
+	if (verify_runs(dynamic_batch) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	SpriteBatch static_batch(true);
+	for (auto &s : scene)
+		static_batch.push(s.sprite, s.transform);
+
+	start = Util::get_current_time_nsecs();
+	unsigned static_draws = 0;
+	for (unsigned frame = 0; frame < NumFrames; frame++)
+	{
+		// Unchanged static layers only cost the run list after the first frame.
+		static_batch.prepare();
+		static_draws = unsigned(static_batch.get_runs().size());
+	}
+	auto static_time = Util::get_current_time_nsecs() - start;
+	if (static_draws != batch_draws)
+	{
+		LOGE("Check failed: static_draws == batch_draws\n");
+		return EXIT_FAILURE;
+	}
+
+	double per_frame = 1e-6 / NumFrames;
+	LOGI("legacy:  %8.3f ms / frame, %u draws.\n", double(legacy_time) * per_frame, legacy_draws);
+	LOGI("batched: %8.3f ms / frame, %u draws.\n", double(batch_time) * per_frame, batch_draws);
+	LOGI("static:  %8.3f ms / frame, %u draws.\n", double(static_time) * per_frame, static_draws);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,816 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "terrain_quadtree.hpp"
+#include "terrain_tiles.hpp"
+#include "filesystem.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace Granite;
+using namespace Vulkan;
+
+struct SyntheticHeights : TerrainHeightSource
+{
+	explicit SyntheticHeights(unsigned size_, bool flat_ = false)
+		: size(size_), flat(flat_)
+	{
+	}
+
+	unsigned get_size() const override
+	{
+		return size;
+	}
+
+	float sample(unsigned x, unsigned z) const override
+	{
+		if (flat)
+			return 0.5f;
+
+		// Low frequency hills with some high frequency detail so every level has error.
+		float fx = float(x) / float(size);
+		float fz = float(z) / float(size);
+		return 0.5f + 0.3f * muglm::sin(fx * 6.0f) * muglm::cos(fz * 5.0f) +
+		       0.05f * muglm::sin(float(x) * 0.9f) * muglm::sin(float(z) * 1.3f);
+	}
+
+	unsigned size;
+	bool flat;
+};
+
+static constexpr unsigned TerrainSize = 512;
+static constexpr unsigned TileSize = 32;
+
+// Maps every level 0 tile to the selected node covering it, or -1.
+static bool build_coverage(const TerrainQuadtree &quadtree, std::vector<int> &coverage)
+{
+	auto &directory = *quadtree.get_directory();
+	unsigned tiles_per_axis = directory.get_tiles_per_axis(0);
+	coverage.assign(tiles_per_axis * tiles_per_axis, -1);
+
+	auto &selected = quadtree.get_selected_nodes();
+	for (size_t i = 0; i < selected.size(); i++)
+	{
+		auto &node = selected[i];
+		unsigned span = 1u << node.level;
+		for (unsigned z = node.z * span; z < (node.z + 1) * span; z++)
+		{
+			for (unsigned x = node.x * span; x < (node.x + 1) * span; x++)
+			{
+				if (coverage[z * tiles_per_axis + x] >= 0)
+				{
+					LOGE("Tile (%u, %u) is covered twice.\n", x, z);
+					return false;
+				}
+				coverage[z * tiles_per_axis + x] = int(i);
+			}
+		}
+	}
+
+	return true;
+}
+
+static void make_all_resident(TerrainQuadtree &quadtree)
+{
+	for (unsigned i = 0; i < quadtree.get_directory()->get_num_tiles(); i++)
+		quadtree.set_resident(i, true);
+}
+
+static int test_layout()
+{
+	TerrainTileDirectory directory;
+	if (!directory.init_layout(TerrainSize, TileSize))
+	{
+		LOGE("Check failed: directory.init_layout(TerrainSize, TileSize)\n");
+		return EXIT_FAILURE;
+	}
+	if (directory.get_num_levels() != 5)
+	{
+		LOGE("Check failed: directory.get_num_levels() == 5\n");
+		return EXIT_FAILURE;
+	}
+	if (directory.get_num_tiles() != 256 + 64 + 16 + 4 + 1)
+	{
+		LOGE("Check failed: directory.get_num_tiles() == 256 + 64 + 16 + 4 + 1\n");
+		return EXIT_FAILURE;
+	}
+	if (directory.get_tile_index(4, 0, 0) != directory.get_num_tiles() - 1)
+	{
+		LOGE("Check failed: directory.get_tile_index(4, 0, 0) == directory.get_num_tiles() - 1\n");
+		return EXIT_FAILURE;
+	}
+
+	if (directory.init_layout(500, TileSize))
+	{
+		LOGE("Check failed: !directory.init_layout(500, TileSize)\n");
+		return EXIT_FAILURE;
+	}
+	if (directory.init_layout(TerrainSize, 48))
+	{
+		LOGE("Check failed: !directory.init_layout(TerrainSize, 48)\n");
+		return EXIT_FAILURE;
+	}
+	if (directory.init_layout(3 * TileSize, TileSize))
+	{
+		LOGE("Check failed: !directory.init_layout(3 * TileSize, TileSize)\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_bounds()
+{
+	SyntheticHeights heights(TerrainSize);
+	TerrainTileDirectory directory;
+	if (!directory.init_layout(TerrainSize, TileSize))
+	{
+		LOGE("Check failed: directory.init_layout(TerrainSize, TileSize)\n");
+		return EXIT_FAILURE;
+	}
+	directory.compute_bounds(heights);
+
+	for (unsigned level = 1; level < directory.get_num_levels(); level++)
+	{
+		for (unsigned z = 0; z < directory.get_tiles_per_axis(level); z++)
+		{
+			for (unsigned x = 0; x < directory.get_tiles_per_axis(level); x++)
+			{
+				auto &tile = directory.get_tile(directory.get_tile_index(level, x, z));
+				if (tile.geometric_error <= 0.0f)
+				{
+					LOGE("Check failed: tile.geometric_error > 0.0f\n");
+					return EXIT_FAILURE;
+				}
+
+				for (unsigned i = 0; i < 4; i++)
+				{
+					auto &child = directory.get_tile(
+							directory.get_tile_index(level - 1, 2 * x + (i & 1), 2 * z + (i >> 1)));
+					if (tile.geometric_error < child.geometric_error)
+					{
+						LOGE("Check failed: tile.geometric_error >= child.geometric_error\n");
+						return EXIT_FAILURE;
+					}
+					if (tile.min_height > child.min_height)
+					{
+						LOGE("Check failed: tile.min_height <= child.min_height\n");
+						return EXIT_FAILURE;
+					}
+					if (tile.max_height < child.max_height)
+					{
+						LOGE("Check failed: tile.max_height >= child.max_height\n");
+						return EXIT_FAILURE;
+					}
+				}
+			}
+		}
+	}
+
+	for (unsigned i = 0; i < directory.get_tiles_per_axis(0) * directory.get_tiles_per_axis(0); i++)
+		if (directory.get_tile(i).geometric_error != 0.0f)
+		{
+			LOGE("Check failed: directory.get_tile(i).geometric_error == 0.0f\n");
+			return EXIT_FAILURE;
+		}
+
+	SyntheticHeights flat(TerrainSize, true);
+	directory.compute_bounds(flat);
+	for (unsigned i = 0; i < directory.get_num_tiles(); i++)
+	{
+		if (directory.get_tile(i).geometric_error != 0.0f)
+		{
+			LOGE("Check failed: directory.get_tile(i).geometric_error == 0.0f\n");
+			return EXIT_FAILURE;
+		}
+		if (directory.get_tile(i).min_height != 0.5f)
+		{
+			LOGE("Check failed: directory.get_tile(i).min_height == 0.5f\n");
+			return EXIT_FAILURE;
+		}
+		if (directory.get_tile(i).max_height != 0.5f)
+		{
+			LOGE("Check failed: directory.get_tile(i).max_height == 0.5f\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Flat terrain never needs refinement.
+	TerrainQuadtree quadtree;
+	quadtree.init(directory, 1.0f, 100.0f, 0.0f);
+	make_all_resident(quadtree);
+	TerrainQuadtree::Parameters params;
+	params.camera_position = vec3(1.0f, 51.0f, 1.0f);
+	params.lod_scale = 1000.0f;
+	quadtree.select(params);
+	if (quadtree.get_selected_nodes().size() != 1)
+	{
+		LOGE("Check failed: quadtree.get_selected_nodes().size() == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (quadtree.get_selected_nodes()[0].tile != quadtree.get_root_tile())
+	{
+		LOGE("Check failed: quadtree.get_selected_nodes()[0].tile == quadtree.get_root_tile()\n");
+		return EXIT_FAILURE;
+	}
+	if (!quadtree.get_stream_requests().empty())
+	{
+		LOGE("Check failed: quadtree.get_stream_requests().empty()\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int test_selection()
+{
+	SyntheticHeights heights(TerrainSize);
+	TerrainTileDirectory directory;
+	if (!directory.init_layout(TerrainSize, TileSize))
+	{
+		LOGE("Check failed: directory.init_layout(TerrainSize, TileSize)\n");
+		return EXIT_FAILURE;
+	}
+	directory.compute_bounds(heights);
+
+	TerrainQuadtree quadtree;
+	quadtree.init(directory, 2.0f, 50.0f, -10.0f);
+	make_all_resident(quadtree);
+
+	TerrainQuadtree::Parameters params;
+	params.camera_position = vec3(20.0f, 40.0f, 20.0f);
+	params.lod_scale = 100.0f;
+	params.max_pixel_error = 2.0f;
+	quadtree.select(params);
+
+	auto &selected = quadtree.get_selected_nodes();
+	if (selected.empty())
+	{
+		LOGE("Check failed: !selected.empty()\n");
+		return EXIT_FAILURE;
+	}
+	if (!quadtree.get_stream_requests().empty())
+	{
+		LOGE("Check failed: quadtree.get_stream_requests().empty()\n");
+		return EXIT_FAILURE;
+	}
+
+	std::vector<int> coverage;
+	if (!build_coverage(quadtree, coverage))
+	{
+		LOGE("Check failed: build_coverage(quadtree, coverage)\n");
+		return EXIT_FAILURE;
+	}
+	for (auto c : coverage)
+		if (c < 0)
+		{
+			LOGE("Check failed: c >= 0\n");
+			return EXIT_FAILURE;
+		}
+
+	// Finest near the camera, coarser far away.
+	unsigned tiles_per_axis = directory.get_tiles_per_axis(0);
+	if (selected[coverage[0]].level != 0)
+	{
+		LOGE("Check failed: selected[coverage[0]].level == 0\n");
+		return EXIT_FAILURE;
+	}
+	unsigned far_level = selected[coverage[tiles_per_axis * tiles_per_axis - 1]].level;
+	if (far_level <= 0)
+	{
+		LOGE("Check failed: far_level > 0\n");
+		return EXIT_FAILURE;
+	}
+
+	unsigned max_level = 0;
+	for (auto &node : selected)
+	{
+		max_level = std::max(max_level, node.level);
+		if (!(quadtree.compute_screen_space_error(node.level, node.x, node.z, params) <= params.max_pixel_error ||
+		      node.level == 0))
+		{
+			LOGE("Check failed: quadtree.compute_screen_space_error(node.level, node.x, node.z, params) <= params.max_pixel_error || node.level == 0\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (max_level <= 1)
+	{
+		LOGE("Check failed: max_level > 1\n");
+		return EXIT_FAILURE;
+	}
+
+	// Every edge must be snapped to the level of a coarser neighbor.
+	static const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	for (auto &node : selected)
+	{
+		unsigned span = 1u << node.level;
+		for (unsigned edge = 0; edge < TerrainQuadtree::EdgeCount; edge++)
+		{
+			int nx = offsets[edge][0] < 0 ? int(node.x * span) - 1 :
+			         offsets[edge][0] > 0 ? int((node.x + 1) * span) : int(node.x * span);
+			int nz = offsets[edge][1] < 0 ? int(node.z * span) - 1 :
+			         offsets[edge][1] > 0 ? int((node.z + 1) * span) : int(node.z * span);
+
+			unsigned expected = 0;
+			if (nx >= 0 && nz >= 0 && nx < int(tiles_per_axis) && nz < int(tiles_per_axis))
+			{
+				auto &neighbor = selected[coverage[nz * tiles_per_axis + nx]];
+				if (neighbor.level > node.level)
+					expected = neighbor.level - node.level;
+			}
+
+			if (node.edge_lod[edge] != expected)
+			{
+				LOGE("Edge %u of node (%u, %u, %u) has LOD %u, expected %u.\n",
+				     edge, node.level, node.x, node.z, node.edge_lod[edge], expected);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int test_residency()
+{
+	SyntheticHeights heights(TerrainSize);
+	TerrainTileDirectory directory;
+	if (!directory.init_layout(TerrainSize, TileSize))
+	{
+		LOGE("Check failed: directory.init_layout(TerrainSize, TileSize)\n");
+		return EXIT_FAILURE;
+	}
+	directory.compute_bounds(heights);
+
+	TerrainQuadtree quadtree;
+	quadtree.init(directory, 1.0f, 50.0f, 0.0f);
+
+	TerrainQuadtree::Parameters params;
+	params.camera_position = vec3(10.0f, 40.0f, 10.0f);
+	params.lod_scale = 500.0f;
+
+	// Nothing can be drawn until the root is resident.
+	quadtree.select(params);
+	if (!quadtree.get_selected_nodes().empty())
+	{
+		LOGE("Check failed: quadtree.get_selected_nodes().empty()\n");
+		return EXIT_FAILURE;
+	}
+	if (quadtree.get_stream_requests().size() != 1)
+	{
+		LOGE("Check failed: quadtree.get_stream_requests().size() == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (quadtree.get_stream_requests()[0].tile != quadtree.get_root_tile())
+	{
+		LOGE("Check failed: quadtree.get_stream_requests()[0].tile == quadtree.get_root_tile()\n");
+		return EXIT_FAILURE;
+	}
+
+	quadtree.set_resident(quadtree.get_root_tile(), true);
+	quadtree.select(params);
+	if (quadtree.get_selected_nodes().size() != 1)
+	{
+		LOGE("Check failed: quadtree.get_selected_nodes().size() == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (quadtree.get_stream_requests().size() != 4)
+	{
+		LOGE("Check failed: quadtree.get_stream_requests().size() == 4\n");
+		return EXIT_FAILURE;
+	}
+	for (auto &req : quadtree.get_stream_requests())
+		if (req.priority <= params.max_pixel_error)
+		{
+			LOGE("Check failed: req.priority > params.max_pixel_error\n");
+			return EXIT_FAILURE;
+		}
+
+	// Stream in what was requested until the selection is stable.
+	unsigned iterations = 0;
+	while (!quadtree.get_stream_requests().empty())
+	{
+		if (++iterations >= directory.get_num_levels() + 1)
+		{
+			LOGE("Check failed: ++iterations < directory.get_num_levels() + 1\n");
+			return EXIT_FAILURE;
+		}
+
+		float last_priority = quadtree.get_stream_requests().front().priority;
+		for (auto &req : quadtree.get_stream_requests())
+		{
+			if (req.priority > last_priority)
+			{
+				LOGE("Check failed: req.priority <= last_priority\n");
+				return EXIT_FAILURE;
+			}
+			last_priority = req.priority;
+			if (quadtree.is_resident(req.tile))
+			{
+				LOGE("Check failed: !quadtree.is_resident(req.tile)\n");
+				return EXIT_FAILURE;
+			}
+			quadtree.set_resident(req.tile, true);
+		}
+
+		quadtree.select(params);
+
+		std::vector<int> coverage;
+		if (!build_coverage(quadtree, coverage))
+		{
+			LOGE("Check failed: build_coverage(quadtree, coverage)\n");
+			return EXIT_FAILURE;
+		}
+		for (auto c : coverage)
+			if (c < 0)
+			{
+				LOGE("Check failed: c >= 0\n");
+				return EXIT_FAILURE;
+			}
+		for (auto &node : quadtree.get_selected_nodes())
+			if (!quadtree.is_resident(node.tile))
+			{
+				LOGE("Check failed: quadtree.is_resident(node.tile)\n");
+				return EXIT_FAILURE;
+			}
+		for (auto tile : quadtree.get_refined_tiles())
+			if (!quadtree.is_resident(tile))
+			{
+				LOGE("Check failed: quadtree.is_resident(tile)\n");
+				return EXIT_FAILURE;
+			}
+	}
+
+	if (quadtree.get_selected_nodes().size() <= 4)
+	{
+		LOGE("Check failed: quadtree.get_selected_nodes().size() > 4\n");
+		return EXIT_FAILURE;
+	}
+
+	// Losing a tile falls back to the parent.
+	auto &node = quadtree.get_selected_nodes().front();
+	if (node.level != 0)
+	{
+		LOGE("Check failed: node.level == 0\n");
+		return EXIT_FAILURE;
+	}
+	unsigned lost = node.tile;
+	quadtree.set_resident(lost, false);
+	quadtree.select(params);
+
+	bool requested = false;
+	for (auto &req : quadtree.get_stream_requests())
+		if (req.tile == lost)
+			requested = true;
+	if (!requested)
+	{
+		LOGE("Check failed: requested\n");
+		return EXIT_FAILURE;
+	}
+
+	for (auto &selected : quadtree.get_selected_nodes())
+		if (selected.tile == lost)
+		{
+			LOGE("Check failed: selected.tile != lost\n");
+			return EXIT_FAILURE;
+		}
+
+	return EXIT_SUCCESS;
+}
+
+static int test_culling()
+{
+	SyntheticHeights heights(TerrainSize);
+	TerrainTileDirectory directory;
+	if (!directory.init_layout(TerrainSize, TileSize))
+	{
+		LOGE("Check failed: directory.init_layout(TerrainSize, TileSize)\n");
+		return EXIT_FAILURE;
+	}
+	directory.compute_bounds(heights);
+
+	TerrainQuadtree quadtree;
+	quadtree.init(directory, 1.0f, 50.0f, 0.0f);
+	make_all_resident(quadtree);
+
+	float extent = float(TerrainSize);
+
+	// Only keep x >= 0.75 * extent. The remaining planes accept everything.
+	vec4 planes[6];
+	planes[0] = vec4(1.0f, 0.0f, 0.0f, -0.75f * extent);
+	for (unsigned i = 1; i < 6; i++)
+		planes[i] = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	TerrainQuadtree::Parameters params;
+	params.camera_position = vec3(0.5f * extent, 40.0f, 0.5f * extent);
+	params.lod_scale = 500.0f;
+	params.frustum_planes = planes;
+	quadtree.select(params);
+
+	if (quadtree.get_selected_nodes().empty())
+	{
+		LOGE("Check failed: !quadtree.get_selected_nodes().empty()\n");
+		return EXIT_FAILURE;
+	}
+	for (auto &node : quadtree.get_selected_nodes())
+	{
+		AABB aabb = quadtree.get_tile_aabb(node.level, node.x, node.z);
+		if (aabb.get_maximum().x < 0.75f * extent)
+		{
+			LOGE("Check failed: aabb.get_maximum().x >= 0.75f * extent\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<int> coverage;
+	if (!build_coverage(quadtree, coverage))
+	{
+		LOGE("Check failed: build_coverage(quadtree, coverage)\n");
+		return EXIT_FAILURE;
+	}
+	unsigned tiles_per_axis = directory.get_tiles_per_axis(0);
+	for (unsigned z = 0; z < tiles_per_axis; z++)
+	{
+		for (unsigned x = 0; x < tiles_per_axis; x++)
+		{
+			bool visible = float((x + 1) * TileSize) >= 0.75f * extent;
+			if (visible)
+				if (coverage[z * tiles_per_axis + x] < 0)
+				{
+					LOGE("Check failed: coverage[z * tiles_per_axis + x] >= 0\n");
+					return EXIT_FAILURE;
+				}
+		}
+	}
+
+	// Entirely outside the terrain.
+	planes[0] = vec4(1.0f, 0.0f, 0.0f, -2.0f * extent);
+	quadtree.select(params);
+	if (!quadtree.get_selected_nodes().empty())
+	{
+		LOGE("Check failed: quadtree.get_selected_nodes().empty()\n");
+		return EXIT_FAILURE;
+	}
+	if (!quadtree.get_stream_requests().empty())
+	{
+		LOGE("Check failed: quadtree.get_stream_requests().empty()\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int test_tile_file()
+{
+	Filesystem fs;
+	fs.register_protocol("tmp", std::make_unique<ScratchFilesystem>());
+
+	SyntheticHeights heights(128);
+	TerrainTileFileInfo info;
+	info.tile_size = 32;
+	info.sample_spacing = 0.5f;
+	info.height_scale = 20.0f;
+	info.height_offset = -5.0f;
+	if (!write_terrain_tile_file(fs, "tmp://terrain.bin", heights, info))
+	{
+		LOGE("Check failed: write_terrain_tile_file(fs, \"tmp://terrain.bin\", heights, info)\n");
+		return EXIT_FAILURE;
+	}
+
+	TerrainTileFile file;
+	if (!file.open(fs, "tmp://terrain.bin"))
+	{
+		LOGE("Check failed: file.open(fs, \"tmp://terrain.bin\")\n");
+		return EXIT_FAILURE;
+	}
+	if (file.get_info().tile_size != 32)
+	{
+		LOGE("Check failed: file.get_info().tile_size == 32\n");
+		return EXIT_FAILURE;
+	}
+	if (file.get_info().sample_spacing != 0.5f)
+	{
+		LOGE("Check failed: file.get_info().sample_spacing == 0.5f\n");
+		return EXIT_FAILURE;
+	}
+	if (file.get_info().height_scale != 20.0f)
+	{
+		LOGE("Check failed: file.get_info().height_scale == 20.0f\n");
+		return EXIT_FAILURE;
+	}
+	if (file.get_info().height_offset != -5.0f)
+	{
+		LOGE("Check failed: file.get_info().height_offset == -5.0f\n");
+		return EXIT_FAILURE;
+	}
+
+	TerrainTileDirectory reference;
+	if (!reference.init_layout(128, 32))
+	{
+		LOGE("Check failed: reference.init_layout(128, 32)\n");
+		return EXIT_FAILURE;
+	}
+	reference.compute_bounds(heights);
+
+	auto &directory = file.get_directory();
+	if (directory.get_num_levels() != reference.get_num_levels())
+	{
+		LOGE("Check failed: directory.get_num_levels() == reference.get_num_levels()\n");
+		return EXIT_FAILURE;
+	}
+	if (directory.get_num_tiles() != reference.get_num_tiles())
+	{
+		LOGE("Check failed: directory.get_num_tiles() == reference.get_num_tiles()\n");
+		return EXIT_FAILURE;
+	}
+
+	for (unsigned level = 0; level < directory.get_num_levels(); level++)
+	{
+		for (unsigned z = 0; z < directory.get_tiles_per_axis(level); z++)
+		{
+			for (unsigned x = 0; x < directory.get_tiles_per_axis(level); x++)
+			{
+				unsigned index = directory.get_tile_index(level, x, z);
+				if (directory.get_tile(index).geometric_error != reference.get_tile(index).geometric_error)
+				{
+					LOGE("Check failed: directory.get_tile(index).geometric_error == reference.get_tile(index).geometric_error\n");
+					return EXIT_FAILURE;
+				}
+				if (directory.get_tile(index).min_height != reference.get_tile(index).min_height)
+				{
+					LOGE("Check failed: directory.get_tile(index).min_height == reference.get_tile(index).min_height\n");
+					return EXIT_FAILURE;
+				}
+				if (directory.get_tile(index).max_height != reference.get_tile(index).max_height)
+				{
+					LOGE("Check failed: directory.get_tile(index).max_height == reference.get_tile(index).max_height\n");
+					return EXIT_FAILURE;
+				}
+
+				MemoryMappedTexture tile_heights;
+				if (!tile_heights.map_read(file.get_heights(index)->map()))
+				{
+					LOGE("Check failed: tile_heights.map_read(file.get_heights(index)->map())\n");
+					return EXIT_FAILURE;
+				}
+				auto &layout = tile_heights.get_layout();
+				if (layout.get_format() != VK_FORMAT_R16_UNORM)
+				{
+					LOGE("Check failed: layout.get_format() == VK_FORMAT_R16_UNORM\n");
+					return EXIT_FAILURE;
+				}
+				if (!(layout.get_width() == 33 && layout.get_height() == 33))
+				{
+					LOGE("Check failed: layout.get_width() == 33 && layout.get_height() == 33\n");
+					return EXIT_FAILURE;
+				}
+
+				// Coarser levels are decimated, so tile borders match their neighbors exactly.
+				unsigned stride = 1u << level;
+				for (unsigned sz = 0; sz <= 32; sz += 8)
+				{
+					for (unsigned sx = 0; sx <= 32; sx += 8)
+					{
+						float h = heights.sample((x * 32 + sx) * stride, (z * 32 + sz) * stride);
+						auto expected = uint16_t(muglm::round(muglm::clamp(h, 0.0f, 1.0f) * 65535.0f));
+						if (!(*layout.data_2d<uint16_t>(sx, sz) == expected))
+						{
+							LOGE("Check failed: *layout.data_2d<uint16_t>(sx, sz) == expected\n");
+							return EXIT_FAILURE;
+						}
+					}
+				}
+
+				MemoryMappedTexture tile_normals;
+				if (!tile_normals.map_read(file.get_normals(index)->map()))
+				{
+					LOGE("Check failed: tile_normals.map_read(file.get_normals(index)->map())\n");
+					return EXIT_FAILURE;
+				}
+				if (tile_normals.get_layout().get_format() != VK_FORMAT_R8G8_UNORM)
+				{
+					LOGE("Check failed: tile_normals.get_layout().get_format() == VK_FORMAT_R8G8_UNORM\n");
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+	// A flat terrain has normals pointing straight up.
+	SyntheticHeights flat(64, true);
+	info.tile_size = 64;
+	if (!write_terrain_tile_file(fs, "tmp://flat.bin", flat, info))
+	{
+		LOGE("Check failed: write_terrain_tile_file(fs, \"tmp://flat.bin\", flat, info)\n");
+		return EXIT_FAILURE;
+	}
+	if (!file.open(fs, "tmp://flat.bin"))
+	{
+		LOGE("Check failed: file.open(fs, \"tmp://flat.bin\")\n");
+		return EXIT_FAILURE;
+	}
+	if (file.get_directory().get_num_tiles() != 1)
+	{
+		LOGE("Check failed: file.get_directory().get_num_tiles() == 1\n");
+		return EXIT_FAILURE;
+	}
+
+	MemoryMappedTexture flat_normals;
+	if (!flat_normals.map_read(file.get_normals(0)->map()))
+	{
+		LOGE("Check failed: flat_normals.map_read(file.get_normals(0)->map())\n");
+		return EXIT_FAILURE;
+	}
+	auto *n = flat_normals.get_layout().data_2d<uint8_t>(17, 40);
+	if (!(n[0] == 128 && n[1] == 128))
+	{
+		LOGE("Check failed: n[0] == 128 && n[1] == 128\n");
+		return EXIT_FAILURE;
+	}
+
+	// Garbage must be rejected.
+	{
+		auto garbage = fs.open("tmp://garbage.bin", FileMode::WriteOnly);
+		if (!garbage)
+		{
+			LOGE("Check failed: garbage\n");
+			return EXIT_FAILURE;
+		}
+		auto mapping = garbage->map_write(256);
+		if (!mapping)
+		{
+			LOGE("Check failed: mapping\n");
+			return EXIT_FAILURE;
+		}
+		memset(mapping->mutable_data(), 0xab, 256);
+	}
+	TerrainTileFile invalid;
+	if (invalid.open(fs, "tmp://garbage.bin"))
+	{
+		LOGE("Check failed: !invalid.open(fs, \"tmp://garbage.bin\")\n");
+		return EXIT_FAILURE;
+	}
+
+	// A payload whose offset + size wraps around must not pass the range check.
+	// The first directory entry follows the 48 byte header, starting with the heights offset and size.
+	{
+		auto src = fs.open("tmp://terrain.bin");
+		auto src_mapping = src ? src->map() : FileMappingHandle{};
+		auto dst = fs.open("tmp://wrapped.bin", FileMode::WriteOnly);
+		auto dst_mapping = dst && src_mapping ? dst->map_write(src_mapping->get_size()) : FileMappingHandle{};
+		if (!dst_mapping)
+		{
+			LOGE("Failed to copy terrain file.\n");
+			return EXIT_FAILURE;
+		}
+
+		memcpy(dst_mapping->mutable_data(), src_mapping->data(), src_mapping->get_size());
+		const uint64_t wrapping[2] = { 64, ~uint64_t(0) - 32 };
+		memcpy(dst_mapping->mutable_data<uint8_t>() + 48, wrapping, sizeof(wrapping));
+	}
+	if (invalid.open(fs, "tmp://wrapped.bin"))
+	{
+		LOGE("Wrapping payload range was accepted.\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	if (test_layout() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_bounds() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_selection() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_residency() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_culling() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_tile_file() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	LOGI("All terrain tests passed.\n");
+	return EXIT_SUCCESS;
+}
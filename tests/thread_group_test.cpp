@@ -22,6 +22,9 @@
 
 #include "thread_group.hpp"
 #include "logging.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
 
 using namespace Granite;
 
@@ -53,4 +56,42 @@ int main()
 	group.submit(task3);
 
 	group.wait_idle();
+
+	// Desc histograms are shared by string content, not by address.
+	char desc[16];
+	snprintf(desc, sizeof(desc), "%s", "ohai");
+	auto *histogram = group.get_desc_histogram(desc);
+	if (!histogram || histogram != group.get_desc_histogram("ohai"))
+	{
+		LOGE("Desc histogram lookup failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	// Descs which vary at runtime must not grow the registry without bound.
+	Util::MetricHistogram *last = nullptr;
+	for (unsigned i = 0; i < 1000; i++)
+	{
+		snprintf(desc, sizeof(desc), "desc-%u", i);
+		last = group.get_desc_histogram(desc);
+	}
+
+	if (last || group.get_desc_histogram("ohai") != histogram)
+	{
+		LOGE("Desc histogram table is not bounded.\n");
+		return EXIT_FAILURE;
+	}
+
+	std::atomic_bool on_worker{false};
+	auto worker_task = group.create_task([&]() {
+		on_worker = ThreadGroup::is_worker_thread();
+	});
+	worker_task->wait();
+
+	if (!on_worker || ThreadGroup::is_worker_thread())
+	{
+		LOGE("Worker thread detection failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
 }
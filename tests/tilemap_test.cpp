@@ -0,0 +1,485 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tilemap.hpp"
+#include "filesystem.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+static constexpr unsigned MapWidth = 100;
+static constexpr unsigned MapHeight = 70;
+static constexpr unsigned TileWidth = 16;
+static constexpr unsigned TileHeight = 8;
+static constexpr unsigned NumTiles = 12;
+
+static std::vector<int> make_layer(unsigned seed, unsigned empty_percent)
+{
+	std::vector<int> tiles(MapWidth * MapHeight);
+	std::mt19937 rnd(seed);
+	for (auto &tile : tiles)
+		tile = rnd() % 100 < empty_percent ? int(TileMap::NoTile) : int(rnd() % NumTiles);
+
+	// Leave the first chunk of the map empty.
+	for (unsigned y = 0; y < TileMap::ChunkSize; y++)
+		for (unsigned x = 0; x < TileMap::ChunkSize; x++)
+			tiles[y * MapWidth + x] = TileMap::NoTile;
+
+	return tiles;
+}
+
+static void init_map(TileMap &map, const std::vector<int> &bottom, const std::vector<int> &top)
+{
+	std::vector<DrawPipeline> pipelines(NumTiles, DrawPipeline::Opaque);
+	pipelines[3] = DrawPipeline::AlphaTest;
+	pipelines[7] = DrawPipeline::AlphaBlend;
+	map.init(uvec2(MapWidth, MapHeight), uvec2(TileWidth, TileHeight), std::move(pipelines));
+	map.add_layer(bottom.data(), 2.0f);
+	map.add_layer(top.data(), 1.0f, 0.5f);
+	map.set_texture(AssetID(0));
+}
+
+static size_t count_tiles(const std::vector<int> &tiles, unsigned x0, unsigned y0, unsigned x1, unsigned y1)
+{
+	size_t count = 0;
+	for (unsigned y = y0; y < y1; y++)
+		for (unsigned x = x0; x < x1; x++)
+			if (tiles[y * MapWidth + x] != TileMap::NoTile)
+				count++;
+	return count;
+}
+
+static size_t count_sprites(const std::vector<SpriteBatch *> &batches)
+{
+	size_t count = 0;
+	for (auto *batch : batches)
+	{
+		batch->prepare();
+		count += batch->size();
+	}
+	return count;
+}
+
+static int test_culling()
+{
+	auto bottom = make_layer(1, 20);
+	auto top = make_layer(2, 80);
+	TileMap map;
+	init_map(map, bottom, top);
+
+	if (map.get_tile(0, 40, 33) != bottom[33 * MapWidth + 40])
+	{
+		LOGE("Check failed: map.get_tile(0, 40, 33) == bottom[33 * MapWidth + 40]\n");
+		return EXIT_FAILURE;
+	}
+	if (map.get_tile(1, 99, 69) != top[69 * MapWidth + 99])
+	{
+		LOGE("Check failed: map.get_tile(1, 99, 69) == top[69 * MapWidth + 99]\n");
+		return EXIT_FAILURE;
+	}
+
+	// 4 x 3 chunks, the first one is empty in both layers.
+	auto &all = map.cull(vec2(0.0f), vec2(MapWidth * TileWidth, MapHeight * TileHeight));
+	if (map.get_stats().visible_chunks != 2 * (4 * 3 - 1))
+	{
+		LOGE("Check failed: map.get_stats().visible_chunks == 2 * (4 * 3 - 1)\n");
+		return EXIT_FAILURE;
+	}
+	if (map.get_stats().rebuilt_chunks != map.get_stats().visible_chunks)
+	{
+		LOGE("Check failed: map.get_stats().rebuilt_chunks == map.get_stats().visible_chunks\n");
+		return EXIT_FAILURE;
+	}
+	if (count_sprites(all) != count_tiles(bottom, 0, 0, MapWidth, MapHeight) +
+	                            count_tiles(top, 0, 0, MapWidth, MapHeight))
+	{
+		LOGE("Check failed: count_sprites(all) == count_tiles(bottom, 0, 0, MapWidth, MapHeight) + count_tiles(top, 0, 0, MapWidth, MapHeight)\n");
+		return EXIT_FAILURE;
+	}
+
+	// Nothing changed, so nothing is rebuilt.
+	map.cull(vec2(0.0f), vec2(MapWidth * TileWidth, MapHeight * TileHeight));
+	if (map.get_stats().rebuilt_chunks != 0)
+	{
+		LOGE("Check failed: map.get_stats().rebuilt_chunks == 0\n");
+		return EXIT_FAILURE;
+	}
+
+	// A view inside the second chunk of the first row only sees that chunk.
+	auto &one = map.cull(vec2(40.0f * TileWidth, 4.0f * TileHeight), vec2(8.0f * TileWidth, 8.0f * TileHeight));
+	if (map.get_stats().visible_chunks != 2)
+	{
+		LOGE("Check failed: map.get_stats().visible_chunks == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (count_sprites(one) != count_tiles(bottom, 32, 0, 64, 32) + count_tiles(top, 32, 0, 64, 32))
+	{
+		LOGE("Check failed: count_sprites(one) == count_tiles(bottom, 32, 0, 64, 32) + count_tiles(top, 32, 0, 64, 32)\n");
+		return EXIT_FAILURE;
+	}
+
+	// Views entirely outside the map or inside the empty chunk see nothing.
+	if (!map.cull(vec2(-1000.0f), vec2(100.0f)).empty())
+	{
+		LOGE("Check failed: map.cull(vec2(-1000.0f), vec2(100.0f)).empty()\n");
+		return EXIT_FAILURE;
+	}
+	if (!map.cull(vec2(MapWidth * TileWidth + 1.0f, 0.0f), vec2(100.0f)).empty())
+	{
+		LOGE("Check failed: map.cull(vec2(MapWidth * TileWidth + 1.0f, 0.0f), vec2(100.0f)).empty()\n");
+		return EXIT_FAILURE;
+	}
+	if (!map.cull(vec2(TileWidth, TileHeight), vec2(4.0f * TileWidth, 4.0f * TileHeight)).empty())
+	{
+		LOGE("Check failed: map.cull(vec2(TileWidth, TileHeight), vec2(4.0f * TileWidth, 4.0f * TileHeight)).empty()\n");
+		return EXIT_FAILURE;
+	}
+
+	// Edges which only touch a chunk do not make it visible.
+	map.cull(vec2(0.0f), vec2(64.0f * TileWidth, 32.0f * TileHeight));
+	if (map.get_stats().visible_chunks != 2)
+	{
+		LOGE("Check failed: map.get_stats().visible_chunks == 2\n");
+		return EXIT_FAILURE;
+	}
+
+	// Hidden layers are skipped.
+	map.set_layer_visible(1, false);
+	map.cull(vec2(0.0f), vec2(MapWidth * TileWidth, MapHeight * TileHeight));
+	if (map.get_stats().visible_chunks != 4 * 3 - 1)
+	{
+		LOGE("Check failed: map.get_stats().visible_chunks == 4 * 3 - 1\n");
+		return EXIT_FAILURE;
+	}
+	map.set_layer_visible(1, true);
+
+	return EXIT_SUCCESS;
+}
+
+static int test_edits()
+{
+	auto bottom = make_layer(3, 10);
+	auto top = make_layer(4, 90);
+	TileMap map;
+	init_map(map, bottom, top);
+
+	vec2 full_size(MapWidth * TileWidth, MapHeight * TileHeight);
+	map.cull(vec2(0.0f), full_size);
+
+	// Filling a tile in the empty chunk brings it to life and only rebuilds that chunk.
+	map.set_tile(0, 5, 6, 2);
+	if (map.get_tile(0, 5, 6) != 2)
+	{
+		LOGE("Check failed: map.get_tile(0, 5, 6) == 2\n");
+		return EXIT_FAILURE;
+	}
+	auto &visible = map.cull(vec2(0.0f), full_size);
+	if (map.get_stats().rebuilt_chunks != 1)
+	{
+		LOGE("Check failed: map.get_stats().rebuilt_chunks == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (map.get_stats().visible_chunks != 2 * (4 * 3 - 1) + 1)
+	{
+		LOGE("Check failed: map.get_stats().visible_chunks == 2 * (4 * 3 - 1) + 1\n");
+		return EXIT_FAILURE;
+	}
+	bottom[6 * MapWidth + 5] = 2;
+	if (count_sprites(visible) != count_tiles(bottom, 0, 0, MapWidth, MapHeight) +
+	                                count_tiles(top, 0, 0, MapWidth, MapHeight))
+	{
+		LOGE("Check failed: count_sprites(visible) == count_tiles(bottom, 0, 0, MapWidth, MapHeight) + count_tiles(top, 0, 0, MapWidth, MapHeight)\n");
+		return EXIT_FAILURE;
+	}
+
+	// Setting a tile to its current value is a no-op.
+	map.set_tile(0, 5, 6, 2);
+	map.cull(vec2(0.0f), full_size);
+	if (map.get_stats().rebuilt_chunks != 0)
+	{
+		LOGE("Check failed: map.get_stats().rebuilt_chunks == 0\n");
+		return EXIT_FAILURE;
+	}
+
+	// Bounds shrink when tiles are cleared. The single tile sits at (5, 6),
+	// so a view covering the rest of the chunk must not see it.
+	map.set_tile(0, 5, 6, TileMap::NoTile);
+	map.set_tile(0, 20, 20, 1);
+	map.cull(vec2(0.0f), vec2(10.0f * TileWidth, 10.0f * TileHeight));
+	if (map.get_stats().visible_chunks != 0)
+	{
+		LOGE("Check failed: map.get_stats().visible_chunks == 0\n");
+		return EXIT_FAILURE;
+	}
+	map.cull(vec2(0.0f), vec2(21.0f * TileWidth, 21.0f * TileHeight));
+	if (map.get_stats().visible_chunks != 1)
+	{
+		LOGE("Check failed: map.get_stats().visible_chunks == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (map.get_stats().rebuilt_chunks != 1)
+	{
+		LOGE("Check failed: map.get_stats().rebuilt_chunks == 1\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int test_eviction()
+{
+	auto bottom = make_layer(5, 0);
+	auto top = make_layer(6, 100);
+	TileMap map;
+	init_map(map, bottom, top);
+	map.set_max_idle_frames(2);
+
+	map.cull(vec2(0.0f), vec2(MapWidth * TileWidth, MapHeight * TileHeight));
+	if (map.get_stats().resident_chunks != 4 * 3 - 1)
+	{
+		LOGE("Check failed: map.get_stats().resident_chunks == 4 * 3 - 1\n");
+		return EXIT_FAILURE;
+	}
+
+	// Keep one chunk in view, the others go idle and are released.
+	vec2 pos(40.0f * TileWidth, 4.0f * TileHeight);
+	vec2 size(8.0f * TileWidth, 8.0f * TileHeight);
+	for (unsigned i = 0; i < 3; i++)
+		map.cull(pos, size);
+	if (map.get_stats().resident_chunks != 1)
+	{
+		LOGE("Check failed: map.get_stats().resident_chunks == 1\n");
+		return EXIT_FAILURE;
+	}
+	if (map.get_stats().rebuilt_chunks != 0)
+	{
+		LOGE("Check failed: map.get_stats().rebuilt_chunks == 0\n");
+		return EXIT_FAILURE;
+	}
+
+	// Released chunks are rebuilt when they come back into view.
+	map.cull(vec2(0.0f), vec2(MapWidth * TileWidth, MapHeight * TileHeight));
+	if (map.get_stats().rebuilt_chunks != 4 * 3 - 2)
+	{
+		LOGE("Check failed: map.get_stats().rebuilt_chunks == 4 * 3 - 2\n");
+		return EXIT_FAILURE;
+	}
+	if (map.get_stats().resident_chunks != 4 * 3 - 1)
+	{
+		LOGE("Check failed: map.get_stats().resident_chunks == 4 * 3 - 1\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int test_baked()
+{
+	Filesystem fs;
+	fs.register_protocol("tmp", std::make_unique<ScratchFilesystem>());
+
+	auto bottom = make_layer(7, 30);
+	auto top = make_layer(8, 70);
+	TileMap map;
+	init_map(map, bottom, top);
+	map.set_layer_visible(1, false);
+	if (!map.save_baked(fs, "tmp://map.tilemap"))
+	{
+		LOGE("Check failed: map.save_baked(fs, \"tmp://map.tilemap\")\n");
+		return EXIT_FAILURE;
+	}
+
+	TileMap baked;
+	if (!baked.load_baked(fs, "tmp://map.tilemap"))
+	{
+		LOGE("Check failed: baked.load_baked(fs, \"tmp://map.tilemap\")\n");
+		return EXIT_FAILURE;
+	}
+	if (!all(equal(baked.get_map_tiles(), uvec2(MapWidth, MapHeight))))
+	{
+		LOGE("Check failed: all(equal(baked.get_map_tiles(), uvec2(MapWidth, MapHeight)))\n");
+		return EXIT_FAILURE;
+	}
+	if (!all(equal(baked.get_tile_size(), uvec2(TileWidth, TileHeight))))
+	{
+		LOGE("Check failed: all(equal(baked.get_tile_size(), uvec2(TileWidth, TileHeight)))\n");
+		return EXIT_FAILURE;
+	}
+	if (baked.get_num_layers() != 2)
+	{
+		LOGE("Check failed: baked.get_num_layers() == 2\n");
+		return EXIT_FAILURE;
+	}
+
+	for (unsigned y = 0; y < MapHeight; y++)
+	{
+		for (unsigned x = 0; x < MapWidth; x++)
+		{
+			if (baked.get_tile(0, x, y) != bottom[y * MapWidth + x])
+			{
+				LOGE("Check failed: baked.get_tile(0, x, y) == bottom[y * MapWidth + x]\n");
+				return EXIT_FAILURE;
+			}
+			if (baked.get_tile(1, x, y) != top[y * MapWidth + x])
+			{
+				LOGE("Check failed: baked.get_tile(1, x, y) == top[y * MapWidth + x]\n");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	// Chunk bounds come from the file, the hidden layer stays hidden.
+	baked.set_texture(AssetID(0));
+	vec2 full_size(MapWidth * TileWidth, MapHeight * TileHeight);
+	auto &visible = baked.cull(vec2(0.0f), full_size);
+	if (baked.get_stats().visible_chunks != 4 * 3 - 1)
+	{
+		LOGE("Check failed: baked.get_stats().visible_chunks == 4 * 3 - 1\n");
+		return EXIT_FAILURE;
+	}
+	if (count_sprites(visible) != count_tiles(bottom, 0, 0, MapWidth, MapHeight))
+	{
+		LOGE("Check failed: count_sprites(visible) == count_tiles(bottom, 0, 0, MapWidth, MapHeight)\n");
+		return EXIT_FAILURE;
+	}
+
+	// Editing a mapped layer copies it and leaves the file alone.
+	baked.set_tile(0, 50, 50, TileMap::NoTile);
+	baked.set_tile(0, 51, 50, 4);
+	if (baked.get_tile(0, 50, 50) != TileMap::NoTile)
+	{
+		LOGE("Check failed: baked.get_tile(0, 50, 50) == TileMap::NoTile\n");
+		return EXIT_FAILURE;
+	}
+	if (baked.get_tile(0, 51, 50) != 4)
+	{
+		LOGE("Check failed: baked.get_tile(0, 51, 50) == 4\n");
+		return EXIT_FAILURE;
+	}
+	if (baked.get_tile(0, 52, 50) != bottom[50 * MapWidth + 52])
+	{
+		LOGE("Check failed: baked.get_tile(0, 52, 50) == bottom[50 * MapWidth + 52]\n");
+		return EXIT_FAILURE;
+	}
+	baked.cull(vec2(0.0f), full_size);
+	if (baked.get_stats().rebuilt_chunks != 1)
+	{
+		LOGE("Check failed: baked.get_stats().rebuilt_chunks == 1\n");
+		return EXIT_FAILURE;
+	}
+
+	TileMap reloaded;
+	if (!reloaded.load_baked(fs, "tmp://map.tilemap"))
+	{
+		LOGE("Check failed: reloaded.load_baked(fs, \"tmp://map.tilemap\")\n");
+		return EXIT_FAILURE;
+	}
+	if (reloaded.get_tile(0, 51, 50) != bottom[50 * MapWidth + 51])
+	{
+		LOGE("Check failed: reloaded.get_tile(0, 51, 50) == bottom[50 * MapWidth + 51]\n");
+		return EXIT_FAILURE;
+	}
+
+	// Garbage must be rejected.
+	{
+		auto garbage = fs.open("tmp://garbage.tilemap", FileMode::WriteOnly);
+		if (!garbage)
+		{
+			LOGE("Check failed: garbage\n");
+			return EXIT_FAILURE;
+		}
+		auto mapping = garbage->map_write(256);
+		if (!mapping)
+		{
+			LOGE("Check failed: mapping\n");
+			return EXIT_FAILURE;
+		}
+		memset(mapping->mutable_data(), 0xab, 256);
+	}
+	TileMap invalid;
+	if (invalid.load_baked(fs, "tmp://garbage.tilemap"))
+	{
+		LOGE("Check failed: !invalid.load_baked(fs, \"tmp://garbage.tilemap\")\n");
+		return EXIT_FAILURE;
+	}
+
+	// So must files which are cut short.
+	{
+		auto src = fs.open_readonly_mapping("tmp://map.tilemap");
+		if (!src)
+		{
+			LOGE("Check failed: src\n");
+			return EXIT_FAILURE;
+		}
+		auto truncated = fs.open("tmp://truncated.tilemap", FileMode::WriteOnly);
+		if (!truncated)
+		{
+			LOGE("Check failed: truncated\n");
+			return EXIT_FAILURE;
+		}
+		size_t size = src->get_size() / 2;
+		auto mapping = truncated->map_write(size);
+		if (!mapping)
+		{
+			LOGE("Check failed: mapping\n");
+			return EXIT_FAILURE;
+		}
+		memcpy(mapping->mutable_data(), src->data(), size);
+	}
+	// The header is intact, so this fails on the layers and must not disturb the loaded map.
+	if (reloaded.load_baked(fs, "tmp://truncated.tilemap"))
+	{
+		LOGE("Check failed: !reloaded.load_baked(fs, \"tmp://truncated.tilemap\")\n");
+		return EXIT_FAILURE;
+	}
+	if (reloaded.get_num_layers() != 2)
+	{
+		LOGE("Check failed: reloaded.get_num_layers() == 2\n");
+		return EXIT_FAILURE;
+	}
+	if (reloaded.get_tile(1, 20, 10) != top[10 * MapWidth + 20])
+	{
+		LOGE("Check failed: reloaded.get_tile(1, 20, 10) == top[10 * MapWidth + 20]\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int main()
+{
+	if (test_culling() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_edits() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_eviction() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (test_baked() != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	LOGI("All tilemap tests passed.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "timeline_trace_file.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Util;
+
+static constexpr unsigned NumThreads = 4;
+static constexpr unsigned EventsPerThread = 200000;
+
+static double trace_events(TimelineTraceFile &file, unsigned thread_index)
+{
+	auto name = "worker-" + std::to_string(thread_index);
+	TimelineTraceFile::set_tid(name.c_str());
+
+	auto start = get_current_time_nsecs();
+	for (unsigned i = 0; i < EventsPerThread; i++)
+	{
+		GRANITE_SCOPED_TIMELINE_EVENT_FILE(&file, (i & 1) ? "odd-event" : "even-event");
+	}
+	auto end = get_current_time_nsecs();
+	return double(end - start) / EventsPerThread;
+}
+
+// The two timestamps per event are a fixed cost, measure them separately.
+static double timer_baseline()
+{
+	auto start = get_current_time_nsecs();
+	int64_t sink = 0;
+	for (unsigned i = 0; i < EventsPerThread; i++)
+	{
+		sink += get_current_time_nsecs();
+		sink -= get_current_time_nsecs();
+	}
+	auto end = get_current_time_nsecs();
+	return double(end - start - (sink & 1)) / EventsPerThread;
+}
+
+static size_t count_json_events(const std::string &path)
+{
+	FILE *file = fopen(path.c_str(), "r");
+	if (!file)
+		return 0;
+
+	size_t count = 0;
+	char line[1024];
+	while (fgets(line, sizeof(line), file))
+		if (strstr(line, "\"ph\": \"X\""))
+			count++;
+	fclose(file);
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	std::string path = argc >= 2 ? argv[1] : "timeline-trace-bench.gtrace";
+	std::string json_path = path + ".json";
+
+	uint64_t dropped;
+	double single_thread_ns;
+	double multi_thread_ns;
+	double timer_ns = timer_baseline();
+
+	{
+		TimelineTraceFile file(path);
+
+		// First pass also warms up the per-thread ring and string cache, as a long running thread would have.
+		trace_events(file, 0);
+		single_thread_ns = trace_events(file, 0);
+
+		auto start = get_current_time_nsecs();
+		std::vector<std::thread> threads;
+		for (unsigned i = 0; i < NumThreads; i++)
+			threads.emplace_back([&, i]() { trace_events(file, i + 1); });
+		for (auto &t : threads)
+			t.join();
+		auto end = get_current_time_nsecs();
+		multi_thread_ns = double(end - start) / (NumThreads * EventsPerThread);
+
+		// Legacy path, as used for GPU timestamps.
+		auto *e = file.allocate_event();
+		e->set_desc("gpu-event");
+		e->set_tid("gpu-queue");
+		e->start_ns = get_current_time_nsecs();
+		e->end_ns = e->start_ns + 1000;
+		file.submit_event(e);
+
+		dropped = file.get_dropped_event_count();
+	}
+
+	LOGI("Single thread: %.1f ns per scoped event, of which %.1f ns is reading the timer twice.\n",
+	     single_thread_ns, timer_ns);
+	LOGI("%u threads: %.1f ns per scoped event (wall clock / total events, %u hardware threads).\n",
+	     NumThreads, multi_thread_ns, std::thread::hardware_concurrency());
+	LOGI("Dropped %llu events.\n", static_cast<unsigned long long>(dropped));
+
+	if (!TimelineTraceFile::convert_to_json(path, json_path))
+	{
+		LOGE("Check failed: TimelineTraceFile::convert_to_json(path, json_path)\n");
+		return EXIT_FAILURE;
+	}
+	size_t total_events = size_t(NumThreads + 2) * EventsPerThread + 1;
+
+	// Producers back off briefly when a ring fills, so losing events means the drain thread is starved.
+	if (dropped * 100 > total_events)
+	{
+		LOGE("Dropped more than 1%% of events.\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t written = count_json_events(json_path);
+	LOGI("Converted %zu events.\n", written);
+	if (written + dropped != total_events)
+	{
+		LOGE("Check failed: written + dropped == total_events\n");
+		return EXIT_FAILURE;
+	}
+
+	remove(path.c_str());
+	remove(json_path.c_str());
+	return EXIT_SUCCESS;
+}
@@ -29,8 +29,10 @@
 #include "thread_priority.hpp"
 #include "string_helpers.hpp"
 #include "timeline_trace_file.hpp"
+#include "timer.hpp"
 #include "thread_name.hpp"
 #include "environment.hpp"
+#include "hash.hpp"
 
 namespace Granite
 {
@@ -116,6 +118,13 @@ TaskGroup::~TaskGroup()
 		flush();
 }
 
+static thread_local bool worker_thread;
+
+bool ThreadGroup::is_worker_thread()
+{
+	return worker_thread;
+}
+
 void ThreadGroup::set_async_main_thread()
 {
 	Util::set_current_thread_name("MainAsyncThread");
@@ -173,7 +182,7 @@ void ThreadGroup::start(unsigned num_threads_foreground,
 	std::string path;
 	if (Util::get_environment("GRANITE_TIMELINE_TRACE", path))
 	{
-		LOGI("Enabling JSON timeline tracing to %s.\n", path.c_str());
+		LOGI("Enabling timeline tracing to %s.\n", path.c_str());
 		timeline_trace_file = std::make_unique<Util::TimelineTraceFile>(path);
 	}
 #endif
@@ -333,6 +342,37 @@ ThreadGroup *TaskGroup::get_thread_group() const
 void TaskGroup::set_desc(const char *desc)
 {
 	snprintf(deps->desc, sizeof(deps->desc), "%s", desc);
+	deps->desc_histogram = group->get_desc_histogram(deps->desc);
+}
+
+Util::MetricHistogram *ThreadGroup::get_desc_histogram(const char *desc)
+{
+	Util::Hasher hasher;
+	hasher.string(desc);
+	// Zero marks an empty slot.
+	uint64_t hash = hasher.get() ? hasher.get() : 1;
+
+	for (unsigned i = 0; i < MaxDescHistograms; i++)
+	{
+		auto &slot = desc_histograms[(hash + i) & (MaxDescHistograms - 1)];
+		uint64_t slot_hash = slot.hash.load(std::memory_order_acquire);
+
+		if (slot_hash == 0)
+		{
+			if (slot.hash.compare_exchange_strong(slot_hash, hash, std::memory_order_acq_rel))
+			{
+				auto *histogram = Util::MetricsRegistry::get().histogram(std::string("threading.task.") + desc);
+				slot.histogram.store(histogram, std::memory_order_release);
+				return histogram;
+			}
+		}
+
+		// Another thread may still be registering the histogram, in which case this task goes untimed.
+		if (slot_hash == hash)
+			return slot.histogram.load(std::memory_order_acquire);
+	}
+
+	return nullptr;
 }
 
 void TaskGroup::set_task_class(TaskClass task_class)
@@ -356,8 +396,13 @@ bool ThreadGroup::is_idle()
 void ThreadGroup::thread_looper(unsigned index, TaskClass task_class)
 {
 	Util::register_thread_index(index);
+	worker_thread = true;
 	auto &ctx = task_class == TaskClass::Foreground ? fg : bg;
 
+	auto &metrics = Util::MetricsRegistry::get();
+	auto *task_histogram = metrics.histogram(task_class == TaskClass::Foreground ?
+	                                         "threading.task_fg" : "threading.task_bg");
+
 	for (;;)
 	{
 		Internal::Task *task = nullptr;
@@ -378,7 +423,12 @@ void ThreadGroup::thread_looper(unsigned index, TaskClass task_class)
 		if (task->callable)
 		{
 			GRANITE_SCOPED_TIMELINE_EVENT_FILE(timeline_trace_file.get(), task->deps->desc);
+			auto start_ns = Util::get_current_time_nsecs();
 			task->callable.call();
+			auto elapsed_ns = uint64_t(Util::get_current_time_nsecs() - start_ns);
+			task_histogram->record(elapsed_ns);
+			if (task->deps->desc_histogram)
+				task->deps->desc_histogram->record(elapsed_ns);
 		}
 
 		task->deps->task_completed();
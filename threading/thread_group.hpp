@@ -33,6 +33,7 @@
 #include "variant.hpp"
 #include "intrusive.hpp"
 #include "timeline_trace_file.hpp"
+#include "metrics.hpp"
 #include "global_managers.hpp"
 #include "small_vector.hpp"
 #include "small_callable.hpp"
@@ -103,6 +104,7 @@ struct TaskDeps : Util::IntrusivePtrEnabled<TaskDeps, TaskDepsDeleter, Util::Mul
 	TaskClass task_class = TaskClass::Foreground;
 
 	char desc[64];
+	Util::MetricHistogram *desc_histogram = nullptr;
 };
 using TaskDepsHandle = Util::IntrusivePtr<TaskDeps>;
 
@@ -166,6 +168,11 @@ public:
 		return unsigned(fg.thread_group.size() + bg.thread_group.size());
 	}
 
+	unsigned get_num_foreground_threads() const
+	{
+		return unsigned(fg.thread_group.size());
+	}
+
 	void stop();
 
 	template <typename Func>
@@ -190,6 +197,13 @@ public:
 
 	static void set_async_main_thread();
 
+	// True on threads owned by a ThreadGroup. Waiting on a task from such a thread can deadlock the pool.
+	static bool is_worker_thread();
+
+	// Per-desc task latency histogram, registered on first use.
+	// Returns nullptr once MaxDescHistograms distinct descs have been seen.
+	Util::MetricHistogram *get_desc_histogram(const char *desc);
+
 private:
 	Util::ThreadSafeObjectPool<Internal::Task> task_pool;
 	Util::ThreadSafeObjectPool<TaskGroup> task_group_pool;
@@ -215,6 +229,16 @@ private:
 
 	std::unique_ptr<Util::TimelineTraceFile> timeline_trace_file;
 	void set_thread_context() override;
+
+	// Lock-free open addressing table keyed on the hash of the desc string.
+	// Avoids the registry lock and a string allocation every time a task gets a desc.
+	enum { MaxDescHistograms = 256 };
+	struct DescHistogram
+	{
+		std::atomic<uint64_t> hash;
+		std::atomic<Util::MetricHistogram *> histogram;
+	};
+	DescHistogram desc_histograms[MaxDescHistograms] = {};
 };
 
 template <typename Func>
@@ -26,6 +26,8 @@
 #include "cli_parser.hpp"
 #include "global_managers_init.hpp"
 #include "thread_group.hpp"
+#include "texture_files.hpp"
+#include "environment_filter.hpp"
 
 using namespace Vulkan;
 using namespace Granite;
@@ -33,24 +35,61 @@ using namespace Util;
 
 static void print_help()
 {
-	LOGE("Usage: [--reflection <path.gtx>] [--irradiance <path.gtx>] <path.gtx>\n");
+	LOGE("Usage: [--reflection <path.gtx>] [--irradiance <path.gtx>] [--cpu] <path.gtx>\n");
+}
+
+struct Args
+{
+	std::string cube;
+	std::string reflection;
+	std::string irradiance;
+	bool cpu = false;
+};
+
+static bool save_texture(MemoryMappedTexture &tex, const std::string &path)
+{
+	if (path.empty())
+		return true;
+
+	if (tex.empty() || !tex.copy_to_path(*GRANITE_FILESYSTEM(), path))
+	{
+		LOGE("Failed to save texture to %s\n", path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static int convert_on_cpu(const Args &args)
+{
+	auto cube = load_texture_from_file(*GRANITE_FILESYSTEM(), args.cube);
+	if (cube.empty())
+	{
+		LOGE("Failed to load %s.\n", args.cube.c_str());
+		return 1;
+	}
+
+	auto &group = *GRANITE_THREAD_GROUP();
+	auto specular = SceneFormats::convert_cube_to_ibl_specular(group, cube.get_layout());
+	auto diffuse = SceneFormats::convert_cube_to_ibl_diffuse(group, cube.get_layout());
+
+	if (!save_texture(specular, args.reflection) || !save_texture(diffuse, args.irradiance))
+		return 1;
+
+	return 0;
 }
 
 int main(int argc, char *argv[])
 {
 	CLICallbacks cbs;
-	struct Args
-	{
-		std::string cube;
-		std::string reflection;
-		std::string irradiance;
-	} args;
+	Args args;
 
 	Granite::Global::init();
 
 	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
 	cbs.add("--reflection", [&](CLIParser &parser) { args.reflection = parser.next_string(); });
 	cbs.add("--irradiance", [&](CLIParser &parser) { args.irradiance = parser.next_string(); });
+	cbs.add("--cpu", [&](CLIParser &) { args.cpu = true; });
 	cbs.default_handler = [&](const char *arg) { args.cube = arg; };
 	cbs.error_handler = [&]() { print_help(); };
 
@@ -66,6 +105,9 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (args.cpu)
+		return convert_on_cpu(args);
+
 	Context::init_loader(nullptr);
 	Context context;
 
@@ -75,7 +117,10 @@ int main(int argc, char *argv[])
 	context.set_system_handles(handles);
 
 	if (!context.init_instance_and_device(nullptr, 0, nullptr, 0))
-		return 1;
+	{
+		LOGW("No Vulkan device available, falling back to CPU filtering.\n");
+		return convert_on_cpu(args);
+	}
 
 	Device device;
 	device.set_context(context);
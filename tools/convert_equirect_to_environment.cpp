@@ -26,6 +26,8 @@
 #include "cli_parser.hpp"
 #include "global_managers_init.hpp"
 #include "thread_group.hpp"
+#include "texture_files.hpp"
+#include "environment_filter.hpp"
 
 using namespace Vulkan;
 using namespace Granite;
@@ -33,20 +35,67 @@ using namespace Util;
 
 static void print_help()
 {
-	LOGE("Usage: [--reflection <path.gtx>] [--irradiance <path.gtx>] [--cube <path.gtx>] [--cube-scale <scale>] <equirect HDR>\n");
+	LOGE("Usage: [--reflection <path.gtx>] [--irradiance <path.gtx>] [--cube <path.gtx>] [--cube-scale <scale>] [--cpu] <equirect HDR>\n");
+}
+
+struct Args
+{
+	std::string equirect;
+	std::string cube;
+	std::string reflection;
+	std::string irradiance;
+	float cube_scale = 1.0f;
+	bool cpu = false;
+};
+
+static bool save_texture(MemoryMappedTexture &tex, const std::string &path)
+{
+	if (path.empty())
+		return true;
+
+	if (tex.empty() || !tex.copy_to_path(*GRANITE_FILESYSTEM(), path))
+	{
+		LOGE("Failed to save texture to %s\n", path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static int convert_on_cpu(const Args &args)
+{
+	auto equirect = load_texture_from_file(*GRANITE_FILESYSTEM(), args.equirect);
+	if (equirect.empty())
+	{
+		LOGE("Failed to load %s.\n", args.equirect.c_str());
+		return 1;
+	}
+
+	auto &group = *GRANITE_THREAD_GROUP();
+	auto cube = SceneFormats::convert_equirect_to_cube(group, equirect.get_layout(), args.cube_scale);
+	if (cube.empty())
+		return 1;
+
+	// The source is no longer needed, release it before filtering.
+	equirect = {};
+
+	auto specular = SceneFormats::convert_cube_to_ibl_specular(group, cube.get_layout());
+	auto diffuse = SceneFormats::convert_cube_to_ibl_diffuse(group, cube.get_layout());
+
+	if (!save_texture(cube, args.cube) ||
+	    !save_texture(specular, args.reflection) ||
+	    !save_texture(diffuse, args.irradiance))
+	{
+		return 1;
+	}
+
+	return 0;
 }
 
 int main(int argc, char *argv[])
 {
 	CLICallbacks cbs;
-	struct Args
-	{
-		std::string equirect;
-		std::string cube;
-		std::string reflection;
-		std::string irradiance;
-		float cube_scale = 1.0f;
-	} args;
+	Args args;
 
 	Granite::Global::init();
 
@@ -55,6 +104,7 @@ int main(int argc, char *argv[])
 	cbs.add("--irradiance", [&](CLIParser &parser) { args.irradiance = parser.next_string(); });
 	cbs.add("--cube", [&](CLIParser &parser) { args.cube = parser.next_string(); });
 	cbs.add("--cube-scale", [&](CLIParser &parser) { args.cube_scale = parser.next_double(); });
+	cbs.add("--cpu", [&](CLIParser &) { args.cpu = true; });
 	cbs.default_handler = [&](const char *arg) { args.equirect = arg; };
 	cbs.error_handler = [&]() { print_help(); };
 
@@ -70,6 +120,9 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (args.cpu)
+		return convert_on_cpu(args);
+
 	Context::init_loader(nullptr);
 	Context context;
 
@@ -79,7 +132,10 @@ int main(int argc, char *argv[])
 	context.set_system_handles(handles);
 
 	if (!context.init_instance_and_device(nullptr, 0, nullptr, 0))
-		return 1;
+	{
+		LOGW("No Vulkan device available, falling back to CPU filtering.\n");
+		return convert_on_cpu(args);
+	}
 
 	Device device;
 	device.set_context(context);
@@ -0,0 +1,194 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "device.hpp"
+#include "context.hpp"
+#include "cli_parser.hpp"
+#include "global_managers_init.hpp"
+#include "os_filesystem.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <climits>
+#include <stdio.h>
+
+using namespace Vulkan;
+using namespace Granite;
+using namespace Util;
+
+// Replays a Fossilize archive through the regular Device replay path and
+// serializes the resulting pipeline cache to <cache>/pipeline_cache.bin.
+// To target a software implementation, e.g. in CI, use GRANITE_VULKAN_DEVICE_INDEX or VK_ICD_FILENAMES.
+
+static void print_help()
+{
+	LOGE("Usage: fossilize-prewarm <archive.foz> --cache <directory>\n"
+	     "\t[--threads <count>]\n"
+	     "\t[--report <path.csv>]\n"
+	     "\t[--top <count>]\n");
+}
+
+static bool write_report(const std::string &path, const Device::PipelineReplayStatistics &stats)
+{
+	FILE *file = fopen(path.c_str(), "w");
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	fprintf(file, "hash,type,compile_time_us\n");
+	for (auto &pipe : stats.pipelines)
+	{
+		fprintf(file, "%016llx,%s,%.3f\n",
+		        static_cast<unsigned long long>(pipe.hash),
+		        pipe.compute ? "compute" : "graphics",
+		        1e-3 * double(pipe.compile_time_ns));
+	}
+
+	fclose(file);
+	return true;
+}
+
+static int main_inner(const std::string &archive, const std::string &report, unsigned top_count)
+{
+	auto *fs = GRANITE_FILESYSTEM();
+
+	// The device replays cache://fossilize/db.foz on startup.
+	auto input = fs->open_readonly_mapping(archive);
+	if (!input)
+	{
+		LOGE("Failed to open Fossilize archive: %s\n", archive.c_str());
+		return EXIT_FAILURE;
+	}
+
+	if (!fs->write_buffer_to_file("cache://fossilize/db.foz", input->data(), input->get_size()))
+	{
+		LOGE("Failed to copy Fossilize archive to cache.\n");
+		return EXIT_FAILURE;
+	}
+	input.reset();
+
+	if (!Context::init_loader(nullptr))
+		return EXIT_FAILURE;
+
+	Context context;
+	Context::SystemHandles handles;
+	handles.filesystem = fs;
+	handles.thread_group = GRANITE_THREAD_GROUP();
+	context.set_system_handles(handles);
+
+	if (!context.init_instance_and_device(nullptr, 0, nullptr, 0))
+		return EXIT_FAILURE;
+
+	Device::PipelineReplayStatistics stats;
+
+	{
+		Device device;
+		device.set_context(context);
+
+		auto start_ns = get_current_time_nsecs();
+		device.begin_shader_caches();
+		device.wait_shader_caches();
+		auto end_ns = get_current_time_nsecs();
+
+		if (!device.get_pipeline_replay_statistics(stats))
+		{
+			LOGE("Fossilize replay did not run.\n");
+			return EXIT_FAILURE;
+		}
+
+		uint64_t total_compile_ns = 0;
+		for (auto &pipe : stats.pipelines)
+			total_compile_ns += pipe.compile_time_ns;
+
+		LOGI("Replayed %u modules, compiled %zu pipelines using %u threads in %.3f s.\n",
+		     stats.num_modules, stats.pipelines.size(), GRANITE_THREAD_GROUP()->get_num_threads(),
+		     1e-9 * double(end_ns - start_ns));
+		LOGI("  Accumulated compile time: %.3f s.\n", 1e-9 * double(total_compile_ns));
+		LOGI("  Deduplicated pipelines: %u.\n", stats.num_duplicates);
+		LOGI("  Failed pipelines: %u.\n", stats.num_failed);
+
+		auto sorted = stats.pipelines;
+		std::sort(sorted.begin(), sorted.end(), [](const Device::PipelineReplayStatistics::Entry &a,
+		                                           const Device::PipelineReplayStatistics::Entry &b) {
+			return a.compile_time_ns > b.compile_time_ns;
+		});
+
+		top_count = std::min<unsigned>(top_count, unsigned(sorted.size()));
+		if (top_count)
+			LOGI("Slowest pipelines:\n");
+		for (unsigned i = 0; i < top_count; i++)
+		{
+			LOGI("  %016llx (%s): %.3f ms\n",
+			     static_cast<unsigned long long>(sorted[i].hash),
+			     sorted[i].compute ? "compute" : "graphics",
+			     1e-6 * double(sorted[i].compile_time_ns));
+		}
+
+		// Device teardown serializes the pipeline cache to cache://pipeline_cache.bin.
+	}
+
+	if (!report.empty() && !write_report(report, stats))
+		return EXIT_FAILURE;
+
+	return stats.num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	CLICallbacks cbs;
+	struct Args
+	{
+		std::string archive;
+		std::string cache;
+		std::string report;
+		unsigned threads = 0;
+		unsigned top = 10;
+	} args;
+
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--cache", [&](CLIParser &parser) { args.cache = parser.next_string(); });
+	cbs.add("--threads", [&](CLIParser &parser) { args.threads = parser.next_uint(); });
+	cbs.add("--report", [&](CLIParser &parser) { args.report = parser.next_string(); });
+	cbs.add("--top", [&](CLIParser &parser) { args.top = parser.next_uint(); });
+	cbs.default_handler = [&](const char *arg) { args.archive = arg; };
+	cbs.error_handler = [&]() { print_help(); };
+
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (args.archive.empty() || args.cache.empty())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	Global::init(Global::MANAGER_FEATURE_DEFAULT_BITS, args.threads ? args.threads : UINT_MAX);
+	GRANITE_FILESYSTEM()->register_protocol("cache", std::make_unique<OSFilesystem>(args.cache));
+	int ret = main_inner(args.archive, args.report, args.top);
+	Global::deinit();
+	return ret;
+}
@@ -31,9 +31,18 @@ using namespace Granite;
 
 int main(int argc, char *argv[])
 {
+	// Inputs may be raw or supercompressed, output is raw unless requested.
+	bool supercompress = argc >= 2 && strcmp(argv[1], "--supercompress") == 0;
+	if (supercompress)
+	{
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
+
 	if (argc < 4)
 	{
-		LOGE("Usage: %s <output> <cube|2D> <inputs>...\n", argv[0]);
+		LOGE("Usage: %s [--supercompress] <output> <cube|2D> <inputs>...\n", argv[0]);
 		return 1;
 	}
 
@@ -52,7 +61,7 @@ int main(int argc, char *argv[])
 	bool type_2d = strcmp(argv[2], "2D") == 0;
 	if (!type_2d && !cube)
 	{
-		LOGE("Usage: %s <output> <cube|2D> <inputs>...\n", argv[0]);
+		LOGE("Usage: %s [--supercompress] <output> <cube|2D> <inputs>...\n", argv[0]);
 		return 1;
 	}
 
@@ -137,7 +146,8 @@ int main(int argc, char *argv[])
 	if (generate_mips)
 		array.set_generate_mipmaps_on_load(true);
 
-	if (!array.map_write(*GRANITE_FILESYSTEM(), argv[1]))
+	bool mapped = supercompress ? array.map_write_scratch() : array.map_write(*GRANITE_FILESYSTEM(), argv[1]);
+	if (!mapped)
 	{
 		LOGE("Failed to save file: %s\n", argv[1]);
 		return 1;
@@ -161,5 +171,11 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (supercompress && !array.write_supercompressed(*GRANITE_FILESYSTEM(), argv[1]))
+	{
+		LOGE("Failed to save file: %s\n", argv[1]);
+		return 1;
+	}
+
 	return 0;
 }
\ No newline at end of file
@@ -39,6 +39,8 @@ static void print_help()
 	     "\t[--fixup-alpha]\n"
 	     "\t[--alpha]\n"
 	     "\t[--deferred-mipgen]\n"
+	     "\t[--supercompress]\n"
+	     "\t[--native-bc]\n"
 	     "\t[--quality [1-5]]\n"
 	     "\t[--format <format>]\n"
 	     "\t[--swizzle <rgba01>x4]\n"
@@ -129,6 +131,8 @@ int main(int argc, char *argv[])
 	cbs.add("--fixup-alpha", [&](CLIParser &) { fixup_alpha = true; });
 	cbs.add("--mipgen", [&](CLIParser &) { generate_mipmap = true; });
 	cbs.add("--deferred-mipgen", [&](CLIParser &) { deferred_generate_mipmap = true; });
+	cbs.add("--supercompress", [&](CLIParser &) { args.supercompress = true; });
+	cbs.add("--native-bc", [&](CLIParser &) { args.native_bc_encoder = true; });
 	cbs.add("--swizzle", [&](CLIParser &parser) { swizzle = parse_swizzle(parser.next_string()); });
 	cbs.default_handler = [&](const char *arg) { input_path = arg; };
 	cbs.error_handler = []() { print_help(); };
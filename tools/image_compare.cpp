@@ -29,13 +29,18 @@
 #include "texture_files.hpp"
 #include "thread_group.hpp"
 #include "global_managers_init.hpp"
+#include "string_helpers.hpp"
+#include "rapidjson_wrapper.hpp"
+#include "image_metrics.hpp"
 #include <algorithm>
+#include <unordered_map>
 #include <string.h>
 #include <vector>
 
 using namespace Util;
 using namespace Granite;
 using namespace Vulkan;
+using namespace rapidjson;
 
 static void save_diff_image(const std::string &path,
                             const MemoryMappedTexture &a,
@@ -77,67 +82,375 @@ static void save_diff_image(const std::string &path,
 		LOGE("Failed to save diff-png to %s.\n", path.c_str());
 }
 
-static double compare_images(const MemoryMappedTexture &a, const MemoryMappedTexture &b)
+static bool validate_images(const MemoryMappedTexture &a, const MemoryMappedTexture &b, std::string &error)
 {
 	if (a.get_layout().get_format() != b.get_layout().get_format())
 	{
-		LOGE("Format mismatch.\n");
-		return 0.0;
+		error = "Format mismatch.";
+		return false;
 	}
 
 	if (a.get_layout().get_format() != VK_FORMAT_R8G8B8A8_SRGB &&
 	    a.get_layout().get_format() != VK_FORMAT_R8G8B8A8_UNORM)
 	{
-		LOGE("Unsupported format.\n");
-		return 0.0;
+		error = "Unsupported format.";
+		return false;
 	}
 
 	if (a.get_layout().get_width() != b.get_layout().get_width() ||
 	    a.get_layout().get_height() != b.get_layout().get_height())
 	{
-		LOGE("Dimension mismatch.\n");
-		return 0.0;
+		error = "Dimension mismatch.";
+		return false;
 	}
 
-	int width = a.get_layout().get_width();
-	int height = a.get_layout().get_height();
+	return true;
+}
+
+// Rows per task when a single large image is split over the thread group.
+// Multiple of the SSIM window stride so that window rows split evenly as well.
+static constexpr unsigned CompareBandRows = 128;
+static_assert(CompareBandRows % ImageSSIMWindowStride == 0, "Band rows must align with SSIM windows.");
+
+static ImageMetrics compare_images(const MemoryMappedTexture &a, const MemoryMappedTexture &b, ThreadGroup *workers)
+{
+	unsigned width = a.get_layout().get_width();
+	unsigned height = a.get_layout().get_height();
+	size_t row_stride = size_t(width) * 4;
 
 	auto *src_a = static_cast<const uint8_t *>(a.get_layout().data());
 	auto *src_b = static_cast<const uint8_t *>(b.get_layout().data());
 
-	double peak_energy = 255.0 * 255.0 * width * height * 3.0;
-	double error_energy = 0.0;
-	for (int pix = 0; pix < width * height; pix++, src_a += 4, src_b += 4)
+	std::vector<uint8_t> luma_a(size_t(width) * height);
+	std::vector<uint8_t> luma_b(size_t(width) * height);
+	unsigned window_rows = get_image_ssim_window_rows(height);
+
+	unsigned num_bands = (height + CompareBandRows - 1) / CompareBandRows;
+	std::vector<ImageErrorAccumulator> error_bands(num_bands);
+	std::vector<ImageErrorAccumulator> ssim_bands(num_bands);
+
+	const auto run_error_band = [&, src_a, src_b](unsigned band) {
+		unsigned begin_row = band * CompareBandRows;
+		unsigned end_row = std::min(begin_row + CompareBandRows, height);
+		accumulate_image_error(src_a, src_b, row_stride, width, begin_row, end_row, error_bands[band]);
+		compute_image_luma(src_a, row_stride, width, begin_row, end_row, luma_a.data());
+		compute_image_luma(src_b, row_stride, width, begin_row, end_row, luma_b.data());
+	};
+
+	const auto run_ssim_band = [&](unsigned band) {
+		unsigned begin_window = band * (CompareBandRows / ImageSSIMWindowStride);
+		unsigned end_window = std::min(begin_window + CompareBandRows / ImageSSIMWindowStride, window_rows);
+		if (begin_window < end_window)
+			accumulate_image_ssim(luma_a.data(), luma_b.data(), width, height, begin_window, end_window, ssim_bands[band]);
+	};
+
+	if (workers && num_bands > 1)
 	{
-		int diff_r = src_a[0] - src_b[0];
-		int diff_g = src_a[1] - src_b[1];
-		int diff_b = src_a[2] - src_b[2];
-		error_energy += diff_r * diff_r;
-		error_energy += diff_g * diff_g;
-		error_energy += diff_b * diff_b;
+		// SSIM windows straddle bands, so all luma must be ready first.
+		auto error_task = workers->create_task();
+		auto ssim_task = workers->create_task();
+		workers->add_dependency(*ssim_task, *error_task);
+
+		for (unsigned band = 0; band < num_bands; band++)
+		{
+			error_task->enqueue_task([&run_error_band, band]() { run_error_band(band); });
+			ssim_task->enqueue_task([&run_ssim_band, band]() { run_ssim_band(band); });
+		}
+
+		error_task->flush();
+		ssim_task->flush();
+		ssim_task->wait();
+	}
+	else
+	{
+		for (unsigned band = 0; band < num_bands; band++)
+			run_error_band(band);
+		for (unsigned band = 0; band < num_bands; band++)
+			run_ssim_band(band);
+	}
+
+	ImageErrorAccumulator acc;
+	for (auto &band : error_bands)
+		acc.merge(band);
+	for (auto &band : ssim_bands)
+		acc.merge(band);
+
+	return finalize_image_metrics(acc, width, height);
+}
+
+struct ComparisonResult
+{
+	enum class Status
+	{
+		Pass,
+		Fail,
+		// Either side could not be loaded. Directories may contain files which are not images.
+		Skipped,
+		// The images cannot be compared, or one side is missing.
+		Error
+	};
+
+	std::string reference;
+	std::string candidate;
+	Status status = Status::Pass;
+	std::string error;
+	unsigned width = 0;
+	unsigned height = 0;
+	ImageMetrics metrics;
+};
+
+struct Arguments
+{
+	std::vector<std::string> inputs;
+	std::string manifest;
+	std::string diff;
+	std::string diff_dir;
+	std::string report;
+	double threshold = -1.0;
+	double ssim_threshold = -1.0;
+};
+
+static bool passes_thresholds(const Arguments &args, const ImageMetrics &metrics)
+{
+	if (args.threshold >= 0.0 && metrics.psnr < args.threshold)
+		return false;
+	if (args.ssim_threshold >= 0.0 && metrics.ssim < args.ssim_threshold)
+		return false;
+	return true;
+}
+
+static const char *status_to_string(ComparisonResult::Status status)
+{
+	switch (status)
+	{
+	case ComparisonResult::Status::Pass:
+		return "pass";
+	case ComparisonResult::Status::Fail:
+		return "fail";
+	case ComparisonResult::Status::Skipped:
+		return "skipped";
+	default:
+		return "error";
+	}
+}
+
+static void compare_pair(const Arguments &args, ComparisonResult &result, ThreadGroup *workers)
+{
+	// Images are only held while their comparison runs,
+	// so memory is bounded by the number of worker threads, not the batch size.
+	auto a = load_texture_from_file(*GRANITE_FILESYSTEM(), result.reference);
+	auto b = load_texture_from_file(*GRANITE_FILESYSTEM(), result.candidate);
+	if (a.empty() || b.empty())
+	{
+		result.status = ComparisonResult::Status::Skipped;
+		result.error = "Failed to load texture.";
+		return;
+	}
+
+	if (!validate_images(a, b, result.error))
+	{
+		result.status = ComparisonResult::Status::Error;
+		return;
+	}
+
+	result.width = a.get_layout().get_width();
+	result.height = a.get_layout().get_height();
+	result.metrics = compare_images(a, b, workers);
+	result.status = passes_thresholds(args, result.metrics) ?
+	                ComparisonResult::Status::Pass : ComparisonResult::Status::Fail;
+
+	// Without thresholds, any difference is interesting enough for a diff image.
+	bool has_threshold = args.threshold >= 0.0 || args.ssim_threshold >= 0.0;
+	bool interesting = has_threshold ? result.status == ComparisonResult::Status::Fail :
+	                   result.metrics.differing_pixels != 0;
+
+	if (!args.diff.empty())
+		save_diff_image(args.diff, a, b);
+	else if (!args.diff_dir.empty() && interesting)
+	{
+		auto diff_path = Path::join(args.diff_dir, Path::basename(result.reference) + ".diff.png");
+		save_diff_image(diff_path, a, b);
+	}
+}
+
+static bool gather_directory_pairs(const std::string &reference_dir, const std::string &candidate_dir,
+                                   std::vector<ComparisonResult> &results)
+{
+	auto a_list = GRANITE_FILESYSTEM()->list(reference_dir);
+	auto b_list = GRANITE_FILESYSTEM()->list(candidate_dir);
+
+	std::sort(begin(a_list), end(a_list), [](const ListEntry &a, const ListEntry &b) {
+		return strcmp(a.path.c_str(), b.path.c_str()) < 0;
+	});
+
+	std::unordered_map<std::string, std::string> candidates;
+	for (auto &entry : b_list)
+		if (entry.type == PathType::File)
+			candidates[Path::basename(entry.path)] = entry.path;
+
+	// Pair by file name so that one missing image doesn't shift every comparison after it.
+	for (auto &entry : a_list)
+	{
+		if (entry.type != PathType::File)
+			continue;
+
+		ComparisonResult result;
+		result.reference = entry.path;
+		auto itr = candidates.find(Path::basename(entry.path));
+		if (itr != end(candidates))
+		{
+			result.candidate = itr->second;
+			candidates.erase(itr);
+		}
+		else
+		{
+			result.status = ComparisonResult::Status::Error;
+			result.error = "Missing candidate.";
+		}
+		results.push_back(std::move(result));
+	}
+
+	for (auto &candidate : candidates)
+	{
+		ComparisonResult result;
+		result.candidate = candidate.second;
+		result.status = ComparisonResult::Status::Error;
+		result.error = "Missing reference.";
+		results.push_back(std::move(result));
+	}
+
+	return true;
+}
+
+// One comparison per line, "<reference> <candidate>". Empty lines and lines starting with # are ignored.
+static bool gather_manifest_pairs(const std::string &path, std::vector<ComparisonResult> &results)
+{
+	std::string manifest;
+	if (!GRANITE_FILESYSTEM()->read_file_to_string(path, manifest))
+	{
+		LOGE("Failed to read manifest: %s\n", path.c_str());
+		return false;
 	}
 
-	return 10.0 * muglm::log10(peak_energy / error_energy);
+	auto lines = Util::split_no_empty(manifest, "\n");
+	for (auto &line : lines)
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+
+		auto tokens = Util::split_no_empty(line, " \t");
+		if (tokens.empty() || tokens.front()[0] == '#')
+			continue;
+
+		if (tokens.size() != 2)
+		{
+			LOGE("Invalid manifest line: %s\n", line.c_str());
+			return false;
+		}
+
+		ComparisonResult result;
+		result.reference = tokens[0];
+		result.candidate = tokens[1];
+		results.push_back(std::move(result));
+	}
+
+	return true;
+}
+
+static bool write_report(const std::string &path, const std::vector<ComparisonResult> &results, unsigned failures)
+{
+	Document doc;
+	doc.SetObject();
+	auto &allocator = doc.GetAllocator();
+
+	Value images(kArrayType);
+	for (auto &result : results)
+	{
+		Value image(kObjectType);
+		Value reference(result.reference.c_str(), allocator);
+		Value candidate(result.candidate.c_str(), allocator);
+		image.AddMember("reference", reference, allocator);
+		image.AddMember("candidate", candidate, allocator);
+		image.AddMember("status", StringRef(status_to_string(result.status)), allocator);
+
+		if (!result.error.empty())
+		{
+			Value error(result.error.c_str(), allocator);
+			image.AddMember("error", error, allocator);
+		}
+
+		if (result.status == ComparisonResult::Status::Pass || result.status == ComparisonResult::Status::Fail)
+		{
+			auto &metrics = result.metrics;
+			image.AddMember("width", result.width, allocator);
+			image.AddMember("height", result.height, allocator);
+			image.AddMember("identical", metrics.differing_pixels == 0, allocator);
+			// JSON cannot represent infinity, identical images have no PSNR.
+			if (metrics.differing_pixels != 0)
+				image.AddMember("psnr", metrics.psnr, allocator);
+			image.AddMember("mse", metrics.mse, allocator);
+			image.AddMember("ssim", metrics.ssim, allocator);
+			image.AddMember("maxDifference", metrics.max_difference, allocator);
+			image.AddMember("differingPixels", uint64_t(metrics.differing_pixels), allocator);
+		}
+
+		images.PushBack(image, allocator);
+	}
+
+	doc.AddMember("count", unsigned(results.size()), allocator);
+	doc.AddMember("failures", failures, allocator);
+	doc.AddMember("images", images, allocator);
+
+	StringBuffer buffer;
+	PrettyWriter<StringBuffer> writer(buffer);
+	doc.Accept(writer);
+
+	if (!GRANITE_FILESYSTEM()->write_string_to_file(path, buffer.GetString()))
+	{
+		LOGE("Failed to write report to %s.\n", path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static void print_help()
+{
+	LOGI("Usage: image-compare [--threshold <PSNR dB>] [--ssim-threshold <SSIM>] [--report <report.json>]\n"
+	     "\t[--diff <diff.png>] <reference> <candidate>\n"
+	     "\t[--diff-dir <dir>] <reference dir> <candidate dir>\n"
+	     "\t[--diff-dir <dir>] --manifest <manifest>\n");
 }
 
 int main(int argc, char *argv[])
 {
 	Global::init();
 
-	struct Arguments
-	{
-		std::vector<std::string> inputs;
-		std::string diff;
-		double threshold = -1.0;
-	} args;
+	Arguments args;
 	CLICallbacks cbs;
 
+	cbs.add("--help", [&](CLIParser &parser) {
+		print_help();
+		parser.end();
+	});
 	cbs.add("--threshold", [&](CLIParser &parser) {
 		args.threshold = parser.next_double();
 	});
+	cbs.add("--ssim-threshold", [&](CLIParser &parser) {
+		args.ssim_threshold = parser.next_double();
+	});
 	cbs.add("--diff", [&](CLIParser &parser) {
 		args.diff = parser.next_string();
 	});
+	cbs.add("--diff-dir", [&](CLIParser &parser) {
+		args.diff_dir = parser.next_string();
+	});
+	cbs.add("--manifest", [&](CLIParser &parser) {
+		args.manifest = parser.next_string();
+	});
+	cbs.add("--report", [&](CLIParser &parser) {
+		args.report = parser.next_string();
+	});
 	cbs.default_handler = [&](const char *arg) {
 		args.inputs.push_back(arg);
 	};
@@ -145,10 +458,13 @@ int main(int argc, char *argv[])
 	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
 	if (!parser.parse())
 		return 1;
+	else if (parser.is_ended_state())
+		return 0;
 
-	if (args.inputs.size() != 2)
+	if (args.manifest.empty() && args.inputs.size() != 2)
 	{
-		LOGE("Need two inputs.\n");
+		LOGE("Need two inputs or a manifest.\n");
+		print_help();
 		return 1;
 	}
 
@@ -158,101 +474,88 @@ int main(int argc, char *argv[])
 		              Global::set_thread_context(*ctx);
 	              });
 
+	std::vector<ComparisonResult> results;
+	bool batch = true;
+
 	FileStat a_stat, b_stat;
-	if (GRANITE_FILESYSTEM()->stat(args.inputs[0], a_stat) && a_stat.type == PathType::Directory &&
-	    GRANITE_FILESYSTEM()->stat(args.inputs[1], b_stat) && b_stat.type == PathType::Directory)
+	if (!args.manifest.empty())
 	{
-		auto a_list = GRANITE_FILESYSTEM()->list(args.inputs[0]);
-		auto b_list = GRANITE_FILESYSTEM()->list(args.inputs[1]);
-
-		std::sort(begin(a_list), end(a_list), [](const ListEntry &a, const ListEntry &b) {
-			return strcmp(a.path.c_str(), b.path.c_str()) < 0;
-		});
-		std::sort(begin(b_list), end(b_list), [](const ListEntry &a, const ListEntry &b) {
-			return strcmp(a.path.c_str(), b.path.c_str()) < 0;
-		});
-
-		if (a_list.size() != b_list.size())
-		{
-			LOGE("Folder size is not identical.\n");
+		if (!gather_manifest_pairs(args.manifest, results))
 			return 1;
-		}
-
-		std::vector<double> psnrs(a_list.size());
-		std::vector<bool> ignore(a_list.size());
+	}
+	else if (GRANITE_FILESYSTEM()->stat(args.inputs[0], a_stat) && a_stat.type == PathType::Directory &&
+	         GRANITE_FILESYSTEM()->stat(args.inputs[1], b_stat) && b_stat.type == PathType::Directory)
+	{
+		if (!gather_directory_pairs(args.inputs[0], args.inputs[1], results))
+			return 1;
+	}
+	else
+	{
+		ComparisonResult result;
+		result.reference = args.inputs[0];
+		result.candidate = args.inputs[1];
+		results.push_back(std::move(result));
+		batch = false;
+	}
 
+	if (batch)
+	{
+		// Parallelize over images, every comparison is single threaded.
+		args.diff.clear();
 		auto task = workers.create_task();
-
-		for (unsigned i = 0; i < a_list.size(); i++)
+		for (auto &result : results)
 		{
-			task->enqueue_task([&a_list, &b_list, &psnrs, &ignore, i]() {
-				auto a = load_texture_from_file(*GRANITE_FILESYSTEM(), a_list[i].path);
-				auto b = load_texture_from_file(*GRANITE_FILESYSTEM(), b_list[i].path);
-				if (a.empty() || b.empty())
-				{
-					psnrs[i] = 0.0;
-					ignore[i] = true;
-				}
-
-				psnrs[i] = compare_images(a, b);
-
+			if (result.status != ComparisonResult::Status::Pass)
+				continue;
+			task->enqueue_task([&args, &result]() {
+				compare_pair(args, result, nullptr);
 			});
 		}
-
 		task->flush();
 		task->wait();
-
-		for (unsigned i = 0; i < a_list.size(); i++)
-		{
-			if (ignore[i])
-				continue;
-
-			LOGI("%s | %s | PSNR: %.f dB\n", a_list[i].path.c_str(), b_list[i].path.c_str(), psnrs[i]);
-
-			if (args.threshold >= 0.0)
-			{
-				if (psnrs[i] < args.threshold)
-				{
-					LOGE("PSNR is too low, failure!\n");
-					return 1;
-				}
-			}
-		}
 	}
 	else
 	{
-		auto a = load_texture_from_file(*GRANITE_FILESYSTEM(), args.inputs[0]);
-		auto b = load_texture_from_file(*GRANITE_FILESYSTEM(), args.inputs[1]);
-
-		if (a.empty())
-		{
-			LOGE("Failed to load texture: %s\n", args.inputs[0].c_str());
-			return 1;
-		}
-
-		if (b.empty())
+		// A single comparison is split into row bands over all threads.
+		compare_pair(args, results.front(), &workers);
+		if (results.front().status == ComparisonResult::Status::Skipped)
 		{
-			LOGE("Failed to load texture: %s\n", args.inputs[1].c_str());
+			LOGE("Failed to load textures: %s, %s\n", args.inputs[0].c_str(), args.inputs[1].c_str());
 			return 1;
 		}
+	}
 
-		if (!args.diff.empty())
-		{
-			save_diff_image(args.diff, a, b);
-		}
-
-		double psnr = compare_images(a, b);
-		LOGI("PSNR: %.f dB\n", psnr);
-
-		if (args.threshold >= 0.0)
+	unsigned failures = 0;
+	for (auto &result : results)
+	{
+		switch (result.status)
 		{
-			if (psnr < args.threshold)
+		case ComparisonResult::Status::Pass:
+		case ComparisonResult::Status::Fail:
+			LOGI("%s | %s | PSNR: %.f dB | SSIM: %.5f\n", result.reference.c_str(), result.candidate.c_str(),
+			     result.metrics.psnr, result.metrics.ssim);
+			if (result.status == ComparisonResult::Status::Fail)
 			{
-				LOGE("PSNR is too low, failure!\n");
-				return 1;
+				LOGE("%s: PSNR or SSIM is too low, failure!\n", result.reference.c_str());
+				failures++;
 			}
+			break;
+
+		case ComparisonResult::Status::Skipped:
+			break;
+
+		case ComparisonResult::Status::Error:
+			LOGE("%s | %s | %s\n", result.reference.c_str(), result.candidate.c_str(), result.error.c_str());
+			failures++;
+			break;
 		}
 	}
 
-	return 0;
+	if (batch)
+		LOGI("Compared %u images, %u failed.\n", unsigned(results.size()), failures);
+
+	if (!args.report.empty() && !write_report(args.report, results, failures))
+		return 1;
+
+	return failures ? 1 : 0;
 }
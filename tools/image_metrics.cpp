@@ -0,0 +1,307 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "image_metrics.hpp"
+#include "simd_headers.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "bitops.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdlib.h>
+
+namespace Granite
+{
+void ImageErrorAccumulator::merge(const ImageErrorAccumulator &other)
+{
+	squared_error += other.squared_error;
+	differing_pixels += other.differing_pixels;
+	max_difference = std::max(max_difference, other.max_difference);
+	ssim_sum += other.ssim_sum;
+	ssim_windows += other.ssim_windows;
+}
+
+static unsigned get_window_count(unsigned size)
+{
+	if (size == 0)
+		return 0;
+	unsigned window = std::min(size, ImageSSIMWindowSize);
+	return (size - window) / ImageSSIMWindowStride + 1;
+}
+
+unsigned get_image_ssim_window_rows(unsigned height)
+{
+	return get_window_count(height);
+}
+
+static void accumulate_row_error_scalar(const uint8_t *a, const uint8_t *b, unsigned count, ImageErrorAccumulator &acc)
+{
+	for (unsigned x = 0; x < count; x++, a += 4, b += 4)
+	{
+		unsigned diff_r = unsigned(std::abs(int(a[0]) - int(b[0])));
+		unsigned diff_g = unsigned(std::abs(int(a[1]) - int(b[1])));
+		unsigned diff_b = unsigned(std::abs(int(a[2]) - int(b[2])));
+		acc.squared_error += diff_r * diff_r + diff_g * diff_g + diff_b * diff_b;
+		unsigned max_diff = std::max(std::max(diff_r, diff_g), diff_b);
+		acc.max_difference = std::max(acc.max_difference, max_diff);
+		acc.differing_pixels += max_diff != 0;
+	}
+}
+
+void accumulate_image_error(const uint8_t *a, const uint8_t *b, size_t row_stride, unsigned width,
+                            unsigned begin_row, unsigned end_row, ImageErrorAccumulator &acc)
+{
+	for (unsigned y = begin_row; y < end_row; y++)
+	{
+		const uint8_t *row_a = a + y * row_stride;
+		const uint8_t *row_b = b + y * row_stride;
+		unsigned x = 0;
+
+#if defined(__SSE3__)
+		const __m128i rgb_mask = _mm_set1_epi32(0x00ffffff);
+		const __m128i zero = _mm_setzero_si128();
+		__m128i max_diff = zero;
+
+		while (x + 4 <= width)
+		{
+			// 32-bit lanes take at most 2 * 3 * 255^2 per iteration, flush before they can overflow.
+			unsigned iterations = std::min((width - x) >> 2, 1024u);
+			__m128i sum = zero;
+			unsigned equal_pixels = 0;
+
+			for (unsigned i = 0; i < iterations; i++, x += 4)
+			{
+				__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row_a + 4 * x));
+				__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row_b + 4 * x));
+				__m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+				diff = _mm_and_si128(diff, rgb_mask);
+				max_diff = _mm_max_epu8(max_diff, diff);
+
+				__m128i equal = _mm_cmpeq_epi32(diff, zero);
+				equal_pixels += Util::popcount32(uint32_t(_mm_movemask_ps(_mm_castsi128_ps(equal))));
+
+				__m128i lo = _mm_unpacklo_epi8(diff, zero);
+				__m128i hi = _mm_unpackhi_epi8(diff, zero);
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(lo, lo));
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(hi, hi));
+			}
+
+			alignas(16) uint32_t lanes[4];
+			_mm_store_si128(reinterpret_cast<__m128i *>(lanes), sum);
+			acc.squared_error += uint64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+			acc.differing_pixels += 4 * iterations - equal_pixels;
+		}
+
+		alignas(16) uint8_t max_bytes[16];
+		_mm_store_si128(reinterpret_cast<__m128i *>(max_bytes), max_diff);
+		for (auto m : max_bytes)
+			acc.max_difference = std::max<unsigned>(acc.max_difference, m);
+#elif defined(__ARM_NEON)
+		const uint8x16_t rgb_mask = vreinterpretq_u8_u32(vdupq_n_u32(0x00ffffff));
+		uint8x16_t max_diff = vdupq_n_u8(0);
+
+		while (x + 4 <= width)
+		{
+			unsigned iterations = std::min((width - x) >> 2, 1024u);
+			uint32x4_t sum = vdupq_n_u32(0);
+			uint32x4_t differing = vdupq_n_u32(0);
+
+			for (unsigned i = 0; i < iterations; i++, x += 4)
+			{
+				uint8x16_t diff = vandq_u8(vabdq_u8(vld1q_u8(row_a + 4 * x), vld1q_u8(row_b + 4 * x)), rgb_mask);
+				max_diff = vmaxq_u8(max_diff, diff);
+
+				// All ones for pixels which differ, subtracting it counts them.
+				uint32x4_t diff32 = vreinterpretq_u32_u8(diff);
+				differing = vsubq_u32(differing, vtstq_u32(diff32, diff32));
+
+				sum = vpadalq_u16(sum, vmull_u8(vget_low_u8(diff), vget_low_u8(diff)));
+				sum = vpadalq_u16(sum, vmull_u8(vget_high_u8(diff), vget_high_u8(diff)));
+			}
+
+			uint32_t lanes[4], counts[4];
+			vst1q_u32(lanes, sum);
+			vst1q_u32(counts, differing);
+			acc.squared_error += uint64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+			acc.differing_pixels += uint64_t(counts[0]) + counts[1] + counts[2] + counts[3];
+		}
+
+		uint8_t max_bytes[16];
+		vst1q_u8(max_bytes, max_diff);
+		for (auto m : max_bytes)
+			acc.max_difference = std::max<unsigned>(acc.max_difference, m);
+#endif
+
+		accumulate_row_error_scalar(row_a + 4 * x, row_b + 4 * x, width - x, acc);
+	}
+}
+
+void compute_image_luma(const uint8_t *rgba, size_t row_stride, unsigned width,
+                        unsigned begin_row, unsigned end_row, uint8_t *luma)
+{
+	// BT.601 weights in 8-bit fixed point. Simple enough for the compiler to vectorize.
+	for (unsigned y = begin_row; y < end_row; y++)
+	{
+		const uint8_t *src = rgba + y * row_stride;
+		uint8_t *dst = luma + size_t(y) * width;
+		for (unsigned x = 0; x < width; x++, src += 4)
+			dst[x] = uint8_t((77u * src[0] + 150u * src[1] + 29u * src[2] + 128u) >> 8);
+	}
+}
+
+struct WindowSums
+{
+	uint32_t sum_a, sum_b, sum_aa, sum_bb, sum_ab;
+};
+
+static WindowSums compute_window_sums_scalar(const uint8_t *a, const uint8_t *b, unsigned width,
+                                             unsigned window_w, unsigned window_h)
+{
+	WindowSums sums = {};
+	for (unsigned y = 0; y < window_h; y++, a += width, b += width)
+	{
+		for (unsigned x = 0; x < window_w; x++)
+		{
+			uint32_t va = a[x], vb = b[x];
+			sums.sum_a += va;
+			sums.sum_b += vb;
+			sums.sum_aa += va * va;
+			sums.sum_bb += vb * vb;
+			sums.sum_ab += va * vb;
+		}
+	}
+	return sums;
+}
+
+static WindowSums compute_window_sums(const uint8_t *a, const uint8_t *b, unsigned width)
+{
+#if defined(__SSE3__)
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum_a = zero, sum_b = zero, sum_aa = zero, sum_bb = zero, sum_ab = zero;
+
+	for (unsigned y = 0; y < ImageSSIMWindowSize; y++, a += width, b += width)
+	{
+		__m128i va = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(a));
+		__m128i vb = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(b));
+		sum_a = _mm_add_epi32(sum_a, _mm_sad_epu8(va, zero));
+		sum_b = _mm_add_epi32(sum_b, _mm_sad_epu8(vb, zero));
+
+		__m128i wa = _mm_unpacklo_epi8(va, zero);
+		__m128i wb = _mm_unpacklo_epi8(vb, zero);
+		sum_aa = _mm_add_epi32(sum_aa, _mm_madd_epi16(wa, wa));
+		sum_bb = _mm_add_epi32(sum_bb, _mm_madd_epi16(wb, wb));
+		sum_ab = _mm_add_epi32(sum_ab, _mm_madd_epi16(wa, wb));
+	}
+
+	const auto horizontal_sum = [](__m128i v) -> uint32_t {
+		v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+		v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+		return uint32_t(_mm_cvtsi128_si32(v));
+	};
+
+	WindowSums sums;
+	sums.sum_a = uint32_t(_mm_cvtsi128_si32(sum_a));
+	sums.sum_b = uint32_t(_mm_cvtsi128_si32(sum_b));
+	sums.sum_aa = horizontal_sum(sum_aa);
+	sums.sum_bb = horizontal_sum(sum_bb);
+	sums.sum_ab = horizontal_sum(sum_ab);
+	return sums;
+#elif defined(__ARM_NEON)
+	uint16x8_t sum_a = vdupq_n_u16(0), sum_b = vdupq_n_u16(0);
+	uint32x4_t sum_aa = vdupq_n_u32(0), sum_bb = vdupq_n_u32(0), sum_ab = vdupq_n_u32(0);
+
+	for (unsigned y = 0; y < ImageSSIMWindowSize; y++, a += width, b += width)
+	{
+		uint8x8_t va = vld1_u8(a);
+		uint8x8_t vb = vld1_u8(b);
+		sum_a = vaddw_u8(sum_a, va);
+		sum_b = vaddw_u8(sum_b, vb);
+		sum_aa = vpadalq_u16(sum_aa, vmull_u8(va, va));
+		sum_bb = vpadalq_u16(sum_bb, vmull_u8(vb, vb));
+		sum_ab = vpadalq_u16(sum_ab, vmull_u8(va, vb));
+	}
+
+	const auto horizontal_sum = [](uint32x4_t v) -> uint32_t {
+		uint32_t lanes[4];
+		vst1q_u32(lanes, v);
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	};
+
+	WindowSums sums;
+	sums.sum_a = horizontal_sum(vpaddlq_u16(sum_a));
+	sums.sum_b = horizontal_sum(vpaddlq_u16(sum_b));
+	sums.sum_aa = horizontal_sum(sum_aa);
+	sums.sum_bb = horizontal_sum(sum_bb);
+	sums.sum_ab = horizontal_sum(sum_ab);
+	return sums;
+#else
+	return compute_window_sums_scalar(a, b, width, ImageSSIMWindowSize, ImageSSIMWindowSize);
+#endif
+}
+
+void accumulate_image_ssim(const uint8_t *luma_a, const uint8_t *luma_b, unsigned width, unsigned height,
+                           unsigned begin_window_row, unsigned end_window_row, ImageErrorAccumulator &acc)
+{
+	// Standard constants for 8-bit data, K1 = 0.01 and K2 = 0.03.
+	constexpr double C1 = (0.01 * 255.0) * (0.01 * 255.0);
+	constexpr double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+
+	unsigned window_w = std::min(width, ImageSSIMWindowSize);
+	unsigned window_h = std::min(height, ImageSSIMWindowSize);
+	bool full_window = window_w == ImageSSIMWindowSize && window_h == ImageSSIMWindowSize;
+	unsigned window_columns = get_window_count(width);
+	double inv_count = 1.0 / double(window_w * window_h);
+
+	for (unsigned wy = begin_window_row; wy < end_window_row; wy++)
+	{
+		for (unsigned wx = 0; wx < window_columns; wx++)
+		{
+			size_t offset = size_t(wy * ImageSSIMWindowStride) * width + wx * ImageSSIMWindowStride;
+			WindowSums sums = full_window ?
+			                  compute_window_sums(luma_a + offset, luma_b + offset, width) :
+			                  compute_window_sums_scalar(luma_a + offset, luma_b + offset, width, window_w, window_h);
+
+			double mean_a = sums.sum_a * inv_count;
+			double mean_b = sums.sum_b * inv_count;
+			double var_a = sums.sum_aa * inv_count - mean_a * mean_a;
+			double var_b = sums.sum_bb * inv_count - mean_b * mean_b;
+			double covar = sums.sum_ab * inv_count - mean_a * mean_b;
+
+			acc.ssim_sum += ((2.0 * mean_a * mean_b + C1) * (2.0 * covar + C2)) /
+			                ((mean_a * mean_a + mean_b * mean_b + C1) * (var_a + var_b + C2));
+		}
+		acc.ssim_windows += window_columns;
+	}
+}
+
+ImageMetrics finalize_image_metrics(const ImageErrorAccumulator &acc, unsigned width, unsigned height)
+{
+	ImageMetrics metrics;
+	double samples = 3.0 * double(width) * double(height);
+	metrics.mse = samples > 0.0 ? double(acc.squared_error) / samples : 0.0;
+	metrics.psnr = metrics.mse > 0.0 ? 10.0 * muglm::log10(255.0 * 255.0 / metrics.mse) :
+	               std::numeric_limits<double>::infinity();
+	metrics.ssim = acc.ssim_windows ? acc.ssim_sum / double(acc.ssim_windows) : 1.0;
+	metrics.max_difference = acc.max_difference;
+	metrics.differing_pixels = acc.differing_pixels;
+	return metrics;
+}
+}
@@ -0,0 +1,69 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Granite
+{
+// Error kernels for comparing RGBA8 images, alpha is ignored.
+// Work is split into row ranges so that large images can be spread over threads,
+// partial results are merged with ImageErrorAccumulator::merge().
+struct ImageErrorAccumulator
+{
+	uint64_t squared_error = 0;
+	uint64_t differing_pixels = 0;
+	unsigned max_difference = 0;
+	double ssim_sum = 0.0;
+	uint64_t ssim_windows = 0;
+
+	void merge(const ImageErrorAccumulator &other);
+};
+
+struct ImageMetrics
+{
+	double mse = 0.0;
+	// Infinite for identical images.
+	double psnr = 0.0;
+	double ssim = 1.0;
+	unsigned max_difference = 0;
+	uint64_t differing_pixels = 0;
+};
+
+// SSIM is evaluated on luma in 8x8 windows with a stride of 4 pixels.
+constexpr unsigned ImageSSIMWindowSize = 8;
+constexpr unsigned ImageSSIMWindowStride = 4;
+unsigned get_image_ssim_window_rows(unsigned height);
+
+void accumulate_image_error(const uint8_t *a, const uint8_t *b, size_t row_stride, unsigned width,
+                            unsigned begin_row, unsigned end_row, ImageErrorAccumulator &acc);
+
+void compute_image_luma(const uint8_t *rgba, size_t row_stride, unsigned width,
+                        unsigned begin_row, unsigned end_row, uint8_t *luma);
+
+void accumulate_image_ssim(const uint8_t *luma_a, const uint8_t *luma_b, unsigned width, unsigned height,
+                           unsigned begin_window_row, unsigned end_window_row, ImageErrorAccumulator &acc);
+
+ImageMetrics finalize_image_metrics(const ImageErrorAccumulator &acc, unsigned width, unsigned height);
+}
@@ -23,66 +23,113 @@
 #include "stb_image.h"
 #include "stb_image_write.h"
 #include "logging.hpp"
+#include "thread_group.hpp"
+#include "string_helpers.hpp"
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <thread>
 #include <vector>
+#include <string>
 #include <string.h>
 #include <stdint.h>
 
 // Handy tool to convert Gloss/Metallic/AO maps to packed textures suitable for glTF 2.0 PBR.
 
-template <uint8_t value>
-static inline void write_constant(stbi_uc *output, int output_component, int x, int y, int stride, const stbi_uc *)
+namespace
 {
-	output[4 * (y * stride + x) + output_component] = value;
-}
-
-static inline void write_image(stbi_uc *output, int output_component, int x, int y, int stride, const stbi_uc *input)
+struct ChannelSource
 {
-	output[4 * (y * stride + x) + output_component] = input[4 * (y * stride + x)];
+	enum class Type
+	{
+		Constant,
+		Copy,
+		Invert
+	};
+
+	Type type = Type::Constant;
+	uint8_t value = 0;
+	stbi_uc *image = nullptr;
+};
 }
 
-static inline void write_image_invert(stbi_uc *output, int output_component, int x, int y, int stride, const stbi_uc *input)
+// Plain per-channel loops with no indirect calls per pixel, so the compiler can vectorize them.
+static void write_channel(uint8_t *output, size_t pixels, unsigned component, const ChannelSource &source)
 {
-	output[4 * (y * stride + x) + output_component] = 255 - input[4 * (y * stride + x)];
+	output += component;
+
+	switch (source.type)
+	{
+	case ChannelSource::Type::Constant:
+		for (size_t i = 0; i < pixels; i++)
+			output[4 * i] = source.value;
+		break;
+
+	case ChannelSource::Type::Copy:
+		for (size_t i = 0; i < pixels; i++)
+			output[4 * i] = source.image[4 * i];
+		break;
+
+	case ChannelSource::Type::Invert:
+		for (size_t i = 0; i < pixels; i++)
+			output[4 * i] = uint8_t(255 - source.image[4 * i]);
+		break;
+	}
 }
 
-int main(int argc, char *argv[])
+static bool pack_image(const std::vector<std::string> &args)
 {
-	if (argc < 4 || (argc & 1))
+	if (args.size() < 3 || (args.size() & 1) == 0)
 	{
-		LOGE("Usage: %s ([R | G | B | A | INV_R | INV_G | INV_B | INV_A] [<component-image> | ONE | ZERO])... <output-image>\n", argv[0]);
-		return 1;
+		LOGE("Invalid number of arguments.\n");
+		return false;
 	}
 
-	int input_components = (argc - 2) / 2;
-	const char *output_image = argv[argc - 1];
+	size_t input_components = (args.size() - 1) / 2;
+	const std::string &output_image = args.back();
 
 	int width = 0;
 	int height = 0;
-	std::vector<uint8_t> output_data;
-	stbi_uc *image_data[4] = {};
+	ChannelSource sources[4];
+	sources[3].value = 0xff;
 
-	using pixel_func = void (*)(stbi_uc *, int, int, int, int, const stbi_uc *);
+	struct ImageReleaser
+	{
+		ChannelSource *sources;
+		~ImageReleaser()
+		{
+			for (unsigned i = 0; i < 4; i++)
+				if (sources[i].image)
+					stbi_image_free(sources[i].image);
+		}
+	} releaser = { sources };
 
-	pixel_func comp_funcs[4] = {
-		write_constant<0>,
-		write_constant<0>,
-		write_constant<0>,
-		write_constant<0xff>,
-	};
+	const auto load_image = [&](int component, const std::string &value, bool invert) -> bool {
+		auto &source = sources[component];
+		if (source.image)
+		{
+			stbi_image_free(source.image);
+			source.image = nullptr;
+		}
 
-	const auto load_image = [&](int component, const char *value, bool invert) {
-		if (strcmp(value, "ZERO") == 0)
-			comp_funcs[component] = write_constant<0>;
-		else if (strcmp(value, "ONE") == 0)
-			comp_funcs[component] = write_constant<0xff>;
+		if (value == "ZERO")
+		{
+			source.type = ChannelSource::Type::Constant;
+			source.value = 0;
+		}
+		else if (value == "ONE")
+		{
+			source.type = ChannelSource::Type::Constant;
+			source.value = 0xff;
+		}
 		else
 		{
 			int x, y, chans;
-			image_data[component] = stbi_load(value, &x, &y, &chans, 4);
-			if (!image_data[component])
+			source.image = stbi_load(value.c_str(), &x, &y, &chans, 4);
+			if (!source.image)
 			{
-				LOGE("Failed to load image: %s\n", value);
-				exit(1);
+				LOGE("Failed to load image: %s\n", value.c_str());
+				return false;
 			}
 
 			if (width || height)
@@ -90,67 +137,124 @@ int main(int argc, char *argv[])
 				if (x != width || y != height)
 				{
 					LOGE("Dimension mismatch!\n");
-					exit(1);
+					return false;
 				}
 			}
 
 			width = x;
 			height = y;
-
-			if (invert)
-				comp_funcs[component] = write_image_invert;
-			else
-				comp_funcs[component] = write_image;
+			source.type = invert ? ChannelSource::Type::Invert : ChannelSource::Type::Copy;
 		}
+
+		return true;
 	};
 
-	for (int i = 0; i < input_components; i++)
+	static const char *commands[] = { "R", "G", "B", "A", "INV_R", "INV_G", "INV_B", "INV_A" };
+
+	for (size_t i = 0; i < input_components; i++)
 	{
-		const char *command = argv[1 + 2 * i];
-		const char *value = argv[2 + 2 * i];
-
-		if (strcmp(command, "R") == 0)
-			load_image(0, value, false);
-		else if (strcmp(command, "G") == 0)
-			load_image(1, value, false);
-		else if (strcmp(command, "B") == 0)
-			load_image(2, value, false);
-		else if (strcmp(command, "A") == 0)
-			load_image(3, value, false);
-		else if (strcmp(command, "INV_R") == 0)
-			load_image(0, value, true);
-		else if (strcmp(command, "INV_G") == 0)
-			load_image(1, value, true);
-		else if (strcmp(command, "INV_B") == 0)
-			load_image(2, value, true);
-		else if (strcmp(command, "INV_A") == 0)
-			load_image(3, value, true);
-		else
+		const std::string &command = args[2 * i];
+		const std::string &value = args[2 * i + 1];
+
+		int index = -1;
+		for (int j = 0; j < 8; j++)
 		{
-			LOGE("Unrecognized command: %s\n", command);
-			return 1;
+			if (command == commands[j])
+			{
+				index = j;
+				break;
+			}
 		}
+
+		if (index < 0)
+		{
+			LOGE("Unrecognized command: %s\n", command.c_str());
+			return false;
+		}
+
+		if (!load_image(index & 3, value, index >= 4))
+			return false;
 	}
 
 	if (!width || !height)
 	{
 		LOGE("No image found. Cannot infer geometry.\n");
-		return 1;
+		return false;
+	}
+
+	size_t pixels = size_t(width) * size_t(height);
+	std::vector<uint8_t> output_data(pixels * 4);
+	for (unsigned c = 0; c < 4; c++)
+		write_channel(output_data.data(), pixels, c, sources[c]);
+
+	if (!stbi_write_png(output_image.c_str(), width, height, 4, output_data.data(), width * 4))
+	{
+		LOGE("Failed to write image: %s\n", output_image.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// Every non-empty line not starting with # is a full set of arguments, as given on the command line.
+static bool pack_batch(const char *manifest_path)
+{
+	std::ifstream file(manifest_path);
+	if (!file)
+	{
+		LOGE("Failed to open manifest: %s\n", manifest_path);
+		return false;
+	}
+
+	std::vector<std::vector<std::string>> jobs;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		auto tokens = Util::split_no_empty(line, " \t");
+		if (tokens.empty() || tokens.front()[0] == '#')
+			continue;
+		jobs.push_back(std::move(tokens));
 	}
 
-	output_data.resize(width * height * 4);
-	for (int y = 0; y < height; y++)
-		for (int x = 0; x < width; x++)
-			for (int c = 0; c < 4; c++)
-				comp_funcs[c](output_data.data(), c, x, y, width, image_data[c]);
+	// Each job only holds its own source images, so peak memory scales with the thread count.
+	Granite::ThreadGroup workers;
+	workers.start(std::thread::hardware_concurrency(), 0, {});
 
-	if (!stbi_write_png(output_image, width, height, 4, output_data.data(), width * 4))
+	std::atomic_bool failed;
+	failed = false;
+
+	auto task = workers.create_task();
+	for (auto &job : jobs)
 	{
-		LOGE("Failed to write image: %s\n", output_image);
+		task->enqueue_task([&job, &failed]() {
+			if (!pack_image(job))
+			{
+				LOGE("Failed to pack %s.\n", job.back().c_str());
+				failed = true;
+			}
+		});
+	}
+	task->flush();
+	task->wait();
+
+	LOGI("Packed %u images.\n", unsigned(jobs.size()));
+	return !failed;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 3 && strcmp(argv[1], "--batch") == 0)
+		return pack_batch(argv[2]) ? 0 : 1;
+
+	if (argc < 4 || (argc & 1))
+	{
+		LOGE("Usage: %s ([R | G | B | A | INV_R | INV_G | INV_B | INV_A] [<component-image> | ONE | ZERO])... <output-image>\n"
+		     "       %s --batch <manifest>\n", argv[0], argv[0]);
 		return 1;
 	}
 
-	for (auto &image : image_data)
-		if (image)
-			stbi_image_free(image);
-}
\ No newline at end of file
+	std::vector<std::string> args(argv + 1, argv + argc);
+	return pack_image(args) ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+
+import sys
+import argparse
+import json
+import statistics
+
+def read_frame_times(path):
+    with open(path, 'r') as f:
+        json_data = f.read()
+        parsed = json.loads(json_data)
+        return parsed
+
+def percentile(values, p):
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(p * (len(ordered) - 1))))
+    return ordered[index]
+
+def summarize(times):
+    return '{:10.3f} {:10.3f} {:10.3f} {:10.3f}'.format(statistics.mean(times), statistics.median(times),
+                                                        percentile(times, 0.95), percentile(times, 0.99))
+
+def main():
+    parser = argparse.ArgumentParser(description = 'Script for diffing per-frame CPU times of headless replays.')
+    parser.add_argument('--frame-times',
+                        help = 'Frame time files written by --frame-times. The first file is the reference.',
+                        nargs = '+')
+    parser.add_argument('--worst',
+                        help = 'Number of frames with the largest regression to list',
+                        type = int,
+                        default = 10)
+    parser.add_argument('--csv',
+                        help = 'Write frame-for-frame times to a CSV file',
+                        type = str)
+
+    args = parser.parse_args()
+    if args.frame_times is None or len(args.frame_times) < 2:
+        print('Need at least two frame time files.')
+        sys.exit(1)
+
+    runs = [read_frame_times(x) for x in args.frame_times]
+    frame_count = min(len(run['frameTimesUs']) for run in runs)
+    if any(len(run['frameTimesUs']) != frame_count for run in runs):
+        print('Warning: frame counts differ, only comparing the first', frame_count, 'frames.')
+
+    reference = runs[0]
+    for path, run in zip(args.frame_times[1:], runs[1:]):
+        if run['timeSteps'][0:frame_count] != reference['timeSteps'][0:frame_count]:
+            print('Warning:', path, 'did not replay the same time steps as the reference.')
+
+    print('{:<40} {:>10} {:>10} {:>10} {:>10}'.format('Run (us)', 'mean', 'median', 'p95', 'p99'))
+    for path, run in zip(args.frame_times, runs):
+        print('{:<40} '.format(path[-40:]) + summarize(run['frameTimesUs'][0:frame_count]))
+
+    ref_times = reference['frameTimesUs']
+    for path, run in zip(args.frame_times[1:], runs[1:]):
+        times = run['frameTimesUs']
+        ratios = [times[i] / ref_times[i] for i in range(frame_count) if ref_times[i] > 0.0]
+        print()
+        print('{}: median per-frame ratio {:.3f}, p95 ratio {:.3f}'.format(path, statistics.median(ratios),
+                                                                           percentile(ratios, 0.95)))
+
+        deltas = sorted(range(frame_count), key = lambda i: times[i] - ref_times[i], reverse = True)
+        for i in deltas[0:args.worst]:
+            print('  frame {:6}: {:10.3f} us -> {:10.3f} us ({:+8.2f} %)'.format(
+                i, ref_times[i], times[i], ((times[i] - ref_times[i]) / ref_times[i]) * 100.0 if ref_times[i] > 0.0 else 0.0))
+
+    if args.csv is not None:
+        with open(args.csv, 'w') as f:
+            f.write('Frame,TimeStep,' + ','.join(args.frame_times) + '\n')
+            for i in range(frame_count):
+                f.write('{},{},'.format(i, reference['timeSteps'][i]) +
+                        ','.join(str(run['frameTimesUs'][i]) for run in runs) + '\n')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,90 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "terrain_tiles.hpp"
+#include "memory_mapped_texture.hpp"
+#include "cli_parser.hpp"
+#include "global_managers_init.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+
+using namespace Granite;
+using namespace Util;
+
+static void print_help()
+{
+	LOGE("Usage: terrain-tile-pack <heightmap.gtx> --output <terrain.bin> [--tile-size <size>] "
+	     "[--sample-spacing <spacing>] [--height-scale <scale>] [--height-offset <offset>]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct Args
+	{
+		std::string input;
+		std::string output;
+		TerrainTileFileInfo info;
+	} args;
+
+	CLICallbacks cbs;
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--output", [&](CLIParser &parser) { args.output = parser.next_string(); });
+	cbs.add("--tile-size", [&](CLIParser &parser) { args.info.tile_size = parser.next_uint(); });
+	cbs.add("--sample-spacing", [&](CLIParser &parser) { args.info.sample_spacing = float(parser.next_double()); });
+	cbs.add("--height-scale", [&](CLIParser &parser) { args.info.height_scale = float(parser.next_double()); });
+	cbs.add("--height-offset", [&](CLIParser &parser) { args.info.height_offset = float(parser.next_double()); });
+	cbs.default_handler = [&](const char *arg) { args.input = arg; };
+	cbs.error_handler = [&]() { print_help(); };
+
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (args.input.empty() || args.output.empty())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	Global::init();
+
+	Vulkan::MemoryMappedTexture texture;
+	if (!texture.map_read(*GRANITE_FILESYSTEM(), args.input) || texture.empty())
+	{
+		LOGE("Failed to load heightmap %s.\n", args.input.c_str());
+		return EXIT_FAILURE;
+	}
+
+	TerrainTextureHeightSource source;
+	if (!source.init(texture))
+		return EXIT_FAILURE;
+
+	if (!write_terrain_tile_file(*GRANITE_FILESYSTEM(), args.output, source, args.info))
+	{
+		LOGE("Failed to write terrain %s.\n", args.output.c_str());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,123 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tmx_parser.hpp"
+#include "tilemap.hpp"
+#include "cli_parser.hpp"
+#include "global_managers_init.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+
+using namespace Granite;
+using namespace Util;
+
+static void print_help()
+{
+	LOGE("Usage: tmx-bake <map.json> --output <map.tilemap> [--tileset <tiles.gtx>] [--layer-spacing <z>]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct Args
+	{
+		std::string input;
+		std::string output;
+		std::string tileset;
+		float layer_spacing = 1.0f;
+	} args;
+
+	CLICallbacks cbs;
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--output", [&](CLIParser &parser) { args.output = parser.next_string(); });
+	cbs.add("--tileset", [&](CLIParser &parser) { args.tileset = parser.next_string(); });
+	cbs.add("--layer-spacing", [&](CLIParser &parser) { args.layer_spacing = float(parser.next_double()); });
+	cbs.default_handler = [&](const char *arg) { args.input = arg; };
+	cbs.error_handler = [&]() { print_help(); };
+
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (args.input.empty() || args.output.empty())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	Global::init();
+
+	try
+	{
+		TMXParser tmx(args.input);
+
+		std::vector<DrawPipeline> pipelines;
+		pipelines.reserve(tmx.get_tiles().size());
+		for (auto &tile : tmx.get_tiles())
+			pipelines.push_back(tile.pipeline);
+
+		TileMap tilemap;
+		tilemap.init(tmx.get_map_tiles(), tmx.get_tile_size(), std::move(pipelines));
+
+		unsigned num_tile_layers = 0;
+		for (auto &layer : tmx.get_layers())
+			if (!layer.tile_indices.empty())
+				num_tile_layers++;
+
+		// The first TMX layer is the bottom one, so it is placed furthest away.
+		for (auto &layer : tmx.get_layers())
+		{
+			if (layer.tile_indices.empty())
+				continue;
+
+			if (any(notEqual(layer.size, tmx.get_map_tiles())))
+			{
+				LOGE("Layer %u does not cover the entire map.\n", layer.id);
+				return EXIT_FAILURE;
+			}
+
+			float z = float(num_tile_layers - tilemap.get_num_layers()) * args.layer_spacing;
+			unsigned index = tilemap.add_layer(layer.tile_indices.data(), z, layer.opacity);
+			tilemap.set_layer_visible(index, layer.visible);
+		}
+
+		if (!tilemap.save_baked(*GRANITE_FILESYSTEM(), args.output))
+		{
+			LOGE("Failed to write tilemap %s.\n", args.output.c_str());
+			return EXIT_FAILURE;
+		}
+
+		if (!args.tileset.empty() && !tmx.save_tilemap_image(*GRANITE_FILESYSTEM(), args.tileset))
+		{
+			LOGE("Failed to write tileset %s.\n", args.tileset.c_str());
+			return EXIT_FAILURE;
+		}
+	}
+	catch (const std::exception &e)
+	{
+		LOGE("Failed to parse %s: %s\n", args.input.c_str(), e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -38,6 +38,7 @@ public:
 	void set_filter(Vulkan::StockSampler sampler_)
 	{
 		sampler = sampler_;
+		redraw_changed();
 	}
 
 	void reconfigure() override;
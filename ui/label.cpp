@@ -35,6 +35,9 @@ Label::Label(std::string text_, FontSize font_size_)
 
 void Label::set_text(std::string text_)
 {
+	// Overlays tend to set text every frame, only relayout and redraw when it changed.
+	if (text == text_)
+		return;
 	text = std::move(text_);
 	geometry_changed();
 }
@@ -31,6 +31,7 @@ namespace UI
 void Slider::set_text(std::string text_)
 {
 	text = std::move(text_);
+	geometry_changed();
 }
 
 void Slider::reconfigure()
@@ -77,6 +78,7 @@ void Slider::set_range(float minimum, float maximum)
 	value_minimum = minimum;
 	value_maximum = maximum;
 	value = mix(value_minimum, value_maximum, normalized_value);
+	geometry_changed();
 	if (value_cb)
 		value_cb(value);
 }
@@ -192,7 +194,11 @@ void Slider::on_mouse_button_move(vec2 offset)
 
 void Slider::on_mouse_button_released(vec2)
 {
-	displaying_tooltip = false;
+	if (displaying_tooltip)
+	{
+		displaying_tooltip = false;
+		redraw_changed();
+	}
 }
 
 float Slider::render(FlatRenderer &renderer, float layer, vec2 offset, vec2)
@@ -53,11 +53,13 @@ public:
 	void set_size(vec2 size_)
 	{
 		size = size_;
+		geometry_changed();
 	}
 
 	void set_color(vec4 color_)
 	{
 		color = color_;
+		redraw_changed();
 	}
 
 	vec4 get_color() const
@@ -68,6 +70,7 @@ public:
 	void set_label_slider_gap(float gap_size)
 	{
 		gap = gap_size;
+		geometry_changed();
 	}
 
 	void set_range(float minimum, float maximum);
@@ -56,6 +56,7 @@ Widget *ToggleButton::on_mouse_button_pressed(vec2)
 {
 	click_held = true;
 	toggled = !toggled;
+	redraw_changed();
 	if (toggle_cb)
 		toggle_cb(toggled);
 	return this;
@@ -64,6 +65,7 @@ Widget *ToggleButton::on_mouse_button_pressed(vec2)
 void ToggleButton::on_mouse_button_released(vec2)
 {
 	click_held = false;
+	redraw_changed();
 }
 
 float ToggleButton::render(FlatRenderer &renderer, float layer, vec2 offset, vec2 size)
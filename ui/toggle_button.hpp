@@ -43,16 +43,19 @@ public:
 	void set_label_alignment(Font::Alignment alignment_)
 	{
 		alignment = alignment_;
+		redraw_changed();
 	}
 
 	void set_untoggled_font_color(vec4 color)
 	{
 		this->untoggled_color = color;
+		redraw_changed();
 	}
 
 	void set_toggled_font_color(vec4 color)
 	{
 		this->toggled_color = color;
+		redraw_changed();
 	}
 
 	void on_toggle(std::function<void (bool)> cb)
@@ -85,7 +85,7 @@ void UIManager::render(Vulkan::CommandBuffer &cmd)
 		}
 
 		renderer.push_scissor(window->get_floating_position(), window_size);
-		float min_layer = widget->render(renderer, minimum_layer, window_pos, window_size);
+		float min_layer = widget->render_retained(renderer, minimum_layer, window_pos, window_size, false);
 		renderer.pop_scissor();
 
 		minimum_layer = min(min_layer, minimum_layer);
@@ -99,6 +99,10 @@ void UIManager::reconfigure_font(FontSize size, const char *ttf, unsigned pix)
 {
 	auto &font = fonts[Util::ecast(size)];
 	font.reset(new Font(ttf, pix));
+
+	// Layouts and retained text draws refer to the old font.
+	for (auto &widget : widgets)
+		widget->invalidate();
 }
 
 Font& UIManager::get_font(FontSize size)
@@ -129,7 +133,9 @@ Font& UIManager::get_font(FontSize size)
 			break;
 		}
 
-		font.reset(new Font("builtin://fonts/font.ttf", pix_size));
+		if (!builtin_atlas)
+			builtin_atlas = Util::make_handle<GlyphAtlas>("builtin://fonts/font.ttf", GlyphAtlas::Mode::Bitmap);
+		font.reset(new Font(builtin_atlas, pix_size));
 	}
 	return *font;
 }
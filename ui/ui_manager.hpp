@@ -71,6 +71,8 @@ public:
 private:
 	FlatRenderer renderer;
 	std::vector<WidgetHandle> widgets;
+	// The built-in font sizes share one glyph atlas.
+	GlyphAtlasHandle builtin_atlas;
 	std::unique_ptr<Font> fonts[Util::ecast(FontSize::Count)];
 	//Font::Alignment alignment = Font::Alignment::Center;
 
@@ -37,32 +37,62 @@ float Widget::render_children(FlatRenderer &renderer, float layer, vec2 offset)
 	{
 		if (child.widget->get_visible())
 		{
-			if (child.widget->bg_color.w > 0.0f)
-			{
-				if (child.widget->bg_image)
-				{
-					auto *view = renderer.get_device().get_resource_manager().get_image_view_blocking(child.widget->bg_image);
-					renderer.render_textured_quad(*view,
-					                              vec3(child.offset + offset, layer - 0.5f), vec2(child.size),
-					                              vec2(0.0f), vec2(view->get_view_width(), view->get_view_height()),
-					                              DrawPipeline::AlphaBlend, child.widget->bg_color, Vulkan::StockSampler::LinearClamp);
-				}
-				else
-				{
-					renderer.render_quad(vec3(child.offset + offset, layer - 0.5f), vec2(child.size),
-					                     child.widget->bg_color);
-				}
-			}
-
-			renderer.push_scissor(child.offset + offset, child.size);
-			float min_layer = child.widget->render(renderer, layer - 1.0f, child.offset + offset, child.size);
+			float min_layer = child.widget->render_retained(renderer, layer, child.offset + offset, child.size, true);
 			minimum_layer = std::min(minimum_layer, min_layer);
-			renderer.pop_scissor();
 		}
 	}
 	return minimum_layer;
 }
 
+float Widget::render_retained(FlatRenderer &renderer, float layer, vec2 offset, vec2 size, bool as_child)
+{
+	Util::Hasher h;
+	h.f32(offset.x);
+	h.f32(offset.y);
+	h.f32(size.x);
+	h.f32(size.y);
+	h.f32(layer);
+	h.u32(uint32_t(as_child));
+	auto key = h.get();
+
+	if (!needs_redraw && renderer.replay_retained(retained_batch, key))
+		return retained_layer;
+
+	renderer.begin_retained(retained_batch, key);
+
+	if (as_child)
+	{
+		if (bg_color.w > 0.0f)
+		{
+			if (bg_image)
+			{
+				auto *view = renderer.get_device().get_resource_manager().get_image_view_blocking(bg_image);
+				renderer.add_retained_dependency(bg_image);
+				renderer.render_textured_quad(*view,
+				                              vec3(offset, layer - 0.5f), size,
+				                              vec2(0.0f), vec2(view->get_view_width(), view->get_view_height()),
+				                              DrawPipeline::AlphaBlend, bg_color, Vulkan::StockSampler::LinearClamp);
+			}
+			else
+			{
+				renderer.render_quad(vec3(offset, layer - 0.5f), size, bg_color);
+			}
+		}
+
+		renderer.push_scissor(offset, size);
+		retained_layer = render(renderer, layer - 1.0f, offset, size);
+		renderer.pop_scissor();
+	}
+	else
+		retained_layer = render(renderer, layer, offset, size);
+
+	renderer.end_retained();
+
+	// Dirty descendants were recorded again as part of this.
+	needs_redraw = false;
+	return retained_layer;
+}
+
 Widget *Widget::on_mouse_button_pressed(vec2 offset)
 {
 	for (auto &child : children)
@@ -99,6 +129,7 @@ Util::IntrusivePtr<Widget> Widget::remove_child(const Widget &widget)
 	auto res = itr->widget;
 	children.erase(itr);
 	res->parent = nullptr;
+	geometry_changed();
 	return res;
 }
 
@@ -120,12 +151,32 @@ void Widget::geometry_changed()
 {
 	needs_redraw = true;
 	needs_reconfigure = true;
+	needs_canvas_reconfigure = true;
 	if (parent)
 		parent->geometry_changed();
 }
 
+void Widget::redraw_changed()
+{
+	needs_redraw = true;
+	if (parent)
+		parent->redraw_changed();
+}
+
+void Widget::invalidate()
+{
+	needs_redraw = true;
+	needs_reconfigure = true;
+	needs_canvas_reconfigure = true;
+	for (auto &child : children)
+		child.widget->invalidate();
+}
+
 void Widget::reconfigure_geometry()
 {
+	if (!needs_reconfigure)
+		return;
+
 	for (auto &child : children)
 		child.widget->reconfigure_geometry();
 	reconfigure();
@@ -134,6 +185,14 @@ void Widget::reconfigure_geometry()
 
 void Widget::reconfigure_geometry_to_canvas(vec2 offset, vec2 size)
 {
+	// Geometry changes dirty all ancestors, so a clean subtree placed at the same spot lays out the same.
+	if (!needs_canvas_reconfigure && all(equal(offset, canvas_offset)) && all(equal(size, canvas_size)))
+		return;
+
+	canvas_offset = offset;
+	canvas_size = size;
+	needs_canvas_reconfigure = false;
+
 	reconfigure_to_canvas(offset, size);
 	for (auto &child : children)
 		child.widget->reconfigure_geometry_to_canvas(child.offset + offset, child.size);
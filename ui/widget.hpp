@@ -25,11 +25,11 @@
 #include "math.hpp"
 #include <vector>
 #include "resource_manager.hpp"
+#include "flat_renderer.hpp"
 
 namespace Granite
 {
 class MouseButtonEvent;
-class FlatRenderer;
 
 namespace UI
 {
@@ -126,19 +126,28 @@ public:
 	void set_background_color(vec4 color)
 	{
 		bg_color = color;
-		needs_redraw = true;
+		redraw_changed();
 	}
 
 	void set_background_image(AssetID texture)
 	{
 		bg_image = texture;
-		needs_redraw = true;
+		redraw_changed();
 	}
 
 	bool get_needs_redraw() const;
+
+	// Only subtrees which changed geometry since the last call are laid out again.
 	void reconfigure_geometry();
 	void reconfigure_geometry_to_canvas(vec2 offset, vec2 size);
 
+	// Forces layout and redraw of the whole subtree, e.g. after fonts changed.
+	void invalidate();
+
+	// Renders through a batch retained from an earlier frame, which is replayed as long as the widget is not dirty.
+	// Children get their background and scissor from the parent, top-level widgets handle those themselves.
+	float render_retained(FlatRenderer &renderer, float layer, vec2 offset, vec2 size, bool as_child);
+
 	virtual float render(FlatRenderer & /* renderer */, float layer, vec2 /* offset */, vec2 /* size */)
 	{
 		return layer;
@@ -178,6 +187,8 @@ public:
 
 protected:
 	void geometry_changed();
+	// For changes which only affect rendering.
+	void redraw_changed();
 
 	vec2 floating_position = vec2(0.0f);
 	vec4 bg_color = vec4(1.0f, 1.0f, 1.0f, 0.0f);
@@ -205,7 +216,13 @@ protected:
 		Util::IntrusivePtr<Widget> widget;
 	};
 	std::vector<Child> children;
-	bool needs_reconfigure = false;
+	bool needs_reconfigure = true;
+	bool needs_canvas_reconfigure = true;
+	vec2 canvas_offset = vec2(0.0f);
+	vec2 canvas_size = vec2(0.0f);
+
+	FlatRenderBatch retained_batch;
+	float retained_layer = 0.0f;
 
 	virtual void reconfigure() = 0;
 	virtual void reconfigure_to_canvas(vec2 offset, vec2 size) = 0;
@@ -46,6 +46,7 @@ void Window::set_title(const std::string &title_)
 void Window::set_title_color(const vec4 &color)
 {
 	title_color = color;
+	redraw_changed();
 }
 
 Widget *Window::on_mouse_button_pressed(vec2 offset)
@@ -109,6 +110,7 @@ float Window::render(FlatRenderer &renderer, float layer, vec2 offset, vec2 size
 		if (bg_image)
 		{
 			auto *view = renderer.get_device().get_resource_manager().get_image_view_blocking(bg_image);
+			renderer.add_retained_dependency(bg_image);
 			renderer.render_textured_quad(*view,
 			                              vec3(offset, layer), size,
 			                              vec2(0.0f), vec2(view->get_view_width(), view->get_view_height()),
@@ -23,6 +23,7 @@
 #include "arena_allocator.hpp"
 #include "bitops.hpp"
 #include <assert.h>
+#include <algorithm>
 
 namespace Util
 {
@@ -69,6 +70,141 @@ void LegionAllocator::update_longest_run()
 	}
 }
 
+void ArenaFragmentationStats::accumulate(const ArenaFragmentationStats &other)
+{
+	num_heaps += other.num_heaps;
+	num_full_heaps += other.num_full_heaps;
+	num_draining_heaps += other.num_draining_heaps;
+	num_free_spans += other.num_free_spans;
+	used_size += other.used_size;
+	free_size += other.free_size;
+	largest_free_spans += other.largest_free_spans;
+}
+
+float ArenaFragmentationStats::get_fragmentation() const
+{
+	if (!free_size)
+		return 0.0f;
+	return 1.0f - float(largest_free_spans) / float(free_size);
+}
+
+float ArenaFragmentationStats::get_occupancy() const
+{
+	uint64_t total_size = used_size + free_size;
+	if (!total_size)
+		return 0.0f;
+	return float(used_size) / float(total_size);
+}
+
+static inline uint32_t run_mask(uint32_t num_blocks)
+{
+	return num_blocks >= LegionAllocator::NumSubBlocks ? ~0u : ((1u << num_blocks) - 1u);
+}
+
+static inline uint32_t count_free_spans(uint32_t free_mask)
+{
+	return popcount32(free_mask & ~(free_mask << 1));
+}
+
+static bool find_free_run(uint32_t free_mask, uint32_t num_blocks, uint32_t &offset)
+{
+	// Same trick as LegionAllocator. Bit N survives if N .. N + num_blocks - 1 are all free.
+	uint32_t runs = free_mask;
+	for (uint32_t i = 1; i < num_blocks && runs; i++)
+		runs &= free_mask >> i;
+
+	if (!runs)
+		return false;
+
+	offset = trailing_zeroes(runs);
+	return true;
+}
+
+void plan_arena_defragmentation(const uint32_t *free_masks, uint32_t count,
+                                const ArenaDefragmentationOptions &options,
+                                std::vector<uint32_t> &drain_indices)
+{
+	enum class HeapState : uint8_t { Untouched, Drained, Target };
+
+	std::vector<uint32_t> order(count);
+	for (uint32_t i = 0; i < count; i++)
+		order[i] = i;
+
+	// Sparsest heaps first. The densest heaps are the best targets, since that is where the allocator places first.
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return popcount32(free_masks[a]) > popcount32(free_masks[b]);
+	});
+
+	// Drain heaps with the most scattered free space first. Their holes are what fragments the arena,
+	// while a heap with contiguous free space can absorb relocated runs without splitting it further.
+	// Among equally scattered heaps, the sparsest is the cheapest to drain.
+	std::vector<uint32_t> candidates = order;
+	std::stable_sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+		return count_free_spans(free_masks[a]) > count_free_spans(free_masks[b]);
+	});
+
+	std::vector<uint32_t> remaining(free_masks, free_masks + count);
+	std::vector<uint32_t> scratch;
+	std::vector<HeapState> state(count, HeapState::Untouched);
+	std::vector<uint32_t> touched;
+	uint32_t num_drained = 0;
+
+	for (uint32_t candidate : candidates)
+	{
+		if (num_drained >= options.max_draining_heaps)
+			break;
+
+		// A heap which is planned to receive allocations cannot also be drained.
+		if (state[candidate] != HeapState::Untouched)
+			continue;
+
+		uint32_t used_mask = ~free_masks[candidate];
+		uint32_t num_used = popcount32(used_mask);
+		if (num_used == 0 || num_used > options.max_used_sub_blocks)
+			continue;
+
+		scratch = remaining;
+		touched.clear();
+		bool fits = true;
+
+		// The heap only tracks which blocks are in use, not where one allocation ends and the next begins.
+		// Moving whole runs is conservative, since it is never easier to place a run than its parts.
+		while (used_mask && fits)
+		{
+			uint32_t offset = trailing_zeroes(used_mask);
+			uint32_t num_blocks = trailing_zeroes(~(used_mask >> offset));
+			used_mask &= ~(run_mask(num_blocks) << offset);
+
+			fits = false;
+			for (auto itr = order.rbegin(); itr != order.rend(); ++itr)
+			{
+				uint32_t target = *itr;
+				uint32_t target_offset;
+				if (target == candidate || state[target] == HeapState::Drained)
+					continue;
+
+				if (find_free_run(scratch[target], num_blocks, target_offset))
+				{
+					scratch[target] &= ~(run_mask(num_blocks) << target_offset);
+					touched.push_back(target);
+					fits = true;
+					break;
+				}
+			}
+		}
+
+		if (!fits)
+			continue;
+
+		remaining.swap(scratch);
+		state[candidate] = HeapState::Drained;
+		for (auto target : touched)
+			state[target] = HeapState::Target;
+		drain_indices.push_back(candidate);
+		num_drained++;
+	}
+}
+
 bool SliceSubAllocator::allocate_backing_heap(AllocatedSlice *allocation)
 {
 	uint32_t count = sub_block_size * Util::LegionAllocator::NumSubBlocks;
@@ -28,6 +28,7 @@
 #include "logging.hpp"
 #include "object_pool.hpp"
 #include "bitops.hpp"
+#include <vector>
 
 namespace Util
 {
@@ -73,6 +74,11 @@ public:
 		return longest_run;
 	}
 
+	inline uint32_t get_free_mask() const
+	{
+		return free_blocks[0];
+	}
+
 	void allocate(uint32_t num_blocks, uint32_t &mask, uint32_t &offset);
 	void free(uint32_t mask);
 
@@ -88,6 +94,9 @@ struct LegionHeap : Util::IntrusiveListEnabled<LegionHeap<BackingAllocation>>
 {
 	BackingAllocation allocation;
 	Util::LegionAllocator heap;
+	// A draining heap accepts no new allocations. Its owners are expected to relocate what is left,
+	// and the heap is released once the last allocation is freed.
+	bool draining = false;
 };
 
 template <typename BackingAllocation>
@@ -95,9 +104,47 @@ struct AllocationArena
 {
 	Util::IntrusiveList<LegionHeap<BackingAllocation>> heaps[Util::LegionAllocator::NumSubBlocks];
 	Util::IntrusiveList<LegionHeap<BackingAllocation>> full_heaps;
+	Util::IntrusiveList<LegionHeap<BackingAllocation>> draining_heaps;
 	uint32_t heap_availability_mask = 0;
 };
 
+// Sizes are in the same units as ArenaAllocator::allocate().
+struct ArenaFragmentationStats
+{
+	uint32_t num_heaps = 0;
+	uint32_t num_full_heaps = 0;
+	uint32_t num_draining_heaps = 0;
+	uint32_t num_free_spans = 0;
+	uint64_t used_size = 0;
+	uint64_t free_size = 0;
+	// Sum of the largest free span in every heap.
+	// Allocations cannot straddle heaps, so this is the free space usable by large allocations.
+	uint64_t largest_free_spans = 0;
+
+	void accumulate(const ArenaFragmentationStats &other);
+
+	// 0 if each heap has all its free space in one span, approaching 1 as free space is scattered.
+	float get_fragmentation() const;
+	float get_occupancy() const;
+};
+
+struct ArenaDefragmentationOptions
+{
+	// Heaps with more sub-blocks in use than this are never drained.
+	uint32_t max_used_sub_blocks = LegionAllocator::NumSubBlocks / 4;
+	// Bounds the number of heaps draining at any one time, and thus the relocation work in flight.
+	uint32_t max_draining_heaps = 1;
+};
+
+// Decides which heaps to drain, given the free masks of all heaps which can accept allocations.
+// A heap is only picked if its allocated spans fit in the free space of heaps which are not drained,
+// so relocating them never requires a new backing allocation.
+// Heaps with the most scattered free space are considered first, so draining also compacts what is left.
+// Picked indices are appended to drain_indices in that order.
+void plan_arena_defragmentation(const uint32_t *free_masks, uint32_t count,
+                                const ArenaDefragmentationOptions &options,
+                                std::vector<uint32_t> &drain_indices);
+
 struct SuballocationResult
 {
 	uint32_t offset;
@@ -118,6 +165,9 @@ public:
 		if (heap_arena.full_heaps.begin())
 			error = true;
 
+		if (heap_arena.draining_heaps.begin())
+			error = true;
+
 		for (auto &h : heap_arena.heaps)
 			if (h.begin())
 				error = true;
@@ -217,6 +267,19 @@ public:
 	{
 		auto *heap = itr.get();
 		auto &block = heap->heap;
+
+		if (heap->draining)
+		{
+			block.free(mask);
+			if (block.empty())
+			{
+				static_cast<DerivedAllocator *>(this)->free_backing_heap(&heap->allocation);
+				heap_arena.draining_heaps.erase(heap);
+				object_pool->free(heap);
+			}
+			return;
+		}
+
 		bool was_full = block.full();
 
 		unsigned index = block.get_longest_run() - 1;
@@ -257,6 +320,100 @@ public:
 		object_pool = object_pool_;
 	}
 
+	ArenaFragmentationStats get_fragmentation_stats() const
+	{
+		ArenaFragmentationStats stats;
+
+		const auto accumulate_heaps = [&](const IntrusiveList<MiniHeap> &list) {
+			for (auto itr = list.begin(); itr != list.end(); ++itr)
+			{
+				uint32_t free_mask = itr->heap.get_free_mask();
+				uint32_t num_free = popcount32(free_mask);
+				stats.num_heaps++;
+				stats.used_size += uint64_t(LegionAllocator::NumSubBlocks - num_free) << sub_block_size_log2;
+				stats.free_size += uint64_t(num_free) << sub_block_size_log2;
+				stats.largest_free_spans += uint64_t(itr->heap.get_longest_run()) << sub_block_size_log2;
+				// Count the first bit of every run of free blocks.
+				stats.num_free_spans += popcount32(free_mask & ~(free_mask << 1));
+			}
+		};
+
+		for (auto &list : heap_arena.heaps)
+			accumulate_heaps(list);
+
+		uint32_t num_heaps = stats.num_heaps;
+		accumulate_heaps(heap_arena.full_heaps);
+		stats.num_full_heaps = stats.num_heaps - num_heaps;
+
+		num_heaps = stats.num_heaps;
+		accumulate_heaps(heap_arena.draining_heaps);
+		stats.num_draining_heaps = stats.num_heaps - num_heaps;
+
+		return stats;
+	}
+
+	// Marks sparse heaps as draining. Returns the number of heaps which started draining.
+	// Allocations in draining heaps can be found with is_heap_draining() and should be relocated by their owner.
+	uint32_t plan_defragmentation(const ArenaDefragmentationOptions &options)
+	{
+		uint32_t num_draining = 0;
+		for (auto itr = heap_arena.draining_heaps.begin(); itr != heap_arena.draining_heaps.end(); ++itr)
+			num_draining++;
+		if (num_draining >= options.max_draining_heaps)
+			return 0;
+
+		// Full heaps can neither be drained, nor receive relocated allocations.
+		std::vector<MiniHeap *> candidates;
+		std::vector<uint32_t> free_masks;
+		for (auto &list : heap_arena.heaps)
+		{
+			for (auto itr = list.begin(); itr != list.end(); ++itr)
+			{
+				candidates.push_back(itr.get());
+				free_masks.push_back(itr->heap.get_free_mask());
+			}
+		}
+
+		auto plan_options = options;
+		plan_options.max_draining_heaps -= num_draining;
+		std::vector<uint32_t> drain_indices;
+		plan_arena_defragmentation(free_masks.data(), uint32_t(free_masks.size()), plan_options, drain_indices);
+
+		for (auto index : drain_indices)
+		{
+			auto *heap = candidates[index];
+			unsigned list_index = heap->heap.get_longest_run() - 1;
+			heap_arena.heaps[list_index].erase(heap);
+			if (!heap_arena.heaps[list_index].begin())
+				heap_arena.heap_availability_mask &= ~(1u << list_index);
+			heap_arena.draining_heaps.insert_front(heap);
+			heap->draining = true;
+		}
+
+		return uint32_t(drain_indices.size());
+	}
+
+	// Makes draining heaps available for allocation again.
+	void cancel_defragmentation()
+	{
+		auto itr = heap_arena.draining_heaps.begin();
+		while (itr)
+		{
+			auto *heap = itr.get();
+			itr = heap_arena.draining_heaps.erase(itr);
+			heap->draining = false;
+
+			unsigned list_index = heap->heap.get_longest_run() - 1;
+			heap_arena.heaps[list_index].insert_front(heap);
+			heap_arena.heap_availability_mask |= 1u << list_index;
+		}
+	}
+
+	static inline bool is_heap_draining(typename IntrusiveList<MiniHeap>::Iterator itr)
+	{
+		return itr && itr->draining;
+	}
+
 protected:
 	AllocationArena<BackingAllocation> heap_arena;
 	ObjectPool<LegionHeap<BackingAllocation>> *object_pool = nullptr;
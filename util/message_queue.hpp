@@ -54,6 +54,8 @@ public:
 		ring.resize(count);
 		read_count.store(0);
 		write_count.store(0);
+		read_offset = 0;
+		write_offset = 0;
 	}
 
 	size_t read_avail() const noexcept
@@ -71,8 +73,8 @@ public:
 
 	bool write_and_move(T *values, size_t count) noexcept
 	{
-		size_t current_written = read_count.load(std::memory_order_relaxed);
-		size_t current_read = write_count.load(std::memory_order_acquire);
+		size_t current_written = write_count.load(std::memory_order_relaxed);
+		size_t current_read = read_count.load(std::memory_order_acquire);
 		if (count > ring.size() - (current_written - current_read))
 			return false;
 
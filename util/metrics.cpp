@@ -0,0 +1,386 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "metrics.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <string.h>
+#include <stdio.h>
+
+namespace Util
+{
+namespace Metrics
+{
+static std::atomic<unsigned> shard_allocator;
+
+unsigned get_shard_index()
+{
+	// Threads are spread round-robin over the shards on first use.
+	// With more threads than shards some will share, which is still correct, just slower.
+	static thread_local unsigned index = shard_allocator.fetch_add(1, std::memory_order_relaxed) % NumShards;
+	return index;
+}
+}
+
+uint64_t MetricCounter::read() const
+{
+	uint64_t total = 0;
+	for (auto &shard : shards)
+		total += shard.value.load(std::memory_order_relaxed);
+	return total;
+}
+
+void MetricHistogram::read(Snapshot &snapshot) const
+{
+	memset(&snapshot, 0, sizeof(snapshot));
+	for (auto &shard : shards)
+	{
+		for (unsigned i = 0; i < NumBuckets; i++)
+			snapshot.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+		snapshot.sum_ns += shard.sum_ns.load(std::memory_order_relaxed);
+	}
+
+	for (auto &bucket : snapshot.buckets)
+		snapshot.count += bucket;
+}
+
+uint64_t MetricHistogram::Snapshot::quantile_ns(double q) const
+{
+	if (!count)
+		return 0;
+
+	auto target = uint64_t(q * double(count) + 0.5);
+	if (target < 1)
+		target = 1;
+
+	uint64_t accum = 0;
+	for (unsigned i = 0; i < NumBuckets; i++)
+	{
+		accum += buckets[i];
+		if (accum >= target)
+			return i ? (uint64_t(1) << i) : 0;
+	}
+
+	return uint64_t(1) << (NumBuckets - 1);
+}
+
+ScopedMetricTimer::ScopedMetricTimer(MetricHistogram *histogram_)
+	: histogram(histogram_)
+{
+	start_ns = histogram ? get_current_time_nsecs() : 0;
+}
+
+ScopedMetricTimer::~ScopedMetricTimer()
+{
+	if (histogram)
+		histogram->record(uint64_t(get_current_time_nsecs() - start_ns));
+}
+
+MetricsRegistry &MetricsRegistry::get()
+{
+	// Intentionally leaked so metrics can be touched from static destructors and detached threads.
+	static MetricsRegistry *registry = new MetricsRegistry;
+	return *registry;
+}
+
+MetricsRegistry::Entry *MetricsRegistry::lookup(const std::string &name, Type type)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	auto itr = entry_map.find(name);
+	if (itr != entry_map.end())
+	{
+		if (itr->second->type != type)
+		{
+			LOGE("Metric %s was registered with a different type.\n", name.c_str());
+			return nullptr;
+		}
+		return itr->second;
+	}
+
+	auto entry = std::make_unique<Entry>();
+	entry->name = name;
+	entry->type = type;
+	switch (type)
+	{
+	case Type::Counter:
+		entry->counter = new MetricCounter;
+		break;
+	case Type::Gauge:
+		entry->gauge = new MetricGauge;
+		break;
+	case Type::Histogram:
+		entry->histogram = new MetricHistogram;
+		break;
+	}
+
+	auto *ret = entry.get();
+	entry_map[name] = ret;
+	entries.push_back(std::move(entry));
+	return ret;
+}
+
+MetricCounter *MetricsRegistry::counter(const std::string &name)
+{
+	auto *entry = lookup(name, Type::Counter);
+	return entry ? entry->counter : nullptr;
+}
+
+MetricGauge *MetricsRegistry::gauge(const std::string &name)
+{
+	auto *entry = lookup(name, Type::Gauge);
+	return entry ? entry->gauge : nullptr;
+}
+
+MetricHistogram *MetricsRegistry::histogram(const std::string &name)
+{
+	auto *entry = lookup(name, Type::Histogram);
+	return entry ? entry->histogram : nullptr;
+}
+
+void MetricsRegistry::set_history_enabled(bool enable)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	history_enabled = enable;
+}
+
+void MetricsRegistry::reset_history()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	frames.clear();
+	for (auto &entry : entries)
+		entry->total_histogram = {};
+}
+
+unsigned MetricsRegistry::get_frame_count() const
+{
+	std::lock_guard<std::mutex> holder{lock};
+	return unsigned(frames.size());
+}
+
+void MetricsRegistry::end_frame()
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	std::vector<FrameSample> *samples = nullptr;
+	if (history_enabled)
+	{
+		frames.emplace_back();
+		samples = &frames.back();
+		samples->resize(entries.size());
+	}
+
+	for (size_t i = 0, n = entries.size(); i < n; i++)
+	{
+		auto &entry = *entries[i];
+		FrameSample sample = {};
+
+		switch (entry.type)
+		{
+		case Type::Counter:
+		{
+			uint64_t value = entry.counter->read();
+			sample.value = double(value - entry.last_counter);
+			entry.last_counter = value;
+			break;
+		}
+
+		case Type::Gauge:
+			sample.value = double(entry.gauge->read());
+			break;
+
+		case Type::Histogram:
+		{
+			MetricHistogram::Snapshot snapshot, delta;
+			entry.histogram->read(snapshot);
+			for (unsigned j = 0; j < MetricHistogram::NumBuckets; j++)
+			{
+				delta.buckets[j] = snapshot.buckets[j] - entry.last_histogram.buckets[j];
+				if (history_enabled)
+					entry.total_histogram.buckets[j] += delta.buckets[j];
+			}
+			delta.sum_ns = snapshot.sum_ns - entry.last_histogram.sum_ns;
+			delta.count = snapshot.count - entry.last_histogram.count;
+			entry.last_histogram = snapshot;
+
+			if (history_enabled)
+			{
+				entry.total_histogram.sum_ns += delta.sum_ns;
+				entry.total_histogram.count += delta.count;
+			}
+
+			sample.count = delta.count;
+			sample.value = delta.count ? 1e-3 * double(delta.sum_ns) / double(delta.count) : 0.0;
+			sample.p50_ns = delta.quantile_ns(0.5);
+			sample.p99_ns = delta.quantile_ns(0.99);
+			break;
+		}
+		}
+
+		if (samples)
+			(*samples)[i] = sample;
+	}
+}
+
+bool MetricsRegistry::write_csv(const std::string &path) const
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	FILE *file = fopen(path.c_str(), "w");
+	if (!file)
+	{
+		LOGE("Failed to open metrics file %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	fprintf(file, "frame");
+	for (auto &entry : entries)
+	{
+		if (entry->type == Type::Histogram)
+		{
+			fprintf(file, ",%s.count,%s.mean_us,%s.p50_us,%s.p99_us",
+			        entry->name.c_str(), entry->name.c_str(), entry->name.c_str(), entry->name.c_str());
+		}
+		else
+			fprintf(file, ",%s", entry->name.c_str());
+	}
+	fprintf(file, "\n");
+
+	for (size_t frame = 0; frame < frames.size(); frame++)
+	{
+		auto &samples = frames[frame];
+		fprintf(file, "%u", unsigned(frame));
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			FrameSample sample = {};
+			if (i < samples.size())
+				sample = samples[i];
+
+			if (entries[i]->type == Type::Histogram)
+			{
+				fprintf(file, ",%llu,%.3f,%.3f,%.3f", static_cast<unsigned long long>(sample.count),
+				        sample.value, 1e-3 * double(sample.p50_ns), 1e-3 * double(sample.p99_ns));
+			}
+			else
+				fprintf(file, ",%.0f", sample.value);
+		}
+		fprintf(file, "\n");
+	}
+
+	bool ret = ferror(file) == 0;
+	fclose(file);
+	return ret;
+}
+
+static void write_json_string(FILE *file, const std::string &str)
+{
+	fputc('"', file);
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+			fputc('\\', file);
+		fputc(c, file);
+	}
+	fputc('"', file);
+}
+
+bool MetricsRegistry::write_json(const std::string &path) const
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	FILE *file = fopen(path.c_str(), "w");
+	if (!file)
+	{
+		LOGE("Failed to open metrics file %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	fprintf(file, "{\n\t\"frames\": %u,\n\t\"metrics\": [\n", unsigned(frames.size()));
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		auto &entry = *entries[i];
+		fprintf(file, "\t\t{\n\t\t\t\"name\": ");
+		write_json_string(file, entry.name);
+
+		switch (entry.type)
+		{
+		case Type::Counter:
+		{
+			uint64_t total = 0;
+			for (auto &samples : frames)
+				if (i < samples.size())
+					total += uint64_t(samples[i].value);
+			fprintf(file, ",\n\t\t\t\"type\": \"counter\",\n\t\t\t\"total\": %llu",
+			        static_cast<unsigned long long>(total));
+			break;
+		}
+
+		case Type::Gauge:
+			fprintf(file, ",\n\t\t\t\"type\": \"gauge\",\n\t\t\t\"last\": %lld",
+			        static_cast<long long>(entry.gauge->read()));
+			break;
+
+		case Type::Histogram:
+		{
+			auto &total = entry.total_histogram;
+			fprintf(file, ",\n\t\t\t\"type\": \"histogram\",\n\t\t\t\"count\": %llu,\n"
+			              "\t\t\t\"meanUs\": %.3f,\n\t\t\t\"p50Us\": %.3f,\n\t\t\t\"p99Us\": %.3f",
+			        static_cast<unsigned long long>(total.count),
+			        total.count ? 1e-3 * double(total.sum_ns) / double(total.count) : 0.0,
+			        1e-3 * double(total.quantile_ns(0.5)),
+			        1e-3 * double(total.quantile_ns(0.99)));
+			break;
+		}
+		}
+
+		fprintf(file, ",\n\t\t\t\"perFrame\": [");
+		for (size_t frame = 0; frame < frames.size(); frame++)
+		{
+			FrameSample sample = {};
+			if (i < frames[frame].size())
+				sample = frames[frame][i];
+			if (frame)
+				fputc(',', file);
+
+			if (entry.type == Type::Histogram)
+				fprintf(file, " [%llu, %.3f]", static_cast<unsigned long long>(sample.count), sample.value);
+			else
+				fprintf(file, " %.0f", sample.value);
+		}
+		fprintf(file, " ]\n\t\t}%s\n", i + 1 < entries.size() ? "," : "");
+	}
+
+	fprintf(file, "\t]\n}\n");
+
+	bool ret = ferror(file) == 0;
+	fclose(file);
+	return ret;
+}
+
+bool MetricsRegistry::write(const std::string &path) const
+{
+	if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0)
+		return write_json(path);
+	else
+		return write_csv(path);
+}
+}
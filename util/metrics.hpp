@@ -0,0 +1,195 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "bitops.hpp"
+#include "aligned_alloc.hpp"
+
+namespace Util
+{
+// Lightweight always-on metrics. Hot paths only touch a per-thread shard with relaxed atomics,
+// and the registry aggregates all shards once per frame in end_frame().
+// Lookups by name take a lock, so callers are expected to look up once and cache the pointer.
+namespace Metrics
+{
+enum { NumShards = 16 };
+unsigned get_shard_index();
+}
+
+class MetricCounter : public AlignedAllocation<MetricCounter>
+{
+public:
+	inline void add(uint64_t count = 1)
+	{
+		shards[Metrics::get_shard_index()].value.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	uint64_t read() const;
+
+private:
+	struct alignas(64) Shard
+	{
+		std::atomic<uint64_t> value{0};
+	};
+	Shard shards[Metrics::NumShards];
+};
+
+// Gauges hold a single current value, e.g. bytes resident, so there is nothing to shard.
+class MetricGauge : public AlignedAllocation<MetricGauge>
+{
+public:
+	inline void set(int64_t v)
+	{
+		value.store(v, std::memory_order_relaxed);
+	}
+
+	inline void add(int64_t v)
+	{
+		value.fetch_add(v, std::memory_order_relaxed);
+	}
+
+	inline int64_t read() const
+	{
+		return value.load(std::memory_order_relaxed);
+	}
+
+private:
+	alignas(64) std::atomic<int64_t> value{0};
+};
+
+// Latency histogram with fixed power-of-two buckets in nanoseconds.
+// Bucket N holds samples in [2^(N-1), 2^N), the last bucket also holds everything above.
+class MetricHistogram : public AlignedAllocation<MetricHistogram>
+{
+public:
+	enum { NumBuckets = 36 };
+
+	inline void record(uint64_t ns)
+	{
+		unsigned bucket = 64u - leading_zeroes64(ns);
+		if (bucket >= NumBuckets)
+			bucket = NumBuckets - 1;
+		auto &shard = shards[Metrics::get_shard_index()];
+		shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+		shard.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+	}
+
+	struct Snapshot
+	{
+		uint64_t buckets[NumBuckets];
+		uint64_t sum_ns;
+		uint64_t count;
+
+		// Upper bound of the bucket containing the given quantile.
+		uint64_t quantile_ns(double q) const;
+	};
+	void read(Snapshot &snapshot) const;
+
+private:
+	struct alignas(64) Shard
+	{
+		std::atomic<uint64_t> buckets[NumBuckets] = {};
+		std::atomic<uint64_t> sum_ns{0};
+	};
+	Shard shards[Metrics::NumShards];
+};
+
+class ScopedMetricTimer
+{
+public:
+	explicit ScopedMetricTimer(MetricHistogram *histogram);
+	~ScopedMetricTimer();
+
+	ScopedMetricTimer(const ScopedMetricTimer &) = delete;
+	void operator=(const ScopedMetricTimer &) = delete;
+
+private:
+	MetricHistogram *histogram;
+	int64_t start_ns;
+};
+
+class MetricsRegistry
+{
+public:
+	static MetricsRegistry &get();
+
+	// Returned pointers are valid for the lifetime of the process.
+	MetricCounter *counter(const std::string &name);
+	MetricGauge *gauge(const std::string &name);
+	MetricHistogram *histogram(const std::string &name);
+
+	// Aggregates all shards and stores the deltas since the previous call.
+	// History is only retained when enabled, otherwise this just advances the baseline.
+	void end_frame();
+	void set_history_enabled(bool enable);
+	void reset_history();
+	unsigned get_frame_count() const;
+
+	// One row per frame. Histograms expand to count, mean, p50 and p99 columns.
+	bool write_csv(const std::string &path) const;
+	// Per-frame series plus whole-run totals.
+	bool write_json(const std::string &path) const;
+	// Picks JSON or CSV based on the file extension.
+	bool write(const std::string &path) const;
+
+private:
+	MetricsRegistry() = default;
+
+	enum class Type { Counter, Gauge, Histogram };
+	struct Entry
+	{
+		std::string name;
+		Type type;
+		MetricCounter *counter = nullptr;
+		MetricGauge *gauge = nullptr;
+		MetricHistogram *histogram = nullptr;
+
+		uint64_t last_counter = 0;
+		MetricHistogram::Snapshot last_histogram = {};
+		MetricHistogram::Snapshot total_histogram = {};
+	};
+
+	struct FrameSample
+	{
+		double value;
+		uint64_t count;
+		uint64_t p50_ns, p99_ns;
+	};
+
+	mutable std::mutex lock;
+	std::vector<std::unique_ptr<Entry>> entries;
+	std::unordered_map<std::string, Entry *> entry_map;
+	// frames[frame][entry index]. Metrics registered late are treated as zero in earlier frames.
+	std::vector<std::vector<FrameSample>> frames;
+	bool history_enabled = false;
+
+	Entry *lookup(const std::string &name, Type type);
+};
+}
@@ -70,4 +70,61 @@ std::string strip_whitespace(const std::string &str)
 	else
 		return ret;
 }
+
+uint32_t utf8_next_codepoint(const char *&text)
+{
+	auto *str = reinterpret_cast<const uint8_t *>(text);
+	uint32_t c = str[0];
+
+	if (c < 0x80)
+	{
+		text++;
+		return c;
+	}
+
+	unsigned len;
+	uint32_t min_value;
+	if ((c & 0xe0) == 0xc0)
+	{
+		len = 2;
+		min_value = 0x80;
+		c &= 0x1f;
+	}
+	else if ((c & 0xf0) == 0xe0)
+	{
+		len = 3;
+		min_value = 0x800;
+		c &= 0x0f;
+	}
+	else if ((c & 0xf8) == 0xf0)
+	{
+		len = 4;
+		min_value = 0x10000;
+		c &= 0x07;
+	}
+	else
+	{
+		text++;
+		return 0xfffd;
+	}
+
+	for (unsigned i = 1; i < len; i++)
+	{
+		if ((str[i] & 0xc0) != 0x80)
+		{
+			text++;
+			return 0xfffd;
+		}
+		c = (c << 6) | (str[i] & 0x3f);
+	}
+
+	if (c < min_value || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+	{
+		text++;
+		return 0xfffd;
+	}
+
+	text += len;
+	return c;
+}
 }
\ No newline at end of file
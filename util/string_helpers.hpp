@@ -26,6 +26,7 @@
 #include <sstream>
 #include <vector>
 #include <type_traits>
+#include <stdint.h>
 
 namespace inner
 {
@@ -56,4 +57,8 @@ inline std::string join(Ts &&... ts)
 std::vector<std::string> split(const std::string &str, const char *delim);
 std::vector<std::string> split_no_empty(const std::string &str, const char *delim);
 std::string strip_whitespace(const std::string &str);
+
+// Decodes one UTF-8 code point and advances text past it.
+// Malformed sequences decode to U+FFFD and consume a single byte.
+uint32_t utf8_next_codepoint(const char *&text);
 }
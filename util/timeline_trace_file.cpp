@@ -24,17 +24,62 @@
 #include "timeline_trace_file.hpp"
 #include "thread_name.hpp"
 #include "timer.hpp"
+#include "hash.hpp"
+#include "aligned_alloc.hpp"
+#include <algorithm>
 #include <string.h>
 #include <stdio.h>
 
 namespace Util
 {
+static constexpr char trace_magic[8] = { 'G', 'R', 'T', 'R', 'A', 'C', 'E', '\0' };
+static std::atomic<uint64_t> trace_instance_counter;
+
+static constexpr unsigned MaxFullRingYields = 16;
+
 static thread_local char trace_tid[32];
+static thread_local uint64_t trace_tid_generation;
 static thread_local TimelineTraceFile *trace_file;
 
+// Single producer (the owning thread), single consumer (the drain thread).
+struct TimelineTraceFile::ThreadRing : AlignedAllocation<TimelineTraceFile::ThreadRing>
+{
+	enum { Size = 16 * 1024 };
+	Record records[Size];
+	alignas(64) std::atomic<uint32_t> write_index{0};
+	alignas(64) std::atomic<uint32_t> read_index{0};
+	std::atomic<uint32_t> dropped{0};
+};
+
+struct TimelineTraceFile::ThreadState
+{
+	enum { CacheSize = 256 };
+
+	uint64_t instance_id = 0;
+	ThreadRing *ring = nullptr;
+	uint64_t tid_generation = 0;
+	uint32_t tid_id = 0;
+
+	struct CacheEntry
+	{
+		uint64_t hash;
+		const char *str;
+		uint32_t id;
+	};
+	CacheEntry cache[CacheSize];
+};
+
+static uint64_t hash_trace_string(const char *str)
+{
+	Hasher h;
+	h.string(str);
+	return h.get();
+}
+
 void TimelineTraceFile::set_tid(const char *tid)
 {
 	snprintf(trace_tid, sizeof(trace_tid), "%s", tid);
+	trace_tid_generation++;
 }
 
 void TimelineTraceFile::set_per_thread(TimelineTraceFile *file)
@@ -57,6 +102,125 @@ void TimelineTraceFile::Event::set_tid(const char *tid_)
 	snprintf(tid, sizeof(tid), "%s", tid_);
 }
 
+TimelineTraceFile::ThreadState &TimelineTraceFile::get_thread_state()
+{
+	// A thread rarely traces to more than one file at a time, so keep a couple of states around.
+	static thread_local std::unique_ptr<ThreadState> thread_states[2];
+	static thread_local unsigned replace_index;
+
+	for (auto &state : thread_states)
+		if (state && state->instance_id == instance_id)
+			return *state;
+
+	auto &state = thread_states[replace_index];
+	replace_index = (replace_index + 1) % 2;
+	if (!state)
+		state = std::make_unique<ThreadState>();
+
+	memset(state->cache, 0, sizeof(state->cache));
+	state->instance_id = instance_id;
+	state->tid_generation = 0;
+	state->tid_id = 0;
+
+	std::lock_guard<std::mutex> holder{lock};
+	auto &ring = thread_rings[std::this_thread::get_id()];
+	if (!ring)
+	{
+		rings.emplace_back(new ThreadRing);
+		ring = rings.back().get();
+	}
+	state->ring = ring;
+	return *state;
+}
+
+uint32_t TimelineTraceFile::intern_string_locked(uint64_t hash, const char *str)
+{
+	auto range = string_ids.equal_range(hash);
+	for (auto itr = range.first; itr != range.second; ++itr)
+		if (strings[itr->second - 1] == str)
+			return itr->second;
+
+	strings.emplace_back(str);
+	auto id = uint32_t(strings.size());
+	string_ids.insert({ hash, id });
+	return id;
+}
+
+uint32_t TimelineTraceFile::intern_string(const char *str)
+{
+	auto &state = get_thread_state();
+	uint64_t hash = hash_trace_string(str);
+
+	auto &entry = state.cache[hash & (ThreadState::CacheSize - 1)];
+	if (entry.id != 0 && entry.hash == hash && strcmp(entry.str, str) == 0)
+		return entry.id;
+
+	std::lock_guard<std::mutex> holder{lock};
+	entry.hash = hash;
+	entry.id = intern_string_locked(hash, str);
+	entry.str = strings[entry.id - 1].c_str();
+	return entry.id;
+}
+
+void TimelineTraceFile::request_drain()
+{
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		drain_requested = true;
+	}
+	cond.notify_one();
+}
+
+void TimelineTraceFile::push_record(ThreadState &state, const Record &record)
+{
+	auto &ring = *state.ring;
+	uint32_t write_index = ring.write_index.load(std::memory_order_relaxed);
+	uint32_t read_index = ring.read_index.load(std::memory_order_acquire);
+
+	if (write_index - read_index >= ThreadRing::Size)
+	{
+		// The drain thread was woken at half full and has not caught up, most likely because it is not
+		// getting scheduled. Give it a few chances to run before losing the event.
+		for (unsigned attempt = 0; attempt < MaxFullRingYields && write_index - read_index >= ThreadRing::Size; attempt++)
+		{
+			request_drain();
+			std::this_thread::yield();
+			read_index = ring.read_index.load(std::memory_order_acquire);
+		}
+
+		if (write_index - read_index >= ThreadRing::Size)
+		{
+			ring.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	ring.records[write_index & (ThreadRing::Size - 1)] = record;
+	ring.write_index.store(write_index + 1, std::memory_order_release);
+
+	// Wake the drain thread early on bursts rather than waiting for its next period.
+	if (write_index - read_index == ThreadRing::Size / 2)
+		request_drain();
+}
+
+void TimelineTraceFile::record_event(uint32_t desc_id, uint64_t start_ns, uint64_t end_ns, uint32_t pid)
+{
+	auto &state = get_thread_state();
+	if (state.tid_generation != trace_tid_generation || state.tid_id == 0)
+	{
+		state.tid_id = intern_string(trace_tid);
+		state.tid_generation = trace_tid_generation;
+	}
+
+	Record record = {};
+	record.start_ns = start_ns;
+	record.end_ns = end_ns;
+	record.desc_id = desc_id;
+	record.tid_id = state.tid_id;
+	record.pid = pid;
+	push_record(state, record);
+}
+
 TimelineTraceFile::Event *TimelineTraceFile::begin_event(const char *desc, uint32_t pid)
 {
 	auto *e = event_pool.allocate();
@@ -80,9 +244,14 @@ TimelineTraceFile::Event *TimelineTraceFile::allocate_event()
 
 void TimelineTraceFile::submit_event(Event *e)
 {
-	std::lock_guard<std::mutex> holder{lock};
-	queued_events.push(e);
-	cond.notify_one();
+	Record record = {};
+	record.start_ns = e->start_ns;
+	record.end_ns = e->end_ns;
+	record.desc_id = intern_string(e->desc);
+	record.tid_id = intern_string(e->tid);
+	record.pid = e->pid;
+	push_record(get_thread_state(), record);
+	event_pool.free(e);
 }
 
 void TimelineTraceFile::end_event(Event *e)
@@ -91,76 +260,268 @@ void TimelineTraceFile::end_event(Event *e)
 	submit_event(e);
 }
 
+uint64_t TimelineTraceFile::get_dropped_event_count() const
+{
+	uint64_t count = 0;
+	std::lock_guard<std::mutex> holder{lock};
+	for (auto &ring : rings)
+		count += ring->dropped.load(std::memory_order_relaxed);
+	return count;
+}
+
 TimelineTraceFile::TimelineTraceFile(const std::string &path)
+	: instance_id(++trace_instance_counter)
+{
+	std::string binary_path = path;
+	if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0)
+	{
+		json_path = path;
+		binary_path = path + ".gtrace";
+	}
+
+	thr = std::thread(&TimelineTraceFile::looper, this, binary_path);
+}
+
+void TimelineTraceFile::drain(FILE *file)
 {
-	thr = std::thread(&TimelineTraceFile::looper, this, path);
+	struct PendingRing
+	{
+		ThreadRing *ring;
+		uint32_t write_index;
+	};
+	std::vector<PendingRing> pending;
+	std::vector<std::string> new_strings;
+
+	{
+		// Observe the rings first. Any string a record refers to was interned before the record was pushed,
+		// so it is guaranteed to be in the table by now.
+		std::lock_guard<std::mutex> holder{lock};
+		pending.reserve(rings.size());
+		for (auto &ring : rings)
+			pending.push_back({ ring.get(), ring->write_index.load(std::memory_order_acquire) });
+		new_strings.assign(strings.begin() + ptrdiff_t(written_strings), strings.end());
+	}
+
+	for (auto &str : new_strings)
+	{
+		uint32_t id = uint32_t(++written_strings);
+		ChunkHeader chunk = { ChunkString, uint32_t(sizeof(id) + str.size()) };
+		if (file)
+		{
+			fwrite(&chunk, sizeof(chunk), 1, file);
+			fwrite(&id, sizeof(id), 1, file);
+			fwrite(str.data(), 1, str.size(), file);
+		}
+	}
+
+	for (auto &p : pending)
+	{
+		uint32_t read_index = p.ring->read_index.load(std::memory_order_relaxed);
+		uint32_t count = p.write_index - read_index;
+		if (!count)
+			continue;
+
+		if (file)
+		{
+			ChunkHeader chunk = { ChunkRecords, uint32_t(count * sizeof(Record)) };
+			fwrite(&chunk, sizeof(chunk), 1, file);
+
+			uint32_t offset = read_index & (ThreadRing::Size - 1);
+			uint32_t first = std::min<uint32_t>(count, ThreadRing::Size - offset);
+			fwrite(p.ring->records + offset, sizeof(Record), first, file);
+			fwrite(p.ring->records, sizeof(Record), count - first, file);
+		}
+
+		p.ring->read_index.store(p.write_index, std::memory_order_release);
+	}
 }
 
 void TimelineTraceFile::looper(std::string path)
 {
-	set_current_thread_name("json-trace-io");
+	set_current_thread_name("timeline-trace-io");
 
-	FILE *file = fopen(path.c_str(), "w");
+	FILE *file = fopen(path.c_str(), "wb");
 	if (!file)
 		LOGE("Failed to open file: %s.\n", path.c_str());
 
 	if (file)
-		fputs("[\n", file);
-
-	uint64_t base_ts = get_current_time_nsecs();
+	{
+		FileHeader header = {};
+		memcpy(header.magic, trace_magic, sizeof(trace_magic));
+		header.version = FileVersion;
+		header.record_size = sizeof(Record);
+		header.base_ns = get_current_time_nsecs();
+		fwrite(&header, sizeof(header), 1, file);
+	}
 
 	for (;;)
 	{
-		Event *e;
+		bool done;
 		{
 			std::unique_lock<std::mutex> holder{lock};
-			cond.wait(holder, [this]() {
-				return !queued_events.empty();
-			});
-			e = queued_events.front();
-			queued_events.pop();
+			cond.wait_for(holder, std::chrono::milliseconds(5), [this]() { return shutting_down || drain_requested; });
+			done = shutting_down;
+			drain_requested = false;
 		}
 
-		if (!e)
+		drain(file);
+		if (done)
 			break;
-
-		auto start_us = int64_t(e->start_ns - base_ts) * 1e-3;
-		auto end_us = int64_t(e->end_ns - base_ts) * 1e-3;
-
-		if (file && start_us <= end_us)
-		{
-			fprintf(file, "{ \"name\": \"%s\", \"ph\": \"B\", \"tid\": \"%s\", \"pid\": \"%u\", \"ts\": %f },\n",
-			        e->desc, e->tid, e->pid, start_us);
-			fprintf(file, "{ \"name\": \"%s\", \"ph\": \"E\", \"tid\": \"%s\", \"pid\": \"%u\", \"ts\": %f },\n",
-			        e->desc, e->tid, e->pid, end_us);
-		}
-
-		event_pool.free(e);
 	}
 
-	// Intentionally truncate the JSON so that we can emit "," after the last element.
+	if (auto dropped = get_dropped_event_count())
+		LOGW("Timeline trace dropped %llu events, ring buffers were full.\n", static_cast<unsigned long long>(dropped));
+
 	if (file)
+	{
 		fclose(file);
+		if (!json_path.empty() && !convert_to_json(path, json_path))
+			LOGE("Failed to convert timeline trace to %s.\n", json_path.c_str());
+	}
 }
 
 TimelineTraceFile::~TimelineTraceFile()
 {
-	submit_event(nullptr);
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		shutting_down = true;
+		cond.notify_one();
+	}
+
 	if (thr.joinable())
 		thr.join();
 }
 
-TimelineTraceFile::ScopedEvent::ScopedEvent(TimelineTraceFile *file_, const char *tag, uint32_t pid)
-	: file(file_)
+static void write_json_string(FILE *file, const std::string &str)
+{
+	fputc('"', file);
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+		{
+			fputc('\\', file);
+			fputc(c, file);
+		}
+		else if (uint8_t(c) < 0x20)
+			fprintf(file, "\\u%04x", unsigned(uint8_t(c)));
+		else
+			fputc(c, file);
+	}
+	fputc('"', file);
+}
+
+bool TimelineTraceFile::convert_to_json(const std::string &trace_path, const std::string &json_path)
 {
-	if (file && tag && *tag != '\0')
-		event = file->begin_event(tag, pid);
+	FILE *input = fopen(trace_path.c_str(), "rb");
+	if (!input)
+	{
+		LOGE("Failed to open %s.\n", trace_path.c_str());
+		return false;
+	}
+
+	FileHeader header = {};
+	if (fread(&header, sizeof(header), 1, input) != 1 ||
+	    memcmp(header.magic, trace_magic, sizeof(trace_magic)) != 0 ||
+	    header.version != FileVersion || header.record_size != sizeof(Record))
+	{
+		LOGE("%s is not a timeline trace.\n", trace_path.c_str());
+		fclose(input);
+		return false;
+	}
+
+	std::vector<std::string> string_table(1);
+	std::vector<Record> records;
+	ChunkHeader chunk;
+
+	// A truncated final chunk is expected if the process died while tracing, keep what is complete.
+	while (fread(&chunk, sizeof(chunk), 1, input) == 1)
+	{
+		if (chunk.type == ChunkString && chunk.size >= sizeof(uint32_t))
+		{
+			uint32_t id;
+			std::string str(chunk.size - sizeof(uint32_t), '\0');
+			if (fread(&id, sizeof(id), 1, input) != 1 ||
+			    (!str.empty() && fread(&str[0], 1, str.size(), input) != str.size()))
+				break;
+			if (id >= string_table.size())
+				string_table.resize(id + 1);
+			string_table[id] = std::move(str);
+		}
+		else if (chunk.type == ChunkRecords && chunk.size % sizeof(Record) == 0)
+		{
+			size_t offset = records.size();
+			size_t count = chunk.size / sizeof(Record);
+			records.resize(offset + count);
+			if (fread(records.data() + offset, sizeof(Record), count, input) != count)
+			{
+				records.resize(offset);
+				break;
+			}
+		}
+		else
+		{
+			LOGE("Corrupt chunk in %s.\n", trace_path.c_str());
+			break;
+		}
+	}
+	fclose(input);
+
+	std::stable_sort(records.begin(), records.end(), [](const Record &a, const Record &b) {
+		return a.start_ns < b.start_ns;
+	});
+
+	FILE *output = fopen(json_path.c_str(), "w");
+	if (!output)
+	{
+		LOGE("Failed to open %s.\n", json_path.c_str());
+		return false;
+	}
+
+	const auto lookup = [&](uint32_t id) -> const std::string & {
+		return id < string_table.size() ? string_table[id] : string_table.front();
+	};
+
+	fputs("[\n", output);
+	bool first = true;
+	for (auto &record : records)
+	{
+		if (record.start_ns > record.end_ns)
+			continue;
+
+		if (!first)
+			fputs(",\n", output);
+		first = false;
+
+		fputs("{ \"name\": ", output);
+		write_json_string(output, lookup(record.desc_id));
+		fputs(", \"ph\": \"X\", \"tid\": ", output);
+		write_json_string(output, lookup(record.tid_id));
+		fprintf(output, ", \"pid\": \"%u\", \"ts\": %f, \"dur\": %f }",
+		        record.pid, double(int64_t(record.start_ns - header.base_ns)) * 1e-3,
+		        double(record.end_ns - record.start_ns) * 1e-3);
+	}
+	fputs("\n]\n", output);
+
+	bool success = ferror(output) == 0;
+	fclose(output);
+	return success;
+}
+
+TimelineTraceFile::ScopedEvent::ScopedEvent(TimelineTraceFile *file_, const char *tag, uint32_t pid_)
+{
+	if (file_ && tag && *tag != '\0')
+	{
+		file = file_;
+		pid = pid_;
+		desc_id = file->intern_string(tag);
+		start_ns = get_current_time_nsecs();
+	}
 }
 
 TimelineTraceFile::ScopedEvent::~ScopedEvent()
 {
-	if (event)
-		file->end_event(event);
+	if (file)
+		file->record_event(desc_id, start_ns, get_current_time_nsecs(), pid);
 }
 
 TimelineTraceFile::ScopedEvent &
@@ -168,11 +529,12 @@ TimelineTraceFile::ScopedEvent::operator=(TimelineTraceFile::ScopedEvent &&other
 {
 	if (this != &other)
 	{
-		if (event)
-			file->end_event(event);
-		event = other.event;
+		if (file)
+			file->record_event(desc_id, start_ns, get_current_time_nsecs(), pid);
 		file = other.file;
-		other.event = nullptr;
+		start_ns = other.start_ns;
+		desc_id = other.desc_id;
+		pid = other.pid;
 		other.file = nullptr;
 	}
 	return *this;
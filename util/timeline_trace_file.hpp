@@ -27,14 +27,22 @@
 #include <condition_variable>
 #include <mutex>
 #include <memory>
-#include <queue>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <stdio.h>
 #include "object_pool.hpp"
 
 namespace Util
 {
+// Events are recorded as compact binary records into lock-free per-thread ring buffers.
+// Strings are interned, and a drain thread periodically writes everything to a binary trace file,
+// which convert_to_json() (or the timeline-trace-convert tool) turns into Chrome / Perfetto JSON.
 class TimelineTraceFile
 {
 public:
+	// If path ends with ".json", the binary trace is written to path + ".gtrace" and converted on destruction.
 	explicit TimelineTraceFile(const std::string &path);
 	~TimelineTraceFile();
 
@@ -42,6 +50,8 @@ public:
 	static TimelineTraceFile *get_per_thread();
 	static void set_per_thread(TimelineTraceFile *file);
 
+	// Fully described events, for callers which fill in timestamps after the fact, e.g. GPU timestamps.
+	// These go through a pool, prefer ScopedEvent or record_event() on hot paths.
 	struct Event
 	{
 		char desc[256];
@@ -58,6 +68,15 @@ public:
 	Event *allocate_event();
 	void submit_event(Event *e);
 
+	// Returns a non-zero ID. Lookups are served from a per-thread cache after the first call.
+	uint32_t intern_string(const char *str);
+	void record_event(uint32_t desc_id, uint64_t start_ns, uint64_t end_ns, uint32_t pid = 0);
+
+	// Events which did not fit in a thread's ring buffer before the drain thread caught up.
+	uint64_t get_dropped_event_count() const;
+
+	static bool convert_to_json(const std::string &trace_path, const std::string &json_path);
+
 	struct ScopedEvent
 	{
 		ScopedEvent(TimelineTraceFile *file, const char *tag, uint32_t pid = 0);
@@ -68,17 +87,69 @@ public:
 		ScopedEvent(ScopedEvent &&other) noexcept;
 		ScopedEvent &operator=(ScopedEvent &&other) noexcept;
 		TimelineTraceFile *file = nullptr;
-		Event *event = nullptr;
+		uint64_t start_ns = 0;
+		uint32_t desc_id = 0;
+		uint32_t pid = 0;
+	};
+
+	// On-disk layout. The file starts with a FileHeader followed by chunks.
+	enum { FileVersion = 1 };
+	enum ChunkType : uint32_t { ChunkString = 1, ChunkRecords = 2 };
+
+	struct FileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t record_size;
+		uint64_t base_ns;
+	};
+
+	// ChunkString payload is a uint32_t ID followed by the string without terminator.
+	// ChunkRecords payload is an array of Record.
+	struct ChunkHeader
+	{
+		uint32_t type;
+		uint32_t size;
+	};
+
+	struct Record
+	{
+		uint64_t start_ns;
+		uint64_t end_ns;
+		uint32_t desc_id;
+		uint32_t tid_id;
+		uint32_t pid;
+		uint32_t reserved;
 	};
 
 private:
+	struct ThreadRing;
+	struct ThreadState;
+
+	ThreadState &get_thread_state();
+	uint32_t intern_string_locked(uint64_t hash, const char *str);
+	void push_record(ThreadState &state, const Record &record);
+	void request_drain();
 	void looper(std::string path);
+	void drain(FILE *file);
+
 	std::thread thr;
-	std::mutex lock;
+	mutable std::mutex lock;
 	std::condition_variable cond;
+	bool shutting_down = false;
+	bool drain_requested = false;
+
+	std::vector<std::unique_ptr<ThreadRing>> rings;
+	std::unordered_map<std::thread::id, ThreadRing *> thread_rings;
+	// Hash collisions chain through the multimap. Strings are never moved once interned,
+	// so per-thread caches can compare against them without the lock.
+	std::unordered_multimap<uint64_t, uint32_t> string_ids;
+	std::deque<std::string> strings;
+	size_t written_strings = 0;
 
+	std::string json_path;
+	uint64_t instance_id;
 	ThreadSafeObjectPool<Event> event_pool;
-	std::queue<Event *> queued_events;
 };
 
 #ifndef GRANITE_SHIPPING
@@ -32,6 +32,7 @@
 #include "physics_system.hpp"
 #include "muglm/matrix_helper.hpp"
 #include "gltf.hpp"
+#include "timer.hpp"
 
 using namespace Granite;
 
@@ -264,8 +265,129 @@ struct PhysicsSandboxApplication : Application, EventHandler
 		}
 	}
 
+	// Stress scene for the threaded stepping and batched queries.
+	// A block of stacked cubes, trigger areas in between them and a grid of rays cast down every frame.
+	void init_benchmark()
+	{
+		if (benchmark_active)
+			return;
+		benchmark_active = true;
+		benchmark_stats = {};
+
+		PhysicsSystem::MaterialInfo info;
+		info.mass = 1.0f;
+		info.restitution = 0.1f;
+		info.angular_damping = 0.3f;
+		info.linear_damping = 0.3f;
+
+		constexpr int Width = 20;
+		constexpr int Height = 10;
+		const vec3 origin = vec3(-0.5f * Width * 2.5f, 1.0f, -60.0f);
+
+		for (int y = 0; y < Height; y++)
+		{
+			for (int z = 0; z < Width; z++)
+			{
+				for (int x = 0; x < Width; x++)
+				{
+					auto node = scene.create_node();
+					node->transform.translation = origin + vec3(float(x) * 2.5f, float(y) * 2.1f, float(z) * 2.5f);
+					node->invalidate_cached_transform();
+					scene.get_root_node()->add_child(node);
+					auto *entity = scene.create_renderable(cube, node.get());
+					auto *handle = GRANITE_PHYSICS()->add_cube(node.get(), info);
+					entity->allocate_component<PhysicsComponent>()->handle = handle;
+					PhysicsSystem::set_handle_parent(handle, entity);
+				}
+			}
+		}
+
+		PhysicsSystem::MaterialInfo area_info;
+		area_info.type = PhysicsSystem::InteractionType::Area;
+		area_info.mass = 0.0f;
+
+		for (int z = 0; z < Width; z += 2)
+		{
+			for (int x = 0; x < Width; x += 2)
+			{
+				auto node = scene.create_node();
+				node->transform.translation = origin + vec3(float(x) * 2.5f + 1.25f, 1.0f, float(z) * 2.5f + 1.25f);
+				node->transform.scale = vec3(2.0f);
+				node->invalidate_cached_transform();
+				scene.get_root_node()->add_child(node);
+				auto *entity = scene.create_entity();
+				auto *handle = GRANITE_PHYSICS()->add_cube(node.get(), area_info);
+				entity->allocate_component<PhysicsComponent>()->handle = handle;
+				PhysicsSystem::set_handle_parent(handle, entity);
+				benchmark_areas.push_back(handle);
+			}
+		}
+
+		constexpr int RayGrid = 64;
+		benchmark_rays.resize(RayGrid * RayGrid);
+		benchmark_ray_results.resize(benchmark_rays.size());
+		for (int z = 0; z < RayGrid; z++)
+		{
+			for (int x = 0; x < RayGrid; x++)
+			{
+				auto &ray = benchmark_rays[z * RayGrid + x];
+				ray.from = origin + vec3(float(x) * 0.8f - 1.0f, 40.0f, float(z) * 0.8f - 1.0f);
+				ray.dir = vec3(0.0f, -1.0f, 0.0f);
+				ray.length = 50.0f;
+				ray.mask = PhysicsSystem::INTERACTION_TYPE_DYNAMIC_BIT;
+			}
+		}
+
+		LOGI("Physics benchmark: %d bodies, %u areas, %u rays.\n", Width * Width * Height,
+		     unsigned(benchmark_areas.size()), unsigned(benchmark_rays.size()));
+	}
+
+	void run_benchmark_queries()
+	{
+		auto start = Util::get_current_time_nsecs();
+		GRANITE_PHYSICS()->query_closest_hit_rays(benchmark_rays.data(), benchmark_ray_results.data(),
+		                                          benchmark_rays.size());
+		auto end_rays = Util::get_current_time_nsecs();
+		GRANITE_PHYSICS()->get_overlapping_objects(benchmark_areas.data(), benchmark_areas.size(),
+		                                           benchmark_overlaps, benchmark_overlap_offsets,
+		                                           PhysicsSystem::OverlapMethod::Manifold);
+		auto end_overlaps = Util::get_current_time_nsecs();
+
+		benchmark_stats.ray_nsecs += end_rays - start;
+		benchmark_stats.overlap_nsecs += end_overlaps - end_rays;
+	}
+
+	void log_benchmark_stats()
+	{
+		if (++benchmark_stats.frames < 120)
+			return;
+
+		unsigned hits = 0;
+		for (auto &result : benchmark_ray_results)
+			if (result.handle)
+				hits++;
+
+		double frames = double(benchmark_stats.frames);
+		LOGI("Physics benchmark (%s): step %.3f ms, %u rays %.3f ms (%u hits), overlaps %.3f ms (%u found).\n",
+		     benchmark_single_threaded ? "single-threaded" : "multi-threaded",
+		     1e-6 * double(benchmark_stats.step_nsecs) / frames,
+		     unsigned(benchmark_rays.size()), 1e-6 * double(benchmark_stats.ray_nsecs) / frames, hits,
+		     1e-6 * double(benchmark_stats.overlap_nsecs) / frames, unsigned(benchmark_overlaps.size()));
+		benchmark_stats = {};
+	}
+
 	bool on_key(const KeyboardEvent &e)
 	{
+		if (e.get_key() == Key::B && e.get_key_state() == KeyState::Pressed)
+			init_benchmark();
+
+		if (e.get_key() == Key::N && e.get_key_state() == KeyState::Pressed)
+		{
+			benchmark_single_threaded = !benchmark_single_threaded;
+			GRANITE_PHYSICS()->set_num_threads(benchmark_single_threaded ? 1 : 0);
+			benchmark_stats = {};
+		}
+
 		if (e.get_key() == Key::M)
 			apply_anti_gravity = e.get_key_state() != KeyState::Released;
 
@@ -469,7 +591,15 @@ struct PhysicsSandboxApplication : Application, EventHandler
 			}
 		}
 
+		auto step_start = Util::get_current_time_nsecs();
 		GRANITE_PHYSICS()->iterate(frame_time);
+		benchmark_stats.step_nsecs += Util::get_current_time_nsecs() - step_start;
+
+		if (benchmark_active)
+		{
+			run_benchmark_queries();
+			log_benchmark_stats();
+		}
 
 		scene.update_all_transforms();
 
@@ -517,6 +647,22 @@ struct PhysicsSandboxApplication : Application, EventHandler
 
 	bool apply_anti_gravity = false;
 	PhysicsHandle *animated_cube = nullptr;
+
+	bool benchmark_active = false;
+	bool benchmark_single_threaded = false;
+	std::vector<PhysicsHandle *> benchmark_areas;
+	std::vector<PhysicsSystem::RaycastQuery> benchmark_rays;
+	std::vector<RaycastResult> benchmark_ray_results;
+	std::vector<PhysicsHandle *> benchmark_overlaps;
+	std::vector<uint32_t> benchmark_overlap_offsets;
+
+	struct
+	{
+		int64_t step_nsecs = 0;
+		int64_t ray_nsecs = 0;
+		int64_t overlap_nsecs = 0;
+		unsigned frames = 0;
+	} benchmark_stats;
 };
 
 namespace Granite
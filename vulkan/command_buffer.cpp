@@ -28,6 +28,7 @@
 #include "vulkan_prerotate.hpp"
 #include "indirect_layout.hpp"
 #include "timer.hpp"
+#include "metrics.hpp"
 #include <string.h>
 
 using namespace Util;
@@ -1025,6 +1026,13 @@ static void log_compile_time(const char *tag, Hash hash,
                              CommandBuffer::CompileMode mode)
 {
 	bool stall = time_ns >= 5 * 1000 * 1000 && mode != CommandBuffer::CompileMode::AsyncThread;
+
+	static auto *compile_histogram = Util::MetricsRegistry::get().histogram("device.pipeline_compile");
+	static auto *stall_counter = Util::MetricsRegistry::get().counter("device.pipeline_compile_stalls");
+	compile_histogram->record(uint64_t(time_ns));
+	if (stall)
+		stall_counter->add();
+
 #ifndef VULKAN_DEBUG
 	// If a compile takes more than 5 ms and it's not happening on an async thread,
 	// we consider it a stall.
@@ -23,6 +23,7 @@
 #define NOMINMAX
 #include "descriptor_set.hpp"
 #include "device.hpp"
+#include "metrics.hpp"
 #include <vector>
 
 using namespace Util;
@@ -221,10 +222,13 @@ VkDescriptorSet DescriptorSetAllocator::allocate_bindless_set(VkDescriptorPool p
 	count_info.pDescriptorCounts = &num_desc;
 	info.pNext = &count_info;
 
+	static auto *bindless_counter = Util::MetricsRegistry::get().counter("device.descriptor_sets_bindless");
+
 	VkDescriptorSet desc_set = VK_NULL_HANDLE;
 	if (table.vkAllocateDescriptorSets(device->get_device(), &info, &desc_set) != VK_SUCCESS)
 		return VK_NULL_HANDLE;
 
+	bindless_counter->add();
 	return desc_set;
 }
 
@@ -271,6 +275,11 @@ VkDescriptorSet DescriptorSetAllocator::request_descriptor_set(unsigned thread_i
 {
 	VK_ASSERT(!bindless);
 
+	static auto *request_counter = Util::MetricsRegistry::get().counter("device.descriptor_sets_requested");
+	static auto *pool_counter = Util::MetricsRegistry::get().counter("device.descriptor_pools_created");
+	static auto *allocate_counter = Util::MetricsRegistry::get().counter("device.descriptor_sets_allocated");
+	request_counter->add();
+
 	size_t flattened_index = thread_index * device->per_frame.size() + frame_index;
 
 	auto &state = per_thread_and_frame[flattened_index];
@@ -311,6 +320,9 @@ VkDescriptorSet DescriptorSetAllocator::request_descriptor_set(unsigned thread_i
 			return VK_NULL_HANDLE;
 		}
 
+		if (need_alloc)
+			pool_counter->add();
+
 		VkDescriptorSetLayout layouts[VULKAN_NUM_SETS_PER_POOL];
 		std::fill(std::begin(layouts), std::end(layouts), set_layout_pool);
 
@@ -321,6 +333,8 @@ VkDescriptorSet DescriptorSetAllocator::request_descriptor_set(unsigned thread_i
 
 		if (table.vkAllocateDescriptorSets(device->get_device(), &alloc, pool->sets) != VK_SUCCESS)
 			LOGE("Failed to allocate descriptor sets.\n");
+		else
+			allocate_counter->add(VULKAN_NUM_SETS_PER_POOL);
 		state.pools.push_back(pool);
 	}
 
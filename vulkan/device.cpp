@@ -27,6 +27,7 @@
 #endif
 #include "format.hpp"
 #include "timeline_trace_file.hpp"
+#include "metrics.hpp"
 #include "type_to_string.hpp"
 #include "quirks.hpp"
 #include "timer.hpp"
@@ -1289,6 +1290,9 @@ QueueIndices Device::get_physical_queue_type(CommandBuffer::Type queue_type) con
 
 void Device::submit_nolock(CommandBufferHandle cmd, Fence *fence, unsigned semaphore_count, Semaphore *semaphores)
 {
+	static auto *submit_counter = Util::MetricsRegistry::get().counter("device.command_buffer_submissions");
+	submit_counter->add();
+
 	auto type = cmd->get_command_buffer_type();
 	auto physical_type = get_physical_queue_type(type);
 	auto &submissions = frame().submissions[physical_type];
@@ -2532,6 +2536,9 @@ void Device::next_frame_context()
 {
 	DRAIN_FRAME_LOCK();
 
+	static auto *frame_context_counter = Util::MetricsRegistry::get().counter("device.frame_contexts");
+	frame_context_counter->add();
+
 	if (frame_context_begin_ts)
 	{
 		auto frame_context_end_ts = write_calibrated_timestamp_nolock();
@@ -3703,6 +3710,30 @@ void Device::get_memory_budget(HeapBudget *budget)
 	managers.memory.get_memory_budget(budget);
 }
 
+Util::ArenaFragmentationStats Device::get_memory_fragmentation_stats(MemoryClass clazz)
+{
+	LOCK_MEMORY();
+	return managers.memory.get_fragmentation_stats(clazz);
+}
+
+uint32_t Device::plan_memory_defragmentation(MemoryClass clazz, const Util::ArenaDefragmentationOptions &options)
+{
+	LOCK_MEMORY();
+	return managers.memory.plan_defragmentation(clazz, options);
+}
+
+void Device::cancel_memory_defragmentation()
+{
+	LOCK_MEMORY();
+	managers.memory.cancel_defragmentation();
+}
+
+bool Device::is_allocation_pending_relocation(const DeviceAllocation &alloc)
+{
+	LOCK_MEMORY();
+	return alloc.is_pending_relocation();
+}
+
 ImageHandle Device::create_image(const ImageCreateInfo &create_info, const ImageInitialData *initial)
 {
 	if (initial)
@@ -5401,6 +5432,11 @@ ShaderManager &Device::get_shader_manager()
 #ifdef GRANITE_VULKAN_SYSTEM_HANDLES
 void Device::init_shader_manager_cache()
 {
+#ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
+	if (system_handles.filesystem && system_handles.filesystem->get_backend("cache"))
+		shader_manager.set_spirv_cache_directory("cache://spirv");
+#endif
+
 	if (!shader_manager.load_shader_cache("assets://shader_cache.json"))
 		shader_manager.load_shader_cache("cache://shader_cache.json");
 }
@@ -452,6 +452,15 @@ public:
 
 	void get_memory_budget(HeapBudget *budget);
 
+	// Incremental defragmentation of suballocated memory.
+	// Planning marks sparse heaps as draining so they receive no new allocations.
+	// Owners of resources query is_allocation_pending_relocation() and move them over time,
+	// e.g. ResourceManager::relocate_images(). Drained heaps are released as their last allocation is freed.
+	Util::ArenaFragmentationStats get_memory_fragmentation_stats(MemoryClass clazz);
+	uint32_t plan_memory_defragmentation(MemoryClass clazz, const Util::ArenaDefragmentationOptions &options);
+	void cancel_memory_defragmentation();
+	bool is_allocation_pending_relocation(const DeviceAllocation &alloc);
+
 	const Sampler &get_stock_sampler(StockSampler sampler) const;
 
 #ifdef GRANITE_VULKAN_SYSTEM_HANDLES
@@ -481,6 +490,28 @@ public:
 	// >= 100 done
 	unsigned query_initialization_progress(InitializationStage status) const;
 
+#ifdef GRANITE_VULKAN_FOSSILIZE
+	struct PipelineReplayStatistics
+	{
+		struct Entry
+		{
+			Fossilize::Hash hash;
+			uint64_t compile_time_ns;
+			bool compute;
+		};
+		// Pipelines which were actually compiled during replay.
+		std::vector<Entry> pipelines;
+		// Pipelines which were skipped since an identical pipeline already existed.
+		unsigned num_duplicates = 0;
+		unsigned num_failed = 0;
+		unsigned num_modules = 0;
+	};
+
+	// Statistics are complete once InitializationStage::Pipelines has completed.
+	// Returns false if Fossilize replay was never started.
+	bool get_pipeline_replay_statistics(PipelineReplayStatistics &stats) const;
+#endif
+
 	// For some platforms, the device and queue might be shared, possibly across threads, so need some mechanism to
 	// lock the global device and queue.
 	void set_queue_lock(std::function<void ()> lock_callback,
@@ -25,6 +25,7 @@
 #include "thread_group.hpp"
 #include "fossilize_db.hpp"
 #include "dynamic_array.hpp"
+#include <algorithm>
 
 namespace Vulkan
 {
@@ -48,6 +49,31 @@ Device::ReplayerState::~ReplayerState()
 {
 }
 
+void Device::ReplayerState::record_pipeline(Fossilize::Hash hash, bool compute, uint64_t compile_time_ns, bool success)
+{
+	std::lock_guard<std::mutex> holder{statistics_lock};
+	if (success)
+		statistics.pipelines.push_back({ hash, compile_time_ns, compute });
+	else
+		statistics.num_failed++;
+}
+
+void Device::ReplayerState::record_duplicate_pipeline()
+{
+	std::lock_guard<std::mutex> holder{statistics_lock};
+	statistics.num_duplicates++;
+}
+
+bool Device::get_pipeline_replay_statistics(PipelineReplayStatistics &stats) const
+{
+	if (!replayer_state)
+		return false;
+
+	std::lock_guard<std::mutex> holder{replayer_state->statistics_lock};
+	stats = replayer_state->statistics;
+	return true;
+}
+
 void Device::register_sampler(VkSampler sampler, Fossilize::Hash hash, const VkSamplerCreateInfo &info)
 {
 	if (!recorder_state)
@@ -314,18 +340,38 @@ bool Device::fossilize_replay_graphics_pipeline(Fossilize::Hash hash, VkGraphics
 		}
 	}
 
+	// Identical state might have been compiled already, e.g. by the application racing against us.
+	if (ret->get_pipeline(hash).pipeline != VK_NULL_HANDLE)
+	{
+		replayer_state->record_duplicate_pipeline();
+		replayer_state->progress.pipelines.fetch_add(1, std::memory_order_release);
+		return true;
+	}
+
 	VkPipeline pipeline = VK_NULL_HANDLE;
+	auto start_ns = Util::get_current_time_nsecs();
 	VkResult res = pipeline_binary_cache.create_pipeline(&info, legacy_pipeline_cache, &pipeline);
+	auto compile_time_ns = Util::get_current_time_nsecs() - start_ns;
+
 	if (res != VK_SUCCESS)
 	{
 		LOGE("Failed to create graphics pipeline!\n");
+		replayer_state->record_pipeline(hash, false, compile_time_ns, false);
 		replayer_state->progress.pipelines.fetch_add(1, std::memory_order_release);
 		return false;
 	}
 
+	// Only the thread whose pipeline made it into the program counts as having compiled it.
 	auto actual_pipe = ret->add_pipeline(hash, { pipeline, dynamic_state }).pipeline;
-	if (actual_pipe != pipeline)
+	if (actual_pipe == pipeline)
+	{
+		replayer_state->record_pipeline(hash, false, compile_time_ns, true);
+	}
+	else
+	{
+		replayer_state->record_duplicate_pipeline();
 		table->vkDestroyPipeline(device, pipeline, nullptr);
+	}
 
 	replayer_state->progress.pipelines.fetch_add(1, std::memory_order_release);
 	return actual_pipe != VK_NULL_HANDLE;
@@ -361,18 +407,37 @@ bool Device::fossilize_replay_compute_pipeline(Fossilize::Hash hash, VkComputePi
 #ifdef VULKAN_DEBUG
 	LOGI("Replaying compute pipeline.\n");
 #endif
+	if (ret->get_pipeline(hash).pipeline != VK_NULL_HANDLE)
+	{
+		replayer_state->record_duplicate_pipeline();
+		replayer_state->progress.pipelines.fetch_add(1, std::memory_order_release);
+		return true;
+	}
+
 	VkPipeline pipeline = VK_NULL_HANDLE;
+	auto start_ns = Util::get_current_time_nsecs();
 	VkResult res = pipeline_binary_cache.create_pipeline(&info, legacy_pipeline_cache, &pipeline);
+	auto compile_time_ns = Util::get_current_time_nsecs() - start_ns;
+
 	if (res != VK_SUCCESS)
 	{
 		LOGE("Failed to create compute pipeline!\n");
+		replayer_state->record_pipeline(hash, true, compile_time_ns, false);
 		replayer_state->progress.pipelines.fetch_add(1, std::memory_order_release);
 		return false;
 	}
 
+	// Only the thread whose pipeline made it into the program counts as having compiled it.
 	auto actual_pipe = ret->add_pipeline(hash, { pipeline, 0 }).pipeline;
-	if (actual_pipe != pipeline)
+	if (actual_pipe == pipeline)
+	{
+		replayer_state->record_pipeline(hash, true, compile_time_ns, true);
+	}
+	else
+	{
+		replayer_state->record_duplicate_pipeline();
 		table->vkDestroyPipeline(device, pipeline, nullptr);
+	}
 
 	replayer_state->progress.pipelines.fetch_add(1, std::memory_order_release);
 	return actual_pipe != VK_NULL_HANDLE;
@@ -705,6 +770,7 @@ void Device::init_pipeline_state(const Fossilize::FeatureFilter &filter,
 	replayer_state->feature_filter = const_cast<Fossilize::FeatureFilter *>(&filter);
 
 	auto *group = get_system_handles().thread_group;
+	replayer_state->num_tasks = std::max<unsigned>(NumTasks, group->get_num_threads());
 
 	auto shader_manager_task = group->create_task([this]() {
 		init_shader_manager_cache();
@@ -784,6 +850,10 @@ void Device::init_pipeline_state(const Fossilize::FeatureFilter &filter,
 			                                                   replayer_state->compute_hashes.data());
 
 			replayer_state->progress.num_modules = replayer_state->module_hashes.size();
+			{
+				std::lock_guard<std::mutex> holder{replayer_state->statistics_lock};
+				replayer_state->statistics.num_modules = replayer_state->progress.num_modules;
+			}
 			replayer_state->progress.num_pipelines =
 			    replayer_state->graphics_hashes.size() + replayer_state->compute_hashes.size();
 		}
@@ -802,7 +872,7 @@ void Device::init_pipeline_state(const Fossilize::FeatureFilter &filter,
 	group->add_dependency(*parse_modules_task, *prepare_task);
 	group->add_dependency(*parse_modules_task, *shader_manager_task);
 
-	for (unsigned i = 0; i < NumTasks; i++)
+	for (unsigned i = 0; i < replayer_state->num_tasks; i++)
 	{
 		parse_modules_task->enqueue_task([this, i]() {
 			if (!replayer_state->db)
@@ -812,8 +882,9 @@ void Device::init_pipeline_state(const Fossilize::FeatureFilter &filter,
 			Util::DynamicArray<uint8_t> buffer;
 			auto &db = *replayer_state->db;
 
-			size_t start = (i * replayer_state->module_hashes.size()) / NumTasks;
-			size_t end = ((i + 1) * replayer_state->module_hashes.size()) / NumTasks;
+			unsigned num_tasks = replayer_state->num_tasks;
+			size_t start = (i * replayer_state->module_hashes.size()) / num_tasks;
+			size_t end = ((i + 1) * replayer_state->module_hashes.size()) / num_tasks;
 			size_t size = 0;
 
 			for (; start < end; start++)
@@ -901,11 +972,12 @@ void Device::init_pipeline_state(const Fossilize::FeatureFilter &filter,
 	group->add_dependency(*compile_graphics_task, *parse_graphics_task);
 	group->add_dependency(*compile_compute_task, *parse_modules_task);
 	group->add_dependency(*compile_compute_task, *parse_compute_task);
-	for (unsigned i = 0; i < NumTasks; i++)
+	for (unsigned i = 0; i < replayer_state->num_tasks; i++)
 	{
 		compile_graphics_task->enqueue_task([this, i]() {
-			size_t start = (i * replayer_state->graphics_pipelines.size()) / NumTasks;
-			size_t end = ((i + 1) * replayer_state->graphics_pipelines.size()) / NumTasks;
+			unsigned num_tasks = replayer_state->num_tasks;
+			size_t start = (i * replayer_state->graphics_pipelines.size()) / num_tasks;
+			size_t end = ((i + 1) * replayer_state->graphics_pipelines.size()) / num_tasks;
 			for (; start < end; start++)
 			{
 				auto &pipe = replayer_state->graphics_pipelines[start];
@@ -914,8 +986,9 @@ void Device::init_pipeline_state(const Fossilize::FeatureFilter &filter,
 		});
 
 		compile_compute_task->enqueue_task([this, i]() {
-			size_t start = (i * replayer_state->compute_pipelines.size()) / NumTasks;
-			size_t end = ((i + 1) * replayer_state->compute_pipelines.size()) / NumTasks;
+			unsigned num_tasks = replayer_state->num_tasks;
+			size_t start = (i * replayer_state->compute_pipelines.size()) / num_tasks;
+			size_t end = ((i + 1) * replayer_state->compute_pipelines.size()) / num_tasks;
 			for (; start < end; start++)
 			{
 				auto &pipe = replayer_state->compute_pipelines[start];
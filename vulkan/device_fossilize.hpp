@@ -24,6 +24,7 @@
 
 #include "device.hpp"
 #include "thread_group.hpp"
+#include <mutex>
 
 namespace Vulkan
 {
@@ -52,6 +53,9 @@ struct Device::ReplayerState
 	Fossilize::StateReplayer compute_replayer;
 	Fossilize::FeatureFilter *feature_filter = nullptr;
 	std::unique_ptr<Fossilize::DatabaseInterface> db;
+	// Fan-out for parsing and compilation, at least NumTasks, but scales with the thread group.
+	unsigned num_tasks = NumTasks;
+
 	Granite::TaskGroupHandle complete;
 	Granite::TaskGroupHandle module_ready;
 	Granite::TaskGroupHandle pipeline_ready;
@@ -66,5 +70,10 @@ struct Device::ReplayerState
 		uint32_t num_pipelines = 0;
 		uint32_t num_modules = 0;
 	} progress;
+
+	std::mutex statistics_lock;
+	PipelineReplayStatistics statistics;
+	void record_pipeline(Fossilize::Hash hash, bool compute, uint64_t compile_time_ns, bool success);
+	void record_duplicate_pipeline();
 };
 }
@@ -74,7 +74,8 @@ void ResourceManager::set_asset_class(Granite::AssetID id, Granite::AssetClass a
 			std::unique_lock<std::mutex> holder{lock};
 			views.resize(assets.size());
 
-			if (!views[id.id])
+			// IDs can be recycled with a different class, so refresh the fallback of anything not resident.
+			if (!views[id.id] || !assets[id.id].image)
 				views[id.id] = &get_fallback_image(asset_class)->get_view();
 		}
 	}
@@ -268,6 +269,8 @@ ImageHandle ResourceManager::create_gtx(const MemoryMappedTexture &mapped_file,
 		             0;
 		info.misc = IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT |
 		            IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT;
+		// Allows the image to be copied elsewhere when its memory heap is defragmented.
+		info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
 		if (info.levels == 1 &&
 		    (mapped_file.get_flags() & MEMORY_MAPPED_TEXTURE_GENERATE_MIPMAP_ON_LOAD_BIT) != 0 &&
@@ -641,6 +644,172 @@ void ResourceManager::instantiate_asset_image(Granite::AssetManager &manager_,
 	cond.notify_all();
 }
 
+static constexpr ImageMiscFlags ConcurrentQueueBits =
+		IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT |
+		IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT |
+		IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT |
+		IMAGE_MISC_CONCURRENT_QUEUE_VIDEO_DUPLEX;
+
+// The copy is recorded on the generic queue and assumes the image sits in SHADER_READ_ONLY_OPTIMAL.
+// Images are not tracked beyond their creation, so only relocate the ones where that is known to hold:
+// created directly in the read-only layout, never switched to GENERAL, and accessible from the generic queue
+// without an ownership transfer.
+static bool image_is_relocatable(const Image &image)
+{
+	auto &info = image.get_create_info();
+	if ((info.usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) == 0)
+		return false;
+	if (info.initial_layout != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		return false;
+	if (image.get_layout_type() != Layout::Optimal || image.is_swapchain_image())
+		return false;
+
+	// Without explicit queues, Device::create_image() either shares the image with every queue
+	// or leaves it exclusively owned by the generic queue.
+	ImageMiscFlags queues = info.misc & ConcurrentQueueBits;
+	return queues == 0 || (queues & IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT) != 0;
+}
+
+ImageHandle ResourceManager::relocate_image(const Image &image)
+{
+	if (!image_is_relocatable(image))
+		return {};
+
+	auto info = image.get_create_info();
+	info.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	info.misc &= ~IMAGE_MISC_GENERATE_MIPS_BIT;
+
+	// Without initial data or an initial layout, no queue bits would make the copy exclusive to the generic queue.
+	// Keep it as widely shared as the source may have been.
+	if ((info.misc & ConcurrentQueueBits) == 0)
+	{
+		info.misc |= IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT |
+		             IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT |
+		             IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT;
+	}
+
+	// Allocations never land in draining heaps, so this is guaranteed to move the image.
+	auto new_image = device->create_image(info);
+	if (!new_image)
+		return {};
+
+	// A concurrent source may still be sampled by async compute or transfer work in flight,
+	// and the generic queue is about to move it out of the read-only layout.
+	// Drain those queues into the generic queue first, and fence their later work behind the copy,
+	// since the old image stays reachable from them until the new one is latched.
+	CommandBuffer::Type shared_queues[2];
+	unsigned num_shared_queues = 0;
+	ImageMiscFlags source_queues = image.get_create_info().misc & ConcurrentQueueBits;
+	auto generic_queue = device->get_physical_queue_type(CommandBuffer::Type::Generic);
+
+	if (source_queues == 0 || (source_queues & IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT) != 0)
+		if (device->get_physical_queue_type(CommandBuffer::Type::AsyncCompute) != generic_queue)
+			shared_queues[num_shared_queues++] = CommandBuffer::Type::AsyncCompute;
+	if (source_queues == 0 || (source_queues & IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT) != 0)
+		if (device->get_physical_queue_type(CommandBuffer::Type::AsyncTransfer) != generic_queue)
+			shared_queues[num_shared_queues++] = CommandBuffer::Type::AsyncTransfer;
+
+	for (unsigned i = 0; i < num_shared_queues; i++)
+	{
+		auto drain_cmd = device->request_command_buffer(shared_queues[i]);
+		Semaphore sem;
+		device->submit(drain_cmd, nullptr, 1, &sem);
+		device->add_wait_semaphore(CommandBuffer::Type::Generic, std::move(sem),
+		                           VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, true);
+	}
+
+	auto cmd = device->request_command_buffer();
+
+	cmd->image_barrier(image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	                   VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0,
+	                   VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+	cmd->image_barrier(*new_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                   VK_PIPELINE_STAGE_NONE, 0,
+	                   VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+	VkImageSubresourceLayers subresource = {};
+	subresource.aspectMask = format_to_aspect_mask(info.format);
+	subresource.layerCount = info.layers;
+
+	for (uint32_t level = 0; level < new_image->get_create_info().levels; level++)
+	{
+		subresource.mipLevel = level;
+		VkExtent3D extent = {
+			image.get_width(level),
+			image.get_height(level),
+			image.get_depth(level),
+		};
+		cmd->copy_image(*new_image, image, {}, {}, extent, subresource, subresource);
+	}
+
+	cmd->image_barrier(*new_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	                   VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+	                   VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+	cmd->image_barrier(image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	                   VK_PIPELINE_STAGE_2_COPY_BIT, 0,
+	                   VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0);
+
+	Semaphore release[2];
+	device->submit(cmd, nullptr, num_shared_queues, release);
+	for (unsigned i = 0; i < num_shared_queues; i++)
+	{
+		device->add_wait_semaphore(shared_queues[i], std::move(release[i]),
+		                           VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, true);
+	}
+
+	return new_image;
+}
+
+unsigned ResourceManager::relocate_images(unsigned max_relocations)
+{
+	Util::SmallVector<std::pair<Granite::AssetID, ImageHandle>> candidates;
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		for (size_t i = 0, n = assets.size(); i < n && candidates.size() < max_relocations; i++)
+		{
+			auto &asset = assets[i];
+			if (asset.asset_class == Granite::AssetClass::Mesh || !asset.latchable || !asset.image)
+				continue;
+			// Fallbacks are shared between assets.
+			if (asset.image == get_fallback_image(asset.asset_class))
+				continue;
+			if (!image_is_relocatable(*asset.image))
+				continue;
+			if (device->is_allocation_pending_relocation(asset.image->get_allocation()))
+				candidates.emplace_back(Granite::AssetID(uint32_t(i)), asset.image);
+		}
+	}
+
+	GRANITE_SCOPED_TIMELINE_EVENT_FILE(device->get_system_handles().timeline_trace_file, "relocate-images");
+
+	unsigned num_relocated = 0;
+	for (auto &candidate : candidates)
+	{
+		auto new_image = relocate_image(*candidate.second);
+		if (!new_image)
+			continue;
+
+		auto name = Util::join("AssetID-", candidate.first.id);
+		device->set_name(*new_image, name.c_str());
+
+		std::lock_guard<std::mutex> holder{lock};
+		auto &asset = assets[candidate.first.id];
+
+		// The asset may have been released or replaced while we were copying.
+		// Then the copy is just thrown away.
+		if (asset.latchable && asset.image == candidate.second)
+		{
+			asset.image = std::move(new_image);
+			updates.push_back(candidate.first);
+			num_relocated++;
+		}
+	}
+
+	return num_relocated;
+}
+
 const ImageHandle &ResourceManager::get_fallback_image(Granite::AssetClass asset_class)
 {
 	switch (asset_class)
@@ -662,6 +831,7 @@ void ResourceManager::latch_handles()
 	std::lock_guard<std::mutex> holder{lock};
 
 	views.resize(assets.size());
+	resident_views.resize(assets.size());
 	draws.resize(assets.size());
 
 	for (auto &update : updates)
@@ -711,6 +881,7 @@ void ResourceManager::latch_handles()
 			}
 
 			views[update.id] = view;
+			resident_views[update.id] = uint8_t(bool(asset.image));
 		}
 	}
 	updates.clear();
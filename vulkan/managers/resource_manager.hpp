@@ -100,6 +100,13 @@ public:
 
 	const Vulkan::ImageView *get_image_view_blocking(Granite::AssetID id);
 
+	// get_image_view() always returns a valid view, substituting a fallback while an image is not resident.
+	// Streaming systems which must not sample the fallback can check this instead.
+	inline bool is_image_view_resident(Granite::AssetID id) const
+	{
+		return id.id < resident_views.size() && resident_views[id.id] != 0;
+	}
+
 	struct DrawRange
 	{
 		uint32_t offset;
@@ -138,6 +145,13 @@ public:
 
 	const Buffer *get_cluster_bounds_buffer() const;
 
+	// Moves images out of memory heaps which Device is draining for defragmentation,
+	// see Device::plan_memory_defragmentation(). Copies are submitted on the generic queue,
+	// so call this on the render thread between frames. Moves at most max_relocations images per call,
+	// spreading the cost over frames. Returns the number of images which were moved.
+	// Images which are not known to be in SHADER_READ_ONLY_OPTIMAL and usable on the generic queue are left alone.
+	unsigned relocate_images(unsigned max_relocations);
+
 private:
 	Device *device;
 	Granite::AssetManager *manager = nullptr;
@@ -167,6 +181,7 @@ private:
 
 	std::vector<Asset> assets;
 	std::vector<const ImageView *> views;
+	std::vector<uint8_t> resident_views;
 	std::vector<DrawCall> draws;
 	std::vector<Granite::AssetID> updates;
 
@@ -175,6 +190,7 @@ private:
 	ImageHandle fallback_zero;
 	ImageHandle fallback_pbr;
 
+	ImageHandle relocate_image(const Image &image);
 	ImageHandle create_gtx(Granite::FileMappingHandle mapping, Granite::AssetID id);
 	ImageHandle create_gtx(const MemoryMappedTexture &mapping, Granite::AssetID id);
 	ImageHandle create_other(const Granite::FileMapping &mapping, Granite::AssetClass asset_class, Granite::AssetID id);
@@ -29,8 +29,11 @@
 #include "device.hpp"
 #include "rapidjson_wrapper.hpp"
 #include "timeline_trace_file.hpp"
+#include "metrics.hpp"
+#include "thread_group.hpp"
 #include <algorithm>
 #include <cstring>
+#include <cstdio>
 
 using namespace Util;
 
@@ -43,13 +46,16 @@ ShaderTemplate::ShaderTemplate(Device *device_,
                                ShaderStage force_stage_,
                                MetaCache &cache_,
                                Util::Hash path_hash_,
-                               const std::vector<std::string> &include_directories_)
+                               const std::vector<std::string> &include_directories_,
+                               const std::string &spirv_cache_directory_)
 	: device(device_), path(shader_path), force_stage(force_stage_), cache(cache_), path_hash(path_hash_)
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
 	, include_directories(include_directories_)
+	, spirv_cache_directory(spirv_cache_directory_)
 #endif
 {
 	(void)include_directories_;
+	(void)spirv_cache_directory_;
 }
 
 ShaderTemplate::~ShaderTemplate()
@@ -98,6 +104,7 @@ bool ShaderTemplate::init()
 		return false;
 	}
 	source_hash = compiler->get_source_hash();
+	compile_options_hash = compiler->get_compile_options_hash();
 #endif
 
 	return true;
@@ -184,20 +191,37 @@ const ShaderTemplateVariant *ShaderTemplate::register_variant(
 				LOGI("Compiling shader: %s%s\n", path.c_str(), hash_debug_str.c_str());
 #endif
 
-				std::string error_message;
+				std::string cache_path;
+				if (!spirv_cache_directory.empty())
+					cache_path = get_spirv_cache_path(hash);
 
-				{
-					GRANITE_SCOPED_TIMELINE_EVENT_FILE(device->get_system_handles().timeline_trace_file,
-					                                   "glsl-compile");
-					variant->spirv = compiler->compile(error_message, defines);
-				}
+				static auto *cache_hit_counter = Util::MetricsRegistry::get().counter("shader_manager.spirv_cache_hits");
+				static auto *compile_histogram = Util::MetricsRegistry::get().histogram("shader_manager.glsl_compile");
 
-				if (variant->spirv.empty())
+				if (cache_path.empty() || !load_cached_spirv(cache_path, variant->spirv))
 				{
-					LOGE("Shader error:\n%s\n", error_message.c_str());
-					variants.free(variant);
-					return nullptr;
+					std::string error_message;
+
+					{
+						GRANITE_SCOPED_TIMELINE_EVENT_FILE(device->get_system_handles().timeline_trace_file,
+						                                   "glsl-compile");
+						Util::ScopedMetricTimer timer{compile_histogram};
+						variant->spirv = compiler->compile(error_message, defines);
+					}
+
+					if (variant->spirv.empty())
+					{
+						LOGE("Shader error:\n%s\n", error_message.c_str());
+						variants.free(variant);
+						return nullptr;
+					}
+
+					if (!cache_path.empty())
+						store_cached_spirv(cache_path, variant->spirv);
 				}
+				else
+					cache_hit_counter->add();
+
 				update_variant_cache(*variant);
 			}
 			else
@@ -252,6 +276,61 @@ void ShaderTemplate::recompile_variant(ShaderTemplateVariant &variant)
 }
 #endif
 
+std::string ShaderTemplate::get_spirv_cache_path(Util::Hash defines_hash) const
+{
+	// Bump if the on-disk layout or anything implicit in the key changes.
+	constexpr uint32_t SpirvCacheVersion = 1;
+
+	Hasher h;
+	h.u32(SpirvCacheVersion);
+	h.u64(source_hash);
+	h.u64(compile_options_hash);
+	h.u64(defines_hash);
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(h.get()));
+	return Granite::Path::join(spirv_cache_directory, name);
+}
+
+bool ShaderTemplate::load_cached_spirv(const std::string &cache_path, std::vector<uint32_t> &spirv) const
+{
+	auto *fs = device->get_system_handles().filesystem;
+	if (!fs)
+		return false;
+
+	Granite::FileStat s;
+	if (!fs->stat(cache_path, s) || s.type != Granite::PathType::File)
+		return false;
+
+	auto file = fs->open_readonly_mapping(cache_path);
+	const uint32_t *ptr;
+	if (!file || !(ptr = file->data<uint32_t>()))
+		return false;
+
+	size_t word_count = file->get_size() / sizeof(uint32_t);
+
+	// Don't trust anything which doesn't look like a SPIR-V module. It will be recompiled and overwritten.
+	if (word_count < 5 || (file->get_size() % sizeof(uint32_t)) != 0 || ptr[0] != 0x07230203u)
+	{
+		LOGW("Ignoring corrupt SPIR-V cache entry %s.\n", cache_path.c_str());
+		return false;
+	}
+
+	spirv = { ptr, ptr + word_count };
+	return true;
+}
+
+void ShaderTemplate::store_cached_spirv(const std::string &cache_path, const std::vector<uint32_t> &spirv) const
+{
+	auto *fs = device->get_system_handles().filesystem;
+	if (!fs)
+		return;
+
+	// Writes are transactional, so concurrent compiles of the same variant cannot observe torn files.
+	if (!fs->write_buffer_to_file(cache_path, spirv.data(), spirv.size() * sizeof(uint32_t)))
+		LOGW("Failed to write SPIR-V cache entry %s.\n", cache_path.c_str());
+}
+
 void ShaderTemplate::update_variant_cache(const ShaderTemplateVariant &variant)
 {
 	if (variant.spirv.empty())
@@ -498,6 +577,33 @@ ShaderProgramVariant *ShaderProgram::register_variant(const std::vector<std::pai
 	return register_variant(nullptr, defines, sampler_bank);
 }
 
+void ShaderProgram::register_variants(const std::vector<std::vector<std::pair<std::string, int>>> &defines,
+                                      const ImmutableSamplerBank *sampler_bank)
+{
+	// Blocking on the batch from a worker can starve the pool, so compile inline there.
+	auto *group = device->get_system_handles().thread_group;
+	if (!group || defines.size() <= 1 || Granite::ThreadGroup::is_worker_thread())
+	{
+		for (auto &def : defines)
+			register_variant(nullptr, def, sampler_bank);
+		return;
+	}
+
+	GRANITE_SCOPED_TIMELINE_EVENT_FILE(device->get_system_handles().timeline_trace_file, "shader-variant-batch");
+
+	// Compilation cost varies wildly between variants, so don't bother with chunking.
+	// The variant caches are thread-safe and duplicate work is resolved by insert_yield.
+	auto task = group->create_task();
+	task->set_desc("shader-variant-batch");
+	for (auto &def : defines)
+	{
+		task->enqueue_task([this, &def, sampler_bank]() {
+			register_variant(nullptr, def, sampler_bank);
+		});
+	}
+	task->wait();
+}
+
 ShaderProgramVariant *ShaderProgram::register_precompiled_variant(Shader *comp,
                                                                   const std::vector<std::pair<std::string, int>> &defines,
                                                                   const ImmutableSamplerBank *sampler_bank)
@@ -591,8 +697,16 @@ ShaderTemplate *ShaderManager::get_template(const std::string &path, ShaderStage
 	auto *ret = shaders.find(hash);
 	if (!ret)
 	{
+		std::string spirv_cache;
+#ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
+		{
+			std::lock_guard<std::mutex> holder{spirv_cache_lock};
+			spirv_cache = spirv_cache_directory;
+		}
+#endif
 		auto *shader = shaders.allocate(device, path, force_stage,
-		                                meta_cache, hasher.get(), include_directories);
+		                                meta_cache, hasher.get(), include_directories,
+		                                spirv_cache);
 		if (!shader->init())
 		{
 			shaders.free(shader);
@@ -661,6 +775,12 @@ ShaderManager::~ShaderManager()
 }
 
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
+void ShaderManager::set_spirv_cache_directory(const std::string &path)
+{
+	std::lock_guard<std::mutex> holder{spirv_cache_lock};
+	spirv_cache_directory = path;
+}
+
 void ShaderManager::register_dependency(ShaderTemplate *shader, const std::string &dependency)
 {
 	DEPENDENCY_LOCK();
@@ -80,7 +80,8 @@ class ShaderTemplate : public Util::IntrusiveHashMapEnabled<ShaderTemplate>
 public:
 	ShaderTemplate(Device *device, const std::string &shader_path,
 	               ShaderStage force_stage, MetaCache &cache,
-	               Util::Hash path_hash, const std::vector<std::string> &include_directories);
+	               Util::Hash path_hash, const std::vector<std::string> &include_directories,
+	               const std::string &spirv_cache_directory);
 	~ShaderTemplate();
 
 	bool init();
@@ -109,8 +110,14 @@ private:
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
 	std::unique_ptr<Granite::GLSLCompiler> compiler;
 	const std::vector<std::string> &include_directories;
+	std::string spirv_cache_directory;
 	void update_variant_cache(const ShaderTemplateVariant &variant);
 	Util::Hash source_hash = 0;
+	Util::Hash compile_options_hash = 0;
+
+	std::string get_spirv_cache_path(Util::Hash defines_hash) const;
+	bool load_cached_spirv(const std::string &cache_path, std::vector<uint32_t> &spirv) const;
+	void store_cached_spirv(const std::string &cache_path, const std::vector<uint32_t> &spirv) const;
 #ifndef GRANITE_SHIPPING
 	// We'll never want to recompile shaders in runtime outside a dev environment.
 	void recompile_variant(ShaderTemplateVariant &variant);
@@ -171,6 +178,11 @@ public:
 	ShaderProgramVariant *register_variant(const std::vector<std::pair<std::string, int>> &defines,
 	                                       const ImmutableSamplerBank *sampler_bank = nullptr);
 
+	// Registers many variants at once. Compilation fans out on the device thread group if there is one.
+	// Blocks until every variant has been compiled. On a thread group worker, variants are compiled inline instead.
+	void register_variants(const std::vector<std::vector<std::pair<std::string, int>>> &defines,
+	                       const ImmutableSamplerBank *sampler_bank = nullptr);
+
 	ShaderProgramVariant *register_precompiled_variant(
 			Shader *vert, Shader *frag,
 			const std::vector<std::pair<std::string, int>> &defines,
@@ -215,6 +227,10 @@ public:
 	ShaderProgram *register_compute(const std::string &compute);
 
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
+	// Compiled SPIR-V is stored here, keyed by preprocessed source, defines and compiler options.
+	// Empty path disables the cache. Templates pick up the directory when they are first registered.
+	void set_spirv_cache_directory(const std::string &path);
+
 	void register_dependency(ShaderTemplate *shader, const std::string &dependency);
 	void register_dependency_nolock(ShaderTemplate *shader, const std::string &dependency);
 #endif
@@ -238,12 +254,14 @@ private:
 	VulkanCache<ShaderTemplate> shaders;
 	VulkanCache<ShaderProgram> programs;
 	std::vector<std::string> include_directories;
+	std::string spirv_cache_directory;
 
 	ShaderTemplate *get_template(const std::string &source, ShaderStage force_stage);
 
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
 	std::unordered_map<std::string, std::unordered_set<ShaderTemplate *>> dependees;
 	std::mutex dependency_lock;
+	std::mutex spirv_cache_lock;
 
 #ifndef GRANITE_SHIPPING
 	// We'll never want to recompile shaders in runtime outside a dev environment.
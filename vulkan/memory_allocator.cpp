@@ -573,6 +573,40 @@ void DeviceAllocator::get_memory_budget(HeapBudget *heap_budgets)
 	get_memory_budget_nolock(heap_budgets);
 }
 
+Util::ArenaFragmentationStats DeviceAllocator::get_fragmentation_stats(MemoryClass clazz) const
+{
+	Util::ArenaFragmentationStats stats;
+	for (auto &allocator : allocators)
+		for (int i = 0; i < Util::ecast(AllocationMode::Count); i++)
+			stats.accumulate(allocator->get_class_allocator(clazz, AllocationMode(i)).get_fragmentation_stats());
+	return stats;
+}
+
+uint32_t DeviceAllocator::plan_defragmentation(MemoryClass clazz, const Util::ArenaDefragmentationOptions &options)
+{
+	uint32_t num_draining = 0;
+	for (auto &allocator : allocators)
+	{
+		for (int i = 0; i < Util::ecast(AllocationMode::Count); i++)
+		{
+			auto mode = AllocationMode(i);
+			// External memory cannot be moved behind the back of whoever imported it.
+			if (mode == AllocationMode::External)
+				continue;
+			num_draining += allocator->get_class_allocator(clazz, mode).plan_defragmentation(options);
+		}
+	}
+	return num_draining;
+}
+
+void DeviceAllocator::cancel_defragmentation()
+{
+	for (auto &allocator : allocators)
+		for (auto clazz = 0; clazz < Util::ecast(MemoryClass::Count); clazz++)
+			for (int i = 0; i < Util::ecast(AllocationMode::Count); i++)
+				allocator->get_class_allocator(MemoryClass(clazz), AllocationMode(i)).cancel_defragmentation();
+}
+
 bool DeviceAllocator::internal_allocate(
 	uint32_t size, uint32_t memory_type, AllocationMode mode,
 	VkDeviceMemory *memory, uint8_t **host_memory,
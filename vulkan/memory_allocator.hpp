@@ -119,6 +119,13 @@ public:
 		return host_base != nullptr;
 	}
 
+	// True if the heap backing this allocation is being drained for defragmentation.
+	// The owner should move the resource to a fresh allocation when convenient.
+	inline bool is_pending_relocation() const
+	{
+		return alloc && heap && heap->draining;
+	}
+
 	static DeviceAllocation make_imported_allocation(VkDeviceMemory memory, VkDeviceSize size, uint32_t memory_type);
 
 	ExternalHandle export_handle(Device &device);
@@ -265,6 +272,12 @@ public:
 
 	void get_memory_budget(HeapBudget *heaps);
 
+	// Per memory class, summed over all memory types and allocation modes.
+	Util::ArenaFragmentationStats get_fragmentation_stats(MemoryClass clazz) const;
+	// Returns the number of heaps which started draining.
+	uint32_t plan_defragmentation(MemoryClass clazz, const Util::ArenaDefragmentationOptions &options);
+	void cancel_defragmentation();
+
 	bool internal_allocate(uint32_t size, uint32_t memory_type, AllocationMode mode,
 	                       VkDeviceMemory *memory, uint8_t **host_memory,
 	                       VkObjectType object_type, uint64_t dedicated_object, ExternalHandle *external);
@@ -21,8 +21,12 @@
  */
 
 #include "memory_mapped_texture.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
 #include <string.h>
 #include <stdlib.h>
+#include <atomic>
+#include <thread>
 
 namespace Vulkan
 {
@@ -45,6 +49,100 @@ static_assert(sizeof(MemoryMappedHeader) == header_size, "Header size is not pro
 
 static const char MAGIC[16] = "GRANITE TEXFMT1";
 
+// v2 files are followed by one table entry per subresource (level-major),
+// then the individually compressed subresources.
+// payload_size in the header is the decoded size.
+static const char MAGIC_SUPERCOMPRESSED[16] = "GRANITE TEXFMT2";
+
+struct SupercompressedSubresource
+{
+	uint64_t offset;
+	uint64_t compressed_size;
+	uint32_t codec;
+	uint32_t reserved;
+};
+static_assert(sizeof(SupercompressedSubresource) == 24, "Subresource entry is not properly packed.");
+static const size_t supercompressed_payload_alignment = 16;
+
+struct MemoryMappedTexture::SupercompressedPayload
+{
+	enum State : uint32_t
+	{
+		Pending,
+		Decoding,
+		Decoded,
+		Failed
+	};
+
+	struct Entry
+	{
+		const uint8_t *src;
+		size_t src_size;
+		uint8_t *dst;
+		size_t dst_size;
+		TextureSupercompression codec;
+	};
+
+	Granite::FileMappingHandle compressed;
+	Granite::FileMappingHandle decoded;
+	std::vector<Entry> entries;
+	std::unique_ptr<std::atomic<uint32_t>[]> states;
+	std::atomic_bool failed;
+	uint32_t block_stride = 0;
+	uint32_t layers = 0;
+
+	bool decode(size_t index)
+	{
+		auto &state = states[index];
+		uint32_t expected = Pending;
+		if (state.compare_exchange_strong(expected, Decoding, std::memory_order_acquire))
+		{
+			auto &entry = entries[index];
+			bool ret = decompress_texture_data(entry.codec, block_stride,
+			                                   entry.src, entry.src_size,
+			                                   entry.dst, entry.dst_size);
+			if (!ret)
+			{
+				LOGE("Failed to decode supercompressed subresource %zu.\n", index);
+				failed.store(true, std::memory_order_relaxed);
+			}
+			state.store(ret ? Decoded : Failed, std::memory_order_release);
+			return ret;
+		}
+
+		// Someone else is decoding this subresource, wait for them.
+		while (expected == Decoding)
+		{
+			std::this_thread::yield();
+			expected = state.load(std::memory_order_acquire);
+		}
+
+		return expected == Decoded;
+	}
+};
+
+static MemoryMappedHeader build_header(const TextureFormatLayout &layout, MemoryMappedTextureFlags flags,
+                                       const char (&magic)[16])
+{
+	MemoryMappedHeader header = {};
+	memcpy(header.magic, magic, sizeof(magic));
+	header.width = layout.get_width();
+	header.height = layout.get_height();
+	header.depth = layout.get_depth();
+	header.flags = flags;
+	header.layers = layout.get_layers();
+	header.levels = layout.get_levels();
+	header.payload_size = layout.get_required_size();
+	header.type = layout.get_image_type();
+	header.format = layout.get_format();
+	return header;
+}
+
+static size_t get_subresource_size(const TextureFormatLayout &layout, uint32_t level)
+{
+	return layout.get_layer_size(level) * layout.get_mip_info(level).depth;
+}
+
 void MemoryMappedTexture::set_generate_mipmaps_on_load(bool enable)
 {
 	mipgen_on_load = enable;
@@ -101,6 +199,8 @@ bool MemoryMappedTexture::copy_to_path(Granite::Filesystem &fs, const std::strin
 {
 	if (layout.get_required_size() == 0 || !mapped)
 		return false;
+	if (!decode_all())
+		return false;
 
 	auto target_file = fs.open(path, Granite::FileMode::WriteOnly);
 	if (!target_file)
@@ -118,18 +218,9 @@ bool MemoryMappedTexture::map_write(Granite::FileMappingHandle new_file)
 {
 	file = std::move(new_file);
 	mapped = file->mutable_data<uint8_t>();
+	supercompressed.reset();
 
-	MemoryMappedHeader header = {};
-	memcpy(header.magic, MAGIC, sizeof(MAGIC));
-	header.width = layout.get_width();
-	header.height = layout.get_height();
-	header.depth = layout.get_depth();
-	header.flags = get_flags();
-	header.layers = layout.get_layers();
-	header.levels = layout.get_levels();
-	header.payload_size = layout.get_required_size();
-	header.type = layout.get_image_type();
-	header.format = layout.get_format();
+	auto header = build_header(layout, get_flags(), MAGIC);
 	memcpy(mapped, &header, sizeof(header));
 
 	layout.set_buffer(mapped + sizeof(header), layout.get_required_size());
@@ -195,6 +286,13 @@ void MemoryMappedTexture::make_local_copy()
 	if (empty())
 		return;
 
+	// The decoded buffer of a supercompressed texture is already a local copy.
+	if (supercompressed)
+	{
+		decode_all();
+		return;
+	}
+
 	auto new_file = Util::make_handle<ScratchFile>(mapped, get_required_size());
 	file = new_file->map();
 	mapped = file->mutable_data<uint8_t>();
@@ -281,12 +379,9 @@ bool MemoryMappedTexture::map_copy(const void *mapped_, size_t size)
 	return map_read(std::move(new_mapped));
 }
 
-bool MemoryMappedTexture::map_read(Granite::FileMappingHandle new_file)
+bool MemoryMappedTexture::parse_header(const void *header_data)
 {
-	file = std::move(new_file);
-	mapped = const_cast<uint8_t *>(file->data<uint8_t>());
-
-	auto *header = reinterpret_cast<const MemoryMappedHeader *>(mapped);
+	auto *header = static_cast<const MemoryMappedHeader *>(header_data);
 	switch (header->type)
 	{
 	case VK_IMAGE_TYPE_1D:
@@ -312,15 +407,242 @@ bool MemoryMappedTexture::map_read(Granite::FileMappingHandle new_file)
 	swizzle.b = static_cast<VkComponentSwizzle>((header->flags >> MEMORY_MAPPED_TEXTURE_SWIZZLE_B_SHIFT) & MEMORY_MAPPED_TEXTURE_SWIZZLE_MASK);
 	swizzle.a = static_cast<VkComponentSwizzle>((header->flags >> MEMORY_MAPPED_TEXTURE_SWIZZLE_A_SHIFT) & MEMORY_MAPPED_TEXTURE_SWIZZLE_MASK);
 
+	return header->payload_size == layout.get_required_size();
+}
+
+bool MemoryMappedTexture::map_read_supercompressed(Granite::FileMappingHandle new_file)
+{
+	if (!parse_header(new_file->data()))
+		return false;
+
+	uint32_t levels = layout.get_levels();
+	uint32_t layers = layout.get_layers();
+	size_t num_subresources = size_t(levels) * layers;
+	size_t file_size = new_file->get_size();
+	size_t table_end = sizeof(MemoryMappedHeader) + num_subresources * sizeof(SupercompressedSubresource);
+	if (file_size < table_end)
+		return false;
+
+	// Validate the whole chunk table before touching the layout's buffer,
+	// so a corrupt file leaves the texture as it was.
+	auto *file_data = new_file->data<uint8_t>();
+	std::vector<SupercompressedSubresource> table(num_subresources);
+	memcpy(table.data(), file_data + sizeof(MemoryMappedHeader), num_subresources * sizeof(SupercompressedSubresource));
+	for (auto &sub : table)
+	{
+		if (sub.offset < table_end || sub.offset > file_size || sub.compressed_size > file_size - sub.offset)
+			return false;
+		if (sub.codec > uint32_t(TextureSupercompression::LZShuffled))
+			return false;
+	}
+
+	auto payload = std::make_shared<SupercompressedPayload>();
+	payload->block_stride = layout.get_block_stride();
+	payload->layers = layers;
+	payload->entries.resize(num_subresources);
+	payload->states.reset(new std::atomic<uint32_t>[num_subresources]);
+	payload->failed = false;
+
+	// The decoded buffer carries a raw header, so it is a complete v1 texture once everything is decoded.
+	auto decoded_file = Util::make_handle<ScratchFile>(nullptr, get_required_size());
+	payload->decoded = decoded_file->map();
+	if (!payload->decoded)
+		return false;
+
+	auto *decoded_mapped = payload->decoded->mutable_data<uint8_t>();
+	auto header = build_header(layout, static_cast<const MemoryMappedHeader *>(new_file->data())->flags, MAGIC);
+	memcpy(decoded_mapped, &header, sizeof(header));
+	layout.set_buffer(decoded_mapped + sizeof(MemoryMappedHeader), layout.get_required_size());
+
+	for (uint32_t level = 0; level < levels; level++)
+	{
+		for (uint32_t layer = 0; layer < layers; layer++)
+		{
+			size_t index = level * layers + layer;
+			auto &sub = table[index];
+			auto &entry = payload->entries[index];
+			entry.src = file_data + sub.offset;
+			entry.src_size = sub.compressed_size;
+			entry.dst = static_cast<uint8_t *>(layout.data(layer, level));
+			entry.dst_size = get_subresource_size(layout, level);
+			entry.codec = TextureSupercompression(sub.codec);
+			payload->states[index].store(SupercompressedPayload::Pending, std::memory_order_relaxed);
+		}
+	}
+
+	payload->compressed = std::move(new_file);
+	file = payload->decoded;
+	mapped = decoded_mapped;
+	supercompressed = std::move(payload);
+	return true;
+}
+
+bool MemoryMappedTexture::map_read_streamed(Granite::FileMappingHandle new_file)
+{
+	supercompressed.reset();
+	if (new_file->get_size() < sizeof(MemoryMappedHeader))
+		return false;
+	if (memcmp(new_file->data(), MAGIC_SUPERCOMPRESSED, sizeof(MAGIC_SUPERCOMPRESSED)) == 0)
+		return map_read_supercompressed(std::move(new_file));
+	else
+		return map_read(std::move(new_file));
+}
+
+bool MemoryMappedTexture::map_read(Granite::FileMappingHandle new_file)
+{
+	supercompressed.reset();
+	if (new_file->get_size() >= sizeof(MemoryMappedHeader) &&
+	    memcmp(new_file->data(), MAGIC_SUPERCOMPRESSED, sizeof(MAGIC_SUPERCOMPRESSED)) == 0)
+	{
+		return map_read_supercompressed(std::move(new_file)) && decode_all();
+	}
+
+	file = std::move(new_file);
+	mapped = const_cast<uint8_t *>(file->data<uint8_t>());
+
+	if (!parse_header(mapped))
+		return false;
 	if ((layout.get_required_size() + sizeof(MemoryMappedHeader)) < file->get_size())
 		return false;
-	if (header->payload_size != layout.get_required_size())
+
+	layout.set_buffer(static_cast<uint8_t *>(mapped) + sizeof(MemoryMappedHeader), layout.get_required_size());
+	return true;
+}
+
+bool MemoryMappedTexture::is_supercompressed() const
+{
+	return bool(supercompressed);
+}
+
+bool MemoryMappedTexture::decode_subresource(uint32_t layer, uint32_t level)
+{
+	if (!supercompressed)
+		return true;
+	if (level >= layout.get_levels() || layer >= layout.get_layers())
+		return false;
+	return supercompressed->decode(level * supercompressed->layers + layer);
+}
+
+bool MemoryMappedTexture::decode_levels(uint32_t first_level, uint32_t num_levels)
+{
+	if (!supercompressed)
+		return true;
+	if (first_level + num_levels > layout.get_levels())
+		return false;
+
+	bool ret = true;
+	for (uint32_t level = first_level; level < first_level + num_levels; level++)
+		for (uint32_t layer = 0; layer < layout.get_layers(); layer++)
+			ret = decode_subresource(layer, level) && ret;
+	return ret;
+}
+
+bool MemoryMappedTexture::decode_all()
+{
+	if (!supercompressed)
+		return true;
+
+	if (!decode_levels(0, layout.get_levels()))
 		return false;
 
-	layout.set_buffer(static_cast<uint8_t *>(mapped) + sizeof(MemoryMappedHeader), header->payload_size);
+	// The compressed mapping is no longer needed.
+	// Any decode task still in flight holds its own reference.
+	supercompressed.reset();
 	return true;
 }
 
+bool MemoryMappedTexture::is_level_decoded(uint32_t level) const
+{
+	if (!supercompressed)
+		return true;
+	if (level >= layout.get_levels())
+		return false;
+
+	for (uint32_t layer = 0; layer < layout.get_layers(); layer++)
+	{
+		auto state = supercompressed->states[level * supercompressed->layers + layer].load(std::memory_order_acquire);
+		if (state != SupercompressedPayload::Decoded)
+			return false;
+	}
+
+	return true;
+}
+
+void MemoryMappedTexture::enqueue_decode(Granite::TaskGroup &group, uint32_t first_level)
+{
+	if (!supercompressed)
+		return;
+
+	for (uint32_t level = layout.get_levels(); level > first_level; level--)
+	{
+		for (uint32_t layer = 0; layer < layout.get_layers(); layer++)
+		{
+			size_t index = (level - 1) * supercompressed->layers + layer;
+			group.enqueue_task([payload = supercompressed, index]() {
+				payload->decode(index);
+			});
+		}
+	}
+}
+
+bool MemoryMappedTexture::decode_failed() const
+{
+	return supercompressed && supercompressed->failed.load(std::memory_order_relaxed);
+}
+
+bool MemoryMappedTexture::write_supercompressed(Granite::Filesystem &fs, const std::string &path,
+                                                TextureSupercompression codec)
+{
+	if (empty() || !mapped)
+		return false;
+	if (!decode_levels(0, layout.get_levels()))
+		return false;
+
+	uint32_t levels = layout.get_levels();
+	uint32_t layers = layout.get_layers();
+	size_t num_subresources = size_t(levels) * layers;
+
+	std::vector<SupercompressedSubresource> table(num_subresources);
+	std::vector<std::vector<uint8_t>> blobs(num_subresources);
+
+	size_t offset = sizeof(MemoryMappedHeader) + num_subresources * sizeof(SupercompressedSubresource);
+	for (uint32_t level = 0; level < levels; level++)
+	{
+		size_t size = get_subresource_size(layout, level);
+		for (uint32_t layer = 0; layer < layers; layer++)
+		{
+			size_t index = level * layers + layer;
+			auto &sub = table[index];
+			auto *data = static_cast<const uint8_t *>(layout.data(layer, level));
+
+			if (codec != TextureSupercompression::None &&
+			    supercompress_texture_data(codec, layout.get_block_stride(), data, size, blobs[index]))
+			{
+				sub.codec = uint32_t(codec);
+			}
+			else
+			{
+				sub.codec = uint32_t(TextureSupercompression::None);
+				blobs[index].assign(data, data + size);
+			}
+
+			offset = (offset + supercompressed_payload_alignment - 1) & ~(supercompressed_payload_alignment - 1);
+			sub.offset = offset;
+			sub.compressed_size = blobs[index].size();
+			offset += blobs[index].size();
+		}
+	}
+
+	std::vector<uint8_t> output(offset);
+	auto header = build_header(layout, get_flags(), MAGIC_SUPERCOMPRESSED);
+	memcpy(output.data(), &header, sizeof(header));
+	memcpy(output.data() + sizeof(header), table.data(), table.size() * sizeof(SupercompressedSubresource));
+	for (size_t i = 0; i < num_subresources; i++)
+		memcpy(output.data() + table[i].offset, blobs[i].data(), blobs[i].size());
+
+	return fs.write_buffer_to_file(path, output.data(), output.size());
+}
+
 bool MemoryMappedTexture::map_read(Granite::Filesystem &fs, const std::string &path)
 {
 	auto loaded_file = fs.open(path, Granite::FileMode::ReadOnly);
@@ -341,6 +663,7 @@ bool MemoryMappedTexture::is_header(const void *mapped_, size_t size)
 {
 	if (size < sizeof(MemoryMappedHeader))
 		return false;
-	return memcmp(mapped_, MAGIC, sizeof(MAGIC)) == 0;
+	return memcmp(mapped_, MAGIC, sizeof(MAGIC)) == 0 ||
+	       memcmp(mapped_, MAGIC_SUPERCOMPRESSED, sizeof(MAGIC_SUPERCOMPRESSED)) == 0;
 }
 }
@@ -23,7 +23,14 @@
 #pragma once
 
 #include "texture_format.hpp"
+#include "texture_supercompression.hpp"
 #include "filesystem.hpp"
+#include <memory>
+
+namespace Granite
+{
+struct TaskGroup;
+}
 
 namespace Vulkan
 {
@@ -53,11 +60,34 @@ public:
 	bool map_write(Granite::FileMappingHandle file);
 	bool map_read(Granite::Filesystem &fs, const std::string &path);
 	bool map_read(Granite::FileMappingHandle file);
+
+	// For supercompressed (v2) files, nothing is decoded up front.
+	// Subresources must be decoded before their data is accessed.
+	// For v1 files, this is equivalent to map_read().
+	bool map_read_streamed(Granite::FileMappingHandle file);
 	bool map_copy(const void *mapped, size_t size);
 	bool map_write_scratch();
 	bool copy_to_path(Granite::Filesystem &fs, const std::string &path);
 	void make_local_copy();
 
+	// Writes a v2 file where every subresource is compressed individually.
+	// Subresources which do not compress are stored raw.
+	bool write_supercompressed(Granite::Filesystem &fs, const std::string &path,
+	                           TextureSupercompression codec = TextureSupercompression::LZShuffled);
+
+	// Streaming decode of supercompressed files. All of these are no-ops for raw textures.
+	// Decoding writes into the texture, but may happen concurrently from multiple threads.
+	bool is_supercompressed() const;
+	bool decode_subresource(uint32_t layer, uint32_t level);
+	bool decode_levels(uint32_t first_level, uint32_t num_levels);
+	bool decode_all();
+	bool is_level_decoded(uint32_t level) const;
+	// Enqueues one decode task per subresource, smallest mips first.
+	// Completion of the task group implies levels [first_level, levels) are decoded,
+	// unless decode_failed() is set.
+	void enqueue_decode(Granite::TaskGroup &group, uint32_t first_level = 0);
+	bool decode_failed() const;
+
 	inline const Vulkan::TextureFormatLayout &get_layout() const
 	{
 		return layout;
@@ -82,6 +112,8 @@ private:
 	Vulkan::TextureFormatLayout layout;
 	Granite::FileMappingHandle file;
 	uint8_t *mapped = nullptr;
+	struct SupercompressedPayload;
+	std::shared_ptr<SupercompressedPayload> supercompressed;
 	bool cube = false;
 	bool mipgen_on_load = false;
 	VkComponentMapping swizzle = {
@@ -90,5 +122,8 @@ private:
 		VK_COMPONENT_SWIZZLE_B,
 		VK_COMPONENT_SWIZZLE_A,
 	};
+
+	bool parse_header(const void *header);
+	bool map_read_supercompressed(Granite::FileMappingHandle file);
 };
 }
@@ -0,0 +1,275 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "texture_supercompression.hpp"
+#include <string.h>
+#include <algorithm>
+
+namespace Vulkan
+{
+// Sequences follow the LZ4 block layout: a token with 4-bit literal and match lengths,
+// 255-extended lengths, literals, then a 16-bit little-endian match offset.
+// The final sequence only has literals.
+static constexpr size_t MinMatch = 4;
+static constexpr size_t MaxOffset = 0xffff;
+static constexpr unsigned HashBits = 16;
+// Matches never extend into the last bytes of the input, so the match finder can always read 4 bytes.
+static constexpr size_t LastLiterals = 5;
+
+static inline uint32_t load_u32(const uint8_t *ptr)
+{
+	uint32_t v;
+	memcpy(&v, ptr, sizeof(v));
+	return v;
+}
+
+static inline uint32_t hash_sequence(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - HashBits);
+}
+
+static void write_length(std::vector<uint8_t> &out, size_t len)
+{
+	while (len >= 255)
+	{
+		out.push_back(255);
+		len -= 255;
+	}
+	out.push_back(uint8_t(len));
+}
+
+static void emit_sequence(std::vector<uint8_t> &out, const uint8_t *literals, size_t num_literals,
+                          size_t offset, size_t match_length)
+{
+	size_t match_code = match_length ? match_length - MinMatch : 0;
+	uint8_t token = uint8_t(std::min<size_t>(num_literals, 15) << 4);
+	token |= uint8_t(std::min<size_t>(match_code, 15));
+	out.push_back(token);
+
+	if (num_literals >= 15)
+		write_length(out, num_literals - 15);
+	out.insert(out.end(), literals, literals + num_literals);
+
+	if (match_length)
+	{
+		out.push_back(uint8_t(offset & 0xff));
+		out.push_back(uint8_t(offset >> 8));
+		if (match_code >= 15)
+			write_length(out, match_code - 15);
+	}
+}
+
+static void lz_compress(const uint8_t *src, size_t size, std::vector<uint8_t> &out)
+{
+	out.clear();
+	out.reserve(size + size / 255 + 16);
+
+	std::vector<uint32_t> table(1u << HashBits, UINT32_MAX);
+	size_t anchor = 0;
+	size_t pos = 0;
+	size_t match_limit = size > LastLiterals ? size - LastLiterals : 0;
+	unsigned misses = 0;
+
+	while (pos + MinMatch <= match_limit)
+	{
+		uint32_t seq = load_u32(src + pos);
+		uint32_t h = hash_sequence(seq);
+		uint32_t candidate = table[h];
+		table[h] = uint32_t(pos);
+
+		if (candidate != UINT32_MAX && pos - candidate <= MaxOffset && load_u32(src + candidate) == seq)
+		{
+			size_t len = MinMatch;
+			while (pos + len < match_limit && src[candidate + len] == src[pos + len])
+				len++;
+
+			emit_sequence(out, src + anchor, pos - anchor, pos - candidate, len);
+			pos += len;
+			anchor = pos;
+			misses = 0;
+		}
+		else
+		{
+			// Skip ahead faster through incompressible data.
+			pos += 1 + (misses++ >> 6);
+		}
+	}
+
+	emit_sequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+static bool read_length(const uint8_t *&src, const uint8_t *src_end, size_t &len)
+{
+	uint8_t v;
+	do
+	{
+		if (src >= src_end)
+			return false;
+		v = *src++;
+		len += v;
+	} while (v == 255);
+	return true;
+}
+
+static bool lz_decompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size)
+{
+	const uint8_t *src_end = src + src_size;
+	uint8_t *dst_begin = dst;
+	uint8_t *dst_end = dst + dst_size;
+
+	while (src < src_end)
+	{
+		uint8_t token = *src++;
+
+		size_t num_literals = token >> 4;
+		if (num_literals == 15 && !read_length(src, src_end, num_literals))
+			return false;
+
+		if (size_t(src_end - src) < num_literals || size_t(dst_end - dst) < num_literals)
+			return false;
+		memcpy(dst, src, num_literals);
+		src += num_literals;
+		dst += num_literals;
+
+		// Final sequence has no match.
+		if (src == src_end)
+			break;
+
+		if (src_end - src < 2)
+			return false;
+		size_t offset = size_t(src[0]) | (size_t(src[1]) << 8);
+		src += 2;
+
+		size_t match_length = token & 15;
+		if (match_length == 15 && !read_length(src, src_end, match_length))
+			return false;
+		match_length += MinMatch;
+
+		if (offset == 0 || offset > size_t(dst - dst_begin) || size_t(dst_end - dst) < match_length)
+			return false;
+
+		// Matches may overlap their own output.
+		const uint8_t *match = dst - offset;
+		if (offset >= match_length)
+		{
+			memcpy(dst, match, match_length);
+			dst += match_length;
+		}
+		else
+		{
+			for (size_t i = 0; i < match_length; i++)
+				*dst++ = *match++;
+		}
+	}
+
+	return dst == dst_end;
+}
+
+static bool can_shuffle(uint32_t block_stride, size_t size)
+{
+	return block_stride > 1 && (size % block_stride) == 0;
+}
+
+static void shuffle_blocks(uint8_t *dst, const uint8_t *src, uint32_t block_stride, size_t size)
+{
+	size_t num_blocks = size / block_stride;
+	for (size_t block = 0; block < num_blocks; block++)
+		for (uint32_t b = 0; b < block_stride; b++)
+			dst[b * num_blocks + block] = src[block * block_stride + b];
+}
+
+static void unshuffle_blocks(uint8_t *dst, const uint8_t *src, uint32_t block_stride, size_t size)
+{
+	size_t num_blocks = size / block_stride;
+	for (size_t block = 0; block < num_blocks; block++)
+		for (uint32_t b = 0; b < block_stride; b++)
+			dst[block * block_stride + b] = src[b * num_blocks + block];
+}
+
+bool supercompress_texture_data(TextureSupercompression codec, uint32_t block_stride,
+                                const void *data, size_t size, std::vector<uint8_t> &compressed)
+{
+	// Offsets in the match finder are 32-bit.
+	if (size == 0 || size > UINT32_MAX)
+		return false;
+
+	auto *src = static_cast<const uint8_t *>(data);
+
+	switch (codec)
+	{
+	case TextureSupercompression::LZ:
+		lz_compress(src, size, compressed);
+		break;
+
+	case TextureSupercompression::LZShuffled:
+		if (can_shuffle(block_stride, size))
+		{
+			std::vector<uint8_t> shuffled(size);
+			shuffle_blocks(shuffled.data(), src, block_stride, size);
+			lz_compress(shuffled.data(), size, compressed);
+		}
+		else
+			lz_compress(src, size, compressed);
+		break;
+
+	default:
+		return false;
+	}
+
+	return compressed.size() < size;
+}
+
+bool decompress_texture_data(TextureSupercompression codec, uint32_t block_stride,
+                             const void *compressed, size_t compressed_size,
+                             void *dst, size_t dst_size)
+{
+	auto *src = static_cast<const uint8_t *>(compressed);
+	auto *out = static_cast<uint8_t *>(dst);
+
+	switch (codec)
+	{
+	case TextureSupercompression::None:
+		if (compressed_size != dst_size)
+			return false;
+		memcpy(out, src, dst_size);
+		return true;
+
+	case TextureSupercompression::LZ:
+		return lz_decompress(src, compressed_size, out, dst_size);
+
+	case TextureSupercompression::LZShuffled:
+		if (can_shuffle(block_stride, dst_size))
+		{
+			std::vector<uint8_t> shuffled(dst_size);
+			if (!lz_decompress(src, compressed_size, shuffled.data(), dst_size))
+				return false;
+			unshuffle_blocks(out, shuffled.data(), block_stride, dst_size);
+			return true;
+		}
+		else
+			return lz_decompress(src, compressed_size, out, dst_size);
+
+	default:
+		return false;
+	}
+}
+}
@@ -0,0 +1,50 @@
+/* Copyright (c) 2017-2024 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vulkan
+{
+// Lossless compression applied on top of GPU formats in GTX v2 files.
+enum class TextureSupercompression : uint32_t
+{
+	None = 0,
+	// LZ77 with an LZ4-style block layout. Very fast to decode.
+	LZ = 1,
+	// Byte planes of each texel block are grouped before LZ.
+	// Endpoints and index bits of BCn/ASTC blocks compress far better when they are not interleaved.
+	LZShuffled = 2
+};
+
+// Returns false if the data did not compress, in which case it should be stored as-is.
+bool supercompress_texture_data(TextureSupercompression codec, uint32_t block_stride,
+                                const void *data, size_t size, std::vector<uint8_t> &compressed);
+
+// dst_size must be the exact decoded size.
+bool decompress_texture_data(TextureSupercompression codec, uint32_t block_stride,
+                             const void *compressed, size_t compressed_size,
+                             void *dst, size_t dst_size);
+}